@@ -0,0 +1,1032 @@
+/*
+ * Copyright 2023 British Broadcasting Corporation - Research and Development
+ *
+ * Author: Sam Hurst <sam.hurst@bbc.co.uk>
+ *
+ * Based on the GStreamer template repository:
+ *  https://gitlab.freedesktop.org/gstreamer/gst-template
+ * Copyright (C) 2005 Thomas Vander Stichele <thomas@apestaart.org>
+ * Copyright (C) 2005 Ronald S. Bultje <rbultje@ronald.bitfreak.net>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/**
+ * SECTION:gstquicfanoutsink
+ * @title: GstQuicFanoutSink
+ * @short description: element used to send the same data to many QUIC peers.
+ *
+ * The quicfanoutsink element listens for QUIC connections and sends every
+ * buffer it receives to all of the connected peers, or subscribers. Like
+ * quicsink, it is designed to be used with a quicmux element upstream. The
+ * streams opened by quicmux are virtual, and each subscriber gets its own
+ * stream on its own connection for each of them.
+ *
+ * Each buffer is mapped once and handed to every subscriber, which keeps a
+ * view sharing the buffer's memory for retransmission rather than a copy.
+ *
+ * A subscriber that connects part way through a stream doesn't receive the
+ * rest of that stream, and joins at the start of the next one. When a
+ * subscriber is congested, the fanout-policy property decides what happens:
+ *
+ *  - block: wait for the subscriber, holding up all of the others.
+ *  - drop: drop the buffer for that subscriber. The subscriber's stream is
+ *    reset, as it can't be delivered with a hole in it, and the rest of it is
+ *    skipped. DATAGRAM frames are simply lost.
+ *  - skip-to-keyframe: as drop, and the subscriber then receives nothing new
+ *    until a buffer without GST_BUFFER_FLAG_DELTA_UNIT set starts a stream or
+ *    arrives as a DATAGRAM frame.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <gst/gst.h>
+
+#include "gstquicfanoutsink.h"
+#include "gstquictransport.h"
+#include "gstquicsignals.h"
+#include "gstquicstream.h"
+#include "gstquicdatagram.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_quicfanoutsink_debug);
+#define GST_CAT_DEFAULT gst_quicfanoutsink_debug
+
+/* Application error code used to reset a stream that data was dropped from */
+#define QUICFANOUTSINK_STREAM_DROPPED 0x1
+
+#define QUICFANOUTSINK_MAX_SUBSCRIBERS_DEFAULT 0
+
+enum
+{
+  PROP_0,
+  PROP_QUIC_ENDPOINT_ENUMS,
+  PROP_FANOUT_POLICY,
+  PROP_MAX_SUBSCRIBERS,
+  PROP_SUBSCRIBERS,
+  PROP_BUFFERS_DROPPED
+};
+
+static guint signals[GST_QUICLIB_SIGNALS_MAX];
+
+static GstStaticPadTemplate sink_factory = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (QUICLIB_RAW)
+    );
+
+/*
+ * A stream opened by upstream. started is set once the first buffer for the
+ * stream has been sent, after which new subscribers don't join it.
+ */
+typedef struct {
+  gint64 upstream_id;
+  gboolean bidi;
+  gboolean started;
+} QuicFanoutStream;
+
+/*
+ * A connected peer. streams maps upstream stream IDs to the stream IDs on
+ * conn, or to -1 if the subscriber is skipping that stream.
+ */
+typedef struct {
+  GstQuicLibTransportConnection *conn;
+  GHashTable *streams;
+  gboolean awaiting_keyframe;
+  guint64 dropped;
+} QuicFanoutSubscriber;
+
+static void gst_quicfanoutsink_common_user_interface_init (gpointer g_iface,
+    gpointer iface_data);
+
+#define gst_quicfanoutsink_parent_class parent_class
+G_DEFINE_TYPE_WITH_CODE (GstQuicFanoutSink, gst_quicfanoutsink,
+    GST_TYPE_BASE_SINK,
+    G_IMPLEMENT_INTERFACE (GST_QUICLIB_COMMON_USER_TYPE,
+        gst_quicfanoutsink_common_user_interface_init));
+
+GST_ELEMENT_REGISTER_DEFINE (quicfanoutsink, "quicfanoutsink", GST_RANK_NONE,
+    GST_TYPE_QUICFANOUTSINK);
+
+static void gst_quicfanoutsink_finalize (GObject * object);
+static void gst_quicfanoutsink_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec);
+static void gst_quicfanoutsink_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec);
+
+static GstStateChangeReturn gst_quicfanoutsink_change_state (
+    GstElement *elem, GstStateChange t);
+
+static gboolean gst_quicfanoutsink_elem_query (GstElement *parent,
+    GstQuery *query);
+static gboolean gst_quicfanoutsink_query (GstBaseSink * parent,
+    GstQuery * query);
+static GstFlowReturn gst_quicfanoutsink_render (GstBaseSink * sink,
+    GstBuffer * buffer);
+
+static gboolean gst_quicfanoutsink_quiclib_listen (GstQuicFanoutSink *sink);
+static gboolean gst_quicfanoutsink_quiclib_stop_listen (
+    GstQuicFanoutSink *sink);
+
+static void
+quicfanoutsink_subscriber_free (QuicFanoutSubscriber *sub)
+{
+  g_object_unref (sub->conn);
+  g_hash_table_destroy (sub->streams);
+  g_free (sub);
+}
+
+static QuicFanoutSubscriber *
+quicfanoutsink_find_subscriber (GstQuicFanoutSink *sink,
+    GstQuicLibTransportContext *ctx)
+{
+  GList *it;
+
+  for (it = sink->subscribers; it != NULL; it = it->next) {
+    QuicFanoutSubscriber *sub = (QuicFanoutSubscriber *) it->data;
+
+    if (GST_QUICLIB_TRANSPORT_CONTEXT (sub->conn) == ctx) {
+      return sub;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * Find the subscriber's stream for an upstream stream, opening one if the
+ * upstream stream hasn't started yet. Returns FALSE if the subscriber is
+ * skipping the stream. Call with the sink mutex held.
+ */
+static gboolean
+quicfanoutsink_subscriber_stream (GstQuicFanoutSink *sink,
+    QuicFanoutSubscriber *sub, QuicFanoutStream *stream, gboolean keyframe,
+    gint64 *stream_id)
+{
+  gint64 *mapped = g_hash_table_lookup (sub->streams, &stream->upstream_id);
+  gint64 *key;
+
+  if (mapped != NULL) {
+    *stream_id = *mapped;
+    return *mapped >= 0;
+  }
+
+  *stream_id = -1;
+
+  if (!stream->started && !(sub->awaiting_keyframe && !keyframe)) {
+    *stream_id = gst_quiclib_transport_open_stream (sub->conn, stream->bidi,
+        NULL);
+
+    if (*stream_id < 0) {
+      GST_WARNING_OBJECT (sink, "Couldn't open a stream for upstream stream "
+          "%ld on subscriber %p: %s", stream->upstream_id, sub->conn,
+          gst_quiclib_error_as_string ((GstQuicLibError) *stream_id));
+      *stream_id = -1;
+    } else {
+      sub->awaiting_keyframe = FALSE;
+    }
+  }
+
+  key = g_new (gint64, 1);
+  *key = stream->upstream_id;
+  mapped = g_new (gint64, 1);
+  *mapped = *stream_id;
+  g_hash_table_insert (sub->streams, key, mapped);
+
+  return *stream_id >= 0;
+}
+
+/*
+ * Apply the fan-out policy to a subscriber that a buffer couldn't be sent to.
+ * Call with the sink mutex held.
+ */
+static void
+quicfanoutsink_subscriber_dropped (GstQuicFanoutSink *sink,
+    QuicFanoutSubscriber *sub, GstQuicLibFanoutTarget *target,
+    QuicFanoutStream *stream)
+{
+  sub->dropped++;
+  sink->buffers_dropped++;
+
+  GST_DEBUG_OBJECT (sink, "Dropped buffer for subscriber %p: %s", sub->conn,
+      gst_quiclib_error_as_string (target->error));
+
+  if (stream != NULL) {
+    gint64 *mapped = g_hash_table_lookup (sub->streams, &stream->upstream_id);
+
+    if (mapped != NULL && *mapped >= 0) {
+      gst_quiclib_transport_close_stream (sub->conn, (guint64) *mapped,
+          QUICFANOUTSINK_STREAM_DROPPED);
+      *mapped = -1;
+    }
+  }
+
+  if (sink->policy == QUICLIB_FANOUT_POLICY_SKIP_TO_KEYFRAME) {
+    sub->awaiting_keyframe = TRUE;
+  }
+}
+
+static gboolean
+gst_quicfanoutsink_quiclib_listen (GstQuicFanoutSink *sink)
+{
+  gst_quicfanoutsink_quiclib_stop_listen (sink);
+
+  g_mutex_lock (&sink->mutex);
+
+  GST_TRACE_OBJECT (sink, "Opening listening port on %s", sink->location);
+
+  sink->server_ctx = gst_quiclib_get_server (GST_QUICLIB_COMMON_USER (sink),
+      sink->location, sink->alpn, sink->privkey_location, sink->cert_location,
+      sink->sni);
+
+  if (sink->server_ctx == NULL) {
+    g_mutex_unlock (&sink->mutex);
+    return FALSE;
+  }
+
+  g_object_set (sink->server_ctx,
+      PROP_MAX_STREAMS_BIDI_REMOTE_SHORTNAME,
+      sink->max_streams_bidi_remote_init,
+      PROP_MAX_STREAMS_UNI_REMOTE_SHORTNAME, sink->max_streams_uni_remote_init,
+      PROP_MAX_STREAM_DATA_BIDI_REMOTE_SHORTNAME,
+      sink->max_stream_data_bidi_remote_init,
+      PROP_MAX_STREAM_DATA_UNI_REMOTE_SHORTNAME,
+      sink->max_stream_data_uni_remote_init,
+      PROP_MAX_DATA_REMOTE_SHORTNAME, sink->max_data_remote_init,
+      PROP_ENABLE_DATAGRAM_SHORTNAME, sink->enable_datagram,
+      PROP_BUSY_POLL_SHORTNAME, sink->busy_poll,
+      PROP_BUSY_POLL_BUDGET_SHORTNAME, sink->busy_poll_budget,
+      PROP_CPU_AFFINITY_SHORTNAME, sink->cpu_affinity,
+      PROP_ASYNC_CPU_AFFINITY_SHORTNAME, sink->async_cpu_affinity,
+      PROP_THREAD_SCHED_POLICY_SHORTNAME, sink->thread_sched_policy,
+      PROP_THREAD_PRIORITY_SHORTNAME, sink->thread_priority,
+      PROP_IO_BACKEND_SHORTNAME, sink->io_backend,
+      PROP_ZEROCOPY_THRESHOLD_SHORTNAME, sink->zerocopy_threshold,
+      PROP_DSCP_SHORTNAME, sink->dscp,
+      PROP_RATE_LIMIT_SHORTNAME, sink->rate_limit,
+      PROP_RATE_BURST_SHORTNAME, sink->rate_burst,
+      PROP_PROBE_DURATION_SHORTNAME, sink->probe_duration,
+      PROP_EGRESS_RATE_LIMIT_SHORTNAME, sink->egress_rate_limit,
+      PROP_ADMISSION_MAX_LOAD_SHORTNAME, sink->admission_max_load,
+      PROP_ADMISSION_MAX_HANDSHAKES_SHORTNAME, sink->admission_max_handshakes,
+      PROP_ADMISSION_MAX_MEMORY_SHORTNAME, sink->admission_max_memory,
+      PROP_ADMISSION_ACTION_SHORTNAME, sink->admission_action,
+      PROP_ADMISSION_SHED_IDLE_SHORTNAME, sink->admission_shed_idle,
+      PROP_CONN_MEMORY_LIMIT_SHORTNAME, sink->conn_memory_limit,
+      PROP_SERVER_MEMORY_LIMIT_SHORTNAME, sink->server_memory_limit,
+      PROP_IDLE_MODE_SHORTNAME, sink->idle_mode,
+      PROP_XDP_INTERFACE_SHORTNAME, sink->xdp_interface,
+      PROP_XDP_QUEUE_SHORTNAME, sink->xdp_queue,
+      PROP_XDP_SKB_MODE_SHORTNAME, sink->xdp_skb_mode,
+      PROP_QUIC_LB_SERVER_ID_SHORTNAME, sink->quic_lb_server_id,
+      PROP_QUIC_LB_KEY_SHORTNAME, sink->quic_lb_key,
+      PROP_PREFERRED_ADDRESS_SHORTNAME, sink->preferred_address, NULL);
+
+  if (gst_quiclib_transport_get_state (
+        GST_QUICLIB_TRANSPORT_CONTEXT (sink->server_ctx)) == QUIC_STATE_NONE) {
+    if (!gst_quiclib_transport_server_listen (sink->server_ctx)) {
+      GST_ERROR_OBJECT (sink, "Couldn't listen on server address %s",
+          sink->location);
+      gst_quiclib_unref (GST_QUICLIB_TRANSPORT_CONTEXT (sink->server_ctx),
+          GST_QUICLIB_COMMON_USER (sink));
+      sink->server_ctx = NULL;
+    }
+  }
+
+  g_mutex_unlock (&sink->mutex);
+
+  return sink->server_ctx != NULL;
+}
+
+static gboolean
+gst_quicfanoutsink_quiclib_stop_listen (GstQuicFanoutSink *sink)
+{
+  g_mutex_lock (&sink->mutex);
+
+  GST_TRACE_OBJECT (sink, "Stop listen called - %sactive server, %u "
+      "subscribers", (sink->server_ctx)?(""):("no "),
+      g_list_length (sink->subscribers));
+
+  g_list_free_full (sink->subscribers,
+      (GDestroyNotify) quicfanoutsink_subscriber_free);
+  sink->subscribers = NULL;
+  g_hash_table_remove_all (sink->streams);
+
+  if (sink->server_ctx != NULL) {
+    gst_quiclib_unref (GST_QUICLIB_TRANSPORT_CONTEXT (sink->server_ctx),
+        GST_QUICLIB_COMMON_USER (sink));
+    sink->server_ctx = NULL;
+    g_mutex_unlock (&sink->mutex);
+    return TRUE;
+  }
+
+  g_mutex_unlock (&sink->mutex);
+  return FALSE;
+}
+
+/* GObject vmethod implementations */
+
+static void
+gst_quicfanoutsink_class_init (GstQuicFanoutSinkClass * klass)
+{
+  GObjectClass *gobject_class;
+  GstElementClass *gstelement_class;
+  GstBaseSinkClass *gstbasesink_class;
+
+  gobject_class = (GObjectClass *) klass;
+  gstelement_class = (GstElementClass *) klass;
+  gstbasesink_class = (GstBaseSinkClass *) klass;
+
+  gobject_class->finalize = gst_quicfanoutsink_finalize;
+  gobject_class->set_property = gst_quicfanoutsink_set_property;
+  gobject_class->get_property = gst_quicfanoutsink_get_property;
+
+  gstelement_class->change_state = gst_quicfanoutsink_change_state;
+  gstelement_class->query = gst_quicfanoutsink_elem_query;
+
+  gstbasesink_class->render = gst_quicfanoutsink_render;
+  gstbasesink_class->query = gst_quicfanoutsink_query;
+
+  /*
+   * See the full list of common endpoint properties for QUIC transport
+   * handling in gstquiccommon.h
+   */
+  gst_quiclib_common_install_endpoint_properties (gobject_class);
+
+  g_object_class_install_property (gobject_class, PROP_FANOUT_POLICY,
+      g_param_spec_enum ("fanout-policy", "Fan-out policy",
+          "What to do with a buffer for a subscriber that is congested",
+          QUICLIB_TYPE_FANOUT_POLICY, QUICLIB_FANOUT_POLICY_DEFAULT,
+          G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_SUBSCRIBERS,
+      g_param_spec_uint ("max-subscribers", "Maximum subscribers",
+          "Maximum number of connected subscribers, 0 for no limit", 0,
+          G_MAXUINT, QUICFANOUTSINK_MAX_SUBSCRIBERS_DEFAULT,
+          G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_SUBSCRIBERS,
+      g_param_spec_uint ("subscribers", "Subscribers",
+          "Number of connected subscribers", 0, G_MAXUINT, 0,
+          G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_BUFFERS_DROPPED,
+      g_param_spec_uint64 ("buffers-dropped", "Buffers dropped",
+          "Number of buffers not sent to a subscriber because of congestion or "
+          "errors, counted once for every subscriber", 0, G_MAXUINT64, 0,
+          G_PARAM_READABLE));
+
+  signals[GST_QUICLIB_HANDSHAKE_COMPLETE_SIGNAL] =
+    gst_quiclib_handshake_complete_signal_new (klass);
+  signals[GST_QUICLIB_CONN_ERROR_SIGNAL] =
+    gst_quiclib_conn_error_signal_new (klass);
+  signals[GST_QUICLIB_CONN_CLOSED_SIGNAL] =
+    gst_quiclib_conn_closed_signal_new (klass);
+
+  gst_element_class_set_static_metadata (gstelement_class,
+        "QUIC fan-out sender", "Sink/Network",
+        "Send the same data to many peers over QUIC transport",
+        "Samuel Hurst <sam.hurst@bbc.co.uk>");
+
+  gst_element_class_add_pad_template (gstelement_class,
+      gst_static_pad_template_get (&sink_factory));
+}
+
+static void
+gst_quicfanoutsink_init (GstQuicFanoutSink * sink)
+{
+  gst_quiclib_common_init_endpoint_properties (sink);
+
+  sink->subscribers = NULL;
+  sink->streams = g_hash_table_new_full (g_int64_hash, g_int64_equal, NULL,
+      g_free);
+  /* Server-initiated bidirectional and unidirectional stream IDs */
+  sink->next_stream_id[QUIC_STREAM_BIDI] = 1;
+  sink->next_stream_id[QUIC_STREAM_UNI] = 3;
+  sink->policy = QUICLIB_FANOUT_POLICY_DEFAULT;
+  sink->max_subscribers = QUICFANOUTSINK_MAX_SUBSCRIBERS_DEFAULT;
+  sink->buffers_dropped = 0;
+
+  g_mutex_init (&sink->mutex);
+}
+
+static void
+gst_quicfanoutsink_finalize (GObject * object)
+{
+  GstQuicFanoutSink *sink = GST_QUICFANOUTSINK (object);
+
+  gst_quiclib_common_free_endpoint_properties (sink);
+  g_hash_table_destroy (sink->streams);
+  g_mutex_clear (&sink->mutex);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_quicfanoutsink_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstQuicFanoutSink *sink = GST_QUICFANOUTSINK (object);
+
+  switch (prop_id) {
+    /*
+     * See the full list of common endpoint properties for QUIC transport
+     * handling in gstquiccommon.h
+     */
+    case PROP_QUIC_ENDPOINT_COMMON_ENUM_CASES:
+    case PROP_QUIC_ENDPOINT_SERVER_ENUM_CASES:
+      if (prop_id == PROP_MODE) {
+        if (g_value_get_enum (value) != QUICLIB_MODE_SERVER) {
+          GST_WARNING_OBJECT (sink,
+              "quicfanoutsink only supports server mode");
+        }
+        break;
+      }
+      g_mutex_lock (&sink->mutex);
+      gst_quiclib_common_set_endpoint_property_checked (sink,
+          sink->server_ctx, pspec, prop_id, value);
+      g_mutex_unlock (&sink->mutex);
+      break;
+    case PROP_QUIC_ENDPOINT_CLIENT_ENUM_CASES:
+      GST_WARNING_OBJECT (sink,
+          "Cannot set client property %s on quicfanoutsink", pspec->name);
+      break;
+    case PROP_FANOUT_POLICY:
+      g_mutex_lock (&sink->mutex);
+      sink->policy = g_value_get_enum (value);
+      g_mutex_unlock (&sink->mutex);
+      break;
+    case PROP_MAX_SUBSCRIBERS:
+      g_mutex_lock (&sink->mutex);
+      sink->max_subscribers = g_value_get_uint (value);
+      g_mutex_unlock (&sink->mutex);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_quicfanoutsink_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstQuicFanoutSink *sink = GST_QUICFANOUTSINK (object);
+
+  switch (prop_id) {
+    /*
+     * See the full list of common endpoint properties for QUIC transport
+     * handling in gstquiccommon.h
+     */
+    case PROP_QUIC_ENDPOINT_COMMON_ENUM_CASES:
+    case PROP_QUIC_ENDPOINT_SERVER_ENUM_CASES:
+      g_mutex_lock (&sink->mutex);
+      gst_quiclib_common_get_endpoint_property_checked (sink,
+          sink->server_ctx, pspec, prop_id, value);
+      g_mutex_unlock (&sink->mutex);
+      break;
+    case PROP_QUIC_ENDPOINT_CLIENT_ENUM_CASES:
+      GST_WARNING_OBJECT (sink,
+          "Cannot get client property %s on quicfanoutsink", pspec->name);
+      break;
+    case PROP_FANOUT_POLICY:
+      g_value_set_enum (value, sink->policy);
+      break;
+    case PROP_MAX_SUBSCRIBERS:
+      g_value_set_uint (value, sink->max_subscribers);
+      break;
+    case PROP_SUBSCRIBERS:
+      g_mutex_lock (&sink->mutex);
+      g_value_set_uint (value, g_list_length (sink->subscribers));
+      g_mutex_unlock (&sink->mutex);
+      break;
+    case PROP_BUFFERS_DROPPED:
+      g_mutex_lock (&sink->mutex);
+      g_value_set_uint64 (value, sink->buffers_dropped);
+      g_mutex_unlock (&sink->mutex);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+/* GstElement vmethod implementations */
+static GstStateChangeReturn
+gst_quicfanoutsink_change_state (GstElement *elem, GstStateChange t)
+{
+  GstQuicFanoutSink *sink = GST_QUICFANOUTSINK (elem);
+
+  GST_TRACE_OBJECT (sink, "Changing state from %s to %s",
+      gst_element_state_get_name ((t & 0xf8) >> 3),
+      gst_element_state_get_name (t & 0x4));
+
+  GstStateChangeReturn rv =
+      GST_ELEMENT_CLASS (parent_class)->change_state (elem, t);
+
+  switch (t) {
+  case GST_STATE_CHANGE_READY_TO_PAUSED:
+    if (gst_quicfanoutsink_quiclib_listen (sink) == FALSE) {
+      return GST_STATE_CHANGE_FAILURE;
+    }
+    return GST_STATE_CHANGE_NO_PREROLL;
+  case GST_STATE_CHANGE_PAUSED_TO_READY:
+    gst_quicfanoutsink_quiclib_stop_listen (sink);
+    break;
+  default:
+    break;
+  }
+
+  return rv;
+}
+
+static gboolean
+gst_quicfanoutsink_elem_query (GstElement *parent, GstQuery *query)
+{
+  return gst_quicfanoutsink_query (GST_BASE_SINK (parent), query);
+}
+
+static gboolean
+gst_quicfanoutsink_query (GstBaseSink * parent, GstQuery * query)
+{
+  GstQuicFanoutSink *sink = GST_QUICFANOUTSINK (parent);
+  const gchar *query_type = GST_QUERY_TYPE_NAME (query);
+  GstStructure *s;
+
+  switch (GST_QUERY_TYPE (query)) {
+  case GST_QUERY_CUSTOM:
+    g_return_val_if_fail (gst_query_is_writable (query), FALSE);
+
+    s = gst_query_writable_structure (query);
+
+    g_return_val_if_fail (s, FALSE);
+
+    if (gst_structure_has_name (s, QUICLIB_CONNECTION_STATE)) {
+      GstQuicLibTransportState state;
+
+      GST_LOG_OBJECT (sink, "Received connection state query");
+
+      /*
+       * There's no single connection to report on. Upstream can open streams
+       * once there's a subscriber to open them on.
+       */
+      g_mutex_lock (&sink->mutex);
+      if (sink->server_ctx == NULL) {
+        state = QUIC_STATE_NONE;
+      } else if (sink->subscribers == NULL) {
+        state = QUIC_STATE_LISTENING;
+      } else {
+        state = QUIC_STATE_OPEN;
+      }
+      g_mutex_unlock (&sink->mutex);
+
+      g_return_val_if_fail (gst_query_fill_quiclib_conn_state (query,
+          QUICLIB_MODE_SERVER, state, NULL, NULL), FALSE);
+    } else if (gst_structure_has_name (s, QUICLIB_STREAM_OPEN)) {
+      GstQuicLibStreamType type;
+      GstQuicLibStreamState state = QUIC_STREAM_OPEN;
+      gint64 stream_id = -1;
+
+      GST_LOG_OBJECT (sink, "Received stream open query");
+
+      g_return_val_if_fail (gst_structure_get_enum (s, QUICLIB_STREAM_TYPE,
+          quiclib_stream_type_get_type (), (gint *) &type), FALSE);
+
+      g_mutex_lock (&sink->mutex);
+
+      if (sink->server_ctx == NULL) {
+        GST_WARNING_OBJECT (sink, "Not listening, can't open a new stream");
+        state = QUIC_STREAM_ERROR_CONNECTION;
+      } else {
+        QuicFanoutStream *stream = g_new0 (QuicFanoutStream, 1);
+
+        stream_id = sink->next_stream_id[type];
+        sink->next_stream_id[type] += 4;
+
+        stream->upstream_id = stream_id;
+        stream->bidi = type == QUIC_STREAM_BIDI;
+        g_hash_table_insert (sink->streams, &stream->upstream_id, stream);
+
+        if (type == QUIC_STREAM_UNI) {
+          state |= QUIC_STREAM_CLOSED_READING;
+        }
+
+        GST_LOG_OBJECT (sink, "Opened fan-out stream %ld", stream_id);
+      }
+
+      g_mutex_unlock (&sink->mutex);
+
+      g_return_val_if_fail (gst_query_fill_new_quiclib_stream (query,
+          stream_id, state), FALSE);
+    } else if (gst_structure_has_name (s, QUICLIB_STREAM_CLOSE)) {
+      guint64 stream_id, reason;
+      gint64 key;
+      GList *it;
+      gboolean rv;
+
+      GST_LOG_OBJECT (sink, "Received stream close query");
+
+      g_return_val_if_fail (gst_structure_get_uint64 (s,
+          QUICLIB_STREAMID_KEY, &stream_id), FALSE);
+
+      if (gst_structure_get_uint64 (s, QUICLIB_CANCEL_REASON, &reason)
+          == FALSE) {
+        reason = 0;
+      }
+
+      key = (gint64) stream_id;
+
+      g_mutex_lock (&sink->mutex);
+
+      for (it = sink->subscribers; it != NULL; it = it->next) {
+        QuicFanoutSubscriber *sub = (QuicFanoutSubscriber *) it->data;
+        gint64 *mapped = g_hash_table_lookup (sub->streams, &key);
+
+        if (mapped != NULL && *mapped >= 0) {
+          gst_quiclib_transport_close_stream (sub->conn, (guint64) *mapped,
+              reason);
+        }
+        g_hash_table_remove (sub->streams, &key);
+      }
+
+      rv = g_hash_table_remove (sink->streams, &key);
+
+      g_mutex_unlock (&sink->mutex);
+
+      GST_LOG_OBJECT (sink, "Closed fan-out stream %lu with reason %lu",
+          stream_id, reason);
+
+      return rv;
+    } else if (gst_structure_has_name (s, QUICLIB_STREAM_STATE)) {
+      QuicFanoutStream *stream;
+      GstQuicLibStreamState state = QUIC_STREAM_CLOSED_BOTH;
+      guint64 stream_id;
+      gint64 key;
+
+      GST_LOG_OBJECT (sink, "Received stream state query");
+
+      g_return_val_if_fail (gst_structure_get_uint64 (s, QUICLIB_STREAMID_KEY,
+          &stream_id), FALSE);
+
+      key = (gint64) stream_id;
+
+      g_mutex_lock (&sink->mutex);
+      stream = g_hash_table_lookup (sink->streams, &key);
+      if (stream != NULL) {
+        state = QUIC_STREAM_OPEN;
+        if (!stream->bidi) {
+          state |= QUIC_STREAM_CLOSED_READING;
+        }
+      }
+      g_mutex_unlock (&sink->mutex);
+
+      g_return_val_if_fail (gst_query_fill_quiclib_stream_state (query, state),
+          FALSE);
+    } else {
+      GST_ERROR_OBJECT (sink, "Unknown custom query type: %s",
+          gst_structure_get_name (s));
+      return FALSE;
+    }
+    break;
+  default:
+    GST_LOG_OBJECT (sink, "Received %s query, passing to base class",
+        query_type);
+    return GST_ELEMENT_CLASS (parent_class)->query (GST_ELEMENT (parent),
+        query);
+  }
+
+  return TRUE;
+}
+
+/*
+ * Send a buffer to every subscriber. The subscribers to send to and their
+ * streams are chosen with the lock held, but the lock is released while
+ * sending so that a blocked subscriber doesn't hold up the transport
+ * callbacks.
+ */
+static GstFlowReturn
+gst_quicfanoutsink_render (GstBaseSink * sink, GstBuffer * buffer)
+{
+  GstQuicFanoutSink *fsink = GST_QUICFANOUTSINK (sink);
+  GstQuicLibStreamMeta *smeta = gst_buffer_get_quiclib_stream_meta (buffer);
+  QuicFanoutStream *stream = NULL;
+  QuicFanoutSubscriber **subs;
+  GstQuicLibFanoutTarget *targets;
+  gboolean keyframe =
+      !GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+  gsize buf_size = gst_buffer_get_size (buffer);
+  guint n = 0, i, sent;
+  GList *it;
+
+  if (smeta == NULL && gst_buffer_get_quiclib_datagram_meta (buffer) == NULL) {
+    GST_ERROR_OBJECT (fsink, "Buffer has neither stream nor datagram meta");
+    return GST_FLOW_ERROR;
+  }
+
+  g_mutex_lock (&fsink->mutex);
+
+  if (smeta != NULL) {
+    stream = g_hash_table_lookup (fsink->streams, &smeta->stream_id);
+    if (stream == NULL) {
+      g_mutex_unlock (&fsink->mutex);
+      GST_ERROR_OBJECT (fsink, "Received buffer for unknown stream %ld",
+          smeta->stream_id);
+      return GST_FLOW_QUIC_STREAM_CLOSED;
+    }
+  }
+
+  subs = g_new (QuicFanoutSubscriber *, g_list_length (fsink->subscribers));
+  targets = g_new0 (GstQuicLibFanoutTarget,
+      g_list_length (fsink->subscribers));
+
+  for (it = fsink->subscribers; it != NULL; it = it->next) {
+    QuicFanoutSubscriber *sub = (QuicFanoutSubscriber *) it->data;
+    gint64 stream_id = -1;
+
+    if (stream != NULL) {
+      if (!quicfanoutsink_subscriber_stream (fsink, sub, stream, keyframe,
+          &stream_id)) {
+        continue;
+      }
+    } else if (sub->awaiting_keyframe) {
+      if (!keyframe) {
+        continue;
+      }
+      sub->awaiting_keyframe = FALSE;
+    }
+
+    subs[n] = sub;
+    targets[n].conn = g_object_ref (sub->conn);
+    targets[n].stream_id = stream_id;
+    targets[n].may_block = fsink->policy == QUICLIB_FANOUT_POLICY_BLOCK;
+    n++;
+  }
+
+  if (stream != NULL) {
+    stream->started = TRUE;
+  }
+
+  g_mutex_unlock (&fsink->mutex);
+
+  sent = gst_quiclib_transport_send_fanout (buffer, targets, n);
+
+  GST_TRACE_OBJECT (fsink, "Buffer of size %lu sent to %u of %u subscribers",
+      buf_size, sent, n);
+
+  g_mutex_lock (&fsink->mutex);
+
+  for (i = 0; i < n; i++) {
+    if (targets[i].error != GST_QUICLIB_ERR_OK ||
+        (gsize) targets[i].bytes_written < buf_size) {
+      /* The subscriber may have gone away while the lock was released */
+      if (g_list_find (fsink->subscribers, subs[i]) != NULL &&
+          subs[i]->conn == targets[i].conn) {
+        quicfanoutsink_subscriber_dropped (fsink, subs[i], &targets[i],
+            stream);
+      }
+    }
+
+    g_object_unref (targets[i].conn);
+  }
+
+  if (smeta != NULL && smeta->final) {
+    gint64 key = (gint64) smeta->stream_id;
+
+    for (it = fsink->subscribers; it != NULL; it = it->next) {
+      g_hash_table_remove (((QuicFanoutSubscriber *) it->data)->streams, &key);
+    }
+    g_hash_table_remove (fsink->streams, &key);
+  }
+
+  g_mutex_unlock (&fsink->mutex);
+
+  g_free (targets);
+  g_free (subs);
+
+  return GST_FLOW_OK;
+}
+
+static gboolean
+quicfanoutsink_user_new_connection (GstQuicLibCommonUser *self,
+    GstQuicLibTransportContext *ctx, GInetSocketAddress *remote,
+    const gchar *alpn)
+{
+  GstQuicFanoutSink *fsink = GST_QUICFANOUTSINK (self);
+  gchar *addr = g_socket_connectable_to_string (G_SOCKET_CONNECTABLE (remote));
+  gboolean accept;
+
+  g_mutex_lock (&fsink->mutex);
+  accept = fsink->max_subscribers == 0 ||
+      g_list_length (fsink->subscribers) < fsink->max_subscribers;
+  g_mutex_unlock (&fsink->mutex);
+
+  if (accept) {
+    GST_TRACE_OBJECT (fsink, "New %s connection with peer %s", alpn, addr);
+  } else {
+    GST_INFO_OBJECT (fsink, "Refusing %s connection with peer %s, already "
+        "have %u subscribers", alpn, addr, fsink->max_subscribers);
+  }
+
+  g_free (addr);
+
+  return accept;
+}
+
+static gboolean
+quicfanoutsink_user_handshake_complete (GstQuicLibCommonUser *self,
+    GstQuicLibTransportContext *ctx, GInetSocketAddress *remote,
+    const gchar *alpn, GstQuicLibTransportConnection *conn)
+{
+  GstQuicFanoutSink *fsink = GST_QUICFANOUTSINK (self);
+  gchar *addr = g_socket_connectable_to_string (G_SOCKET_CONNECTABLE (remote));
+  QuicFanoutSubscriber *sub;
+  gboolean first;
+
+  g_mutex_lock (&fsink->mutex);
+
+  if (quicfanoutsink_find_subscriber (fsink,
+      GST_QUICLIB_TRANSPORT_CONTEXT (conn)) != NULL) {
+    g_mutex_unlock (&fsink->mutex);
+    g_free (addr);
+    return TRUE;
+  }
+
+  sub = g_new0 (QuicFanoutSubscriber, 1);
+  sub->conn = g_object_ref (conn);
+  sub->streams = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free,
+      g_free);
+  sub->awaiting_keyframe =
+      fsink->policy == QUICLIB_FANOUT_POLICY_SKIP_TO_KEYFRAME;
+
+  first = fsink->subscribers == NULL;
+  fsink->subscribers = g_list_append (fsink->subscribers, sub);
+
+  GST_DEBUG_OBJECT (fsink, "New %s subscriber %s, %u subscribers", alpn, addr,
+      g_list_length (fsink->subscribers));
+
+  g_mutex_unlock (&fsink->mutex);
+
+  g_free (addr);
+
+  gst_quiclib_handshake_complete_signal_emit (fsink,
+      G_SOCKET_ADDRESS (remote), alpn);
+
+  /* Let upstream know that it can start opening streams */
+  if (first) {
+    return gst_quiclib_new_handshake_complete_event (
+        GST_BASE_SINK (fsink)->sinkpad, G_SOCKET_ADDRESS (remote), alpn);
+  }
+
+  return TRUE;
+}
+
+static gboolean
+quicfanoutsink_user_stream_opened (GstQuicLibCommonUser *self,
+    GstQuicLibTransportContext *ctx, guint64 stream_id)
+{
+  GstQuicFanoutSink *fsink = GST_QUICFANOUTSINK (self);
+
+  GST_TRACE_OBJECT (fsink, "Subscriber %p opened stream %lu", ctx, stream_id);
+
+  return TRUE;
+}
+
+static void
+quicfanoutsink_user_stream_closed (GstQuicLibCommonUser *self,
+    GstQuicLibTransportContext *ctx, guint64 stream_id)
+{
+  GstQuicFanoutSink *fsink = GST_QUICFANOUTSINK (self);
+
+  GST_TRACE_OBJECT (fsink, "Subscriber %p stream %lu closed", ctx, stream_id);
+}
+
+static void
+quicfanoutsink_user_stream_ackd (GstQuicLibCommonUser *self,
+    GstQuicLibTransportContext *ctx, guint64 stream_id, gsize ackd_offset)
+{
+  GstQuicFanoutSink *fsink = GST_QUICFANOUTSINK (self);
+
+  GST_TRACE_OBJECT (fsink, "Acknowledged up to %ld on stream %lu",
+      ackd_offset, stream_id);
+}
+
+static void
+quicfanoutsink_user_datagram_ackd (GstQuicLibCommonUser *self,
+    GstQuicLibTransportContext *ctx, GstBuffer *ackd_datagram)
+{
+  GstQuicFanoutSink *fsink = GST_QUICFANOUTSINK (self);
+
+  GST_TRACE_OBJECT (fsink, "Datagram %" GST_PTR_FORMAT " acknowledged",
+      ackd_datagram);
+}
+
+static gboolean
+quicfanoutsink_user_connection_error (GstQuicLibCommonUser *self,
+    GstQuicLibTransportContext *ctx, guint64 error)
+{
+  GstQuicFanoutSink *fsink = GST_QUICFANOUTSINK (self);
+
+  GST_DEBUG_OBJECT (fsink, "Subscriber %p connection error: %lu", ctx, error);
+
+  return FALSE;
+}
+
+static void
+quicfanoutsink_user_connection_closed (GstQuicLibCommonUser *self,
+    GstQuicLibTransportContext *ctx, GInetSocketAddress *remote)
+{
+  GstQuicFanoutSink *fsink = GST_QUICFANOUTSINK (self);
+  gchar *addr = g_socket_connectable_to_string (G_SOCKET_CONNECTABLE (remote));
+  QuicFanoutSubscriber *sub;
+
+  g_mutex_lock (&fsink->mutex);
+
+  sub = quicfanoutsink_find_subscriber (fsink, ctx);
+  if (sub != NULL) {
+    fsink->subscribers = g_list_remove (fsink->subscribers, sub);
+    quicfanoutsink_subscriber_free (sub);
+  }
+
+  GST_DEBUG_OBJECT (fsink, "Subscriber %s left, %u subscribers", addr,
+      g_list_length (fsink->subscribers));
+
+  g_mutex_unlock (&fsink->mutex);
+
+  gst_quiclib_conn_closed_signal_emit (fsink, G_SOCKET_ADDRESS (remote));
+
+  g_free (addr);
+}
+
+static void gst_quicfanoutsink_common_user_interface_init (gpointer g_iface,
+    gpointer iface_data)
+{
+  GstQuicLibCommonUserInterface *iface = g_iface;
+
+  iface->new_connection = quicfanoutsink_user_new_connection;
+  iface->handshake_complete = quicfanoutsink_user_handshake_complete;
+  iface->stream_opened = quicfanoutsink_user_stream_opened;
+  iface->stream_closed = quicfanoutsink_user_stream_closed;
+  iface->stream_data = NULL;
+  iface->stream_ackd = quicfanoutsink_user_stream_ackd;
+  iface->datagram_data = NULL;
+  iface->datagram_ackd = quicfanoutsink_user_datagram_ackd;
+  iface->connection_error = quicfanoutsink_user_connection_error;
+  iface->connection_closed = quicfanoutsink_user_connection_closed;
+}
+
+static gboolean
+quicfanoutsink_init (GstPlugin * quicfanoutsink)
+{
+  GST_DEBUG_CATEGORY_INIT (gst_quicfanoutsink_debug, "quicfanoutsink",
+      0, "QUIC fan-out sink");
+
+  return GST_ELEMENT_REGISTER (quicfanoutsink, quicfanoutsink);
+}
+
+#ifndef PACKAGE
+#define PACKAGE "quicfanoutsink"
+#endif
+
+GST_PLUGIN_DEFINE (GST_VERSION_MAJOR,
+    GST_VERSION_MINOR,
+    quicfanoutsink,
+    "quicfanoutsink",
+    quicfanoutsink_init,
+    PACKAGE_VERSION, GST_LICENSE, GST_PACKAGE_NAME, GST_PACKAGE_ORIGIN)
@@ -73,6 +73,18 @@
  * sink pad will map directly to a QUIC DATAGRAM  frame, and as such upstream
  * elements should perform chunking of data to fit within the QUIC DATAGRAM
  * frame maximum transmission unit.
+ *
+ * Each sink pad has a "dscp" property, which sets the Differentiated Services
+ * Code Point that packets carrying its stream or datagrams are marked with.
+ * Upstream elements can instead set the dscp field of the GstQuicLibStreamMeta
+ * or GstQuicLibDatagramMeta themselves, which takes precedence over the pad.
+ *
+ * Stream sink pads also have "rate-limit" and "rate-burst" properties, which
+ * shape the stream to a token bucket of that rate in bits/second and depth in
+ * bytes on top of any connection-wide rate limit. Data over the limit is held
+ * back by the transport and released as tokens accrue, so the pad is not
+ * blocked while it waits. As with the DSCP, a rate_limit already set in the
+ * GstQuicLibStreamMeta takes precedence.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -132,6 +144,134 @@ quic_mux_new_stream_object (GstQuicMux *quicmux, guint64 stream_id, GstPad *pad)
   return stream;
 }
 
+enum
+{
+  PROP_PAD_0,
+  PROP_PAD_DSCP,
+  PROP_PAD_RATE_LIMIT,
+  PROP_PAD_RATE_BURST,
+};
+
+G_DEFINE_TYPE (GstQuicMuxPad, gst_quic_mux_pad, GST_TYPE_PAD);
+
+static void
+gst_quic_mux_pad_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstQuicMuxPad *pad = GST_QUICMUX_PAD (object);
+
+  switch (prop_id) {
+    case PROP_PAD_DSCP:
+      GST_OBJECT_LOCK (pad);
+      pad->dscp = g_value_get_int (value);
+      GST_OBJECT_UNLOCK (pad);
+      break;
+    case PROP_PAD_RATE_LIMIT:
+      GST_OBJECT_LOCK (pad);
+      pad->rate_limit = g_value_get_uint64 (value);
+      GST_OBJECT_UNLOCK (pad);
+      break;
+    case PROP_PAD_RATE_BURST:
+      GST_OBJECT_LOCK (pad);
+      pad->rate_burst = g_value_get_uint64 (value);
+      GST_OBJECT_UNLOCK (pad);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_quic_mux_pad_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstQuicMuxPad *pad = GST_QUICMUX_PAD (object);
+
+  switch (prop_id) {
+    case PROP_PAD_DSCP:
+      GST_OBJECT_LOCK (pad);
+      g_value_set_int (value, pad->dscp);
+      GST_OBJECT_UNLOCK (pad);
+      break;
+    case PROP_PAD_RATE_LIMIT:
+      GST_OBJECT_LOCK (pad);
+      g_value_set_uint64 (value, pad->rate_limit);
+      GST_OBJECT_UNLOCK (pad);
+      break;
+    case PROP_PAD_RATE_BURST:
+      GST_OBJECT_LOCK (pad);
+      g_value_set_uint64 (value, pad->rate_burst);
+      GST_OBJECT_UNLOCK (pad);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_quic_mux_pad_class_init (GstQuicMuxPadClass *klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+
+  gobject_class->set_property = gst_quic_mux_pad_set_property;
+  gobject_class->get_property = gst_quic_mux_pad_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_PAD_DSCP,
+      g_param_spec_int ("dscp", "DSCP",
+          "Differentiated Services Code Point to mark packets carrying data "
+          "from this pad with, or -1 to use the connection's default",
+          -1, QUICLIB_DSCP_MAX, -1,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING |
+          G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PAD_RATE_LIMIT,
+      g_param_spec_uint64 ("rate-limit", "Rate limit",
+          "Rate in bits/second to shape the stream from this pad to, or 0 to "
+          "only apply the connection's rate limit",
+          0, G_MAXUINT64, 0,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING |
+          G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PAD_RATE_BURST,
+      g_param_spec_uint64 ("rate-burst", "Rate burst",
+          "Token bucket depth in bytes for rate-limit, or 0 for 100ms worth "
+          "of the rate",
+          0, G_MAXUINT64, 0,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING |
+          G_PARAM_STATIC_STRINGS));
+}
+
+static void
+gst_quic_mux_pad_init (GstQuicMuxPad *pad)
+{
+  pad->dscp = -1;
+  pad->rate_limit = 0;
+  pad->rate_burst = 0;
+}
+
+static gint
+gst_quic_mux_pad_get_dscp (GstPad *pad)
+{
+  gint dscp;
+
+  GST_OBJECT_LOCK (pad);
+  dscp = GST_QUICMUX_PAD (pad)->dscp;
+  GST_OBJECT_UNLOCK (pad);
+
+  return dscp;
+}
+
+static void
+gst_quic_mux_pad_get_rate_limit (GstPad *pad, guint64 *rate, guint64 *burst)
+{
+  GST_OBJECT_LOCK (pad);
+  *rate = GST_QUICMUX_PAD (pad)->rate_limit;
+  *burst = GST_QUICMUX_PAD (pad)->rate_burst;
+  GST_OBJECT_UNLOCK (pad);
+}
+
 enum
 {
   PROP_0,
@@ -226,11 +366,14 @@ gst_quic_mux_class_init (GstQuicMuxClass * klass)
   gst_element_class_add_pad_template (gstelement_class,
       gst_static_pad_template_get (&src_factory));
   gst_element_class_add_pad_template (gstelement_class,
-      gst_static_pad_template_get (&sink_bidi_factory));
+      gst_pad_template_new_from_static_pad_template_with_gtype (
+          &sink_bidi_factory, GST_TYPE_QUICMUX_PAD));
   gst_element_class_add_pad_template (gstelement_class,
-      gst_static_pad_template_get (&sink_uni_factory));
+      gst_pad_template_new_from_static_pad_template_with_gtype (
+          &sink_uni_factory, GST_TYPE_QUICMUX_PAD));
   gst_element_class_add_pad_template (gstelement_class,
-      gst_static_pad_template_get (&sink_datagram_factory));
+      gst_pad_template_new_from_static_pad_template_with_gtype (
+          &sink_datagram_factory, GST_TYPE_QUICMUX_PAD));
 }
 
 /* initialize the new element
@@ -530,7 +673,8 @@ gst_quic_mux_request_new_pad (GstElement *element, GstPadTemplate *templ,
     return NULL;
   }
 
-  pad = gst_pad_new_from_template (templ, NULL);
+  pad = g_object_new (GST_TYPE_QUICMUX_PAD, "name", NULL, "direction",
+      GST_PAD_TEMPLATE_DIRECTION (templ), "template", templ, NULL);
 
   switch (pad_type) {
     case PAD_BIDI:
@@ -764,6 +908,13 @@ gst_quic_mux_src_event (GstPad * pad, GstObject * parent, GstEvent * event)
       g_rec_mutex_unlock (&quicmux->mutex);
 
       return TRUE;
+    } else if (gst_structure_has_name (s, QUICLIB_BITRATE_HINT)) {
+      /*
+       * The capacity is shared by every stream, so let all of the upstream
+       * encoders know about it.
+       */
+      ret = gst_pad_event_default (pad, parent, event);
+      break;
     } else {
       GST_WARNING_OBJECT (quicmux,
           "Received unknown upstream event with name %s",
@@ -916,11 +1067,20 @@ gst_quic_mux_stream_chain (GstPad * pad, GstObject * parent, GstBuffer * buf)
       return GST_FLOW_ERROR;
     }
   } else {
-    gst_buffer_add_quiclib_stream_meta (buf, stream->stream_id,
+    smeta = gst_buffer_add_quiclib_stream_meta (buf, stream->stream_id,
         stream->offset + 1, buflen,
         gst_buffer_has_flags (buf, GST_BUFFER_FLAG_LAST));
   }
 
+  if (smeta != NULL && smeta->dscp < 0) {
+    smeta->dscp = gst_quic_mux_pad_get_dscp (pad);
+  }
+
+  if (smeta != NULL && smeta->rate_limit == 0) {
+    gst_quic_mux_pad_get_rate_limit (pad, &smeta->rate_limit,
+        &smeta->rate_burst);
+  }
+
   stream->offset += buflen;  
 
   if (print_pipeline == FALSE) {
@@ -975,7 +1135,12 @@ gst_quic_mux_dgram_chain (GstPad * pad, GstObject * parent, GstBuffer * buf)
 
   dmeta = gst_buffer_get_quiclib_datagram_meta (buf);
   if (!dmeta) {
-    gst_buffer_add_quiclib_datagram_meta (buf, gst_buffer_get_size (buf));
+    dmeta = gst_buffer_add_quiclib_datagram_meta (buf,
+        gst_buffer_get_size (buf));
+  }
+
+  if (dmeta != NULL && dmeta->dscp < 0) {
+    dmeta->dscp = gst_quic_mux_pad_get_dscp (pad);
   }
 
   GST_DEBUG_OBJECT (quicmux, "Pushing datagram of size %lu",
@@ -71,6 +71,19 @@ struct _GstQuicMuxStreamObject
   GCond wait;
 };
 
+#define GST_TYPE_QUICMUX_PAD (gst_quic_mux_pad_get_type())
+G_DECLARE_FINAL_TYPE (GstQuicMuxPad, gst_quic_mux_pad,
+    GST, QUICMUX_PAD, GstPad)
+
+struct _GstQuicMuxPad
+{
+  GstPad parent;
+
+  gint dscp;
+  guint64 rate_limit;
+  guint64 rate_burst;
+};
+
 #define GST_TYPE_QUICMUX (gst_quic_mux_get_type())
 G_DECLARE_FINAL_TYPE (GstQuicMux, gst_quic_mux,
     GST, QUICMUX, GstElement)
@@ -0,0 +1,696 @@
+/*
+ * Copyright 2023 British Broadcasting Corporation - Research and Development
+ *
+ * Author: Sam Hurst <sam.hurst@bbc.co.uk>
+ *
+ * Based on the GStreamer template repository:
+ *  https://gitlab.freedesktop.org/gstreamer/gst-template
+ * Copyright (C) 2005 Thomas Vander Stichele <thomas@apestaart.org>
+ * Copyright (C) 2005 Ronald S. Bultje <rbultje@ronald.bitfreak.net>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/**
+ * SECTION:gstquicrelay
+ * @title: GstQuicRelay
+ * @short description: element relaying QUIC streams between connections.
+ *
+ * The quicrelay element connects to an upstream peer at upstream-location, and
+ * listens for downstream peers at location. Every stream the upstream peer
+ * sends is forwarded onto a new stream to each downstream peer, and with
+ * relay-datagrams set so are its DATAGRAM frames.
+ *
+ * The forwarding is done inside the QUIC transport on the upstream
+ * connection's thread, rather than by a quicsrc ! quicdemux ! quicmux !
+ * quicsink pipeline, so the data never passes through a pad and each buffer
+ * received is sent to every downstream peer from the same memory. The element
+ * has no pads.
+ *
+ * A downstream peer that connects part way through a stream joins at the
+ * start of the next one. Data for a downstream peer that is congested is
+ * queued, and if more than max-queued bytes of a stream are waiting, that
+ * peer's stream is reset and it misses the rest of it. Nothing that
+ * downstream peers send is relayed upstream.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <gst/gst.h>
+
+#include "gstquicrelay.h"
+#include "gstquictransport.h"
+#include "gstquicsignals.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_quicrelay_debug);
+#define GST_CAT_DEFAULT gst_quicrelay_debug
+
+#define QUICRELAY_UPSTREAM_LOCATION_DEFAULT NULL
+#define QUICRELAY_UPSTREAM_ALPN_DEFAULT NULL
+#define QUICRELAY_RELAY_DATAGRAMS_DEFAULT FALSE
+#define QUICRELAY_MAX_QUEUED_DEFAULT 1048576
+
+enum
+{
+  PROP_0,
+  PROP_QUIC_ENDPOINT_ENUMS,
+  PROP_UPSTREAM_LOCATION,
+  PROP_UPSTREAM_ALPN,
+  PROP_RELAY_DATAGRAMS,
+  PROP_MAX_QUEUED,
+  PROP_DOWNSTREAMS
+};
+
+static guint signals[GST_QUICLIB_SIGNALS_MAX];
+
+static void gst_quicrelay_common_user_interface_init (gpointer g_iface,
+    gpointer iface_data);
+
+#define gst_quicrelay_parent_class parent_class
+G_DEFINE_TYPE_WITH_CODE (GstQuicRelay, gst_quicrelay, GST_TYPE_ELEMENT,
+    G_IMPLEMENT_INTERFACE (GST_QUICLIB_COMMON_USER_TYPE,
+        gst_quicrelay_common_user_interface_init));
+
+GST_ELEMENT_REGISTER_DEFINE (quicrelay, "quicrelay", GST_RANK_NONE,
+    GST_TYPE_QUICRELAY);
+
+static void gst_quicrelay_finalize (GObject * object);
+static void gst_quicrelay_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec);
+static void gst_quicrelay_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec);
+
+static GstStateChangeReturn gst_quicrelay_change_state (GstElement *elem,
+    GstStateChange t);
+
+static gboolean gst_quicrelay_start (GstQuicRelay *relay);
+static void gst_quicrelay_stop (GstQuicRelay *relay);
+
+/*
+ * Start relaying from the upstream connection onto a downstream connection.
+ * Call with the relay mutex held.
+ */
+static void
+quicrelay_add_downstream_rule (GstQuicRelay *relay,
+    GstQuicLibTransportConnection *downstream)
+{
+  gst_quiclib_transport_relay_add (relay->upstream, downstream, -1,
+      relay->relay_datagrams, (gsize) relay->max_queued);
+}
+
+static gboolean
+gst_quicrelay_start (GstQuicRelay *relay)
+{
+  const gchar *upstream_alpn;
+
+  gst_quicrelay_stop (relay);
+
+  g_mutex_lock (&relay->mutex);
+
+  if (relay->upstream_location == NULL) {
+    GST_ERROR_OBJECT (relay, "No upstream-location to relay from");
+    g_mutex_unlock (&relay->mutex);
+    return FALSE;
+  }
+
+  GST_TRACE_OBJECT (relay, "Opening listening port on %s", relay->location);
+
+  relay->server_ctx = gst_quiclib_get_server (GST_QUICLIB_COMMON_USER (relay),
+      relay->location, relay->alpn, relay->privkey_location,
+      relay->cert_location, relay->sni);
+
+  if (relay->server_ctx == NULL) {
+    g_mutex_unlock (&relay->mutex);
+    return FALSE;
+  }
+
+  g_object_set (relay->server_ctx,
+      PROP_MAX_STREAMS_BIDI_REMOTE_SHORTNAME,
+      relay->max_streams_bidi_remote_init,
+      PROP_MAX_STREAMS_UNI_REMOTE_SHORTNAME,
+      relay->max_streams_uni_remote_init,
+      PROP_MAX_STREAM_DATA_BIDI_REMOTE_SHORTNAME,
+      relay->max_stream_data_bidi_remote_init,
+      PROP_MAX_STREAM_DATA_UNI_REMOTE_SHORTNAME,
+      relay->max_stream_data_uni_remote_init,
+      PROP_MAX_DATA_REMOTE_SHORTNAME, relay->max_data_remote_init,
+      PROP_ENABLE_DATAGRAM_SHORTNAME, relay->enable_datagram,
+      PROP_BUSY_POLL_SHORTNAME, relay->busy_poll,
+      PROP_BUSY_POLL_BUDGET_SHORTNAME, relay->busy_poll_budget,
+      PROP_CPU_AFFINITY_SHORTNAME, relay->cpu_affinity,
+      PROP_ASYNC_CPU_AFFINITY_SHORTNAME, relay->async_cpu_affinity,
+      PROP_THREAD_SCHED_POLICY_SHORTNAME, relay->thread_sched_policy,
+      PROP_THREAD_PRIORITY_SHORTNAME, relay->thread_priority,
+      PROP_IO_BACKEND_SHORTNAME, relay->io_backend,
+      PROP_ZEROCOPY_THRESHOLD_SHORTNAME, relay->zerocopy_threshold,
+      PROP_DSCP_SHORTNAME, relay->dscp,
+      PROP_RATE_LIMIT_SHORTNAME, relay->rate_limit,
+      PROP_RATE_BURST_SHORTNAME, relay->rate_burst,
+      PROP_PROBE_DURATION_SHORTNAME, relay->probe_duration,
+      PROP_EGRESS_RATE_LIMIT_SHORTNAME, relay->egress_rate_limit,
+      PROP_ADMISSION_MAX_LOAD_SHORTNAME, relay->admission_max_load,
+      PROP_ADMISSION_MAX_HANDSHAKES_SHORTNAME, relay->admission_max_handshakes,
+      PROP_ADMISSION_MAX_MEMORY_SHORTNAME, relay->admission_max_memory,
+      PROP_ADMISSION_ACTION_SHORTNAME, relay->admission_action,
+      PROP_ADMISSION_SHED_IDLE_SHORTNAME, relay->admission_shed_idle,
+      PROP_CONN_MEMORY_LIMIT_SHORTNAME, relay->conn_memory_limit,
+      PROP_SERVER_MEMORY_LIMIT_SHORTNAME, relay->server_memory_limit,
+      PROP_IDLE_MODE_SHORTNAME, relay->idle_mode,
+      PROP_XDP_INTERFACE_SHORTNAME, relay->xdp_interface,
+      PROP_XDP_QUEUE_SHORTNAME, relay->xdp_queue,
+      PROP_XDP_SKB_MODE_SHORTNAME, relay->xdp_skb_mode,
+      PROP_QUIC_LB_SERVER_ID_SHORTNAME, relay->quic_lb_server_id,
+      PROP_QUIC_LB_KEY_SHORTNAME, relay->quic_lb_key,
+      PROP_PREFERRED_ADDRESS_SHORTNAME, relay->preferred_address, NULL);
+
+  if (gst_quiclib_transport_get_state (
+        GST_QUICLIB_TRANSPORT_CONTEXT (relay->server_ctx))
+      == QUIC_STATE_NONE) {
+    if (!gst_quiclib_transport_server_listen (relay->server_ctx)) {
+      GST_ERROR_OBJECT (relay, "Couldn't listen on server address %s",
+          relay->location);
+      gst_quiclib_unref (GST_QUICLIB_TRANSPORT_CONTEXT (relay->server_ctx),
+          GST_QUICLIB_COMMON_USER (relay));
+      relay->server_ctx = NULL;
+      g_mutex_unlock (&relay->mutex);
+      return FALSE;
+    }
+  }
+
+  /*
+   * The upstream connection is always our own, as relayed data is taken away
+   * from any other users of the connection.
+   */
+  upstream_alpn = (relay->upstream_alpn != NULL) ? relay->upstream_alpn :
+      relay->alpn;
+
+  GST_TRACE_OBJECT (relay, "Connecting to %s with ALPN %s",
+      relay->upstream_location, upstream_alpn);
+
+  relay->upstream = gst_quiclib_new_client (GST_QUICLIB_COMMON_USER (relay),
+      relay->upstream_location, upstream_alpn);
+
+  if (relay->upstream == NULL) {
+    g_mutex_unlock (&relay->mutex);
+    return FALSE;
+  }
+
+  g_object_set (relay->upstream,
+      PROP_MAX_STREAMS_BIDI_REMOTE_SHORTNAME,
+      relay->max_streams_bidi_remote_init,
+      PROP_MAX_STREAMS_UNI_REMOTE_SHORTNAME,
+      relay->max_streams_uni_remote_init,
+      PROP_MAX_STREAM_DATA_BIDI_REMOTE_SHORTNAME,
+      relay->max_stream_data_bidi_remote_init,
+      PROP_MAX_STREAM_DATA_UNI_REMOTE_SHORTNAME,
+      relay->max_stream_data_uni_remote_init,
+      PROP_MAX_DATA_REMOTE_SHORTNAME, relay->max_data_remote_init,
+      PROP_ENABLE_DATAGRAM_SHORTNAME, relay->enable_datagram,
+      PROP_CPU_AFFINITY_SHORTNAME, relay->cpu_affinity,
+      PROP_ASYNC_CPU_AFFINITY_SHORTNAME, relay->async_cpu_affinity,
+      PROP_THREAD_SCHED_POLICY_SHORTNAME, relay->thread_sched_policy,
+      PROP_THREAD_PRIORITY_SHORTNAME, relay->thread_priority,
+      PROP_IO_BACKEND_SHORTNAME, relay->io_backend,
+      PROP_DSCP_SHORTNAME, relay->dscp,
+      PROP_RATE_LIMIT_SHORTNAME, relay->rate_limit,
+      PROP_RATE_BURST_SHORTNAME, relay->rate_burst,
+      PROP_PROBE_DURATION_SHORTNAME, relay->probe_duration,
+      PROP_EGRESS_RATE_LIMIT_SHORTNAME, relay->egress_rate_limit,
+      PROP_ADMISSION_MAX_LOAD_SHORTNAME, relay->admission_max_load,
+      PROP_ADMISSION_MAX_HANDSHAKES_SHORTNAME, relay->admission_max_handshakes,
+      PROP_ADMISSION_MAX_MEMORY_SHORTNAME, relay->admission_max_memory,
+      PROP_ADMISSION_ACTION_SHORTNAME, relay->admission_action,
+      PROP_ADMISSION_SHED_IDLE_SHORTNAME, relay->admission_shed_idle,
+      PROP_CONN_MEMORY_LIMIT_SHORTNAME, relay->conn_memory_limit,
+      PROP_SERVER_MEMORY_LIMIT_SHORTNAME, relay->server_memory_limit,
+      PROP_IDLE_MODE_SHORTNAME, relay->idle_mode,
+      PROP_XDP_INTERFACE_SHORTNAME, relay->xdp_interface,
+      PROP_XDP_QUEUE_SHORTNAME, relay->xdp_queue,
+      PROP_XDP_SKB_MODE_SHORTNAME, relay->xdp_skb_mode, NULL);
+
+  if (!gst_quiclib_transport_client_connect (relay->upstream)) {
+    GST_ERROR_OBJECT (relay, "Couldn't open upstream connection to %s",
+        relay->upstream_location);
+    gst_quiclib_unref (GST_QUICLIB_TRANSPORT_CONTEXT (relay->upstream),
+        GST_QUICLIB_COMMON_USER (relay));
+    relay->upstream = NULL;
+    g_mutex_unlock (&relay->mutex);
+    return FALSE;
+  }
+
+  g_mutex_unlock (&relay->mutex);
+
+  return TRUE;
+}
+
+static void
+gst_quicrelay_stop (GstQuicRelay *relay)
+{
+  GList *it;
+
+  g_mutex_lock (&relay->mutex);
+
+  GST_TRACE_OBJECT (relay, "Stopping with %u downstream connections",
+      g_list_length (relay->downstreams));
+
+  for (it = relay->downstreams; it != NULL; it = it->next) {
+    if (relay->upstream != NULL) {
+      gst_quiclib_transport_relay_remove (relay->upstream,
+          GST_QUICLIB_TRANSPORT_CONNECTION (it->data));
+    }
+  }
+  g_list_free_full (relay->downstreams, g_object_unref);
+  relay->downstreams = NULL;
+
+  if (relay->upstream != NULL) {
+    gst_quiclib_unref (GST_QUICLIB_TRANSPORT_CONTEXT (relay->upstream),
+        GST_QUICLIB_COMMON_USER (relay));
+    relay->upstream = NULL;
+  }
+  relay->upstream_open = FALSE;
+
+  if (relay->server_ctx != NULL) {
+    gst_quiclib_unref (GST_QUICLIB_TRANSPORT_CONTEXT (relay->server_ctx),
+        GST_QUICLIB_COMMON_USER (relay));
+    relay->server_ctx = NULL;
+  }
+
+  g_mutex_unlock (&relay->mutex);
+}
+
+/* GObject vmethod implementations */
+
+static void
+gst_quicrelay_class_init (GstQuicRelayClass * klass)
+{
+  GObjectClass *gobject_class;
+  GstElementClass *gstelement_class;
+
+  gobject_class = (GObjectClass *) klass;
+  gstelement_class = (GstElementClass *) klass;
+
+  gobject_class->finalize = gst_quicrelay_finalize;
+  gobject_class->set_property = gst_quicrelay_set_property;
+  gobject_class->get_property = gst_quicrelay_get_property;
+
+  gstelement_class->change_state = gst_quicrelay_change_state;
+
+  /*
+   * See the full list of common endpoint properties for QUIC transport
+   * handling in gstquiccommon.h
+   */
+  gst_quiclib_common_install_endpoint_properties (gobject_class);
+
+  g_object_class_install_property (gobject_class, PROP_UPSTREAM_LOCATION,
+      g_param_spec_string ("upstream-location", "Upstream location",
+          "Address and port of the peer to relay from",
+          QUICRELAY_UPSTREAM_LOCATION_DEFAULT, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_UPSTREAM_ALPN,
+      g_param_spec_string ("upstream-alpn", "Upstream ALPN",
+          "ALPN to connect to the upstream peer with, or NULL to use alpn",
+          QUICRELAY_UPSTREAM_ALPN_DEFAULT, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_RELAY_DATAGRAMS,
+      g_param_spec_boolean ("relay-datagrams", "Relay DATAGRAMs",
+          "Relay DATAGRAM frames as well as streams",
+          QUICRELAY_RELAY_DATAGRAMS_DEFAULT, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_QUEUED,
+      g_param_spec_uint64 ("max-queued", "Maximum queued bytes",
+          "Most bytes of a stream to queue for a congested downstream peer "
+          "before resetting its stream, 0 for no limit", 0, G_MAXUINT64,
+          QUICRELAY_MAX_QUEUED_DEFAULT, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_DOWNSTREAMS,
+      g_param_spec_uint ("downstreams", "Downstream peers",
+          "Number of connected downstream peers", 0, G_MAXUINT, 0,
+          G_PARAM_READABLE));
+
+  signals[GST_QUICLIB_HANDSHAKE_COMPLETE_SIGNAL] =
+    gst_quiclib_handshake_complete_signal_new (klass);
+  signals[GST_QUICLIB_CONN_ERROR_SIGNAL] =
+    gst_quiclib_conn_error_signal_new (klass);
+  signals[GST_QUICLIB_CONN_CLOSED_SIGNAL] =
+    gst_quiclib_conn_closed_signal_new (klass);
+
+  gst_element_class_set_static_metadata (gstelement_class,
+        "QUIC relay", "Generic/Network",
+        "Relay streams from one QUIC peer to many",
+        "Samuel Hurst <sam.hurst@bbc.co.uk>");
+}
+
+static void
+gst_quicrelay_init (GstQuicRelay * relay)
+{
+  gst_quiclib_common_init_endpoint_properties (relay);
+
+  relay->server_ctx = NULL;
+  relay->upstream = NULL;
+  relay->upstream_open = FALSE;
+  relay->downstreams = NULL;
+  relay->upstream_location = g_strdup (QUICRELAY_UPSTREAM_LOCATION_DEFAULT);
+  relay->upstream_alpn = g_strdup (QUICRELAY_UPSTREAM_ALPN_DEFAULT);
+  relay->relay_datagrams = QUICRELAY_RELAY_DATAGRAMS_DEFAULT;
+  relay->max_queued = QUICRELAY_MAX_QUEUED_DEFAULT;
+
+  g_mutex_init (&relay->mutex);
+
+  GST_OBJECT_FLAG_SET (relay, GST_ELEMENT_FLAG_SOURCE);
+}
+
+static void
+gst_quicrelay_finalize (GObject * object)
+{
+  GstQuicRelay *relay = GST_QUICRELAY (object);
+
+  gst_quiclib_common_free_endpoint_properties (relay);
+  g_free (relay->upstream_location);
+  g_free (relay->upstream_alpn);
+  g_mutex_clear (&relay->mutex);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_quicrelay_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstQuicRelay *relay = GST_QUICRELAY (object);
+
+  switch (prop_id) {
+    /*
+     * See the full list of common endpoint properties for QUIC transport
+     * handling in gstquiccommon.h
+     */
+    case PROP_QUIC_ENDPOINT_COMMON_ENUM_CASES:
+    case PROP_QUIC_ENDPOINT_SERVER_ENUM_CASES:
+      if (prop_id == PROP_MODE) {
+        GST_WARNING_OBJECT (relay, "quicrelay always listens for downstream "
+            "peers, and connects to upstream-location");
+        break;
+      }
+      g_mutex_lock (&relay->mutex);
+      gst_quiclib_common_set_endpoint_property_checked (relay,
+          relay->server_ctx, pspec, prop_id, value);
+      g_mutex_unlock (&relay->mutex);
+      break;
+    case PROP_QUIC_ENDPOINT_CLIENT_ENUM_CASES:
+      GST_WARNING_OBJECT (relay,
+          "Cannot set client property %s on quicrelay", pspec->name);
+      break;
+    case PROP_UPSTREAM_LOCATION:
+      g_mutex_lock (&relay->mutex);
+      g_free (relay->upstream_location);
+      relay->upstream_location = g_value_dup_string (value);
+      g_mutex_unlock (&relay->mutex);
+      break;
+    case PROP_UPSTREAM_ALPN:
+      g_mutex_lock (&relay->mutex);
+      g_free (relay->upstream_alpn);
+      relay->upstream_alpn = g_value_dup_string (value);
+      g_mutex_unlock (&relay->mutex);
+      break;
+    case PROP_RELAY_DATAGRAMS:
+      g_mutex_lock (&relay->mutex);
+      relay->relay_datagrams = g_value_get_boolean (value);
+      g_mutex_unlock (&relay->mutex);
+      break;
+    case PROP_MAX_QUEUED:
+      g_mutex_lock (&relay->mutex);
+      relay->max_queued = g_value_get_uint64 (value);
+      g_mutex_unlock (&relay->mutex);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_quicrelay_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstQuicRelay *relay = GST_QUICRELAY (object);
+
+  switch (prop_id) {
+    /*
+     * See the full list of common endpoint properties for QUIC transport
+     * handling in gstquiccommon.h
+     */
+    case PROP_QUIC_ENDPOINT_COMMON_ENUM_CASES:
+    case PROP_QUIC_ENDPOINT_SERVER_ENUM_CASES:
+      g_mutex_lock (&relay->mutex);
+      gst_quiclib_common_get_endpoint_property_checked (relay,
+          relay->server_ctx, pspec, prop_id, value);
+      g_mutex_unlock (&relay->mutex);
+      break;
+    case PROP_QUIC_ENDPOINT_CLIENT_ENUM_CASES:
+      GST_WARNING_OBJECT (relay,
+          "Cannot get client property %s on quicrelay", pspec->name);
+      break;
+    case PROP_UPSTREAM_LOCATION:
+      g_value_set_string (value, relay->upstream_location);
+      break;
+    case PROP_UPSTREAM_ALPN:
+      g_value_set_string (value, relay->upstream_alpn);
+      break;
+    case PROP_RELAY_DATAGRAMS:
+      g_value_set_boolean (value, relay->relay_datagrams);
+      break;
+    case PROP_MAX_QUEUED:
+      g_value_set_uint64 (value, relay->max_queued);
+      break;
+    case PROP_DOWNSTREAMS:
+      g_mutex_lock (&relay->mutex);
+      g_value_set_uint (value, g_list_length (relay->downstreams));
+      g_mutex_unlock (&relay->mutex);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+/* GstElement vmethod implementations */
+static GstStateChangeReturn
+gst_quicrelay_change_state (GstElement *elem, GstStateChange t)
+{
+  GstQuicRelay *relay = GST_QUICRELAY (elem);
+
+  GST_TRACE_OBJECT (relay, "Changing state from %s to %s",
+      gst_element_state_get_name ((t & 0xf8) >> 3),
+      gst_element_state_get_name (t & 0x4));
+
+  GstStateChangeReturn rv =
+      GST_ELEMENT_CLASS (parent_class)->change_state (elem, t);
+
+  switch (t) {
+  case GST_STATE_CHANGE_READY_TO_PAUSED:
+    if (gst_quicrelay_start (relay) == FALSE) {
+      gst_quicrelay_stop (relay);
+      return GST_STATE_CHANGE_FAILURE;
+    }
+    return GST_STATE_CHANGE_NO_PREROLL;
+  case GST_STATE_CHANGE_PAUSED_TO_READY:
+    gst_quicrelay_stop (relay);
+    break;
+  default:
+    break;
+  }
+
+  return rv;
+}
+
+static gboolean
+quicrelay_user_handshake_complete (GstQuicLibCommonUser *self,
+    GstQuicLibTransportContext *ctx, GInetSocketAddress *remote,
+    const gchar *alpn, GstQuicLibTransportConnection *conn)
+{
+  GstQuicRelay *relay = GST_QUICRELAY (self);
+  gchar *addr = g_socket_connectable_to_string (G_SOCKET_CONNECTABLE (remote));
+  GList *it;
+
+  g_mutex_lock (&relay->mutex);
+
+  if (conn == relay->upstream) {
+    GST_DEBUG_OBJECT (relay, "Connected to upstream peer %s, relaying to %u "
+        "downstream peers", addr, g_list_length (relay->downstreams));
+
+    relay->upstream_open = TRUE;
+    for (it = relay->downstreams; it != NULL; it = it->next) {
+      quicrelay_add_downstream_rule (relay,
+          GST_QUICLIB_TRANSPORT_CONNECTION (it->data));
+    }
+  } else if (g_list_find (relay->downstreams, conn) == NULL) {
+    relay->downstreams = g_list_append (relay->downstreams,
+        g_object_ref (conn));
+
+    GST_DEBUG_OBJECT (relay, "New downstream peer %s, %u downstream peers",
+        addr, g_list_length (relay->downstreams));
+
+    if (relay->upstream_open) {
+      quicrelay_add_downstream_rule (relay, conn);
+    }
+  }
+
+  g_mutex_unlock (&relay->mutex);
+
+  g_free (addr);
+
+  gst_quiclib_handshake_complete_signal_emit (relay,
+      G_SOCKET_ADDRESS (remote), alpn);
+
+  return TRUE;
+}
+
+static void
+quicrelay_user_stream_data (GstQuicLibCommonUser *self,
+    GstQuicLibTransportContext *ctx, GstBuffer *buf)
+{
+  GstQuicRelay *relay = GST_QUICRELAY (self);
+
+  /* Only data that isn't relayed ends up here, such as from downstream */
+  GST_LOG_OBJECT (relay, "Ignoring %lu bytes of stream data from %p",
+      gst_buffer_get_size (buf), ctx);
+
+  gst_buffer_unref (buf);
+}
+
+static void
+quicrelay_user_datagram_data (GstQuicLibCommonUser *self,
+    GstQuicLibTransportContext *ctx, GstBuffer *buf)
+{
+  GstQuicRelay *relay = GST_QUICRELAY (self);
+
+  GST_LOG_OBJECT (relay, "Ignoring DATAGRAM of %lu bytes from %p",
+      gst_buffer_get_size (buf), ctx);
+
+  gst_buffer_unref (buf);
+}
+
+static gboolean
+quicrelay_user_connection_error (GstQuicLibCommonUser *self,
+    GstQuicLibTransportContext *ctx, guint64 error)
+{
+  GstQuicRelay *relay = GST_QUICRELAY (self);
+
+  GST_DEBUG_OBJECT (relay, "Connection %p error: %lu", ctx, error);
+
+  return FALSE;
+}
+
+static void
+quicrelay_user_connection_closed (GstQuicLibCommonUser *self,
+    GstQuicLibTransportContext *ctx, GInetSocketAddress *remote)
+{
+  GstQuicRelay *relay = GST_QUICRELAY (self);
+  gchar *addr = g_socket_connectable_to_string (G_SOCKET_CONNECTABLE (remote));
+  GList *link;
+
+  g_mutex_lock (&relay->mutex);
+
+  if (ctx == GST_QUICLIB_TRANSPORT_CONTEXT (relay->upstream)) {
+    GST_WARNING_OBJECT (relay, "Upstream connection to %s closed", addr);
+    relay->upstream_open = FALSE;
+    g_mutex_unlock (&relay->mutex);
+    GST_ELEMENT_ERROR (relay, RESOURCE, READ, ("Upstream connection closed"),
+        ("Connection to %s closed", addr));
+    g_free (addr);
+    return;
+  }
+
+  link = g_list_find (relay->downstreams, ctx);
+  if (link != NULL) {
+    if (relay->upstream != NULL) {
+      gst_quiclib_transport_relay_remove (relay->upstream,
+          GST_QUICLIB_TRANSPORT_CONNECTION (ctx));
+    }
+    g_object_unref (link->data);
+    relay->downstreams = g_list_delete_link (relay->downstreams, link);
+
+    GST_DEBUG_OBJECT (relay, "Downstream peer %s left, %u downstream peers",
+        addr, g_list_length (relay->downstreams));
+  }
+
+  g_mutex_unlock (&relay->mutex);
+
+  gst_quiclib_conn_closed_signal_emit (relay, G_SOCKET_ADDRESS (remote));
+
+  g_free (addr);
+}
+
+static void gst_quicrelay_common_user_interface_init (gpointer g_iface,
+    gpointer iface_data)
+{
+  GstQuicLibCommonUserInterface *iface = g_iface;
+
+  iface->new_connection = NULL;
+  iface->handshake_complete = quicrelay_user_handshake_complete;
+  iface->stream_opened = NULL;
+  iface->stream_closed = NULL;
+  iface->stream_data = quicrelay_user_stream_data;
+  iface->stream_ackd = NULL;
+  iface->datagram_data = quicrelay_user_datagram_data;
+  iface->datagram_ackd = NULL;
+  iface->connection_error = quicrelay_user_connection_error;
+  iface->connection_closed = quicrelay_user_connection_closed;
+}
+
+static gboolean
+quicrelay_init (GstPlugin * quicrelay)
+{
+  GST_DEBUG_CATEGORY_INIT (gst_quicrelay_debug, "quicrelay",
+      0, "QUIC relay");
+
+  return GST_ELEMENT_REGISTER (quicrelay, quicrelay);
+}
+
+#ifndef PACKAGE
+#define PACKAGE "quicrelay"
+#endif
+
+GST_PLUGIN_DEFINE (GST_VERSION_MAJOR,
+    GST_VERSION_MINOR,
+    quicrelay,
+    "quicrelay",
+    quicrelay_init,
+    PACKAGE_VERSION, GST_LICENSE, GST_PACKAGE_NAME, GST_PACKAGE_ORIGIN)
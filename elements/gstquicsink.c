@@ -59,6 +59,45 @@
  * must always be tagged with GstQuicLibStreamMeta if they contain stream frame
  * data or GstQuicLibDatagramMeta if they contain datagram frame data, which
  * quicmux is guaranteed to always do.
+ *
+ * Setting the stripe-connections property above 1 opens that many connections
+ * to the peer, each with its own congestion controller. New streams are opened
+ * on the connection chosen by the path-scheduler property, and datagrams are
+ * spread the same way. The stream IDs given to quicmux are remapped to be
+ * unique across all of the connections. The redundant scheduler instead sends
+ * each datagram on every connection, tagged with a sequence number so that a
+ * quicsrc receiving the stripe can drop the duplicates. This is agreed with
+ * the server in the handshake of each connection, and connections where it
+ * isn't get no redundant copies.
+ *
+ * The underlying QUIC stack doesn't support the multipath extension, so
+ * multipath is built on the same striping. In client mode, the
+ * multipath-addresses property opens one striped connection bound to each of
+ * the local addresses given, for example one per bonded cellular or Wi-Fi
+ * interface. The statistics for each path can be read by calling
+ * gst_quiclib_transport_get_conn_stats on each entry of the quic-stripes
+ * property, which are in the same order as the addresses.
+ *
+ * The sink estimates how much the connection can carry from its congestion
+ * window, the rate at which data is being acknowledged and how much queueing
+ * delay is building up on the path. It answers bitrate queries with this
+ * estimate, and sends it upstream in a quic-bitrate-hint event every
+ * bitrate-hint-interval milliseconds, or sooner if the estimate falls sharply,
+ * so that adaptive encoders can track the available capacity.
+ *
+ * With the probe-duration property set, the spare congestion window is filled
+ * with probe datagrams for that long after the handshake so that the estimate
+ * reaches the path capacity without waiting for the media to ramp up. When
+ * probing ends, the capacity it found is posted in a quic-capacity-probe
+ * element message and sent upstream in a bitrate hint straight away, so that
+ * adaptive bitrate logic can start at the right rendition. The receiving
+ * quicsrc needs probe-duration set as well, or it passes the probes on.
+ *
+ * Latency queries are answered with the upstream latency plus how long
+ * buffers wait for the connection to take them, smoothed for the minimum and
+ * with four mean deviations added for the maximum. The network latency itself
+ * is reported by the quicsrc at the receiving end. A latency message is
+ * posted when this send delay moves significantly.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -71,6 +110,7 @@
 #include "gstquictransport.h"
 #include "gstquicsignals.h"
 #include "gstquicstream.h"
+#include "gstquicdatagram.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_quicsink_debug);
 #define GST_CAT_DEFAULT gst_quicsink_debug
@@ -79,7 +119,13 @@ enum
 {
   PROP_0,
   PROP_QUIC_ENDPOINT_ENUMS,
-  PROP_QUIC_CONNECTION_CTX
+  PROP_QUIC_CONNECTION_CTX,
+  PROP_QUIC_STRIPES_CTX,
+  PROP_STRIPE_CONNECTIONS,
+  PROP_MULTIPATH_ADDRESSES,
+  PROP_PATH_SCHEDULER,
+  PROP_PATH_WEIGHTS,
+  PROP_BITRATE_HINT_INTERVAL
 };
 
 static guint signals[GST_QUICLIB_SIGNALS_MAX];
@@ -109,6 +155,7 @@ static void gst_quicsink_set_property (GObject * object,
     guint prop_id, const GValue * value, GParamSpec * pspec);
 static void gst_quicsink_get_property (GObject * object,
     guint prop_id, GValue * value, GParamSpec * pspec);
+static void gst_quicsink_finalize (GObject * object);
 
 static GstStateChangeReturn gst_quicsink_change_state (GstElement *elem,
     GstStateChange t);
@@ -120,9 +167,91 @@ static GstFlowReturn gst_quicsink_render (GstBaseSink * sink,
 
 static gboolean gst_quicsink_quiclib_listen (GstQuicSink *sink);
 static gboolean gst_quicsink_quiclib_connect (GstQuicSink *sink);
+static gboolean gst_quicsink_quiclib_connect_stripe (GstQuicSink *sink,
+    GstQuicLibTransportConnection *conn);
 static gboolean gst_quicsink_quiclib_disconnect (GstQuicSink *sink);
 static gboolean gst_quicsink_quiclib_stop_listen (GstQuicSink *sink);
 
+/*
+ * Parse the multipath-addresses property into a list of local socket
+ * addresses with port 0. Entries that aren't IP addresses are skipped. Call
+ * with the sink mutex held.
+ */
+static GPtrArray *
+quicsink_parse_multipath_addresses (GstQuicSink *sink)
+{
+  GPtrArray *addrs = g_ptr_array_new_with_free_func (g_object_unref);
+  gchar **entries;
+  guint i;
+
+  if (sink->multipath_addresses == NULL) {
+    return addrs;
+  }
+
+  entries = g_strsplit (sink->multipath_addresses, ",", -1);
+
+  for (i = 0; entries[i] != NULL; i++) {
+    GInetAddress *addr;
+
+    g_strstrip (entries[i]);
+    if (*entries[i] == '\0') {
+      continue;
+    }
+
+    addr = g_inet_address_new_from_string (entries[i]);
+    if (addr == NULL) {
+      GST_WARNING_OBJECT (sink, "Ignoring multipath address \"%s\", it isn't "
+          "an IP address", entries[i]);
+      continue;
+    }
+
+    g_ptr_array_add (addrs, g_inet_socket_address_new (addr, 0));
+    g_object_unref (addr);
+  }
+
+  g_strfreev (entries);
+
+  return addrs;
+}
+
+/*
+ * Parse the path-weights property into a weight for every possible stripe,
+ * and reset the weighted scheduler. Call with the sink mutex held.
+ */
+static void
+quicsink_parse_path_weights (GstQuicSink *sink)
+{
+  gchar **entries = NULL;
+  guint i;
+
+  g_free (sink->path_weight);
+  g_free (sink->path_credit);
+  sink->path_weight = g_new (guint, sink->stripe_connections);
+  sink->path_credit = g_new0 (gint64, sink->stripe_connections);
+
+  if (sink->path_weights != NULL) {
+    entries = g_strsplit (sink->path_weights, ",", -1);
+  }
+
+  for (i = 0; i < sink->stripe_connections; i++) {
+    sink->path_weight[i] = 1;
+
+    if (entries != NULL && i < g_strv_length (entries)) {
+      guint64 weight;
+
+      if (g_ascii_string_to_unsigned (g_strstrip (entries[i]), 10, 0,
+          G_MAXUINT16, &weight, NULL)) {
+        sink->path_weight[i] = (guint) weight;
+      } else {
+        GST_WARNING_OBJECT (sink, "Invalid weight \"%s\" for path %u",
+            entries[i], i);
+      }
+    }
+  }
+
+  g_strfreev (entries);
+}
+
 static gboolean
 gst_quicsink_quiclib_listen (GstQuicSink *sink)
 {
@@ -147,7 +276,34 @@ gst_quicsink_quiclib_listen (GstQuicSink *sink)
       PROP_MAX_STREAM_DATA_UNI_REMOTE_SHORTNAME,
       sink->max_stream_data_uni_remote_init,
       PROP_MAX_DATA_REMOTE_SHORTNAME, sink->max_data_remote_init,
-      PROP_ENABLE_DATAGRAM_SHORTNAME, sink->enable_datagram, NULL);
+      PROP_ENABLE_DATAGRAM_SHORTNAME, sink->enable_datagram,
+      PROP_BUSY_POLL_SHORTNAME, sink->busy_poll,
+      PROP_BUSY_POLL_BUDGET_SHORTNAME, sink->busy_poll_budget,
+      PROP_CPU_AFFINITY_SHORTNAME, sink->cpu_affinity,
+      PROP_ASYNC_CPU_AFFINITY_SHORTNAME, sink->async_cpu_affinity,
+      PROP_THREAD_SCHED_POLICY_SHORTNAME, sink->thread_sched_policy,
+      PROP_THREAD_PRIORITY_SHORTNAME, sink->thread_priority,
+      PROP_IO_BACKEND_SHORTNAME, sink->io_backend,
+      PROP_ZEROCOPY_THRESHOLD_SHORTNAME, sink->zerocopy_threshold,
+      PROP_DSCP_SHORTNAME, sink->dscp,
+      PROP_RATE_LIMIT_SHORTNAME, sink->rate_limit,
+      PROP_RATE_BURST_SHORTNAME, sink->rate_burst,
+      PROP_PROBE_DURATION_SHORTNAME, sink->probe_duration,
+      PROP_EGRESS_RATE_LIMIT_SHORTNAME, sink->egress_rate_limit,
+      PROP_ADMISSION_MAX_LOAD_SHORTNAME, sink->admission_max_load,
+      PROP_ADMISSION_MAX_HANDSHAKES_SHORTNAME, sink->admission_max_handshakes,
+      PROP_ADMISSION_MAX_MEMORY_SHORTNAME, sink->admission_max_memory,
+      PROP_ADMISSION_ACTION_SHORTNAME, sink->admission_action,
+      PROP_ADMISSION_SHED_IDLE_SHORTNAME, sink->admission_shed_idle,
+      PROP_CONN_MEMORY_LIMIT_SHORTNAME, sink->conn_memory_limit,
+      PROP_SERVER_MEMORY_LIMIT_SHORTNAME, sink->server_memory_limit,
+      PROP_IDLE_MODE_SHORTNAME, sink->idle_mode,
+      PROP_XDP_INTERFACE_SHORTNAME, sink->xdp_interface,
+      PROP_XDP_QUEUE_SHORTNAME, sink->xdp_queue,
+      PROP_XDP_SKB_MODE_SHORTNAME, sink->xdp_skb_mode,
+      PROP_QUIC_LB_SERVER_ID_SHORTNAME, sink->quic_lb_server_id,
+      PROP_QUIC_LB_KEY_SHORTNAME, sink->quic_lb_key,
+      PROP_PREFERRED_ADDRESS_SHORTNAME, sink->preferred_address, NULL);
 
   if (gst_quiclib_transport_get_state (
         GST_QUICLIB_TRANSPORT_CONTEXT (sink->server_ctx)) == QUIC_STATE_NONE) {
@@ -167,18 +323,108 @@ gst_quicsink_quiclib_listen (GstQuicSink *sink)
 static gboolean
 gst_quicsink_quiclib_connect (GstQuicSink *sink)
 {
+  GPtrArray *local_addrs;
+  guint64 stripe_id = 0;
+  guint i;
+
   g_return_val_if_fail (sink->mode == QUICLIB_MODE_CLIENT, FALSE);
 
   gst_quicsink_quiclib_disconnect (sink);
 
   g_mutex_lock (&sink->mutex);
 
-  GST_TRACE_OBJECT (sink, "Connecting to %s with ALPN %s", sink->location,
-      sink->alpn);
-  sink->conn = gst_quiclib_get_client (GST_QUICLIB_COMMON_USER (sink),
-      sink->location, sink->alpn);
+  /* With multipath, there is a stripe for every local address */
+  local_addrs = quicsink_parse_multipath_addresses (sink);
+  if (local_addrs->len > 0) {
+    sink->stripe_connections = MIN (local_addrs->len,
+        QUICLIB_STRIPE_CONNECTIONS_MAX);
+  }
+
+  quicsink_parse_path_weights (sink);
+
+  /*
+   * Every connection in a stripe carries the same random session ID, so that
+   * the server only puts connections from this element in the same stripe.
+   */
+  while (sink->stripe_connections > 1 && stripe_id == 0) {
+    stripe_id = ((guint64) g_random_int () << 32) | g_random_int ();
+  }
+
+  sink->stripes = g_ptr_array_new ();
 
-  g_object_set (sink->conn,
+  for (i = 0; i < sink->stripe_connections; i++) {
+    GstQuicLibTransportConnection *conn;
+
+    GST_TRACE_OBJECT (sink, "Connecting to %s with ALPN %s (stripe %u of %u)",
+        sink->location, sink->alpn, i + 1, sink->stripe_connections);
+
+    /*
+     * Without striping, the connection can be shared with other elements
+     * talking to the same peer, but a stripe, and any connection bound to a
+     * particular local address, has to be our own.
+     */
+    if (stripe_id == 0 && local_addrs->len == 0) {
+      conn = gst_quiclib_get_client (GST_QUICLIB_COMMON_USER (sink),
+          sink->location, sink->alpn);
+    } else {
+      conn = gst_quiclib_new_client (GST_QUICLIB_COMMON_USER (sink),
+          sink->location, sink->alpn);
+    }
+
+    if (conn == NULL) {
+      break;
+    }
+
+    if (i < local_addrs->len) {
+      gst_quiclib_transport_client_set_local_address (conn,
+          G_INET_SOCKET_ADDRESS (g_ptr_array_index (local_addrs, i)));
+    }
+
+    if (stripe_id != 0) {
+      gst_quiclib_transport_client_set_stripe_id (conn, stripe_id);
+      if (sink->path_scheduler == QUICLIB_PATH_SCHEDULER_REDUNDANT) {
+        gst_quiclib_transport_client_set_stripe_redundant (conn, TRUE);
+      }
+    }
+
+    if (!gst_quicsink_quiclib_connect_stripe (sink, conn)) {
+      break;
+    }
+
+    g_ptr_array_add (sink->stripes, conn);
+  }
+
+  g_ptr_array_free (local_addrs, TRUE);
+
+  if (sink->stripes->len == 0) {
+    g_ptr_array_free (sink->stripes, TRUE);
+    sink->stripes = NULL;
+    g_mutex_unlock (&sink->mutex);
+    return FALSE;
+  }
+
+  sink->conn = GST_QUICLIB_TRANSPORT_CONNECTION (
+      g_ptr_array_index (sink->stripes, 0));
+
+  if (sink->stripes->len < sink->stripe_connections) {
+    GST_WARNING_OBJECT (sink, "Only opened %u of %u striped connections",
+        sink->stripes->len, sink->stripe_connections);
+  }
+
+  g_mutex_unlock (&sink->mutex);
+
+  return sink->conn != NULL;
+}
+
+/*
+ * Configure and start a single client connection. Call with the sink mutex
+ * held.
+ */
+static gboolean
+gst_quicsink_quiclib_connect_stripe (GstQuicSink *sink,
+    GstQuicLibTransportConnection *conn)
+{
+  g_object_set (conn,
       PROP_MAX_STREAMS_BIDI_REMOTE_SHORTNAME,
       sink->max_streams_bidi_remote_init,
       PROP_MAX_STREAMS_UNI_REMOTE_SHORTNAME, sink->max_streams_uni_remote_init,
@@ -187,21 +433,44 @@ gst_quicsink_quiclib_connect (GstQuicSink *sink)
       PROP_MAX_STREAM_DATA_UNI_REMOTE_SHORTNAME,
       sink->max_stream_data_uni_remote_init,
       PROP_MAX_DATA_REMOTE_SHORTNAME, sink->max_data_remote_init,
-      PROP_ENABLE_DATAGRAM_SHORTNAME, sink->enable_datagram, NULL);
+      PROP_ENABLE_DATAGRAM_SHORTNAME, sink->enable_datagram,
+      PROP_BUSY_POLL_SHORTNAME, sink->busy_poll,
+      PROP_BUSY_POLL_BUDGET_SHORTNAME, sink->busy_poll_budget,
+      PROP_CPU_AFFINITY_SHORTNAME, sink->cpu_affinity,
+      PROP_ASYNC_CPU_AFFINITY_SHORTNAME, sink->async_cpu_affinity,
+      PROP_THREAD_SCHED_POLICY_SHORTNAME, sink->thread_sched_policy,
+      PROP_THREAD_PRIORITY_SHORTNAME, sink->thread_priority,
+      PROP_IO_BACKEND_SHORTNAME, sink->io_backend,
+      PROP_ZEROCOPY_THRESHOLD_SHORTNAME, sink->zerocopy_threshold,
+      PROP_DSCP_SHORTNAME, sink->dscp,
+      PROP_RATE_LIMIT_SHORTNAME, sink->rate_limit,
+      PROP_RATE_BURST_SHORTNAME, sink->rate_burst,
+      PROP_PROBE_DURATION_SHORTNAME, sink->probe_duration,
+      PROP_EGRESS_RATE_LIMIT_SHORTNAME, sink->egress_rate_limit,
+      PROP_ADMISSION_MAX_LOAD_SHORTNAME, sink->admission_max_load,
+      PROP_ADMISSION_MAX_HANDSHAKES_SHORTNAME, sink->admission_max_handshakes,
+      PROP_ADMISSION_MAX_MEMORY_SHORTNAME, sink->admission_max_memory,
+      PROP_ADMISSION_ACTION_SHORTNAME, sink->admission_action,
+      PROP_ADMISSION_SHED_IDLE_SHORTNAME, sink->admission_shed_idle,
+      PROP_CONN_MEMORY_LIMIT_SHORTNAME, sink->conn_memory_limit,
+      PROP_SERVER_MEMORY_LIMIT_SHORTNAME, sink->server_memory_limit,
+      PROP_IDLE_MODE_SHORTNAME, sink->idle_mode,
+      PROP_XDP_INTERFACE_SHORTNAME, sink->xdp_interface,
+      PROP_XDP_QUEUE_SHORTNAME, sink->xdp_queue,
+      PROP_XDP_SKB_MODE_SHORTNAME, sink->xdp_skb_mode, NULL);
 
   if (gst_quiclib_transport_get_state (
-        GST_QUICLIB_TRANSPORT_CONTEXT (sink->conn)) == QUIC_STATE_NONE) {
-    if (!gst_quiclib_transport_client_connect (sink->conn)) {
+        GST_QUICLIB_TRANSPORT_CONTEXT (conn)) == QUIC_STATE_NONE) {
+    if (!gst_quiclib_transport_client_connect (conn)) {
       GST_ERROR_OBJECT (sink, "Couldn't open client connection with location %s",
           sink->location);
-      gst_quiclib_unref (GST_QUICLIB_TRANSPORT_CONTEXT (sink->conn),
+      gst_quiclib_unref (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
           GST_QUICLIB_COMMON_USER (sink));
+      return FALSE;
     }
   }
 
-  g_mutex_unlock (&sink->mutex);
-
-  return sink->conn != NULL;
+  return TRUE;
 }
 
 static gboolean
@@ -211,9 +480,19 @@ gst_quicsink_quiclib_disconnect (GstQuicSink *sink)
   GST_TRACE_OBJECT (sink, "Disconnect called - %sactive connection",
       (sink->conn)?(""):("no "));
   if (sink->conn != NULL) {
-    gst_quiclib_unref (GST_QUICLIB_TRANSPORT_CONTEXT (sink->conn),
-        GST_QUICLIB_COMMON_USER (sink));
+    guint i;
+
+    for (i = 0; i < sink->stripes->len; i++) {
+      gst_quiclib_unref (GST_QUICLIB_TRANSPORT_CONTEXT (
+          g_ptr_array_index (sink->stripes, i)),
+          GST_QUICLIB_COMMON_USER (sink));
+    }
+    g_ptr_array_free (sink->stripes, TRUE);
+    sink->stripes = NULL;
+    g_clear_pointer (&sink->path_weight, g_free);
+    g_clear_pointer (&sink->path_credit, g_free);
     sink->conn = NULL;
+    sink->probe_reported = FALSE;
     g_mutex_unlock (&sink->mutex);
     return TRUE;
   }
@@ -246,6 +525,318 @@ gst_quicsink_quiclib_stop_listen (GstQuicSink *sink)
   return FALSE;
 }
 
+/*
+ * Connection striping helpers.
+ *
+ * Stream IDs handed upstream are mapped with gst_quiclib_stripe_stream_id so
+ * that they're unique across every connection in the stripe. With a single
+ * connection the mapping does nothing. The stripes array is only changed
+ * while connecting, on handshake completion and while disconnecting, so
+ * like conn it can be read from the transport callbacks without the lock.
+ */
+static gint
+quicsink_stripe_index (GstQuicSink *sink, GstQuicLibTransportContext *ctx)
+{
+  guint i;
+
+  if (sink->stripes == NULL) {
+    return -1;
+  }
+
+  for (i = 0; i < sink->stripes->len; i++) {
+    if (g_ptr_array_index (sink->stripes, i) == (gpointer) ctx) {
+      return (gint) i;
+    }
+  }
+
+  return -1;
+}
+
+static guint64
+quicsink_stripe_stream_id (GstQuicSink *sink, GstQuicLibTransportContext *ctx,
+    guint64 stream_id)
+{
+  gint stripe = quicsink_stripe_index (sink, ctx);
+
+  if (stripe < 0) {
+    return stream_id;
+  }
+
+  return gst_quiclib_stripe_stream_id (stream_id, (guint) stripe,
+      sink->stripe_connections);
+}
+
+/*
+ * Find the connection a stream belongs to, and the ID that connection knows
+ * it by. Call with the sink mutex held.
+ */
+static GstQuicLibTransportConnection *
+quicsink_stream_conn (GstQuicSink *sink, guint64 stream_id,
+    guint64 *conn_stream_id)
+{
+  guint stripe;
+
+  if (sink->stripes == NULL) {
+    *conn_stream_id = stream_id;
+    return sink->conn;
+  }
+
+  *conn_stream_id = gst_quiclib_unstripe_stream_id (stream_id,
+      sink->stripe_connections, &stripe);
+
+  if (stripe >= sink->stripes->len) {
+    return NULL;
+  }
+
+  return GST_QUICLIB_TRANSPORT_CONNECTION (
+      g_ptr_array_index (sink->stripes, stripe));
+}
+
+/*
+ * Pick the connection to carry a new stream or datagram, according to the
+ * path scheduler:
+ *
+ * least-loaded: The smallest share of its congestion window in flight.
+ * min-rtt and redundant: The lowest smoothed RTT, preferring connections that
+ *     still have room in their congestion window.
+ * weighted: Smooth weighted round-robin, so each connection gets its share
+ *     of path-weights without bursts.
+ *
+ * Only open connections are considered. The search starts after the last
+ * connection picked, so that ties are shared out evenly. Call with the sink
+ * mutex held.
+ *
+ * Returns the stripe index, or -1 if no connection is open.
+ */
+static gint
+quicsink_pick_stripe (GstQuicSink *sink)
+{
+  guint64 best_load = G_MAXUINT64;
+  guint64 best_rtt = G_MAXUINT64;
+  gboolean best_has_window = FALSE;
+  gint64 total_weight = 0;
+  gint best = -1;
+  guint i;
+
+  if (sink->stripes == NULL || sink->stripes->len == 0) {
+    return -1;
+  }
+
+  for (i = 0; i < sink->stripes->len; i++) {
+    guint stripe = (sink->next_stripe + i) % sink->stripes->len;
+    GstQuicLibTransportConnection *conn = GST_QUICLIB_TRANSPORT_CONNECTION (
+        g_ptr_array_index (sink->stripes, stripe));
+    guint64 rtt, cwnd, bytes_in_flight;
+
+    if (gst_quiclib_transport_get_state (GST_QUICLIB_TRANSPORT_CONTEXT (conn))
+        != QUIC_STATE_OPEN) {
+      continue;
+    }
+
+    if (sink->path_scheduler == QUICLIB_PATH_SCHEDULER_WEIGHTED) {
+      sink->path_credit[stripe] += sink->path_weight[stripe];
+      total_weight += sink->path_weight[stripe];
+      if (best < 0 || sink->path_credit[stripe] > sink->path_credit[best]) {
+        best = (gint) stripe;
+      }
+      continue;
+    }
+
+    if (!gst_quiclib_transport_get_path_load (conn, &rtt, &cwnd,
+        &bytes_in_flight)) {
+      continue;
+    }
+
+    switch (sink->path_scheduler) {
+      case QUICLIB_PATH_SCHEDULER_MIN_RTT:
+      case QUICLIB_PATH_SCHEDULER_REDUNDANT:
+      {
+        gboolean has_window = bytes_in_flight < cwnd;
+
+        if ((has_window && !best_has_window) ||
+            (has_window == best_has_window && rtt < best_rtt)) {
+          best_has_window = has_window;
+          best_rtt = rtt;
+          best = (gint) stripe;
+        }
+        break;
+      }
+      default:
+      {
+        guint64 load = (bytes_in_flight * 1000) / MAX (cwnd, 1);
+
+        if (load < best_load) {
+          best_load = load;
+          best = (gint) stripe;
+        }
+        break;
+      }
+    }
+  }
+
+  if (best < 0) {
+    return -1;
+  }
+
+  if (sink->path_scheduler == QUICLIB_PATH_SCHEDULER_WEIGHTED) {
+    sink->path_credit[best] -= total_weight;
+  }
+
+  sink->next_stripe = (best + 1) % sink->stripes->len;
+
+  return best;
+}
+
+/*
+ * Returns a copy of a datagram with the next redundant datagram sequence
+ * number in front of it. Call with the sink mutex held.
+ */
+static GstBuffer *
+quicsink_redundant_frame (GstQuicSink *sink, GstBuffer *buffer)
+{
+  GstQuicLibDatagramMeta *meta;
+  guint8 *header;
+
+  header = g_malloc (QUICLIB_REDUNDANT_HEADER_LEN);
+  GST_WRITE_UINT64_BE (header, ++sink->redundant_seq);
+
+  buffer = gst_buffer_copy (buffer);
+  gst_buffer_prepend_memory (buffer, gst_memory_new_wrapped (0, header,
+        QUICLIB_REDUNDANT_HEADER_LEN, 0, QUICLIB_REDUNDANT_HEADER_LEN, header,
+        g_free));
+  meta = gst_buffer_get_quiclib_datagram_meta (buffer);
+  meta->length += QUICLIB_REDUNDANT_HEADER_LEN;
+
+  return buffer;
+}
+
+/*
+ * Whether any open connection has agreed to carry redundant datagrams. Call
+ * with the sink mutex held.
+ */
+static gboolean
+quicsink_redundant_negotiated (GstQuicSink *sink)
+{
+  guint i;
+
+  for (i = 0; i < sink->stripes->len; i++) {
+    GstQuicLibTransportConnection *conn = GST_QUICLIB_TRANSPORT_CONNECTION (
+        g_ptr_array_index (sink->stripes, i));
+
+    if (gst_quiclib_transport_get_state (GST_QUICLIB_TRANSPORT_CONTEXT (conn))
+        == QUIC_STATE_OPEN &&
+        gst_quiclib_transport_get_stripe_redundant (conn)) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/*
+ * Send a datagram on every open connection that has agreed to carry redundant
+ * datagrams, for the redundant scheduler. Each copy carries the same sequence
+ * number, so that the quicsrc at the other end can discard all but the first
+ * to arrive. A connection whose server didn't agree would pass the duplicates
+ * on, so it gets none. Call with the sink mutex held.
+ */
+static GstFlowReturn
+quicsink_send_redundant_datagram (GstQuicSink *sink, GstBuffer *buffer)
+{
+  GstQuicLibError err = GST_QUICLIB_ERR;
+  guint sent = 0;
+  guint i;
+
+  buffer = quicsink_redundant_frame (sink, buffer);
+
+  for (i = 0; i < sink->stripes->len; i++) {
+    GstQuicLibTransportConnection *conn = GST_QUICLIB_TRANSPORT_CONNECTION (
+        g_ptr_array_index (sink->stripes, i));
+    gssize b_sent = 0;
+
+    if (gst_quiclib_transport_get_state (GST_QUICLIB_TRANSPORT_CONTEXT (conn))
+        != QUIC_STATE_OPEN ||
+        !gst_quiclib_transport_get_stripe_redundant (conn)) {
+      continue;
+    }
+
+    err = gst_quiclib_transport_send_buffer (conn, buffer, &b_sent);
+    if (err == GST_QUICLIB_ERR_OK) {
+      sent++;
+    } else {
+      GST_DEBUG_OBJECT (sink, "Couldn't send redundant datagram on path %u: "
+          "%s", i, gst_quiclib_error_as_string (err));
+    }
+  }
+
+  gst_buffer_unref (buffer);
+
+  GST_TRACE_OBJECT (sink, "Sent datagram %" G_GUINT64_FORMAT " on %u paths",
+      sink->redundant_seq, sent);
+
+  if (sent > 0) {
+    return GST_FLOW_OK;
+  }
+
+  switch (err) {
+    case GST_QUICLIB_ERR_CONN_DATA_BLOCKED:
+      return GST_FLOW_QUIC_BLOCKED;
+    case GST_QUICLIB_ERR_EXTENSION_NOT_SUPPORTED:
+      return GST_FLOW_QUIC_EXTENSION_NOT_SUPPORTED;
+    default:
+      return GST_FLOW_ERROR;
+  }
+}
+
+/*
+ * Work out which connection a buffer goes out on. Stream frames go on the
+ * connection their stream was opened on, under the ID that connection knows
+ * it by, which needs a copy of the buffer as the one being rendered can't be
+ * changed. Datagrams go on whichever connection the path scheduler picks.
+ * Call with the sink mutex held.
+ */
+static GstQuicLibTransportConnection *
+quicsink_stripe_buffer (GstQuicSink *sink, GstBuffer **buffer)
+{
+  GstQuicLibStreamMeta *stream_meta;
+  GstQuicLibTransportConnection *conn;
+  guint64 stream_id;
+  gint stripe;
+
+  stream_meta = gst_buffer_get_quiclib_stream_meta (*buffer);
+
+  if (sink->stripes == NULL || sink->stripes->len <= 1) {
+    conn = sink->conn;
+  } else if (stream_meta == NULL) {
+    stripe = quicsink_pick_stripe (sink);
+    if (stripe < 0) {
+      conn = sink->conn;
+    } else {
+      conn = GST_QUICLIB_TRANSPORT_CONNECTION (
+          g_ptr_array_index (sink->stripes, stripe));
+    }
+  } else {
+    conn = quicsink_stream_conn (sink, stream_meta->stream_id, &stream_id);
+    if (conn == NULL) {
+      return NULL;
+    }
+
+    *buffer = gst_buffer_copy (*buffer);
+    stream_meta = gst_buffer_get_quiclib_stream_meta (*buffer);
+    stream_meta->stream_id = stream_id;
+
+    return conn;
+  }
+
+  /* Every datagram on a connection carrying redundant datagrams is framed */
+  if (stream_meta == NULL && conn != NULL &&
+      gst_quiclib_transport_get_stripe_redundant (conn)) {
+    *buffer = quicsink_redundant_frame (sink, *buffer);
+  }
+
+  return conn;
+}
+
 /* GObject vmethod implementations */
 
 /* initialize the quicsink's class */
@@ -262,6 +853,7 @@ gst_quicsink_class_init (GstQuicSinkClass * klass)
 
   gobject_class->set_property = gst_quicsink_set_property;
   gobject_class->get_property = gst_quicsink_get_property;
+  gobject_class->finalize = gst_quicsink_finalize;
 
   gstelement_class->change_state = gst_quicsink_change_state;
   gstelement_class->query = gst_quicsink_elem_query;
@@ -279,6 +871,23 @@ gst_quicsink_class_init (GstQuicSinkClass * klass)
       g_param_spec_pointer ("quic-ctx", "QUIC Transport Context",
           "Underlying QUIC transport context", G_PARAM_READABLE));
 
+  g_object_class_install_property (gobject_class, PROP_QUIC_STRIPES_CTX,
+      g_param_spec_pointer ("quic-stripes", "QUIC Striped Connections",
+          "GPtrArray of every striped QUIC transport connection, for use with "
+          "gst_quiclib_transport_get_striped_conn_stats", G_PARAM_READABLE));
+
+  gst_quiclib_common_install_stripe_connections_property (gobject_class);
+  gst_quiclib_common_install_multipath_addresses_property (gobject_class);
+  gst_quiclib_common_install_path_scheduler_property (gobject_class);
+  gst_quiclib_common_install_path_weights_property (gobject_class);
+
+  g_object_class_install_property (gobject_class, PROP_BITRATE_HINT_INTERVAL,
+      g_param_spec_uint ("bitrate-hint-interval", "Bitrate Hint Interval",
+          "How often to send the estimated connection capacity upstream in a "
+          "quic-bitrate-hint event, in milliseconds. 0 disables the hints",
+          0, G_MAXUINT, QUICLIB_BITRATE_HINT_INTERVAL_DEFAULT,
+          G_PARAM_READWRITE));
+
   signals[GST_QUICLIB_HANDSHAKE_COMPLETE_SIGNAL] =
     gst_quiclib_handshake_complete_signal_new (klass);
   signals[GST_QUICLIB_STREAM_OPENED_SIGNAL] =
@@ -313,10 +922,42 @@ gst_quicsink_init (GstQuicSink * sink)
 {
   gst_quiclib_common_init_endpoint_properties (sink);
 
+  sink->stripe_connections = QUICLIB_STRIPE_CONNECTIONS_DEFAULT;
+  sink->stripes = NULL;
+  sink->next_stripe = 0;
+  sink->redundant_seq = 0;
+  sink->multipath_addresses = g_strdup (QUICLIB_MULTIPATH_ADDRESSES_DEFAULT);
+  sink->path_scheduler = QUICLIB_PATH_SCHEDULER_DEFAULT;
+  sink->path_weights = g_strdup (QUICLIB_PATH_WEIGHTS_DEFAULT);
+  sink->path_weight = NULL;
+  sink->path_credit = NULL;
+  sink->bitrate_hint_interval = QUICLIB_BITRATE_HINT_INTERVAL_DEFAULT;
+  sink->last_bitrate_check = 0;
+  sink->last_bitrate_hint = 0;
+  sink->bitrate_hint = 0;
+  sink->probe_reported = FALSE;
+  sink->send_delay_smoothed = 0;
+  sink->send_delay_meandev = 0;
+  sink->reported_send_delay = GST_CLOCK_TIME_NONE;
+
   g_mutex_init (&sink->mutex);
   g_cond_init (&sink->ctx_change);
 }
 
+static void
+gst_quicsink_finalize (GObject * object)
+{
+  GstQuicSink *sink = GST_QUICSINK (object);
+
+  gst_quiclib_common_free_endpoint_properties (sink);
+  g_free (sink->multipath_addresses);
+  g_free (sink->path_weights);
+  g_mutex_clear (&sink->mutex);
+  g_cond_clear (&sink->ctx_change);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
 static void
 gst_quicsink_set_property (GObject * object, guint prop_id,
     const GValue * value, GParamSpec * pspec)
@@ -349,6 +990,46 @@ gst_quicsink_set_property (GObject * object, guint prop_id,
             "Cannot set server property %s in client mode", pspec->name);
       }
       break;
+    case PROP_STRIPE_CONNECTIONS:
+      g_mutex_lock (&sink->mutex);
+      if (sink->stripes != NULL) {
+        GST_WARNING_OBJECT (sink,
+            "Cannot change the number of striped connections while connected");
+      } else {
+        sink->stripe_connections = g_value_get_uint (value);
+      }
+      g_mutex_unlock (&sink->mutex);
+      break;
+    case PROP_MULTIPATH_ADDRESSES:
+      g_mutex_lock (&sink->mutex);
+      if (sink->stripes != NULL) {
+        GST_WARNING_OBJECT (sink,
+            "Cannot change the multipath addresses while connected");
+      } else {
+        g_free (sink->multipath_addresses);
+        sink->multipath_addresses = g_value_dup_string (value);
+      }
+      g_mutex_unlock (&sink->mutex);
+      break;
+    case PROP_PATH_SCHEDULER:
+      g_mutex_lock (&sink->mutex);
+      sink->path_scheduler = g_value_get_enum (value);
+      g_mutex_unlock (&sink->mutex);
+      break;
+    case PROP_PATH_WEIGHTS:
+      g_mutex_lock (&sink->mutex);
+      g_free (sink->path_weights);
+      sink->path_weights = g_value_dup_string (value);
+      if (sink->path_weight != NULL) {
+        quicsink_parse_path_weights (sink);
+      }
+      g_mutex_unlock (&sink->mutex);
+      break;
+    case PROP_BITRATE_HINT_INTERVAL:
+      g_mutex_lock (&sink->mutex);
+      sink->bitrate_hint_interval = g_value_get_uint (value);
+      g_mutex_unlock (&sink->mutex);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -385,6 +1066,24 @@ gst_quicsink_get_property (GObject * object, guint prop_id,
     case PROP_QUIC_CONNECTION_CTX:
       g_value_set_pointer (value, (gpointer) sink->conn);
       break;
+    case PROP_QUIC_STRIPES_CTX:
+      g_value_set_pointer (value, (gpointer) sink->stripes);
+      break;
+    case PROP_STRIPE_CONNECTIONS:
+      g_value_set_uint (value, sink->stripe_connections);
+      break;
+    case PROP_MULTIPATH_ADDRESSES:
+      g_value_set_string (value, sink->multipath_addresses);
+      break;
+    case PROP_PATH_SCHEDULER:
+      g_value_set_enum (value, sink->path_scheduler);
+      break;
+    case PROP_PATH_WEIGHTS:
+      g_value_set_string (value, sink->path_weights);
+      break;
+    case PROP_BITRATE_HINT_INTERVAL:
+      g_value_set_uint (value, sink->bitrate_hint_interval);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -436,6 +1135,155 @@ gst_quicsink_change_state (GstElement *elem, GstStateChange t)
   return rv;
 }
 
+/*
+ * The estimated capacity of the connection, or the sum across the stripe, in
+ * bits/second. Call with the sink mutex held.
+ */
+static guint64
+quicsink_bitrate_estimate (GstQuicSink *sink)
+{
+  guint64 bitrate = 0;
+  guint i;
+
+  if (sink->stripes == NULL) {
+    return gst_quiclib_transport_get_bitrate_estimate (sink->conn);
+  }
+
+  for (i = 0; i < sink->stripes->len; i++) {
+    bitrate += gst_quiclib_transport_get_bitrate_estimate (
+        GST_QUICLIB_TRANSPORT_CONNECTION (
+            g_ptr_array_index (sink->stripes, i)));
+  }
+
+  return bitrate;
+}
+
+/*
+ * The capacity found by probing the connection, or the sum across the stripe
+ * once every connection has finished probing. Call with the sink mutex held.
+ */
+static gboolean
+quicsink_probe_result (GstQuicSink *sink, guint64 *bitrate)
+{
+  guint64 stripe_bitrate;
+  guint i;
+
+  if (sink->stripes == NULL) {
+    return sink->conn != NULL &&
+        gst_quiclib_transport_get_probe_result (sink->conn, bitrate);
+  }
+
+  *bitrate = 0;
+  for (i = 0; i < sink->stripes->len; i++) {
+    if (!gst_quiclib_transport_get_probe_result (
+        GST_QUICLIB_TRANSPORT_CONNECTION (g_ptr_array_index (sink->stripes, i)),
+        &stripe_bitrate)) {
+      return FALSE;
+    }
+    *bitrate += stripe_bitrate;
+  }
+
+  return sink->stripes->len > 0;
+}
+
+/*
+ * The estimate is checked at a quarter of the hint interval. A hint is sent
+ * when the interval has passed, or straight away if the estimate has fallen
+ * by more than a quarter since the last hint, so that encoders back off
+ * before a queue builds up.
+ */
+static void
+quicsink_maybe_send_bitrate_hint (GstQuicSink *sink)
+{
+  gint64 now = g_get_monotonic_time ();
+  gint64 interval;
+  guint64 bitrate;
+
+  g_mutex_lock (&sink->mutex);
+
+  interval = (gint64) sink->bitrate_hint_interval * 1000;
+
+  if (!sink->probe_reported && sink->probe_duration > 0 &&
+      quicsink_probe_result (sink, &bitrate)) {
+    sink->probe_reported = TRUE;
+    sink->last_bitrate_check = now;
+    sink->last_bitrate_hint = now;
+    sink->bitrate_hint = bitrate;
+
+    g_mutex_unlock (&sink->mutex);
+
+    GST_INFO_OBJECT (sink, "Probing found a capacity of %lu bps", bitrate);
+
+    gst_element_post_message (GST_ELEMENT (sink),
+        gst_quiclib_new_capacity_probe_message (GST_OBJECT (sink), bitrate));
+    if (interval > 0 && bitrate > 0) {
+      gst_quiclib_new_bitrate_hint_event (GST_BASE_SINK (sink)->sinkpad,
+          bitrate);
+    }
+    return;
+  }
+
+  if (interval == 0 || now - sink->last_bitrate_check < interval / 4) {
+    g_mutex_unlock (&sink->mutex);
+    return;
+  }
+
+  sink->last_bitrate_check = now;
+  bitrate = quicsink_bitrate_estimate (sink);
+
+  if (bitrate == 0 || (now - sink->last_bitrate_hint < interval &&
+      bitrate >= sink->bitrate_hint - sink->bitrate_hint / 4)) {
+    g_mutex_unlock (&sink->mutex);
+    return;
+  }
+
+  sink->last_bitrate_hint = now;
+  sink->bitrate_hint = bitrate;
+
+  g_mutex_unlock (&sink->mutex);
+
+  GST_DEBUG_OBJECT (sink, "Sending bitrate hint of %lu bps upstream", bitrate);
+
+  gst_quiclib_new_bitrate_hint_event (GST_BASE_SINK (sink)->sinkpad, bitrate);
+}
+
+/*
+ * Fold the time a buffer waited to be sent into the smoothed send delay, in
+ * the same way RFC 9002 section 5.3 smooths the RTT. Returns TRUE if it has
+ * moved far enough from the last reported delay that the pipeline latency
+ * should be reconfigured. Call with the sink mutex held.
+ */
+static gboolean
+quicsink_update_send_delay (GstQuicSink *sink, GstClockTime delay)
+{
+  GstClockTime dev;
+
+  if (sink->send_delay_smoothed == 0) {
+    sink->send_delay_smoothed = delay;
+    sink->send_delay_meandev = delay / 2;
+  } else {
+    dev = (delay > sink->send_delay_smoothed) ?
+        (delay - sink->send_delay_smoothed) :
+        (sink->send_delay_smoothed - delay);
+    sink->send_delay_meandev = (3 * sink->send_delay_meandev + dev) / 4;
+    sink->send_delay_smoothed = (7 * sink->send_delay_smoothed + delay) / 8;
+  }
+
+  if (!gst_quiclib_latency_changed (sink->reported_send_delay,
+      sink->send_delay_smoothed)) {
+    return FALSE;
+  }
+
+  GST_INFO_OBJECT (sink, "Send delay has moved from %" GST_TIME_FORMAT " to %"
+      GST_TIME_FORMAT, GST_TIME_ARGS (sink->reported_send_delay),
+      GST_TIME_ARGS (sink->send_delay_smoothed));
+
+  /* Don't post again before the pipeline has re-queried */
+  sink->reported_send_delay = sink->send_delay_smoothed;
+
+  return TRUE;
+}
+
 static gboolean
 gst_quicsink_elem_query (GstElement *parent, GstQuery *query)
 {
@@ -523,8 +1371,28 @@ gst_quicsink_query (GstBaseSink * parent, GstQuery * query)
         g_return_val_if_fail (gst_structure_get_enum (s, QUICLIB_STREAM_TYPE,
             quiclib_stream_type_get_type (), (gint *) &type), FALSE);
 
-        stream_id = gst_quiclib_transport_open_stream (sink->conn,
-            type == QUIC_STREAM_BIDI, NULL);
+        if (sink->stripes != NULL && sink->stripes->len > 1) {
+          gint stripe = quicsink_pick_stripe (sink);
+
+          if (stripe < 0) {
+            stripe = 0;
+          }
+
+          stream_id = gst_quiclib_transport_open_stream (
+              GST_QUICLIB_TRANSPORT_CONNECTION (
+                  g_ptr_array_index (sink->stripes, stripe)),
+              type == QUIC_STREAM_BIDI, NULL);
+
+          if (stream_id >= 0) {
+            GST_LOG_OBJECT (sink, "Opened stream %ld on stripe %d", stream_id,
+                stripe);
+            stream_id = (gint64) gst_quiclib_stripe_stream_id (
+                (guint64) stream_id, (guint) stripe, sink->stripe_connections);
+          }
+        } else {
+          stream_id = gst_quiclib_transport_open_stream (sink->conn,
+              type == QUIC_STREAM_BIDI, NULL);
+        }
 
         g_mutex_unlock (&sink->mutex);
 
@@ -559,7 +1427,8 @@ gst_quicsink_query (GstBaseSink * parent, GstQuery * query)
       g_return_val_if_fail (gst_query_fill_new_quiclib_stream (query,
           stream_id, state), FALSE);
     } else if (gst_structure_has_name (s, QUICLIB_STREAM_CLOSE)) {
-      guint64 stream_id, reason;
+      GstQuicLibTransportConnection *conn;
+      guint64 stream_id, conn_stream_id, reason;
       gboolean rv;
 
       GST_LOG_OBJECT (sink, "Received stream close query");
@@ -579,14 +1448,16 @@ gst_quicsink_query (GstBaseSink * parent, GstQuery * query)
       GST_LOG_OBJECT (sink, "Asking transport to close stream %lu with reason "
           "%lu", stream_id, reason);
 
-      rv = gst_quiclib_transport_close_stream (sink->conn, stream_id,
-          reason);
+      conn = quicsink_stream_conn (sink, stream_id, &conn_stream_id);
+      rv = (conn != NULL) && gst_quiclib_transport_close_stream (conn,
+          conn_stream_id, reason);
 
       g_mutex_unlock (&sink->mutex);
       
       return rv;
     } else if (gst_structure_has_name (s, QUICLIB_STREAM_STATE)) {
-      guint64 stream_id;
+      GstQuicLibTransportConnection *conn;
+      guint64 stream_id, conn_stream_id;
       GstQuicLibStreamState state;
       gchar *statestr;
 
@@ -597,7 +1468,12 @@ gst_quicsink_query (GstBaseSink * parent, GstQuery * query)
       g_return_val_if_fail (gst_structure_get_uint64 (s, QUICLIB_STREAMID_KEY,
           &stream_id), FALSE);
 
-      state = gst_quiclib_transport_stream_state (sink->conn, stream_id);
+      conn = quicsink_stream_conn (sink, stream_id, &conn_stream_id);
+      if (conn != NULL) {
+        state = gst_quiclib_transport_stream_state (conn, conn_stream_id);
+      } else {
+        state = QUIC_STREAM_ERROR_CONNECTION;
+      }
       statestr = g_enum_to_string (quiclib_stream_status_get_type (), state);
 
       g_mutex_unlock (&sink->mutex);
@@ -616,7 +1492,53 @@ gst_quicsink_query (GstBaseSink * parent, GstQuery * query)
     }
     break;
   case GST_QUERY_BITRATE:
-    return FALSE;
+  {
+    guint64 bitrate;
+
+    g_mutex_lock (&sink->mutex);
+    bitrate = quicsink_bitrate_estimate (sink);
+    g_mutex_unlock (&sink->mutex);
+
+    if (bitrate == 0) {
+      return FALSE;
+    }
+
+    GST_LOG_OBJECT (sink, "Returning bitrate query with estimate of %lu bps",
+        bitrate);
+
+    gst_query_set_bitrate (query, (guint) MIN (bitrate, G_MAXUINT));
+    break;
+  }
+  case GST_QUERY_LATENCY:
+  {
+    gboolean live;
+    GstClockTime min, max, delay, worst_case;
+
+    if (!GST_ELEMENT_CLASS (parent_class)->query (GST_ELEMENT (parent),
+        query)) {
+      return FALSE;
+    }
+
+    gst_query_parse_latency (query, &live, &min, &max);
+
+    g_mutex_lock (&sink->mutex);
+    delay = sink->send_delay_smoothed;
+    worst_case = delay + 4 * sink->send_delay_meandev;
+    sink->reported_send_delay = delay;
+    g_mutex_unlock (&sink->mutex);
+
+    min += delay;
+    if (GST_CLOCK_TIME_IS_VALID (max)) {
+      max += worst_case;
+    }
+
+    GST_LOG_OBJECT (sink, "Returning latency query with min %" GST_TIME_FORMAT
+        ", max %" GST_TIME_FORMAT " including send delay of %" GST_TIME_FORMAT,
+        GST_TIME_ARGS (min), GST_TIME_ARGS (max), GST_TIME_ARGS (delay));
+
+    gst_query_set_latency (query, live, min, max);
+    break;
+  }
   default:
     GST_LOG_OBJECT (sink, "Received %s query, passing to base class",
         query_type);
@@ -635,7 +1557,11 @@ static GstFlowReturn
 gst_quicsink_render (GstBaseSink * sink, GstBuffer * buffer)
 {
   GstQuicSink *quicsink = GST_QUICSINK (sink);
+  GstQuicLibTransportConnection *conn;
+  GstBuffer *send_buf = buffer;
   gsize sent = 0, buf_size = gst_buffer_get_size (buffer);
+  gint64 send_start;
+  gboolean latency_changed;
 
   GST_DEBUG_OBJECT (quicsink, "Received buffer of size %lu", buf_size);
 
@@ -651,10 +1577,35 @@ gst_quicsink_render (GstBaseSink * sink, GstBuffer * buffer)
     g_cond_wait (&quicsink->ctx_change, &quicsink->mutex);
   }
 
+  send_start = g_get_monotonic_time ();
+
+  if (quicsink->path_scheduler == QUICLIB_PATH_SCHEDULER_REDUNDANT &&
+      quicsink->stripes != NULL && quicsink->stripes->len > 1 &&
+      gst_buffer_get_quiclib_datagram_meta (buffer) != NULL &&
+      quicsink_redundant_negotiated (quicsink)) {
+    GstFlowReturn ret = quicsink_send_redundant_datagram (quicsink, buffer);
+
+    g_mutex_unlock (&quicsink->mutex);
+
+    if (ret == GST_FLOW_OK) {
+      quicsink_maybe_send_bitrate_hint (quicsink);
+    }
+
+    return ret;
+  }
+
+  conn = quicsink_stripe_buffer (quicsink, &send_buf);
+  if (conn == NULL) {
+    g_mutex_unlock (&quicsink->mutex);
+    GST_ERROR_OBJECT (quicsink, "No striped connection for buffer of size %lu",
+        buf_size);
+    return GST_FLOW_ERROR;
+  }
+
   do {
     gssize b_sent = 0;
-    GstQuicLibError err = gst_quiclib_transport_send_buffer (quicsink->conn,
-        buffer, &b_sent);
+    GstQuicLibError err = gst_quiclib_transport_send_buffer (conn, send_buf,
+        &b_sent);
 
     GST_TRACE_OBJECT (quicsink,
         "Send buffer returned %d (%s) with %lu bytes sent", err,
@@ -662,6 +1613,9 @@ gst_quicsink_render (GstBaseSink * sink, GstBuffer * buffer)
         
     if (err != GST_QUICLIB_ERR_OK) {
       g_mutex_unlock (&quicsink->mutex);
+      if (send_buf != buffer) {
+        gst_buffer_unref (send_buf);
+      }
       switch (err) {
         case GST_QUICLIB_ERR:
           return GST_FLOW_ERROR;
@@ -717,10 +1671,24 @@ gst_quicsink_render (GstBaseSink * sink, GstBuffer * buffer)
         buf_size, sent);
   } while (sent < buf_size);
 
+  latency_changed = quicsink_update_send_delay (quicsink,
+      (g_get_monotonic_time () - send_start) * GST_USECOND);
+
   g_mutex_unlock (&quicsink->mutex);
 
+  if (latency_changed) {
+    gst_element_post_message (GST_ELEMENT (quicsink),
+        gst_message_new_latency (GST_OBJECT (quicsink)));
+  }
+
+  if (send_buf != buffer) {
+    gst_buffer_unref (send_buf);
+  }
+
   GST_DEBUG_OBJECT (quicsink, "Buffer sent");
 
+  quicsink_maybe_send_bitrate_hint (quicsink);
+
   return GST_FLOW_OK;
 }
 
@@ -748,6 +1716,7 @@ quicsink_user_handshake_complete (GstQuicLibCommonUser *self,
 {
   GstQuicSink *quicsink = GST_QUICSINK (self);
   gchar *addr = g_socket_connectable_to_string (G_SOCKET_CONNECTABLE (remote));
+  gint stripe;
 
   GST_TRACE_OBJECT (quicsink, "Handshake complete for %s connection with %s",
       alpn, addr);
@@ -756,11 +1725,43 @@ quicsink_user_handshake_complete (GstQuicLibCommonUser *self,
 
   g_free (addr);
 
-  quicsink->conn = conn;
+  if (quicsink->stripes == NULL) {
+    quicsink->stripes = g_ptr_array_new ();
+    quicsink_parse_path_weights (quicsink);
+  }
+
+  stripe = quicsink_stripe_index (quicsink,
+      GST_QUICLIB_TRANSPORT_CONTEXT (conn));
+  if (stripe < 0) {
+    /*
+     * A server connection. Without striping a new connection replaces the
+     * last, otherwise it joins the stripe if there's room.
+     */
+    if (quicsink->stripe_connections == 1 && quicsink->stripes->len > 0) {
+      g_ptr_array_index (quicsink->stripes, 0) = conn;
+      stripe = 0;
+    } else if (quicsink->stripes->len < quicsink->stripe_connections) {
+      stripe = (gint) quicsink->stripes->len;
+      g_ptr_array_add (quicsink->stripes, conn);
+    } else {
+      GST_WARNING_OBJECT (quicsink, "Already have %u striped connections, "
+          "not sending on the new one", quicsink->stripes->len);
+      g_mutex_unlock (&quicsink->mutex);
+      return TRUE;
+    }
+  }
+
+  quicsink->conn = GST_QUICLIB_TRANSPORT_CONNECTION (
+      g_ptr_array_index (quicsink->stripes, 0));
 
   g_cond_signal (&quicsink->ctx_change);
   g_mutex_unlock (&quicsink->mutex);
 
+  /* The rest of the stripe is hidden from the rest of the pipeline */
+  if (stripe > 0) {
+    return TRUE;
+  }
+
   gst_element_set_state (GST_ELEMENT (quicsink), GST_STATE_PLAYING);
 
   gst_quiclib_handshake_complete_signal_emit (quicsink,
@@ -776,6 +1777,8 @@ quicsink_user_stream_opened (GstQuicLibCommonUser *self,
 {
   GstQuicSink *quicsink = GST_QUICSINK (self);
 
+  stream_id = quicsink_stripe_stream_id (quicsink, ctx, stream_id);
+
   GST_TRACE_OBJECT (quicsink, "Stream %lu opened", stream_id);
 
   g_cond_signal (&quicsink->ctx_change);
@@ -790,6 +1793,8 @@ quicsink_user_stream_closed (GstQuicLibCommonUser *self,
 {
   GstQuicSink *quicsink = GST_QUICSINK (self);
 
+  stream_id = quicsink_stripe_stream_id (quicsink, ctx, stream_id);
+
   GST_TRACE_OBJECT (quicsink, "Stream %lu closed", stream_id);
 
   g_cond_signal (&quicsink->ctx_change);
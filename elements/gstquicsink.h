@@ -68,6 +68,48 @@ struct _GstQuicSink
   GstQuicLibServerContext *server_ctx;
   GstQuicLibTransportConnection *conn;
 
+  /*
+   * With connection striping, every connection to the peer in stripe order.
+   * conn is always the first of these.
+   */
+  guint stripe_connections;
+  GPtrArray *stripes;
+  guint next_stripe;
+
+  /*
+   * Multipath: one stripe per local address, and how traffic is scheduled
+   * across the stripes. path_weight and path_credit have an entry per stripe
+   * for the weighted scheduler.
+   */
+  gchar *multipath_addresses;
+  GstQuicLibPathScheduler path_scheduler;
+  gchar *path_weights;
+  guint *path_weight;
+  gint64 *path_credit;
+
+  /* Sequence number of the last datagram sent by the redundant scheduler */
+  guint64 redundant_seq;
+
+  /*
+   * Bitrate hints sent upstream: how often, in milliseconds, and when the
+   * estimate was last checked and last sent, in monotonic microseconds.
+   */
+  guint bitrate_hint_interval;
+  gint64 last_bitrate_check;
+  gint64 last_bitrate_hint;
+  guint64 bitrate_hint;
+
+  /* Whether the outcome of probing the connection has been posted */
+  gboolean probe_reported;
+
+  /*
+   * How long buffers wait in render for the connection to take them, smoothed
+   * like the RTT, and the smoothed delay last reported in a LATENCY query.
+   */
+  GstClockTime send_delay_smoothed;
+  GstClockTime send_delay_meandev;
+  GstClockTime reported_send_delay;
+
   GMutex mutex;
   GCond ctx_change;
 
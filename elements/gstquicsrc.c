@@ -59,12 +59,31 @@
  * with a GstQuicLibStreamMeta or GstQuicLibDatagramMeta if they contain stream
  * frame data or datagram frame data respectively, and quicdemux demultiplexes
  * these onto individual stream/datagram pads.
+ *
+ * With the stripe-connections property above 1, up to that many connections
+ * from the same peer are merged into one flow. Stream IDs are remapped to be
+ * unique across the connections, and EOS is only sent once all of them have
+ * closed. Each connection of a stripe carries a session ID in its handshake,
+ * and in server mode connections are only merged if their IDs match.
+ * Datagrams that quicsink's redundant path scheduler sent on every connection
+ * are passed on once, from whichever connection delivers them first. This is
+ * agreed in the handshake of each connection, after which every datagram on
+ * it carries a sequence number.
+ *
+ * Latency queries are answered with the one-way transport latency: half the
+ * smoothed RTT plus the time received packets wait before their data reaches
+ * the element, as the minimum, and a worst case allowing for RTT and receive
+ * jitter as the maximum. With striping, the slowest connection is reported.
+ * When the latency moves significantly, a latency message is posted so that
+ * downstream jitterbuffers and sinks can be reconfigured.
  */
 
 #ifdef HAVE_CONFIG_H
 #  include <config.h>
 #endif
 
+#include <string.h>
+
 #include <gst/gst.h>
 
 #include "gstquicsrc.h"
@@ -80,7 +99,9 @@ enum
 {
   PROP_0,
   PROP_QUIC_ENDPOINT_ENUMS,
-  PROP_QUIC_CONNECTION_CTX
+  PROP_QUIC_CONNECTION_CTX,
+  PROP_QUIC_STRIPES_CTX,
+  PROP_STRIPE_CONNECTIONS
 };
 
 static guint signals[GST_QUICLIB_SIGNALS_MAX];
@@ -113,6 +134,7 @@ static void gst_quicsrc_set_property (GObject * object,
     guint prop_id, const GValue * value, GParamSpec * pspec);
 static void gst_quicsrc_get_property (GObject * object,
     guint prop_id, GValue * value, GParamSpec * pspec);
+static void gst_quicsrc_finalize (GObject * object);
 
 /*
  * GstElement virtual methods
@@ -132,6 +154,7 @@ static gboolean gst_quicsrc_is_seekable (GstBaseSrc *bsrc) { return FALSE; }
 static GstFlowReturn gst_quicsrc_create (GstPushSrc *psrc, GstBuffer **outbuf);
 
 static gboolean gst_quicsrc_quiclib_connect (GstQUICSrc *src);
+static gboolean gst_quicsrc_quiclib_configure (GstQUICSrc *src, GObject *obj);
 static gboolean gst_quicsrc_quiclib_disconnect (GstQUICSrc *src);
 
 static void quicsrc_stream_flow_control_limited_signal_cb (
@@ -151,6 +174,7 @@ gst_quicsrc_class_init (GstQUICSrcClass * klass)
 
   gobject_class->set_property = GST_DEBUG_FUNCPTR (gst_quicsrc_set_property);
   gobject_class->get_property = GST_DEBUG_FUNCPTR (gst_quicsrc_get_property);
+  gobject_class->finalize = GST_DEBUG_FUNCPTR (gst_quicsrc_finalize);
 
   gstelement_class->change_state = GST_DEBUG_FUNCPTR (
       gst_quicsrc_change_state);
@@ -167,6 +191,13 @@ gst_quicsrc_class_init (GstQUICSrcClass * klass)
       g_param_spec_pointer ("quic-ctx", "QUIC Transport Context",
           "Underlying QUIC transport context", G_PARAM_READABLE));
 
+  g_object_class_install_property (gobject_class, PROP_QUIC_STRIPES_CTX,
+      g_param_spec_pointer ("quic-stripes", "QUIC Striped Connections",
+          "GPtrArray of every striped QUIC transport connection, for use with "
+          "gst_quiclib_transport_get_striped_conn_stats", G_PARAM_READABLE));
+
+  gst_quiclib_common_install_stripe_connections_property (gobject_class);
+
   signals[GST_QUICLIB_HANDSHAKE_COMPLETE_SIGNAL] =
     gst_quiclib_handshake_complete_signal_new (klass);
   signals[GST_QUICLIB_STREAM_OPENED_SIGNAL] =
@@ -191,6 +222,67 @@ gst_quicsrc_class_init (GstQUICSrcClass * klass)
       gst_static_pad_template_get (&src_factory));
 }
 
+/*
+ * Connection striping helpers.
+ *
+ * Stream IDs from every connection in the stripe are mapped with
+ * gst_quiclib_stripe_stream_id before they go downstream, so that quicdemux
+ * sees a single flow. With a single connection the mapping does nothing.
+ */
+static gint
+quicsrc_stripe_index (GstQUICSrc *src, GstQuicLibTransportContext *ctx)
+{
+  guint i;
+
+  if (src->stripes == NULL) {
+    return -1;
+  }
+
+  for (i = 0; i < src->stripes->len; i++) {
+    if (g_ptr_array_index (src->stripes, i) == (gpointer) ctx) {
+      return (gint) i;
+    }
+  }
+
+  return -1;
+}
+
+static guint64
+quicsrc_stripe_stream_id (GstQUICSrc *src, GstQuicLibTransportContext *ctx,
+    guint64 stream_id)
+{
+  gint stripe = quicsrc_stripe_index (src, ctx);
+
+  if (stripe < 0) {
+    return stream_id;
+  }
+
+  return gst_quiclib_stripe_stream_id (stream_id, (guint) stripe,
+      src->stripe_connections);
+}
+
+static GstQuicLibTransportConnection *
+quicsrc_stream_conn (GstQUICSrc *src, guint64 stream_id,
+    guint64 *conn_stream_id)
+{
+  guint stripe;
+
+  if (src->stripes == NULL) {
+    *conn_stream_id = stream_id;
+    return src->conn;
+  }
+
+  *conn_stream_id = gst_quiclib_unstripe_stream_id (stream_id,
+      src->stripe_connections, &stripe);
+
+  if (stripe >= src->stripes->len) {
+    return NULL;
+  }
+
+  return GST_QUICLIB_TRANSPORT_CONNECTION (
+      g_ptr_array_index (src->stripes, stripe));
+}
+
 gboolean
 quicsrc_user_new_connection (GstQuicLibCommonUser *self,
     GstQuicLibTransportContext *ctx, GInetSocketAddress *remote,
@@ -198,10 +290,17 @@ quicsrc_user_new_connection (GstQuicLibCommonUser *self,
 {
   GstQUICSrc *src = GST_QUICSRC (self);
   GstCaps *new_caps;
+  gint stripe;
 
   GST_DEBUG_OBJECT (src, "New connection from remote %s with ALPN %s",
       g_socket_connectable_to_string (G_SOCKET_CONNECTABLE (remote)), alpn);
 
+  stripe = quicsrc_stripe_index (src, ctx);
+  if (stripe > 0) {
+    /* Another of our own client connections, caps are already set */
+    return TRUE;
+  }
+
   new_caps = gst_caps_new_simple ("application/quic", "alpn", G_TYPE_STRING,
       alpn, NULL);
 
@@ -211,15 +310,6 @@ quicsrc_user_new_connection (GstQuicLibCommonUser *self,
     return FALSE;
   }
 
-  if (src->server_ctx) {
-    src->conn = GST_QUICLIB_TRANSPORT_CONNECTION (ctx);
-
-    gst_quiclib_stream_flow_control_limited_signal_connect (src->conn,
-        quicsrc_stream_flow_control_limited_signal_cb, (gpointer) src);
-    gst_quiclib_conn_flow_control_limited_signal_connect (src->conn,
-        quicsrc_conn_flow_control_limited_signal_cb, (gpointer) src);
-  }
-
   gst_base_src_set_caps (GST_BASE_SRC (src), new_caps);
 
   /* TODO: Send a query for whether to accept this connection? Or is
@@ -229,6 +319,63 @@ quicsrc_user_new_connection (GstQuicLibCommonUser *self,
   return TRUE;
 }
 
+/**
+ * quicsrc_stripe_admit
+ *
+ * Decide whether a connection to the server can be used, and where it goes in
+ * the stripe. Without striping a new connection replaces the last. Otherwise,
+ * the first connection starts a stripe, and further connections join it until
+ * it is full, as long as they carry the same stripe ID. This is only known
+ * once the handshake is complete.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quicsrc_stripe_admit (GstQUICSrc *src, GstQuicLibTransportConnection *conn)
+{
+  guint64 stripe_id = gst_quiclib_transport_get_stripe_id (conn);
+
+  /*
+   * The server owns its connections, and drops them once they have closed, so
+   * the stripe keeps its own references.
+   */
+  if (src->stripes == NULL) {
+    src->stripes = g_ptr_array_new_with_free_func (g_object_unref);
+  }
+
+  if (src->stripe_connections == 1 || src->stripes->len == 0 ||
+      src->stripes_closed >= src->stripes->len) {
+    g_ptr_array_set_size (src->stripes, 0);
+    g_ptr_array_add (src->stripes, g_object_ref (conn));
+    src->stripes_closed = 0;
+    src->stripe_id = stripe_id;
+    g_mutex_lock (&src->mutex);
+    memset (&src->redundant_window, 0, sizeof (src->redundant_window));
+    g_mutex_unlock (&src->mutex);
+  } else if (stripe_id == 0 || stripe_id != src->stripe_id) {
+    GST_WARNING_OBJECT (src, "Refusing connection with stripe ID %"
+        G_GINT64_MODIFIER "x, already have a stripe with ID %"
+        G_GINT64_MODIFIER "x", stripe_id, src->stripe_id);
+    return FALSE;
+  } else if (src->stripes->len < src->stripe_connections) {
+    GST_DEBUG_OBJECT (src, "Connection joins stripe %" G_GINT64_MODIFIER
+        "x as %u of %u", stripe_id, src->stripes->len + 1,
+        src->stripe_connections);
+    g_ptr_array_add (src->stripes, g_object_ref (conn));
+  } else {
+    GST_WARNING_OBJECT (src, "Refusing connection, already have %u striped "
+        "connections", src->stripes->len);
+    return FALSE;
+  }
+
+  gst_quiclib_stream_flow_control_limited_signal_connect (conn,
+      quicsrc_stream_flow_control_limited_signal_cb, (gpointer) src);
+  gst_quiclib_conn_flow_control_limited_signal_connect (conn,
+      quicsrc_conn_flow_control_limited_signal_cb, (gpointer) src);
+
+  return TRUE;
+}
+
 gboolean
 quicsrc_user_handshake_complete (GstQuicLibCommonUser *self,
     GstQuicLibTransportContext *ctx, GInetSocketAddress *remote,
@@ -239,6 +386,16 @@ quicsrc_user_handshake_complete (GstQuicLibCommonUser *self,
   GST_DEBUG_OBJECT (src, "Handshake complete for %s connection with remote %s",
       alpn, g_socket_connectable_to_string (G_SOCKET_CONNECTABLE (remote)));
 
+  if (src->server_ctx &&
+      !quicsrc_stripe_admit (src, GST_QUICLIB_TRANSPORT_CONNECTION (ctx))) {
+    return FALSE;
+  }
+
+  /* The rest of the stripe is hidden from the rest of the pipeline */
+  if (quicsrc_stripe_index (src, ctx) > 0) {
+    return TRUE;
+  }
+
   gst_quiclib_handshake_complete_signal_emit (src, G_SOCKET_ADDRESS (remote),
       alpn);
 
@@ -258,6 +415,8 @@ quicsrc_user_stream_opened (GstQuicLibCommonUser *self,
 {
   GstQUICSrc *src = GST_QUICSRC (self);
 
+  stream_id = quicsrc_stripe_stream_id (src, ctx, stream_id);
+
   gst_quiclib_stream_opened_signal_emit (src, stream_id);
 
   return gst_quiclib_new_stream_opened_event (GST_BASE_SRC (src)->srcpad,
@@ -272,6 +431,8 @@ quicsrc_user_stream_closed (GstQuicLibCommonUser *self,
   GList *it;
   GstQuicLibStreamMeta *last_meta = NULL;
 
+  stream_id = quicsrc_stripe_stream_id (src, ctx, stream_id);
+
   GST_TRACE_OBJECT (src, "Stream %lu has closed", stream_id);
 
   g_mutex_lock (&src->mutex);
@@ -318,13 +479,23 @@ quicsrc_user_stream_data (GstQuicLibCommonUser *self,
 {
   GstQUICSrc *src = GST_QUICSRC (self);
   GstQuicLibStreamMeta *meta = gst_buffer_get_quiclib_stream_meta (buf);
+  guint64 stream_id;
 
   g_assert (meta != NULL);
 
+  stream_id = quicsrc_stripe_stream_id (src, ctx, meta->stream_id);
+
   GST_DEBUG_OBJECT (src, "Received %ld bytes of stream data for stream %ld",
-      meta->length, meta->stream_id);
+      meta->length, stream_id);
 
-  gst_buffer_ref (buf);
+  if (stream_id != (guint64) meta->stream_id) {
+    /* The transport may still hold the buffer, so change a copy */
+    buf = gst_buffer_copy (buf);
+    meta = gst_buffer_get_quiclib_stream_meta (buf);
+    meta->stream_id = stream_id;
+  } else {
+    gst_buffer_ref (buf);
+  }
 
   g_mutex_lock (&src->mutex);
   src->frames = g_list_append (src->frames, (gpointer) buf);
@@ -338,14 +509,50 @@ quicsrc_user_datagram_data (GstQuicLibCommonUser *self,
 {
   GstQUICSrc *src = GST_QUICSRC (self);
   GstQuicLibDatagramMeta *meta = gst_buffer_get_quiclib_datagram_meta (buf);
+  guint8 header[QUICLIB_REDUNDANT_HEADER_LEN];
+  gboolean redundant;
+  guint64 seq = 0;
 
   g_assert (meta != NULL);
 
   GST_DEBUG_OBJECT (src, "Received QUIC datagram of length %ld", meta->length);
 
-  gst_buffer_ref (buf);
+  /*
+   * Every datagram on a connection that agreed to carry quicsink's redundant
+   * datagrams starts with a sequence number, whether or not it was also sent
+   * on the other connections of the stripe.
+   */
+  redundant = gst_quiclib_transport_get_stripe_redundant (
+      GST_QUICLIB_TRANSPORT_CONNECTION (ctx));
+  if (redundant) {
+    if (gst_buffer_extract (buf, 0, header, QUICLIB_REDUNDANT_HEADER_LEN) !=
+        QUICLIB_REDUNDANT_HEADER_LEN) {
+      GST_WARNING_OBJECT (src, "Dropping redundant datagram of length %ld, "
+          "too short for its header", meta->length);
+      return;
+    }
+    seq = GST_READ_UINT64_BE (header);
+  }
 
   g_mutex_lock (&src->mutex);
+
+  if (redundant) {
+    if (!gst_quiclib_redundant_window_is_new (&src->redundant_window, seq)) {
+      g_mutex_unlock (&src->mutex);
+      GST_LOG_OBJECT (src, "Dropping duplicate redundant datagram %"
+          G_GUINT64_FORMAT, seq);
+      return;
+    }
+
+    buf = gst_buffer_copy_region (buf, GST_BUFFER_COPY_ALL,
+        QUICLIB_REDUNDANT_HEADER_LEN,
+        gst_buffer_get_size (buf) - QUICLIB_REDUNDANT_HEADER_LEN);
+    meta = gst_buffer_get_quiclib_datagram_meta (buf);
+    meta->length -= QUICLIB_REDUNDANT_HEADER_LEN;
+  } else {
+    gst_buffer_ref (buf);
+  }
+
   src->frames = g_list_append (src->frames, (gpointer) buf);
   g_cond_signal (&src->signal);
   g_mutex_unlock (&src->mutex);
@@ -357,8 +564,15 @@ quicsrc_user_connection_error (GstQuicLibCommonUser *self,
 {
   GstQUICSrc *src = GST_QUICSRC (self);
 
-  gst_quiclib_unref (GST_QUICLIB_TRANSPORT_CONTEXT (src->conn),
-      GST_QUICLIB_COMMON_USER (src));
+  /* Server connections are held by the stripe rather than by user refs */
+  if (src->server_ctx == NULL) {
+    if (quicsrc_stripe_index (src, ctx) > 0) {
+      gst_quiclib_unref (ctx, GST_QUICLIB_COMMON_USER (src));
+    } else {
+      gst_quiclib_unref (GST_QUICLIB_TRANSPORT_CONTEXT (src->conn),
+          GST_QUICLIB_COMMON_USER (src));
+    }
+  }
 
   gst_quiclib_conn_error_signal_emit (src, error);
 
@@ -373,9 +587,20 @@ quicsrc_user_connection_closed (GstQuicLibCommonUser *self,
 {
   GstQUICSrc *src = GST_QUICSRC (self);
   GstEvent *eos;
+  gint stripe = quicsrc_stripe_index (src, ctx);
 
   GST_TRACE_OBJECT (src, "Connection closed");
 
+  /* Only end the flow once every connection in the stripe has closed */
+  if (stripe >= 0 && ++src->stripes_closed < src->stripes->len) {
+    GST_DEBUG_OBJECT (src, "Striped connection %d closed, %u still open",
+        stripe, src->stripes->len - src->stripes_closed);
+    if (stripe > 0 && src->server_ctx == NULL) {
+      gst_quiclib_unref (ctx, GST_QUICLIB_COMMON_USER (src));
+    }
+    return;
+  }
+
   eos = gst_event_new_eos ();
 
   gst_pad_push_event (GST_BASE_SRC (src)->srcpad, eos);
@@ -384,6 +609,15 @@ quicsrc_user_connection_closed (GstQuicLibCommonUser *self,
 
   g_cond_signal (&src->signal);
 
+  /* Server connections are held by the stripe rather than by user refs */
+  if (src->server_ctx) {
+    return;
+  }
+
+  if (stripe > 0) {
+    gst_quiclib_unref (ctx, GST_QUICLIB_COMMON_USER (src));
+  }
+
   if (src->conn) {
     gst_quiclib_unref (GST_QUICLIB_TRANSPORT_CONTEXT (src->conn),
         GST_QUICLIB_COMMON_USER (src));
@@ -438,6 +672,14 @@ gst_quicsrc_init (GstQUICSrc * src)
 
   gst_quiclib_common_init_endpoint_properties (src);
 
+  src->stripe_connections = QUICLIB_STRIPE_CONNECTIONS_DEFAULT;
+  src->stripes = NULL;
+  src->stripes_closed = 0;
+  src->stripe_id = 0;
+  memset (&src->redundant_window, 0, sizeof (src->redundant_window));
+  src->reported_latency = GST_CLOCK_TIME_NONE;
+  src->last_latency_check = 0;
+
   g_mutex_init (&src->mutex);
   g_cond_init (&src->signal);
 
@@ -446,6 +688,18 @@ gst_quicsrc_init (GstQUICSrc * src)
   gst_base_src_set_do_timestamp (GST_BASE_SRC_CAST (src), TRUE);
 }
 
+static void
+gst_quicsrc_finalize (GObject * object)
+{
+  GstQUICSrc *src = GST_QUICSRC (object);
+
+  gst_quiclib_common_free_endpoint_properties (src);
+  g_mutex_clear (&src->mutex);
+  g_cond_clear (&src->signal);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
 static void
 gst_quicsrc_set_property (GObject * object, guint prop_id,
     const GValue * value, GParamSpec * pspec)
@@ -474,6 +728,14 @@ gst_quicsrc_set_property (GObject * object, guint prop_id,
             "Cannot set server property %s in client mode", pspec->name);
       }
       break;
+    case PROP_STRIPE_CONNECTIONS:
+      if (src->stripes != NULL && src->stripes->len > 0) {
+        GST_WARNING_OBJECT (src,
+            "Cannot change the number of striped connections while connected");
+      } else {
+        src->stripe_connections = g_value_get_uint (value);
+      }
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -504,6 +766,12 @@ gst_quicsrc_get_property (GObject * object, guint prop_id,
     case PROP_QUIC_CONNECTION_CTX:
       g_value_set_pointer (value, (gpointer) src->conn);
       break;
+    case PROP_QUIC_STRIPES_CTX:
+      g_value_set_pointer (value, (gpointer) src->stripes);
+      break;
+    case PROP_STRIPE_CONNECTIONS:
+      g_value_set_uint (value, src->stripe_connections);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -541,6 +809,86 @@ gst_quicsrc_change_state (GstElement *elem, GstStateChange t)
   return rv;
 }
 
+/*
+ * Transport latency helpers.
+ *
+ * The latency of a stripe is that of its slowest connection, as a stream
+ * can't be delivered any sooner than its last piece. Call with the src mutex
+ * held.
+ */
+static gboolean
+quicsrc_transport_latency (GstQUICSrc *src, GstClockTime *min,
+    GstClockTime *max)
+{
+  guint64 smoothed, worst_case;
+  gboolean found = FALSE;
+  guint i;
+
+  if (src->stripes == NULL) {
+    if (!gst_quiclib_transport_get_latency (src->conn, &smoothed,
+        &worst_case)) {
+      return FALSE;
+    }
+    *min = smoothed;
+    *max = worst_case;
+    return TRUE;
+  }
+
+  *min = 0;
+  *max = 0;
+
+  for (i = 0; i < src->stripes->len; i++) {
+    if (gst_quiclib_transport_get_latency (GST_QUICLIB_TRANSPORT_CONNECTION (
+        g_ptr_array_index (src->stripes, i)), &smoothed, &worst_case)) {
+      *min = MAX (*min, smoothed);
+      *max = MAX (*max, worst_case);
+      found = TRUE;
+    }
+  }
+
+  return found;
+}
+
+#define QUICSRC_LATENCY_CHECK_INTERVAL (250 * G_TIME_SPAN_MILLISECOND)
+
+/*
+ * Post a latency message if the transport latency has moved significantly
+ * from what was last reported. The reported latency is updated straight away
+ * so that the message isn't posted again before the pipeline re-queries.
+ */
+static void
+quicsrc_check_latency (GstQUICSrc *src)
+{
+  gint64 now = g_get_monotonic_time ();
+  GstClockTime min, max;
+  gboolean changed;
+
+  g_mutex_lock (&src->mutex);
+
+  if (now - src->last_latency_check < QUICSRC_LATENCY_CHECK_INTERVAL ||
+      !quicsrc_transport_latency (src, &min, &max)) {
+    g_mutex_unlock (&src->mutex);
+    return;
+  }
+
+  src->last_latency_check = now;
+
+  changed = gst_quiclib_latency_changed (src->reported_latency, min);
+  if (changed) {
+    GST_INFO_OBJECT (src, "Transport latency has moved from %" GST_TIME_FORMAT
+        " to %" GST_TIME_FORMAT, GST_TIME_ARGS (src->reported_latency),
+        GST_TIME_ARGS (min));
+    src->reported_latency = min;
+  }
+
+  g_mutex_unlock (&src->mutex);
+
+  if (changed) {
+    gst_element_post_message (GST_ELEMENT (src),
+        gst_message_new_latency (GST_OBJECT (src)));
+  }
+}
+
 /*
  * GstBaseSrc virtual methods
  */
@@ -587,7 +935,8 @@ gst_quicsrc_query (GstBaseSrc *bsrc, GstQuery *query)
           state, local_addr, peer_addr), FALSE);
 
     } else if (gst_structure_has_name (s, QUICLIB_STREAM_CLOSE)) {
-      guint64 stream_id, reason;
+      GstQuicLibTransportConnection *conn;
+      guint64 stream_id, conn_stream_id, reason;
 
       GST_LOG_OBJECT (src, "Received stream close query");
 
@@ -603,9 +952,13 @@ gst_quicsrc_query (GstBaseSrc *bsrc, GstQuery *query)
       GST_LOG_OBJECT (src, "Asking transport to close stream %lu with reason "
           "%lu", stream_id, reason);
 
-      return gst_quiclib_transport_close_stream (src->conn, stream_id, reason);
+      conn = quicsrc_stream_conn (src, stream_id, &conn_stream_id);
+      g_return_val_if_fail (conn, FALSE);
+
+      return gst_quiclib_transport_close_stream (conn, conn_stream_id, reason);
     } else if (gst_structure_has_name (s, QUICLIB_STREAM_STATE)) {
-      guint64 stream_id;
+      GstQuicLibTransportConnection *conn;
+      guint64 stream_id, conn_stream_id;
       GstQuicLibStreamState state;
       gchar *statestr;
 
@@ -614,7 +967,10 @@ gst_quicsrc_query (GstBaseSrc *bsrc, GstQuery *query)
       g_return_val_if_fail (gst_structure_get_uint64 (s, QUICLIB_STREAMID_KEY,
           &stream_id), FALSE);
 
-      state = gst_quiclib_transport_stream_state (src->conn, stream_id);
+      conn = quicsrc_stream_conn (src, stream_id, &conn_stream_id);
+      g_return_val_if_fail (conn, FALSE);
+
+      state = gst_quiclib_transport_stream_state (conn, conn_stream_id);
       statestr = g_enum_to_string (quiclib_stream_status_get_type (), state);
 
       GST_LOG_OBJECT (src, "Return stream state query for stream %lu with "
@@ -630,6 +986,24 @@ gst_quicsrc_query (GstBaseSrc *bsrc, GstQuery *query)
       return FALSE;
     }
     break;
+  case GST_QUERY_LATENCY:
+  {
+    GstClockTime min, max;
+
+    g_mutex_lock (&src->mutex);
+    if (!quicsrc_transport_latency (src, &min, &max)) {
+      g_mutex_unlock (&src->mutex);
+      return GST_BASE_SRC_CLASS (parent_class)->query (bsrc, query);
+    }
+    src->reported_latency = min;
+    g_mutex_unlock (&src->mutex);
+
+    GST_LOG_OBJECT (src, "Returning latency query with min %" GST_TIME_FORMAT
+        ", max %" GST_TIME_FORMAT, GST_TIME_ARGS (min), GST_TIME_ARGS (max));
+
+    gst_query_set_latency (query, TRUE, min, max);
+    break;
+  }
   default:
     return GST_BASE_SRC_CLASS (parent_class)->query (bsrc, query);
   }
@@ -686,23 +1060,80 @@ gst_quicsrc_create (GstPushSrc *psrc, GstBuffer **outbuf)
       GST_TIME_FORMAT ", DTS %" GST_TIME_FORMAT, gst_buffer_get_size (*outbuf),
       GST_TIME_ARGS ((*outbuf)->pts), GST_TIME_ARGS ((*outbuf)->dts));
 
+  quicsrc_check_latency (src);
+
   return GST_FLOW_OK;
 }
 
 static gboolean
 gst_quicsrc_quiclib_connect (GstQUICSrc *src)
 {
-  GObject *obj;
+  guint64 stripe_id = 0;
+  guint i;
 
   gst_quicsrc_quiclib_disconnect (src);
 
+  if (src->stripes != NULL) {
+    g_ptr_array_free (src->stripes, TRUE);
+    src->stripes = NULL;
+  }
+  src->stripes_closed = 0;
+
   switch (src->mode) {
   case QUICLIB_MODE_CLIENT:
-    src->conn = gst_quiclib_get_client (GST_QUICLIB_COMMON_USER (src),
-        src->location, src->alpn);
-    if (src->conn == NULL) return FALSE;
+    src->stripes = g_ptr_array_new ();
+
+    /* Every connection in the stripe carries the same random session ID */
+    while (src->stripe_connections > 1 && stripe_id == 0) {
+      stripe_id = ((guint64) g_random_int () << 32) | g_random_int ();
+    }
+    src->stripe_id = stripe_id;
+    memset (&src->redundant_window, 0, sizeof (src->redundant_window));
+
+    for (i = 0; i < src->stripe_connections; i++) {
+      GstQuicLibTransportConnection *conn;
+
+      /*
+       * Without striping, the connection can be shared with other elements
+       * talking to the same peer, but a stripe has to be our own.
+       */
+      if (stripe_id == 0) {
+        conn = gst_quiclib_get_client (GST_QUICLIB_COMMON_USER (src),
+            src->location, src->alpn);
+      } else {
+        conn = gst_quiclib_new_client (GST_QUICLIB_COMMON_USER (src),
+            src->location, src->alpn);
+      }
+
+      if (conn == NULL) {
+        break;
+      }
 
-    obj = G_OBJECT (src->conn);
+      if (stripe_id != 0) {
+        gst_quiclib_transport_client_set_stripe_id (conn, stripe_id);
+      }
+
+      /* Added first so the connection callbacks can find it */
+      g_ptr_array_add (src->stripes, conn);
+      if (i == 0) {
+        src->conn = conn;
+      }
+
+      if (!gst_quicsrc_quiclib_configure (src, G_OBJECT (conn))) {
+        g_ptr_array_remove_index (src->stripes, i);
+        break;
+      }
+    }
+
+    if (src->stripes->len == 0) {
+      src->conn = NULL;
+      return FALSE;
+    }
+
+    if (src->stripes->len < src->stripe_connections) {
+      GST_WARNING_OBJECT (src, "Only opened %u of %u striped connections",
+          src->stripes->len, src->stripe_connections);
+    }
     break;
   case QUICLIB_MODE_SERVER:
     src->server_ctx = gst_quiclib_get_server (GST_QUICLIB_COMMON_USER (src),
@@ -710,10 +1141,19 @@ gst_quicsrc_quiclib_connect (GstQUICSrc *src)
         src->sni);
     if (src->server_ctx == NULL) return FALSE;
 
-    obj = G_OBJECT (src->server_ctx);
-    break;
+    return gst_quicsrc_quiclib_configure (src, G_OBJECT (src->server_ctx));
   }
 
+  return TRUE;
+}
+
+/*
+ * Configure a client connection or server context with the element's
+ * properties and start it if it isn't already running.
+ */
+static gboolean
+gst_quicsrc_quiclib_configure (GstQUICSrc *src, GObject *obj)
+{
   g_object_set (obj,
       PROP_MAX_STREAMS_BIDI_REMOTE_SHORTNAME, src->max_streams_bidi_remote_init,
       PROP_MAX_STREAMS_UNI_REMOTE_SHORTNAME, src->max_streams_uni_remote_init,
@@ -722,17 +1162,45 @@ gst_quicsrc_quiclib_connect (GstQUICSrc *src)
       PROP_MAX_STREAM_DATA_UNI_REMOTE_SHORTNAME,
       src->max_stream_data_uni_remote_init,
       PROP_MAX_DATA_REMOTE_SHORTNAME, src->max_data_remote_init,
-      PROP_ENABLE_DATAGRAM_SHORTNAME, src->enable_datagram, NULL);
+      PROP_ENABLE_DATAGRAM_SHORTNAME, src->enable_datagram,
+      PROP_BUSY_POLL_SHORTNAME, src->busy_poll,
+      PROP_BUSY_POLL_BUDGET_SHORTNAME, src->busy_poll_budget,
+      PROP_CPU_AFFINITY_SHORTNAME, src->cpu_affinity,
+      PROP_ASYNC_CPU_AFFINITY_SHORTNAME, src->async_cpu_affinity,
+      PROP_THREAD_SCHED_POLICY_SHORTNAME, src->thread_sched_policy,
+      PROP_THREAD_PRIORITY_SHORTNAME, src->thread_priority,
+      PROP_IO_BACKEND_SHORTNAME, src->io_backend,
+      PROP_ZEROCOPY_THRESHOLD_SHORTNAME, src->zerocopy_threshold,
+      PROP_DSCP_SHORTNAME, src->dscp,
+      PROP_RATE_LIMIT_SHORTNAME, src->rate_limit,
+      PROP_RATE_BURST_SHORTNAME, src->rate_burst,
+      PROP_PROBE_DURATION_SHORTNAME, src->probe_duration,
+      PROP_EGRESS_RATE_LIMIT_SHORTNAME, src->egress_rate_limit,
+      PROP_ADMISSION_MAX_LOAD_SHORTNAME, src->admission_max_load,
+      PROP_ADMISSION_MAX_HANDSHAKES_SHORTNAME, src->admission_max_handshakes,
+      PROP_ADMISSION_MAX_MEMORY_SHORTNAME, src->admission_max_memory,
+      PROP_ADMISSION_ACTION_SHORTNAME, src->admission_action,
+      PROP_ADMISSION_SHED_IDLE_SHORTNAME, src->admission_shed_idle,
+      PROP_CONN_MEMORY_LIMIT_SHORTNAME, src->conn_memory_limit,
+      PROP_SERVER_MEMORY_LIMIT_SHORTNAME, src->server_memory_limit,
+      PROP_IDLE_MODE_SHORTNAME, src->idle_mode,
+      PROP_XDP_INTERFACE_SHORTNAME, src->xdp_interface,
+      PROP_XDP_QUEUE_SHORTNAME, src->xdp_queue,
+      PROP_XDP_SKB_MODE_SHORTNAME, src->xdp_skb_mode,
+      PROP_QUIC_LB_SERVER_ID_SHORTNAME, src->quic_lb_server_id,
+      PROP_QUIC_LB_KEY_SHORTNAME, src->quic_lb_key,
+      PROP_PREFERRED_ADDRESS_SHORTNAME, src->preferred_address, NULL);
 
   if (gst_quiclib_transport_get_state (GST_QUICLIB_TRANSPORT_CONTEXT (obj))
       == QUIC_STATE_NONE) {
     switch (src->mode) {
       case QUICLIB_MODE_CLIENT:
-        if (!gst_quiclib_transport_client_connect (src->conn)) {
+        if (!gst_quiclib_transport_client_connect (
+              GST_QUICLIB_TRANSPORT_CONNECTION (obj))) {
           GST_ERROR_OBJECT (src,
               "Couldn't open client connection with location %s",
               src->location);
-          gst_quiclib_unref (GST_QUICLIB_TRANSPORT_CONTEXT (src->conn),
+          gst_quiclib_unref (GST_QUICLIB_TRANSPORT_CONTEXT (obj),
               GST_QUICLIB_COMMON_USER (src));
           return FALSE;
         }
@@ -754,7 +1222,13 @@ gst_quicsrc_quiclib_connect (GstQUICSrc *src)
 static gboolean
 gst_quicsrc_quiclib_disconnect (GstQUICSrc *src)
 {
+  guint i;
+
   if (src->conn != NULL) {
+    for (i = 1; src->stripes != NULL && i < src->stripes->len; i++) {
+      gst_quiclib_transport_disconnect (GST_QUICLIB_TRANSPORT_CONNECTION (
+          g_ptr_array_index (src->stripes, i)), FALSE, QUICLIB_CLOSE_NO_ERROR);
+    }
     return gst_quiclib_transport_disconnect (src->conn, FALSE,
         QUICLIB_CLOSE_NO_ERROR) == 0;
   }
@@ -68,6 +68,26 @@ struct _GstQUICSrc
   GstQuicLibServerContext *server_ctx;
   GstQuicLibTransportConnection *conn;
 
+  /*
+   * With connection striping, every connection to the peer in stripe order.
+   * conn is always the first of these. Every connection in the stripe
+   * carries stripe_id in its handshake.
+   */
+  guint stripe_connections;
+  GPtrArray *stripes;
+  guint stripes_closed;
+  guint64 stripe_id;
+
+  /* Datagrams sent redundantly across the stripe. Guarded by the mutex. */
+  GstQuicLibRedundantWindow redundant_window;
+
+  /*
+   * Transport latency last given in a LATENCY query, and when it was last
+   * checked for changes, in monotonic microseconds.
+   */
+  GstClockTime reported_latency;
+  gint64 last_latency_check;
+
   GMutex mutex;
   GCond signal;
 
@@ -541,9 +541,9 @@ free_libctx:
   return NULL;
 }
 
-GstQuicLibTransportConnection *
-gst_quiclib_get_client (GstQuicLibCommonUser *user, const gchar *location,
-                     const gchar *alpn)
+static GstQuicLibTransportConnection *
+quiclib_get_client (GstQuicLibCommonUser *user, const gchar *location,
+    const gchar *alpn, gboolean reuse)
 {
   GUri *uri;
   GInetSocketAddress *sa;
@@ -564,7 +564,7 @@ gst_quiclib_get_client (GstQuicLibCommonUser *user, const gchar *location,
     goto free_uri;
   }
 
-  while (connections != NULL) {
+  while (reuse && connections != NULL) {
     GSocketAddress *peer = G_SOCKET_ADDRESS (gst_quiclib_transport_get_peer (
         GST_QUICLIB_TRANSPORT_CONNECTION (connections->data)));
     if (quiclib_sockaddr_equals (G_SOCKET_ADDRESS (sa),
@@ -576,7 +576,7 @@ gst_quiclib_get_client (GstQuicLibCommonUser *user, const gchar *location,
   }
 
   if (!conn) {
-    connections = g_list_append (connections, user);
+    connections = g_list_append (NULL, user);
     conn = gst_quiclib_transport_client_new (QUICLIB_TRANSPORT_USER (libctx),
         connections);
     g_object_set (G_OBJECT (conn), PROP_LOCATION_SHORT, location,
@@ -598,6 +598,20 @@ free_libctx:
   return NULL;
 }
 
+GstQuicLibTransportConnection *
+gst_quiclib_get_client (GstQuicLibCommonUser *user, const gchar *location,
+                     const gchar *alpn)
+{
+  return quiclib_get_client (user, location, alpn, TRUE);
+}
+
+GstQuicLibTransportConnection *
+gst_quiclib_new_client (GstQuicLibCommonUser *user, const gchar *location,
+    const gchar *alpn)
+{
+  return quiclib_get_client (user, location, alpn, FALSE);
+}
+
 GInetSocketAddress *
 gst_quiclib_get_connection_peer (GstQuicLibTransportContext *ctx)
 {
@@ -798,6 +812,78 @@ gst_quiclib_parse_stream_closed_event (GstEvent *event, guint64 *stream_id)
   return TRUE;
 }
 
+gboolean
+gst_quiclib_new_bitrate_hint_event (GstPad *pad, guint64 bitrate)
+{
+  return quiclib_new_event (pad, gst_structure_new (QUICLIB_BITRATE_HINT,
+      QUICLIB_BITRATE_KEY, G_TYPE_UINT64, bitrate, NULL));
+}
+
+gboolean
+gst_quiclib_parse_bitrate_hint_event (GstEvent *event, guint64 *bitrate)
+{
+  const GstStructure *s;
+
+  s = gst_event_get_structure (event);
+
+  g_return_val_if_fail (s, FALSE);
+
+  g_return_val_if_fail (gst_structure_has_name (s, QUICLIB_BITRATE_HINT),
+      FALSE);
+
+  g_return_val_if_fail (gst_structure_get_uint64 (s, QUICLIB_BITRATE_KEY,
+      bitrate), FALSE);
+
+  return TRUE;
+}
+
+GstMessage *
+gst_quiclib_new_capacity_probe_message (GstObject *src, guint64 bitrate)
+{
+  return gst_message_new_element (src, gst_structure_new (
+      QUICLIB_CAPACITY_PROBE, QUICLIB_BITRATE_KEY, G_TYPE_UINT64, bitrate,
+      NULL));
+}
+
+gboolean
+gst_quiclib_parse_capacity_probe_message (GstMessage *msg, guint64 *bitrate)
+{
+  const GstStructure *s;
+
+  s = gst_message_get_structure (msg);
+
+  g_return_val_if_fail (s, FALSE);
+
+  g_return_val_if_fail (gst_structure_has_name (s, QUICLIB_CAPACITY_PROBE),
+      FALSE);
+
+  g_return_val_if_fail (gst_structure_get_uint64 (s, QUICLIB_BITRATE_KEY,
+      bitrate), FALSE);
+
+  return TRUE;
+}
+
+/*
+ * Latency changes smaller than a quarter of the last reported latency, or
+ * smaller than this, aren't worth reconfiguring the pipeline for.
+ */
+#define QUICLIB_LATENCY_CHANGE_MIN (1 * GST_MSECOND)
+
+gboolean
+gst_quiclib_latency_changed (GstClockTime reported, GstClockTime current)
+{
+  GstClockTime diff;
+
+  if (!GST_CLOCK_TIME_IS_VALID (reported) ||
+      !GST_CLOCK_TIME_IS_VALID (current)) {
+    return FALSE;
+  }
+
+  diff = (current > reported) ? (current - reported) : (reported - current);
+
+  return diff > QUICLIB_LATENCY_CHANGE_MIN && diff > reported / 4;
+}
+
 gboolean
 gst_quiclib_new_connection_error_pad_event (GstPad *pad, guint64 error)
 {
@@ -1102,6 +1188,121 @@ quiclib_mode_get_type (void)
   return type;
 }
 
+GType
+quiclib_thread_sched_policy_get_type (void)
+{
+  static GType type = 0;
+  static const GEnumValue quiclib_thread_sched_policies[] = {
+      {QUICLIB_THREAD_SCHED_OTHER, "Default time-sharing scheduling", "other"},
+      {QUICLIB_THREAD_SCHED_FIFO, "Real-time first-in first-out", "fifo"},
+      {QUICLIB_THREAD_SCHED_RR, "Real-time round-robin", "rr"},
+      {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&type)) {
+    GType _type = g_enum_register_static ("GstQuicLibThreadSchedPolicy",
+        quiclib_thread_sched_policies);
+    g_once_init_leave (&type, _type);
+  }
+
+  return type;
+}
+
+GType
+quiclib_io_backend_get_type (void)
+{
+  static GType type = 0;
+  static const GEnumValue quiclib_io_backends[] = {
+      {QUICLIB_IO_BACKEND_GSOCKET, "GSocket with GSource polling", "gsocket"},
+      {QUICLIB_IO_BACKEND_IO_URING, "io_uring", "io-uring"},
+      {QUICLIB_IO_BACKEND_AF_XDP, "AF_XDP", "af-xdp"},
+      {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&type)) {
+    GType _type = g_enum_register_static ("GstQuicLibIOBackend",
+        quiclib_io_backends);
+    g_once_init_leave (&type, _type);
+  }
+
+  return type;
+}
+
+GType
+quiclib_path_scheduler_get_type (void)
+{
+  static GType type = 0;
+  static const GEnumValue quiclib_path_schedulers[] = {
+      {QUICLIB_PATH_SCHEDULER_LEAST_LOADED,
+          "Path with the least of its congestion window in flight",
+          "least-loaded"},
+      {QUICLIB_PATH_SCHEDULER_MIN_RTT,
+          "Lowest RTT path with congestion window available", "min-rtt"},
+      {QUICLIB_PATH_SCHEDULER_REDUNDANT,
+          "Lowest RTT path for streams, datagrams sent on every path",
+          "redundant"},
+      {QUICLIB_PATH_SCHEDULER_WEIGHTED, "Weighted round-robin", "weighted"},
+      {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&type)) {
+    GType _type = g_enum_register_static ("GstQuicLibPathScheduler",
+        quiclib_path_schedulers);
+    g_once_init_leave (&type, _type);
+  }
+
+  return type;
+}
+
+GType
+quiclib_fanout_policy_get_type (void)
+{
+  static GType type = 0;
+  static const GEnumValue quiclib_fanout_policies[] = {
+      {QUICLIB_FANOUT_POLICY_BLOCK,
+          "Wait for congested subscribers to accept the data", "block"},
+      {QUICLIB_FANOUT_POLICY_DROP,
+          "Drop data for congested subscribers", "drop"},
+      {QUICLIB_FANOUT_POLICY_SKIP_TO_KEYFRAME,
+          "Drop data for congested subscribers until the next keyframe",
+          "skip-to-keyframe"},
+      {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&type)) {
+    GType _type = g_enum_register_static ("GstQuicLibFanoutPolicy",
+        quiclib_fanout_policies);
+    g_once_init_leave (&type, _type);
+  }
+
+  return type;
+}
+
+GType
+quiclib_admission_action_get_type (void)
+{
+  static GType type = 0;
+  static const GEnumValue quiclib_admission_actions[] = {
+      {QUICLIB_ADMISSION_ACTION_REFUSE,
+          "Close new connections with CONNECTION_REFUSED", "refuse"},
+      {QUICLIB_ADMISSION_ACTION_RETRY,
+          "Send new connections a Retry, admitting those that come back once "
+          "no longer overloaded", "retry"},
+      {QUICLIB_ADMISSION_ACTION_VALIDATE,
+          "Send new connections a Retry, admitting those that come back "
+          "even while overloaded", "validate"},
+      {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&type)) {
+    GType _type = g_enum_register_static ("GstQuicLibAdmissionAction",
+        quiclib_admission_actions);
+    g_once_init_leave (&type, _type);
+  }
+
+  return type;
+}
+
 GType
 quiclib_stream_type_get_type (void)
 {
@@ -69,6 +69,52 @@ typedef enum _GstQUICMode {
 	QUICLIB_MODE_SERVER
 } GstQUICMode;
 
+#define QUICLIB_TYPE_THREAD_SCHED_POLICY quiclib_thread_sched_policy_get_type()
+
+GType quiclib_thread_sched_policy_get_type (void);
+typedef enum _GstQuicLibThreadSchedPolicy {
+  QUICLIB_THREAD_SCHED_OTHER,
+  QUICLIB_THREAD_SCHED_FIFO,
+  QUICLIB_THREAD_SCHED_RR
+} GstQuicLibThreadSchedPolicy;
+
+#define QUICLIB_TYPE_IO_BACKEND quiclib_io_backend_get_type()
+
+GType quiclib_io_backend_get_type (void);
+typedef enum _GstQuicLibIOBackend {
+  QUICLIB_IO_BACKEND_GSOCKET,
+  QUICLIB_IO_BACKEND_IO_URING,
+  QUICLIB_IO_BACKEND_AF_XDP
+} GstQuicLibIOBackend;
+
+#define QUICLIB_TYPE_PATH_SCHEDULER quiclib_path_scheduler_get_type()
+
+GType quiclib_path_scheduler_get_type (void);
+typedef enum _GstQuicLibPathScheduler {
+  QUICLIB_PATH_SCHEDULER_LEAST_LOADED,
+  QUICLIB_PATH_SCHEDULER_MIN_RTT,
+  QUICLIB_PATH_SCHEDULER_REDUNDANT,
+  QUICLIB_PATH_SCHEDULER_WEIGHTED
+} GstQuicLibPathScheduler;
+
+#define QUICLIB_TYPE_FANOUT_POLICY quiclib_fanout_policy_get_type()
+
+GType quiclib_fanout_policy_get_type (void);
+typedef enum _GstQuicLibFanoutPolicy {
+  QUICLIB_FANOUT_POLICY_BLOCK,
+  QUICLIB_FANOUT_POLICY_DROP,
+  QUICLIB_FANOUT_POLICY_SKIP_TO_KEYFRAME
+} GstQuicLibFanoutPolicy;
+
+#define QUICLIB_TYPE_ADMISSION_ACTION quiclib_admission_action_get_type()
+
+GType quiclib_admission_action_get_type (void);
+typedef enum _GstQuicLibAdmissionAction {
+  QUICLIB_ADMISSION_ACTION_REFUSE,
+  QUICLIB_ADMISSION_ACTION_RETRY,
+  QUICLIB_ADMISSION_ACTION_VALIDATE
+} GstQuicLibAdmissionAction;
+
 #define GST_FLOW_QUIC_BLOCKED GST_FLOW_CUSTOM_ERROR_1
 #define GST_FLOW_QUIC_STREAM_CLOSED GST_FLOW_CUSTOM_ERROR_2
 #define GST_FLOW_QUIC_EXTENSION_NOT_SUPPORTED -103
@@ -90,6 +136,45 @@ typedef enum _GstQUICMode {
 #define QUICLIB_ENABLE_DATAGRAM_DEFAULT FALSE
 #define QUICLIB_SEND_DATAGRAMS_DEFAULT FALSE
 #define QUICLIB_ENABLE_STATS_DEFAULT TRUE
+#define QUICLIB_BUSY_POLL_DEFAULT 0
+#define QUICLIB_BUSY_POLL_BUDGET_DEFAULT 0
+#define QUICLIB_CPU_AFFINITY_DEFAULT NULL
+#define QUICLIB_THREAD_SCHED_POLICY_DEFAULT QUICLIB_THREAD_SCHED_OTHER
+#define QUICLIB_THREAD_PRIORITY_DEFAULT 0
+#define QUICLIB_IO_BACKEND_DEFAULT QUICLIB_IO_BACKEND_GSOCKET
+#define QUICLIB_ZEROCOPY_THRESHOLD_DEFAULT 0
+#define QUICLIB_ZEROCOPY_THRESHOLD_MIN 10240
+#define QUICLIB_DSCP_DEFAULT 0
+#define QUICLIB_RATE_LIMIT_DEFAULT 0
+#define QUICLIB_RATE_BURST_DEFAULT 0
+#define QUICLIB_PROBE_DURATION_DEFAULT 0
+#define QUICLIB_PROBE_DURATION_MAX 10000
+#define QUICLIB_EGRESS_RATE_LIMIT_DEFAULT 0
+#define QUICLIB_EGRESS_WEIGHT_DEFAULT 1
+#define QUICLIB_EGRESS_WEIGHT_MAX 1000
+#define QUICLIB_ADMISSION_MAX_LOAD_DEFAULT 0
+#define QUICLIB_ADMISSION_MAX_HANDSHAKES_DEFAULT 0
+#define QUICLIB_ADMISSION_MAX_MEMORY_DEFAULT 0
+#define QUICLIB_ADMISSION_ACTION_DEFAULT QUICLIB_ADMISSION_ACTION_REFUSE
+#define QUICLIB_ADMISSION_SHED_IDLE_DEFAULT 0
+#define QUICLIB_CONN_MEMORY_LIMIT_DEFAULT 0
+#define QUICLIB_SERVER_MEMORY_LIMIT_DEFAULT 0
+#define QUICLIB_IDLE_MODE_DEFAULT FALSE
+#define QUICLIB_XDP_INTERFACE_DEFAULT NULL
+#define QUICLIB_XDP_QUEUE_DEFAULT 0
+#define QUICLIB_XDP_QUEUE_MAX 63
+#define QUICLIB_XDP_SKB_MODE_DEFAULT FALSE
+#define QUICLIB_QUIC_LB_SERVER_ID_DEFAULT NULL
+#define QUICLIB_QUIC_LB_KEY_DEFAULT NULL
+#define QUICLIB_PREFERRED_ADDRESS_DEFAULT NULL
+#define QUICLIB_DSCP_MAX 63
+#define QUICLIB_STRIPE_CONNECTIONS_DEFAULT 1
+#define QUICLIB_STRIPE_CONNECTIONS_MAX 16
+#define QUICLIB_MULTIPATH_ADDRESSES_DEFAULT NULL
+#define QUICLIB_PATH_SCHEDULER_DEFAULT QUICLIB_PATH_SCHEDULER_LEAST_LOADED
+#define QUICLIB_PATH_WEIGHTS_DEFAULT NULL
+#define QUICLIB_FANOUT_POLICY_DEFAULT QUICLIB_FANOUT_POLICY_DROP
+#define QUICLIB_BITRATE_HINT_INTERVAL_DEFAULT 1000
 
 #define QUICLIB_CONTEXT_MODE "quic-ctx-mode"
 #define QUICLIB_CLIENT_CONNECT "quic-conn-connect"
@@ -107,6 +192,9 @@ typedef enum _GstQUICMode {
 #define QUICLIB_STREAM_STATE "quic-stream-state"
 #define QUICLIB_DATAGRAM "quic-datagram"
 #define QUICLIB_STATS "quic-stats"
+#define QUICLIB_BITRATE_HINT "quic-bitrate-hint"
+#define QUICLIB_BITRATE_KEY "bitrate"
+#define QUICLIB_CAPACITY_PROBE "quic-capacity-probe"
 
 
 #define GST_QUICLIB_COMMON_USER_TYPE gst_quiclib_common_user_get_type ()
@@ -163,9 +251,123 @@ GstQuicLibTransportConnection *
 gst_quiclib_get_client (GstQuicLibCommonUser *user, const gchar *location,
     const gchar *alpn);
 
+/**
+ * gst_quiclib_new_client
+ *
+ * As gst_quiclib_get_client, but always opens a new connection to the peer
+ * instead of reusing an existing one. Used to stripe several connections to
+ * the same peer.
+ */
+GstQuicLibTransportConnection *
+gst_quiclib_new_client (GstQuicLibCommonUser *user, const gchar *location,
+    const gchar *alpn);
+
 GInetSocketAddress *
 gst_quiclib_get_connection_peer (GstQuicLibTransportContext *conn);
 
+/**
+ * gst_quiclib_stripe_stream_id
+ * @stream_id: Stream ID on the connection.
+ * @stripe: Index of the connection in the stripe.
+ * @width: Number of connections in the stripe.
+ *
+ * Map a stream ID on one of a set of striped connections to a stream ID that
+ * is unique across the whole set. The two least significant bits that give
+ * the stream type and initiator are kept, so the result can be used anywhere
+ * a stream ID can. With a width of 1 the stream ID is returned unchanged.
+ */
+static inline guint64
+gst_quiclib_stripe_stream_id (guint64 stream_id, guint stripe, guint width)
+{
+  return ((((stream_id >> 2) * width) + stripe) << 2) | (stream_id & 0x3);
+}
+
+/**
+ * gst_quiclib_unstripe_stream_id
+ * @stream_id: Stream ID from gst_quiclib_stripe_stream_id.
+ * @width: Number of connections in the stripe.
+ * @stripe: (out): Index of the connection the stream belongs to.
+ *
+ * The reverse of gst_quiclib_stripe_stream_id.
+ *
+ * Returns: The stream ID on the connection at index @stripe.
+ */
+static inline guint64
+gst_quiclib_unstripe_stream_id (guint64 stream_id, guint width, guint *stripe)
+{
+  guint64 seq = stream_id >> 2;
+
+  *stripe = seq % width;
+  return ((seq / width) << 2) | (stream_id & 0x3);
+}
+
+/*
+ * With the redundant path scheduler, quicsink asks each striped connection to
+ * carry redundant datagrams, see
+ * gst_quiclib_transport_client_set_stripe_redundant. On every connection
+ * where the server accepts, each datagram is prefixed with a 64-bit sequence
+ * number in network byte order, and a copy of each is sent on all of them.
+ * quicsrc strips the header from every datagram on those connections and
+ * passes on the first copy of each sequence number to arrive. Copies more than
+ * QUICLIB_REDUNDANT_WINDOW sequence numbers behind the newest are treated as
+ * duplicates.
+ */
+#define QUICLIB_REDUNDANT_HEADER_LEN 8
+#define QUICLIB_REDUNDANT_WINDOW 64
+
+/**
+ * GstQuicLibRedundantWindow
+ * @seq_max: The highest redundant datagram sequence number seen.
+ * @seen: Bitmap of the sequence numbers seen up to QUICLIB_REDUNDANT_WINDOW
+ *    behind @seq_max, with bit 0 for @seq_max itself.
+ *
+ * Tracks which redundant datagrams have arrived, so that only the first copy
+ * of each is passed on. Zero it to start a new stripe.
+ */
+typedef struct {
+  guint64 seq_max;
+  guint64 seen;
+} GstQuicLibRedundantWindow;
+
+/**
+ * gst_quiclib_redundant_window_is_new
+ * @window: The window of the stripe the datagram arrived on.
+ * @seq: Sequence number from the datagram's header.
+ *
+ * Records that a copy of redundant datagram @seq has arrived.
+ *
+ * Returns: FALSE if a copy has been seen before, or @seq is too far behind
+ *    the newest to tell.
+ */
+static inline gboolean
+gst_quiclib_redundant_window_is_new (GstQuicLibRedundantWindow *window,
+    guint64 seq)
+{
+  guint64 behind;
+
+  if (seq > window->seq_max) {
+    guint64 ahead = seq - window->seq_max;
+
+    if (ahead >= QUICLIB_REDUNDANT_WINDOW) {
+      window->seen = 0;
+    } else {
+      window->seen <<= ahead;
+    }
+    window->seen |= 1;
+    window->seq_max = seq;
+    return TRUE;
+  }
+
+  behind = window->seq_max - seq;
+  if (behind >= QUICLIB_REDUNDANT_WINDOW ||
+      (window->seen & (G_GUINT64_CONSTANT (1) << behind))) {
+    return FALSE;
+  }
+
+  window->seen |= G_GUINT64_CONSTANT (1) << behind;
+  return TRUE;
+}
+
 void
 gst_quiclib_unref (GstQuicLibTransportContext *ctx,
     GstQuicLibCommonUser *user);
@@ -206,6 +408,49 @@ gst_quiclib_new_connection_error_element_event (GstElement *element,
 gboolean
 gst_quiclib_parse_connection_error_event (GstEvent *event, guint64 *error);
 
+/**
+ * gst_quiclib_new_bitrate_hint_event
+ * @pad: Sink pad to send the hint upstream from.
+ * @bitrate: Estimated capacity of the connection in bits/second.
+ *
+ * Tell upstream elements how fast the connection can currently send. Adaptive
+ * encoders, or the application via a pad probe, can use this to keep their
+ * output rate within what the connection can carry.
+ */
+gboolean
+gst_quiclib_new_bitrate_hint_event (GstPad *pad, guint64 bitrate);
+
+gboolean
+gst_quiclib_parse_bitrate_hint_event (GstEvent *event, guint64 *bitrate);
+
+/**
+ * gst_quiclib_new_capacity_probe_message
+ * @src: The element that probed the connection.
+ * @bitrate: Capacity of the connection in bits/second found by probing.
+ *
+ * Element message posted on the bus when the probe-duration window after the
+ * handshake ends, so that the application can pick the right starting
+ * rendition straight away instead of ramping up to it.
+ */
+GstMessage *
+gst_quiclib_new_capacity_probe_message (GstObject *src, guint64 bitrate);
+
+gboolean
+gst_quiclib_parse_capacity_probe_message (GstMessage *msg, guint64 *bitrate);
+
+/**
+ * gst_quiclib_latency_changed
+ * @reported: Latency last reported in a LATENCY query, or GST_CLOCK_TIME_NONE
+ *      if none has been.
+ * @current: Latency that would be reported now.
+ *
+ * Returns: TRUE if @current has moved far enough from @reported that the
+ *      element should post a latency message to have the pipeline latency
+ *      reconfigured.
+ */
+gboolean
+gst_quiclib_latency_changed (GstClockTime reported, GstClockTime current);
+
 GType quiclib_stream_type_get_type (void);
 typedef enum _GstQuicLibStreamType {
   QUIC_STREAM_BIDI,
@@ -319,7 +564,34 @@ void gst_quiclib_address_list_free (GstQuicLibAddressList *l);
   PROP_MAX_DATA_REMOTE, \
   PROP_ENABLE_DATAGRAM, \
   PROP_SEND_DATAGRAMS, \
-  PROP_ENABLE_STATS
+  PROP_ENABLE_STATS, \
+  PROP_BUSY_POLL, \
+  PROP_BUSY_POLL_BUDGET, \
+  PROP_CPU_AFFINITY, \
+  PROP_ASYNC_CPU_AFFINITY, \
+  PROP_THREAD_SCHED_POLICY, \
+  PROP_THREAD_PRIORITY, \
+  PROP_IO_BACKEND, \
+  PROP_ZEROCOPY_THRESHOLD, \
+  PROP_DSCP, \
+  PROP_RATE_LIMIT, \
+  PROP_RATE_BURST, \
+  PROP_PROBE_DURATION, \
+  PROP_EGRESS_RATE_LIMIT, \
+  PROP_ADMISSION_MAX_LOAD, \
+  PROP_ADMISSION_MAX_HANDSHAKES, \
+  PROP_ADMISSION_MAX_MEMORY, \
+  PROP_ADMISSION_ACTION, \
+  PROP_ADMISSION_SHED_IDLE, \
+  PROP_CONN_MEMORY_LIMIT, \
+  PROP_SERVER_MEMORY_LIMIT, \
+  PROP_IDLE_MODE, \
+  PROP_XDP_INTERFACE, \
+  PROP_XDP_QUEUE, \
+  PROP_XDP_SKB_MODE, \
+  PROP_QUIC_LB_SERVER_ID, \
+  PROP_QUIC_LB_KEY, \
+  PROP_PREFERRED_ADDRESS
 
 #define PROP_QUIC_ENDPOINT_SERVER_ENUMS \
   PROP_ALPN, \
@@ -370,7 +642,34 @@ void gst_quiclib_address_list_free (GstQuicLibAddressList *l);
   case PROP_MAX_DATA_REMOTE: \
   case PROP_ENABLE_DATAGRAM: \
   case PROP_SEND_DATAGRAMS: \
-  case PROP_ENABLE_STATS
+  case PROP_ENABLE_STATS: \
+  case PROP_BUSY_POLL: \
+  case PROP_BUSY_POLL_BUDGET: \
+  case PROP_CPU_AFFINITY: \
+  case PROP_ASYNC_CPU_AFFINITY: \
+  case PROP_THREAD_SCHED_POLICY: \
+  case PROP_THREAD_PRIORITY: \
+  case PROP_IO_BACKEND: \
+  case PROP_ZEROCOPY_THRESHOLD: \
+  case PROP_DSCP: \
+  case PROP_RATE_LIMIT: \
+  case PROP_RATE_BURST: \
+  case PROP_PROBE_DURATION: \
+  case PROP_EGRESS_RATE_LIMIT: \
+  case PROP_ADMISSION_MAX_LOAD: \
+  case PROP_ADMISSION_MAX_HANDSHAKES: \
+  case PROP_ADMISSION_MAX_MEMORY: \
+  case PROP_ADMISSION_ACTION: \
+  case PROP_ADMISSION_SHED_IDLE: \
+  case PROP_CONN_MEMORY_LIMIT: \
+  case PROP_SERVER_MEMORY_LIMIT: \
+  case PROP_IDLE_MODE: \
+  case PROP_XDP_INTERFACE: \
+  case PROP_XDP_QUEUE: \
+  case PROP_XDP_SKB_MODE: \
+  case PROP_QUIC_LB_SERVER_ID: \
+  case PROP_QUIC_LB_KEY: \
+  case PROP_PREFERRED_ADDRESS
 
 #define PROP_QUIC_ENDPOINT_SERVER_ENUM_CASES PROP_PRIVKEY_LOCATION: \
   case PROP_CERT_LOCATION: \
@@ -399,7 +698,34 @@ void gst_quiclib_address_list_free (GstQuicLibAddressList *l);
   guint64 max_data_remote_init; \
   gboolean enable_datagram; \
   gboolean send_datagrams; \
-  gboolean enable_stats;
+  gboolean enable_stats; \
+  guint busy_poll; \
+  guint busy_poll_budget; \
+  gchar *cpu_affinity; \
+  gchar *async_cpu_affinity; \
+  GstQuicLibThreadSchedPolicy thread_sched_policy; \
+  guint thread_priority; \
+  GstQuicLibIOBackend io_backend; \
+  guint zerocopy_threshold; \
+  guint dscp; \
+  guint64 rate_limit; \
+  guint64 rate_burst; \
+  guint probe_duration; \
+  guint64 egress_rate_limit; \
+  guint admission_max_load; \
+  guint admission_max_handshakes; \
+  guint64 admission_max_memory; \
+  GstQuicLibAdmissionAction admission_action; \
+  guint admission_shed_idle; \
+  guint64 conn_memory_limit; \
+  guint64 server_memory_limit; \
+  gboolean idle_mode; \
+  gchar *xdp_interface; \
+  guint xdp_queue; \
+  gboolean xdp_skb_mode; \
+  gchar *quic_lb_server_id; \
+  gchar *quic_lb_key; \
+  gchar *preferred_address;
 
 #define gst_quiclib_common_init_endpoint_properties(inst) \
   do { \
@@ -417,6 +743,48 @@ void gst_quiclib_address_list_free (GstQuicLibAddressList *l);
     inst->enable_datagram = QUICLIB_ENABLE_DATAGRAM_DEFAULT; \
     inst->send_datagrams = QUICLIB_SEND_DATAGRAMS_DEFAULT; \
     inst->enable_stats = QUICLIB_ENABLE_STATS_DEFAULT; \
+    inst->busy_poll = QUICLIB_BUSY_POLL_DEFAULT; \
+    inst->busy_poll_budget = QUICLIB_BUSY_POLL_BUDGET_DEFAULT; \
+    inst->cpu_affinity = g_strdup (QUICLIB_CPU_AFFINITY_DEFAULT); \
+    inst->async_cpu_affinity = g_strdup (QUICLIB_CPU_AFFINITY_DEFAULT); \
+    inst->thread_sched_policy = QUICLIB_THREAD_SCHED_POLICY_DEFAULT; \
+    inst->thread_priority = QUICLIB_THREAD_PRIORITY_DEFAULT; \
+    inst->io_backend = QUICLIB_IO_BACKEND_DEFAULT; \
+    inst->zerocopy_threshold = QUICLIB_ZEROCOPY_THRESHOLD_DEFAULT; \
+    inst->dscp = QUICLIB_DSCP_DEFAULT; \
+    inst->rate_limit = QUICLIB_RATE_LIMIT_DEFAULT; \
+    inst->rate_burst = QUICLIB_RATE_BURST_DEFAULT; \
+    inst->probe_duration = QUICLIB_PROBE_DURATION_DEFAULT; \
+    inst->egress_rate_limit = QUICLIB_EGRESS_RATE_LIMIT_DEFAULT; \
+    inst->admission_max_load = QUICLIB_ADMISSION_MAX_LOAD_DEFAULT; \
+    inst->admission_max_handshakes = QUICLIB_ADMISSION_MAX_HANDSHAKES_DEFAULT; \
+    inst->admission_max_memory = QUICLIB_ADMISSION_MAX_MEMORY_DEFAULT; \
+    inst->admission_action = QUICLIB_ADMISSION_ACTION_DEFAULT; \
+    inst->admission_shed_idle = QUICLIB_ADMISSION_SHED_IDLE_DEFAULT; \
+    inst->conn_memory_limit = QUICLIB_CONN_MEMORY_LIMIT_DEFAULT; \
+    inst->server_memory_limit = QUICLIB_SERVER_MEMORY_LIMIT_DEFAULT; \
+    inst->idle_mode = QUICLIB_IDLE_MODE_DEFAULT; \
+    inst->xdp_interface = g_strdup (QUICLIB_XDP_INTERFACE_DEFAULT); \
+    inst->xdp_queue = QUICLIB_XDP_QUEUE_DEFAULT; \
+    inst->xdp_skb_mode = QUICLIB_XDP_SKB_MODE_DEFAULT; \
+    inst->quic_lb_server_id = g_strdup (QUICLIB_QUIC_LB_SERVER_ID_DEFAULT); \
+    inst->quic_lb_key = g_strdup (QUICLIB_QUIC_LB_KEY_DEFAULT); \
+    inst->preferred_address = g_strdup (QUICLIB_PREFERRED_ADDRESS_DEFAULT); \
+  } while (0);
+
+#define gst_quiclib_common_free_endpoint_properties(inst) \
+  do { \
+    g_free (inst->location); \
+    g_free (inst->alpn); \
+    g_free (inst->privkey_location); \
+    g_free (inst->cert_location); \
+    g_free (inst->sni); \
+    g_free (inst->cpu_affinity); \
+    g_free (inst->async_cpu_affinity); \
+    g_free (inst->xdp_interface); \
+    g_free (inst->quic_lb_server_id); \
+    g_free (inst->quic_lb_key); \
+    g_free (inst->preferred_address); \
   } while (0);
 
 #define gst_quiclib_common_install_endpoint_properties(klass) \
@@ -446,6 +814,33 @@ void gst_quiclib_address_list_free (GstQuicLibAddressList *l);
     gst_quiclib_common_install_enable_datagram_property (klass); \
     gst_quiclib_common_install_send_datagrams_property (klass); \
     gst_quiclib_common_install_enable_stats_property (klass); \
+    gst_quiclib_common_install_busy_poll_property (klass); \
+    gst_quiclib_common_install_busy_poll_budget_property (klass); \
+    gst_quiclib_common_install_cpu_affinity_property (klass); \
+    gst_quiclib_common_install_async_cpu_affinity_property (klass); \
+    gst_quiclib_common_install_thread_sched_policy_property (klass); \
+    gst_quiclib_common_install_thread_priority_property (klass); \
+    gst_quiclib_common_install_io_backend_property (klass); \
+    gst_quiclib_common_install_zerocopy_threshold_property (klass); \
+    gst_quiclib_common_install_dscp_property (klass); \
+    gst_quiclib_common_install_rate_limit_property (klass); \
+    gst_quiclib_common_install_rate_burst_property (klass); \
+    gst_quiclib_common_install_probe_duration_property (klass); \
+    gst_quiclib_common_install_egress_rate_limit_property (klass); \
+    gst_quiclib_common_install_admission_max_load_property (klass); \
+    gst_quiclib_common_install_admission_max_handshakes_property (klass); \
+    gst_quiclib_common_install_admission_max_memory_property (klass); \
+    gst_quiclib_common_install_admission_action_property (klass); \
+    gst_quiclib_common_install_admission_shed_idle_property (klass); \
+    gst_quiclib_common_install_conn_memory_limit_property (klass); \
+    gst_quiclib_common_install_server_memory_limit_property (klass); \
+    gst_quiclib_common_install_idle_mode_property (klass); \
+    gst_quiclib_common_install_xdp_interface_property (klass); \
+    gst_quiclib_common_install_xdp_queue_property (klass); \
+    gst_quiclib_common_install_xdp_skb_mode_property (klass); \
+    gst_quiclib_common_install_quic_lb_server_id_property (klass); \
+    gst_quiclib_common_install_quic_lb_key_property (klass); \
+    gst_quiclib_common_install_preferred_address_property (klass); \
   } while (0); \
 
 #define PROP_LOCATION_SHORT "location"
@@ -674,6 +1069,345 @@ void gst_quiclib_address_list_free (GstQuicLibAddressList *l);
             "queried using the gst_quiclib_transport_get_conn_stats API call", \
             QUICLIB_ENABLE_STATS_DEFAULT, G_PARAM_READWRITE));
 
+#define PROP_BUSY_POLL_SHORTNAME "busy-poll"
+#define gst_quiclib_common_install_busy_poll_property(klass) \
+    g_object_class_install_property (klass, PROP_BUSY_POLL, \
+        g_param_spec_uint (PROP_BUSY_POLL_SHORTNAME, \
+            "Socket busy poll timeout", \
+            "Time in microseconds the kernel should busy poll the device " \
+            "queue for packets on the UDP socket (SO_BUSY_POLL). 0 disables " \
+            "busy polling. Only takes effect when the socket is opened.", \
+            0, G_MAXINT, QUICLIB_BUSY_POLL_DEFAULT, G_PARAM_READWRITE));
+
+#define PROP_BUSY_POLL_BUDGET_SHORTNAME "busy-poll-budget"
+#define gst_quiclib_common_install_busy_poll_budget_property(klass) \
+    g_object_class_install_property (klass, PROP_BUSY_POLL_BUDGET, \
+        g_param_spec_uint (PROP_BUSY_POLL_BUDGET_SHORTNAME, \
+            "Receive spin budget", \
+            "Time in microseconds the transport thread keeps spinning on " \
+            "non-blocking receives after the socket runs dry, before " \
+            "falling back to blocking in poll(). 0 disables spinning.", \
+            0, G_MAXUINT, QUICLIB_BUSY_POLL_BUDGET_DEFAULT, \
+            G_PARAM_READWRITE));
+
+#define PROP_CPU_AFFINITY_SHORTNAME "cpu-affinity"
+#define gst_quiclib_common_install_cpu_affinity_property(klass) \
+    g_object_class_install_property (klass, PROP_CPU_AFFINITY, \
+        g_param_spec_string (PROP_CPU_AFFINITY_SHORTNAME, \
+            "Transport thread CPU affinity", \
+            "List of CPUs to pin the transport thread to, in the format " \
+            "\"0-3,6\". Unset or empty leaves the thread unpinned. Only " \
+            "takes effect when the socket is opened.", \
+            QUICLIB_CPU_AFFINITY_DEFAULT, G_PARAM_READWRITE));
+
+#define PROP_ASYNC_CPU_AFFINITY_SHORTNAME "async-cpu-affinity"
+#define gst_quiclib_common_install_async_cpu_affinity_property(klass) \
+    g_object_class_install_property (klass, PROP_ASYNC_CPU_AFFINITY, \
+        g_param_spec_string (PROP_ASYNC_CPU_AFFINITY_SHORTNAME, \
+            "Asynchronous notification thread CPU affinity", \
+            "List of CPUs to pin the asynchronous notification thread to, in " \
+            "the same format as " PROP_CPU_AFFINITY_SHORTNAME ". Unset or " \
+            "empty leaves the thread unpinned.", \
+            QUICLIB_CPU_AFFINITY_DEFAULT, G_PARAM_READWRITE));
+
+#define PROP_THREAD_SCHED_POLICY_SHORTNAME "thread-sched-policy"
+#define gst_quiclib_common_install_thread_sched_policy_property(klass) \
+    g_object_class_install_property (klass, PROP_THREAD_SCHED_POLICY, \
+        g_param_spec_enum (PROP_THREAD_SCHED_POLICY_SHORTNAME, \
+            "Transport thread scheduling policy", \
+            "Scheduling policy for the transport and asynchronous " \
+            "notification threads. The real-time policies need " \
+            "CAP_SYS_NICE or a suitable RLIMIT_RTPRIO.", \
+            QUICLIB_TYPE_THREAD_SCHED_POLICY, \
+            QUICLIB_THREAD_SCHED_POLICY_DEFAULT, G_PARAM_READWRITE));
+
+#define PROP_THREAD_PRIORITY_SHORTNAME "thread-priority"
+#define gst_quiclib_common_install_thread_priority_property(klass) \
+    g_object_class_install_property (klass, PROP_THREAD_PRIORITY, \
+        g_param_spec_uint (PROP_THREAD_PRIORITY_SHORTNAME, \
+            "Transport thread real-time priority", \
+            "Static priority to run the transport threads at when " \
+            PROP_THREAD_SCHED_POLICY_SHORTNAME " is fifo or rr. Clamped to " \
+            "the range supported by the policy.", \
+            0, 99, QUICLIB_THREAD_PRIORITY_DEFAULT, G_PARAM_READWRITE));
+
+#define PROP_IO_BACKEND_SHORTNAME "io-backend"
+#define gst_quiclib_common_install_io_backend_property(klass) \
+    g_object_class_install_property (klass, PROP_IO_BACKEND, \
+        g_param_spec_enum (PROP_IO_BACKEND_SHORTNAME, \
+            "Socket I/O backend", \
+            "Mechanism used to send and receive UDP packets. If the selected " \
+            "backend isn't available at runtime, GSocket is used instead. " \
+            "af-xdp needs " PROP_XDP_INTERFACE_SHORTNAME " to be set, and " \
+            "the capabilities to load an XDP program on it.", \
+            QUICLIB_TYPE_IO_BACKEND, QUICLIB_IO_BACKEND_DEFAULT, \
+            G_PARAM_READWRITE));
+
+#define PROP_ZEROCOPY_THRESHOLD_SHORTNAME "zerocopy-threshold"
+#define gst_quiclib_common_install_zerocopy_threshold_property(klass) \
+    g_object_class_install_property (klass, PROP_ZEROCOPY_THRESHOLD, \
+        g_param_spec_uint (PROP_ZEROCOPY_THRESHOLD_SHORTNAME, \
+            "Zero-copy send threshold", \
+            "Send UDP payloads of at least this many bytes with MSG_ZEROCOPY. " \
+            "Zero-copy has a per-send completion cost, and only pays off for " \
+            "sends of around 10KB or more, so lower values are raised to " \
+            "10240. Each send is a single datagram, so this only has an " \
+            "effect on paths with a larger maximum UDP payload, such as " \
+            "loopback. 0 disables zero-copy. Only supported by the gsocket " \
+            "I/O backend.", \
+            0, G_MAXUINT, QUICLIB_ZEROCOPY_THRESHOLD_DEFAULT, \
+            G_PARAM_READWRITE));
+
+#define PROP_DSCP_SHORTNAME "dscp"
+#define gst_quiclib_common_install_dscp_property(klass) \
+    g_object_class_install_property (klass, PROP_DSCP, \
+        g_param_spec_uint (PROP_DSCP_SHORTNAME, "DSCP", \
+            "Default Differentiated Services Code Point to mark outgoing " \
+            "packets with. Streams and datagrams can override this, and a " \
+            "packet carrying frames of several classes takes the highest.", \
+            0, QUICLIB_DSCP_MAX, QUICLIB_DSCP_DEFAULT, G_PARAM_READWRITE));
+
+#define PROP_RATE_LIMIT_SHORTNAME "rate-limit"
+#define gst_quiclib_common_install_rate_limit_property(klass) \
+    g_object_class_install_property (klass, PROP_RATE_LIMIT, \
+        g_param_spec_uint64 (PROP_RATE_LIMIT_SHORTNAME, "Rate limit", \
+            "Limit in bits/second on the data sent by each connection, " \
+            "enforced with a token bucket. Stream data over the limit is " \
+            "held back rather than blocking the sender. 0 for no limit.", \
+            0, G_MAXUINT64, QUICLIB_RATE_LIMIT_DEFAULT, G_PARAM_READWRITE));
+
+#define PROP_RATE_BURST_SHORTNAME "rate-burst"
+#define gst_quiclib_common_install_rate_burst_property(klass) \
+    g_object_class_install_property (klass, PROP_RATE_BURST, \
+        g_param_spec_uint64 (PROP_RATE_BURST_SHORTNAME, "Rate burst", \
+            "Size in bytes of the token bucket that " \
+            PROP_RATE_LIMIT_SHORTNAME " is enforced with, which is how much " \
+            "can be sent at once after a quiet period. 0 for 100ms worth " \
+            "of the rate limit.", \
+            0, G_MAXUINT64, QUICLIB_RATE_BURST_DEFAULT, G_PARAM_READWRITE));
+
+#define PROP_PROBE_DURATION_SHORTNAME "probe-duration"
+#define gst_quiclib_common_install_probe_duration_property(klass) \
+    g_object_class_install_property (klass, PROP_PROBE_DURATION, \
+        g_param_spec_uint (PROP_PROBE_DURATION_SHORTNAME, \
+            "Probe duration", \
+            "Time in milliseconds after the handshake to fill the spare " \
+            "congestion window with probe DATAGRAM frames, so that " \
+            "congestion control ramps up to the path capacity before the " \
+            "media does. Needs DATAGRAM support at both ends, and must be " \
+            "set at both ends, as the receiving end only discards probes " \
+            "when its own probe-duration is above 0. 0 disables probing.", \
+            0, QUICLIB_PROBE_DURATION_MAX, QUICLIB_PROBE_DURATION_DEFAULT, \
+            G_PARAM_READWRITE));
+
+#define PROP_EGRESS_RATE_LIMIT_SHORTNAME "egress-rate-limit"
+#define gst_quiclib_common_install_egress_rate_limit_property(klass) \
+    g_object_class_install_property (klass, PROP_EGRESS_RATE_LIMIT, \
+        g_param_spec_uint64 (PROP_EGRESS_RATE_LIMIT_SHORTNAME, \
+            "Egress rate limit", \
+            "In server mode, a cap in bits/second on the data sent by all " \
+            "of the server's connections together. Stream data over the " \
+            "cap is held back and shared out between the connections by " \
+            "weighted fair queueing. 0 for no cap.", \
+            0, G_MAXUINT64, QUICLIB_EGRESS_RATE_LIMIT_DEFAULT, \
+            G_PARAM_READWRITE));
+
+#define PROP_ADMISSION_MAX_LOAD_SHORTNAME "admission-max-load"
+#define gst_quiclib_common_install_admission_max_load_property(klass) \
+    g_object_class_install_property (klass, PROP_ADMISSION_MAX_LOAD, \
+        g_param_spec_uint (PROP_ADMISSION_MAX_LOAD_SHORTNAME, \
+            "Admission max load", \
+            "In server mode, the percentage of the transport thread's time " \
+            "spent busy above which new connections are turned away. 0 to " \
+            "not limit on load.", \
+            0, 100, QUICLIB_ADMISSION_MAX_LOAD_DEFAULT, G_PARAM_READWRITE));
+
+#define PROP_ADMISSION_MAX_HANDSHAKES_SHORTNAME "admission-max-handshakes"
+#define gst_quiclib_common_install_admission_max_handshakes_property(klass) \
+    g_object_class_install_property (klass, PROP_ADMISSION_MAX_HANDSHAKES, \
+        g_param_spec_uint (PROP_ADMISSION_MAX_HANDSHAKES_SHORTNAME, \
+            "Admission max handshakes", \
+            "In server mode, the number of handshakes in progress above " \
+            "which new connections are turned away. 0 for no limit.", \
+            0, G_MAXUINT, QUICLIB_ADMISSION_MAX_HANDSHAKES_DEFAULT, \
+            G_PARAM_READWRITE));
+
+#define PROP_ADMISSION_MAX_MEMORY_SHORTNAME "admission-max-memory"
+#define gst_quiclib_common_install_admission_max_memory_property(klass) \
+    g_object_class_install_property (klass, PROP_ADMISSION_MAX_MEMORY, \
+        g_param_spec_uint64 (PROP_ADMISSION_MAX_MEMORY_SHORTNAME, \
+            "Admission max memory", \
+            "In server mode, the resident memory of the process in bytes " \
+            "above which new connections are turned away. 0 for no limit.", \
+            0, G_MAXUINT64, QUICLIB_ADMISSION_MAX_MEMORY_DEFAULT, \
+            G_PARAM_READWRITE));
+
+#define PROP_ADMISSION_ACTION_SHORTNAME "admission-action"
+#define gst_quiclib_common_install_admission_action_property(klass) \
+    g_object_class_install_property (klass, PROP_ADMISSION_ACTION, \
+        g_param_spec_enum (PROP_ADMISSION_ACTION_SHORTNAME, \
+            "Admission action", \
+            "How a server turns away new connections while it is over one " \
+            "of its admission limits.", \
+            QUICLIB_TYPE_ADMISSION_ACTION, QUICLIB_ADMISSION_ACTION_DEFAULT, \
+            G_PARAM_READWRITE));
+
+#define PROP_ADMISSION_SHED_IDLE_SHORTNAME "admission-shed-idle"
+#define gst_quiclib_common_install_admission_shed_idle_property(klass) \
+    g_object_class_install_property (klass, PROP_ADMISSION_SHED_IDLE, \
+        g_param_spec_uint (PROP_ADMISSION_SHED_IDLE_SHORTNAME, \
+            "Admission shed idle", \
+            "In server mode, while over one of the admission limits, close " \
+            "connections that have been idle for this many seconds, lowest " \
+            "egress weight first. 0 to never close connections.", \
+            0, G_MAXUINT, QUICLIB_ADMISSION_SHED_IDLE_DEFAULT, \
+            G_PARAM_READWRITE));
+
+#define PROP_CONN_MEMORY_LIMIT_SHORTNAME "conn-memory-limit"
+#define gst_quiclib_common_install_conn_memory_limit_property(klass) \
+    g_object_class_install_property (klass, PROP_CONN_MEMORY_LIMIT, \
+        g_param_spec_uint64 (PROP_CONN_MEMORY_LIMIT_SHORTNAME, \
+            "Connection memory limit", \
+            "The bytes that a connection may pin in unacknowledged, queued " \
+            "and undelivered data and QUIC state before sending blocks and " \
+            "datagrams are dropped. 0 for no limit.", \
+            0, G_MAXUINT64, QUICLIB_CONN_MEMORY_LIMIT_DEFAULT, \
+            G_PARAM_READWRITE));
+
+#define PROP_SERVER_MEMORY_LIMIT_SHORTNAME "server-memory-limit"
+#define gst_quiclib_common_install_server_memory_limit_property(klass) \
+    g_object_class_install_property (klass, PROP_SERVER_MEMORY_LIMIT, \
+        g_param_spec_uint64 (PROP_SERVER_MEMORY_LIMIT_SHORTNAME, \
+            "Server memory limit", \
+            "In server mode, the bytes that all connections together may " \
+            "pin before every connection is held back and new connections " \
+            "are turned away. 0 for no limit.", \
+            0, G_MAXUINT64, QUICLIB_SERVER_MEMORY_LIMIT_DEFAULT, \
+            G_PARAM_READWRITE));
+
+#define PROP_IDLE_MODE_SHORTNAME "idle-mode"
+#define gst_quiclib_common_install_idle_mode_property(klass) \
+    g_object_class_install_property (klass, PROP_IDLE_MODE, \
+        g_param_spec_boolean (PROP_IDLE_MODE_SHORTNAME, \
+            "Idle mode", \
+            "Run client connections on a small pool of loop threads shared " \
+            "by the whole process instead of two threads of their own, " \
+            "release their buffer caches while they have nothing in flight " \
+            "and coalesce their idle timer wakeups. The CPU affinity, " \
+            "real-time scheduling and busy-poll-budget settings don't " \
+            "apply to the shared threads", \
+            QUICLIB_IDLE_MODE_DEFAULT, G_PARAM_READWRITE));
+
+#define PROP_XDP_INTERFACE_SHORTNAME "xdp-interface"
+#define gst_quiclib_common_install_xdp_interface_property(klass) \
+    g_object_class_install_property (klass, PROP_XDP_INTERFACE, \
+        g_param_spec_string (PROP_XDP_INTERFACE_SHORTNAME, \
+            "AF_XDP interface", \
+            "Network interface to attach the AF_XDP socket to when " \
+            PROP_IO_BACKEND_SHORTNAME " is af-xdp", \
+            QUICLIB_XDP_INTERFACE_DEFAULT, G_PARAM_READWRITE));
+
+#define PROP_XDP_QUEUE_SHORTNAME "xdp-queue"
+#define gst_quiclib_common_install_xdp_queue_property(klass) \
+    g_object_class_install_property (klass, PROP_XDP_QUEUE, \
+        g_param_spec_uint (PROP_XDP_QUEUE_SHORTNAME, \
+            "AF_XDP queue", \
+            "Receive queue of " PROP_XDP_INTERFACE_SHORTNAME " that the " \
+            "AF_XDP socket is bound to. Packets for the socket's port that " \
+            "arrive on any other queue are read through the kernel as " \
+            "usual, so steer them to this queue for the full benefit.", \
+            0, QUICLIB_XDP_QUEUE_MAX, QUICLIB_XDP_QUEUE_DEFAULT, \
+            G_PARAM_READWRITE));
+
+#define PROP_XDP_SKB_MODE_SHORTNAME "xdp-skb-mode"
+#define gst_quiclib_common_install_xdp_skb_mode_property(klass) \
+    g_object_class_install_property (klass, PROP_XDP_SKB_MODE, \
+        g_param_spec_boolean (PROP_XDP_SKB_MODE_SHORTNAME, \
+            "AF_XDP generic mode", \
+            "Attach the XDP program in generic (SKB) mode and copy packets " \
+            "to and from the AF_XDP socket, for interfaces whose drivers " \
+            "don't support native XDP, such as veth", \
+            QUICLIB_XDP_SKB_MODE_DEFAULT, G_PARAM_READWRITE));
+
+#define PROP_QUIC_LB_SERVER_ID_SHORTNAME "quic-lb-server-id"
+#define gst_quiclib_common_install_quic_lb_server_id_property(klass) \
+    g_object_class_install_property (klass, PROP_QUIC_LB_SERVER_ID, \
+        g_param_spec_string (PROP_QUIC_LB_SERVER_ID_SHORTNAME, \
+            "QUIC-LB server ID", \
+            "Hex server ID to encode in the connection IDs issued in server " \
+            "mode, in the QUIC-LB format, so that a load balancer can route " \
+            "connections to this server. Unset for random connection IDs.", \
+            QUICLIB_QUIC_LB_SERVER_ID_DEFAULT, G_PARAM_READWRITE));
+
+#define PROP_QUIC_LB_KEY_SHORTNAME "quic-lb-key"
+#define gst_quiclib_common_install_quic_lb_key_property(klass) \
+    g_object_class_install_property (klass, PROP_QUIC_LB_KEY, \
+        g_param_spec_string (PROP_QUIC_LB_KEY_SHORTNAME, "QUIC-LB key", \
+            "Hex AES-128 key shared with the load balancer to encrypt the " \
+            PROP_QUIC_LB_SERVER_ID_SHORTNAME " in connection IDs with. Unset " \
+            "to send the server ID in the clear.", \
+            QUICLIB_QUIC_LB_KEY_DEFAULT, G_PARAM_READWRITE));
+
+#define PROP_PREFERRED_ADDRESS_SHORTNAME "preferred-address"
+#define gst_quiclib_common_install_preferred_address_property(klass) \
+    g_object_class_install_property (klass, PROP_PREFERRED_ADDRESS, \
+        g_param_spec_string (PROP_PREFERRED_ADDRESS_SHORTNAME, \
+            "Preferred address", \
+            "Comma separated list of at most one IPv4 and one IPv6 " \
+            "address:port that clients are asked to migrate to once the " \
+            "handshake has completed in server mode, such as " \
+            "\"192.0.2.1:4443,[2001:db8::1]:4443\". Unset to keep clients " \
+            "on the address they connected to.", \
+            QUICLIB_PREFERRED_ADDRESS_DEFAULT, G_PARAM_READWRITE));
+
+/*
+ * Not one of the common endpoint properties, as it belongs to the element
+ * rather than any one transport context. Elements that support striping
+ * install it with their own PROP_STRIPE_CONNECTIONS enum value.
+ */
+#define PROP_STRIPE_CONNECTIONS_SHORTNAME "stripe-connections"
+#define gst_quiclib_common_install_stripe_connections_property(klass) \
+    g_object_class_install_property (klass, PROP_STRIPE_CONNECTIONS, \
+        g_param_spec_uint (PROP_STRIPE_CONNECTIONS_SHORTNAME, \
+            "Stripe connections", \
+            "Number of parallel connections to the peer to spread streams " \
+            "and datagrams across, each with its own congestion controller. " \
+            "Stream IDs are remapped so that the set appears as a single " \
+            "connection.", \
+            1, QUICLIB_STRIPE_CONNECTIONS_MAX, \
+            QUICLIB_STRIPE_CONNECTIONS_DEFAULT, G_PARAM_READWRITE));
+
+/*
+ * Element properties for running striped connections over several local
+ * interfaces, installed with the element's own enum values as above.
+ */
+#define PROP_MULTIPATH_ADDRESSES_SHORTNAME "multipath-addresses"
+#define gst_quiclib_common_install_multipath_addresses_property(klass) \
+    g_object_class_install_property (klass, PROP_MULTIPATH_ADDRESSES, \
+        g_param_spec_string (PROP_MULTIPATH_ADDRESSES_SHORTNAME, \
+            "Multipath local addresses", \
+            "Comma separated list of local IP addresses to open a path from " \
+            "in client mode. Each path is a striped connection bound to that " \
+            "address, and this overrides stripe-connections.", \
+            QUICLIB_MULTIPATH_ADDRESSES_DEFAULT, G_PARAM_READWRITE));
+
+#define PROP_PATH_SCHEDULER_SHORTNAME "path-scheduler"
+#define gst_quiclib_common_install_path_scheduler_property(klass) \
+    g_object_class_install_property (klass, PROP_PATH_SCHEDULER, \
+        g_param_spec_enum (PROP_PATH_SCHEDULER_SHORTNAME, "Path scheduler", \
+            "How new streams and datagrams are spread across striped " \
+            "connections", QUICLIB_TYPE_PATH_SCHEDULER, \
+            QUICLIB_PATH_SCHEDULER_DEFAULT, G_PARAM_READWRITE));
+
+#define PROP_PATH_WEIGHTS_SHORTNAME "path-weights"
+#define gst_quiclib_common_install_path_weights_property(klass) \
+    g_object_class_install_property (klass, PROP_PATH_WEIGHTS, \
+        g_param_spec_string (PROP_PATH_WEIGHTS_SHORTNAME, "Path weights", \
+            "Comma separated list of relative weights for each striped " \
+            "connection, in order, for the weighted path scheduler. Missing " \
+            "weights default to 1.", \
+            QUICLIB_PATH_WEIGHTS_DEFAULT, G_PARAM_READWRITE));
+
 #define gst_quiclib_common_set_endpoint_property_checked( \
     obj, tctx, pspec, prop_id, value) \
   do { \
@@ -742,6 +1476,97 @@ void gst_quiclib_address_list_free (GstQuicLibAddressList *l);
       case PROP_ENABLE_STATS: \
         obj->enable_stats = g_value_get_boolean (value); \
         break; \
+      case PROP_BUSY_POLL: \
+        obj->busy_poll = g_value_get_uint (value); \
+        break; \
+      case PROP_BUSY_POLL_BUDGET: \
+        obj->busy_poll_budget = g_value_get_uint (value); \
+        break; \
+      case PROP_CPU_AFFINITY: \
+        if (obj->cpu_affinity) { \
+          g_free (obj->cpu_affinity); \
+        } \
+        obj->cpu_affinity = g_value_dup_string (value); \
+        break; \
+      case PROP_ASYNC_CPU_AFFINITY: \
+        if (obj->async_cpu_affinity) { \
+          g_free (obj->async_cpu_affinity); \
+        } \
+        obj->async_cpu_affinity = g_value_dup_string (value); \
+        break; \
+      case PROP_THREAD_SCHED_POLICY: \
+        obj->thread_sched_policy = g_value_get_enum (value); \
+        break; \
+      case PROP_THREAD_PRIORITY: \
+        obj->thread_priority = g_value_get_uint (value); \
+        break; \
+      case PROP_IO_BACKEND: \
+        obj->io_backend = g_value_get_enum (value); \
+        break; \
+      case PROP_ZEROCOPY_THRESHOLD: \
+        obj->zerocopy_threshold = g_value_get_uint (value); \
+        break; \
+      case PROP_DSCP: \
+        obj->dscp = g_value_get_uint (value); \
+        break; \
+      case PROP_RATE_LIMIT: \
+        obj->rate_limit = g_value_get_uint64 (value); \
+        break; \
+      case PROP_RATE_BURST: \
+        obj->rate_burst = g_value_get_uint64 (value); \
+        break; \
+      case PROP_PROBE_DURATION: \
+        obj->probe_duration = g_value_get_uint (value); \
+        break; \
+      case PROP_EGRESS_RATE_LIMIT: \
+        obj->egress_rate_limit = g_value_get_uint64 (value); \
+        break; \
+      case PROP_ADMISSION_MAX_LOAD: \
+        obj->admission_max_load = g_value_get_uint (value); \
+        break; \
+      case PROP_ADMISSION_MAX_HANDSHAKES: \
+        obj->admission_max_handshakes = g_value_get_uint (value); \
+        break; \
+      case PROP_ADMISSION_MAX_MEMORY: \
+        obj->admission_max_memory = g_value_get_uint64 (value); \
+        break; \
+      case PROP_ADMISSION_ACTION: \
+        obj->admission_action = g_value_get_enum (value); \
+        break; \
+      case PROP_ADMISSION_SHED_IDLE: \
+        obj->admission_shed_idle = g_value_get_uint (value); \
+        break; \
+      case PROP_CONN_MEMORY_LIMIT: \
+        obj->conn_memory_limit = g_value_get_uint64 (value); \
+        break; \
+      case PROP_SERVER_MEMORY_LIMIT: \
+        obj->server_memory_limit = g_value_get_uint64 (value); \
+        break; \
+      case PROP_IDLE_MODE: \
+        obj->idle_mode = g_value_get_boolean (value); \
+        break; \
+      case PROP_XDP_INTERFACE: \
+        g_free (obj->xdp_interface); \
+        obj->xdp_interface = g_value_dup_string (value); \
+        break; \
+      case PROP_XDP_QUEUE: \
+        obj->xdp_queue = g_value_get_uint (value); \
+        break; \
+      case PROP_XDP_SKB_MODE: \
+        obj->xdp_skb_mode = g_value_get_boolean (value); \
+        break; \
+      case PROP_QUIC_LB_SERVER_ID: \
+        g_free (obj->quic_lb_server_id); \
+        obj->quic_lb_server_id = g_value_dup_string (value); \
+        break; \
+      case PROP_QUIC_LB_KEY: \
+        g_free (obj->quic_lb_key); \
+        obj->quic_lb_key = g_value_dup_string (value); \
+        break; \
+      case PROP_PREFERRED_ADDRESS: \
+        g_free (obj->preferred_address); \
+        obj->preferred_address = g_value_dup_string (value); \
+        break; \
       /* Read-only properties start */ \
       case PROP_MAX_STREAMS_BIDI_LOCAL: \
       case PROP_BIDI_STREAMS_REMAINING_LOCAL: \
@@ -815,6 +1640,87 @@ void gst_quiclib_address_list_free (GstQuicLibAddressList *l);
         case PROP_ENABLE_STATS: \
           g_value_set_boolean (value, obj->enable_stats); \
           break; \
+        case PROP_BUSY_POLL: \
+          g_value_set_uint (value, obj->busy_poll); \
+          break; \
+        case PROP_BUSY_POLL_BUDGET: \
+          g_value_set_uint (value, obj->busy_poll_budget); \
+          break; \
+        case PROP_CPU_AFFINITY: \
+          g_value_set_string (value, obj->cpu_affinity); \
+          break; \
+        case PROP_ASYNC_CPU_AFFINITY: \
+          g_value_set_string (value, obj->async_cpu_affinity); \
+          break; \
+        case PROP_THREAD_SCHED_POLICY: \
+          g_value_set_enum (value, obj->thread_sched_policy); \
+          break; \
+        case PROP_THREAD_PRIORITY: \
+          g_value_set_uint (value, obj->thread_priority); \
+          break; \
+        case PROP_IO_BACKEND: \
+          g_value_set_enum (value, obj->io_backend); \
+          break; \
+        case PROP_ZEROCOPY_THRESHOLD: \
+          g_value_set_uint (value, obj->zerocopy_threshold); \
+          break; \
+        case PROP_DSCP: \
+          g_value_set_uint (value, obj->dscp); \
+          break; \
+        case PROP_RATE_LIMIT: \
+          g_value_set_uint64 (value, obj->rate_limit); \
+          break; \
+        case PROP_RATE_BURST: \
+          g_value_set_uint64 (value, obj->rate_burst); \
+          break; \
+        case PROP_PROBE_DURATION: \
+          g_value_set_uint (value, obj->probe_duration); \
+          break; \
+        case PROP_EGRESS_RATE_LIMIT: \
+          g_value_set_uint64 (value, obj->egress_rate_limit); \
+          break; \
+        case PROP_ADMISSION_MAX_LOAD: \
+          g_value_set_uint (value, obj->admission_max_load); \
+          break; \
+        case PROP_ADMISSION_MAX_HANDSHAKES: \
+          g_value_set_uint (value, obj->admission_max_handshakes); \
+          break; \
+        case PROP_ADMISSION_MAX_MEMORY: \
+          g_value_set_uint64 (value, obj->admission_max_memory); \
+          break; \
+        case PROP_ADMISSION_ACTION: \
+          g_value_set_enum (value, obj->admission_action); \
+          break; \
+        case PROP_ADMISSION_SHED_IDLE: \
+          g_value_set_uint (value, obj->admission_shed_idle); \
+          break; \
+        case PROP_CONN_MEMORY_LIMIT: \
+          g_value_set_uint64 (value, obj->conn_memory_limit); \
+          break; \
+        case PROP_SERVER_MEMORY_LIMIT: \
+          g_value_set_uint64 (value, obj->server_memory_limit); \
+          break; \
+        case PROP_IDLE_MODE: \
+          g_value_set_boolean (value, obj->idle_mode); \
+          break; \
+        case PROP_XDP_INTERFACE: \
+          g_value_set_string (value, obj->xdp_interface); \
+          break; \
+        case PROP_XDP_QUEUE: \
+          g_value_set_uint (value, obj->xdp_queue); \
+          break; \
+        case PROP_XDP_SKB_MODE: \
+          g_value_set_boolean (value, obj->xdp_skb_mode); \
+          break; \
+        case PROP_QUIC_LB_SERVER_ID: \
+          g_value_set_string (value, obj->quic_lb_server_id); \
+          break; \
+        case PROP_QUIC_LB_KEY: \
+          g_value_set_string (value, obj->quic_lb_key); \
+          break; \
+        case PROP_PREFERRED_ADDRESS: \
+          g_value_set_string (value, obj->preferred_address); \
+          break; \
         default: \
           GST_DEBUG_OBJECT (obj, "Property %s unavailable when there is " \
               "no transport context", pspec->name); \
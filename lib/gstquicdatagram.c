@@ -69,6 +69,7 @@ quiclib_datagram_meta_init (GstMeta *meta, gpointer params, GstBuffer *buffer)
     GstQuicLibDatagramMeta *datagrammeta = (GstQuicLibDatagramMeta *) meta;
 
     datagrammeta->length = 0;
+    datagrammeta->dscp = -1;
 
     return TRUE;
 }
@@ -84,6 +85,8 @@ quiclib_datagram_meta_transform (GstBuffer *transbuf, GstMeta *meta,
     if (!dmeta)
         return FALSE;
 
+    dmeta->dscp = smeta->dscp;
+
     return TRUE;
 }
 
@@ -56,6 +56,8 @@ struct _GstQuicLibDatagramMeta {
   GstMeta meta;
 
   guint64 length;
+  /* DSCP to mark the datagram's packet with, or -1 for the connection default */
+  gint dscp;
 };
 
 typedef guint64 GstQuicLibDatagramTicket;
@@ -0,0 +1,469 @@
+/*
+ * Copyright 2024 British Broadcasting Corporation - Research and Development
+ *
+ * Author: Sam Hurst <sam.hurst@bbc.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+#include "gstquiclb.h"
+
+#include <string.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#define QUIC_LB_BLOCK_LEN 16
+
+struct _GstQuicLibQuicLbConfig {
+  guint8 config_id;
+  guint8 server_id[GST_QUICLIB_QUIC_LB_MAX_SERVER_ID_LEN];
+  gsize server_id_len;
+  gsize nonce_len;
+
+  /*
+   * AES-128-ECB contexts for the encrypted formats, or NULL for plaintext.
+   * They are shared by every connection of a server, so are only used with
+   * the mutex held.
+   */
+  EVP_CIPHER_CTX *encrypt;
+  EVP_CIPHER_CTX *decrypt;
+  GMutex mutex;
+};
+
+static EVP_CIPHER_CTX *
+quic_lb_cipher_new (const guint8 *key, gboolean encrypt)
+{
+  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new ();
+
+  if (ctx == NULL) {
+    return NULL;
+  }
+
+  if (EVP_CipherInit_ex (ctx, EVP_aes_128_ecb (), NULL, key, NULL,
+      encrypt ? 1 : 0) != 1) {
+    EVP_CIPHER_CTX_free (ctx);
+    return NULL;
+  }
+
+  EVP_CIPHER_CTX_set_padding (ctx, 0);
+
+  return ctx;
+}
+
+static gboolean
+quic_lb_cipher_block (EVP_CIPHER_CTX *ctx, const guint8 *in, guint8 *out)
+{
+  int outlen = 0;
+
+  return EVP_CipherUpdate (ctx, out, &outlen, in, QUIC_LB_BLOCK_LEN) == 1 &&
+      outlen == QUIC_LB_BLOCK_LEN;
+}
+
+/*
+ * With an odd plaintext length, the two halves of the four-pass construction
+ * share the middle octet: the left half owns its high nibble and the right
+ * half its low nibble.
+ */
+static void
+quic_lb_split (gsize plaintext_len, const guint8 *text, guint8 *left,
+    guint8 *right)
+{
+  gsize half_len = (plaintext_len + 1) / 2;
+
+  memcpy (left, text, half_len);
+  memcpy (right, text + plaintext_len - half_len, half_len);
+
+  if (plaintext_len & 1) {
+    left[half_len - 1] &= 0xf0;
+    right[0] &= 0x0f;
+  }
+}
+
+static void
+quic_lb_merge (gsize plaintext_len, const guint8 *left, const guint8 *right,
+    guint8 *text)
+{
+  gsize half_len = (plaintext_len + 1) / 2;
+
+  memcpy (text + plaintext_len - half_len, right, half_len);
+  memcpy (text, left, half_len);
+
+  if (plaintext_len & 1) {
+    text[half_len - 1] = left[half_len - 1] | right[0];
+  }
+}
+
+/*
+ * One pass of the four-pass construction. @half is expanded to a block with
+ * the plaintext length and pass number in its last two octets and encrypted,
+ * and the leading octets of the result are XORed into the other half,
+ * @target.
+ */
+static gboolean
+quic_lb_pass (GstQuicLibQuicLbConfig *config, const guint8 *half,
+    guint8 *target, gboolean target_is_left, guint8 pass)
+{
+  gsize plaintext_len = config->server_id_len + config->nonce_len;
+  gsize half_len = (plaintext_len + 1) / 2;
+  guint8 in[QUIC_LB_BLOCK_LEN] = { 0 }, out[QUIC_LB_BLOCK_LEN];
+  guint8 *mask = out;
+  gsize i;
+
+  memcpy (in, half, half_len);
+  in[QUIC_LB_BLOCK_LEN - 2] = (guint8) plaintext_len;
+  in[QUIC_LB_BLOCK_LEN - 1] = pass;
+
+  if (!quic_lb_cipher_block (config->encrypt, in, out)) {
+    return FALSE;
+  }
+
+  if (plaintext_len & 1) {
+    if (target_is_left) {
+      mask[half_len - 1] &= 0xf0;
+    } else {
+      mask[0] &= 0x0f;
+    }
+  }
+
+  for (i = 0; i < half_len; i++) {
+    target[i] ^= mask[i];
+  }
+
+  return TRUE;
+}
+
+/*
+ * Encrypts or decrypts the server ID and nonce in @text in place. Call with
+ * the config mutex held.
+ */
+static gboolean
+quic_lb_crypt (GstQuicLibQuicLbConfig *config, guint8 *text, gboolean encrypt)
+{
+  gsize plaintext_len = config->server_id_len + config->nonce_len;
+  guint8 left[QUIC_LB_BLOCK_LEN / 2 + 2], right[QUIC_LB_BLOCK_LEN / 2 + 2];
+  gboolean rv;
+
+  if (plaintext_len == QUIC_LB_BLOCK_LEN) {
+    guint8 out[QUIC_LB_BLOCK_LEN];
+
+    if (!quic_lb_cipher_block (encrypt ? config->encrypt : config->decrypt,
+        text, out)) {
+      return FALSE;
+    }
+
+    memcpy (text, out, QUIC_LB_BLOCK_LEN);
+    return TRUE;
+  }
+
+  quic_lb_split (plaintext_len, text, left, right);
+
+  if (encrypt) {
+    rv = quic_lb_pass (config, left, right, FALSE, 1) &&
+        quic_lb_pass (config, right, left, TRUE, 2) &&
+        quic_lb_pass (config, left, right, FALSE, 3) &&
+        quic_lb_pass (config, right, left, TRUE, 4);
+  } else {
+    rv = quic_lb_pass (config, right, left, TRUE, 4) &&
+        quic_lb_pass (config, left, right, FALSE, 3) &&
+        quic_lb_pass (config, right, left, TRUE, 2) &&
+        quic_lb_pass (config, left, right, FALSE, 1);
+  }
+
+  if (rv) {
+    quic_lb_merge (plaintext_len, left, right, text);
+  }
+
+  return rv;
+}
+
+/**
+ * gst_quiclib_quic_lb_config_new
+ *
+ * Create a QUIC-LB configuration for generating connection IDs that route to
+ * the server @server_id.
+ *
+ * @config_id: Config rotation codepoint, from 0 to
+ *    GST_QUICLIB_QUIC_LB_MAX_CONFIG_ID.
+ * @server_id: The server ID the load balancer routes on.
+ * @server_id_len: Length of @server_id in octets.
+ * @nonce_len: Length of the random nonce in octets, at least
+ *    GST_QUICLIB_QUIC_LB_MIN_NONCE_LEN.
+ * @key: GST_QUICLIB_QUIC_LB_KEY_LEN octet AES-128 key to encrypt the server
+ *    ID and nonce with, or NULL for the plaintext format.
+ * @return The new configuration, or NULL if the parameters don't make a valid
+ *    CID. Free with gst_quiclib_quic_lb_config_free.
+ */
+GstQuicLibQuicLbConfig *
+gst_quiclib_quic_lb_config_new (guint8 config_id, const guint8 *server_id,
+    gsize server_id_len, gsize nonce_len, const guint8 *key)
+{
+  GstQuicLibQuicLbConfig *config;
+
+  if (config_id > GST_QUICLIB_QUIC_LB_MAX_CONFIG_ID) {
+    g_warning ("QUIC-LB config ID %u is out of range", config_id);
+    return NULL;
+  }
+
+  if (server_id_len == 0 ||
+      server_id_len > GST_QUICLIB_QUIC_LB_MAX_SERVER_ID_LEN) {
+    g_warning ("QUIC-LB server ID length %lu is out of range", server_id_len);
+    return NULL;
+  }
+
+  if (nonce_len < GST_QUICLIB_QUIC_LB_MIN_NONCE_LEN ||
+      1 + server_id_len + nonce_len > GST_QUICLIB_QUIC_LB_MAX_CID_LEN) {
+    g_warning ("QUIC-LB nonce length %lu is out of range for a %lu octet "
+        "server ID", nonce_len, server_id_len);
+    return NULL;
+  }
+
+  config = g_new0 (GstQuicLibQuicLbConfig, 1);
+  config->config_id = config_id;
+  memcpy (config->server_id, server_id, server_id_len);
+  config->server_id_len = server_id_len;
+  config->nonce_len = nonce_len;
+  g_mutex_init (&config->mutex);
+
+  if (key != NULL) {
+    config->encrypt = quic_lb_cipher_new (key, TRUE);
+    config->decrypt = quic_lb_cipher_new (key, FALSE);
+
+    if (config->encrypt == NULL || config->decrypt == NULL) {
+      g_warning ("Couldn't set up AES-128 for QUIC-LB");
+      gst_quiclib_quic_lb_config_free (config);
+      return NULL;
+    }
+  }
+
+  return config;
+}
+
+static gboolean
+quic_lb_parse_hex (const gchar *hex, guint8 *out, gsize max, gsize *len)
+{
+  gsize hexlen = strlen (hex), i;
+
+  if (hexlen == 0 || hexlen % 2 != 0 || hexlen / 2 > max) {
+    return FALSE;
+  }
+
+  for (i = 0; i < hexlen / 2; i++) {
+    gint hi = g_ascii_xdigit_value (hex[2 * i]);
+    gint lo = g_ascii_xdigit_value (hex[2 * i + 1]);
+
+    if (hi < 0 || lo < 0) {
+      return FALSE;
+    }
+
+    out[i] = (guint8) ((hi << 4) | lo);
+  }
+
+  *len = hexlen / 2;
+
+  return TRUE;
+}
+
+/**
+ * gst_quiclib_quic_lb_config_new_from_hex
+ *
+ * As gst_quiclib_quic_lb_config_new, with the server ID and key given as hex
+ * strings.
+ *
+ * @nonce_len: Length of the nonce in octets, or 0 for
+ *    GST_QUICLIB_QUIC_LB_NONCE_LEN_DEFAULT, shortened if need be to fit the
+ *    maximum CID length.
+ * @key: Hex string of the AES-128 key, or NULL or empty for plaintext.
+ */
+GstQuicLibQuicLbConfig *
+gst_quiclib_quic_lb_config_new_from_hex (guint8 config_id,
+    const gchar *server_id, gsize nonce_len, const gchar *key)
+{
+  guint8 sid[GST_QUICLIB_QUIC_LB_MAX_SERVER_ID_LEN];
+  guint8 key_bytes[GST_QUICLIB_QUIC_LB_KEY_LEN];
+  gsize sid_len, key_len;
+
+  if (server_id == NULL ||
+      !quic_lb_parse_hex (server_id, sid, sizeof (sid), &sid_len)) {
+    g_warning ("Invalid QUIC-LB server ID \"%s\"", server_id);
+    return NULL;
+  }
+
+  if (key != NULL && *key != '\0' &&
+      (!quic_lb_parse_hex (key, key_bytes, sizeof (key_bytes), &key_len) ||
+       key_len != GST_QUICLIB_QUIC_LB_KEY_LEN)) {
+    g_warning ("QUIC-LB key must be %d hex octets",
+        GST_QUICLIB_QUIC_LB_KEY_LEN);
+    return NULL;
+  }
+
+  if (nonce_len == 0) {
+    nonce_len = MIN (GST_QUICLIB_QUIC_LB_NONCE_LEN_DEFAULT,
+        GST_QUICLIB_QUIC_LB_MAX_CID_LEN - 1 - sid_len);
+  }
+
+  return gst_quiclib_quic_lb_config_new (config_id, sid, sid_len, nonce_len,
+      (key != NULL && *key != '\0') ? key_bytes : NULL);
+}
+
+void
+gst_quiclib_quic_lb_config_free (GstQuicLibQuicLbConfig *config)
+{
+  if (config == NULL) {
+    return;
+  }
+
+  if (config->encrypt) {
+    EVP_CIPHER_CTX_free (config->encrypt);
+  }
+  if (config->decrypt) {
+    EVP_CIPHER_CTX_free (config->decrypt);
+  }
+
+  g_mutex_clear (&config->mutex);
+  g_free (config);
+}
+
+/**
+ * gst_quiclib_quic_lb_config_get_cid_len
+ *
+ * @return The length in octets of the CIDs that @config generates.
+ */
+gsize
+gst_quiclib_quic_lb_config_get_cid_len (const GstQuicLibQuicLbConfig *config)
+{
+  return 1 + config->server_id_len + config->nonce_len;
+}
+
+/**
+ * gst_quiclib_quic_lb_encode_cid
+ *
+ * Build the connection ID for @config with the given nonce. This is the
+ * deterministic half of gst_quiclib_quic_lb_generate_cid, for checking the
+ * encoding against known vectors.
+ *
+ * @nonce: The configuration's nonce length of octets to put in the CID.
+ * @cid: Buffer for the new CID.
+ * @cidlen: Length of @cid, which must be the configuration's CID length.
+ * @return TRUE if @cid was filled in.
+ */
+gboolean
+gst_quiclib_quic_lb_encode_cid (GstQuicLibQuicLbConfig *config,
+    const guint8 *nonce, guint8 *cid, gsize cidlen)
+{
+  gboolean rv = TRUE;
+
+  if (cidlen != gst_quiclib_quic_lb_config_get_cid_len (config)) {
+    return FALSE;
+  }
+
+  /* Config rotation in the top three bits, then the length self-description */
+  cid[0] = (guint8) ((config->config_id << 5) | (cidlen - 1));
+  memcpy (cid + 1, config->server_id, config->server_id_len);
+  memcpy (cid + 1 + config->server_id_len, nonce, config->nonce_len);
+
+  if (config->encrypt != NULL) {
+    g_mutex_lock (&config->mutex);
+    rv = quic_lb_crypt (config, cid + 1, TRUE);
+    g_mutex_unlock (&config->mutex);
+  }
+
+  return rv;
+}
+
+/**
+ * gst_quiclib_quic_lb_generate_cid
+ *
+ * Generate a new connection ID with a random nonce. The signature matches
+ * GstQuicLibCidGenerator, so a configuration can be given to
+ * gst_quiclib_transport_set_cid_generator directly.
+ *
+ * @cid: Buffer for the new CID.
+ * @cidlen: Length of CID wanted, which must be the configuration's CID length.
+ * @config: The GstQuicLibQuicLbConfig.
+ * @return TRUE if @cid was filled in.
+ */
+gboolean
+gst_quiclib_quic_lb_generate_cid (guint8 *cid, gsize cidlen, gpointer config)
+{
+  GstQuicLibQuicLbConfig *lb = (GstQuicLibQuicLbConfig *) config;
+  guint8 nonce[GST_QUICLIB_QUIC_LB_MAX_CID_LEN];
+
+  if (RAND_bytes (nonce, (int) lb->nonce_len) != 1) {
+    return FALSE;
+  }
+
+  return gst_quiclib_quic_lb_encode_cid (lb, nonce, cid, cidlen);
+}
+
+/**
+ * gst_quiclib_quic_lb_decode_server_id
+ *
+ * Recover the server ID from a CID generated with @config, as a load balancer
+ * would.
+ *
+ * @server_id: Buffer of at least the configuration's server ID length.
+ * @return FALSE if @cid wasn't generated with @config's config ID and length.
+ */
+gboolean
+gst_quiclib_quic_lb_decode_server_id (GstQuicLibQuicLbConfig *config,
+    const guint8 *cid, gsize cidlen, guint8 *server_id)
+{
+  guint8 text[GST_QUICLIB_QUIC_LB_MAX_CID_LEN];
+  gboolean rv = TRUE;
+
+  if (cidlen != gst_quiclib_quic_lb_config_get_cid_len (config) ||
+      (cid[0] >> 5) != config->config_id) {
+    return FALSE;
+  }
+
+  memcpy (text, cid + 1, cidlen - 1);
+
+  if (config->decrypt != NULL) {
+    g_mutex_lock (&config->mutex);
+    rv = quic_lb_crypt (config, text, FALSE);
+    g_mutex_unlock (&config->mutex);
+  }
+
+  if (rv) {
+    memcpy (server_id, text, config->server_id_len);
+  }
+
+  return rv;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2024 British Broadcasting Corporation - Research and Development
+ *
+ * Author: Sam Hurst <sam.hurst@bbc.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+#ifndef LIB_GSTQUICLB_H_
+#define LIB_GSTQUICLB_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Connection ID generation following the QUIC-LB draft
+ * (draft-ietf-quic-load-balancers), so that a load balancer in front of
+ * several servers can route packets on their connection IDs without keeping
+ * any per-connection state.
+ *
+ * Each CID is a first octet carrying the config rotation codepoint and the
+ * CID length, then the server ID and a random nonce. The server ID and nonce
+ * are either sent in the clear, or encrypted with AES-128: in a single pass
+ * when together they are exactly one block, or with the draft's four-pass
+ * construction otherwise.
+ */
+
+#define GST_QUICLIB_QUIC_LB_KEY_LEN 16
+#define GST_QUICLIB_QUIC_LB_MAX_CONFIG_ID 6
+#define GST_QUICLIB_QUIC_LB_MAX_SERVER_ID_LEN 15
+#define GST_QUICLIB_QUIC_LB_MIN_NONCE_LEN 4
+#define GST_QUICLIB_QUIC_LB_MAX_CID_LEN 20
+#define GST_QUICLIB_QUIC_LB_NONCE_LEN_DEFAULT 8
+
+typedef struct _GstQuicLibQuicLbConfig GstQuicLibQuicLbConfig;
+
+GstQuicLibQuicLbConfig *
+gst_quiclib_quic_lb_config_new (guint8 config_id, const guint8 *server_id,
+    gsize server_id_len, gsize nonce_len, const guint8 *key);
+
+GstQuicLibQuicLbConfig *
+gst_quiclib_quic_lb_config_new_from_hex (guint8 config_id,
+    const gchar *server_id, gsize nonce_len, const gchar *key);
+
+void
+gst_quiclib_quic_lb_config_free (GstQuicLibQuicLbConfig *config);
+
+gsize
+gst_quiclib_quic_lb_config_get_cid_len (const GstQuicLibQuicLbConfig *config);
+
+gboolean
+gst_quiclib_quic_lb_encode_cid (GstQuicLibQuicLbConfig *config,
+    const guint8 *nonce, guint8 *cid, gsize cidlen);
+
+gboolean
+gst_quiclib_quic_lb_generate_cid (guint8 *cid, gsize cidlen, gpointer config);
+
+gboolean
+gst_quiclib_quic_lb_decode_server_id (GstQuicLibQuicLbConfig *config,
+    const guint8 *cid, gsize cidlen, guint8 *server_id);
+
+G_END_DECLS
+
+#endif
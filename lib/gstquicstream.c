@@ -75,6 +75,9 @@ quiclib_stream_meta_init (GstMeta *meta, gpointer params, GstBuffer *buffer)
   streammeta->offset = 0;
   streammeta->length = 0;
   streammeta->final = FALSE;
+  streammeta->dscp = -1;
+  streammeta->rate_limit = 0;
+  streammeta->rate_burst = 0;
 
   return TRUE;
 }
@@ -92,6 +95,10 @@ quiclib_stream_meta_transform (GstBuffer *transbuf, GstMeta *meta,
   if (!dmeta)
     return FALSE;
 
+  dmeta->dscp = smeta->dscp;
+  dmeta->rate_limit = smeta->rate_limit;
+  dmeta->rate_burst = smeta->rate_burst;
+
   return TRUE;
 }
 
@@ -59,6 +59,12 @@ struct _GstQuicLibStreamMeta {
 	guint64	offset;
 	guint64	length;
 	gboolean final;
+	/* DSCP to mark the stream's packets with, or -1 to leave it unchanged */
+	gint	dscp;
+	/* Token bucket rate in bits/s and depth in bytes to shape the stream to,
+	 * or a rate of 0 to leave the stream's shaping unchanged */
+	guint64	rate_limit;
+	guint64	rate_burst;
 };
 
 GType
@@ -65,6 +65,7 @@
 #include "gstquicdatagram.h"
 #include "gstquiccommon.h"
 #include "gstquicpriv.h"
+#include "gstquiclb.h"
 #include <ngtcp2/ngtcp2.h>
 #include <ngtcp2/ngtcp2_crypto.h>
 #include <ngtcp2/ngtcp2_crypto_quictls.h>
@@ -87,8 +88,29 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <time.h>
+#include <errno.h>
+#include <linux/errqueue.h>
 #include <sys/time.h>
 #include <linux/net.h>
+#include <pthread.h>
+#include <sched.h>
+#include <glib-unix.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#include <sys/eventfd.h>
+#endif
+#ifdef HAVE_LIBXDP
+#include <xdp/xsk.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include <linux/if_link.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+#include <sys/mman.h>
+#endif
 
 GST_DEBUG_CATEGORY_STATIC (quiclib_transport);  // define category (statically)
 #define GST_CAT_DEFAULT quiclib_transport       // set as default
@@ -266,10 +288,17 @@ socket_control_message_ecn_deserialise (int level, int type, gsize size,
 {
   if ((level == IPPROTO_IP && type == IP_TOS) ||
       (level == IPPROTO_IPV6 && type == IPV6_TCLASS)) {
-    guint8 ecn_mark = *(guint8 *) data;
+    guint8 ecn_mark;
 
-    g_return_val_if_fail (ecn_mark >= ECN_NOT_ECT || ecn_mark <= ECN_ECT_CE,
-        NULL);
+    /*
+     * IP_TOS arrives as a byte and IPV6_TCLASS as an int. Either way, the ECN
+     * codepoint is the bottom two bits, below the DSCP.
+     */
+    if (size >= sizeof (int)) {
+      ecn_mark = (guint8) (*(int *) data) & 0x3;
+    } else {
+      ecn_mark = *(guint8 *) data & 0x3;
+    }
 
     return g_object_new (SOCKET_CONTROL_MESSAGE_ECN_TYPE,
         "ecn", (guint) ecn_mark, NULL);
@@ -278,6 +307,92 @@ socket_control_message_ecn_deserialise (int level, int type, gsize size,
   return NULL;
 }
 
+#define SOCKET_CONTROL_MESSAGE_TOS_TYPE socket_control_message_tos_get_type ()
+G_DECLARE_FINAL_TYPE (SocketControlMessageTOS, socket_control_message_tos,
+    SOCKET_CONTROL_MESSAGE, TOS, GSocketControlMessage);
+
+struct _SocketControlMessageTOS {
+  GSocketControlMessage parent;
+
+  GSocketFamily family;
+  gint tos;
+};
+
+/**
+ * GSocketControlMessage inherited type to set the IP_TOS or IPV6_TCLASS byte,
+ * carrying the DSCP and ECN marks, on an individual outgoing packet.
+ */
+G_DEFINE_TYPE (SocketControlMessageTOS, socket_control_message_tos,
+    G_TYPE_SOCKET_CONTROL_MESSAGE);
+
+static gsize
+socket_control_message_tos_get_size (GSocketControlMessage *msg)
+{
+  return sizeof (gint);
+}
+
+static int
+socket_control_message_tos_get_level (GSocketControlMessage *msg)
+{
+  SocketControlMessageTOS *tosscm = SOCKET_CONTROL_MESSAGE_TOS (msg);
+
+  return (tosscm->family == G_SOCKET_FAMILY_IPV6)?(IPPROTO_IPV6):(IPPROTO_IP);
+}
+
+static int
+socket_control_message_tos_get_msg_type (GSocketControlMessage *msg)
+{
+  SocketControlMessageTOS *tosscm = SOCKET_CONTROL_MESSAGE_TOS (msg);
+
+  return (tosscm->family == G_SOCKET_FAMILY_IPV6)?(IPV6_TCLASS):(IP_TOS);
+}
+
+static void
+socket_control_message_tos_serialise (GSocketControlMessage *msg,
+    gpointer data)
+{
+  memcpy (data, &SOCKET_CONTROL_MESSAGE_TOS (msg)->tos, sizeof (gint));
+}
+
+static GSocketControlMessage *
+socket_control_message_tos_deserialise (int level, int type, gsize size,
+    gpointer data)
+{
+  /* Receive side marks are handled by SocketControlMessageECN */
+  return NULL;
+}
+
+static void
+socket_control_message_tos_class_init (SocketControlMessageTOSClass *klass)
+{
+  GSocketControlMessageClass *scmclass = G_SOCKET_CONTROL_MESSAGE_CLASS (klass);
+
+  scmclass->get_size = socket_control_message_tos_get_size;
+  scmclass->get_level = socket_control_message_tos_get_level;
+  scmclass->get_type = socket_control_message_tos_get_msg_type;
+  scmclass->serialize = socket_control_message_tos_serialise;
+  scmclass->deserialize = socket_control_message_tos_deserialise;
+}
+
+static void
+socket_control_message_tos_init (SocketControlMessageTOS *tosscm)
+{
+  tosscm->family = G_SOCKET_FAMILY_IPV4;
+  tosscm->tos = 0;
+}
+
+static GSocketControlMessage *
+socket_control_message_tos_new (GSocketFamily family, guint8 tos)
+{
+  SocketControlMessageTOS *tosscm =
+      g_object_new (SOCKET_CONTROL_MESSAGE_TOS_TYPE, NULL);
+
+  tosscm->family = family;
+  tosscm->tos = tos;
+
+  return G_SOCKET_CONTROL_MESSAGE (tosscm);
+}
+
 /**
  * GSocketControlMessage inherited type to expose pktinfo messages to
  * applications.
@@ -534,7 +649,8 @@ socket_control_message_timestamp_get_property (GObject *object, guint prop_id,
   switch (prop_id) {
     case PROP_TIMESTAMP_NS:
       g_value_set_uint64 (value,
-          (tsscm->timestamp.tv_sec * 1000000000) + tsscm->timestamp.tv_nsec);
+          ((guint64) tsscm->timestamp.tv_sec * 1000000000) +
+              tsscm->timestamp.tv_nsec);
       break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -550,13 +666,15 @@ socket_control_message_timestamp_deserialise (int level, int type, gsize size,
   if (type == SCM_TIMESTAMP) {
     struct timeval *tv = (struct timeval *) data;
     return g_object_new (SOCKET_CONTROL_MESSAGE_TIMESTAMP_TYPE,
-        "timestamp-ns", (tv->tv_sec * 1000000000) + (tv->tv_usec * 1000), NULL);
+        "timestamp-ns",
+            ((guint64) tv->tv_sec * 1000000000) + (tv->tv_usec * 1000), NULL);
   }
 
   if (type == SCM_TIMESTAMPNS) {
     struct timespec *ts = (struct timespec *) data;
     return g_object_new (SOCKET_CONTROL_MESSAGE_TIMESTAMP_TYPE,
-        "timestamp-ns", (ts->tv_sec * 1000000000) + ts->tv_nsec, NULL);
+        "timestamp-ns", ((guint64) ts->tv_sec * 1000000000) + ts->tv_nsec,
+            NULL);
   }
 
   return NULL;
@@ -611,6 +729,8 @@ typedef struct _GstQuicLibTransportParameters {
   gboolean enable_datagrams;
 } GstQuicLibTransportParameters;
 
+typedef struct _QuicLibSharedLoop QuicLibSharedLoop;
+
 /**
  * GstQuicLibTransportContextPrivate
  * @user: The GstQuicLibTransportUser class instance to send callbacks to.
@@ -621,6 +741,8 @@ typedef struct _GstQuicLibTransportParameters {
  * @async_notif_loop: A GMainLoop that runs asynchronous callbacks.
  * @async_notif_loop_context: GMainContext for the @async_notif_loop.
  * @async_notif_loop_thread: A thread that runs @async_notif_loop.
+ * @shared_loop: For a client in idle mode, the shared loop that the loop
+ *    fields point at, or NULL if it has threads of its own.
  * @timeout: Timeout source.
  * @state: Connection state.
  * @location: For a server, the listening string. For a client or connection,
@@ -629,6 +751,66 @@ typedef struct _GstQuicLibTransportParameters {
  *    any new server connections.
  * @rmutex: Mutex for locking this connection.
  * @enable_stats: Flag to enable storage of statistics.
+ * @busy_poll: SO_BUSY_POLL value in microseconds to set on any sockets opened
+ *    by this context, or 0 to leave busy polling disabled.
+ * @busy_poll_budget: How long in microseconds the receive loop keeps spinning
+ *    on non-blocking reads after the socket runs dry before returning to the
+ *    GMainLoop, or 0 to never spin.
+ * @cpu_affinity: CPU list to pin @loop_thread to, or NULL to leave it unpinned.
+ * @async_cpu_affinity: CPU list to pin @async_notif_thread to, or NULL to leave
+ *    it unpinned.
+ * @thread_sched_policy: Scheduling policy for both threads.
+ * @thread_priority: Static priority for both threads when
+ *    @thread_sched_policy is a real-time policy.
+ * @io_backend: The requested packet I/O backend for sockets opened by this
+ *    context. See QuicLibSocketContext for the one actually in use.
+ * @zerocopy_threshold: Minimum send size in bytes to use MSG_ZEROCOPY for, or
+ *    0 to always copy. Raised to QUICLIB_ZEROCOPY_THRESHOLD_MIN when a socket
+ *    is opened.
+ * @dscp: DSCP to mark packets with when the streams or datagrams they carry
+ *    haven't asked for one of their own.
+ * @rate_limit: Token bucket rate in bits/second that each connection shapes
+ *    its outgoing data to, or 0 for no limit.
+ * @rate_burst: Depth in bytes of that token bucket, or 0 to size it from
+ *    @rate_limit.
+ * @probe_duration: Milliseconds after the handshake to probe the path
+ *    capacity for, or 0 not to probe.
+ * @egress_rate_limit: For a server, the cap in bits/second on the data sent
+ *    by all of its connections together, or 0 for no cap.
+ * @admission_max_load: For a server, the loop thread utilisation in percent
+ *    above which new connections are turned away, or 0 for no limit.
+ * @admission_max_handshakes: For a server, the handshakes in progress above
+ *    which new connections are turned away, or 0 for no limit.
+ * @admission_max_memory: For a server, the resident memory of the process in
+ *    bytes above which new connections are turned away, or 0 for no limit.
+ * @admission_action: How a server turns away new connections while over one
+ *    of the admission limits.
+ * @admission_shed_idle: For a server, the seconds a connection must be idle
+ *    for to be closed while over one of the admission limits, or 0 to never
+ *    close connections.
+ * @conn_memory_limit: The accounted bytes a connection may pin before it is
+ *    held back, or 0 for no limit.
+ * @server_memory_limit: For a server, the accounted bytes of all of its
+ *    connections together above which they are all held back, or 0 for no
+ *    limit.
+ * @idle_mode: Whether client connections run on a shared loop thread, and
+ *    whether connections trim their caches and coarsen their timers when
+ *    idle.
+ * @xdp_interface: Name of the interface that AF_XDP sockets are bound to.
+ * @xdp_queue: Receive queue of @xdp_interface that AF_XDP sockets bind to.
+ * @xdp_skb_mode: Whether the XDP program is attached in generic mode.
+ * @quic_lb_server_id: Hex QUIC-LB server ID that @cid_generator was made from.
+ * @quic_lb_key: Hex QUIC-LB key that @cid_generator was made from.
+ * @preferred_address: The preferred addresses a server advertises to its
+ *    clients, as given to the preferred-address property. Parsed when the
+ *    server starts listening.
+ * @cid_generator: Generates the CIDs that a server issues, or NULL for random
+ *    CIDs. Connections of a server use the server's generator.
+ * @cid_generator_len: Length of the CIDs that @cid_generator makes.
+ * @cid_generator_data: User data for @cid_generator.
+ * @cid_generator_destroy: Frees @cid_generator_data.
+ * @cid_generator_mutex: Protects the @cid_generator fields, which are read
+ *    from the loop threads of the server's connections.
  */
 struct _GstQuicLibTransportContextPrivate {
   GstQuicLibTransportUser *user; /* TODO: Rename to owner? */
@@ -641,6 +823,8 @@ struct _GstQuicLibTransportContextPrivate {
   GMainContext *async_notif_loop_context;
   GThread *async_notif_thread;
 
+  QuicLibSharedLoop *shared_loop;
+
   GSource *timeout;
   GstQuicLibTransportState state;
 
@@ -651,6 +835,50 @@ struct _GstQuicLibTransportContextPrivate {
   GRecMutex rmutex;
 
   gboolean enable_stats;
+
+  guint busy_poll;
+  guint busy_poll_budget;
+
+  gchar *cpu_affinity;
+  gchar *async_cpu_affinity;
+  GstQuicLibThreadSchedPolicy thread_sched_policy;
+  guint thread_priority;
+
+  GstQuicLibIOBackend io_backend;
+  guint zerocopy_threshold;
+
+  guint dscp;
+
+  guint64 rate_limit;
+  guint64 rate_burst;
+
+  guint probe_duration;
+
+  guint64 egress_rate_limit;
+
+  guint admission_max_load;
+  guint admission_max_handshakes;
+  guint64 admission_max_memory;
+  GstQuicLibAdmissionAction admission_action;
+  guint admission_shed_idle;
+
+  guint64 conn_memory_limit;
+  guint64 server_memory_limit;
+
+  gboolean idle_mode;
+
+  gchar *xdp_interface;
+  guint xdp_queue;
+  gboolean xdp_skb_mode;
+
+  gchar *quic_lb_server_id;
+  gchar *quic_lb_key;
+  gchar *preferred_address;
+  GstQuicLibCidGenerator cid_generator;
+  gsize cid_generator_len;
+  gpointer cid_generator_data;
+  GDestroyNotify cid_generator_destroy;
+  GMutex cid_generator_mutex;
 };
 
 typedef struct _GstQuicLibTransportContextPrivate
@@ -673,12 +901,111 @@ void
 gst_quiclib_transport_connection_get_local_transport_param (
     GstQuicLibTransportContext * ctx, guint prop_id, GValue * value);
 
+/**
+ * quiclib_parse_cpu_list
+ *
+ * Parses a CPU list of the form "0-3,6,8" into @set. Returns FALSE if the list
+ * is malformed or names a CPU that doesn't fit in a cpu_set_t.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_parse_cpu_list (const gchar *list, cpu_set_t *set)
+{
+  const gchar *p = list;
+
+  CPU_ZERO (set);
+
+  while (*p != '\0') {
+    gchar *end;
+    guint64 first, last;
+
+    first = g_ascii_strtoull (p, &end, 10);
+    if (end == p) return FALSE;
+    last = first;
+    p = end;
+
+    if (*p == '-') {
+      p++;
+      last = g_ascii_strtoull (p, &end, 10);
+      if (end == p || last < first) return FALSE;
+      p = end;
+    }
+
+    if (last >= CPU_SETSIZE) return FALSE;
+
+    for (; first <= last; first++) {
+      CPU_SET ((gint) first, set);
+    }
+
+    if (*p == ',') {
+      p++;
+    } else if (*p != '\0') {
+      return FALSE;
+    }
+  }
+
+  return CPU_COUNT (set) > 0;
+}
+
+/**
+ * quiclib_transport_thread_setup
+ *
+ * Applies the CPU affinity and scheduling policy configured on the context to
+ * the calling thread. Failures are logged and otherwise ignored, the thread
+ * just carries on with the default scheduling.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_transport_thread_setup (GstQuicLibTransportContextPrivate *priv,
+    const gchar *cpu_list)
+{
+  gint rv;
+
+  if (cpu_list != NULL && cpu_list[0] != '\0') {
+    cpu_set_t cpus;
+
+    if (quiclib_parse_cpu_list (cpu_list, &cpus)) {
+      rv = pthread_setaffinity_np (pthread_self (), sizeof (cpus), &cpus);
+      if (rv != 0) {
+        GST_WARNING ("Couldn't pin thread to CPUs \"%s\": %s", cpu_list,
+            g_strerror (rv));
+      }
+    } else {
+      GST_WARNING ("Ignoring invalid CPU list \"%s\"", cpu_list);
+    }
+  }
+
+  if (priv->thread_sched_policy != QUICLIB_THREAD_SCHED_OTHER) {
+    struct sched_param param;
+    gint policy = (priv->thread_sched_policy == QUICLIB_THREAD_SCHED_FIFO) ?
+        SCHED_FIFO : SCHED_RR;
+
+    memset (&param, 0, sizeof (param));
+    param.sched_priority = CLAMP ((gint) priv->thread_priority,
+        sched_get_priority_min (policy), sched_get_priority_max (policy));
+
+    rv = pthread_setschedparam (pthread_self (), policy, &param);
+    if (rv != 0) {
+      /*
+       * Most likely EPERM - needs CAP_SYS_NICE or a high enough RLIMIT_RTPRIO.
+       */
+      GST_WARNING ("Couldn't set %s scheduling at priority %d: %s",
+          policy == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_RR",
+          param.sched_priority, g_strerror (rv));
+    }
+  }
+}
+
 gpointer
 quiclib_transport_context_loop_thread (gpointer user_data)
 {
   GstQuicLibTransportContextPrivate *priv =
       (GstQuicLibTransportContextPrivate *) (user_data);
 
+  quiclib_transport_thread_setup (priv, priv->cpu_affinity);
+
   g_main_loop_run (priv->loop);
 
   return NULL;
@@ -690,15 +1017,177 @@ quiclib_transport_async_notif_context_loop_thread (gpointer user_data)
   GstQuicLibTransportContextPrivate *priv =
       (GstQuicLibTransportContextPrivate *) (user_data);
 
+  quiclib_transport_thread_setup (priv, priv->async_cpu_affinity);
+
   g_main_loop_run (priv->async_notif_loop);
 
   return NULL;
 }
 
+/*
+ * Shared loops.
+ *
+ * With the idle-mode property set, a client connection doesn't start a loop
+ * thread and an async notification thread of its own. It joins whichever of
+ * up to QUICLIB_SHARED_LOOPS_MAX pairs of threads, shared by the whole
+ * process, has the fewest connections on it, and its loop fields point at
+ * that pair's contexts. The threads are started when the first connection
+ * joins the pair and stopped when the last one leaves it. The last to leave
+ * may be finalised on one of the pair's own threads, which can't be joined
+ * from itself, so that one is left to exit on its own. As they serve many
+ * connections, the shared threads keep the default CPU affinity and
+ * scheduling, and never busy-poll their sockets.
+ *
+ * The loop keeps running after a connection on it is finalised, so
+ * everything the connection attached to it is destroyed first, from the loop
+ * thread. See quiclib_conn_leave_shared_loop. The async notification
+ * callbacks hold a reference to their connection instead.
+ */
+#define QUICLIB_SHARED_LOOPS_MAX 4
+
+struct _QuicLibSharedLoop {
+  GMainContext *context;
+  GMainLoop *loop;
+  GThread *thread;
+
+  GMainContext *async_context;
+  GMainLoop *async_loop;
+  GThread *async_thread;
+
+  guint users;
+};
+
+static QuicLibSharedLoop quiclib_shared_loops[QUICLIB_SHARED_LOOPS_MAX];
+static GMutex quiclib_shared_loops_mutex;
+
+static gpointer
+quiclib_shared_loop_thread (gpointer user_data)
+{
+  g_main_loop_run ((GMainLoop *) user_data);
+
+  return NULL;
+}
+
+/**
+ * quiclib_shared_loop_join
+ *
+ * Points the loop fields of @priv at the least used shared loop, starting its
+ * threads if it hasn't been used before.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_shared_loop_join (GstQuicLibTransportContextPrivate *priv)
+{
+  QuicLibSharedLoop *shared = NULL;
+  guint n = CLAMP (g_get_num_processors (), 1, QUICLIB_SHARED_LOOPS_MAX);
+  guint i;
+
+  g_mutex_lock (&quiclib_shared_loops_mutex);
+
+  for (i = 0; i < n; i++) {
+    if (shared == NULL || quiclib_shared_loops[i].users < shared->users) {
+      shared = &quiclib_shared_loops[i];
+    }
+  }
+
+  if (shared->thread == NULL) {
+    guint index = (guint) (shared - quiclib_shared_loops);
+    gchar thread_name[16];
+
+    g_snprintf (thread_name, sizeof (thread_name), "qtx-idle%u", index);
+    shared->context = g_main_context_new ();
+    shared->loop = g_main_loop_new (shared->context, FALSE);
+    shared->thread = g_thread_new (thread_name, quiclib_shared_loop_thread,
+        shared->loop);
+
+    g_snprintf (thread_name, sizeof (thread_name), "qas-idle%u", index);
+    shared->async_context = g_main_context_new ();
+    shared->async_loop = g_main_loop_new (shared->async_context, FALSE);
+    shared->async_thread = g_thread_new (thread_name,
+        quiclib_shared_loop_thread, shared->async_loop);
+  }
+
+  shared->users++;
+
+  g_mutex_unlock (&quiclib_shared_loops_mutex);
+
+  priv->shared_loop = shared;
+  priv->loop_context = g_main_context_ref (shared->context);
+  priv->loop = g_main_loop_ref (shared->loop);
+  priv->loop_thread = g_thread_ref (shared->thread);
+  priv->async_notif_loop_context = g_main_context_ref (shared->async_context);
+  priv->async_notif_loop = g_main_loop_ref (shared->async_loop);
+  priv->async_notif_thread = g_thread_ref (shared->async_thread);
+}
+
+/**
+ * quiclib_shared_loop_leave
+ *
+ * Drops the references to the shared loop that quiclib_shared_loop_join took
+ * for @priv, and stops the shared loop's threads if @priv was the last user.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_shared_loop_leave (GstQuicLibTransportContextPrivate *priv)
+{
+  QuicLibSharedLoop stopping = { 0 };
+
+  g_mutex_lock (&quiclib_shared_loops_mutex);
+  if (--priv->shared_loop->users == 0) {
+    /* A connection joining from now on starts a fresh pair of threads */
+    stopping = *priv->shared_loop;
+    memset (priv->shared_loop, 0, sizeof (QuicLibSharedLoop));
+  }
+  g_mutex_unlock (&quiclib_shared_loops_mutex);
+
+  if (stopping.thread != NULL) {
+    GThread *self = g_thread_self ();
+
+    g_main_loop_quit (stopping.loop);
+    g_main_loop_quit (stopping.async_loop);
+
+    if (stopping.thread != self) {
+      g_thread_join (stopping.thread);
+    } else {
+      g_thread_unref (stopping.thread);
+    }
+    if (stopping.async_thread != self) {
+      g_thread_join (stopping.async_thread);
+    } else {
+      g_thread_unref (stopping.async_thread);
+    }
+
+    g_main_loop_unref (stopping.loop);
+    g_main_context_unref (stopping.context);
+    g_main_loop_unref (stopping.async_loop);
+    g_main_context_unref (stopping.async_context);
+  }
+
+  g_main_loop_unref (priv->loop);
+  g_main_context_unref (priv->loop_context);
+  g_thread_unref (priv->loop_thread);
+  g_main_loop_unref (priv->async_notif_loop);
+  g_main_context_unref (priv->async_notif_loop_context);
+  g_thread_unref (priv->async_notif_thread);
+
+  priv->loop = NULL;
+  priv->loop_context = NULL;
+  priv->loop_thread = NULL;
+  priv->async_notif_loop = NULL;
+  priv->async_notif_loop_context = NULL;
+  priv->async_notif_thread = NULL;
+  priv->shared_loop = NULL;
+}
+
 static void gst_quiclib_transport_context_set_property (GObject * object,
     guint prop_id, const GValue * value, GParamSpec * pspec);
 static void gst_quiclib_transport_context_get_property (GObject * object,
     guint prop_id, GValue * value, GParamSpec * pspec);
+static void gst_quiclib_transport_context_finalize (GObject * object);
+static void quiclib_transport_context_update_quic_lb (
+    GstQuicLibTransportContext *ctx);
 
 void
 gst_quiclib_transport_context_class_init (
@@ -708,6 +1197,7 @@ gst_quiclib_transport_context_class_init (
 
   gobject_class->get_property = gst_quiclib_transport_context_get_property;
   gobject_class->set_property = gst_quiclib_transport_context_set_property;
+  gobject_class->finalize = gst_quiclib_transport_context_finalize;
 
   g_object_class_install_property (gobject_class, PROP_TRANSPORT_CONTEXT_USER,
       g_param_spec_pointer ("user", "User",
@@ -738,6 +1228,33 @@ gst_quiclib_transport_context_class_init (
   gst_quiclib_common_install_max_streams_uni_remote_property (gobject_class);
   gst_quiclib_common_install_enable_datagram_property (gobject_class);
   gst_quiclib_common_install_enable_stats_property (gobject_class);
+  gst_quiclib_common_install_busy_poll_property (gobject_class);
+  gst_quiclib_common_install_busy_poll_budget_property (gobject_class);
+  gst_quiclib_common_install_cpu_affinity_property (gobject_class);
+  gst_quiclib_common_install_async_cpu_affinity_property (gobject_class);
+  gst_quiclib_common_install_thread_sched_policy_property (gobject_class);
+  gst_quiclib_common_install_thread_priority_property (gobject_class);
+  gst_quiclib_common_install_io_backend_property (gobject_class);
+  gst_quiclib_common_install_zerocopy_threshold_property (gobject_class);
+  gst_quiclib_common_install_dscp_property (gobject_class);
+  gst_quiclib_common_install_rate_limit_property (gobject_class);
+  gst_quiclib_common_install_rate_burst_property (gobject_class);
+  gst_quiclib_common_install_probe_duration_property (gobject_class);
+  gst_quiclib_common_install_egress_rate_limit_property (gobject_class);
+  gst_quiclib_common_install_admission_max_load_property (gobject_class);
+  gst_quiclib_common_install_admission_max_handshakes_property (gobject_class);
+  gst_quiclib_common_install_admission_max_memory_property (gobject_class);
+  gst_quiclib_common_install_admission_action_property (gobject_class);
+  gst_quiclib_common_install_admission_shed_idle_property (gobject_class);
+  gst_quiclib_common_install_conn_memory_limit_property (gobject_class);
+  gst_quiclib_common_install_server_memory_limit_property (gobject_class);
+  gst_quiclib_common_install_idle_mode_property (gobject_class);
+  gst_quiclib_common_install_xdp_interface_property (gobject_class);
+  gst_quiclib_common_install_xdp_queue_property (gobject_class);
+  gst_quiclib_common_install_xdp_skb_mode_property (gobject_class);
+  gst_quiclib_common_install_quic_lb_server_id_property (gobject_class);
+  gst_quiclib_common_install_quic_lb_key_property (gobject_class);
+  gst_quiclib_common_install_preferred_address_property (gobject_class);
 
   g_object_class_install_property (gobject_class,
       PROP_TRANSPORT_CONTEXT_DEFAULT_NUM_CIDS,
@@ -770,9 +1287,42 @@ gst_quiclib_transport_context_init (GstQuicLibTransportContext *self)
   priv->async_notif_loop_context = NULL;
   priv->async_notif_loop = NULL;
   priv->async_notif_thread = NULL;
+  priv->shared_loop = NULL;
   priv->timeout = NULL;
   priv->location = g_strdup (QUICLIB_LOCATION_DEFAULT);
   priv->enable_stats = TRUE;
+  priv->busy_poll = QUICLIB_BUSY_POLL_DEFAULT;
+  priv->busy_poll_budget = QUICLIB_BUSY_POLL_BUDGET_DEFAULT;
+  priv->cpu_affinity = g_strdup (QUICLIB_CPU_AFFINITY_DEFAULT);
+  priv->async_cpu_affinity = g_strdup (QUICLIB_CPU_AFFINITY_DEFAULT);
+  priv->thread_sched_policy = QUICLIB_THREAD_SCHED_POLICY_DEFAULT;
+  priv->thread_priority = QUICLIB_THREAD_PRIORITY_DEFAULT;
+  priv->io_backend = QUICLIB_IO_BACKEND_DEFAULT;
+  priv->zerocopy_threshold = QUICLIB_ZEROCOPY_THRESHOLD_DEFAULT;
+  priv->dscp = QUICLIB_DSCP_DEFAULT;
+  priv->rate_limit = QUICLIB_RATE_LIMIT_DEFAULT;
+  priv->rate_burst = QUICLIB_RATE_BURST_DEFAULT;
+  priv->probe_duration = QUICLIB_PROBE_DURATION_DEFAULT;
+  priv->egress_rate_limit = QUICLIB_EGRESS_RATE_LIMIT_DEFAULT;
+  priv->admission_max_load = QUICLIB_ADMISSION_MAX_LOAD_DEFAULT;
+  priv->admission_max_handshakes = QUICLIB_ADMISSION_MAX_HANDSHAKES_DEFAULT;
+  priv->admission_max_memory = QUICLIB_ADMISSION_MAX_MEMORY_DEFAULT;
+  priv->admission_action = QUICLIB_ADMISSION_ACTION_DEFAULT;
+  priv->admission_shed_idle = QUICLIB_ADMISSION_SHED_IDLE_DEFAULT;
+  priv->conn_memory_limit = QUICLIB_CONN_MEMORY_LIMIT_DEFAULT;
+  priv->server_memory_limit = QUICLIB_SERVER_MEMORY_LIMIT_DEFAULT;
+  priv->idle_mode = QUICLIB_IDLE_MODE_DEFAULT;
+  priv->xdp_interface = g_strdup (QUICLIB_XDP_INTERFACE_DEFAULT);
+  priv->xdp_queue = QUICLIB_XDP_QUEUE_DEFAULT;
+  priv->xdp_skb_mode = QUICLIB_XDP_SKB_MODE_DEFAULT;
+  priv->quic_lb_server_id = g_strdup (QUICLIB_QUIC_LB_SERVER_ID_DEFAULT);
+  priv->quic_lb_key = g_strdup (QUICLIB_QUIC_LB_KEY_DEFAULT);
+  priv->preferred_address = g_strdup (QUICLIB_PREFERRED_ADDRESS_DEFAULT);
+  priv->cid_generator = NULL;
+  priv->cid_generator_len = 0;
+  priv->cid_generator_data = NULL;
+  priv->cid_generator_destroy = NULL;
+  g_mutex_init (&priv->cid_generator_mutex);
 
   priv->tp_sent.max_data = QUICLIB_MAX_DATA_DEFAULT;
   priv->tp_sent.max_stream_data_bidi = QUICLIB_MAX_STREAM_DATA_DEFAULT;
@@ -785,6 +1335,26 @@ gst_quiclib_transport_context_init (GstQuicLibTransportContext *self)
   g_rec_mutex_init (&priv->rmutex);
 }
 
+static void
+gst_quiclib_transport_context_finalize (GObject * object)
+{
+  GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (
+          GST_QUICLIB_TRANSPORT_CONTEXT (object));
+
+  g_free (priv->location);
+  g_free (priv->cpu_affinity);
+  g_free (priv->async_cpu_affinity);
+  g_free (priv->xdp_interface);
+  g_free (priv->quic_lb_server_id);
+  g_free (priv->quic_lb_key);
+  g_free (priv->preferred_address);
+  g_mutex_clear (&priv->cid_generator_mutex);
+
+  G_OBJECT_CLASS (gst_quiclib_transport_context_parent_class)->finalize (
+      object);
+}
+
 static void gst_quiclib_transport_context_set_property (GObject * object,
     guint prop_id, const GValue * value, GParamSpec * pspec)
 {
@@ -838,6 +1408,99 @@ static void gst_quiclib_transport_context_set_property (GObject * object,
   case PROP_ENABLE_DATAGRAM:
     priv->tp_sent.enable_datagrams = g_value_get_boolean (value);
     break;
+  case PROP_BUSY_POLL:
+    priv->busy_poll = g_value_get_uint (value);
+    break;
+  case PROP_BUSY_POLL_BUDGET:
+    priv->busy_poll_budget = g_value_get_uint (value);
+    break;
+  case PROP_CPU_AFFINITY:
+    if (priv->cpu_affinity) {
+      g_free (priv->cpu_affinity);
+    }
+    priv->cpu_affinity = g_value_dup_string (value);
+    break;
+  case PROP_ASYNC_CPU_AFFINITY:
+    if (priv->async_cpu_affinity) {
+      g_free (priv->async_cpu_affinity);
+    }
+    priv->async_cpu_affinity = g_value_dup_string (value);
+    break;
+  case PROP_THREAD_SCHED_POLICY:
+    priv->thread_sched_policy = g_value_get_enum (value);
+    break;
+  case PROP_THREAD_PRIORITY:
+    priv->thread_priority = g_value_get_uint (value);
+    break;
+  case PROP_IO_BACKEND:
+    priv->io_backend = g_value_get_enum (value);
+    break;
+  case PROP_ZEROCOPY_THRESHOLD:
+    priv->zerocopy_threshold = g_value_get_uint (value);
+    break;
+  case PROP_DSCP:
+    priv->dscp = g_value_get_uint (value);
+    break;
+  case PROP_RATE_LIMIT:
+    priv->rate_limit = g_value_get_uint64 (value);
+    break;
+  case PROP_RATE_BURST:
+    priv->rate_burst = g_value_get_uint64 (value);
+    break;
+  case PROP_PROBE_DURATION:
+    priv->probe_duration = g_value_get_uint (value);
+    break;
+  case PROP_EGRESS_RATE_LIMIT:
+    priv->egress_rate_limit = g_value_get_uint64 (value);
+    break;
+  case PROP_ADMISSION_MAX_LOAD:
+    priv->admission_max_load = g_value_get_uint (value);
+    break;
+  case PROP_ADMISSION_MAX_HANDSHAKES:
+    priv->admission_max_handshakes = g_value_get_uint (value);
+    break;
+  case PROP_ADMISSION_MAX_MEMORY:
+    priv->admission_max_memory = g_value_get_uint64 (value);
+    break;
+  case PROP_ADMISSION_ACTION:
+    priv->admission_action = g_value_get_enum (value);
+    break;
+  case PROP_ADMISSION_SHED_IDLE:
+    priv->admission_shed_idle = g_value_get_uint (value);
+    break;
+  case PROP_CONN_MEMORY_LIMIT:
+    priv->conn_memory_limit = g_value_get_uint64 (value);
+    break;
+  case PROP_SERVER_MEMORY_LIMIT:
+    priv->server_memory_limit = g_value_get_uint64 (value);
+    break;
+  case PROP_IDLE_MODE:
+    priv->idle_mode = g_value_get_boolean (value);
+    break;
+  case PROP_XDP_INTERFACE:
+    g_free (priv->xdp_interface);
+    priv->xdp_interface = g_value_dup_string (value);
+    break;
+  case PROP_XDP_QUEUE:
+    priv->xdp_queue = g_value_get_uint (value);
+    break;
+  case PROP_XDP_SKB_MODE:
+    priv->xdp_skb_mode = g_value_get_boolean (value);
+    break;
+  case PROP_QUIC_LB_SERVER_ID:
+    g_free (priv->quic_lb_server_id);
+    priv->quic_lb_server_id = g_value_dup_string (value);
+    quiclib_transport_context_update_quic_lb (ctx);
+    break;
+  case PROP_QUIC_LB_KEY:
+    g_free (priv->quic_lb_key);
+    priv->quic_lb_key = g_value_dup_string (value);
+    quiclib_transport_context_update_quic_lb (ctx);
+    break;
+  case PROP_PREFERRED_ADDRESS:
+    g_free (priv->preferred_address);
+    priv->preferred_address = g_value_dup_string (value);
+    break;
   case PROP_MAX_DATA_LOCAL:
   case PROP_MAX_STREAM_DATA_BIDI_LOCAL:
   case PROP_MAX_STREAM_DATA_UNI_LOCAL:
@@ -907,6 +1570,87 @@ static void gst_quiclib_transport_context_get_property (GObject * object,
   case PROP_ENABLE_STATS:
     g_value_set_boolean (value, priv->enable_stats);
     break;
+  case PROP_BUSY_POLL:
+    g_value_set_uint (value, priv->busy_poll);
+    break;
+  case PROP_BUSY_POLL_BUDGET:
+    g_value_set_uint (value, priv->busy_poll_budget);
+    break;
+  case PROP_CPU_AFFINITY:
+    g_value_set_string (value, priv->cpu_affinity);
+    break;
+  case PROP_ASYNC_CPU_AFFINITY:
+    g_value_set_string (value, priv->async_cpu_affinity);
+    break;
+  case PROP_THREAD_SCHED_POLICY:
+    g_value_set_enum (value, priv->thread_sched_policy);
+    break;
+  case PROP_THREAD_PRIORITY:
+    g_value_set_uint (value, priv->thread_priority);
+    break;
+  case PROP_IO_BACKEND:
+    g_value_set_enum (value, priv->io_backend);
+    break;
+  case PROP_ZEROCOPY_THRESHOLD:
+    g_value_set_uint (value, priv->zerocopy_threshold);
+    break;
+  case PROP_DSCP:
+    g_value_set_uint (value, priv->dscp);
+    break;
+  case PROP_RATE_LIMIT:
+    g_value_set_uint64 (value, priv->rate_limit);
+    break;
+  case PROP_RATE_BURST:
+    g_value_set_uint64 (value, priv->rate_burst);
+    break;
+  case PROP_PROBE_DURATION:
+    g_value_set_uint (value, priv->probe_duration);
+    break;
+  case PROP_EGRESS_RATE_LIMIT:
+    g_value_set_uint64 (value, priv->egress_rate_limit);
+    break;
+  case PROP_ADMISSION_MAX_LOAD:
+    g_value_set_uint (value, priv->admission_max_load);
+    break;
+  case PROP_ADMISSION_MAX_HANDSHAKES:
+    g_value_set_uint (value, priv->admission_max_handshakes);
+    break;
+  case PROP_ADMISSION_MAX_MEMORY:
+    g_value_set_uint64 (value, priv->admission_max_memory);
+    break;
+  case PROP_ADMISSION_ACTION:
+    g_value_set_enum (value, priv->admission_action);
+    break;
+  case PROP_ADMISSION_SHED_IDLE:
+    g_value_set_uint (value, priv->admission_shed_idle);
+    break;
+  case PROP_CONN_MEMORY_LIMIT:
+    g_value_set_uint64 (value, priv->conn_memory_limit);
+    break;
+  case PROP_SERVER_MEMORY_LIMIT:
+    g_value_set_uint64 (value, priv->server_memory_limit);
+    break;
+  case PROP_IDLE_MODE:
+    g_value_set_boolean (value, priv->idle_mode);
+    break;
+  case PROP_XDP_INTERFACE:
+    g_value_set_string (value, priv->xdp_interface);
+    break;
+  case PROP_XDP_QUEUE:
+    g_value_set_uint (value, priv->xdp_queue);
+    break;
+  case PROP_XDP_SKB_MODE:
+    g_value_set_boolean (value, priv->xdp_skb_mode);
+    break;
+  case PROP_QUIC_LB_SERVER_ID:
+    g_value_set_string (value, priv->quic_lb_server_id);
+    break;
+  case PROP_QUIC_LB_KEY:
+    g_value_set_string (value, priv->quic_lb_key);
+    break;
+  case PROP_PREFERRED_ADDRESS:
+    g_value_set_string (value, priv->preferred_address);
+    break;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -1152,7 +1896,10 @@ quiclib_ngtcp2_timestamp (void);
 
 gssize
 quiclib_packet_write (GstQuicLibTransportConnection *conn, const gchar *data,
-    gsize nwrite, ngtcp2_path_storage *ps);
+    gsize nwrite, ngtcp2_path_storage *ps, guint8 tos, GstBuffer *owner);
+
+void
+_quiclib_record_rx_delivery (GstQuicLibTransportConnection *conn);
 
 #define QUICLIB_SERVER(ctx) \
 		g_type_check_instance_is_a ((GTypeInstance *) ctx, \
@@ -1161,2506 +1908,6043 @@ quiclib_packet_write (GstQuicLibTransportConnection *conn, const gchar *data,
 		g_type_check_instance_is_a ((GTypeInstance *) ctx, \
 				gst_quiclib_transport_connection_get_type ())
 
-struct _QuicLibSocketContext {
-  GSocket *socket;
-  GSource *source;
-  GstQuicLibTransportContext *owner;
-};
-typedef struct _QuicLibSocketContext QuicLibSocketContext;
-
+/**
+ * gst_quiclib_transport_set_cid_generator
+ *
+ * Replace the random connection IDs that a server issues with ones from
+ * @generator, such as gst_quiclib_quic_lb_generate_cid. Takes effect for CIDs
+ * issued from then on, including those of connections already open. Has no
+ * effect on a client connection.
+ *
+ * @ctx: The server context.
+ * @generator: The CID generator, or NULL to go back to random CIDs.
+ * @cidlen: Length of the CIDs @generator makes, between NGTCP2_MIN_CIDLEN
+ *    and NGTCP2_MAX_CIDLEN.
+ * @user_data: Passed to @generator.
+ * @destroy: Called to free @user_data when the generator is replaced.
+ */
 void
-quiclib_socket_context_destroy (gpointer data)
+gst_quiclib_transport_set_cid_generator (GstQuicLibTransportContext *ctx,
+    GstQuicLibCidGenerator generator, gsize cidlen, gpointer user_data,
+    GDestroyNotify destroy)
 {
-  QuicLibSocketContext *ctx = (QuicLibSocketContext *) data;
+  GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (ctx);
+  GDestroyNotify old_destroy;
+  gpointer old_data;
 
-  GST_INFO_OBJECT (ctx->owner, "Destroying transport context %p", data);
+  g_return_if_fail (generator == NULL ||
+      (cidlen >= NGTCP2_MIN_CIDLEN && cidlen <= NGTCP2_MAX_CIDLEN));
 
-  g_source_destroy (ctx->source);
-  g_source_unref (ctx->source);
+  g_mutex_lock (&priv->cid_generator_mutex);
+  old_destroy = priv->cid_generator_destroy;
+  old_data = priv->cid_generator_data;
+  priv->cid_generator = generator;
+  priv->cid_generator_len = (generator != NULL) ? cidlen : 0;
+  priv->cid_generator_data = user_data;
+  priv->cid_generator_destroy = destroy;
+  g_mutex_unlock (&priv->cid_generator_mutex);
 
-  g_assert (g_socket_close (ctx->socket, NULL));
-  g_object_unref (ctx->socket);
+  if (old_destroy != NULL) {
+    old_destroy (old_data);
+  }
+}
 
-  ctx->source = NULL;
-  ctx->socket = NULL;
+/**
+ * quiclib_transport_context_update_quic_lb
+ *
+ * Rebuilds a server's CID generator from the quic-lb-server-id and quic-lb-key
+ * properties.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_transport_context_update_quic_lb (GstQuicLibTransportContext *ctx)
+{
+  GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (ctx);
+  GstQuicLibQuicLbConfig *config;
 
-  g_free (ctx);
+  if (!QUICLIB_SERVER (ctx)) {
+    return;
+  }
+
+  if (priv->quic_lb_server_id == NULL || *priv->quic_lb_server_id == '\0') {
+    gst_quiclib_transport_set_cid_generator (ctx, NULL, 0, NULL, NULL);
+    return;
+  }
+
+  config = gst_quiclib_quic_lb_config_new_from_hex (0,
+      priv->quic_lb_server_id, 0, priv->quic_lb_key);
+  if (config == NULL) {
+    GST_WARNING_OBJECT (ctx, "Invalid QUIC-LB configuration, issuing random "
+        "connection IDs");
+    gst_quiclib_transport_set_cid_generator (ctx, NULL, 0, NULL, NULL);
+    return;
+  }
+
+  GST_INFO_OBJECT (ctx, "Issuing %s QUIC-LB connection IDs for server ID %s",
+      (priv->quic_lb_key != NULL && *priv->quic_lb_key != '\0') ?
+          "encrypted" : "plaintext", priv->quic_lb_server_id);
+
+  gst_quiclib_transport_set_cid_generator (ctx,
+      gst_quiclib_quic_lb_generate_cid,
+      gst_quiclib_quic_lb_config_get_cid_len (config), config,
+      (GDestroyNotify) gst_quiclib_quic_lb_config_free);
 }
 
-struct _GstQuicLibServerContext {
-  GstQuicLibTransportContext parent;
+#ifdef HAVE_LIBURING
+#define QUICLIB_URING_ENTRIES 256
+#define QUICLIB_URING_RX_BUFFERS 256
+#define QUICLIB_URING_RX_BGID 0
+#define QUICLIB_URING_CONTROL_LEN 256
 
-  GSList *sockets; /* GSList of QuicLibSocketContexts */
-  GSList *acceptable_alpns; /* GSList of strings */
-  const gchar *cert_file_location;
-  const gchar *priv_key_location;
-  const gchar *sni_host;
+/**
+ * QuicLibUring
+ * @ring: The io_uring instance for the socket.
+ * @sq_mutex: Protects the submission queue, as packets can be written from
+ *    application threads as well as the transport thread.
+ * @buf_ring: Provided buffer ring that the multishot receive reads into.
+ * @rx_bufs: Backing memory for @buf_ring, QUICLIB_URING_RX_BUFFERS buffers of
+ *    @rx_buf_size bytes each.
+ * @rx_buf_size: Size of each receive buffer. Large enough for the
+ *    io_uring_recvmsg_out header, the peer address, the control messages and a
+ *    MAX_UDP sized payload.
+ * @rx_msg: msghdr giving the name and control lengths to the multishot
+ *    receive. Must stay valid for as long as the receive is armed.
+ * @event_fd: eventfd registered with @ring to signal new completions.
+ * @source: GSource watching @event_fd on the transport thread's loop.
+ * @batch_thread: The thread currently reaping completions. Sends made from
+ *    this thread are queued and submitted in one go once it's finished.
+ * @pending: Number of SQEs prepared but not yet submitted.
+ * @tx_inflight: Number of sends whose QuicLibUringTx hasn't been reaped and
+ *    freed yet. Accessed atomically.
+ */
+typedef struct _QuicLibUring {
+  struct io_uring ring;
+  GMutex sq_mutex;
 
-  SSL_CTX *ssl_ctx;
+  struct io_uring_buf_ring *buf_ring;
+  guint8 *rx_bufs;
+  gsize rx_buf_size;
+  struct msghdr rx_msg;
 
-  GList *connections; /* GList of GstQuicLibTransportConnection */
-};
+  gint event_fd;
+  GSource *source;
 
-G_DEFINE_TYPE (GstQuicLibServerContext, gst_quiclib_server_context,
-    GST_TYPE_QUICLIB_TRANSPORT_CONTEXT);
+  GThread *batch_thread;
+  guint pending;
+  gint tx_inflight;
+} QuicLibUring;
 
-static void gst_quiclib_server_context_set_property (GObject * object,
-    guint prop_id, const GValue * value, GParamSpec * pspec);
-static void gst_quiclib_server_context_get_property (GObject * object,
-    guint prop_id, GValue * value, GParamSpec * pspec);
+/**
+ * QuicLibUringTx
+ *
+ * An in-flight sendmsg submission. Holds copies of everything the kernel reads
+ * from, so the caller's packet buffer can be reused as soon as the send has
+ * been queued. Freed when the completion is reaped.
+ */
+typedef struct _QuicLibUringTx {
+  struct msghdr msg;
+  struct iovec iov;
+  struct sockaddr_storage addr;
+  guint8 control[CMSG_SPACE (sizeof (int))];
+  guint8 data[];
+} QuicLibUringTx;
+#endif
 
-static void
-gst_quiclib_server_context_finalise (GstQuicLibServerContext *self);
+#ifdef HAVE_LIBXDP
+#define QUICLIB_XDP_FRAME_SIZE XSK_UMEM__DEFAULT_FRAME_SIZE
+#define QUICLIB_XDP_RING_SIZE 2048
+#define QUICLIB_XDP_FRAMES (QUICLIB_XDP_RING_SIZE * 2)
+#define QUICLIB_XDP_RX_BATCH 64
+#define QUICLIB_XDP_MAX_NEIGHBOURS 65536
 
-void
-gst_quiclib_server_context_class_init (GstQuicLibServerContextClass *klass)
+/**
+ * QuicLibXdpNeighbour
+ * @local_mac: Destination MAC address of the last frame received from the
+ *    peer, used as the source of frames sent back to it.
+ * @next_hop_mac: Source MAC address of that frame. This is the peer itself if
+ *    it's on-link, otherwise the router that forwarded the frame.
+ * @local_ip: Destination IP address of that frame, used as the source address
+ *    of packets sent back to the peer. 4 or 16 bytes long, the same as the
+ *    peer's address.
+ */
+typedef struct _QuicLibXdpNeighbour {
+  guint8 local_mac[ETH_ALEN];
+  guint8 next_hop_mac[ETH_ALEN];
+  guint8 local_ip[16];
+} QuicLibXdpNeighbour;
+
+/**
+ * QuicLibXdp
+ * @ifindex: Index of the interface the XDP program is attached to.
+ * @mode_flags: XDP_FLAGS_SKB_MODE or XDP_FLAGS_DRV_MODE, whichever the
+ *    program was attached with.
+ * @attached: Whether the program is attached to @ifindex.
+ * @prog_fd: The XDP program, which redirects UDP packets for @port to @xsk and
+ *    passes everything else to the kernel.
+ * @map_fd: The XSKMAP that the program redirects into, indexed by receive
+ *    queue.
+ * @port: The UDP port of the socket, in network byte order.
+ * @umem_area: Packet buffer memory shared with the kernel. Holds
+ *    QUICLIB_XDP_FRAMES frames of QUICLIB_XDP_FRAME_SIZE bytes, the first
+ *    QUICLIB_XDP_RING_SIZE of which are for receiving and the rest for
+ *    sending.
+ * @umem: Registration of @umem_area with the kernel.
+ * @xsk: The AF_XDP socket.
+ * @fill: Ring that gives free receive frames to the kernel.
+ * @comp: Ring that the kernel returns sent frames on.
+ * @rx: Ring of received frames.
+ * @tx: Ring of frames to send.
+ * @tx_mutex: Protects @tx, @comp and @tx_free, as packets can be written from
+ *    application threads as well as the transport thread.
+ * @tx_free: Stack of the addresses of send frames not in use.
+ * @n_tx_free: Number of addresses in @tx_free.
+ * @neigh_mutex: Protects @neighbours.
+ * @neighbours: Table of QuicLibXdpNeighbour keyed by a GBytes of the peer's IP
+ *    address, learned from received frames.
+ * @source: GSource watching @xsk on the transport thread's loop.
+ */
+typedef struct _QuicLibXdp {
+  gint ifindex;
+  guint32 mode_flags;
+  gboolean attached;
+  gint prog_fd;
+  gint map_fd;
+  guint16 port;
+
+  guint8 *umem_area;
+  struct xsk_umem *umem;
+  struct xsk_socket *xsk;
+  struct xsk_ring_prod fill;
+  struct xsk_ring_cons comp;
+  struct xsk_ring_cons rx;
+  struct xsk_ring_prod tx;
+
+  GMutex tx_mutex;
+  guint64 tx_free[QUICLIB_XDP_RING_SIZE];
+  guint n_tx_free;
+
+  GMutex neigh_mutex;
+  GHashTable *neighbours;
+
+  GSource *source;
+} QuicLibXdp;
+#endif
+
+/**
+ * QuicLibSocketContext
+ * @socket: The UDP socket.
+ * @source: GSource that calls quiclib_data_received when @socket is readable.
+ *    Not attached when @backend is QUICLIB_IO_BACKEND_IO_URING.
+ * @owner: The transport context that opened the socket.
+ * @backend: The packet I/O backend in use. This can differ from the one asked
+ *    for by the owner if that wasn't available.
+ * @uring: io_uring state when @backend is QUICLIB_IO_BACKEND_IO_URING.
+ * @xdp: AF_XDP state when @backend is QUICLIB_IO_BACKEND_AF_XDP.
+ * @io_stats_mutex: Protects @io_stats.
+ * @io_stats: Per-socket packet and CPU counters, so that backends can be
+ *    compared. See the @io member of GstQuicLibConnStats.
+ * @rx_pending: Datagrams handled in the current wakeup, not yet added to
+ *    @io_stats. Only touched by the transport thread.
+ * @zerocopy_threshold: Sends of at least this many bytes use MSG_ZEROCOPY. 0 if
+ *    zero-copy is disabled or SO_ZEROCOPY couldn't be enabled on @socket.
+ * @zc_mutex: Serialises zero-copy sends with @zc_next_seq and @zc_pending, as
+ *    the kernel numbers completions in the order the sends were made.
+ * @zc_next_seq: The completion ID the kernel will give the next zero-copy
+ *    send.
+ * @zc_pending: Queue of QuicLibZerocopyPending, oldest first, holding the
+ *    buffers the kernel may still be reading from.
+ * @local_addr: The address @socket is bound to, which may be a wildcard
+ *    address for a server socket.
+ * @local_addrlen: Length of @local_addr.
+ * @ref_count: References to the context. Senders take one under the context
+ *    lock so that a migration can't free the socket while they're using it.
+ */
+struct _QuicLibSocketContext {
+  gint ref_count;
+  GSocket *socket;
+  GSource *source;
+  GstQuicLibTransportContext *owner;
+
+  ngtcp2_sockaddr_union local_addr;
+  ngtcp2_socklen local_addrlen;
+
+  GstQuicLibIOBackend backend;
+#ifdef HAVE_LIBURING
+  QuicLibUring *uring;
+#endif
+#ifdef HAVE_LIBXDP
+  QuicLibXdp *xdp;
+#endif
+
+  GMutex io_stats_mutex;
+  struct {
+    guint64 rx_packets;
+    guint64 tx_packets;
+    guint64 rx_cpu_ns;
+    guint64 zerocopy_sent;
+    guint64 zerocopy_copied;
+    guint64 zerocopy_fallback;
+  } io_stats;
+  guint64 rx_pending;
+
+  guint zerocopy_threshold;
+  GMutex zc_mutex;
+  guint32 zc_next_seq;
+  GQueue zc_pending;
+};
+typedef struct _QuicLibSocketContext QuicLibSocketContext;
+
+/**
+ * QuicLibZerocopyPending
+ * @seq: The kernel's completion ID for the send.
+ * @buffer: Reference to the buffer the packet was sent from, held until the
+ *    kernel reports the send complete.
+ */
+typedef struct _QuicLibZerocopyPending {
+  guint32 seq;
+  GstBuffer *buffer;
+} QuicLibZerocopyPending;
+
+/**
+ * quiclib_thread_cpu_ns
+ *
+ * Returns the CPU time consumed by the calling thread, in nanoseconds.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static guint64
+quiclib_thread_cpu_ns (void)
 {
-  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  struct timespec ts;
 
-  gobject_class->get_property = gst_quiclib_server_context_get_property;
-  gobject_class->set_property = gst_quiclib_server_context_set_property;
-  gobject_class->finalize =
-      (GObjectFinalizeFunc) gst_quiclib_server_context_finalise;
+  clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts);
 
-  gst_quiclib_common_install_alpn_property (gobject_class);
-  gst_quiclib_common_install_privkey_location_property (gobject_class);
-  gst_quiclib_common_install_cert_location_property (gobject_class);
-  gst_quiclib_common_install_sni_property (gobject_class);
+  return ((guint64) ts.tv_sec * 1000000000) + ts.tv_nsec;
 }
 
+/**
+ * quiclib_socket_account_rx
+ *
+ * Adds the datagrams handled during a socket wakeup, and the thread CPU time
+ * used since @cpu_start, to the socket's I/O counters. @cpu_start is 0 when
+ * statistics are disabled, in which case only the packets are counted.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
 static void
-gst_quiclib_server_context_init (GstQuicLibServerContext *self)
+quiclib_socket_account_rx (QuicLibSocketContext *socket_ctx,
+    guint64 cpu_start)
 {
-  self->sockets = NULL;
-  self->acceptable_alpns = NULL;
-  self->cert_file_location = NULL;
-  self->priv_key_location = NULL;
-  self->sni_host = NULL;
-  self->ssl_ctx = NULL;
-  self->connections = NULL;
+  guint64 cpu_used = 0;
+
+  if (cpu_start != 0) {
+    cpu_used = quiclib_thread_cpu_ns () - cpu_start;
+  }
+
+  g_mutex_lock (&socket_ctx->io_stats_mutex);
+  socket_ctx->io_stats.rx_packets += socket_ctx->rx_pending;
+  socket_ctx->io_stats.rx_cpu_ns += cpu_used;
+  g_mutex_unlock (&socket_ctx->io_stats_mutex);
+
+  socket_ctx->rx_pending = 0;
 }
 
-static void gst_quiclib_server_context_set_property (GObject * object,
-    guint prop_id, const GValue * value, GParamSpec * pspec)
+#ifdef HAVE_LIBURING
+/**
+ * quiclib_uring_submit_locked
+ *
+ * Submits any queued SQEs. Must be called with @sq_mutex held.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_uring_submit_locked (QuicLibSocketContext *socket_ctx)
 {
-  GstQuicLibServerContext *server = GST_QUICLIB_SERVER_CONTEXT (object);
+  QuicLibUring *uring = socket_ctx->uring;
+  gint rv;
 
-  if (gst_debug_category_get_threshold (quiclib_transport) >= GST_LEVEL_TRACE)
-  {
-    gchar *valcon = g_strdup_value_contents (value);
+  if (uring->pending == 0) return;
 
-    GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (server),
-        "Setting property %s to %s", pspec->name, valcon);
+  rv = io_uring_submit (&uring->ring);
+  if (rv < 0) {
+    GST_WARNING_OBJECT (socket_ctx->owner, "io_uring_submit failed: %s",
+        g_strerror (-rv));
+  }
 
-    g_free (valcon);
+  uring->pending = 0;
+}
+
+/**
+ * quiclib_uring_get_sqe_locked
+ *
+ * Gets a free SQE, flushing the submission queue to make space if it's full.
+ * Must be called with @sq_mutex held.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static struct io_uring_sqe *
+quiclib_uring_get_sqe_locked (QuicLibSocketContext *socket_ctx)
+{
+  struct io_uring_sqe *sqe = io_uring_get_sqe (&socket_ctx->uring->ring);
+
+  if (sqe == NULL) {
+    quiclib_uring_submit_locked (socket_ctx);
+    sqe = io_uring_get_sqe (&socket_ctx->uring->ring);
   }
 
-  switch (prop_id) {
-    case PROP_ALPN:
-    {
-      gchar *v, *start = NULL, *v_orig;
-      gboolean avoid_whitespace = TRUE;
+  return sqe;
+}
 
-      if (server->acceptable_alpns) {
-        g_slist_free (server->acceptable_alpns);
-      }
+/**
+ * quiclib_uring_send
+ *
+ * Queues a sendmsg for a single UDP datagram on the socket's io_uring. When
+ * called from the transport thread while it's reaping completions, the
+ * submission is held back and flushed along with any others once all of the
+ * received packets have been processed. Otherwise it's submitted immediately.
+ * A non-zero @tos is set on the packet with an IP_TOS or IPV6_TCLASS control
+ * message.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gssize
+quiclib_uring_send (QuicLibSocketContext *socket_ctx, GSocketAddress *addr,
+    const gchar *data, gsize len, guint8 tos, GError **err)
+{
+  QuicLibUring *uring = socket_ctx->uring;
+  QuicLibUringTx *tx;
+  struct io_uring_sqe *sqe;
 
-      v_orig = v = g_value_dup_string (value);
+  tx = g_malloc (sizeof (QuicLibUringTx) + len);
 
-      /* Deserialise the ALPNs into a GList */
-      while (v != NULL) {
-        if (avoid_whitespace && (*v != ' ' && *v != '\t')) {
-          avoid_whitespace = FALSE;
-          start = v;
-        }
+  if (!g_socket_address_to_native (addr, &tx->addr, sizeof (tx->addr), err)) {
+    g_free (tx);
+    return -1;
+  }
 
-        if (*v == ',' || *v == '\0') {
-          server->acceptable_alpns = g_slist_append (server->acceptable_alpns,
-              g_strndup (start, v - start));
-          avoid_whitespace = TRUE;
+  memcpy (tx->data, data, len);
+  tx->iov.iov_base = tx->data;
+  tx->iov.iov_len = len;
+  memset (&tx->msg, 0, sizeof (tx->msg));
+  tx->msg.msg_name = &tx->addr;
+  tx->msg.msg_namelen = g_socket_address_get_native_size (addr);
+  tx->msg.msg_iov = &tx->iov;
+  tx->msg.msg_iovlen = 1;
 
-          if (*v == '\0') {
-            break;
-          }
-        }
+  if (tos != 0) {
+    struct cmsghdr *cmsg;
+    int tos_val = tos;
 
-        v++;
-      }
+    tx->msg.msg_control = tx->control;
+    tx->msg.msg_controllen = sizeof (tx->control);
 
-      g_free (v_orig);
-      break;
+    cmsg = CMSG_FIRSTHDR (&tx->msg);
+    if (g_socket_get_family (socket_ctx->socket) == G_SOCKET_FAMILY_IPV6) {
+      cmsg->cmsg_level = IPPROTO_IPV6;
+      cmsg->cmsg_type = IPV6_TCLASS;
+    } else {
+      cmsg->cmsg_level = IPPROTO_IP;
+      cmsg->cmsg_type = IP_TOS;
     }
-    /*
-     * TODO: Should it ever be expected that the private key and cert location
-     * would change during runtime? Or could these be CONSTRUCT_ONLY?
-     */
-    case PROP_PRIVKEY_LOCATION:
-      if (server->priv_key_location) {
-        g_free ((gpointer) server->priv_key_location);
-      }
-      server->priv_key_location = g_value_dup_string (value);
-      break;
-    case PROP_CERT_LOCATION:
-      if (server->cert_file_location) {
-        g_free ((gpointer) server->cert_file_location);
-      }
-      server->cert_file_location = g_value_dup_string (value);
-      break;
-    case PROP_SNI:
-      if (server->sni_host) {
-        g_free ((gpointer) server->sni_host);
-      }
-      server->sni_host = g_value_dup_string (value);
-      break;
-    default:
-      G_OBJECT_CLASS (gst_quiclib_server_context_parent_class)->
-        set_property (object, prop_id, value, pspec);
+    cmsg->cmsg_len = CMSG_LEN (sizeof (tos_val));
+    memcpy (CMSG_DATA (cmsg), &tos_val, sizeof (tos_val));
   }
-}
 
-static void gst_quiclib_server_context_get_property (GObject * object,
-    guint prop_id, GValue * value, GParamSpec * pspec)
-{
-  GstQuicLibServerContext *server = GST_QUICLIB_SERVER_CONTEXT (object);
+  g_mutex_lock (&uring->sq_mutex);
 
-  GST_TRACE_OBJECT (server, "Getting value of property %s", pspec->name);
+  sqe = quiclib_uring_get_sqe_locked (socket_ctx);
+  if (sqe == NULL) {
+    g_mutex_unlock (&uring->sq_mutex);
+    g_free (tx);
+    g_set_error_literal (err, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK,
+        "io_uring submission queue is full");
+    return -1;
+  }
 
-  switch (prop_id) {
-    case PROP_ALPN:
-    {
-      /* Serialise the list to a string */
-      GSList *lptr = server->acceptable_alpns;
-      guint i = 0;
-      gchar **in;
-      gchar *out = NULL;
+  io_uring_prep_sendmsg (sqe, g_socket_get_fd (socket_ctx->socket), &tx->msg,
+      0);
+  io_uring_sqe_set_data (sqe, tx);
+  uring->pending++;
+  g_atomic_int_inc (&uring->tx_inflight);
 
-      in = (gchar **) g_malloc (sizeof (gchar *) *
-          (g_slist_length (server->acceptable_alpns) + 1));
+  if (uring->batch_thread != g_thread_self ()) {
+    quiclib_uring_submit_locked (socket_ctx);
+  }
 
-      for (; lptr != NULL; lptr = g_slist_next (lptr)) {
-        in[i++] = lptr->data;
-      }
+  g_mutex_unlock (&uring->sq_mutex);
 
-      in[i] = NULL;
+  return (gssize) len;
+}
 
-      out = g_strjoinv (", ", in);
+/**
+ * quiclib_uring_free
+ *
+ * Tears down the io_uring for a socket. The receive and any sends still in
+ * flight are cancelled, and their completions reaped so that every
+ * QuicLibUringTx is freed before the ring goes away.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_uring_free (QuicLibUring *uring)
+{
+  struct io_uring_cqe *cqe;
+  struct io_uring_sqe *sqe;
 
-      g_value_set_string (value, out);
+  if (uring->source != NULL) {
+    g_source_destroy (uring->source);
+    g_source_unref (uring->source);
+  }
 
-      if (out) {
-        g_free (out);
-      }
+  g_mutex_lock (&uring->sq_mutex);
+  sqe = io_uring_get_sqe (&uring->ring);
+  if (sqe == NULL) {
+    io_uring_submit (&uring->ring);
+    sqe = io_uring_get_sqe (&uring->ring);
+  }
+  if (sqe != NULL) {
+    io_uring_prep_cancel (sqe, NULL, IORING_ASYNC_CANCEL_ANY);
+    io_uring_sqe_set_data (sqe, NULL);
+  }
+  io_uring_submit (&uring->ring);
+  uring->pending = 0;
+  g_mutex_unlock (&uring->sq_mutex);
+
+  while (g_atomic_int_get (&uring->tx_inflight) > 0) {
+    /* Cancelled sends complete straight away, this is only a backstop */
+    struct __kernel_timespec timeout = { .tv_sec = 1, .tv_nsec = 0 };
+    QuicLibUringTx *tx;
+
+    if (io_uring_wait_cqe_timeout (&uring->ring, &cqe, &timeout) != 0) {
+      GST_WARNING ("Timed out waiting for %d io_uring sends to complete",
+          g_atomic_int_get (&uring->tx_inflight));
       break;
     }
-    case PROP_PRIVKEY_LOCATION:
-      g_value_set_string (value, server->priv_key_location);
-      break;
-    case PROP_CERT_LOCATION:
-      g_value_set_string (value, server->cert_file_location);
-      break;
-    case PROP_SNI:
-      g_value_set_string (value, server->sni_host);
-      break;
-    default:
-      G_OBJECT_CLASS (gst_quiclib_server_context_parent_class)->
-        get_property (object, prop_id, value, pspec);
+
+    tx = (QuicLibUringTx *) io_uring_cqe_get_data (cqe);
+    if (tx != NULL) {
+      g_free (tx);
+      g_atomic_int_dec_and_test (&uring->tx_inflight);
+    }
+    io_uring_cqe_seen (&uring->ring, cqe);
+  }
+
+  if (uring->buf_ring != NULL) {
+    io_uring_free_buf_ring (&uring->ring, uring->buf_ring,
+        QUICLIB_URING_RX_BUFFERS, QUICLIB_URING_RX_BGID);
   }
+  io_uring_queue_exit (&uring->ring);
+
+  if (uring->event_fd >= 0) {
+    close (uring->event_fd);
+  }
+
+  g_free (uring->rx_bufs);
+  g_mutex_clear (&uring->sq_mutex);
+  g_free (uring);
 }
+#endif
 
+#ifdef HAVE_LIBXDP
+/**
+ * quiclib_xdp_free
+ *
+ * Detaches the XDP program from the interface and tears down the AF_XDP
+ * socket and its packet buffers.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
 static void
-gst_quiclib_server_context_finalise (GstQuicLibServerContext *self)
+quiclib_xdp_free (QuicLibXdp *xdp)
 {
-  if (self->connections) {
-    g_list_free_full (self->connections, g_object_unref);
-    self->connections = NULL;
+  if (xdp->source != NULL) {
+    g_source_destroy (xdp->source);
+    g_source_unref (xdp->source);
   }
 
-  if (self->sockets) {
-    g_slist_free_full (self->sockets, quiclib_socket_context_destroy);
-    self->sockets = NULL;
+  if (xdp->attached) {
+    LIBBPF_OPTS (bpf_xdp_attach_opts, opts, .old_prog_fd = xdp->prog_fd);
+
+    /* Only detach the program if nobody has replaced it in the meantime */
+    bpf_xdp_detach (xdp->ifindex, xdp->mode_flags, &opts);
   }
 
-  if (self->acceptable_alpns) {
-    g_slist_free_full (self->acceptable_alpns, g_free);
+  if (xdp->prog_fd >= 0) {
+    close (xdp->prog_fd);
+  }
+  if (xdp->map_fd >= 0) {
+    close (xdp->map_fd);
   }
 
-  if (self->ssl_ctx) {
-    SSL_CTX_free (self->ssl_ctx);
-    self->ssl_ctx = NULL;
+  if (xdp->xsk != NULL) {
+    xsk_socket__delete (xdp->xsk);
+  }
+  if (xdp->umem != NULL) {
+    xsk_umem__delete (xdp->umem);
+  }
+  if (xdp->umem_area != NULL) {
+    munmap (xdp->umem_area,
+        (gsize) QUICLIB_XDP_FRAMES * QUICLIB_XDP_FRAME_SIZE);
   }
 
-  gst_quiclib_transport_context_kill_thread (
-        GST_QUICLIB_TRANSPORT_CONTEXT (self));
+  g_hash_table_unref (xdp->neighbours);
+  g_mutex_clear (&xdp->tx_mutex);
+  g_mutex_clear (&xdp->neigh_mutex);
+  g_free (xdp);
 }
 
-#define QUICLIB_SERVER_CONTEXT_SAFE_CAST(o) \
-		(GstQuicLibServerContext *) o; \
-		if (GST_QUICLIB_TRANSPORT_CONTEXT (o)->type != QUIC_CTX_SERVER) \
-		abort (0);
-
-/*
- * Asynchronous callback handling source types
+/**
+ * quiclib_xdp_native_ip
+ *
+ * Copies the IP address of the native socket address @sa to @ip, and its
+ * port in network byte order to @port. An IPv4-mapped IPv6 address is
+ * copied as the IPv4 address. Returns the length of the address copied, 4 or
+ * 16, or 0 if @sa isn't an IP socket address.
+ *
+ * INTERNAL FUNCTION ONLY.
  */
+static gsize
+quiclib_xdp_native_ip (const struct sockaddr *sa, guint8 *ip, guint16 *port)
+{
+  if (sa->sa_family == AF_INET) {
+    const struct sockaddr_in *sin = (const struct sockaddr_in *) sa;
 
-typedef struct {
-  GSource parent;
+    memcpy (ip, &sin->sin_addr, 4);
+    *port = sin->sin_port;
+    return 4;
+  }
 
-  GstQuicLibTransportConnection *conn;
+  if (sa->sa_family == AF_INET6) {
+    const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *) sa;
 
-  GMutex mutex;
+    *port = sin6->sin6_port;
+    if (IN6_IS_ADDR_V4MAPPED (&sin6->sin6_addr)) {
+      memcpy (ip, &sin6->sin6_addr.s6_addr[12], 4);
+      return 4;
+    }
+    memcpy (ip, &sin6->sin6_addr, 16);
+    return 16;
+  }
 
-  gsize queue_len;
-  GAsyncQueue *queue;
-} GstQuicLibTransportSendQueueSource;
+  return 0;
+}
 
-typedef struct {
-  GSource parent;
+/**
+ * quiclib_xdp_csum_add
+ *
+ * Adds the @len bytes at @data to the one's complement sum @sum, as 16-bit
+ * big endian words. Only the last block added may have an odd length.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static guint32
+quiclib_xdp_csum_add (guint32 sum, const guint8 *data, gsize len)
+{
+  gsize i;
 
-  enum {
-    CB_HANDSHAKE_COMPLETED,
-    CB_STREAM_ACK,
-    CB_STREAM_OPEN,
-    CB_STREAM_CLOSE,
-    CB_STREAM_RESET,
-    CB_DATAGRAM_ACK
-  } type;
+  for (i = 0; i + 1 < len; i += 2) {
+    sum += (data[i] << 8) | data[i + 1];
+  }
+  if (len & 1) {
+    sum += data[len - 1] << 8;
+  }
 
-  GstQuicLibTransportConnection *conn;
-} GstQuicLibTransportCallbackSource;
+  return sum;
+}
 
-typedef struct {
-  GstQuicLibTransportCallbackSource source;
+/**
+ * quiclib_xdp_csum_fold
+ *
+ * Folds @sum to 16 bits and returns its complement in network byte order.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static guint16
+quiclib_xdp_csum_fold (guint32 sum)
+{
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
 
-  GSocketAddress *peer;
-} GstQuicLibTransportHandshakeCompleteCallbackSource;
+  return g_htons ((guint16) ~sum);
+}
 
-typedef struct {
-  GstQuicLibTransportCallbackSource source;
+/**
+ * quiclib_xdp_reap_locked
+ *
+ * Returns the frames of sends the kernel has finished with to the free list.
+ * Must be called with tx_mutex held.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_xdp_reap_locked (QuicLibXdp *xdp)
+{
+  guint32 idx, n, i;
 
-  guint64 stream_id;
-} GstQuicLibTransportStreamIDCallbackSource;
+  n = xsk_ring_cons__peek (&xdp->comp, QUICLIB_XDP_RING_SIZE, &idx);
+  for (i = 0; i < n; i++) {
+    xdp->tx_free[xdp->n_tx_free++] =
+        *xsk_ring_cons__comp_addr (&xdp->comp, idx + i);
+  }
+  xsk_ring_cons__release (&xdp->comp, n);
+}
 
-typedef struct {
-  GstQuicLibTransportCallbackSource source;
+/**
+ * quiclib_xdp_send
+ *
+ * Writes a single UDP datagram straight to the AF_XDP socket's transmit ring,
+ * with Ethernet and IP headers built from the last frame received from the
+ * same peer. Returns FALSE without sending anything if the packet can't go
+ * this way, because nothing has been received from the peer yet, the packet
+ * won't fit in a frame or every frame is in flight. The caller should send it
+ * through the socket instead. Otherwise sets @written.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_xdp_send (QuicLibSocketContext *socket_ctx, GSocketAddress *addr,
+    const gchar *data, gsize len, guint8 tos, gssize *written)
+{
+  QuicLibXdp *xdp = socket_ctx->xdp;
+  struct sockaddr_storage peer;
+  QuicLibXdpNeighbour neigh, *found;
+  struct xdp_desc *desc;
+  struct ether_header *eth;
+  struct udphdr *udp;
+  guint8 peer_ip[16];
+  guint16 peer_port;
+  gsize ip_len, hdr_len;
+  guint64 frame_addr;
+  guint32 sum, idx;
+  GBytes *key;
+
+  if (!g_socket_address_to_native (addr, &peer, sizeof (peer), NULL)) {
+    return FALSE;
+  }
 
-  guint64 stream_id;
-  guint64 offset;
-} GstQuicLibTransportAckCallbackSource;
+  ip_len = quiclib_xdp_native_ip ((const struct sockaddr *) &peer, peer_ip,
+      &peer_port);
+  if (ip_len == 0) {
+    return FALSE;
+  }
 
-typedef struct {
-  guint64 timestamp_ns;
-  gsize bytes;
-} GstQuicLibPacketStats;
+  hdr_len = sizeof (struct ether_header) + sizeof (struct udphdr) +
+      ((ip_len == 4) ? sizeof (struct iphdr) : sizeof (struct ip6_hdr));
+  if (hdr_len + len > QUICLIB_XDP_FRAME_SIZE) {
+    return FALSE;
+  }
 
-typedef struct {
-  struct {
-    guint64 sent;
-    guint64 received;
-    guint64 rtx;
-  } pkt_counts;
+  key = g_bytes_new_static (peer_ip, ip_len);
+  g_mutex_lock (&xdp->neigh_mutex);
+  found = (QuicLibXdpNeighbour *) g_hash_table_lookup (xdp->neighbours, key);
+  if (found != NULL) {
+    neigh = *found;
+  }
+  g_mutex_unlock (&xdp->neigh_mutex);
+  g_bytes_unref (key);
 
-  GMutex mutex;
-  GList *bytes_received;
-  GList *bytes_sent;
-} GstQuicLibConnStatsTrackers;
+  if (found == NULL) {
+    return FALSE;
+  }
 
-struct _GstQuicLibTransportConnection {
-  GstQuicLibTransportContext parent;
+  g_mutex_lock (&xdp->tx_mutex);
 
-  GstQuicLibServerContext *server;
+  quiclib_xdp_reap_locked (xdp);
+  if (xdp->n_tx_free == 0 || xsk_ring_prod__reserve (&xdp->tx, 1, &idx) != 1) {
+    g_mutex_unlock (&xdp->tx_mutex);
+    return FALSE;
+  }
 
-  QuicLibSocketContext *socket;
-  guint watch_source;
+  frame_addr = xdp->tx_free[--xdp->n_tx_free];
+
+  eth = (struct ether_header *) xsk_umem__get_data (xdp->umem_area,
+      frame_addr);
+  memcpy (eth->ether_dhost, neigh.next_hop_mac, ETH_ALEN);
+  memcpy (eth->ether_shost, neigh.local_mac, ETH_ALEN);
+
+  if (ip_len == 4) {
+    struct iphdr *ip = (struct iphdr *) (eth + 1);
+
+    eth->ether_type = g_htons (ETHERTYPE_IP);
+    ip->version = 4;
+    ip->ihl = sizeof (struct iphdr) / 4;
+    ip->tos = tos;
+    ip->tot_len = g_htons (sizeof (struct iphdr) + sizeof (struct udphdr) +
+        len);
+    ip->id = 0;
+    ip->frag_off = g_htons (IP_DF);
+    ip->ttl = 64;
+    ip->protocol = IPPROTO_UDP;
+    ip->check = 0;
+    memcpy (&ip->saddr, neigh.local_ip, 4);
+    memcpy (&ip->daddr, peer_ip, 4);
+    ip->check = quiclib_xdp_csum_fold (quiclib_xdp_csum_add (0,
+        (const guint8 *) ip, sizeof (struct iphdr)));
+
+    /* Pseudo-header source and destination addresses */
+    sum = quiclib_xdp_csum_add (0, (const guint8 *) &ip->saddr, 8);
+    udp = (struct udphdr *) (ip + 1);
+  } else {
+    struct ip6_hdr *ip6 = (struct ip6_hdr *) (eth + 1);
 
-  gsize send_queue_lim;
-  GstQuicLibTransportSendQueueSource *send_queue_source;
+    eth->ether_type = g_htons (ETHERTYPE_IPV6);
+    ip6->ip6_flow = g_htonl (((guint32) 6 << 28) | ((guint32) tos << 20));
+    ip6->ip6_plen = g_htons (sizeof (struct udphdr) + len);
+    ip6->ip6_nxt = IPPROTO_UDP;
+    ip6->ip6_hlim = 64;
+    memcpy (&ip6->ip6_src, neigh.local_ip, 16);
+    memcpy (&ip6->ip6_dst, peer_ip, 16);
 
-  gchar *alpn;
+    sum = quiclib_xdp_csum_add (0, (const guint8 *) &ip6->ip6_src, 32);
+    udp = (struct udphdr *) (ip6 + 1);
+  }
 
-  ngtcp2_conn *quic_conn;
-  ngtcp2_path_storage path;
-  ngtcp2_crypto_conn_ref conn_ref;
-  ngtcp2_settings conn_settings;
-  ngtcp2_transport_params transport_params;
-  ngtcp2_ccerr last_error;
+  udp->source = xdp->port;
+  udp->dest = peer_port;
+  udp->len = g_htons (sizeof (struct udphdr) + len);
+  udp->check = 0;
+  memcpy (udp + 1, data, len);
 
-  guint64 datagram_ticket;
+  sum += IPPROTO_UDP + sizeof (struct udphdr) + len;
+  sum = quiclib_xdp_csum_add (sum, (const guint8 *) udp,
+      sizeof (struct udphdr) + len);
+  udp->check = quiclib_xdp_csum_fold (sum);
+  if (udp->check == 0) {
+    udp->check = 0xffff;
+  }
 
-  SSL_CTX *ssl_ctx;
-  SSL *ssl;
+  desc = xsk_ring_prod__tx_desc (&xdp->tx, idx);
+  desc->addr = frame_addr;
+  desc->len = hdr_len + len;
+  xsk_ring_prod__submit (&xdp->tx, 1);
 
-  GList *cids;
+  if (xsk_ring_prod__needs_wakeup (&xdp->tx) &&
+      sendto (xsk_socket__fd (xdp->xsk), NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+      errno != EAGAIN && errno != EBUSY && errno != ENOBUFS) {
+    GST_WARNING_OBJECT (socket_ctx->owner, "Couldn't kick AF_XDP send: %s",
+        g_strerror (errno));
+  }
 
-  /** GHashTable<gint64 (stream id), GstQuicLibStreamContext> */
-  GHashTable *streams;
+  g_mutex_unlock (&xdp->tx_mutex);
 
-  /** GHashTable <gint64 (datagram ticket), GstBuffer> */
-  GHashTable *datagrams_awaiting_ack;
+  *written = (gssize) len;
 
-  /** GList <gint64 (stream id)> */
-  GList *streams_to_close;
+  return TRUE;
+}
+#endif
 
-  /*
-   * ngtcp2 doesn't give us this information directly, only local streams
-   * remaining
-   */
-  guint64 bidi_remote_streams_remaining;
-  guint64 uni_remote_streams_remaining;
-  guint64 last_client_bidi_stream_id;
-  guint64 last_server_bidi_stream_id;
-  guint64 last_client_uni_stream_id;
-  guint64 last_server_uni_stream_id;
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+/**
+ * quiclib_socket_drain_zerocopy
+ *
+ * Reads MSG_ZEROCOPY completion notifications from the socket's error queue
+ * and releases the buffers of any sends the kernel has finished with. Also
+ * counts the sends that the kernel completed by copying after all, for
+ * example because the route's device doesn't support scatter-gather.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_socket_drain_zerocopy (QuicLibSocketContext *socket_ctx)
+{
+  gint fd = g_socket_get_fd (socket_ctx->socket);
+  guint8 control[CMSG_SPACE (sizeof (struct sock_extended_err) +
+      sizeof (struct sockaddr_in6))];
 
-  GMutex mutex;
-  GCond cond;
+  g_mutex_lock (&socket_ctx->zc_mutex);
 
-  GstQuicLibConnStatsTrackers stats;
-};
+  while (!g_queue_is_empty (&socket_ctx->zc_pending)) {
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
 
-gboolean _quiclib_add_stream_to_close (GstQuicLibTransportConnection *conn,
-    guint64 stream_id)
-{
-  gint64 *_id = g_new (gint64, 1);
-  *_id = stream_id;
-  conn->streams_to_close = g_list_append (conn->streams_to_close, _id);
-  GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-      "Added Stream ID %ld to close list", *_id);
-  return TRUE;
-}
+    memset (&msg, 0, sizeof (msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof (control);
 
-gint64 _quiclib_pop_stream_to_close (GstQuicLibTransportConnection *conn)
-{
-  gint64 stream_id = *((gint64 *) conn->streams_to_close->data);
-  g_free (conn->streams_to_close->data);
-  conn->streams_to_close = g_list_delete_link (conn->streams_to_close,
-      conn->streams_to_close);
-  GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-      "Popped stream %ld from close list", stream_id);
-  return stream_id;
-}
+    if (recvmsg (fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+      break;
+    }
 
-struct _GstQuicLibStreamContext {
-  GstQuicLibStreamState state;
+    for (cmsg = CMSG_FIRSTHDR (&msg); cmsg != NULL;
+        cmsg = CMSG_NXTHDR (&msg, cmsg)) {
+      struct sock_extended_err *serr;
+      guint32 lo, hi;
 
-  gsize last_offset;
+      if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+          !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+        continue;
+      }
 
-  GList *ack_bufs;
+      serr = (struct sock_extended_err *) CMSG_DATA (cmsg);
+      if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0) {
+        continue;
+      }
 
-  GMutex mutex;
-};
+      lo = serr->ee_info;
+      hi = serr->ee_data;
 
-typedef struct _GstQuicLibStreamContext GstQuicLibStreamContext;
+      /* Completions are ranges of IDs, which are allowed to wrap */
+      while (!g_queue_is_empty (&socket_ctx->zc_pending)) {
+        QuicLibZerocopyPending *pending =
+            g_queue_peek_head (&socket_ctx->zc_pending);
 
-static void
-quiclib_stream_context_destroy (gpointer ctx)
-{
-  GstQuicLibStreamContext *stream = (GstQuicLibStreamContext *) ctx;
+        if ((guint32) (pending->seq - lo) > (guint32) (hi - lo)) {
+          break;
+        }
 
-  g_mutex_clear (&stream->mutex);
+        g_queue_pop_head (&socket_ctx->zc_pending);
+        gst_buffer_unref (pending->buffer);
+        g_free (pending);
+      }
 
-  g_free (stream);
+      if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+        g_mutex_lock (&socket_ctx->io_stats_mutex);
+        socket_ctx->io_stats.zerocopy_copied += (guint32) (hi - lo) + 1;
+        g_mutex_unlock (&socket_ctx->io_stats_mutex);
+      }
+    }
+  }
+
+  g_mutex_unlock (&socket_ctx->zc_mutex);
 }
 
-G_DEFINE_TYPE (GstQuicLibTransportConnection, gst_quiclib_transport_connection,
-    GST_TYPE_QUICLIB_TRANSPORT_CONTEXT);
+/**
+ * quiclib_socket_send_zerocopy
+ *
+ * Sends a datagram with MSG_ZEROCOPY, holding a reference to @owner until the
+ * kernel reports it's done with the data. If the kernel refuses, for example
+ * because the socket's optmem limit on pinned pages has been reached, the
+ * packet is sent with a normal copying send instead.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gssize
+quiclib_socket_send_zerocopy (QuicLibSocketContext *socket_ctx,
+    GSocketAddress *addr, const gchar *data, gsize len,
+    GSocketControlMessage **messages, gint num_messages, GstBuffer *owner,
+    GError **err)
+{
+  GOutputVector ovec;
+  GError *zc_err = NULL;
+  gssize written;
 
-static void gst_quiclib_transport_connection_set_property (GObject * object,
-    guint prop_id, const GValue * value, GParamSpec * pspec);
-static void gst_quiclib_transport_connection_get_property (GObject * object,
-    guint prop_id, GValue * value, GParamSpec * pspec);
+  quiclib_socket_drain_zerocopy (socket_ctx);
 
-static void
-gst_quiclib_transport_connection_finalise (
-    GstQuicLibTransportConnection *self);
-
-void
-gst_quiclib_transport_connection_class_init (
-    GstQuicLibTransportConnectionClass *klass)
-{
-  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
-  gobject_class->set_property = gst_quiclib_transport_connection_set_property;
-  gobject_class->get_property = gst_quiclib_transport_connection_get_property;
-  gobject_class->finalize =
-      (GObjectFinalizeFunc) gst_quiclib_transport_connection_finalise;
-
-  gst_quiclib_common_install_alpn_property (gobject_class);
-  gst_quiclib_common_install_bidi_streams_remaining_local_property (
-      gobject_class);
-  gst_quiclib_common_install_bidi_streams_remaining_remote_property (
-      gobject_class);
-  gst_quiclib_common_install_uni_streams_remaining_local_property (
-      gobject_class);
-  gst_quiclib_common_install_uni_streams_remaining_remote_property (
-      gobject_class);
-  gst_quiclib_common_install_peer_addresses_property (gobject_class);
-  gst_quiclib_common_install_local_addresses_property (gobject_class);
-  gst_quiclib_common_install_send_datagrams_property (gobject_class);
-}
-
-static void gst_quiclib_transport_connection_set_property (GObject * object,
-    guint prop_id, const GValue * value, GParamSpec * pspec)
-{
-  GstQuicLibTransportConnection *conn =
-      GST_QUICLIB_TRANSPORT_CONNECTION (object);
+  ovec.buffer = data;
+  ovec.size = len;
 
+  g_mutex_lock (&socket_ctx->zc_mutex);
 
-  if (gst_debug_category_get_threshold (quiclib_transport) >= GST_LEVEL_TRACE)
-  {
-    gchar *valcon = g_strdup_value_contents (value);
+  written = g_socket_send_message (socket_ctx->socket, addr, &ovec, 1,
+      messages, num_messages, MSG_ZEROCOPY, NULL, &zc_err);
 
-    GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Setting property %s to %s", pspec->name, valcon);
+  if (written >= 0) {
+    QuicLibZerocopyPending *pending = g_new (QuicLibZerocopyPending, 1);
 
-    g_free (valcon);
+    pending->seq = socket_ctx->zc_next_seq++;
+    pending->buffer = gst_buffer_ref (owner);
+    g_queue_push_tail (&socket_ctx->zc_pending, pending);
   }
 
-  g_mutex_lock (&conn->mutex);
+  g_mutex_unlock (&socket_ctx->zc_mutex);
 
-  switch (prop_id) {
-    case PROP_ALPN:
-      if (conn->alpn) {
-        g_free (conn->alpn);
-      }
-      conn->alpn = g_value_dup_string (value);
-      break;
-    case PROP_BIDI_STREAMS_REMAINING_REMOTE:
-    {
-      guint64 v = g_value_get_uint64 (value);
-      if (v > conn->bidi_remote_streams_remaining) {
-        v -= conn->bidi_remote_streams_remaining;
-        ngtcp2_conn_extend_max_streams_bidi (conn->quic_conn, v);
+  if (written < 0) {
+    GST_LOG_OBJECT (socket_ctx->owner,
+        "Zero-copy send failed, falling back to copying: %s",
+        zc_err->message);
+    g_error_free (zc_err);
 
-        conn->bidi_remote_streams_remaining += v;
-      }
-      break;
-    }
-    case PROP_UNI_STREAMS_REMAINING_REMOTE:
-    {
-      guint v = g_value_get_uint64 (value);
-      if (v > conn->uni_remote_streams_remaining) {
-        v -= conn->uni_remote_streams_remaining;
-        ngtcp2_conn_extend_max_streams_uni (conn->quic_conn, v);
+    g_mutex_lock (&socket_ctx->io_stats_mutex);
+    socket_ctx->io_stats.zerocopy_fallback++;
+    g_mutex_unlock (&socket_ctx->io_stats_mutex);
 
-        conn->uni_remote_streams_remaining += v;
-      }
-      break;
-    }
-    case PROP_BIDI_STREAMS_REMAINING_LOCAL:
-    case PROP_UNI_STREAMS_REMAINING_LOCAL:
-    case PROP_PEER_ADDRESSES:
-    case PROP_LOCAL_ADDRESSES:
-    case PROP_SEND_DATAGRAMS:
-      g_critical ("Attempted to set read-only parameter: %s", pspec->name);
-      /* no break */
-    default:
-      G_OBJECT_CLASS (gst_quiclib_transport_connection_parent_class)
-        ->set_property (object, prop_id, value, pspec);
+    return g_socket_send_message (socket_ctx->socket, addr, &ovec, 1,
+        messages, num_messages, 0, NULL, err);
   }
 
-  g_mutex_unlock (&conn->mutex);
+  g_mutex_lock (&socket_ctx->io_stats_mutex);
+  socket_ctx->io_stats.zerocopy_sent++;
+  g_mutex_unlock (&socket_ctx->io_stats_mutex);
+
+  return written;
 }
+#endif
 
-static void gst_quiclib_transport_connection_get_property (GObject * object,
-    guint prop_id, GValue * value, GParamSpec * pspec)
+/**
+ * quiclib_socket_send
+ *
+ * Sends a single UDP datagram to @addr using whichever I/O backend the socket
+ * is using. If @owner is the buffer that @data points into, large enough sends
+ * may be made with MSG_ZEROCOPY, in which case a reference to @owner is held
+ * until the kernel has finished with it. Pass NULL for @owner if @data can't
+ * outlive the call.
+ *
+ * @tos is the value for the packet's IP TOS or IPv6 traffic class byte, with
+ * the DSCP in the upper six bits. If it's 0 then no control message is added
+ * and the socket's default applies.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gssize
+quiclib_socket_send (QuicLibSocketContext *socket_ctx, GSocketAddress *addr,
+    const gchar *data, gsize len, guint8 tos, GstBuffer *owner, GError **err)
 {
-  GstQuicLibTransportConnection *conn =
-      GST_QUICLIB_TRANSPORT_CONNECTION (object);
-
-  GST_TRACE_OBJECT (conn, "Getting value of property %s", pspec->name);
-
-  g_mutex_lock (&conn->mutex);
-
-  switch (prop_id) {
-    case PROP_ALPN:
-      g_value_set_string (value, conn->alpn);
-      break;
-    case PROP_BIDI_STREAMS_REMAINING_LOCAL:
-      if (conn->quic_conn) {
-        guint64 bidi_left =
-            (guint64) ngtcp2_conn_get_streams_bidi_left (conn->quic_conn);
-
-        g_value_set_uint64 (value, bidi_left);
-      } else {
-        g_value_set_uint64 (value, 0);
-      }
-      break;
-    case PROP_BIDI_STREAMS_REMAINING_REMOTE:
-      g_value_set_uint64 (value, conn->bidi_remote_streams_remaining);
-      break;
-    case PROP_UNI_STREAMS_REMAINING_LOCAL:
-      if (conn->quic_conn) {
-        guint64 uni_left =
-            (guint64) ngtcp2_conn_get_streams_uni_left (conn->quic_conn);
-        g_value_set_uint64 (value, uni_left);
-      } else {
-        g_value_set_uint64 (value, 0);
-      }
-      break;
-    case PROP_UNI_STREAMS_REMAINING_REMOTE:
-      g_value_set_uint64 (value, conn->uni_remote_streams_remaining);
-      break;
-    case PROP_PEER_ADDRESSES:
-    {
-      const ngtcp2_path *path;
-      GSocketAddress *sa;
-      GList *list = NULL;
+  GSocketControlMessage *tos_msg = NULL;
+  GOutputVector ovec;
+  gssize written;
 
-      path = ngtcp2_conn_get_path (conn->quic_conn);
-      sa = g_socket_address_new_from_native (path->remote.addr,
-          path->remote.addrlen);
+#ifdef HAVE_LIBURING
+  if (socket_ctx->backend == QUICLIB_IO_BACKEND_IO_URING) {
+    written = quiclib_uring_send (socket_ctx, addr, data, len, tos, err);
+    goto sent;
+  }
+#endif
 
-      list = g_list_append (list, (gpointer) sa);
+#ifdef HAVE_LIBXDP
+  if (socket_ctx->backend == QUICLIB_IO_BACKEND_AF_XDP &&
+      quiclib_xdp_send (socket_ctx, addr, data, len, tos, &written)) {
+    goto sent;
+  }
+#endif
 
-      g_value_set_boxed (value, list);
+  if (tos != 0) {
+    tos_msg = socket_control_message_tos_new (
+        g_socket_get_family (socket_ctx->socket), tos);
+  }
 
-      break;
-    }
-    case PROP_LOCAL_ADDRESSES:
-    {
-      const ngtcp2_path *path;
-      GSocketAddress *sa;
-      GList *list = NULL;
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+  if (owner != NULL && socket_ctx->zerocopy_threshold > 0 &&
+      len >= socket_ctx->zerocopy_threshold) {
+    written = quiclib_socket_send_zerocopy (socket_ctx, addr, data, len,
+        (tos_msg != NULL)?(&tos_msg):(NULL), (tos_msg != NULL)?(1):(0), owner,
+        err);
+  } else
+#endif
+  {
+    ovec.buffer = data;
+    ovec.size = len;
 
-      path = ngtcp2_conn_get_path (conn->quic_conn);
-      sa = g_socket_address_new_from_native (path->local.addr,
-          path->local.addrlen);
+    written = g_socket_send_message (socket_ctx->socket, addr, &ovec, 1,
+        (tos_msg != NULL)?(&tos_msg):(NULL), (tos_msg != NULL)?(1):(0), 0,
+        NULL, err);
+  }
 
-      list = g_list_append (list, (gpointer) sa);
+  if (tos_msg != NULL) {
+    g_object_unref (tos_msg);
+  }
 
-      g_value_set_boxed (value, list);
+#if defined(HAVE_LIBURING) || defined(HAVE_LIBXDP)
+sent:
+#endif
 
-      break;
-    }
-    case PROP_SEND_DATAGRAMS:
-    {
-      const ngtcp2_transport_params *tp =
-          ngtcp2_conn_get_remote_transport_params (conn->quic_conn);
-      
-      if (tp) {
-        g_value_set_boolean (value, tp->max_datagram_frame_size > 0);
-      } else {
-        GST_WARNING_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn), "Attempted "
-            "to get remote transport parameter before they were ready");
-        g_value_set_boolean (value, FALSE);
-      }
-      break;
-    }
-    default:
-      G_OBJECT_CLASS (gst_quiclib_transport_connection_parent_class)->
-        get_property (object, prop_id, value, pspec);
+  if (written >= 0) {
+    g_mutex_lock (&socket_ctx->io_stats_mutex);
+    socket_ctx->io_stats.tx_packets++;
+    g_mutex_unlock (&socket_ctx->io_stats_mutex);
   }
 
-  g_mutex_unlock (&conn->mutex);
+  return written;
+}
+
+/**
+ * quiclib_socket_context_ref
+ *
+ * Takes a reference to @ctx, to be dropped with quiclib_socket_context_destroy.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static QuicLibSocketContext *
+quiclib_socket_context_ref (QuicLibSocketContext *ctx)
+{
+  g_atomic_int_inc (&ctx->ref_count);
+  return ctx;
 }
 
+/*
+ * Drops a reference to the socket context, closing the socket and freeing the
+ * context when it was the last one.
+ */
 void
-gst_quiclib_transport_connection_get_local_transport_param (
-    GstQuicLibTransportContext * ctx, guint prop_id, GValue * value) {
-  GstQuicLibTransportConnection *conn;
-  const ngtcp2_transport_params *local_tp;
+quiclib_socket_context_destroy (gpointer data)
+{
+  QuicLibSocketContext *ctx = (QuicLibSocketContext *) data;
 
-  if (!GST_IS_QUICLIB_TRANSPORT_CONNECTION (ctx)) {
-    g_value_set_uint64 (value, 0);
+  if (!g_atomic_int_dec_and_test (&ctx->ref_count)) {
     return;
   }
 
-  conn = GST_QUICLIB_TRANSPORT_CONNECTION (ctx);
+  GST_INFO_OBJECT (ctx->owner, "Destroying transport context %p", data);
 
-  if (conn->quic_conn == NULL) {
-    g_value_set_uint64 (value, 0);
-    return;
+#ifdef HAVE_LIBURING
+  if (ctx->uring != NULL) {
+    quiclib_uring_free (ctx->uring);
+    ctx->uring = NULL;
   }
-
-  local_tp = ngtcp2_conn_get_local_transport_params (conn->quic_conn);
-
-  switch (prop_id) {
-    case PROP_MAX_DATA_LOCAL:
-      g_value_set_uint64 (value, local_tp->initial_max_data);
-      break;
-    case PROP_MAX_STREAM_DATA_BIDI_LOCAL:
-      g_value_set_uint64 (value, local_tp->initial_max_stream_data_bidi_local);
-      break;
-    case PROP_MAX_STREAM_DATA_UNI_LOCAL:
-      g_value_set_uint64 (value, local_tp->initial_max_stream_data_uni);
-      break;
-    case PROP_MAX_STREAMS_BIDI_LOCAL:
-      g_value_set_uint64 (value, local_tp->initial_max_streams_bidi);
-      break;
-    case PROP_MAX_STREAMS_UNI_LOCAL:
-      g_value_set_uint64 (value, local_tp->initial_max_streams_uni);
-      break;
-    default:
-      g_critical ("Unreachable");
-      g_assert (0);
+#endif
+#ifdef HAVE_LIBXDP
+  if (ctx->xdp != NULL) {
+    quiclib_xdp_free (ctx->xdp);
+    ctx->xdp = NULL;
   }
-}
-
-gpointer
-quiclib_int64_hash_key (gint64 key)
-{
-  gint64 *p = (gint64 *) g_malloc (sizeof (gint64));
-  *p = key;
-  return (gpointer) p;
-}
+#endif
 
-void
-quiclib_hash_key_destroy (gpointer data)
-{
-  g_free (data);
-}
+  g_source_destroy (ctx->source);
+  g_source_unref (ctx->source);
 
-static void
-gst_quiclib_transport_connection_init (GstQuicLibTransportConnection *self)
-{
-  GValue gv_uint64 = G_VALUE_INIT;
-  GValue gv_uint = G_VALUE_INIT;
+  g_assert (g_socket_close (ctx->socket, NULL));
+  g_object_unref (ctx->socket);
 
-  g_value_init (&gv_uint64, G_TYPE_UINT64);
-  g_value_init (&gv_uint, G_TYPE_UINT);
+  ctx->source = NULL;
+  ctx->socket = NULL;
 
-  self->socket = NULL;
-  self->alpn = NULL;
-  self->quic_conn = NULL;
-  self->conn_ref.user_data = NULL;
-  self->datagram_ticket = 0;
-  self->ssl_ctx = NULL;
-  self->ssl = NULL;
-  self->streams = g_hash_table_new_full (g_int64_hash, g_int64_equal,
-      quiclib_hash_key_destroy, quiclib_stream_context_destroy);
-  self->datagrams_awaiting_ack = g_hash_table_new_full (g_int64_hash,
-      g_int64_equal, g_free, (GDestroyNotify) gst_buffer_unref);
-  ngtcp2_ccerr_default (&self->last_error);
-  ngtcp2_transport_params_default (&self->transport_params);
+  g_mutex_clear (&ctx->io_stats_mutex);
 
   /*
-   * Init to 0, they'll be set to the correct values when the connection is made
+   * The socket is closed, so the kernel has let go of any zero-copy sends that
+   * were still outstanding.
    */
-  self->bidi_remote_streams_remaining = 0;
-  self->uni_remote_streams_remaining = 0;
+  while (!g_queue_is_empty (&ctx->zc_pending)) {
+    QuicLibZerocopyPending *pending = g_queue_pop_head (&ctx->zc_pending);
 
-  g_mutex_init (&self->mutex);
-  g_cond_init (&self->cond);
-  memset (&self->stats, 0, sizeof (GstQuicLibConnStatsTrackers));
-  g_mutex_init (&self->stats.mutex);
-}
+    gst_buffer_unref (pending->buffer);
+    g_free (pending);
+  }
+  g_mutex_clear (&ctx->zc_mutex);
 
-static void
-gst_quiclib_transport_connection_finalise (GstQuicLibTransportConnection *self)
-{
-  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (self), "Finalizing");
+  g_free (ctx);
+}
 
-  gst_quiclib_transport_context_kill_thread (
-      GST_QUICLIB_TRANSPORT_CONTEXT (self));
+/*
+ * A token bucket filled at rate bits/second up to a depth of burst bytes, or
+ * a default depth if burst is 0. A rate of 0 means no limit. The tokens can go
+ * negative, as buffers are charged for in full once they've been sent, and
+ * that debt is paid off before anything else is let through.
+ */
+typedef struct {
+  guint64 rate;
+  guint64 burst;
+  gint64 tokens;
+  ngtcp2_tstamp last_fill;
+} QuicLibTokenBucket;
 
-  if (self->quic_conn) {
-    gst_quiclib_transport_context_lock (self);
-    if (!ngtcp2_conn_in_closing_period (self->quic_conn) &&
-        !ngtcp2_conn_in_draining_period (self->quic_conn)) {
-      ngtcp2_ssize nwrite;
-      ngtcp2_pkt_info pi;
-      ngtcp2_path_storage ps;
-      guint8 buf[1280];
+struct _GstQuicLibServerContext {
+  GstQuicLibTransportContext parent;
 
-      ngtcp2_path_storage_zero (&ps);
+  GSList *sockets; /* GSList of QuicLibSocketContexts */
+  GSList *acceptable_alpns; /* GSList of strings */
+  const gchar *cert_file_location;
+  const gchar *priv_key_location;
+  const gchar *sni_host;
 
-      nwrite = ngtcp2_conn_write_connection_close (self->quic_conn, &ps.path,
-          &pi, buf, sizeof (buf), &self->last_error,
-          quiclib_ngtcp2_timestamp());
+  SSL_CTX *ssl_ctx;
 
-      if (nwrite < 0) {
-        GST_ERROR_OBJECT (self,
-            "Couldn't write NGTCP2 CONNECTION_CLOSE frame: %s",
-            ngtcp2_strerror ((int) nwrite));
-      } else {
-        quiclib_packet_write (self, (const gchar *) buf, nwrite, &ps);
-      }
-    }
+  GList *connections; /* GList of GstQuicLibTransportConnection */
 
-    ngtcp2_conn_del (self->quic_conn);
+  /* Advertised to clients in the preferred_address transport parameter */
+  GSocketAddress *preferred_addr_ipv4;
+  GSocketAddress *preferred_addr_ipv6;
 
-    gst_quiclib_transport_context_unlock (self);
+  /*
+   * Egress scheduling, protected by egress_mutex. The token bucket for the
+   * egress-rate-limit property, the connections with stream data held back
+   * waiting for it, the virtual time of the weighted fair queue, and whether
+   * a release of the backlog is scheduled on the loop thread.
+   */
+  GMutex egress_mutex;
+  QuicLibTokenBucket egress;
+  /** GList <GstQuicLibTransportConnection *> (reffed) */
+  GList *egress_backlog;
+  guint64 egress_vtime;
+  gboolean egress_scheduled;
 
-    self->quic_conn = NULL;
-  }
+  /*
+   * Admission control. When the load was last sampled and the loop thread's
+   * CPU time then, and the secret that Retry tokens are made with, which are
+   * only used on the loop thread. The statistics are protected by mutex, and
+   * only written on the loop thread. memory_limited is set atomically while
+   * the connections together are over the server-memory-limit property.
+   */
+  struct {
+    GMutex mutex;
+    ngtcp2_tstamp sample_ts;
+    guint64 sample_cpu;
+    guint8 retry_secret[32];
+    GstQuicLibAdmissionStats stats;
+    gint memory_limited;
+  } admission;
+};
 
-  if (!self->server && self->socket) {
-    g_source_destroy (self->socket->source);
-    g_source_unref (self->socket->source);
+G_DEFINE_TYPE (GstQuicLibServerContext, gst_quiclib_server_context,
+    GST_TYPE_QUICLIB_TRANSPORT_CONTEXT);
 
-    g_object_unref (self->socket->socket);
+static void gst_quiclib_server_context_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec);
+static void gst_quiclib_server_context_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec);
 
-    g_free (self->socket);
-    self->socket = NULL;
-  }
+static void
+gst_quiclib_server_context_finalise (GstQuicLibServerContext *self);
 
-  if (self->cids) {
-    g_list_free_full (self->cids, g_free);
-    self->cids = NULL;
-  }
+void
+gst_quiclib_server_context_class_init (GstQuicLibServerContextClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
 
-  if (self->streams) {
-    g_hash_table_destroy (self->streams);
-    self->streams = NULL;
-  }
+  gobject_class->get_property = gst_quiclib_server_context_get_property;
+  gobject_class->set_property = gst_quiclib_server_context_set_property;
+  gobject_class->finalize =
+      (GObjectFinalizeFunc) gst_quiclib_server_context_finalise;
 
-  if (self->datagrams_awaiting_ack) {
-    g_hash_table_destroy (self->datagrams_awaiting_ack);
-    self->datagrams_awaiting_ack = NULL;
-  }
+  gst_quiclib_common_install_alpn_property (gobject_class);
+  gst_quiclib_common_install_privkey_location_property (gobject_class);
+  gst_quiclib_common_install_cert_location_property (gobject_class);
+  gst_quiclib_common_install_sni_property (gobject_class);
+}
 
-  if (self->ssl) {
-    SSL_free (self->ssl);
-    self->ssl = NULL;
+static void
+gst_quiclib_server_context_init (GstQuicLibServerContext *self)
+{
+  self->sockets = NULL;
+  self->acceptable_alpns = NULL;
+  self->cert_file_location = NULL;
+  self->priv_key_location = NULL;
+  self->sni_host = NULL;
+  self->ssl_ctx = NULL;
+  self->connections = NULL;
+  self->preferred_addr_ipv4 = NULL;
+  self->preferred_addr_ipv6 = NULL;
+
+  g_mutex_init (&self->egress_mutex);
+  memset (&self->egress, 0, sizeof (self->egress));
+  self->egress_backlog = NULL;
+  self->egress_vtime = 0;
+  self->egress_scheduled = FALSE;
+
+  memset (&self->admission, 0, sizeof (self->admission));
+  g_mutex_init (&self->admission.mutex);
+  if (RAND_bytes (self->admission.retry_secret,
+      sizeof (self->admission.retry_secret)) != 1) {
+    GST_WARNING_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (self),
+        "OpenSSL RAND_bytes failed to generate the Retry token secret: %s",
+        ERR_error_string (ERR_get_error (), NULL));
   }
+}
 
-  if (self->ssl_ctx) {
-    SSL_CTX_free (self->ssl_ctx);
-    self->ssl_ctx = NULL;
-  }
+static void gst_quiclib_server_context_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec)
+{
+  GstQuicLibServerContext *server = GST_QUICLIB_SERVER_CONTEXT (object);
 
-  g_mutex_lock (&self->stats.mutex);
-  if (self->stats.bytes_received) {
-    g_list_free_full (self->stats.bytes_received, g_free);
-  }
-  if (self->stats.bytes_sent) {
-    g_list_free_full (self->stats.bytes_sent, g_free);
-  }
-  g_mutex_unlock (&self->stats.mutex);
+  if (gst_debug_category_get_threshold (quiclib_transport) >= GST_LEVEL_TRACE)
+  {
+    gchar *valcon = g_strdup_value_contents (value);
 
-  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (self), "Done finalizing");
-}
+    GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (server),
+        "Setting property %s to %s", pspec->name, valcon);
 
-struct GstQuicLibConnectionID {
-  enum {
-    TYPE_SCID,
-    TYPE_DCID
-  } type;
-  ngtcp2_cid cid;
-};
+    g_free (valcon);
+  }
 
-struct _GstQuicLibDatagramBuffers {
-  guint64 datagram_id;
-  GstBuffer *buf;
-};
+  switch (prop_id) {
+    case PROP_ALPN:
+    {
+      gchar *v, *start = NULL, *v_orig;
+      gboolean avoid_whitespace = TRUE;
 
-typedef struct _GstQuicLibDatagramBuffers GstQuicLibDatagramBuffers;
+      if (server->acceptable_alpns) {
+        g_slist_free (server->acceptable_alpns);
+      }
 
+      v_orig = v = g_value_dup_string (value);
 
-gint
-quiclib_transport_process_packet (GstQuicLibTransportConnection *conn,
-    const ngtcp2_pkt_info *pktinfo, uint8_t *pkt, size_t pktlen);
+      /* Deserialise the ALPNs into a GList */
+      while (v != NULL) {
+        if (avoid_whitespace && (*v != ' ' && *v != '\t')) {
+          avoid_whitespace = FALSE;
+          start = v;
+        }
 
-/*
- * ngtcp2 callback declarations
- */
+        if (*v == ',' || *v == '\0') {
+          server->acceptable_alpns = g_slist_append (server->acceptable_alpns,
+              g_strndup (start, v - start));
+          avoid_whitespace = TRUE;
 
-void
-quiclib_ngtcp2_print (void *user_data, const char *format, ...);
+          if (*v == '\0') {
+            break;
+          }
+        }
 
-int
-quiclib_ngtcp2_recv_client_initial (ngtcp2_conn *quic_conn,
-    const ngtcp2_cid *dcid, void *user_data);
+        v++;
+      }
 
-int
-quiclib_ngtcp2_handshake_completed (ngtcp2_conn *conn, void *user_data);
+      g_free (v_orig);
+      break;
+    }
+    /*
+     * TODO: Should it ever be expected that the private key and cert location
+     * would change during runtime? Or could these be CONSTRUCT_ONLY?
+     */
+    case PROP_PRIVKEY_LOCATION:
+      if (server->priv_key_location) {
+        g_free ((gpointer) server->priv_key_location);
+      }
+      server->priv_key_location = g_value_dup_string (value);
+      break;
+    case PROP_CERT_LOCATION:
+      if (server->cert_file_location) {
+        g_free ((gpointer) server->cert_file_location);
+      }
+      server->cert_file_location = g_value_dup_string (value);
+      break;
+    case PROP_SNI:
+      if (server->sni_host) {
+        g_free ((gpointer) server->sni_host);
+      }
+      server->sni_host = g_value_dup_string (value);
+      break;
+    default:
+      G_OBJECT_CLASS (gst_quiclib_server_context_parent_class)->
+        set_property (object, prop_id, value, pspec);
+  }
+}
 
-int
-quiclib_ngtcp2_recv_stream_data (ngtcp2_conn *conn, uint32_t flags,
-    int64_t stream_id, uint64_t offset,
-    const uint8_t *data, size_t datalen,
-    void *user_data, void *stream_user_data);
+static void gst_quiclib_server_context_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec)
+{
+  GstQuicLibServerContext *server = GST_QUICLIB_SERVER_CONTEXT (object);
 
-int
-quiclib_ngtcp2_recv_datagram (ngtcp2_conn *conn, uint32_t flags,
-    const uint8_t *data, size_t datalen,
-    void *user_data);
+  GST_TRACE_OBJECT (server, "Getting value of property %s", pspec->name);
 
-int
-quiclib_ngtcp2_ack_stream (ngtcp2_conn *ngconn, int64_t stream_id,
-    uint64_t offset, uint64_t datalen,
-    void *user_data, void *stream_user_data);
+  switch (prop_id) {
+    case PROP_ALPN:
+    {
+      /* Serialise the list to a string */
+      GSList *lptr = server->acceptable_alpns;
+      guint i = 0;
+      gchar **in;
+      gchar *out = NULL;
 
-int
-quiclib_ngtcp2_ack_datagram (ngtcp2_conn *quic_conn, uint64_t dgram_id,
-    void *user_data);
+      in = (gchar **) g_malloc (sizeof (gchar *) *
+          (g_slist_length (server->acceptable_alpns) + 1));
 
-int
-quiclib_ngtcp2_on_stream_open (ngtcp2_conn *quic_conn, int64_t stream_id,
-    void *user_data);
+      for (; lptr != NULL; lptr = g_slist_next (lptr)) {
+        in[i++] = lptr->data;
+      }
 
-int
-quiclib_ngtcp2_on_stream_close (ngtcp2_conn *quic_conn, uint32_t flags,
-    int64_t stream_id, uint64_t app_error_code,
-    void *user_data, void *stream_user_data);
+      in[i] = NULL;
 
-int
-quiclib_ngtcp2_on_stream_reset (ngtcp2_conn *quic_conn, int64_t stream_id,
-    uint64_t final_size, uint64_t app_error_code, void *user_data,
-    void *stream_user_data);
+      out = g_strjoinv (", ", in);
 
-void
-quiclib_ngtcp2_rand (uint8_t *dest, size_t destlen, const ngtcp2_rand_ctx *ctx);
+      g_value_set_string (value, out);
 
-int
-quiclib_ngtcp2_get_new_connection_id (ngtcp2_conn *conn, ngtcp2_cid *cid,
-    uint8_t *token, size_t cidlen,
-    void *user_data);
+      if (out) {
+        g_free (out);
+      }
+      break;
+    }
+    case PROP_PRIVKEY_LOCATION:
+      g_value_set_string (value, server->priv_key_location);
+      break;
+    case PROP_CERT_LOCATION:
+      g_value_set_string (value, server->cert_file_location);
+      break;
+    case PROP_SNI:
+      g_value_set_string (value, server->sni_host);
+      break;
+    default:
+      G_OBJECT_CLASS (gst_quiclib_server_context_parent_class)->
+        get_property (object, prop_id, value, pspec);
+  }
+}
 
-int
-quiclib_ngtcp2_remove_connection_id (ngtcp2_conn *conn,
-    const ngtcp2_cid *cid, void *user_data);
+static void
+gst_quiclib_server_context_finalise (GstQuicLibServerContext *self)
+{
+  if (self->connections) {
+    g_list_free_full (self->connections, g_object_unref);
+    self->connections = NULL;
+  }
 
-ngtcp2_conn *
-quiclib_get_ngtcp2_conn (ngtcp2_crypto_conn_ref *conn_ref);
+  if (self->sockets) {
+    g_slist_free_full (self->sockets, quiclib_socket_context_destroy);
+    self->sockets = NULL;
+  }
 
-ngtcp2_callbacks quiclib_ngtcp2_client_callbacks = {
-    .client_initial = ngtcp2_crypto_client_initial_cb,
-    .recv_client_initial = NULL,
-    .recv_crypto_data = ngtcp2_crypto_recv_crypto_data_cb,
-    .handshake_completed = quiclib_ngtcp2_handshake_completed,
-    .recv_version_negotiation = NULL,
-    .encrypt = ngtcp2_crypto_encrypt_cb,
-    .decrypt = ngtcp2_crypto_decrypt_cb,
-    .hp_mask = ngtcp2_crypto_hp_mask_cb,
-    .recv_stream_data = quiclib_ngtcp2_recv_stream_data,
-    .acked_stream_data_offset = quiclib_ngtcp2_ack_stream,
-    .stream_open = quiclib_ngtcp2_on_stream_open,
-    .stream_close = quiclib_ngtcp2_on_stream_close,
-    .recv_stateless_reset = NULL,
-    .recv_retry = ngtcp2_crypto_recv_retry_cb,
-    .extend_max_local_streams_bidi = NULL,
-    .extend_max_local_streams_uni = NULL,
-    .rand = quiclib_ngtcp2_rand,
-    .get_new_connection_id = quiclib_ngtcp2_get_new_connection_id,
-    .remove_connection_id = quiclib_ngtcp2_remove_connection_id,
-    .update_key = ngtcp2_crypto_update_key_cb,
-    .path_validation = NULL,
-    .select_preferred_addr = NULL,
-    .stream_reset = quiclib_ngtcp2_on_stream_reset,
-    .extend_max_remote_streams_bidi = NULL,
-    .extend_max_remote_streams_uni = NULL,
-    .extend_max_stream_data = NULL,
-    .dcid_status = NULL,
-    .handshake_confirmed = NULL,
-    .recv_new_token = NULL,
-    .delete_crypto_aead_ctx = ngtcp2_crypto_delete_crypto_aead_ctx_cb,
-    .delete_crypto_cipher_ctx = ngtcp2_crypto_delete_crypto_cipher_ctx_cb,
-    .recv_datagram = quiclib_ngtcp2_recv_datagram,
-    .ack_datagram = quiclib_ngtcp2_ack_datagram,
-    .lost_datagram = NULL,
-    .get_path_challenge_data = ngtcp2_crypto_get_path_challenge_data_cb,
-    .stream_stop_sending = NULL,
-    .version_negotiation = ngtcp2_crypto_version_negotiation_cb,
-    .recv_rx_key = NULL,
-    .recv_tx_key = NULL,
-    .tls_early_data_rejected = NULL
-};
+  if (self->acceptable_alpns) {
+    g_slist_free_full (self->acceptable_alpns, g_free);
+  }
 
-ngtcp2_callbacks quiclib_ngtcp2_server_callbacks = {
-    .client_initial = NULL,
-    .recv_client_initial = ngtcp2_crypto_recv_client_initial_cb,
-    .recv_crypto_data = ngtcp2_crypto_recv_crypto_data_cb,
-    .handshake_completed = quiclib_ngtcp2_handshake_completed,
-    .recv_version_negotiation = NULL,
-    .encrypt = ngtcp2_crypto_encrypt_cb,
-    .decrypt = ngtcp2_crypto_decrypt_cb,
-    .hp_mask = ngtcp2_crypto_hp_mask_cb,
-    .recv_stream_data = quiclib_ngtcp2_recv_stream_data,
-    .acked_stream_data_offset = quiclib_ngtcp2_ack_stream,
-    .stream_open = quiclib_ngtcp2_on_stream_open,
-    .stream_close = quiclib_ngtcp2_on_stream_close,
-    .recv_stateless_reset = NULL,
-    .recv_retry = ngtcp2_crypto_recv_retry_cb,
-    .extend_max_local_streams_bidi = NULL,
-    .extend_max_local_streams_uni = NULL,
-    .rand = quiclib_ngtcp2_rand,
-    .get_new_connection_id = quiclib_ngtcp2_get_new_connection_id,
-    .remove_connection_id = quiclib_ngtcp2_remove_connection_id,
-    .update_key = ngtcp2_crypto_update_key_cb,
-    .path_validation = NULL,
-    .select_preferred_addr = NULL,
-    .stream_reset = quiclib_ngtcp2_on_stream_reset,
-    .extend_max_remote_streams_bidi = NULL,
-    .extend_max_remote_streams_uni = NULL,
-    .extend_max_stream_data = NULL,
-    .dcid_status = NULL,
-    .handshake_confirmed = NULL,
-    .recv_new_token = NULL,
-    .delete_crypto_aead_ctx = ngtcp2_crypto_delete_crypto_aead_ctx_cb,
-    .delete_crypto_cipher_ctx = ngtcp2_crypto_delete_crypto_cipher_ctx_cb,
-    .recv_datagram = quiclib_ngtcp2_recv_datagram,
-    .ack_datagram = quiclib_ngtcp2_ack_datagram,
-    .lost_datagram = NULL,
-    .get_path_challenge_data = ngtcp2_crypto_get_path_challenge_data_cb,
-    .stream_stop_sending = NULL,
-    .version_negotiation = ngtcp2_crypto_version_negotiation_cb,
-    .recv_rx_key = NULL,
-    .recv_tx_key = NULL,
-    .tls_early_data_rejected = NULL
-};
+  if (self->ssl_ctx) {
+    SSL_CTX_free (self->ssl_ctx);
+    self->ssl_ctx = NULL;
+  }
 
-#define CID_STR_LEN ((NGTCP2_MAX_CIDLEN * 2) + 1)
-#define NIBBLE_TO_HEX(nibble, out) \
-		if (nibble > 9) { \
-			out = nibble + 87; \
-		} else { \
-			out = nibble + 48; \
-		}
+  g_clear_object (&self->preferred_addr_ipv4);
+  g_clear_object (&self->preferred_addr_ipv6);
 
-void
-hextoascii (uint8_t in, char *out) {
-  uint8_t top_nibble = (in & 0xf0) >> 4;
-  uint8_t bottom_nibble = in & 0x0f;
+  g_list_free_full (self->egress_backlog, g_object_unref);
+  self->egress_backlog = NULL;
+  g_mutex_clear (&self->egress_mutex);
 
-  NIBBLE_TO_HEX (top_nibble, out[0]);
-  NIBBLE_TO_HEX (bottom_nibble, out[1]);
-}
+  g_mutex_clear (&self->admission.mutex);
 
-gchar *
-quiclib_rawcidtostr (const uint8_t *cid, const size_t cidlen, gchar *buf)
-{
-  gsize i;
+  gst_quiclib_transport_set_cid_generator (
+      GST_QUICLIB_TRANSPORT_CONTEXT (self), NULL, 0, NULL, NULL);
 
-  if (cidlen == 0) {
-    sprintf (buf, "(not present)");
-    return buf;
-  }
+  gst_quiclib_transport_context_kill_thread (
+        GST_QUICLIB_TRANSPORT_CONTEXT (self));
 
-  for (i = 0; i < cidlen; i++) {
-    hextoascii (cid[i], buf + i * 2);
-  }
-  buf[i * 2] = 0;
-  return buf;
+  G_OBJECT_CLASS (gst_quiclib_server_context_parent_class)->finalize (
+      G_OBJECT (self));
 }
 
-/*
- * Used for debugging only
- */
-gchar *
-quiclib_cidtostr (ngtcp2_cid *cid, gchar *buf)
-{
-  return quiclib_rawcidtostr (cid->data, cid->datalen, buf);
-}
+#define QUICLIB_SERVER_CONTEXT_SAFE_CAST(o) \
+		(GstQuicLibServerContext *) o; \
+		if (GST_QUICLIB_TRANSPORT_CONTEXT (o)->type != QUIC_CTX_SERVER) \
+		abort (0);
 
 /*
- * OpenSSL callback definitions
+ * Asynchronous callback handling source types
  */
 
-int
-quiclib_ssl_select_proto_cb (SSL *ssl, const unsigned char **out,
-    unsigned char *outlen, const unsigned char *in,
-    unsigned int inlen, void *arg)
-{
-  unsigned int len = 0;
-  /* Limited to 255 according to OpenSSL docs */
-  GSList *alpn, *src = NULL;
-  unsigned char *client_list;
-  int rv;
-  ngtcp2_crypto_conn_ref *conn_ref =
-      (ngtcp2_crypto_conn_ref *) SSL_get_app_data (ssl);
-  GstQuicLibTransportConnection *conn =
-      (GstQuicLibTransportConnection *) conn_ref->user_data;
+typedef struct {
+  GSource parent;
 
-  if (conn->server) {
-    src = conn->server->acceptable_alpns;
-  } else {
-    gchar *alpn_str = g_strdup (conn->alpn);
-    src = g_slist_append (src, (gpointer) alpn_str);
-  }
+  GstQuicLibTransportConnection *conn;
 
-  alpn = src;
-  while (alpn != NULL) {
-    len += strlen ((gchar *) alpn->data) + 1;
-    alpn = alpn->next;
-  }
+  GMutex mutex;
 
-  client_list = alloca (len);
-  alpn = src;
-  len = 0;
-  while (alpn != NULL) {
-    gchar *a = (gchar *) alpn->data;
-    client_list[len++] = strlen (a);
-    memcpy (client_list + len, a, strlen (a));
-    len += strlen (a);
-    alpn = alpn->next;
-  }
+  gsize queue_len;
+  GAsyncQueue *queue;
+} GstQuicLibTransportSendQueueSource;
 
-  rv = SSL_select_next_proto ((unsigned char **) out, outlen, in, inlen,
-      client_list, len);
+typedef struct {
+  GSource parent;
 
-  if (rv == OPENSSL_NPN_NEGOTIATED) {
-    conn->alpn = g_strndup ((const gchar *) *out, *outlen);
-  }
+  enum {
+    CB_HANDSHAKE_COMPLETED,
+    CB_STREAM_ACK,
+    CB_STREAM_OPEN,
+    CB_STREAM_CLOSE,
+    CB_STREAM_RESET,
+    CB_DATAGRAM_ACK
+  } type;
 
-  if (!conn->server) {
-    g_free (src->data);
-    g_slist_free (src);
-  }
+  GstQuicLibTransportConnection *conn;
+  gboolean conn_ref;
+} GstQuicLibTransportCallbackSource;
 
-  if (rv == OPENSSL_NPN_NEGOTIATED) {
-    return SSL_TLSEXT_ERR_OK;
-  }
+typedef struct {
+  GstQuicLibTransportCallbackSource source;
 
-  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-      "Client did not present an acceptable ALPN: %.*s",
-      (int) inlen, (char *) in);
+  GSocketAddress *peer;
+} GstQuicLibTransportHandshakeCompleteCallbackSource;
 
-  return SSL_TLSEXT_ERR_ALERT_FATAL;
-}
+typedef struct {
+  GstQuicLibTransportCallbackSource source;
 
-#ifdef OPENSSL_DEBUG
-void
-quiclib_openssl_dbg_cb (int write_p, int version, int content_type,
-    const void *bufv, size_t len, SSL *ssl, void *arg)
-{
-  GstQuicLibTransportContext *ctx = GST_QUICLIB_TRANSPORT_CONTEXT (arg);
-  const unsigned char *buf = (const unsigned char *) bufv;
+  guint64 stream_id;
+} GstQuicLibTransportStreamIDCallbackSource;
 
-  switch (content_type) {
-  case SSL3_RT_HEADER:
-    GST_TRACE_OBJECT (ctx, "OpenSSL debugging (%p): %s %s record header,"
-        " epoch %d, sequence number %04x%04x%04x", ssl, write_p == 1?"Sent":"Received",
-            version == TLS1_3_VERSION?"TLS 1.3":"NOT TLS 1.3", (buf[3] << 8 | buf[4]),
-                (buf[5] << 8 | buf[6]), (buf[7] << 8 | buf[8]), (buf[9] << 8 | buf[10]));
-    break;
-  case SSL3_RT_INNER_CONTENT_TYPE:
-  {
-    const gchar *ict;
-    switch (buf[0]) {
-    case SSL3_RT_CHANGE_CIPHER_SPEC:
-      ict = "ChangeCipherSpec";
-      break;
-    case SSL3_RT_ALERT:
-      ict = "Alert";
-      break;
-    case SSL3_RT_HANDSHAKE:
-      ict = "Handshake";
-      break;
-    case SSL3_RT_APPLICATION_DATA:
-      ict = "ApplicationData";
-      break;
-    default:
-      ict = "Unknown";
-    }
+typedef struct {
+  GstQuicLibTransportCallbackSource source;
 
-    GST_TRACE_OBJECT (ctx,
-        "OpenSSL debugging (%p): %s %s inner content type %s", ssl,
-        write_p == 1?"Sent":"Received",
-            version == TLS1_3_VERSION?"TLS 1.3":"NOT TLS 1.3", ict);
-    break;
+  guint64 stream_id;
+  guint64 offset;
+} GstQuicLibTransportAckCallbackSource;
+
+/*
+ * The bytes in a packet sent or received, and when. Kept on one of the
+ * connection's stats queues through @link, so that adding one to a queue
+ * doesn't allocate a list node.
+ */
+typedef struct {
+  guint64 timestamp_ns;
+  gsize bytes;
+  GList link;
+} GstQuicLibPacketStats;
+
+typedef struct {
+  struct {
+    guint64 sent;
+    guint64 received;
+    guint64 rtx;
+  } pkt_counts;
+
+  GMutex mutex;
+  GQueue bytes_received;
+  GQueue bytes_sent;
+
+  /*
+   * CLOCK_REALTIME arrival time of the packet currently being processed, so
+   * that the ngtcp2 receive callbacks can work out the delivery latency.
+   */
+  guint64 rx_timestamp_ns;
+  GstQuicLibLatencyHistogram rx_delivery;
+  GstQuicLibLatencyHistogram rx_queueing;
+
+  /*
+   * The receive delivery time smoothed in the same way as the RTT, and its
+   * mean deviation, for reporting the transport latency. These are kept
+   * whenever there's an arrival time, even without statistics enabled.
+   */
+  guint64 rx_delivery_smoothed;
+  guint64 rx_delivery_meandev;
+
+  /* Time buffers of stream data were held back by rate limits */
+  GstQuicLibLatencyHistogram shaping_delay;
+
+  /*
+   * Packet counts indexed by ECN codepoint, and the ngtcp2 timestamps of the
+   * last unmarked and ECT-marked packets sent while ECN was being validated.
+   */
+  struct {
+    guint64 tx[4];
+    guint64 rx[4];
+    guint64 last_ect_ts;
+    guint64 last_not_ect_ts;
+  } ecn;
+} GstQuicLibConnStatsTrackers;
+
+/*
+ * Memory pools.
+ *
+ * Each connection hands ngtcp2 an ngtcp2_mem that allocates from its own
+ * pool, so that the frame chains, retransmission buffer entries and stream
+ * buffers that ngtcp2 churns through are recycled within the connection
+ * rather than contending on the global allocator with other threads. Small
+ * allocations are rounded up to a power-of-two size class and freed blocks
+ * are kept on a free list for that class, up to QUICLIB_MEM_POOL_MAX_CACHED
+ * bytes in all. Larger allocations go straight to g_malloc. Every block
+ * carries a QuicLibMemHeader in front of it, recording its size for the
+ * accounting and for realloc.
+ *
+ * ngtcp2 only ever uses a connection from one thread at a time, under the
+ * context lock, so the pool needs no locking of its own.
+ */
+#define QUICLIB_MEM_POOL_MIN_SHIFT 5
+#define QUICLIB_MEM_POOL_CLASSES 8
+#define QUICLIB_MEM_POOL_LARGE QUICLIB_MEM_POOL_CLASSES
+#define QUICLIB_MEM_POOL_MAX_CACHED (256 * 1024)
+
+typedef struct {
+  gsize size;
+  gsize size_class;
+} QuicLibMemHeader;
+
+/*
+ * The free list of each size class, the bytes of blocks on all of them, and
+ * the bytes of the allocations that ngtcp2 currently holds.
+ */
+typedef struct {
+  gpointer free_lists[QUICLIB_MEM_POOL_CLASSES];
+  gsize cached;
+  gsize held;
+} QuicLibMemPool;
+
+/**
+ * quiclib_mem_pool_class_size
+ *
+ * Returns the size in bytes of the blocks in @size_class.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static inline gsize
+quiclib_mem_pool_class_size (gsize size_class)
+{
+  return (gsize) 1 << (size_class + QUICLIB_MEM_POOL_MIN_SHIFT);
+}
+
+/**
+ * quiclib_mem_pool_malloc
+ *
+ * ngtcp2_mem malloc hook. Returns a block of at least @size bytes from the
+ * pool in @user_data, reusing a freed one of the same size class if there is
+ * one.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void *
+quiclib_mem_pool_malloc (size_t size, void *user_data)
+{
+  QuicLibMemPool *pool = (QuicLibMemPool *) user_data;
+  QuicLibMemHeader *hdr;
+  gsize size_class = 0;
+
+  while (size_class < QUICLIB_MEM_POOL_CLASSES &&
+      quiclib_mem_pool_class_size (size_class) < size) {
+    size_class++;
   }
-  case SSL3_RT_HANDSHAKE:
-    GST_TRACE_OBJECT (ctx, "OpenSSL debugging (%p): %s %s handshake", ssl,
-        write_p == 1?"Sent":"Received",
-            version == TLS1_3_VERSION?"TLS 1.3":"NOT TLS 1.3");
-    break;
-  case SSL3_RT_CHANGE_CIPHER_SPEC:
-    GST_TRACE_OBJECT (ctx, "OpenSSL debugging (%p): %s %s ChangeCipherSpec",
-        ssl, write_p == 1?"Sent":"Received",
-            version == TLS1_3_VERSION?"TLS 1.3":"NOT TLS 1.3");
-    break;
-  case SSL3_RT_ALERT:
-    GST_TRACE_OBJECT (ctx, "OpenSSL debugging (%p): %s %s Alert: "
-        "Level \"%s\", description \"%s\"", ssl,
-        write_p == 1?"Sent":"Received",
-            version == TLS1_3_VERSION?"TLS 1.3":"NOT TLS 1.3",
-                SSL_alert_type_string_long (buf[0] << 8),
-                SSL_alert_desc_string_long (buf[1]));
-    break;
-  default:
-    GST_TRACE_OBJECT (ctx,
-        "OpenSSL debugging (%p): Unknown %s content type %d", ssl,
-        version == TLS1_3_VERSION?"TLS 1.3":"NOT TLS 1.3", content_type);
+
+  if (size_class == QUICLIB_MEM_POOL_LARGE) {
+    hdr = g_try_malloc (sizeof (QuicLibMemHeader) + size);
+    if (hdr == NULL) {
+      return NULL;
+    }
+  } else if (pool->free_lists[size_class] != NULL) {
+    hdr = (QuicLibMemHeader *) pool->free_lists[size_class];
+    pool->free_lists[size_class] = *(gpointer *) (hdr + 1);
+    pool->cached -= quiclib_mem_pool_class_size (size_class);
+  } else {
+    hdr = g_try_malloc (sizeof (QuicLibMemHeader) +
+        quiclib_mem_pool_class_size (size_class));
+    if (hdr == NULL) {
+      return NULL;
+    }
   }
+
+  hdr->size = size;
+  hdr->size_class = size_class;
+  pool->held += size;
+
+  return hdr + 1;
 }
-#endif
 
-void
-quiclib_ssl_keylog_cb (const SSL *ssl, const char *line)
+/**
+ * quiclib_mem_pool_free
+ *
+ * ngtcp2_mem free hook. Returns @ptr to the free list of its size class in the
+ * pool in @user_data, or to g_free if it is large or the pool has cached
+ * enough already.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_mem_pool_free (void *ptr, void *user_data)
 {
-  time_t curtime;
-  struct tm *curtm;
-  size_t sz;
-  char filename[PATH_MAX];
-  FILE *fp;
-  gchar cidstr[CID_STR_LEN];
-  ngtcp2_crypto_conn_ref *conn_ref =
-      (ngtcp2_crypto_conn_ref *) SSL_get_app_data (ssl);
-  GstQuicLibTransportConnection *conn =
-      (GstQuicLibTransportConnection *) conn_ref->user_data;
-  ngtcp2_cid *cid = (ngtcp2_cid *) g_list_first (conn->cids)->data;
-  const gchar *tls_export_dir = g_getenv ("GST_QUICLIB_TLS_EXPORT_DIR");
+  QuicLibMemPool *pool = (QuicLibMemPool *) user_data;
+  QuicLibMemHeader *hdr;
+  gsize class_size;
 
-  curtime = time(NULL);
-  curtm = localtime (&curtime);
+  if (ptr == NULL) {
+    return;
+  }
 
-  snprintf (filename, PATH_MAX, "%s/%04d%02d%02d-%02d%02d%02d-%s.keys",
-      tls_export_dir, curtm->tm_year + 1900, curtm->tm_mon + 1,
-      curtm->tm_mday, curtm->tm_hour, curtm->tm_min, curtm->tm_sec,
-      quiclib_cidtostr (cid, cidstr));
+  hdr = (QuicLibMemHeader *) ptr - 1;
+  pool->held -= hdr->size;
 
-  fp = fopen (filename, "ab");
-  if (fp == NULL) {
-    GST_WARNING_OBJECT (GST_QUICLIB_TRANSPORT_CONNECTION (conn),
-        "Couldn't open TLS secrets file %s: %s", filename,
-        strerror (errno));
+  if (hdr->size_class == QUICLIB_MEM_POOL_LARGE) {
+    g_free (hdr);
     return;
   }
 
-  sz = fprintf (fp, "%s:\n", line);
-  fclose (fp);
+  class_size = quiclib_mem_pool_class_size (hdr->size_class);
+  if (pool->cached + class_size > QUICLIB_MEM_POOL_MAX_CACHED) {
+    g_free (hdr);
+    return;
+  }
 
-  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONNECTION (conn),
-      "Wrote %ld bytes to TLS secrets file %s", sz, filename);
+  *(gpointer *) ptr = pool->free_lists[hdr->size_class];
+  pool->free_lists[hdr->size_class] = hdr;
+  pool->cached += class_size;
 }
 
-void
-quiclib_enable_tls_export (GstQuicLibTransportContext *ctx, SSL *ssl)
+/**
+ * quiclib_mem_pool_calloc
+ *
+ * ngtcp2_mem calloc hook.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void *
+quiclib_mem_pool_calloc (size_t nmemb, size_t size, void *user_data)
 {
-  const gchar *tls_export_dir = g_getenv ("GST_QUICLIB_TLS_EXPORT_DIR");
+  void *ptr;
 
-  if (tls_export_dir) {
-    GStatBuf sb;
-    if (g_stat (tls_export_dir, &sb) == -1) {
-      if (g_mkdir_with_parents (tls_export_dir, 0700) == -1) {
-        GST_WARNING_OBJECT (ctx, "Couldn't create TLS export directory: %s",
-            strerror (errno));
-        return;
-      }
+  if (size != 0 && nmemb > G_MAXSIZE / size) {
+    return NULL;
+  }
+
+  ptr = quiclib_mem_pool_malloc (nmemb * size, user_data);
+  if (ptr != NULL) {
+    memset (ptr, 0, nmemb * size);
+  }
+
+  return ptr;
+}
+
+/**
+ * quiclib_mem_pool_realloc
+ *
+ * ngtcp2_mem realloc hook. Resizes @ptr in place if @size still fits its size
+ * class, and otherwise moves it to a new block.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void *
+quiclib_mem_pool_realloc (void *ptr, size_t size, void *user_data)
+{
+  QuicLibMemPool *pool = (QuicLibMemPool *) user_data;
+  QuicLibMemHeader *hdr;
+  void *moved;
+
+  if (ptr == NULL) {
+    return quiclib_mem_pool_malloc (size, user_data);
+  }
+
+  hdr = (QuicLibMemHeader *) ptr - 1;
+
+  if (hdr->size_class == QUICLIB_MEM_POOL_LARGE) {
+    if (size <= quiclib_mem_pool_class_size (QUICLIB_MEM_POOL_CLASSES - 1)) {
+      goto move;
     }
 
-    if (!(sb.st_mode & S_IFDIR)) {
-      GST_WARNING_OBJECT (ctx, "TLS export path %s is not a directory",
-          tls_export_dir);
+    hdr = g_try_realloc (hdr, sizeof (QuicLibMemHeader) + size);
+    if (hdr == NULL) {
+      return NULL;
     }
+  } else if (size > quiclib_mem_pool_class_size (hdr->size_class)) {
+    goto move;
+  }
 
-    GST_DEBUG_OBJECT (ctx, "Logging TLS secrets for connection to %s",
-        tls_export_dir);
+  pool->held += size;
+  pool->held -= hdr->size;
+  hdr->size = size;
 
-    SSL_CTX_set_keylog_callback (SSL_get_SSL_CTX (ssl), quiclib_ssl_keylog_cb);
+  return hdr + 1;
+
+move:
+  moved = quiclib_mem_pool_malloc (size, user_data);
+  if (moved == NULL) {
+    return NULL;
   }
+
+  memcpy (moved, ptr, MIN (size, hdr->size));
+  quiclib_mem_pool_free (ptr, user_data);
+
+  return moved;
 }
 
-/*
- * ngtcp2 callback definitions
+/**
+ * quiclib_mem_pool_clear
+ *
+ * Frees the blocks cached on the free lists of @pool. Call once ngtcp2 has
+ * finished with it.
+ *
+ * INTERNAL FUNCTION ONLY.
  */
-void
-quiclib_ngtcp2_print (void *user_data, const char *format, ...)
+static void
+quiclib_mem_pool_clear (QuicLibMemPool *pool)
 {
-  GstQuicLibTransportConnection *conn =
-      (GstQuicLibTransportConnection *) user_data;
-  va_list args;
-  va_start (args, format);
-  gst_debug_log_valist (GST_CAT_DEFAULT, GST_LEVEL_LOG, "ngtcp2",
-      conn->server?"server":"client", 0, G_OBJECT (conn), format, args);
-  va_end (args);
-}
+  gsize i;
 
-#define ASYNC_CALLBACKS 1
+  for (i = 0; i < QUICLIB_MEM_POOL_CLASSES; i++) {
+    while (pool->free_lists[i] != NULL) {
+      QuicLibMemHeader *hdr = (QuicLibMemHeader *) pool->free_lists[i];
 
-const gchar *
-_quiclib_transport_callback_type_to_string (int type) {
-  switch (type) {
-    case CB_HANDSHAKE_COMPLETED: return "handshake completed";
-    case CB_STREAM_ACK: return "stream ACK";
-    case CB_STREAM_OPEN: return "stream open";
-    case CB_STREAM_CLOSE: return "stream close";
-    case CB_STREAM_RESET: return "stream reset";
-    case CB_DATAGRAM_ACK: return "datagram ACK";
+      pool->free_lists[i] = *(gpointer *) (hdr + 1);
+      g_free (hdr);
+    }
   }
-  return "unknown";
-}
 
-static gboolean
-_quiclib_transport_callback_source_prepare (GSource *source, gint *timeout)
-{
-  GstQuicLibTransportCallbackSource *cb_source =
-      (GstQuicLibTransportCallbackSource *) source;
-  GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (cb_source->conn),
-      "Prepare async callback of type %s",
-      _quiclib_transport_callback_type_to_string (cb_source->type));
-  return TRUE;
+  pool->cached = 0;
 }
 
-static gboolean
-_quiclib_transport_callback_source_dispatch (GSource *source, GSourceFunc cb,
-    gpointer user_data)
-{
-  GstQuicLibTransportCallbackSource *cb_source =
-      (GstQuicLibTransportCallbackSource *) source;
-  GstQuicLibTransportConnection * conn = cb_source->conn;
-  GstQuicLibTransportUserInterface *iface = QUICLIB_TRANSPORT_USER_GET_IFACE (
-      gst_quiclib_transport_context_get_user (conn));
-
-  GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-      "Dispatching async callback of type %s",
-      _quiclib_transport_callback_type_to_string (cb_source->type));
-
-  switch (cb_source->type) {
-    case CB_HANDSHAKE_COMPLETED:
-      if (iface->handshake_complete != NULL) {
-        GstQuicLibTransportHandshakeCompleteCallbackSource *hc_source =
-            (GstQuicLibTransportHandshakeCompleteCallbackSource *) cb_source;
-        gboolean rv = iface->handshake_complete (
-            gst_quiclib_transport_context_get_user (conn),
-            &conn->parent, conn, G_INET_SOCKET_ADDRESS (hc_source->peer),
-            conn->alpn);
-        g_object_unref (hc_source->peer);
-        if (rv == FALSE) {
-          GST_WARNING_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-              "Transport user indicated handshake was unacceptable");
-          /* TODO: Tear down connection */
-        }
-      }
-      break;
-    case CB_STREAM_ACK:
-      /* TODO: Implement application buffer acknowledgements */
-      GST_FIXME_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-          "Need to implement app buffer acknowledgements");
-      break;
-    case CB_STREAM_OPEN:
-      if (iface->stream_opened != NULL) {
-        GstQuicLibTransportStreamIDCallbackSource *sid_source =
-            (GstQuicLibTransportStreamIDCallbackSource *) cb_source;
-        if (!iface->stream_opened (gst_quiclib_transport_context_get_user (conn),
-            GST_QUICLIB_TRANSPORT_CONTEXT (conn), sid_source->stream_id)) {
-          GST_FIXME_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-              "Need to implement closing stream async");
-        }
-      }
-      break;
-    case CB_STREAM_CLOSE:
-    case CB_STREAM_RESET:
-      if (iface->stream_closed != NULL) {
-        GstQuicLibTransportStreamIDCallbackSource *sid_source =
-            (GstQuicLibTransportStreamIDCallbackSource *) cb_source;
-        iface->stream_closed (gst_quiclib_transport_context_get_user (conn),
-            GST_QUICLIB_TRANSPORT_CONTEXT (conn), sid_source->stream_id);
-      }
-      break;
-    case CB_DATAGRAM_ACK:
-      /* TODO: Implement application buffer acknowledgements */
-      GST_FIXME_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-          "Need to implement app buffer acknowledgements");
-      break;
-  }
+/*
+ * Slab caches.
+ *
+ * The small control objects that the library allocates on its hot paths -
+ * copies of connection IDs, packet statistics, stream ID keys, datagram ACK
+ * records and buffer mapping records - come from per-connection slabs of
+ * fixed-size objects rather than from g_malloc. A slab grows by
+ * QUICLIB_SLAB_CHUNK_OBJECTS objects at a time. Freed objects go back on its
+ * free list, and its chunks are released when the connection is finalised.
+ * In idle mode, the chunks with none of their objects in use are also
+ * released when the connection goes idle. Once a connection has reached
+ * its working set the refill count stops rising, which is what the alloc
+ * counters in GstQuicLibConnStats are for.
+ *
+ * Packet statistics are freed under the stats mutex rather than the context
+ * lock, and buffer mappings are made by the sending thread, so each slab has
+ * a mutex of its own.
+ */
+#define QUICLIB_SLAB_CHUNK_OBJECTS 64
 
-  return FALSE; /* Don't keep this source around after firing */
-}
+typedef struct {
+  GMutex mutex;
+  gsize object_size;
+  gpointer free_list;
+  GSList *chunks;
 
-static GSourceFuncs _quiclib_transport_callback_source_funcs = {
-    .prepare = _quiclib_transport_callback_source_prepare,
-    .check = NULL,
-    .dispatch = _quiclib_transport_callback_source_dispatch,
-    .finalize = NULL
-};
+  guint64 allocs;
+  guint64 refills;
+  guint64 in_use;
+} QuicLibSlab;
 
-void
-_quiclib_transport_run_handshake_complete_callback (
-    GstQuicLibTransportConnection *conn, GSocketAddress *sa)
+/**
+ * quiclib_slab_init
+ *
+ * Sets up @slab to hand out objects of @size bytes.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_slab_init (QuicLibSlab *slab, gsize size)
 {
-  GstQuicLibTransportHandshakeCompleteCallbackSource *hc_source;
-  GstQuicLibTransportContextPrivate *priv =
-      gst_quiclib_transport_context_get_instance_private (
-          GST_QUICLIB_TRANSPORT_CONTEXT (conn));
-
-  hc_source = (GstQuicLibTransportHandshakeCompleteCallbackSource *)
-      g_source_new (&_quiclib_transport_callback_source_funcs,
-          sizeof (GstQuicLibTransportHandshakeCompleteCallbackSource));
-
-  hc_source->peer = (GSocketAddress *) g_object_ref (G_OBJECT (sa));
-  hc_source->source.type = CB_HANDSHAKE_COMPLETED;
-  hc_source->source.conn = conn;
-
-  g_source_attach ((GSource *) hc_source, priv->async_notif_loop_context);
+  memset (slab, 0, sizeof (*slab));
+  g_mutex_init (&slab->mutex);
+  slab->object_size = (MAX (size, sizeof (gpointer)) + 7) & ~((gsize) 7);
 }
 
-void
-_quiclib_transport_run_stream_id_callback (GstQuicLibTransportConnection *conn,
-    int type, guint64 stream_id)
+/**
+ * quiclib_slab_alloc
+ *
+ * Returns an uninitialised object from @slab, allocating another chunk of
+ * them if its free list is empty.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gpointer
+quiclib_slab_alloc (QuicLibSlab *slab)
 {
-  GstQuicLibTransportStreamIDCallbackSource *sid_source;
-  GstQuicLibTransportContextPrivate *priv =
-      gst_quiclib_transport_context_get_instance_private (
-          GST_QUICLIB_TRANSPORT_CONTEXT (conn));
+  gpointer obj;
 
-  sid_source = (GstQuicLibTransportStreamIDCallbackSource *)
-      g_source_new (&_quiclib_transport_callback_source_funcs,
-          sizeof (GstQuicLibTransportStreamIDCallbackSource));
+  g_mutex_lock (&slab->mutex);
 
-  sid_source->stream_id = stream_id;
-  sid_source->source.type = type;
-  sid_source->source.conn = conn;
+  if (slab->free_list == NULL) {
+    guint8 *chunk = g_malloc (slab->object_size * QUICLIB_SLAB_CHUNK_OBJECTS);
+    gsize i;
 
-  g_source_attach ((GSource *) sid_source, priv->async_notif_loop_context);
-}
+    for (i = 0; i < QUICLIB_SLAB_CHUNK_OBJECTS; i++) {
+      gpointer o = chunk + (i * slab->object_size);
 
-#define _quiclib_transport_run_stream_open_callback(conn, stream_id) \
-  _quiclib_transport_run_stream_id_callback (conn, CB_STREAM_OPEN, stream_id)
+      *(gpointer *) o = slab->free_list;
+      slab->free_list = o;
+    }
 
-#define _quiclib_transport_run_stream_close_callback(conn, stream_id) \
-  _quiclib_transport_run_stream_id_callback (conn, CB_STREAM_CLOSE, stream_id)
+    slab->chunks = g_slist_prepend (slab->chunks, chunk);
+    slab->refills++;
+  }
 
-#define _quiclib_transport_run_stream_reset_callback(conn, stream_id) \
-  _quiclib_transport_run_stream_id_callback (conn, CB_STREAM_RESET, stream_id)
+  obj = slab->free_list;
+  slab->free_list = *(gpointer *) obj;
+  slab->allocs++;
+  slab->in_use++;
 
-void
-_quiclib_transport_run_ack_callback (GstQuicLibTransportConnection *conn,
-    guint64 stream_id, guint64 offset)
-{
-  GstQuicLibTransportAckCallbackSource *ack_source;
-  GstQuicLibTransportContextPrivate *priv =
-      gst_quiclib_transport_context_get_instance_private (
-          GST_QUICLIB_TRANSPORT_CONTEXT (conn));
+  g_mutex_unlock (&slab->mutex);
 
-  ack_source = (GstQuicLibTransportAckCallbackSource *)
-      g_source_new (&_quiclib_transport_callback_source_funcs,
-          sizeof (GstQuicLibTransportAckCallbackSource));
+  return obj;
+}
 
-  ack_source->stream_id = stream_id;
-  ack_source->offset = offset;
-  ack_source->source.type =
-      (stream_id > QUICLIB_VARINT_MAX)?(CB_DATAGRAM_ACK):(CB_STREAM_ACK);
-  ack_source->source.conn = conn;
+/**
+ * quiclib_slab_free
+ *
+ * Returns @obj to the free list of @slab. @obj may be NULL.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_slab_free (QuicLibSlab *slab, gpointer obj)
+{
+  if (obj == NULL) return;
 
-  g_source_attach ((GSource *) ack_source, priv->async_notif_loop_context);
+  g_mutex_lock (&slab->mutex);
+  *(gpointer *) obj = slab->free_list;
+  slab->free_list = obj;
+  slab->in_use--;
+  g_mutex_unlock (&slab->mutex);
 }
 
-int
-quiclib_ngtcp2_handshake_completed (ngtcp2_conn *quic_conn, void *user_data)
+/**
+ * quiclib_slab_chunk_index
+ *
+ * Returns the index in @chunks of the chunk that @obj was allocated from.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static guint
+quiclib_slab_chunk_index (guint8 **chunks, guint n_chunks, gsize chunk_size,
+    gpointer obj)
 {
-  GstQuicLibTransportConnection *conn =
-      (GstQuicLibTransportConnection *) user_data;
-  GstQuicLibTransportUserInterface *iface =
-      QUICLIB_TRANSPORT_USER_GET_IFACE (
-          gst_quiclib_transport_context_get_user (conn));
-  const ngtcp2_transport_params *remote_params;
+  guint i;
 
-  gst_quiclib_transport_context_set_state (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-      QUIC_STATE_HANDSHAKE);
+  for (i = 0; i < n_chunks; i++) {
+    if ((guint8 *) obj >= chunks[i] &&
+        (guint8 *) obj < chunks[i] + chunk_size) {
+      break;
+    }
+  }
 
-  remote_params = ngtcp2_conn_get_remote_transport_params (conn->quic_conn);
+  g_assert (i < n_chunks);
 
-  /*
-   * TODO: How to deal with early streams? Presumably these aren't accounted
-   * for in the remote params. This isn't a massive problem as the current
-   * implementation here only opens streams when the handshake is completed, but
-   * in the future that might change, or we might interop with someone else who
-   * does do early streams.
-   */
-  conn->bidi_remote_streams_remaining = remote_params->initial_max_streams_bidi;
-  conn->uni_remote_streams_remaining = remote_params->initial_max_streams_uni;
+  return i;
+}
 
-  if (conn->alpn == NULL) {
-    const unsigned char *negotiated_alpn;
-    unsigned int negotiated_alpn_len;
+/**
+ * quiclib_slab_trim
+ *
+ * Frees the chunks of @slab that have none of their objects in use, and
+ * returns the bytes freed. It looks up the chunk of every free object, so is
+ * only for occasional use such as when a connection goes idle.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gsize
+quiclib_slab_trim (QuicLibSlab *slab)
+{
+  gsize chunk_size = slab->object_size * QUICLIB_SLAB_CHUNK_OBJECTS;
+  gsize freed = 0;
+  guint8 **chunks;
+  guint *n_free;
+  guint n_chunks, i;
+  gpointer *link;
+  GSList *it;
+
+  g_mutex_lock (&slab->mutex);
+
+  n_chunks = g_slist_length (slab->chunks);
+  if (n_chunks == 0) {
+    g_mutex_unlock (&slab->mutex);
+    return 0;
+  }
 
-    SSL_get0_alpn_selected (conn->ssl, &negotiated_alpn, &negotiated_alpn_len);
+  chunks = g_new (guint8 *, n_chunks);
+  n_free = g_new0 (guint, n_chunks);
+  for (it = slab->chunks, i = 0; it != NULL; it = it->next, i++) {
+    chunks[i] = (guint8 *) it->data;
+  }
 
-    if (negotiated_alpn == NULL || negotiated_alpn_len == 0) {
-      GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-          "Couldn't get negotiated ALPN from OpenSSL!");
+  for (link = &slab->free_list; *link != NULL; link = (gpointer *) *link) {
+    n_free[quiclib_slab_chunk_index (chunks, n_chunks, chunk_size, *link)]++;
+  }
+
+  /* Unlink the objects of the chunks that are wholly free, then free those */
+  link = &slab->free_list;
+  while (*link != NULL) {
+    if (n_free[quiclib_slab_chunk_index (chunks, n_chunks, chunk_size,
+        *link)] == QUICLIB_SLAB_CHUNK_OBJECTS) {
+      *link = *(gpointer *) *link;
     } else {
-      conn->alpn = g_strndup ((gchar *) negotiated_alpn, negotiated_alpn_len);
+      link = (gpointer *) *link;
     }
   }
 
-  gst_quiclib_transport_context_set_state (
-        GST_QUICLIB_TRANSPORT_CONTEXT (conn), QUIC_STATE_OPEN);
-
-  if (iface->handshake_complete != NULL) {
-    GInetSocketAddress *sa = (GInetSocketAddress *)
-	          g_socket_address_new_from_native (conn->path.path.remote.addr,
-	              conn->path.path.remote.addrlen);
-    gboolean rv = iface->handshake_complete (
-        gst_quiclib_transport_context_get_user (conn),
-        &conn->parent, conn, sa, conn->alpn);
-    g_object_unref (sa);
-    if (rv == FALSE) {
-      GST_WARNING_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-          "Transport user indicated handshake was unacceptable");
-      return -1;
+  for (i = 0; i < n_chunks; i++) {
+    if (n_free[i] == QUICLIB_SLAB_CHUNK_OBJECTS) {
+      slab->chunks = g_slist_remove (slab->chunks, chunks[i]);
+      g_free (chunks[i]);
+      freed += chunk_size;
     }
   }
 
-  return 0;
+  g_mutex_unlock (&slab->mutex);
+
+  g_free (n_free);
+  g_free (chunks);
+
+  return freed;
 }
 
-int
-quiclib_ngtcp2_recv_stream_data (ngtcp2_conn *quic_conn, uint32_t flags,
-    int64_t stream_id, uint64_t offset,
-    const uint8_t *data, size_t datalen,
-    void *user_data, void *stream_user_data)
+/**
+ * quiclib_slab_count
+ *
+ * Adds the counters of @slab to the alloc statistics in @stats.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_slab_count (QuicLibSlab *slab, GstQuicLibConnStats *stats)
 {
-  GstQuicLibTransportConnection *conn =
-      (GstQuicLibTransportConnection *) user_data;
-  GstQuicLibTransportUserInterface *iface =
-      QUICLIB_TRANSPORT_USER_GET_IFACE (
-          gst_quiclib_transport_context_get_user (conn));
-  gboolean fin = (flags & NGTCP2_STREAM_DATA_FLAG_FIN)?(TRUE):(FALSE);
-  GstBuffer *buffer;
+  g_mutex_lock (&slab->mutex);
+  stats->alloc.objects += slab->allocs;
+  stats->alloc.refills += slab->refills;
+  stats->alloc.in_use += slab->in_use;
+  g_mutex_unlock (&slab->mutex);
+}
 
-  GST_INFO_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-      "Received %s%lu bytes on stream %ld", (fin)?("final "):(""), datalen,
-      stream_id);
+/**
+ * quiclib_slab_clear
+ *
+ * Frees every chunk of @slab, including any objects still handed out from it.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_slab_clear (QuicLibSlab *slab)
+{
+  g_slist_free_full (slab->chunks, g_free);
+  slab->chunks = NULL;
+  slab->free_list = NULL;
+  slab->in_use = 0;
+  g_mutex_clear (&slab->mutex);
+}
 
-  if (fin && datalen == 0) {
-    /* Empty buffer that will just carry the meta so as to close the stream */
-    buffer = gst_buffer_new ();
-  } else {
-    buffer = gst_buffer_new_memdup (data, datalen);
-  }
+/*
+ * Memory accounting.
+ *
+ * Each connection counts the bytes it pins in each of these categories:
+ *
+ * - retained: stream data sent and kept in ack_bufs until it is ACKed.
+ * - datagrams: datagrams kept in datagrams_awaiting_ack.
+ * - shaped: stream data held back on the shaping queues.
+ * - received: received data handed to the user that the user, or anything
+ *   downstream of it such as quicsrc's queue, still holds. Received data is
+ *   copied into blocks carrying a QuicLibRxTrailer after the data, which
+ *   uncharges the connection when the last buffer using the block goes.
+ * - ngtcp2's own allocations, from the connection's memory pool.
+ *
+ * The counters are updated from both the loop thread and the threads sending
+ * on the connection, so they are atomic. Received blocks can outlive the
+ * connection, so the counters live in a reference counted QuicLibMemAccount
+ * rather than in the connection itself.
+ *
+ * Once a connection's total reaches the conn-memory-limit property, or the
+ * total across a server's connections reaches the server-memory-limit
+ * property, sending stream data on it blocks (or fails with
+ * GST_QUICLIB_ERR_CONN_DATA_BLOCKED where it may not block) until ACKs bring
+ * it back under, and datagrams to and from it are dropped. OpenSSL doesn't
+ * account its allocations per connection, so TLS state isn't counted.
+ */
+typedef struct {
+  gint ref_count;
 
-  if (buffer == NULL) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Couldn't duplicate memory into a GstBuffer");
-    return NGTCP2_ERR_CALLBACK_FAILURE;
-  }
+  gssize retained;
+  gssize datagrams;
+  gssize shaped;
+  gssize received;
 
-  buffer->pts = GST_CLOCK_TIME_NONE;
-  buffer->dts = GST_CLOCK_TIME_NONE;
-  buffer->duration = GST_CLOCK_TIME_NONE;
-  buffer->offset = offset;
-  buffer->offset_end = offset + datalen;
+  /* Sends held back by a limit, and datagrams dropped because of one */
+  gssize limited;
+  gssize shed;
+} QuicLibMemAccount;
 
-  gst_buffer_add_quiclib_stream_meta (buffer, stream_id, offset, datalen, fin);
+typedef struct {
+  QuicLibMemAccount *account;
+  gsize size;
+} QuicLibRxTrailer;
 
-  iface->stream_data (gst_quiclib_transport_context_get_user (conn),
-      GST_QUICLIB_TRANSPORT_CONTEXT (conn), buffer);
+#define QUICLIB_RX_TRAILER_OFFSET(size) (((size) + 7) & ~((gsize) 7))
 
-  return 0;
+static inline void
+quiclib_mem_charge (gssize *counter, gssize bytes)
+{
+  g_atomic_pointer_add (counter, bytes);
 }
 
-int
-quiclib_ngtcp2_recv_datagram (ngtcp2_conn *quic_conn, uint32_t flags,
-    const uint8_t *data, size_t datalen,
-    void *user_data)
+static inline guint64
+quiclib_mem_read (gssize *counter)
 {
-  GstQuicLibTransportConnection *conn =
-      (GstQuicLibTransportConnection *) user_data;
-  GstQuicLibTransportUserInterface *iface =
-      QUICLIB_TRANSPORT_USER_GET_IFACE (
-          gst_quiclib_transport_context_get_user (conn));
+  gssize bytes = (gssize) g_atomic_pointer_get (counter);
 
-  GstBuffer *buffer;
+  return (bytes > 0) ? (guint64) bytes : 0;
+}
 
-  GST_INFO_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-      "Received QUIC datagram of size %lu bytes", datalen);
+static QuicLibMemAccount *
+quiclib_mem_account_ref (QuicLibMemAccount *account)
+{
+  g_atomic_int_inc (&account->ref_count);
+  return account;
+}
 
-  buffer = gst_buffer_new_memdup (data, datalen);
-  if (buffer == NULL) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Couldn't duplicate memory into a GstBuffer");
-    return NGTCP2_ERR_CALLBACK_FAILURE;
+static void
+quiclib_mem_account_unref (QuicLibMemAccount *account)
+{
+  if (g_atomic_int_dec_and_test (&account->ref_count)) {
+    g_free (account);
   }
+}
 
-  gst_buffer_add_quiclib_datagram_meta (buffer, datalen);
+/**
+ * quiclib_rx_block_release
+ *
+ * GDestroyNotify for the memory of a buffer made by quiclib_rx_buffer_new.
+ * Uncharges the received bytes from the account they were charged to.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_rx_block_release (gpointer data)
+{
+  QuicLibRxTrailer *trailer = (QuicLibRxTrailer *) data;
+  guint8 *block =
+      (guint8 *) trailer - QUICLIB_RX_TRAILER_OFFSET (trailer->size);
 
-  iface->datagram_data (gst_quiclib_transport_context_get_user (conn),
-      GST_QUICLIB_TRANSPORT_CONTEXT (conn), buffer);
-  return 0;
+  quiclib_mem_charge (&trailer->account->received, -(gssize) trailer->size);
+  quiclib_mem_account_unref (trailer->account);
+  g_free (block);
 }
 
-int
-quiclib_ngtcp2_ack_stream (ngtcp2_conn *quic_conn, int64_t stream_id,
-    uint64_t offset, uint64_t datalen,
-    void *user_data, void *stream_user_data)
+/**
+ * quiclib_rx_buffer_new
+ *
+ * Returns a new buffer holding a copy of the @datalen bytes at @data, which
+ * are charged to @account as received until the buffer's memory is freed.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static GstBuffer *
+quiclib_rx_buffer_new (QuicLibMemAccount *account, const guint8 *data,
+    gsize datalen)
 {
-  GstQuicLibTransportConnection *conn =
-      (GstQuicLibTransportConnection *) user_data;
-  GstQuicLibStreamContext *stream =
-      (GstQuicLibStreamContext *) stream_user_data;
-  GstQuicLibTransportUserInterface *iface =
-      QUICLIB_TRANSPORT_USER_GET_IFACE (
-          gst_quiclib_transport_context_get_user (conn));
-  GList *bufs;
+  guint8 *block;
+  QuicLibRxTrailer *trailer;
 
-  GST_LOG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Received ACK for stream %ld, for %lu bytes at offset %lu", stream_id,
-        datalen, offset);
+  if (datalen == 0) {
+    return gst_buffer_new ();
+  }
 
-  g_mutex_lock (&stream->mutex);
+  block = g_malloc (QUICLIB_RX_TRAILER_OFFSET (datalen) +
+      sizeof (QuicLibRxTrailer));
+  memcpy (block, data, datalen);
 
-  bufs = g_list_first (stream->ack_bufs);
-  while (bufs != NULL) {
-    GstBuffer *sent_buf = (GstBuffer *) bufs->data;
+  trailer = (QuicLibRxTrailer *) (block + QUICLIB_RX_TRAILER_OFFSET (datalen));
+  trailer->account = quiclib_mem_account_ref (account);
+  trailer->size = datalen;
+  quiclib_mem_charge (&account->received, (gssize) datalen);
 
-    if ((offset + datalen) >=
-        (sent_buf->offset + gst_buffer_get_size (sent_buf))) {
-      GST_LOG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-          "Dropping acknowledged buffer for stream %ld, length %lu at offset "
-          "%lu", stream_id, gst_buffer_get_size (sent_buf), sent_buf->offset);
+  /* The trailer is outside maxsize, so the buffer can't be grown over it */
+  return gst_buffer_new_wrapped_full (0, block, datalen, 0, datalen, trailer,
+      quiclib_rx_block_release);
+}
 
-      if (iface->stream_ackd) {
-        iface->stream_ackd (gst_quiclib_transport_context_get_user (conn),
-            GST_QUICLIB_TRANSPORT_CONTEXT (conn), (guint64) stream_id,
-            (gsize) offset, sent_buf);
-      }
+struct _GstQuicLibTransportConnection {
+  GstQuicLibTransportContext parent;
 
-      gst_buffer_unref (sent_buf);
-      bufs = stream->ack_bufs = g_list_delete_link (stream->ack_bufs, bufs);
-    } else {
-      bufs = bufs->next;
-    }
-  }
+  GstQuicLibServerContext *server;
 
-  if (stream->state == QUIC_STREAM_CLOSED_BOTH && stream->ack_bufs == NULL) {
-    g_mutex_unlock (&stream->mutex);
-    quiclib_stream_context_destroy ((gpointer) stream);
-  } else {
-    g_mutex_unlock (&stream->mutex);
-  }
+  QuicLibSocketContext *socket;
 
-  return 0;
-}
+  /* The allocator handed to ngtcp2, and the pool behind it */
+  ngtcp2_mem mem;
+  QuicLibMemPool mem_pool;
 
-int
-quiclib_ngtcp2_ack_datagram (ngtcp2_conn *quic_conn, uint64_t dgram_id,
-    void *user_data)
-{
-  GstQuicLibTransportConnection *conn =
-      (GstQuicLibTransportConnection *) user_data;
-  GstQuicLibTransportUserInterface *iface =
-      QUICLIB_TRANSPORT_USER_GET_IFACE (
-          gst_quiclib_transport_context_get_user (conn));
+  /*
+   * Slabs of ngtcp2_cids, GstQuicLibPacketStats, gint64 stream IDs,
+   * QuicLibDatagramAcks and QuicLibUnmaps. Cleared last of all in finalise.
+   */
+  QuicLibSlab cid_slab;
+  QuicLibSlab stat_slab;
+  QuicLibSlab id_slab;
+  QuicLibSlab dgram_slab;
+  QuicLibSlab unmap_slab;
+
+  /* See "Memory accounting" */
+  QuicLibMemAccount *memory;
+  guint watch_source;
 
-  GST_LOG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-      "Received ACK for datagram %lu", dgram_id);
+  /*
+   * In idle mode, whether the connection had nothing in flight when the
+   * last packet was processed. Protected by the context lock.
+   */
+  gboolean idle;
 
-  if (iface->datagram_ackd) {
-    GstBuffer *buf;
-    if (!g_hash_table_lookup_extended (conn->datagrams_awaiting_ack, &dgram_id,
-        NULL, (gpointer *) &buf)) {
-      GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-          "Couldn't find matching buffer for datagram ticket %lu?", dgram_id);
-      return 0;
-    }
-    iface->datagram_ackd (gst_quiclib_transport_context_get_user (conn),
-        GST_QUICLIB_TRANSPORT_CONTEXT (conn), buf);
-  }
+  /*
+   * Local address to bind a client connection's socket to, so that it leaves
+   * through a particular interface. NULL lets the kernel choose.
+   */
+  GSocketAddress *bind_addr;
 
-  g_hash_table_remove (conn->datagrams_awaiting_ack, (gconstpointer) &dgram_id);
+  /*
+   * While a client-initiated migration is being validated, the socket bound
+   * to the new local address and the path it probes. NULL otherwise.
+   */
+  QuicLibSocketContext *migration_socket;
+  ngtcp2_path_storage migration_path;
+  ngtcp2_path_validation_result migration_result;
 
-  return 0;
-}
+  gsize send_queue_lim;
+  GstQuicLibTransportSendQueueSource *send_queue_source;
 
-/**
- * Allocates the local stream context, and will extend the maximum number of
- * streams the remote endpoint can open if required.
- */
-gboolean
-quiclib_alloc_stream_context (GstQuicLibTransportConnection *conn,
-    gint64 stream_id)
-{
-  gboolean rv;
-  GstQuicLibStreamContext *stream = g_new0 (GstQuicLibStreamContext, 1);
+  gchar *alpn;
 
-  g_mutex_init (&stream->mutex);
+  /*
+   * Session ID shared by a set of striped connections, carried in the client
+   * hello. 0 if the connection isn't part of a stripe.
+   *
+   * stripe_redundant is TRUE once both ends have agreed that every datagram
+   * on the connection carries a redundant datagram header. A client asks for
+   * it with stripe_redundant_requested.
+   */
+  guint64 stripe_id;
+  gboolean stripe_redundant_requested;
+  gboolean stripe_redundant;
 
-  stream->state = QUIC_STREAM_OPEN;
-  if ((conn->server && QUICLIB_STREAM_IS_UNI_CLIENT (stream_id)) ||
-      QUICLIB_STREAM_IS_UNI_SERVER (stream_id)) {
-    stream->state |= QUIC_STREAM_CLOSED_SENDING;
-  } else if (QUICLIB_STREAM_IS_UNI (stream_id)) {
-    stream->state |= QUIC_STREAM_CLOSED_READING;
-  }
+  ngtcp2_conn *quic_conn;
+  ngtcp2_path_storage path;
+  ngtcp2_crypto_conn_ref conn_ref;
+  ngtcp2_settings conn_settings;
+  ngtcp2_transport_params transport_params;
+  ngtcp2_ccerr last_error;
 
-  stream->last_offset = 0;
+  guint64 datagram_ticket;
+
+  SSL_CTX *ssl_ctx;
+  SSL *ssl;
+
+  GList *cids;
 
   /*
-   * If this is a remote stream opening, check whether we need to permit more
-   * streams from the peer.
+   * For a server's connection, the DCID of the client's first Initial packet.
+   * The client's retransmitted Initials and its 0-RTT packets carry it until
+   * the client learns the server's CID, so it is kept in cids until the
+   * handshake completes.
    */
-  if ((conn->server && QUICLIB_STREAM_IS_CLIENT_INIT (stream_id)) ||
-      (QUICLIB_STREAM_IS_SERVER_INIT (stream_id))) {
-    gst_quiclib_transport_context_lock (conn);
+  ngtcp2_cid *initial_dcid;
 
-    GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn), "Streams remaining "
-        "bidi: %lu, uni: %lu. Max streams bidi: %lu, uni: %lu",
-        conn->bidi_remote_streams_remaining, conn->uni_remote_streams_remaining,
-        conn->transport_params.initial_max_streams_bidi,
-        conn->transport_params.initial_max_streams_uni);
+  /** GHashTable<gint64 (stream id), GstQuicLibStreamContext> */
+  GHashTable *streams;
 
-    if (QUICLIB_STREAM_IS_BIDI (stream_id)) {
-      if (--conn->bidi_remote_streams_remaining <
-          conn->transport_params.initial_max_streams_bidi / 2) {
-        ngtcp2_conn_extend_max_streams_bidi (conn->quic_conn,
-            conn->transport_params.initial_max_streams_bidi);
-        conn->bidi_remote_streams_remaining =
-            conn->transport_params.initial_max_streams_bidi;
-      }
-    } else {
-      if (--conn->uni_remote_streams_remaining <
-          conn->transport_params.initial_max_streams_uni / 2) {
-        ngtcp2_conn_extend_max_streams_uni (conn->quic_conn,
-            conn->transport_params.initial_max_streams_uni);
-        conn->uni_remote_streams_remaining =
-            conn->transport_params.initial_max_streams_uni;
-      }
-    }
-  }
+  /** GHashTable <gint64 (datagram ticket), GstBuffer> */
+  GHashTable *datagrams_awaiting_ack;
 
-  if (ngtcp2_conn_set_stream_user_data (conn->quic_conn, stream_id, stream)
-      != 0) {
-    g_free (stream);
-    rv = FALSE;
-  } else {
-    rv = g_hash_table_insert (conn->streams,
-        quiclib_int64_hash_key (stream_id), stream);
-  }
+  /** GList <gint64 (stream id)> */
+  GList *streams_to_close;
 
-  gst_quiclib_transport_context_unlock (conn);
+  /*
+   * ngtcp2 doesn't give us this information directly, only local streams
+   * remaining
+   */
+  guint64 bidi_remote_streams_remaining;
+  guint64 uni_remote_streams_remaining;
+  guint64 last_client_bidi_stream_id;
+  guint64 last_server_bidi_stream_id;
+  guint64 last_client_uni_stream_id;
+  guint64 last_server_uni_stream_id;
 
-  return rv;
-}
+  /* The latest timestamp given to ngtcp2, which must never go backwards */
+  ngtcp2_tstamp last_ts;
+
+  /*
+   * Relay rules forwarding what's received on this connection to others, as
+   * QuicLibRelayRule, and the connections with rules forwarding to this one,
+   * each reffed. Both are protected by the context lock. relay_flush_pending
+   * is set while a flush of this connection's relay queues is scheduled.
+   */
+  GList *relays;
+  GList *relay_upstreams;
+  gint relay_flush_pending;
+
+  /*
+   * Bandwidth estimation, protected by the context lock. The bytes newly
+   * acknowledged since the current delivery rate sample started at
+   * sample_start, the smoothed delivery rate in bits/second, and the
+   * queueing delay seen when the last estimate was made.
+   */
+  struct {
+    guint64 acked;
+    ngtcp2_tstamp sample_start;
+    guint64 delivery_rate;
+    guint64 queue_delay;
+  } bwe;
+
+  /*
+   * Token bucket shaping, protected by the context lock. The connection-wide
+   * bucket, the streams with buffers held back on their shaping queues, and
+   * whether a release of those queues is scheduled on the loop thread.
+   */
+  QuicLibTokenBucket shaper;
+  /** GList <gint64 (stream id)> */
+  GList *shaped_streams;
+  gboolean shaper_scheduled;
+
+  /*
+   * For a server's connections, their share of its egress-rate-limit and
+   * their virtual finish time in its weighted fair queue, protected by the
+   * server's egress_mutex, and whether they're on its egress backlog.
+   */
+  guint egress_weight;
+  guint64 egress_vtime;
+  gboolean egress_backlogged;
+
+  /*
+   * Path capacity probing, protected by the context lock. The ngtcp2
+   * timestamp the probe ends at, or 0 when not probing, the bytes acked since
+   * the current delivery rate sample started, the highest sample, and the
+   * result once done. buf is the payload of the probe DATAGRAM frames, which
+   * is what awaits their ACKs in datagrams_awaiting_ack.
+   */
+  struct {
+    ngtcp2_tstamp end;
+    ngtcp2_tstamp sample_start;
+    guint64 acked;
+    guint64 max_rate;
+    guint64 sent;
+    guint64 result;
+    gboolean done;
+    GstBuffer *buf;
+  } probe;
+
+  GMutex mutex;
+  GCond cond;
+
+  GstQuicLibConnStatsTrackers stats;
+};
+
+static gboolean quiclib_relay_stream_data (GstQuicLibTransportConnection *conn,
+    GstBuffer *buf, gint64 stream_id, guint64 offset, gboolean fin);
+static gboolean quiclib_relay_datagram (GstQuicLibTransportConnection *conn,
+    GstBuffer *buf);
+static void quiclib_relay_stream_reset (GstQuicLibTransportConnection *conn,
+    gint64 stream_id, guint64 app_error_code);
+static void quiclib_relay_schedule_flushes (
+    GstQuicLibTransportConnection *downstream);
+static void quiclib_relay_remove_rules (GstQuicLibTransportConnection *upstream,
+    GstQuicLibTransportConnection *downstream);
+static void quiclib_probe_start (GstQuicLibTransportConnection *conn);
+static gboolean quiclib_probe_is_probe (GstQuicLibTransportConnection *conn,
+    const uint8_t *data, size_t datalen);
+static GstQuicLibError quiclib_transport_write_stream_vec (
+    GstQuicLibTransportConnection *conn, GstBuffer *buf, gint64 stream_id,
+    const ngtcp2_vec *buf_vec, size_t n, gboolean may_block,
+    ssize_t *bytes_written);
 
 /**
- * Implements the ngtcp2_stream_open callback. Called when a remote stream is
- * opened by the peer.
+ * quiclib_conn_timestamp
  *
- * Sends a stream opened event to the instance owner via callback. If the
- * callback returns FALSE, then the owner rejects the stream and it is not
- * opened.
+ * Returns @ts, or the latest timestamp already given to ngtcp2 for @conn if
+ * that is later. ngtcp2 requires the timestamps passed to it to be
+ * non-decreasing, which a kernel receive timestamp from before the last write
+ * or timer expiry wouldn't be. Call with the context lock held.
+ *
+ * This means a kernel receive timestamp only reaches ngtcp2's RTT samples
+ * when the packet arrived after the last write or timer expiry. Otherwise its
+ * arrival time is moved up to that point. The rx_queueing histogram is
+ * filled from the raw kernel timestamp, so it isn't affected.
+ *
+ * INTERNAL FUNCTION ONLY.
  */
-int
-quiclib_ngtcp2_on_stream_open (ngtcp2_conn *quic_conn, int64_t stream_id,
-    void *user_data)
+static ngtcp2_tstamp
+quiclib_conn_timestamp (GstQuicLibTransportConnection *conn, ngtcp2_tstamp ts)
 {
-  GstQuicLibTransportConnection *conn =
-      (GstQuicLibTransportConnection *) user_data;
-#ifndef ASYNC_CALLBACKS
-  GstQuicLibTransportUserInterface *iface =
-      QUICLIB_TRANSPORT_USER_GET_IFACE (
-          gst_quiclib_transport_context_get_user (conn));
-#endif
-  gboolean rv = TRUE;
-
-  switch (stream_id & 0x3) {
-    case 0x0: conn->last_client_bidi_stream_id = (guint64) stream_id; break;
-    case 0x1: conn->last_server_bidi_stream_id = (guint64) stream_id; break;
-    case 0x2: conn->last_client_uni_stream_id = (guint64) stream_id; break;
-    case 0x3: conn->last_server_uni_stream_id = (guint64) stream_id; break;
+  if (ts < conn->last_ts) {
+    return conn->last_ts;
   }
 
-#ifdef ASYNC_CALLBACKS
-  _quiclib_transport_run_stream_open_callback (conn, stream_id);
-#else
-  if (iface->stream_opened != NULL) {
-    rv = iface->stream_opened (gst_quiclib_transport_context_get_user (conn),
-        GST_QUICLIB_TRANSPORT_CONTEXT (conn), stream_id);
-  }
-#endif
+  conn->last_ts = ts;
 
-  if (rv == TRUE) {
-    rv = quiclib_alloc_stream_context (conn, stream_id);
-  } else {
-    GST_WARNING_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "User did not agree to open stream %ld", stream_id);
-  }
-
-  return (rv == TRUE)?(0):(NGTCP2_ERR_CALLBACK_FAILURE);
+  return ts;
 }
 
 /**
- * Implements the ngtcp2_stream_close callback.
+ * quiclib_path_storage_from_addresses
+ *
+ * Fills @ps with the ngtcp2 path between @local and @remote.
+ *
+ * Returns FALSE if either address can't be converted to a native sockaddr.
+ *
+ * INTERNAL FUNCTION ONLY.
  */
-int
-quiclib_ngtcp2_on_stream_close (ngtcp2_conn *quic_conn, uint32_t flags,
-    int64_t stream_id, uint64_t app_error_code,
-    void *user_data, void *stream_user_data)
+static gboolean
+quiclib_path_storage_from_addresses (ngtcp2_path_storage *ps,
+    GSocketAddress *local, GSocketAddress *remote, void *user_data)
 {
-  GstQuicLibTransportConnection *conn =
-      (GstQuicLibTransportConnection *) user_data;
-  GstQuicLibStreamContext *stream =
-      (GstQuicLibStreamContext *) stream_user_data;
-#ifndef ASYNC_CALLBACKS
-  GstQuicLibTransportUserInterface *iface =
-      QUICLIB_TRANSPORT_USER_GET_IFACE (
-          gst_quiclib_transport_context_get_user (conn));
-#endif
+  ngtcp2_sockaddr_union local_sa, remote_sa;
+  gssize local_len, remote_len;
 
-  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-      "Stream %ld is closed", stream_id);
+  local_len = g_socket_address_get_native_size (local);
+  remote_len = g_socket_address_get_native_size (remote);
 
-#ifdef ASYNC_CALLBACKS
-  _quiclib_transport_run_stream_close_callback (conn, stream_id);
-#else
-  if (iface->stream_closed != NULL) {
-    iface->stream_closed (gst_quiclib_transport_context_get_user (conn),
-        GST_QUICLIB_TRANSPORT_CONTEXT (conn), stream_id);
+  if (local_len < 0 || remote_len < 0 ||
+      !g_socket_address_to_native (local, &local_sa, sizeof (local_sa),
+          NULL) ||
+      !g_socket_address_to_native (remote, &remote_sa, sizeof (remote_sa),
+          NULL)) {
+    return FALSE;
   }
-#endif
 
-  g_mutex_lock (&stream->mutex);
-  stream->state = QUIC_STREAM_CLOSED_BOTH;
-  if (stream->ack_bufs == NULL) {
-    g_mutex_unlock (&stream->mutex);
-    g_hash_table_remove (conn->streams, &stream_id);
-  } else {
-    g_mutex_unlock (&stream->mutex);
-  }
+  ngtcp2_path_storage_init (ps, &local_sa.sa, (ngtcp2_socklen) local_len,
+      &remote_sa.sa, (ngtcp2_socklen) remote_len, user_data);
 
-  return 0;
+  return TRUE;
 }
 
-/*
- * Implements the ngtcp2_on_stream_reset callback.
+/**
+ * quiclib_conn_is_migration_local
+ *
+ * Returns TRUE if @local is the local address of the path that a
+ * client-initiated migration of @conn is validating.
+ *
+ * INTERNAL FUNCTION ONLY.
  */
-int
-quiclib_ngtcp2_on_stream_reset (ngtcp2_conn *quic_conn, int64_t stream_id,
-    uint64_t final_size, uint64_t app_error_code, void *user_data,
-    void *stream_user_data)
+static gboolean
+quiclib_conn_is_migration_local (GstQuicLibTransportConnection *conn,
+    const ngtcp2_addr *local)
 {
-  GstQuicLibTransportConnection *conn =
-      (GstQuicLibTransportConnection *) user_data;
-  GstQuicLibStreamContext *stream =
-      (GstQuicLibStreamContext *) stream_user_data;
-#ifndef ASYNC_CALLBACKS
-  GstQuicLibTransportUserInterface *iface =
-      QUICLIB_TRANSPORT_USER_GET_IFACE (
-          gst_quiclib_transport_context_get_user (conn));
-#endif
-
-  GST_INFO_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-      "Stream %ld was reset after %lu bytes with error code %lu", stream_id,
-      final_size, app_error_code);
-
-#ifdef ASYNC_CALLBACKS
-  _quiclib_transport_run_stream_reset_callback (conn, stream_id);
-#else
-  if (iface->stream_closed != NULL) {
-    iface->stream_closed (gst_quiclib_transport_context_get_user (conn),
-        GST_QUICLIB_TRANSPORT_CONTEXT (conn), stream_id);
-  }
-#endif
-
-  g_mutex_lock (&stream->mutex);
-  stream->state = QUIC_STREAM_CLOSED_BOTH;
-  g_mutex_unlock (&stream->mutex);
-
-  return 0;
+  return conn->migration_socket != NULL &&
+      local->addrlen == conn->migration_path.path.local.addrlen &&
+      memcmp (local->addr, conn->migration_path.path.local.addr,
+          local->addrlen) == 0;
 }
 
 /**
- * Implements the ngtcp2_rand callback. Simply a wrapper around the OpenSSL
- * RAND_bytes function. The ngtcp2_rand_ctx is ignored (it is never set anyway)
+ * quiclib_socket_serves_local
+ *
+ * Returns TRUE if packets from @local can be sent through @socket_ctx, as it
+ * is bound either to @local or to the wildcard address on the same port.
+ *
+ * INTERNAL FUNCTION ONLY.
  */
-void
-quiclib_ngtcp2_rand (uint8_t *dest, size_t destlen, const ngtcp2_rand_ctx *ctx)
+static gboolean
+quiclib_socket_serves_local (QuicLibSocketContext *socket_ctx,
+    const ngtcp2_addr *local)
 {
-  RAND_bytes (dest, destlen);
+  const ngtcp2_sockaddr_union *bound = &socket_ctx->local_addr;
+  const ngtcp2_sockaddr_union *addr =
+      (const ngtcp2_sockaddr_union *) local->addr;
+
+  if (socket_ctx->local_addrlen == 0 || local->addrlen == 0 ||
+      bound->sa.sa_family != addr->sa.sa_family) {
+    return FALSE;
+  }
+
+  switch (bound->sa.sa_family) {
+  case AF_INET:
+    return bound->in.sin_port == addr->in.sin_port &&
+        (bound->in.sin_addr.s_addr == htonl (INADDR_ANY) ||
+            bound->in.sin_addr.s_addr == addr->in.sin_addr.s_addr);
+  case AF_INET6:
+    return bound->in6.sin6_port == addr->in6.sin6_port &&
+        (IN6_IS_ADDR_UNSPECIFIED (&bound->in6.sin6_addr) ||
+            IN6_ARE_ADDR_EQUAL (&bound->in6.sin6_addr, &addr->in6.sin6_addr));
+  default:
+    return FALSE;
+  }
 }
 
 /**
- * Implements the ngtcp2_get_new_connection_id callback. Uses OpenSSL RAND_bytes
- * to generate new connection IDs and tokens on request.
+ * quiclib_server_socket_for_local
+ *
+ * Returns the listening socket of @server that packets from @local should be
+ * sent through, or NULL if it has none.
+ *
+ * INTERNAL FUNCTION ONLY.
  */
-int
-quiclib_ngtcp2_get_new_connection_id (ngtcp2_conn *quic_conn, ngtcp2_cid *cid,
-    uint8_t *token, size_t cidlen,
-    void *user_data)
+static QuicLibSocketContext *
+quiclib_server_socket_for_local (GstQuicLibServerContext *server,
+    const ngtcp2_addr *local)
 {
-  GstQuicLibTransportConnection *conn =
-      (GstQuicLibTransportConnection *) user_data;
-  ngtcp2_cid *lcid;
+  GSList *it;
 
-  if (RAND_bytes (cid->data, (int) cidlen) != 1) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Couldn't generate a new CID of length %lu with RAND_bytes: %s",
-        cidlen, ERR_error_string (ERR_get_error (), NULL));
-    return NGTCP2_ERR_CALLBACK_FAILURE;
+  for (it = server->sockets; it != NULL; it = it->next) {
+    if (quiclib_socket_serves_local ((QuicLibSocketContext *) it->data,
+        local)) {
+      return (QuicLibSocketContext *) it->data;
+    }
   }
 
-  cid->datalen = cidlen;
+  return NULL;
+}
 
-  if (gst_debug_category_get_threshold (quiclib_transport) >= GST_LEVEL_TRACE)
-  {
-    gchar cid_str[CID_STR_LEN], *sa_str;
-    GSocketAddress *sa = g_socket_address_new_from_native (
-        (struct sockaddr *) &conn->path.remote_addrbuf,
-        sizeof (ngtcp2_sockaddr_union));
+QuicLibSocketContext *
+quiclib_open_socket (GstQuicLibTransportContext *ctx, GSocketAddress *addr);
 
-    sa_str = g_socket_connectable_to_string (G_SOCKET_CONNECTABLE (sa));
+/**
+ * quiclib_conn_open_path_socket
+ *
+ * Opens a new socket for the client connection @conn, bound to @local, or to
+ * an address of the kernel's choosing if @local is NULL, and connected to
+ * @remote. @ps is filled with the path between the two.
+ *
+ * Returns NULL if the socket couldn't be opened.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static QuicLibSocketContext *
+quiclib_conn_open_path_socket (GstQuicLibTransportConnection *conn,
+    GSocketAddress *local, GSocketAddress *remote, ngtcp2_path_storage *ps)
+{
+  GstQuicLibTransportContext *ctx = GST_QUICLIB_TRANSPORT_CONTEXT (conn);
+  GSocketAddress *old_bind_addr, *new_local;
+  QuicLibSocketContext *socket_ctx;
+  GError *err = NULL;
+  gboolean ok;
 
-    GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Generated new CID for peer %s: %s", sa_str,
-        quiclib_cidtostr (cid, cid_str));
+  old_bind_addr = conn->bind_addr;
+  conn->bind_addr = local;
+  socket_ctx = quiclib_open_socket (ctx, remote);
+  conn->bind_addr = old_bind_addr;
 
-    g_free (sa_str);
+  if (socket_ctx == NULL) {
+    return NULL;
   }
 
-  if (token != NULL &&
-      RAND_bytes (token, NGTCP2_STATELESS_RESET_TOKENLEN) != 1) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn), "Couldn't generate a "
-        "new stateless reset token of length %d with RAND_bytes: %s",
-        NGTCP2_STATELESS_RESET_TOKENLEN,
-        ERR_error_string (ERR_get_error (), NULL));
-    return NGTCP2_ERR_CALLBACK_FAILURE;
+  new_local = g_socket_get_local_address (socket_ctx->socket, &err);
+  if (new_local == NULL) {
+    GST_ERROR_OBJECT (ctx, "Couldn't get local address of new path socket: "
+        "%s", err->message);
+    g_error_free (err);
+    quiclib_socket_context_destroy (socket_ctx);
+    return NULL;
   }
 
-  /* Make a copy as *cid seems to be allocated on the stack */
-  lcid = g_malloc (sizeof (ngtcp2_cid));
-  memcpy (lcid->data, cid->data, cid->datalen);
-  lcid->datalen = cid->datalen;
-  conn->cids = g_list_append (conn->cids, (gpointer) lcid);
-
-  return 0;
-}
-
-/**
- * Implements the ngtcp2_remove_connection_id callback. Retires old connection
- * IDs.
- */
-int
-quiclib_ngtcp2_remove_connection_id (ngtcp2_conn *quic_conn,
-    const ngtcp2_cid *cid, void *user_data)
-{
-  GstQuicLibTransportConnection *conn =
-      (GstQuicLibTransportConnection *) user_data;
-  GList *it;
+  ok = quiclib_path_storage_from_addresses (ps, new_local, remote,
+      (void *) conn);
+  g_object_unref (new_local);
 
-  for (it = conn->cids; it != NULL; it = it->next) {
-    if (((ngtcp2_cid *) it->data)->datalen == cid->datalen &&
-        memcmp (((ngtcp2_cid *) it->data)->data, cid->data, cid->datalen) == 0)
-    {
-      g_free (it->data);
-      conn->cids = g_list_delete_link (conn->cids, it);
-    }
+  if (!ok) {
+    GST_ERROR_OBJECT (ctx, "Couldn't make a path for the new socket");
+    quiclib_socket_context_destroy (socket_ctx);
+    return NULL;
   }
 
-  return 0;
+  return socket_ctx;
 }
 
-/*
- * Implements the ngtcp2_crypto_get_conn callback.
- */
-ngtcp2_conn *
-quiclib_get_ngtcp2_conn (ngtcp2_crypto_conn_ref *conn_ref)
+gboolean _quiclib_add_stream_to_close (GstQuicLibTransportConnection *conn,
+    guint64 stream_id)
 {
-  GstQuicLibTransportConnection *conn =
-      (GstQuicLibTransportConnection *) conn_ref->user_data;
-  return conn->quic_conn;
+  gint64 *_id = quiclib_slab_alloc (&conn->id_slab);
+  *_id = stream_id;
+  conn->streams_to_close = g_list_append (conn->streams_to_close, _id);
+  GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      "Added Stream ID %ld to close list", *_id);
+  return TRUE;
 }
 
-/*
- * ngtcp2 callbacks end
- */
+gint64 _quiclib_pop_stream_to_close (GstQuicLibTransportConnection *conn)
+{
+  gint64 stream_id = *((gint64 *) conn->streams_to_close->data);
+  quiclib_slab_free (&conn->id_slab, conn->streams_to_close->data);
+  conn->streams_to_close = g_list_delete_link (conn->streams_to_close,
+      conn->streams_to_close);
+  GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      "Popped stream %ld from close list", stream_id);
+  return stream_id;
+}
 
 /*
- * ngtcp2 utility functions
+ * A buffer held back on a stream's shaping queue, and the ngtcp2 timestamp of
+ * when it was queued.
  */
+typedef struct {
+  GstBuffer *buf;
+  ngtcp2_tstamp queued_at;
+} QuicLibShapedBuffer;
 
-/**
- * Get the current time in nanoseconds.
- */
-guint64
-quiclib_ngtcp2_timestamp (void)
+static void
+quiclib_shaped_buffer_free (gpointer data)
 {
-  struct timespec tp;
-  if (clock_gettime (CLOCK_MONOTONIC, &tp) != 0) {
-    return UINT64_MAX;
-  }
-  return (guint64) tp.tv_sec * NGTCP2_SECONDS + (guint64) tp.tv_nsec;
+  QuicLibShapedBuffer *sb = (QuicLibShapedBuffer *) data;
+
+  gst_buffer_unref (sb->buf);
+  g_free (sb);
 }
 
-ssize_t
-quiclib_ngtcp2_get_stream_window (GstQuicLibTransportConnection *conn,
-    int64_t stream_id)
-{
-  uint64_t cwnd, swnd;
+struct _GstQuicLibStreamContext {
+  /* The key of the stream in the connection's streams hash table */
+  gint64 stream_id;
 
-  gst_quiclib_transport_context_lock (conn);
+  GstQuicLibStreamState state;
 
-  cwnd = ngtcp2_conn_get_cwnd_left (conn->quic_conn);
-  if (stream_id >= 0) {
-    swnd = ngtcp2_conn_get_max_stream_data_left (conn->quic_conn,
-        stream_id);
+  gsize last_offset;
 
-    /*g_assert (swnd != 0);*/
+  /* DSCP for packets carrying this stream's frames, -1 for the default */
+  gint dscp;
 
-    if (cwnd > swnd) {
-      cwnd = swnd;
-    }
-  }
+  GList *ack_bufs;
 
-  gst_quiclib_transport_context_unlock (conn);
+  /*
+   * The stream's own token bucket, and the QuicLibShapedBuffers held back by
+   * it or by the connection's. shaped_close is set when the stream is to be
+   * closed once they have all been sent. Protected by the context lock.
+   */
+  QuicLibTokenBucket shaper;
+  GQueue shaped;
+  gsize shaped_bytes;
+  gboolean shaped_close;
 
-  return cwnd;
-}
+  /* The connection's account, which ack_bufs and shaped are charged to */
+  QuicLibMemAccount *memory;
 
-gboolean
-quiclib_timer_expired (gpointer user_data)
-{
-  GstQuicLibTransportConnection *conn =
-      (GstQuicLibTransportConnection *) user_data;
-  int rv;
+  GMutex mutex;
+};
 
-  gst_quiclib_transport_context_lock (conn);
+typedef struct _GstQuicLibStreamContext GstQuicLibStreamContext;
 
-  rv = ngtcp2_conn_handle_expiry (conn->quic_conn,
-      quiclib_ngtcp2_timestamp ());
+static void
+quiclib_stream_context_destroy (gpointer ctx)
+{
+  GstQuicLibStreamContext *stream = (GstQuicLibStreamContext *) ctx;
+  GList *it;
 
-  if (rv != 0) {
-    gst_quiclib_transport_disconnect (conn, FALSE,
-        QUICLIB_CLOSE_INTERNAL_ERROR);
+  for (it = stream->ack_bufs; it != NULL; it = it->next) {
+    quiclib_mem_charge (&stream->memory->retained,
+        -(gssize) gst_buffer_get_size (GST_BUFFER (it->data)));
   }
+  g_list_free_full (stream->ack_bufs, (GDestroyNotify) gst_buffer_unref);
 
-  gst_quiclib_transport_context_unlock (conn);
+  quiclib_mem_charge (&stream->memory->shaped, -(gssize) stream->shaped_bytes);
+  g_queue_clear_full (&stream->shaped, quiclib_shaped_buffer_free);
+  g_mutex_clear (&stream->mutex);
 
-  return G_SOURCE_REMOVE;
+  g_free (stream);
 }
 
-/*
- * End ngtcp2 utility functions
+/**
+ * quiclib_conn_memory
+ *
+ * Returns the bytes that @conn currently pins, as counted against the
+ * conn-memory-limit property. See "Memory accounting".
+ *
+ * INTERNAL FUNCTION ONLY.
  */
-
-void
-quiclib_store_datagram_ack_ref (GstQuicLibTransportConnection *conn,
-    guint64 datagram_id, GstBuffer *orig)
+static guint64
+quiclib_conn_memory (GstQuicLibTransportConnection *conn)
 {
-  gint64 *key;
-  GstQuicLibTransportUserInterface *iface =
-      QUICLIB_TRANSPORT_USER_GET_IFACE (
-          gst_quiclib_transport_context_get_user (conn));
-  if (iface->datagram_ackd == NULL) return;
-
-  key = g_malloc (sizeof (gint64));
-  *key = datagram_id;
-
-  if (!g_hash_table_insert (conn->datagrams_awaiting_ack, (gpointer) key, 
-      (gpointer) gst_buffer_ref (orig))) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Couldn't add datagram buffer to awaiting ack hashtable");
-  }
+  /*
+   * The pool is only changed under the context lock, but a stale read here
+   * just moves the point at which the limit is applied by a packet or so.
+   */
+  return quiclib_mem_read (&conn->memory->retained) +
+      quiclib_mem_read (&conn->memory->datagrams) +
+      quiclib_mem_read (&conn->memory->shaped) +
+      quiclib_mem_read (&conn->memory->received) +
+      conn->mem_pool.held + conn->mem_pool.cached;
 }
 
-gboolean
-quiclib_cancel_timer (GstQuicLibTransportContext *ctx)
+/**
+ * quiclib_conn_memory_limited
+ *
+ * Returns TRUE if @conn is over the conn-memory-limit property, or its server
+ * is over the server-memory-limit property.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_conn_memory_limited (GstQuicLibTransportConnection *conn)
 {
   GstQuicLibTransportContextPrivate *priv =
-      gst_quiclib_transport_context_get_instance_private (ctx);
+      gst_quiclib_transport_context_get_instance_private (
+          GST_QUICLIB_TRANSPORT_CONTEXT (conn));
 
-  if (priv->timeout) {
-    g_source_destroy (priv->timeout);
-    g_source_unref (priv->timeout);
-    priv->timeout = NULL;
+  if (conn->server != NULL &&
+      g_atomic_int_get (&conn->server->admission.memory_limited)) {
     return TRUE;
   }
-  return FALSE;
+
+  return priv->conn_memory_limit > 0 &&
+      quiclib_conn_memory (conn) >= priv->conn_memory_limit;
 }
 
-gboolean
-quiclib_set_timer (GstQuicLibTransportContext *ctx, GSourceFunc cb,
-    guint msec)
+/**
+ * quiclib_conn_memory_wait
+ *
+ * Waits for @conn to come back under its memory limits before more stream
+ * data is sent on it. Returns FALSE without waiting if @may_block is FALSE,
+ * or if called on the loop thread, which is what processes the ACKs that
+ * would bring it back under.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_conn_memory_wait (GstQuicLibTransportConnection *conn,
+    gboolean may_block)
 {
   GstQuicLibTransportContextPrivate *priv =
-      gst_quiclib_transport_context_get_instance_private (ctx);
+      gst_quiclib_transport_context_get_instance_private (
+          GST_QUICLIB_TRANSPORT_CONTEXT (conn));
 
-  GST_DEBUG_OBJECT (ctx, "Setting %s timer for %u msec",
-      (priv->timeout)?("replacement"):("new"), msec);
+  if (!quiclib_conn_memory_limited (conn)) {
+    return TRUE;
+  }
 
-  quiclib_cancel_timer (ctx);
+  quiclib_mem_charge (&conn->memory->limited, 1);
 
-  priv->timeout = g_timeout_source_new (msec);
-  g_source_set_callback (priv->timeout, cb, ctx, NULL);
-  g_source_attach (priv->timeout, priv->loop_context);
+  if (!may_block || (priv->loop_context != NULL &&
+      g_main_context_is_owner (priv->loop_context))) {
+    return FALSE;
+  }
 
-  return TRUE;
-}
+  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      "Over memory limit with %lu bytes pinned, waiting for ACKs",
+      quiclib_conn_memory (conn));
 
-void
-_quiclib_add_stat (GstQuicLibTransportConnection *conn, GList **list,
-    GstQuicLibPacketStats *stat)
-{
-  g_mutex_lock (&conn->stats.mutex);
-  while (*list && stat->timestamp_ns >
-      (((GstQuicLibPacketStats *) (*list)->data)->timestamp_ns + 1000000000)) {
-    g_free ((*list)->data);
-    *list = g_list_delete_link (*list, *list);
+  g_mutex_lock (&conn->mutex);
+  while (quiclib_conn_memory_limited (conn) &&
+      gst_quiclib_transport_get_state (GST_QUICLIB_TRANSPORT_CONTEXT (conn))
+          == QUIC_STATE_OPEN) {
+    g_cond_wait_until (&conn->cond, &conn->mutex,
+        g_get_monotonic_time () + (100 * G_TIME_SPAN_MILLISECOND));
   }
+  g_mutex_unlock (&conn->mutex);
 
-  *list = g_list_append (*list, stat);
-  g_mutex_unlock (&conn->stats.mutex);
+  return TRUE;
 }
 
-/*
- * quiclib_packet_write
+/**
+ * quiclib_conn_update_idle
  *
- * Sends packets to the network that have been created by ngtcp2.
+ * Returns TRUE if the idle-mode property is set and @conn is open with
+ * nothing in flight, held back or awaiting acknowledgement. When @conn first
+ * goes idle, the blocks cached in its ngtcp2 pool and the slab chunks with no
+ * objects in use are released. Call with the context lock held.
+ *
+ * INTERNAL FUNCTION ONLY.
  */
-gssize
-quiclib_packet_write (GstQuicLibTransportConnection *conn, const gchar *data,
-    gsize nwrite, ngtcp2_path_storage *ps)
+static gboolean
+quiclib_conn_update_idle (GstQuicLibTransportConnection *conn)
 {
-  GError *err = NULL;
-  gssize written;
-  GSocketAddress *gsa = g_socket_address_new_from_native (
-      ps->path.remote.addr, ps->path.remote.addrlen);
+  GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (
+          GST_QUICLIB_TRANSPORT_CONTEXT (conn));
+  gboolean idle;
 
-  g_assert (gsa != NULL);
+  if (!priv->idle_mode || conn->quic_conn == NULL) {
+    return FALSE;
+  }
 
-  written = g_socket_send_to (conn->socket->socket, gsa, data, nwrite, NULL,
-      &err);
+  idle = priv->state == QUIC_STATE_OPEN &&
+      ngtcp2_conn_get_bytes_in_flight (conn->quic_conn) == 0 &&
+      conn->shaped_streams == NULL && conn->streams_to_close == NULL &&
+      g_hash_table_size (conn->datagrams_awaiting_ack) == 0 &&
+      quiclib_mem_read (&conn->memory->retained) == 0;
 
-  if (written < 0 && err != NULL) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "g_socket_send_to failed: %s", err->message);
-  } else if (gst_debug_category_get_threshold (quiclib_transport)
-      >= GST_LEVEL_DEBUG){
-    gchar *peer_addr_str = g_socket_connectable_to_string (
-        G_SOCKET_CONNECTABLE (gsa));
-    ngtcp2_version_cid vc;
-    char dcid_str[CID_STR_LEN], scid_str[CID_STR_LEN];
+  if (idle && !conn->idle) {
+    gsize freed = conn->mem_pool.cached;
 
-    ngtcp2_pkt_decode_version_cid (&vc, (const uint8_t *) data, nwrite, 18);
+    quiclib_mem_pool_clear (&conn->mem_pool);
+    freed += quiclib_slab_trim (&conn->cid_slab);
+    freed += quiclib_slab_trim (&conn->stat_slab);
+    freed += quiclib_slab_trim (&conn->id_slab);
+    freed += quiclib_slab_trim (&conn->dgram_slab);
+    freed += quiclib_slab_trim (&conn->unmap_slab);
 
     GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Sent %ld bytes to peer %s with DCID %s and SCID %s", written,
-        peer_addr_str, quiclib_rawcidtostr (vc.dcid, vc.dcidlen, dcid_str),
-        quiclib_rawcidtostr (vc.scid, vc.scidlen, scid_str));
-
-    g_free (peer_addr_str);
+        "Connection is idle, released %lu cached bytes", freed);
   }
 
-  if (written > 0) {
-    GstQuicLibTransportContextPrivate *priv =
-      gst_quiclib_transport_context_get_instance_private (
-        GST_QUICLIB_TRANSPORT_CONTEXT (conn));
-    
-    if (priv->enable_stats) {
-      struct timespec ts;
-      GstQuicLibPacketStats *stat = g_new (GstQuicLibPacketStats, 1);
+  conn->idle = idle;
 
-      clock_gettime (CLOCK_REALTIME, &ts);
-      stat->bytes = (gsize) written;
-      stat->timestamp_ns = (ts.tv_sec * 1000000000) + ts.tv_nsec;
+  return idle;
+}
 
-      _quiclib_add_stat (conn, &conn->stats.bytes_sent, stat);
-    }
+/**
+ * quiclib_conn_stream_dscp
+ *
+ * Returns the DSCP to mark packets carrying frames for @stream_id with. This is
+ * the connection's default unless the stream has one of its own. Pass -1 for
+ * packets that don't carry stream data.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static guint8
+quiclib_conn_stream_dscp (GstQuicLibTransportConnection *conn,
+    gint64 stream_id)
+{
+  GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (
+          GST_QUICLIB_TRANSPORT_CONTEXT (conn));
+  GstQuicLibStreamContext *stream;
 
-    conn->stats.pkt_counts.sent++;
+  if (stream_id >= 0 && g_hash_table_lookup_extended (conn->streams,
+      &stream_id, NULL, (gpointer *) &stream) && stream->dscp >= 0) {
+    return (guint8) stream->dscp;
   }
 
-  g_object_unref (gsa);
+  return (guint8) priv->dscp;
+}
 
-  return written;
+/*
+ * DSCPs in ascending order of priority, after RFC 4594 and RFC 8622, for
+ * picking the marking of a packet that carries frames for streams with
+ * different ones. Lower effort ranks below the default, and network control
+ * is kept below the real-time classes so that it can't promote media past
+ * EF. Codepoints not listed rank the same as the default.
+ */
+static const guint8 quiclib_dscp_ranking[] = {
+  1,            /* LE */
+  8,            /* CS1 */
+  0,            /* CS0, default */
+  14, 12, 10,   /* AF13, AF12, AF11 */
+  16,           /* CS2 */
+  22, 20, 18,   /* AF23, AF22, AF21 */
+  24,           /* CS3 */
+  30, 28, 26,   /* AF33, AF32, AF31 */
+  32,           /* CS4 */
+  38, 36, 34,   /* AF43, AF42, AF41 */
+  40,           /* CS5 */
+  48, 56,       /* CS6, CS7 */
+  44,           /* VOICE-ADMIT */
+  46            /* EF */
+};
+
+/**
+ * quiclib_dscp_rank
+ *
+ * Returns the position of @dscp in quiclib_dscp_ranking.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static guint
+quiclib_dscp_rank (guint8 dscp)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (quiclib_dscp_ranking); i++) {
+    if (quiclib_dscp_ranking[i] == dscp) {
+      return i;
+    }
+  }
+
+  return quiclib_dscp_rank (0);
 }
 
 /**
- * quiclib_ngtcp2_conn_write
- * 
+ * quiclib_dscp_higher
+ *
+ * Returns whichever of @a and @b has the higher priority.
+ *
  * INTERNAL FUNCTION ONLY.
- * Make ngtcp2 create packets to be sent with @quiclib_packet_write.
- * 
- * This code can be re-entrant if it is possible to send more than one packet.
- * 
- * @conn: The QUIC connection to write packets for
- * @stream_id: The stream ID to write. This can be -1 during handshake and
- *    crypto exchanges, and implies that some connection-level stuff needs to be
- *    exchanged, not in streams. This will all be managed internally by ngtcp2,
- *    and there should be a zero-length vector of buffers in this case.
- * @frame: A vector of buffers for the stream to be sent.
- * @nvec: The number of buffers in @frame.
- * @final: Whether the stream should be closed on the completion of sending the
- *    buffers in @frame.
- * 
- * @return The size of QUIC stream data written from @frame, or <0 on error.
  */
-ssize_t
-quiclib_ngtcp2_conn_write (GstQuicLibTransportConnection *conn,
-    gint64 stream_id, ngtcp2_vec *frame, size_t nvec,
-    int final)
+static guint8
+quiclib_dscp_higher (guint8 a, guint8 b)
 {
-  ngtcp2_path_storage ps, prev_ps;
-  uint32_t flags = 0; /* NGTCP2_WRITE_STREAM_FLAG_MORE */
-  ngtcp2_pkt_info pi;
-  size_t max_udp_size;
-  ngtcp2_ssize nwrite, to_write = 0, pdatalen = 0;
-  size_t i;
-  guint64 ts;
+  return (quiclib_dscp_rank (b) > quiclib_dscp_rank (a)) ? b : a;
+}
 
-  GstBuffer *buffer;
-  GstMapInfo map;
+G_DEFINE_TYPE (GstQuicLibTransportConnection, gst_quiclib_transport_connection,
+    GST_TYPE_QUICLIB_TRANSPORT_CONTEXT);
 
-  gst_quiclib_transport_context_lock (conn);
+static void gst_quiclib_transport_connection_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec);
+static void gst_quiclib_transport_connection_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec);
 
-  GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn), "nvec(%lu) final(%s)",
-      nvec, (final)?("TRUE"):("FALSE"));
+static void
+gst_quiclib_transport_connection_finalise (
+    GstQuicLibTransportConnection *self);
 
-  if (nvec == 0 && final) {
-    _quiclib_add_stream_to_close (conn, stream_id);
-    gst_quiclib_transport_context_unlock (conn);
-    return 0;
-  }
+void
+gst_quiclib_transport_connection_class_init (
+    GstQuicLibTransportConnectionClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  gobject_class->set_property = gst_quiclib_transport_connection_set_property;
+  gobject_class->get_property = gst_quiclib_transport_connection_get_property;
+  gobject_class->finalize =
+      (GObjectFinalizeFunc) gst_quiclib_transport_connection_finalise;
 
-  if (ngtcp2_conn_in_closing_period (conn->quic_conn) ||
-      ngtcp2_conn_in_draining_period (conn->quic_conn)) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Connection closed");
-    gst_quiclib_transport_context_unlock (conn);
-    return -1;
-  }
+  gst_quiclib_common_install_alpn_property (gobject_class);
+  gst_quiclib_common_install_bidi_streams_remaining_local_property (
+      gobject_class);
+  gst_quiclib_common_install_bidi_streams_remaining_remote_property (
+      gobject_class);
+  gst_quiclib_common_install_uni_streams_remaining_local_property (
+      gobject_class);
+  gst_quiclib_common_install_uni_streams_remaining_remote_property (
+      gobject_class);
+  gst_quiclib_common_install_peer_addresses_property (gobject_class);
+  gst_quiclib_common_install_local_addresses_property (gobject_class);
+  gst_quiclib_common_install_send_datagrams_property (gobject_class);
+}
 
-  ngtcp2_path_storage_zero (&ps);
-  ngtcp2_path_storage_zero (&prev_ps);
+static void gst_quiclib_transport_connection_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec)
+{
+  GstQuicLibTransportConnection *conn =
+      GST_QUICLIB_TRANSPORT_CONNECTION (object);
 
-  max_udp_size = ngtcp2_conn_get_max_tx_udp_payload_size (conn->quic_conn);
 
-  if (final) {
-    flags |= NGTCP2_WRITE_STREAM_FLAG_FIN;
-  }
+  if (gst_debug_category_get_threshold (quiclib_transport) >= GST_LEVEL_TRACE)
+  {
+    gchar *valcon = g_strdup_value_contents (value);
 
-  buffer = gst_buffer_new_and_alloc (max_udp_size);
-  if (buffer == NULL) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Couldn't allocate GstBuffer");
-    gst_quiclib_transport_context_unlock (conn);
-    return -1;
+    GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Setting property %s to %s", pspec->name, valcon);
+
+    g_free (valcon);
   }
 
-  gst_buffer_map (buffer, &map, GST_MAP_READ);
+  g_mutex_lock (&conn->mutex);
 
-  GST_LOG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-      "There are %ld bytes available in the cwnd for stream %ld",
-      quiclib_ngtcp2_get_stream_window (conn, stream_id),
-      stream_id);
+  switch (prop_id) {
+    case PROP_ALPN:
+      if (conn->alpn) {
+        g_free (conn->alpn);
+      }
+      conn->alpn = g_value_dup_string (value);
+      break;
+    case PROP_BIDI_STREAMS_REMAINING_REMOTE:
+    {
+      guint64 v = g_value_get_uint64 (value);
+      if (v > conn->bidi_remote_streams_remaining) {
+        v -= conn->bidi_remote_streams_remaining;
+        ngtcp2_conn_extend_max_streams_bidi (conn->quic_conn, v);
 
-  for (i = 0; i < nvec; i++) {
-    to_write += frame[i].len;
-  }
+        conn->bidi_remote_streams_remaining += v;
+      }
+      break;
+    }
+    case PROP_UNI_STREAMS_REMAINING_REMOTE:
+    {
+      guint v = g_value_get_uint64 (value);
+      if (v > conn->uni_remote_streams_remaining) {
+        v -= conn->uni_remote_streams_remaining;
+        ngtcp2_conn_extend_max_streams_uni (conn->quic_conn, v);
 
-  if (gst_debug_category_get_threshold (quiclib_transport) >= GST_LEVEL_TRACE)
-  {
-    GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "There are %lu stream buffers to write and %u outstanding streams to "
-        "close gracefully", nvec, g_list_length (conn->streams_to_close));
-    for (i = 0; i < nvec; i++) {
-      GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-          "Buffer %lu has size %lu bytes", i, frame[i].len);
+        conn->uni_remote_streams_remaining += v;
+      }
+      break;
     }
+    case PROP_BIDI_STREAMS_REMAINING_LOCAL:
+    case PROP_UNI_STREAMS_REMAINING_LOCAL:
+    case PROP_PEER_ADDRESSES:
+    case PROP_LOCAL_ADDRESSES:
+    case PROP_SEND_DATAGRAMS:
+      g_critical ("Attempted to set read-only parameter: %s", pspec->name);
+      /* no break */
+    default:
+      G_OBJECT_CLASS (gst_quiclib_transport_connection_parent_class)
+        ->set_property (object, prop_id, value, pspec);
   }
 
-  ts = quiclib_ngtcp2_timestamp ();
+  g_mutex_unlock (&conn->mutex);
+}
 
-  while (conn->streams_to_close) {
-    gint64 _close_stream_id = _quiclib_pop_stream_to_close (conn);
-    nwrite = ngtcp2_conn_writev_stream (conn->quic_conn, &ps.path, &pi,
-        map.data, map.size, &pdatalen,
-        flags | NGTCP2_WRITE_STREAM_FLAG_MORE | NGTCP2_WRITE_STREAM_FLAG_FIN,
-        _close_stream_id, NULL, 0, ts);
+static void gst_quiclib_transport_connection_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec)
+{
+  GstQuicLibTransportConnection *conn =
+      GST_QUICLIB_TRANSPORT_CONNECTION (object);
 
-    switch (nwrite) {
-      case NGTCP2_ERR_NOMEM:
-      case NGTCP2_ERR_INVALID_ARGUMENT:
-        gst_quiclib_transport_context_unlock (conn);
-        return GST_QUICLIB_ERR;
-      case NGTCP2_ERR_STREAM_NOT_FOUND:
-      case NGTCP2_ERR_STREAM_SHUT_WR:
-      case NGTCP2_ERR_WRITE_MORE:
-        continue;
-      case 0:
-        gst_quiclib_transport_context_unlock (conn);
-        return 0;
-      default:
-        GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-            "Ran out of packet space after writing final stream frame for "
-            "stream %lu", _close_stream_id);
-        gst_quiclib_transport_context_unlock (conn);
+  GST_TRACE_OBJECT (conn, "Getting value of property %s", pspec->name);
 
-        nwrite = quiclib_packet_write (conn, (const gchar *) map.data, nwrite,
-            &ps);
-        if (nwrite < 0) {
-          gst_buffer_unmap (buffer, &map);
-          return -1;
-        }
+  g_mutex_lock (&conn->mutex);
 
-        gst_buffer_unmap (buffer, &map);
+  switch (prop_id) {
+    case PROP_ALPN:
+      g_value_set_string (value, conn->alpn);
+      break;
+    case PROP_BIDI_STREAMS_REMAINING_LOCAL:
+      if (conn->quic_conn) {
+        guint64 bidi_left =
+            (guint64) ngtcp2_conn_get_streams_bidi_left (conn->quic_conn);
 
-        return quiclib_ngtcp2_conn_write (conn, stream_id, frame, nvec, final);
-    }
-  }
+        g_value_set_uint64 (value, bidi_left);
+      } else {
+        g_value_set_uint64 (value, 0);
+      }
+      break;
+    case PROP_BIDI_STREAMS_REMAINING_REMOTE:
+      g_value_set_uint64 (value, conn->bidi_remote_streams_remaining);
+      break;
+    case PROP_UNI_STREAMS_REMAINING_LOCAL:
+      if (conn->quic_conn) {
+        guint64 uni_left =
+            (guint64) ngtcp2_conn_get_streams_uni_left (conn->quic_conn);
+        g_value_set_uint64 (value, uni_left);
+      } else {
+        g_value_set_uint64 (value, 0);
+      }
+      break;
+    case PROP_UNI_STREAMS_REMAINING_REMOTE:
+      g_value_set_uint64 (value, conn->uni_remote_streams_remaining);
+      break;
+    case PROP_PEER_ADDRESSES:
+    {
+      const ngtcp2_path *path;
+      GSocketAddress *sa;
+      GList *list = NULL;
 
-  /* 
-   * For WRITE_MORE: conn->quic_conn, ps.path, pi, map.data, map.size and the
-   * timestamp must be the same.
-   */
-  nwrite = ngtcp2_conn_writev_stream (conn->quic_conn, &ps.path, &pi,
-      map.data, map.size, &pdatalen, flags, stream_id,
-      (frame != NULL)?(frame):(NULL), (frame != NULL)?(nvec):(0), ts);
+      path = ngtcp2_conn_get_path (conn->quic_conn);
+      sa = g_socket_address_new_from_native (path->remote.addr,
+          path->remote.addrlen);
 
-  gst_quiclib_transport_context_unlock (conn);
+      list = g_list_append (list, (gpointer) sa);
 
-  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-      "ngtcp2_conn_writev_stream: nwrite %ld, pdatalen %ld", nwrite, pdatalen);
+      g_value_set_boxed (value, list);
 
-  if (nwrite <= 0) {
-    if (nwrite == 0) return 0;
+      break;
+    }
+    case PROP_LOCAL_ADDRESSES:
+    {
+      const ngtcp2_path *path;
+      GSocketAddress *sa;
+      GList *list = NULL;
 
-    GST_LOG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "writev_stream returned %s", ngtcp2_strerror (nwrite));
-    gst_buffer_unmap (buffer, &map);
+      path = ngtcp2_conn_get_path (conn->quic_conn);
+      sa = g_socket_address_new_from_native (path->local.addr,
+          path->local.addrlen);
 
-    switch (nwrite) {
-    case NGTCP2_ERR_WRITE_MORE:
-      GST_LOG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn), "Wrote packet "
-          "containing %ld bytes for stream ID %ld, with space remaining in "
-          "the same packet.", pdatalen, stream_id);
-      g_assert (0);
-      break;
-    case NGTCP2_ERR_NOMEM:
-    case NGTCP2_ERR_INVALID_ARGUMENT:
-      return GST_QUICLIB_ERR;
-    case NGTCP2_ERR_STREAM_NOT_FOUND:
-      guint64 test = 0;
-      switch (stream_id & 0x3) {
-        case 0x0: test = conn->last_client_bidi_stream_id; break;
-        case 0x1: test = conn->last_server_bidi_stream_id; break;
-        case 0x2: test = conn->last_client_uni_stream_id; break;
-        case 0x3: test = conn->last_server_uni_stream_id; break;
-      }
+      list = g_list_append (list, (gpointer) sa);
 
-      if (test < stream_id) {
-        return GST_QUICLIB_ERR;
+      g_value_set_boxed (value, list);
+
+      break;
+    }
+    case PROP_SEND_DATAGRAMS:
+    {
+      const ngtcp2_transport_params *tp =
+          ngtcp2_conn_get_remote_transport_params (conn->quic_conn);
+      
+      if (tp) {
+        g_value_set_boolean (value, tp->max_datagram_frame_size > 0);
+      } else {
+        GST_WARNING_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn), "Attempted "
+            "to get remote transport parameter before they were ready");
+        g_value_set_boolean (value, FALSE);
       }
-      /* Probably already been closed */
-      return GST_QUICLIB_ERR_STREAM_CLOSED;
-    case NGTCP2_ERR_STREAM_SHUT_WR:
-      return GST_QUICLIB_ERR_STREAM_CLOSED;
-    case NGTCP2_ERR_PKT_NUM_EXHAUSTED:
-      return GST_QUICLIB_ERR_PACKET_NUM_EXHAUSTED;
-    case NGTCP2_ERR_STREAM_DATA_BLOCKED:
-      return GST_QUICLIB_ERR_STREAM_DATA_BLOCKED;;
-    default:
-      GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-          "UNKNOWN NGTCP2 RETURN CODE: %ld", nwrite);
-      return GST_QUICLIB_ERR;
+      break;
     }
+    default:
+      G_OBJECT_CLASS (gst_quiclib_transport_connection_parent_class)->
+        get_property (object, prop_id, value, pspec);
   }
 
-  g_assert (nwrite <= max_udp_size);
+  g_mutex_unlock (&conn->mutex);
+}
 
-  nwrite = quiclib_packet_write (conn, (const gchar *) map.data, nwrite, &ps);
-  if (nwrite < 0) {
-    gst_buffer_unmap (buffer, &map);
-    return -1;
+void
+gst_quiclib_transport_connection_get_local_transport_param (
+    GstQuicLibTransportContext * ctx, guint prop_id, GValue * value) {
+  GstQuicLibTransportConnection *conn;
+  const ngtcp2_transport_params *local_tp;
+
+  if (!GST_IS_QUICLIB_TRANSPORT_CONNECTION (ctx)) {
+    g_value_set_uint64 (value, 0);
+    return;
   }
 
-  gst_buffer_unmap (buffer, &map);
+  conn = GST_QUICLIB_TRANSPORT_CONNECTION (ctx);
 
-  if (pdatalen == -1) {
-    pdatalen = 0;
+  if (conn->quic_conn == NULL) {
+    g_value_set_uint64 (value, 0);
+    return;
   }
 
-  return pdatalen;
-}
+  local_tp = ngtcp2_conn_get_local_transport_params (conn->quic_conn);
 
-/**
- * quiclib_ngtcp2_datagram_write
- * 
- * INTERNAL FUNCTION ONLY.
- * Like @quiclib_ngtcp2_conn_write, but for writing DATAGRAM frames ONLY.
- * 
- * @conn: The connection to write the DATAGRAM frames out to.
- * @frame: A vector of buffers to package into DATAGRAM frames. These will be
- *    payloaded into individual DATAGRAM frames.
- * @nvec: The number of buffers in @frame.
- * 
- * @return The size of QUIC DATAGRAM frame body data written from @frame, or <0
- *    on error.
+  switch (prop_id) {
+    case PROP_MAX_DATA_LOCAL:
+      g_value_set_uint64 (value, local_tp->initial_max_data);
+      break;
+    case PROP_MAX_STREAM_DATA_BIDI_LOCAL:
+      g_value_set_uint64 (value, local_tp->initial_max_stream_data_bidi_local);
+      break;
+    case PROP_MAX_STREAM_DATA_UNI_LOCAL:
+      g_value_set_uint64 (value, local_tp->initial_max_stream_data_uni);
+      break;
+    case PROP_MAX_STREAMS_BIDI_LOCAL:
+      g_value_set_uint64 (value, local_tp->initial_max_streams_bidi);
+      break;
+    case PROP_MAX_STREAMS_UNI_LOCAL:
+      g_value_set_uint64 (value, local_tp->initial_max_streams_uni);
+      break;
+    default:
+      g_critical ("Unreachable");
+      g_assert (0);
+  }
+}
+
+/*
+ * A datagram awaiting its ACK, keyed in datagrams_awaiting_ack by @ticket.
  */
-ssize_t
-quiclib_ngtcp2_datagram_write (GstQuicLibTransportConnection *conn,
-    ngtcp2_vec *frame, size_t nvec)
+typedef struct {
+  gint64 ticket;
+  GstBuffer *buf;
+  QuicLibSlab *slab;
+  QuicLibMemAccount *memory;
+} QuicLibDatagramAck;
+
+static void
+quiclib_datagram_ack_free (gpointer data)
 {
-  ngtcp2_path_storage ps, prev_ps;
-  uint32_t flags = 0; /* NGTCP2_WRITE_DATAGRAM_FLAG_MORE */
-  ngtcp2_pkt_info pi;
-  size_t max_udp_size;
-  ngtcp2_ssize nwrite;
-  gint paccepted = 0;
-  guint64 datagram_id = conn->datagram_ticket;
+  QuicLibDatagramAck *ack = (QuicLibDatagramAck *) data;
 
-  GstBuffer *buffer;
+  quiclib_mem_charge (&ack->memory->datagrams,
+      -(gssize) gst_buffer_get_size (ack->buf));
+  gst_buffer_unref (ack->buf);
+  quiclib_slab_free (ack->slab, ack);
+}
+
+/*
+ * A memory of a buffer mapped by quiclib_buffer_to_vec, chained through
+ * @next. @slab is the slab it came from, or NULL if it was g_malloc'd.
+ */
+typedef struct _QuicLibUnmap {
   GstMapInfo map;
+  gsize end_offset;
+  GstMemory *mem;
+  QuicLibSlab *slab;
+  struct _QuicLibUnmap *next;
+} QuicLibUnmap;
 
-  gst_quiclib_transport_context_lock (conn);
+static void
+gst_quiclib_transport_connection_init (GstQuicLibTransportConnection *self)
+{
+  GValue gv_uint64 = G_VALUE_INIT;
+  GValue gv_uint = G_VALUE_INIT;
+
+  g_value_init (&gv_uint64, G_TYPE_UINT64);
+  g_value_init (&gv_uint, G_TYPE_UINT);
+
+  self->socket = NULL;
+  self->bind_addr = NULL;
+  self->migration_socket = NULL;
+  ngtcp2_path_storage_zero (&self->migration_path);
+  self->alpn = NULL;
+  self->stripe_id = 0;
+  self->stripe_redundant_requested = FALSE;
+  self->stripe_redundant = FALSE;
+  self->quic_conn = NULL;
+  self->conn_ref.user_data = NULL;
+  self->datagram_ticket = 0;
+  self->ssl_ctx = NULL;
+  self->ssl = NULL;
+  memset (&self->mem_pool, 0, sizeof (self->mem_pool));
+  self->mem.user_data = &self->mem_pool;
+  self->mem.malloc = quiclib_mem_pool_malloc;
+  self->mem.free = quiclib_mem_pool_free;
+  self->mem.calloc = quiclib_mem_pool_calloc;
+  self->mem.realloc = quiclib_mem_pool_realloc;
+  quiclib_slab_init (&self->cid_slab, sizeof (ngtcp2_cid));
+  quiclib_slab_init (&self->stat_slab, sizeof (GstQuicLibPacketStats));
+  quiclib_slab_init (&self->id_slab, sizeof (gint64));
+  quiclib_slab_init (&self->dgram_slab, sizeof (QuicLibDatagramAck));
+  quiclib_slab_init (&self->unmap_slab, sizeof (QuicLibUnmap));
+  self->memory = g_new0 (QuicLibMemAccount, 1);
+  self->memory->ref_count = 1;
+  self->idle = FALSE;
+  /* The keys live in the values, so only the values are freed */
+  self->streams = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+      NULL, quiclib_stream_context_destroy);
+  self->datagrams_awaiting_ack = g_hash_table_new_full (g_int64_hash,
+      g_int64_equal, NULL, quiclib_datagram_ack_free);
+  ngtcp2_ccerr_default (&self->last_error);
+  ngtcp2_transport_params_default (&self->transport_params);
 
   /*
-   * Wait until the handshake is completed, as we don't know whether we can send
-   * datagrams until this time!
+   * Init to 0, they'll be set to the correct values when the connection is made
    */
-  /* TODO: Do this better! */
-  while (!ngtcp2_conn_get_handshake_completed (conn->quic_conn)) {
-    gst_quiclib_transport_context_unlock (conn);
-    usleep (100000);
-    gst_quiclib_transport_context_lock (conn);
-  }
-
-  if (ngtcp2_conn_in_closing_period (conn->quic_conn) ||
-      ngtcp2_conn_in_draining_period (conn->quic_conn)) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Connection closed");
-    gst_quiclib_transport_context_unlock (conn);
-    return GST_QUICLIB_ERR_CONN_CLOSED;
-  }
-  ngtcp2_path_storage_zero (&ps);
-  ngtcp2_path_storage_zero (&prev_ps);
+  self->bidi_remote_streams_remaining = 0;
+  self->uni_remote_streams_remaining = 0;
 
-  max_udp_size = ngtcp2_conn_get_max_tx_udp_payload_size (conn->quic_conn);
+  self->relays = NULL;
+  self->relay_upstreams = NULL;
+  self->relay_flush_pending = 0;
 
-  buffer = gst_buffer_new_and_alloc (max_udp_size);
-  if (buffer == NULL) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Couldn't allocate GstBuffer");
-    gst_quiclib_transport_context_unlock (conn);
-    return GST_QUICLIB_ERR_OOM;
-  }
+  memset (&self->bwe, 0, sizeof (self->bwe));
 
-  gst_buffer_map (buffer, &map, GST_MAP_WRITE);
+  memset (&self->shaper, 0, sizeof (self->shaper));
+  self->shaped_streams = NULL;
+  self->shaper_scheduled = FALSE;
+  self->egress_weight = QUICLIB_EGRESS_WEIGHT_DEFAULT;
+  self->egress_vtime = 0;
+  self->egress_backlogged = FALSE;
 
-  GST_LOG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-      "Writing datagram of size %lu into buffer of size %lu with %ld bytes "
-      "available in the cwnd", frame[0].len, map.size,
-      ngtcp2_conn_get_cwnd_left (conn->quic_conn));
+  memset (&self->probe, 0, sizeof (self->probe));
 
-  nwrite = ngtcp2_conn_writev_datagram (conn->quic_conn, &ps.path,
-      &pi, (uint8_t *) map.data, map.size, &paccepted, flags, datagram_id,
-      frame, nvec, quiclib_ngtcp2_timestamp ());
+  g_mutex_init (&self->mutex);
+  g_cond_init (&self->cond);
+  memset (&self->stats, 0, sizeof (GstQuicLibConnStatsTrackers));
+  g_mutex_init (&self->stats.mutex);
+}
 
-  gst_quiclib_transport_context_unlock (conn);
+/**
+ * quiclib_socket_context_detach
+ *
+ * Destroys the sources that read from @socket_ctx, leaving it otherwise
+ * intact. @socket_ctx may be NULL.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_socket_context_detach (QuicLibSocketContext *socket_ctx)
+{
+  if (socket_ctx == NULL) return;
 
-  gst_buffer_unmap (buffer, &map);
-  if (nwrite > 0) {
-    GError *err = NULL;
-    gssize written;
-    GSocketAddress *gsa = g_socket_address_new_from_native (
-        ps.path.remote.addr, ps.path.remote.addrlen);
+#ifdef HAVE_LIBURING
+  if (socket_ctx->uring != NULL && socket_ctx->uring->source != NULL) {
+    g_source_destroy (socket_ctx->uring->source);
+  }
+#endif
+#ifdef HAVE_LIBXDP
+  if (socket_ctx->xdp != NULL && socket_ctx->xdp->source != NULL) {
+    g_source_destroy (socket_ctx->xdp->source);
+  }
+#endif
 
-    g_assert (gsa != NULL);
+  if (socket_ctx->source != NULL) {
+    g_source_destroy (socket_ctx->source);
+  }
+}
 
-    written = g_socket_send_to (conn->socket->socket, gsa, (gchar *) map.data,
-        nwrite, NULL, &err);
+typedef struct {
+  GstQuicLibTransportConnection *conn;
+  GMutex mutex;
+  GCond cond;
+  gboolean done;
+} QuicLibConnDetach;
 
-    GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Sent UDP packet of size %ld bytes containing %lu bytes of payload - "
-        "paccepted is %d", written, frame->len, paccepted);
+gboolean
+quiclib_cancel_timer (GstQuicLibTransportContext *ctx);
 
-    if (written < 0 && err != NULL) {
-      GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-          "g_socket_send_to failed: %s", err->message);
-    }
+/**
+ * quiclib_conn_detach_sources
+ *
+ * Destroys the sources on the loop of a connection that don't hold a
+ * reference to it. Runs on the loop thread, so none of them can be
+ * dispatching while this runs, and none can dispatch afterwards.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_conn_detach_sources (gpointer user_data)
+{
+  QuicLibConnDetach *detach = (QuicLibConnDetach *) user_data;
+  GstQuicLibTransportConnection *conn = detach->conn;
 
-    if (paccepted != 0) {
-      quiclib_store_datagram_ack_ref (conn, datagram_id, buffer);
-      conn->datagram_ticket++;
-    }
+  quiclib_cancel_timer (GST_QUICLIB_TRANSPORT_CONTEXT (conn));
 
-    g_object_unref (gsa);
-  } else {
-    switch (nwrite) {
-    case 0:
-      GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-          "ngtcp2_conn_writev_datagram returned 0. paccepted is %d", paccepted);
-      break;
-    case NGTCP2_ERR_WRITE_MORE:
-      GST_LOG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn), "Wrote packet for "
-          "datagram %ld, with space remaining in the same packet.",
-          datagram_id);
-      g_assert (0);
-      break;
-    case NGTCP2_ERR_INVALID_STATE:
-      GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-          "Remote endpoint does not support DATAGRAMs!");
-      return GST_QUICLIB_ERR_EXTENSION_NOT_SUPPORTED;
-    default:
-      GST_LOG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-          "writev_datagram returned %s", ngtcp2_strerror (nwrite));
-      return GST_QUICLIB_ERR;
-    }
+  if (conn->send_queue_source != NULL) {
+    g_source_destroy ((GSource *) conn->send_queue_source);
   }
 
-  return nwrite;
-}
+  quiclib_socket_context_detach (conn->socket);
+  quiclib_socket_context_detach (conn->migration_socket);
 
-/* For debugging only */
-#define quiclib_print_ngtcp2_transport_params(ctx, params) \
-do { \
-  GST_DEBUG_OBJECT (ctx, \
-      "Preferred addr %s present, Original DCID %s present, " \
-      "Initial SCID %s present, Retry SCID %s present, " \
-      "initial_max_stream_data_bidi_local %lu, " \
-      "initial_max_stream_data_bidi_remote %lu, " \
-      "initial_max_stream_data_uni %lu, initial_max_data %lu, " \
-      "initial_max_streams_bidi %lu, initial_max_streams_uni %lu, " \
-      "max_idle_timeout %lu, max_udp_payload_size %lu, " \
-      "active_connection_id_limit %lu, ack_delay_exponent %lu, " \
-      "max_ack_delay %lu, max_datagram_frame_size %lu, " \
-      "stateless_reset_token_present %s, disable_active_migration %s,", \
-      params.preferred_addr_present?(""):("not"), \
-      params.original_dcid_present?(""):("not"), \
-      params.initial_scid_present?(""):("not"), \
-      params.retry_scid_present?(""):("not"), \
-      params.initial_max_stream_data_bidi_local, \
-      params.initial_max_stream_data_bidi_remote, \
-      params.initial_max_stream_data_uni, params.initial_max_data, \
-      params.initial_max_streams_bidi, params.initial_max_streams_uni, \
-      params.max_idle_timeout, params.max_udp_payload_size,\
-      params.active_connection_id_limit, params.ack_delay_exponent,\
-      params.max_ack_delay, params.max_datagram_frame_size, \
-      params.stateless_reset_token_present?("SET"):("NOT SET"), \
-      params.disable_active_migration?("SET"):("NOT SET")); \
-} while (0); \
+  g_mutex_lock (&detach->mutex);
+  detach->done = TRUE;
+  g_cond_signal (&detach->cond);
+  g_mutex_unlock (&detach->mutex);
 
-#define MAX_UDP 65507
+  return G_SOURCE_REMOVE;
+}
 
 /**
- * gst_quiclib_new_conn_from_server
- * 
- * Create a new connection object from a running server instance. This is used
- * when a client makes a connection to the server.
- * 
+ * quiclib_conn_leave_shared_loop
+ *
+ * Takes a finalising client connection off its shared loop. This stands in
+ * for stopping the threads that a connection with its own loop would have.
+ *
  * INTERNAL FUNCTION ONLY.
  */
-GstQuicLibTransportConnection *
-gst_quiclib_new_conn_from_server (GstQuicLibServerContext *server)
+static void
+quiclib_conn_leave_shared_loop (GstQuicLibTransportConnection *conn)
 {
-  GstQuicLibTransportConnection *conn;
-  GstQuicLibTransportContextPrivate *conn_priv;
-  GstQuicLibTransportContextPrivate *server_priv =
+  GstQuicLibTransportContextPrivate *priv =
       gst_quiclib_transport_context_get_instance_private (
-          GST_QUICLIB_TRANSPORT_CONTEXT (server));
+          GST_QUICLIB_TRANSPORT_CONTEXT (conn));
+  QuicLibConnDetach detach;
 
-  conn = g_object_new (GST_TYPE_QUICLIB_TRANSPORT_CONNECTION, NULL);
-  if (!conn) {
-    return NULL;
+  detach.conn = conn;
+  detach.done = FALSE;
+  g_mutex_init (&detach.mutex);
+  g_cond_init (&detach.cond);
+
+  if (g_main_context_is_owner (priv->loop_context)) {
+    quiclib_conn_detach_sources (&detach);
+  } else {
+    g_main_context_invoke_full (priv->loop_context, G_PRIORITY_HIGH,
+        quiclib_conn_detach_sources, &detach, NULL);
+
+    g_mutex_lock (&detach.mutex);
+    while (!detach.done) {
+      g_cond_wait (&detach.cond, &detach.mutex);
+    }
+    g_mutex_unlock (&detach.mutex);
   }
 
-  conn->server = server;
-  conn_priv = gst_quiclib_transport_context_get_instance_private (
-      GST_QUICLIB_TRANSPORT_CONTEXT (conn));
+  g_mutex_clear (&detach.mutex);
+  g_cond_clear (&detach.cond);
 
-  gst_quiclib_transport_context_lock (server);
-  gst_quiclib_transport_context_lock (conn);
+  quiclib_shared_loop_leave (priv);
+}
 
-  conn_priv->user = server_priv->user;
-  conn_priv->app_ctx = server_priv->app_ctx;
-  conn_priv->loop = server_priv->loop;
-  conn_priv->loop_context = server_priv->loop_context;
-  conn_priv->loop_thread = server_priv->loop_thread;
-  conn_priv->enable_stats = server_priv->enable_stats;
-  conn_priv->async_notif_loop = server_priv->async_notif_loop;
-  conn_priv->async_notif_loop_context = server_priv->async_notif_loop_context;
-  conn_priv->async_notif_thread = server_priv->async_notif_thread;
+static void
+gst_quiclib_transport_connection_finalise (GstQuicLibTransportConnection *self)
+{
+  GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (
+          GST_QUICLIB_TRANSPORT_CONTEXT (self));
 
-  conn->transport_params.initial_max_data = server_priv->tp_sent.max_data;
-  conn->transport_params.initial_max_stream_data_bidi_local =
-      conn->transport_params.initial_max_stream_data_bidi_remote =
-          server_priv->tp_sent.max_stream_data_bidi;
-  conn->transport_params.initial_max_stream_data_uni =
-      server_priv->tp_sent.max_stream_data_uni;
-  conn->transport_params.initial_max_streams_bidi =
-      server_priv->tp_sent.max_streams_bidi;
-  conn->transport_params.initial_max_streams_uni =
+  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (self), "Finalizing");
+
+  /*
+   * Server connections share the loop thread of their server, which keeps
+   * running for the other clients, and so do clients on a shared loop.
+   */
+  if (priv->shared_loop != NULL) {
+    quiclib_conn_leave_shared_loop (self);
+  } else if (self->server == NULL) {
+    gst_quiclib_transport_context_kill_thread (
+        GST_QUICLIB_TRANSPORT_CONTEXT (self));
+  }
+
+  quiclib_relay_remove_rules (self, NULL);
+  g_list_free_full (self->relay_upstreams, g_object_unref);
+  self->relay_upstreams = NULL;
+
+  g_list_free (self->shaped_streams);
+  self->shaped_streams = NULL;
+
+  gst_clear_buffer (&self->probe.buf);
+
+  if (self->quic_conn) {
+    gst_quiclib_transport_context_lock (self);
+    if (!ngtcp2_conn_in_closing_period (self->quic_conn) &&
+        !ngtcp2_conn_in_draining_period (self->quic_conn)) {
+      ngtcp2_ssize nwrite;
+      ngtcp2_pkt_info pi;
+      ngtcp2_path_storage ps;
+      guint8 buf[1280];
+
+      ngtcp2_path_storage_zero (&ps);
+
+      nwrite = ngtcp2_conn_write_connection_close (self->quic_conn, &ps.path,
+          &pi, buf, sizeof (buf), &self->last_error,
+          quiclib_conn_timestamp (self, quiclib_ngtcp2_timestamp ()));
+
+      if (nwrite < 0) {
+        GST_ERROR_OBJECT (self,
+            "Couldn't write NGTCP2 CONNECTION_CLOSE frame: %s",
+            ngtcp2_strerror ((int) nwrite));
+      } else {
+        quiclib_packet_write (self, (const gchar *) buf, nwrite, &ps,
+            (quiclib_conn_stream_dscp (self, -1) << 2) | pi.ecn, NULL);
+      }
+    }
+
+    ngtcp2_conn_del (self->quic_conn);
+
+    gst_quiclib_transport_context_unlock (self);
+
+    self->quic_conn = NULL;
+  }
+
+  quiclib_mem_pool_clear (&self->mem_pool);
+
+  g_clear_object (&self->bind_addr);
+
+  if (self->migration_socket) {
+    quiclib_socket_context_destroy (self->migration_socket);
+    self->migration_socket = NULL;
+  }
+
+  if (!self->server && self->socket) {
+    quiclib_socket_context_destroy (self->socket);
+    self->socket = NULL;
+  }
+
+  if (self->cids) {
+    g_list_free (self->cids);
+    self->cids = NULL;
+    self->initial_dcid = NULL;
+  }
+
+  g_list_free (self->streams_to_close);
+  self->streams_to_close = NULL;
+
+  if (self->streams) {
+    g_hash_table_destroy (self->streams);
+    self->streams = NULL;
+  }
+
+  if (self->datagrams_awaiting_ack) {
+    g_hash_table_destroy (self->datagrams_awaiting_ack);
+    self->datagrams_awaiting_ack = NULL;
+  }
+
+  if (self->ssl) {
+    SSL_free (self->ssl);
+    self->ssl = NULL;
+  }
+
+  if (self->ssl_ctx) {
+    SSL_CTX_free (self->ssl_ctx);
+    self->ssl_ctx = NULL;
+  }
+
+  g_mutex_lock (&self->stats.mutex);
+  g_queue_init (&self->stats.bytes_received);
+  g_queue_init (&self->stats.bytes_sent);
+  g_mutex_unlock (&self->stats.mutex);
+
+  /* Everything that was allocated from these has been dropped above */
+  quiclib_slab_clear (&self->cid_slab);
+  quiclib_slab_clear (&self->stat_slab);
+  quiclib_slab_clear (&self->id_slab);
+  quiclib_slab_clear (&self->dgram_slab);
+  quiclib_slab_clear (&self->unmap_slab);
+
+  /* Received buffers still held elsewhere keep the account alive */
+  quiclib_mem_account_unref (self->memory);
+  self->memory = NULL;
+
+  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (self), "Done finalizing");
+
+  G_OBJECT_CLASS (gst_quiclib_transport_connection_parent_class)->finalize (
+      G_OBJECT (self));
+}
+
+struct GstQuicLibConnectionID {
+  enum {
+    TYPE_SCID,
+    TYPE_DCID
+  } type;
+  ngtcp2_cid cid;
+};
+
+struct _GstQuicLibDatagramBuffers {
+  guint64 datagram_id;
+  GstBuffer *buf;
+};
+
+typedef struct _GstQuicLibDatagramBuffers GstQuicLibDatagramBuffers;
+
+
+gint
+quiclib_transport_process_packet (GstQuicLibTransportConnection *conn,
+    const ngtcp2_path *path, const ngtcp2_pkt_info *pktinfo, uint8_t *pkt,
+    size_t pktlen, ngtcp2_tstamp ts);
+
+/*
+ * ngtcp2 callback declarations
+ */
+
+void
+quiclib_ngtcp2_print (void *user_data, const char *format, ...);
+
+int
+quiclib_ngtcp2_recv_client_initial (ngtcp2_conn *quic_conn,
+    const ngtcp2_cid *dcid, void *user_data);
+
+int
+quiclib_ngtcp2_handshake_completed (ngtcp2_conn *conn, void *user_data);
+
+int
+quiclib_ngtcp2_recv_stream_data (ngtcp2_conn *conn, uint32_t flags,
+    int64_t stream_id, uint64_t offset,
+    const uint8_t *data, size_t datalen,
+    void *user_data, void *stream_user_data);
+
+int
+quiclib_ngtcp2_recv_datagram (ngtcp2_conn *conn, uint32_t flags,
+    const uint8_t *data, size_t datalen,
+    void *user_data);
+
+int
+quiclib_ngtcp2_ack_stream (ngtcp2_conn *ngconn, int64_t stream_id,
+    uint64_t offset, uint64_t datalen,
+    void *user_data, void *stream_user_data);
+
+int
+quiclib_ngtcp2_ack_datagram (ngtcp2_conn *quic_conn, uint64_t dgram_id,
+    void *user_data);
+
+int
+quiclib_ngtcp2_on_stream_open (ngtcp2_conn *quic_conn, int64_t stream_id,
+    void *user_data);
+
+int
+quiclib_ngtcp2_on_stream_close (ngtcp2_conn *quic_conn, uint32_t flags,
+    int64_t stream_id, uint64_t app_error_code,
+    void *user_data, void *stream_user_data);
+
+int
+quiclib_ngtcp2_on_stream_reset (ngtcp2_conn *quic_conn, int64_t stream_id,
+    uint64_t final_size, uint64_t app_error_code, void *user_data,
+    void *stream_user_data);
+
+void
+quiclib_ngtcp2_rand (uint8_t *dest, size_t destlen, const ngtcp2_rand_ctx *ctx);
+
+int
+quiclib_ngtcp2_get_new_connection_id (ngtcp2_conn *conn, ngtcp2_cid *cid,
+    uint8_t *token, size_t cidlen,
+    void *user_data);
+
+int
+quiclib_ngtcp2_remove_connection_id (ngtcp2_conn *conn,
+    const ngtcp2_cid *cid, void *user_data);
+
+int
+quiclib_ngtcp2_path_validation (ngtcp2_conn *quic_conn, uint32_t flags,
+    const ngtcp2_path *path, const ngtcp2_path *fallback_path,
+    ngtcp2_path_validation_result res, void *user_data);
+
+int
+quiclib_ngtcp2_select_preferred_addr (ngtcp2_conn *quic_conn,
+    ngtcp2_path *dest, const ngtcp2_preferred_addr *paddr, void *user_data);
+
+ngtcp2_conn *
+quiclib_get_ngtcp2_conn (ngtcp2_crypto_conn_ref *conn_ref);
+
+ngtcp2_callbacks quiclib_ngtcp2_client_callbacks = {
+    .client_initial = ngtcp2_crypto_client_initial_cb,
+    .recv_client_initial = NULL,
+    .recv_crypto_data = ngtcp2_crypto_recv_crypto_data_cb,
+    .handshake_completed = quiclib_ngtcp2_handshake_completed,
+    .recv_version_negotiation = NULL,
+    .encrypt = ngtcp2_crypto_encrypt_cb,
+    .decrypt = ngtcp2_crypto_decrypt_cb,
+    .hp_mask = ngtcp2_crypto_hp_mask_cb,
+    .recv_stream_data = quiclib_ngtcp2_recv_stream_data,
+    .acked_stream_data_offset = quiclib_ngtcp2_ack_stream,
+    .stream_open = quiclib_ngtcp2_on_stream_open,
+    .stream_close = quiclib_ngtcp2_on_stream_close,
+    .recv_stateless_reset = NULL,
+    .recv_retry = ngtcp2_crypto_recv_retry_cb,
+    .extend_max_local_streams_bidi = NULL,
+    .extend_max_local_streams_uni = NULL,
+    .rand = quiclib_ngtcp2_rand,
+    .get_new_connection_id = quiclib_ngtcp2_get_new_connection_id,
+    .remove_connection_id = quiclib_ngtcp2_remove_connection_id,
+    .update_key = ngtcp2_crypto_update_key_cb,
+    .path_validation = quiclib_ngtcp2_path_validation,
+    .select_preferred_addr = quiclib_ngtcp2_select_preferred_addr,
+    .stream_reset = quiclib_ngtcp2_on_stream_reset,
+    .extend_max_remote_streams_bidi = NULL,
+    .extend_max_remote_streams_uni = NULL,
+    .extend_max_stream_data = NULL,
+    .dcid_status = NULL,
+    .handshake_confirmed = NULL,
+    .recv_new_token = NULL,
+    .delete_crypto_aead_ctx = ngtcp2_crypto_delete_crypto_aead_ctx_cb,
+    .delete_crypto_cipher_ctx = ngtcp2_crypto_delete_crypto_cipher_ctx_cb,
+    .recv_datagram = quiclib_ngtcp2_recv_datagram,
+    .ack_datagram = quiclib_ngtcp2_ack_datagram,
+    .lost_datagram = NULL,
+    .get_path_challenge_data = ngtcp2_crypto_get_path_challenge_data_cb,
+    .stream_stop_sending = NULL,
+    .version_negotiation = ngtcp2_crypto_version_negotiation_cb,
+    .recv_rx_key = NULL,
+    .recv_tx_key = NULL,
+    .tls_early_data_rejected = NULL
+};
+
+ngtcp2_callbacks quiclib_ngtcp2_server_callbacks = {
+    .client_initial = NULL,
+    .recv_client_initial = ngtcp2_crypto_recv_client_initial_cb,
+    .recv_crypto_data = ngtcp2_crypto_recv_crypto_data_cb,
+    .handshake_completed = quiclib_ngtcp2_handshake_completed,
+    .recv_version_negotiation = NULL,
+    .encrypt = ngtcp2_crypto_encrypt_cb,
+    .decrypt = ngtcp2_crypto_decrypt_cb,
+    .hp_mask = ngtcp2_crypto_hp_mask_cb,
+    .recv_stream_data = quiclib_ngtcp2_recv_stream_data,
+    .acked_stream_data_offset = quiclib_ngtcp2_ack_stream,
+    .stream_open = quiclib_ngtcp2_on_stream_open,
+    .stream_close = quiclib_ngtcp2_on_stream_close,
+    .recv_stateless_reset = NULL,
+    .recv_retry = ngtcp2_crypto_recv_retry_cb,
+    .extend_max_local_streams_bidi = NULL,
+    .extend_max_local_streams_uni = NULL,
+    .rand = quiclib_ngtcp2_rand,
+    .get_new_connection_id = quiclib_ngtcp2_get_new_connection_id,
+    .remove_connection_id = quiclib_ngtcp2_remove_connection_id,
+    .update_key = ngtcp2_crypto_update_key_cb,
+    .path_validation = quiclib_ngtcp2_path_validation,
+    .select_preferred_addr = NULL,
+    .stream_reset = quiclib_ngtcp2_on_stream_reset,
+    .extend_max_remote_streams_bidi = NULL,
+    .extend_max_remote_streams_uni = NULL,
+    .extend_max_stream_data = NULL,
+    .dcid_status = NULL,
+    .handshake_confirmed = NULL,
+    .recv_new_token = NULL,
+    .delete_crypto_aead_ctx = ngtcp2_crypto_delete_crypto_aead_ctx_cb,
+    .delete_crypto_cipher_ctx = ngtcp2_crypto_delete_crypto_cipher_ctx_cb,
+    .recv_datagram = quiclib_ngtcp2_recv_datagram,
+    .ack_datagram = quiclib_ngtcp2_ack_datagram,
+    .lost_datagram = NULL,
+    .get_path_challenge_data = ngtcp2_crypto_get_path_challenge_data_cb,
+    .stream_stop_sending = NULL,
+    .version_negotiation = ngtcp2_crypto_version_negotiation_cb,
+    .recv_rx_key = NULL,
+    .recv_tx_key = NULL,
+    .tls_early_data_rejected = NULL
+};
+
+#define CID_STR_LEN ((NGTCP2_MAX_CIDLEN * 2) + 1)
+#define NIBBLE_TO_HEX(nibble, out) \
+		if (nibble > 9) { \
+			out = nibble + 87; \
+		} else { \
+			out = nibble + 48; \
+		}
+
+void
+hextoascii (uint8_t in, char *out) {
+  uint8_t top_nibble = (in & 0xf0) >> 4;
+  uint8_t bottom_nibble = in & 0x0f;
+
+  NIBBLE_TO_HEX (top_nibble, out[0]);
+  NIBBLE_TO_HEX (bottom_nibble, out[1]);
+}
+
+gchar *
+quiclib_rawcidtostr (const uint8_t *cid, const size_t cidlen, gchar *buf)
+{
+  gsize i;
+
+  if (cidlen == 0) {
+    sprintf (buf, "(not present)");
+    return buf;
+  }
+
+  for (i = 0; i < cidlen; i++) {
+    hextoascii (cid[i], buf + i * 2);
+  }
+  buf[i * 2] = 0;
+  return buf;
+}
+
+/*
+ * Used for debugging only
+ */
+gchar *
+quiclib_cidtostr (ngtcp2_cid *cid, gchar *buf)
+{
+  return quiclib_rawcidtostr (cid->data, cid->datalen, buf);
+}
+
+/*
+ * OpenSSL callback definitions
+ */
+
+int
+quiclib_ssl_select_proto_cb (SSL *ssl, const unsigned char **out,
+    unsigned char *outlen, const unsigned char *in,
+    unsigned int inlen, void *arg)
+{
+  unsigned int len = 0;
+  /* Limited to 255 according to OpenSSL docs */
+  GSList *alpn, *src = NULL;
+  unsigned char *client_list;
+  int rv;
+  ngtcp2_crypto_conn_ref *conn_ref =
+      (ngtcp2_crypto_conn_ref *) SSL_get_app_data (ssl);
+  GstQuicLibTransportConnection *conn =
+      (GstQuicLibTransportConnection *) conn_ref->user_data;
+
+  if (conn->server) {
+    src = conn->server->acceptable_alpns;
+  } else {
+    gchar *alpn_str = g_strdup (conn->alpn);
+    src = g_slist_append (src, (gpointer) alpn_str);
+  }
+
+  alpn = src;
+  while (alpn != NULL) {
+    len += strlen ((gchar *) alpn->data) + 1;
+    alpn = alpn->next;
+  }
+
+  client_list = alloca (len);
+  alpn = src;
+  len = 0;
+  while (alpn != NULL) {
+    gchar *a = (gchar *) alpn->data;
+    client_list[len++] = strlen (a);
+    memcpy (client_list + len, a, strlen (a));
+    len += strlen (a);
+    alpn = alpn->next;
+  }
+
+  rv = SSL_select_next_proto ((unsigned char **) out, outlen, in, inlen,
+      client_list, len);
+
+  if (rv == OPENSSL_NPN_NEGOTIATED) {
+    conn->alpn = g_strndup ((const gchar *) *out, *outlen);
+  }
+
+  if (!conn->server) {
+    g_free (src->data);
+    g_slist_free (src);
+  }
+
+  if (rv == OPENSSL_NPN_NEGOTIATED) {
+    return SSL_TLSEXT_ERR_OK;
+  }
+
+  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      "Client did not present an acceptable ALPN: %.*s",
+      (int) inlen, (char *) in);
+
+  return SSL_TLSEXT_ERR_ALERT_FATAL;
+}
+
+/*
+ * Private use TLS extension carrying a striped connection's session ID, as 8
+ * bytes in network byte order, optionally followed by a byte of
+ * QUICLIB_STRIPE_FLAG_* flags. The client sends it in the client hello. If the
+ * client asked for any flags, the server echoes the ones it accepts as a
+ * single byte in its encrypted extensions.
+ */
+#define QUICLIB_TLS_EXT_STRIPE_ID 0xff5a
+
+/* Every datagram carries a QUICLIB_REDUNDANT_HEADER_LEN sequence number */
+#define QUICLIB_STRIPE_FLAG_REDUNDANT 0x01
+
+/**
+ * quiclib_ssl_stripe_id_add_cb
+ *
+ * Adds the stripe ID extension to a client hello, if the connection has one.
+ * On a server, echoes the flags it has accepted in the encrypted extensions.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static int
+quiclib_ssl_stripe_id_add_cb (SSL *ssl, unsigned int ext_type,
+    unsigned int context, const unsigned char **out, size_t *outlen, X509 *x,
+    size_t chainidx, int *al, void *add_arg)
+{
+  ngtcp2_crypto_conn_ref *conn_ref =
+      (ngtcp2_crypto_conn_ref *) SSL_get_app_data (ssl);
+  GstQuicLibTransportConnection *conn =
+      (GstQuicLibTransportConnection *) conn_ref->user_data;
+  guint8 *ext;
+
+  if (context & SSL_EXT_TLS1_3_ENCRYPTED_EXTENSIONS) {
+    if (!conn->stripe_redundant) {
+      return 0;
+    }
+
+    ext = g_malloc (1);
+    ext[0] = QUICLIB_STRIPE_FLAG_REDUNDANT;
+    *out = ext;
+    *outlen = 1;
+
+    return 1;
+  }
+
+  if (conn->stripe_id == 0) {
+    return 0;
+  }
+
+  ext = g_malloc (sizeof (guint64) + 1);
+  GST_WRITE_UINT64_BE (ext, conn->stripe_id);
+  *out = ext;
+  *outlen = sizeof (guint64);
+
+  if (conn->stripe_redundant_requested) {
+    ext[sizeof (guint64)] = QUICLIB_STRIPE_FLAG_REDUNDANT;
+    *outlen += 1;
+  }
+
+  return 1;
+}
+
+static void
+quiclib_ssl_stripe_id_free_cb (SSL *ssl, unsigned int ext_type,
+    unsigned int context, const unsigned char *out, void *add_arg)
+{
+  g_free ((gpointer) out);
+}
+
+/**
+ * quiclib_ssl_stripe_id_parse_cb
+ *
+ * Records the stripe ID and requested flags from a client hello on the
+ * server's connection, accepting redundant datagrams. On a client, records
+ * whether the server accepted them. A malformed extension fails the
+ * handshake.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static int
+quiclib_ssl_stripe_id_parse_cb (SSL *ssl, unsigned int ext_type,
+    unsigned int context, const unsigned char *in, size_t inlen, X509 *x,
+    size_t chainidx, int *al, void *parse_arg)
+{
+  ngtcp2_crypto_conn_ref *conn_ref =
+      (ngtcp2_crypto_conn_ref *) SSL_get_app_data (ssl);
+  GstQuicLibTransportConnection *conn =
+      (GstQuicLibTransportConnection *) conn_ref->user_data;
+
+  if (context & SSL_EXT_TLS1_3_ENCRYPTED_EXTENSIONS) {
+    if (inlen != 1) {
+      *al = SSL_AD_DECODE_ERROR;
+      return 0;
+    }
+
+    conn->stripe_redundant = conn->stripe_redundant_requested &&
+        (in[0] & QUICLIB_STRIPE_FLAG_REDUNDANT);
+
+    return 1;
+  }
+
+  if (inlen != sizeof (guint64) && inlen != sizeof (guint64) + 1) {
+    *al = SSL_AD_DECODE_ERROR;
+    return 0;
+  }
+
+  conn->stripe_id = GST_READ_UINT64_BE (in);
+  conn->stripe_redundant = inlen > sizeof (guint64) &&
+      (in[sizeof (guint64)] & QUICLIB_STRIPE_FLAG_REDUNDANT);
+
+  return 1;
+}
+
+#ifdef OPENSSL_DEBUG
+void
+quiclib_openssl_dbg_cb (int write_p, int version, int content_type,
+    const void *bufv, size_t len, SSL *ssl, void *arg)
+{
+  GstQuicLibTransportContext *ctx = GST_QUICLIB_TRANSPORT_CONTEXT (arg);
+  const unsigned char *buf = (const unsigned char *) bufv;
+
+  switch (content_type) {
+  case SSL3_RT_HEADER:
+    GST_TRACE_OBJECT (ctx, "OpenSSL debugging (%p): %s %s record header,"
+        " epoch %d, sequence number %04x%04x%04x", ssl, write_p == 1?"Sent":"Received",
+            version == TLS1_3_VERSION?"TLS 1.3":"NOT TLS 1.3", (buf[3] << 8 | buf[4]),
+                (buf[5] << 8 | buf[6]), (buf[7] << 8 | buf[8]), (buf[9] << 8 | buf[10]));
+    break;
+  case SSL3_RT_INNER_CONTENT_TYPE:
+  {
+    const gchar *ict;
+    switch (buf[0]) {
+    case SSL3_RT_CHANGE_CIPHER_SPEC:
+      ict = "ChangeCipherSpec";
+      break;
+    case SSL3_RT_ALERT:
+      ict = "Alert";
+      break;
+    case SSL3_RT_HANDSHAKE:
+      ict = "Handshake";
+      break;
+    case SSL3_RT_APPLICATION_DATA:
+      ict = "ApplicationData";
+      break;
+    default:
+      ict = "Unknown";
+    }
+
+    GST_TRACE_OBJECT (ctx,
+        "OpenSSL debugging (%p): %s %s inner content type %s", ssl,
+        write_p == 1?"Sent":"Received",
+            version == TLS1_3_VERSION?"TLS 1.3":"NOT TLS 1.3", ict);
+    break;
+  }
+  case SSL3_RT_HANDSHAKE:
+    GST_TRACE_OBJECT (ctx, "OpenSSL debugging (%p): %s %s handshake", ssl,
+        write_p == 1?"Sent":"Received",
+            version == TLS1_3_VERSION?"TLS 1.3":"NOT TLS 1.3");
+    break;
+  case SSL3_RT_CHANGE_CIPHER_SPEC:
+    GST_TRACE_OBJECT (ctx, "OpenSSL debugging (%p): %s %s ChangeCipherSpec",
+        ssl, write_p == 1?"Sent":"Received",
+            version == TLS1_3_VERSION?"TLS 1.3":"NOT TLS 1.3");
+    break;
+  case SSL3_RT_ALERT:
+    GST_TRACE_OBJECT (ctx, "OpenSSL debugging (%p): %s %s Alert: "
+        "Level \"%s\", description \"%s\"", ssl,
+        write_p == 1?"Sent":"Received",
+            version == TLS1_3_VERSION?"TLS 1.3":"NOT TLS 1.3",
+                SSL_alert_type_string_long (buf[0] << 8),
+                SSL_alert_desc_string_long (buf[1]));
+    break;
+  default:
+    GST_TRACE_OBJECT (ctx,
+        "OpenSSL debugging (%p): Unknown %s content type %d", ssl,
+        version == TLS1_3_VERSION?"TLS 1.3":"NOT TLS 1.3", content_type);
+  }
+}
+#endif
+
+void
+quiclib_ssl_keylog_cb (const SSL *ssl, const char *line)
+{
+  time_t curtime;
+  struct tm *curtm;
+  size_t sz;
+  char filename[PATH_MAX];
+  FILE *fp;
+  gchar cidstr[CID_STR_LEN];
+  ngtcp2_crypto_conn_ref *conn_ref =
+      (ngtcp2_crypto_conn_ref *) SSL_get_app_data (ssl);
+  GstQuicLibTransportConnection *conn =
+      (GstQuicLibTransportConnection *) conn_ref->user_data;
+  ngtcp2_cid *cid = (ngtcp2_cid *) g_list_first (conn->cids)->data;
+  const gchar *tls_export_dir = g_getenv ("GST_QUICLIB_TLS_EXPORT_DIR");
+
+  curtime = time(NULL);
+  curtm = localtime (&curtime);
+
+  snprintf (filename, PATH_MAX, "%s/%04d%02d%02d-%02d%02d%02d-%s.keys",
+      tls_export_dir, curtm->tm_year + 1900, curtm->tm_mon + 1,
+      curtm->tm_mday, curtm->tm_hour, curtm->tm_min, curtm->tm_sec,
+      quiclib_cidtostr (cid, cidstr));
+
+  fp = fopen (filename, "ab");
+  if (fp == NULL) {
+    GST_WARNING_OBJECT (GST_QUICLIB_TRANSPORT_CONNECTION (conn),
+        "Couldn't open TLS secrets file %s: %s", filename,
+        strerror (errno));
+    return;
+  }
+
+  sz = fprintf (fp, "%s:\n", line);
+  fclose (fp);
+
+  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONNECTION (conn),
+      "Wrote %ld bytes to TLS secrets file %s", sz, filename);
+}
+
+void
+quiclib_enable_tls_export (GstQuicLibTransportContext *ctx, SSL *ssl)
+{
+  const gchar *tls_export_dir = g_getenv ("GST_QUICLIB_TLS_EXPORT_DIR");
+
+  if (tls_export_dir) {
+    GStatBuf sb;
+    if (g_stat (tls_export_dir, &sb) == -1) {
+      if (g_mkdir_with_parents (tls_export_dir, 0700) == -1) {
+        GST_WARNING_OBJECT (ctx, "Couldn't create TLS export directory: %s",
+            strerror (errno));
+        return;
+      }
+    }
+
+    if (!(sb.st_mode & S_IFDIR)) {
+      GST_WARNING_OBJECT (ctx, "TLS export path %s is not a directory",
+          tls_export_dir);
+    }
+
+    GST_DEBUG_OBJECT (ctx, "Logging TLS secrets for connection to %s",
+        tls_export_dir);
+
+    SSL_CTX_set_keylog_callback (SSL_get_SSL_CTX (ssl), quiclib_ssl_keylog_cb);
+  }
+}
+
+/*
+ * ngtcp2 callback definitions
+ */
+void
+quiclib_ngtcp2_print (void *user_data, const char *format, ...)
+{
+  GstQuicLibTransportConnection *conn =
+      (GstQuicLibTransportConnection *) user_data;
+  va_list args;
+  va_start (args, format);
+  gst_debug_log_valist (GST_CAT_DEFAULT, GST_LEVEL_LOG, "ngtcp2",
+      conn->server?"server":"client", 0, G_OBJECT (conn), format, args);
+  va_end (args);
+}
+
+#define ASYNC_CALLBACKS 1
+
+const gchar *
+_quiclib_transport_callback_type_to_string (int type) {
+  switch (type) {
+    case CB_HANDSHAKE_COMPLETED: return "handshake completed";
+    case CB_STREAM_ACK: return "stream ACK";
+    case CB_STREAM_OPEN: return "stream open";
+    case CB_STREAM_CLOSE: return "stream close";
+    case CB_STREAM_RESET: return "stream reset";
+    case CB_DATAGRAM_ACK: return "datagram ACK";
+  }
+  return "unknown";
+}
+
+static gboolean
+_quiclib_transport_callback_source_prepare (GSource *source, gint *timeout)
+{
+  GstQuicLibTransportCallbackSource *cb_source =
+      (GstQuicLibTransportCallbackSource *) source;
+  GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (cb_source->conn),
+      "Prepare async callback of type %s",
+      _quiclib_transport_callback_type_to_string (cb_source->type));
+  return TRUE;
+}
+
+static gboolean
+_quiclib_transport_callback_source_dispatch (GSource *source, GSourceFunc cb,
+    gpointer user_data)
+{
+  GstQuicLibTransportCallbackSource *cb_source =
+      (GstQuicLibTransportCallbackSource *) source;
+  GstQuicLibTransportConnection * conn = cb_source->conn;
+  GstQuicLibTransportUserInterface *iface = QUICLIB_TRANSPORT_USER_GET_IFACE (
+      gst_quiclib_transport_context_get_user (conn));
+
+  GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      "Dispatching async callback of type %s",
+      _quiclib_transport_callback_type_to_string (cb_source->type));
+
+  switch (cb_source->type) {
+    case CB_HANDSHAKE_COMPLETED:
+      if (iface->handshake_complete != NULL) {
+        GstQuicLibTransportHandshakeCompleteCallbackSource *hc_source =
+            (GstQuicLibTransportHandshakeCompleteCallbackSource *) cb_source;
+        gboolean rv = iface->handshake_complete (
+            gst_quiclib_transport_context_get_user (conn),
+            &conn->parent, conn, G_INET_SOCKET_ADDRESS (hc_source->peer),
+            conn->alpn);
+        g_object_unref (hc_source->peer);
+        if (rv == FALSE) {
+          GST_WARNING_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+              "Transport user indicated handshake was unacceptable");
+          /* TODO: Tear down connection */
+        }
+      }
+      break;
+    case CB_STREAM_ACK:
+      /* TODO: Implement application buffer acknowledgements */
+      GST_FIXME_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+          "Need to implement app buffer acknowledgements");
+      break;
+    case CB_STREAM_OPEN:
+      if (iface->stream_opened != NULL) {
+        GstQuicLibTransportStreamIDCallbackSource *sid_source =
+            (GstQuicLibTransportStreamIDCallbackSource *) cb_source;
+        if (!iface->stream_opened (gst_quiclib_transport_context_get_user (conn),
+            GST_QUICLIB_TRANSPORT_CONTEXT (conn), sid_source->stream_id)) {
+          GST_FIXME_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+              "Need to implement closing stream async");
+        }
+      }
+      break;
+    case CB_STREAM_CLOSE:
+    case CB_STREAM_RESET:
+      if (iface->stream_closed != NULL) {
+        GstQuicLibTransportStreamIDCallbackSource *sid_source =
+            (GstQuicLibTransportStreamIDCallbackSource *) cb_source;
+        iface->stream_closed (gst_quiclib_transport_context_get_user (conn),
+            GST_QUICLIB_TRANSPORT_CONTEXT (conn), sid_source->stream_id);
+      }
+      break;
+    case CB_DATAGRAM_ACK:
+      /* TODO: Implement application buffer acknowledgements */
+      GST_FIXME_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+          "Need to implement app buffer acknowledgements");
+      break;
+  }
+
+  return FALSE; /* Don't keep this source around after firing */
+}
+
+static void
+_quiclib_transport_callback_source_finalize (GSource *source)
+{
+  GstQuicLibTransportCallbackSource *cb_source =
+      (GstQuicLibTransportCallbackSource *) source;
+
+  if (cb_source->conn_ref) {
+    g_object_unref (cb_source->conn);
+  }
+}
+
+static GSourceFuncs _quiclib_transport_callback_source_funcs = {
+    .prepare = _quiclib_transport_callback_source_prepare,
+    .check = NULL,
+    .dispatch = _quiclib_transport_callback_source_dispatch,
+    .finalize = _quiclib_transport_callback_source_finalize
+};
+
+/**
+ * _quiclib_transport_callback_source_attach
+ *
+ * Attaches @source to the async notification loop of @conn. A connection on
+ * a shared loop can be finalised while the loop runs on, so there @source
+ * holds a reference to @conn until it has been dispatched.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+_quiclib_transport_callback_source_attach (GstQuicLibTransportConnection *conn,
+    GstQuicLibTransportCallbackSource *source)
+{
+  GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (
+          GST_QUICLIB_TRANSPORT_CONTEXT (conn));
+
+  source->conn = conn;
+  source->conn_ref = priv->shared_loop != NULL;
+  if (source->conn_ref) {
+    g_object_ref (conn);
+  }
+
+  g_source_attach ((GSource *) source, priv->async_notif_loop_context);
+  g_source_unref ((GSource *) source);
+}
+
+void
+_quiclib_transport_run_handshake_complete_callback (
+    GstQuicLibTransportConnection *conn, GSocketAddress *sa)
+{
+  GstQuicLibTransportHandshakeCompleteCallbackSource *hc_source;
+
+  hc_source = (GstQuicLibTransportHandshakeCompleteCallbackSource *)
+      g_source_new (&_quiclib_transport_callback_source_funcs,
+          sizeof (GstQuicLibTransportHandshakeCompleteCallbackSource));
+
+  hc_source->peer = (GSocketAddress *) g_object_ref (G_OBJECT (sa));
+  hc_source->source.type = CB_HANDSHAKE_COMPLETED;
+
+  _quiclib_transport_callback_source_attach (conn, &hc_source->source);
+}
+
+void
+_quiclib_transport_run_stream_id_callback (GstQuicLibTransportConnection *conn,
+    int type, guint64 stream_id)
+{
+  GstQuicLibTransportStreamIDCallbackSource *sid_source;
+
+  sid_source = (GstQuicLibTransportStreamIDCallbackSource *)
+      g_source_new (&_quiclib_transport_callback_source_funcs,
+          sizeof (GstQuicLibTransportStreamIDCallbackSource));
+
+  sid_source->stream_id = stream_id;
+  sid_source->source.type = type;
+
+  _quiclib_transport_callback_source_attach (conn, &sid_source->source);
+}
+
+#define _quiclib_transport_run_stream_open_callback(conn, stream_id) \
+  _quiclib_transport_run_stream_id_callback (conn, CB_STREAM_OPEN, stream_id)
+
+#define _quiclib_transport_run_stream_close_callback(conn, stream_id) \
+  _quiclib_transport_run_stream_id_callback (conn, CB_STREAM_CLOSE, stream_id)
+
+#define _quiclib_transport_run_stream_reset_callback(conn, stream_id) \
+  _quiclib_transport_run_stream_id_callback (conn, CB_STREAM_RESET, stream_id)
+
+void
+_quiclib_transport_run_ack_callback (GstQuicLibTransportConnection *conn,
+    guint64 stream_id, guint64 offset)
+{
+  GstQuicLibTransportAckCallbackSource *ack_source;
+
+  ack_source = (GstQuicLibTransportAckCallbackSource *)
+      g_source_new (&_quiclib_transport_callback_source_funcs,
+          sizeof (GstQuicLibTransportAckCallbackSource));
+
+  ack_source->stream_id = stream_id;
+  ack_source->offset = offset;
+  ack_source->source.type =
+      (stream_id > QUICLIB_VARINT_MAX)?(CB_DATAGRAM_ACK):(CB_STREAM_ACK);
+
+  _quiclib_transport_callback_source_attach (conn, &ack_source->source);
+}
+
+/**
+ * quiclib_thread_rename
+ *
+ * Idle callback that renames the thread running the main context it was
+ * attached to. A thread can only reliably rename itself, so this is how the
+ * transport and async threads of a connection pick up their new names.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_thread_rename (gpointer user_data)
+{
+  const gchar *name = (const gchar *) user_data;
+  gint rv;
+
+  rv = pthread_setname_np (pthread_self (), name);
+  if (rv != 0) {
+    GST_WARNING ("Couldn't rename thread to %s: %s", name, g_strerror (rv));
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * quiclib_conn_name_threads
+ *
+ * Renames the threads of a client connection once its handshake has
+ * completed, adding the first two bytes of its SCID to the local port they
+ * were started with. That tells apart the threads of connections that share
+ * a local port, such as the stripes of a striped sink.
+ *
+ * Server threads serve every connection on the listener and the shared loops
+ * every idle connection in the process, so they keep their original names.
+ * The SCID of each connection is logged instead.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_conn_name_threads (GstQuicLibTransportConnection *conn)
+{
+  GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (
+          GST_QUICLIB_TRANSPORT_CONTEXT (conn));
+  ngtcp2_cid *cid;
+  GSocketAddress *local;
+  guint16 local_port;
+  gchar name[16];
+  GSource *source;
+
+  if (conn->cids == NULL) return;
+  cid = (ngtcp2_cid *) g_list_first (conn->cids)->data;
+
+  if (conn->server != NULL || priv->loop_thread == NULL || cid->datalen < 2) {
+    gchar cidstr[CID_STR_LEN];
+
+    GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Connection with SCID %s runs on a shared thread",
+        quiclib_cidtostr (cid, cidstr));
+    return;
+  }
+
+  local = g_socket_address_new_from_native (conn->path.path.local.addr,
+      conn->path.path.local.addrlen);
+  local_port = g_inet_socket_address_get_port (
+      G_INET_SOCKET_ADDRESS (local));
+  g_object_unref (local);
+
+  g_snprintf (name, sizeof (name), "qtx-c%u-%02x%02x", local_port,
+      cid->data[0], cid->data[1]);
+  source = g_idle_source_new ();
+  g_source_set_callback (source, quiclib_thread_rename, g_strdup (name),
+      g_free);
+  g_source_attach (source, priv->loop_context);
+  g_source_unref (source);
+
+  name[1] = 'a';
+  name[2] = 's';
+  source = g_idle_source_new ();
+  g_source_set_callback (source, quiclib_thread_rename, g_strdup (name),
+      g_free);
+  g_source_attach (source, priv->async_notif_loop_context);
+  g_source_unref (source);
+
+  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      "Renaming connection threads to qtx-c%u-%02x%02x and qas-c%u-%02x%02x",
+      local_port, cid->data[0], cid->data[1], local_port, cid->data[0],
+      cid->data[1]);
+}
+
+int
+quiclib_ngtcp2_handshake_completed (ngtcp2_conn *quic_conn, void *user_data)
+{
+  GstQuicLibTransportConnection *conn =
+      (GstQuicLibTransportConnection *) user_data;
+  GstQuicLibTransportUserInterface *iface =
+      QUICLIB_TRANSPORT_USER_GET_IFACE (
+          gst_quiclib_transport_context_get_user (conn));
+  const ngtcp2_transport_params *remote_params;
+
+  gst_quiclib_transport_context_set_state (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      QUIC_STATE_HANDSHAKE);
+
+  /* The client now only uses CIDs issued by this server */
+  if (conn->initial_dcid != NULL) {
+    conn->cids = g_list_remove (conn->cids, conn->initial_dcid);
+    quiclib_slab_free (&conn->cid_slab, conn->initial_dcid);
+    conn->initial_dcid = NULL;
+  }
+
+  remote_params = ngtcp2_conn_get_remote_transport_params (conn->quic_conn);
+
+  /*
+   * TODO: How to deal with early streams? Presumably these aren't accounted
+   * for in the remote params. This isn't a massive problem as the current
+   * implementation here only opens streams when the handshake is completed, but
+   * in the future that might change, or we might interop with someone else who
+   * does do early streams.
+   */
+  conn->bidi_remote_streams_remaining = remote_params->initial_max_streams_bidi;
+  conn->uni_remote_streams_remaining = remote_params->initial_max_streams_uni;
+
+  if (conn->alpn == NULL) {
+    const unsigned char *negotiated_alpn;
+    unsigned int negotiated_alpn_len;
+
+    SSL_get0_alpn_selected (conn->ssl, &negotiated_alpn, &negotiated_alpn_len);
+
+    if (negotiated_alpn == NULL || negotiated_alpn_len == 0) {
+      GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+          "Couldn't get negotiated ALPN from OpenSSL!");
+    } else {
+      conn->alpn = g_strndup ((gchar *) negotiated_alpn, negotiated_alpn_len);
+    }
+  }
+
+  gst_quiclib_transport_context_set_state (
+        GST_QUICLIB_TRANSPORT_CONTEXT (conn), QUIC_STATE_OPEN);
+
+  quiclib_probe_start (conn);
+
+  quiclib_conn_name_threads (conn);
+
+  if (iface->handshake_complete != NULL) {
+    GInetSocketAddress *sa = (GInetSocketAddress *)
+	          g_socket_address_new_from_native (conn->path.path.remote.addr,
+	              conn->path.path.remote.addrlen);
+    gboolean rv = iface->handshake_complete (
+        gst_quiclib_transport_context_get_user (conn),
+        &conn->parent, conn, sa, conn->alpn);
+    g_object_unref (sa);
+    if (rv == FALSE) {
+      GST_WARNING_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+          "Transport user indicated handshake was unacceptable");
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int
+quiclib_ngtcp2_recv_stream_data (ngtcp2_conn *quic_conn, uint32_t flags,
+    int64_t stream_id, uint64_t offset,
+    const uint8_t *data, size_t datalen,
+    void *user_data, void *stream_user_data)
+{
+  GstQuicLibTransportConnection *conn =
+      (GstQuicLibTransportConnection *) user_data;
+  GstQuicLibTransportUserInterface *iface =
+      QUICLIB_TRANSPORT_USER_GET_IFACE (
+          gst_quiclib_transport_context_get_user (conn));
+  gboolean fin = (flags & NGTCP2_STREAM_DATA_FLAG_FIN)?(TRUE):(FALSE);
+  GstBuffer *buffer;
+
+  GST_INFO_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      "Received %s%lu bytes on stream %ld", (fin)?("final "):(""), datalen,
+      stream_id);
+
+  /* An empty buffer will just carry the meta so as to close the stream */
+  buffer = quiclib_rx_buffer_new (conn->memory, data, datalen);
+
+  if (buffer == NULL) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Couldn't duplicate memory into a GstBuffer");
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+
+  buffer->pts = GST_CLOCK_TIME_NONE;
+  buffer->dts = GST_CLOCK_TIME_NONE;
+  buffer->duration = GST_CLOCK_TIME_NONE;
+  buffer->offset = offset;
+  buffer->offset_end = offset + datalen;
+
+  gst_buffer_add_quiclib_stream_meta (buffer, stream_id, offset, datalen, fin);
+
+  _quiclib_record_rx_delivery (conn);
+
+  if (quiclib_relay_stream_data (conn, buffer, stream_id, offset, fin)) {
+    gst_buffer_unref (buffer);
+    return 0;
+  }
+
+  iface->stream_data (gst_quiclib_transport_context_get_user (conn),
+      GST_QUICLIB_TRANSPORT_CONTEXT (conn), buffer);
+
+  return 0;
+}
+
+int
+quiclib_ngtcp2_recv_datagram (ngtcp2_conn *quic_conn, uint32_t flags,
+    const uint8_t *data, size_t datalen,
+    void *user_data)
+{
+  GstQuicLibTransportConnection *conn =
+      (GstQuicLibTransportConnection *) user_data;
+  GstQuicLibTransportUserInterface *iface =
+      QUICLIB_TRANSPORT_USER_GET_IFACE (
+          gst_quiclib_transport_context_get_user (conn));
+
+  GstBuffer *buffer;
+
+  GST_INFO_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      "Received QUIC datagram of size %lu bytes", datalen);
+
+  if (quiclib_probe_is_probe (conn, data, datalen)) {
+    GST_LOG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Discarding capacity probe datagram");
+    return 0;
+  }
+
+  if (quiclib_conn_memory_limited (conn)) {
+    GST_LOG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Over memory limit, dropping received datagram");
+    quiclib_mem_charge (&conn->memory->shed, 1);
+    return 0;
+  }
+
+  buffer = quiclib_rx_buffer_new (conn->memory, data, datalen);
+  if (buffer == NULL) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Couldn't duplicate memory into a GstBuffer");
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+
+  gst_buffer_add_quiclib_datagram_meta (buffer, datalen);
+
+  _quiclib_record_rx_delivery (conn);
+
+  if (quiclib_relay_datagram (conn, buffer)) {
+    gst_buffer_unref (buffer);
+    return 0;
+  }
+
+  iface->datagram_data (gst_quiclib_transport_context_get_user (conn),
+      GST_QUICLIB_TRANSPORT_CONTEXT (conn), buffer);
+  return 0;
+}
+
+int
+quiclib_ngtcp2_ack_stream (ngtcp2_conn *quic_conn, int64_t stream_id,
+    uint64_t offset, uint64_t datalen,
+    void *user_data, void *stream_user_data)
+{
+  GstQuicLibTransportConnection *conn =
+      (GstQuicLibTransportConnection *) user_data;
+  GstQuicLibStreamContext *stream =
+      (GstQuicLibStreamContext *) stream_user_data;
+  GstQuicLibTransportUserInterface *iface =
+      QUICLIB_TRANSPORT_USER_GET_IFACE (
+          gst_quiclib_transport_context_get_user (conn));
+  GList *bufs;
+
+  GST_LOG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Received ACK for stream %ld, for %lu bytes at offset %lu", stream_id,
+        datalen, offset);
+
+  conn->bwe.acked += datalen;
+  if (conn->probe.end != 0) {
+    conn->probe.acked += datalen;
+  }
+
+  g_mutex_lock (&stream->mutex);
+
+  bufs = g_list_first (stream->ack_bufs);
+  while (bufs != NULL) {
+    GstBuffer *sent_buf = (GstBuffer *) bufs->data;
+
+    if ((offset + datalen) >=
+        (sent_buf->offset + gst_buffer_get_size (sent_buf))) {
+      GST_LOG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+          "Dropping acknowledged buffer for stream %ld, length %lu at offset "
+          "%lu", stream_id, gst_buffer_get_size (sent_buf), sent_buf->offset);
+
+      if (iface->stream_ackd) {
+        iface->stream_ackd (gst_quiclib_transport_context_get_user (conn),
+            GST_QUICLIB_TRANSPORT_CONTEXT (conn), (guint64) stream_id,
+            (gsize) offset, sent_buf);
+      }
+
+      quiclib_mem_charge (&conn->memory->retained,
+          -(gssize) gst_buffer_get_size (sent_buf));
+      gst_buffer_unref (sent_buf);
+      bufs = stream->ack_bufs = g_list_delete_link (stream->ack_bufs, bufs);
+    } else {
+      bufs = bufs->next;
+    }
+  }
+
+  if (stream->state == QUIC_STREAM_CLOSED_BOTH && stream->ack_bufs == NULL) {
+    g_mutex_unlock (&stream->mutex);
+    g_hash_table_remove (conn->streams, &stream_id);
+  } else {
+    g_mutex_unlock (&stream->mutex);
+  }
+
+  /* Acknowledged data may have opened the window for queued relay data */
+  if (conn->relay_upstreams != NULL) {
+    quiclib_relay_schedule_flushes (conn);
+  }
+
+  return 0;
+}
+
+int
+quiclib_ngtcp2_ack_datagram (ngtcp2_conn *quic_conn, uint64_t dgram_id,
+    void *user_data)
+{
+  GstQuicLibTransportConnection *conn =
+      (GstQuicLibTransportConnection *) user_data;
+  GstQuicLibTransportUserInterface *iface =
+      QUICLIB_TRANSPORT_USER_GET_IFACE (
+          gst_quiclib_transport_context_get_user (conn));
+
+  QuicLibDatagramAck *ack;
+  GstBuffer *buf;
+
+  GST_LOG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      "Received ACK for datagram %lu", dgram_id);
+
+  if (!g_hash_table_lookup_extended (conn->datagrams_awaiting_ack, &dgram_id,
+      NULL, (gpointer *) &ack)) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Couldn't find matching buffer for datagram ticket %lu?", dgram_id);
+    return 0;
+  }
+
+  buf = ack->buf;
+
+  conn->bwe.acked += gst_buffer_get_size (buf);
+
+  if (buf == conn->probe.buf) {
+    conn->probe.acked += gst_buffer_get_size (buf);
+  } else if (iface->datagram_ackd) {
+    iface->datagram_ackd (gst_quiclib_transport_context_get_user (conn),
+        GST_QUICLIB_TRANSPORT_CONTEXT (conn), buf);
+  }
+
+  g_hash_table_remove (conn->datagrams_awaiting_ack, (gconstpointer) &dgram_id);
+
+  return 0;
+}
+
+/**
+ * Allocates the local stream context, and will extend the maximum number of
+ * streams the remote endpoint can open if required.
+ */
+gboolean
+quiclib_alloc_stream_context (GstQuicLibTransportConnection *conn,
+    gint64 stream_id)
+{
+  gboolean rv;
+  GstQuicLibStreamContext *stream = g_new0 (GstQuicLibStreamContext, 1);
+
+  g_mutex_init (&stream->mutex);
+  stream->memory = conn->memory;
+
+  stream->state = QUIC_STREAM_OPEN;
+  if ((conn->server && QUICLIB_STREAM_IS_UNI_CLIENT (stream_id)) ||
+      QUICLIB_STREAM_IS_UNI_SERVER (stream_id)) {
+    stream->state |= QUIC_STREAM_CLOSED_SENDING;
+  } else if (QUICLIB_STREAM_IS_UNI (stream_id)) {
+    stream->state |= QUIC_STREAM_CLOSED_READING;
+  }
+
+  stream->last_offset = 0;
+  stream->dscp = -1;
+  g_queue_init (&stream->shaped);
+
+  /*
+   * If this is a remote stream opening, check whether we need to permit more
+   * streams from the peer.
+   */
+  if ((conn->server && QUICLIB_STREAM_IS_CLIENT_INIT (stream_id)) ||
+      (QUICLIB_STREAM_IS_SERVER_INIT (stream_id))) {
+    gst_quiclib_transport_context_lock (conn);
+
+    GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn), "Streams remaining "
+        "bidi: %lu, uni: %lu. Max streams bidi: %lu, uni: %lu",
+        conn->bidi_remote_streams_remaining, conn->uni_remote_streams_remaining,
+        conn->transport_params.initial_max_streams_bidi,
+        conn->transport_params.initial_max_streams_uni);
+
+    if (QUICLIB_STREAM_IS_BIDI (stream_id)) {
+      if (--conn->bidi_remote_streams_remaining <
+          conn->transport_params.initial_max_streams_bidi / 2) {
+        ngtcp2_conn_extend_max_streams_bidi (conn->quic_conn,
+            conn->transport_params.initial_max_streams_bidi);
+        conn->bidi_remote_streams_remaining =
+            conn->transport_params.initial_max_streams_bidi;
+      }
+    } else {
+      if (--conn->uni_remote_streams_remaining <
+          conn->transport_params.initial_max_streams_uni / 2) {
+        ngtcp2_conn_extend_max_streams_uni (conn->quic_conn,
+            conn->transport_params.initial_max_streams_uni);
+        conn->uni_remote_streams_remaining =
+            conn->transport_params.initial_max_streams_uni;
+      }
+    }
+  }
+
+  stream->stream_id = stream_id;
+
+  if (ngtcp2_conn_set_stream_user_data (conn->quic_conn, stream_id, stream)
+      != 0) {
+    g_free (stream);
+    rv = FALSE;
+  } else {
+    rv = g_hash_table_replace (conn->streams, &stream->stream_id, stream);
+  }
+
+  gst_quiclib_transport_context_unlock (conn);
+
+  return rv;
+}
+
+/**
+ * Implements the ngtcp2_stream_open callback. Called when a remote stream is
+ * opened by the peer.
+ *
+ * Sends a stream opened event to the instance owner via callback. If the
+ * callback returns FALSE, then the owner rejects the stream and it is not
+ * opened.
+ */
+int
+quiclib_ngtcp2_on_stream_open (ngtcp2_conn *quic_conn, int64_t stream_id,
+    void *user_data)
+{
+  GstQuicLibTransportConnection *conn =
+      (GstQuicLibTransportConnection *) user_data;
+#ifndef ASYNC_CALLBACKS
+  GstQuicLibTransportUserInterface *iface =
+      QUICLIB_TRANSPORT_USER_GET_IFACE (
+          gst_quiclib_transport_context_get_user (conn));
+#endif
+  gboolean rv = TRUE;
+
+  switch (stream_id & 0x3) {
+    case 0x0: conn->last_client_bidi_stream_id = (guint64) stream_id; break;
+    case 0x1: conn->last_server_bidi_stream_id = (guint64) stream_id; break;
+    case 0x2: conn->last_client_uni_stream_id = (guint64) stream_id; break;
+    case 0x3: conn->last_server_uni_stream_id = (guint64) stream_id; break;
+  }
+
+#ifdef ASYNC_CALLBACKS
+  _quiclib_transport_run_stream_open_callback (conn, stream_id);
+#else
+  if (iface->stream_opened != NULL) {
+    rv = iface->stream_opened (gst_quiclib_transport_context_get_user (conn),
+        GST_QUICLIB_TRANSPORT_CONTEXT (conn), stream_id);
+  }
+#endif
+
+  if (rv == TRUE) {
+    rv = quiclib_alloc_stream_context (conn, stream_id);
+  } else {
+    GST_WARNING_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "User did not agree to open stream %ld", stream_id);
+  }
+
+  return (rv == TRUE)?(0):(NGTCP2_ERR_CALLBACK_FAILURE);
+}
+
+/**
+ * Implements the ngtcp2_stream_close callback.
+ */
+int
+quiclib_ngtcp2_on_stream_close (ngtcp2_conn *quic_conn, uint32_t flags,
+    int64_t stream_id, uint64_t app_error_code,
+    void *user_data, void *stream_user_data)
+{
+  GstQuicLibTransportConnection *conn =
+      (GstQuicLibTransportConnection *) user_data;
+  GstQuicLibStreamContext *stream =
+      (GstQuicLibStreamContext *) stream_user_data;
+#ifndef ASYNC_CALLBACKS
+  GstQuicLibTransportUserInterface *iface =
+      QUICLIB_TRANSPORT_USER_GET_IFACE (
+          gst_quiclib_transport_context_get_user (conn));
+#endif
+
+  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      "Stream %ld is closed", stream_id);
+
+#ifdef ASYNC_CALLBACKS
+  _quiclib_transport_run_stream_close_callback (conn, stream_id);
+#else
+  if (iface->stream_closed != NULL) {
+    iface->stream_closed (gst_quiclib_transport_context_get_user (conn),
+        GST_QUICLIB_TRANSPORT_CONTEXT (conn), stream_id);
+  }
+#endif
+
+  g_mutex_lock (&stream->mutex);
+  stream->state = QUIC_STREAM_CLOSED_BOTH;
+  if (stream->ack_bufs == NULL) {
+    g_mutex_unlock (&stream->mutex);
+    g_hash_table_remove (conn->streams, &stream_id);
+  } else {
+    g_mutex_unlock (&stream->mutex);
+  }
+
+  return 0;
+}
+
+/*
+ * Implements the ngtcp2_on_stream_reset callback.
+ */
+int
+quiclib_ngtcp2_on_stream_reset (ngtcp2_conn *quic_conn, int64_t stream_id,
+    uint64_t final_size, uint64_t app_error_code, void *user_data,
+    void *stream_user_data)
+{
+  GstQuicLibTransportConnection *conn =
+      (GstQuicLibTransportConnection *) user_data;
+  GstQuicLibStreamContext *stream =
+      (GstQuicLibStreamContext *) stream_user_data;
+#ifndef ASYNC_CALLBACKS
+  GstQuicLibTransportUserInterface *iface =
+      QUICLIB_TRANSPORT_USER_GET_IFACE (
+          gst_quiclib_transport_context_get_user (conn));
+#endif
+
+  GST_INFO_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      "Stream %ld was reset after %lu bytes with error code %lu", stream_id,
+      final_size, app_error_code);
+
+  quiclib_relay_stream_reset (conn, stream_id, app_error_code);
+
+#ifdef ASYNC_CALLBACKS
+  _quiclib_transport_run_stream_reset_callback (conn, stream_id);
+#else
+  if (iface->stream_closed != NULL) {
+    iface->stream_closed (gst_quiclib_transport_context_get_user (conn),
+        GST_QUICLIB_TRANSPORT_CONTEXT (conn), stream_id);
+  }
+#endif
+
+  g_mutex_lock (&stream->mutex);
+  stream->state = QUIC_STREAM_CLOSED_BOTH;
+  g_mutex_unlock (&stream->mutex);
+
+  return 0;
+}
+
+/**
+ * Implements the ngtcp2_rand callback. Simply a wrapper around the OpenSSL
+ * RAND_bytes function. The ngtcp2_rand_ctx is ignored (it is never set anyway)
+ */
+void
+quiclib_ngtcp2_rand (uint8_t *dest, size_t destlen, const ngtcp2_rand_ctx *ctx)
+{
+  RAND_bytes (dest, destlen);
+}
+
+/**
+ * quiclib_generate_cid_for
+ *
+ * Fills @cid with a new connection ID of @cidlen octets for @ctx, or of the
+ * length @server's CID generator makes if @cidlen is 0. @server's CID
+ * generator is used if it has one for CIDs of that length, and RAND_bytes
+ * otherwise. @server is NULL for client connections.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_generate_cid_for (GstQuicLibTransportContext *ctx,
+    GstQuicLibServerContext *server, ngtcp2_cid *cid, gsize cidlen)
+{
+  gboolean generated = FALSE;
+
+  if (server != NULL) {
+    GstQuicLibTransportContextPrivate *priv =
+        gst_quiclib_transport_context_get_instance_private (
+            GST_QUICLIB_TRANSPORT_CONTEXT (server));
+
+    g_mutex_lock (&priv->cid_generator_mutex);
+    if (priv->cid_generator != NULL) {
+      if (cidlen == 0) {
+        cidlen = priv->cid_generator_len;
+      }
+
+      if (cidlen == priv->cid_generator_len) {
+        if (!priv->cid_generator (cid->data, cidlen,
+            priv->cid_generator_data)) {
+          g_mutex_unlock (&priv->cid_generator_mutex);
+          GST_ERROR_OBJECT (ctx,
+              "CID generator failed to make a CID of length %lu", cidlen);
+          return FALSE;
+        }
+        generated = TRUE;
+      }
+    }
+    g_mutex_unlock (&priv->cid_generator_mutex);
+  }
+
+  /* The length of the CIDs a server picks for itself without a generator */
+  if (cidlen == 0) {
+    cidlen = 18;
+  }
+
+  if (!generated && RAND_bytes (cid->data, (int) cidlen) != 1) {
+    GST_ERROR_OBJECT (ctx,
+        "Couldn't generate a new CID of length %lu with RAND_bytes: %s",
+        cidlen, ERR_error_string (ERR_get_error (), NULL));
+    return FALSE;
+  }
+
+  cid->datalen = cidlen;
+
+  return TRUE;
+}
+
+/**
+ * quiclib_generate_cid
+ *
+ * Fills @cid with a new connection ID of @cidlen octets for @conn, as
+ * quiclib_generate_cid_for does for @conn's server.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_generate_cid (GstQuicLibTransportConnection *conn, ngtcp2_cid *cid,
+    gsize cidlen)
+{
+  return quiclib_generate_cid_for (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      conn->server, cid, cidlen);
+}
+
+/**
+ * quiclib_conn_set_preferred_addr
+ *
+ * Fills the preferred_address transport parameter of the new server connection
+ * @conn from the preferred addresses of its server, with a CID and stateless
+ * reset token of its own for clients to use once they have moved. Leaves the
+ * parameter out if the server has no preferred address.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_conn_set_preferred_addr (GstQuicLibTransportConnection *conn)
+{
+  GstQuicLibServerContext *server = conn->server;
+  ngtcp2_preferred_addr *paddr = &conn->transport_params.preferred_addr;
+  gchar cidstr[CID_STR_LEN];
+
+  conn->transport_params.preferred_addr_present = 0;
+
+  if (server->preferred_addr_ipv4 == NULL &&
+      server->preferred_addr_ipv6 == NULL) {
+    return TRUE;
+  }
+
+  memset (paddr, 0, sizeof (ngtcp2_preferred_addr));
+
+  if (server->preferred_addr_ipv4 != NULL) {
+    if (!g_socket_address_to_native (server->preferred_addr_ipv4,
+        &paddr->ipv4, sizeof (paddr->ipv4), NULL)) {
+      return FALSE;
+    }
+    paddr->ipv4_present = 1;
+  }
+
+  if (server->preferred_addr_ipv6 != NULL) {
+    if (!g_socket_address_to_native (server->preferred_addr_ipv6,
+        &paddr->ipv6, sizeof (paddr->ipv6), NULL)) {
+      return FALSE;
+    }
+    paddr->ipv6_present = 1;
+  }
+
+  if (!quiclib_generate_cid (conn, &paddr->cid, 0)) {
+    return FALSE;
+  }
+
+  if (RAND_bytes (paddr->stateless_reset_token,
+      NGTCP2_STATELESS_RESET_TOKENLEN) != 1) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "OpenSSL RAND_bytes failed to generate a stateless reset token for "
+        "the preferred address: %s", ERR_error_string (ERR_get_error (), NULL));
+    return FALSE;
+  }
+
+  conn->transport_params.preferred_addr_present = 1;
+
+  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      "Advertising preferred address with CID %s",
+      quiclib_cidtostr (&paddr->cid, cidstr));
+
+  return TRUE;
+}
+
+/**
+ * Implements the ngtcp2_get_new_connection_id callback. Generates new
+ * connection IDs with quiclib_generate_cid, and tokens with OpenSSL
+ * RAND_bytes, on request.
+ */
+int
+quiclib_ngtcp2_get_new_connection_id (ngtcp2_conn *quic_conn, ngtcp2_cid *cid,
+    uint8_t *token, size_t cidlen,
+    void *user_data)
+{
+  GstQuicLibTransportConnection *conn =
+      (GstQuicLibTransportConnection *) user_data;
+  ngtcp2_cid *lcid;
+
+  if (!quiclib_generate_cid (conn, cid, cidlen)) {
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+
+  if (gst_debug_category_get_threshold (quiclib_transport) >= GST_LEVEL_TRACE)
+  {
+    gchar cid_str[CID_STR_LEN], *sa_str;
+    GSocketAddress *sa = g_socket_address_new_from_native (
+        (struct sockaddr *) &conn->path.remote_addrbuf,
+        sizeof (ngtcp2_sockaddr_union));
+
+    sa_str = g_socket_connectable_to_string (G_SOCKET_CONNECTABLE (sa));
+
+    GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Generated new CID for peer %s: %s", sa_str,
+        quiclib_cidtostr (cid, cid_str));
+
+    g_free (sa_str);
+  }
+
+  if (token != NULL &&
+      RAND_bytes (token, NGTCP2_STATELESS_RESET_TOKENLEN) != 1) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn), "Couldn't generate a "
+        "new stateless reset token of length %d with RAND_bytes: %s",
+        NGTCP2_STATELESS_RESET_TOKENLEN,
+        ERR_error_string (ERR_get_error (), NULL));
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+
+  /* Make a copy as *cid seems to be allocated on the stack */
+  lcid = quiclib_slab_alloc (&conn->cid_slab);
+  memcpy (lcid->data, cid->data, cid->datalen);
+  lcid->datalen = cid->datalen;
+  conn->cids = g_list_append (conn->cids, (gpointer) lcid);
+
+  return 0;
+}
+
+/**
+ * Implements the ngtcp2_remove_connection_id callback. Retires old connection
+ * IDs.
+ */
+int
+quiclib_ngtcp2_remove_connection_id (ngtcp2_conn *quic_conn,
+    const ngtcp2_cid *cid, void *user_data)
+{
+  GstQuicLibTransportConnection *conn =
+      (GstQuicLibTransportConnection *) user_data;
+  GList *it, *next;
+
+  for (it = conn->cids; it != NULL; it = next) {
+    next = it->next;
+    if (((ngtcp2_cid *) it->data)->datalen == cid->datalen &&
+        memcmp (((ngtcp2_cid *) it->data)->data, cid->data, cid->datalen) == 0)
+    {
+      quiclib_slab_free (&conn->cid_slab, it->data);
+      conn->cids = g_list_delete_link (conn->cids, it);
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * quiclib_migration_finish
+ *
+ * Adopts the socket of a validated migration path in place of the old one, or
+ * closes it if validation failed. This runs from the connection's loop rather
+ * than from the path_validation callback, which can be called while the socket
+ * that is about to be closed is being read from.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_migration_finish (gpointer user_data)
+{
+  GstQuicLibTransportConnection *conn =
+      GST_QUICLIB_TRANSPORT_CONNECTION (user_data);
+  QuicLibSocketContext *old_socket;
+
+  gst_quiclib_transport_context_lock (conn);
+
+  if (conn->migration_socket == NULL) {
+    gst_quiclib_transport_context_unlock (conn);
+    return G_SOURCE_REMOVE;
+  }
+
+  if (conn->migration_result == NGTCP2_PATH_VALIDATION_RESULT_SUCCESS) {
+    old_socket = conn->socket;
+    conn->socket = conn->migration_socket;
+
+    ngtcp2_path_storage_init (&conn->path,
+        conn->migration_path.path.local.addr,
+        conn->migration_path.path.local.addrlen,
+        conn->migration_path.path.remote.addr,
+        conn->migration_path.path.remote.addrlen, (void *) conn);
+
+    g_clear_object (&conn->bind_addr);
+    conn->bind_addr = g_socket_address_new_from_native (
+        conn->migration_path.path.local.addr,
+        conn->migration_path.path.local.addrlen);
+  } else {
+    old_socket = conn->migration_socket;
+  }
+
+  conn->migration_socket = NULL;
+  ngtcp2_path_storage_zero (&conn->migration_path);
+
+  gst_quiclib_transport_context_unlock (conn);
+
+  quiclib_socket_context_destroy (old_socket);
+
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * Implements the ngtcp2_path_validation callback. For a client, this finishes
+ * a migration started by gst_quiclib_transport_client_migrate or by the server
+ * advertising a preferred address.
+ */
+int
+quiclib_ngtcp2_path_validation (ngtcp2_conn *quic_conn, uint32_t flags,
+    const ngtcp2_path *path, const ngtcp2_path *fallback_path,
+    ngtcp2_path_validation_result res, void *user_data)
+{
+  GstQuicLibTransportConnection *conn =
+      (GstQuicLibTransportConnection *) user_data;
+  GSource *source;
+
+  if (gst_debug_category_get_threshold (quiclib_transport) >= GST_LEVEL_INFO)
+  {
+    GSocketAddress *local, *remote;
+    gchar *local_str, *remote_str;
+
+    local = g_socket_address_new_from_native (path->local.addr,
+        path->local.addrlen);
+    remote = g_socket_address_new_from_native (path->remote.addr,
+        path->remote.addrlen);
+    local_str = g_socket_connectable_to_string (G_SOCKET_CONNECTABLE (local));
+    remote_str =
+        g_socket_connectable_to_string (G_SOCKET_CONNECTABLE (remote));
+
+    GST_INFO_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Validation of path from %s to %s %s", local_str, remote_str,
+        (res == NGTCP2_PATH_VALIDATION_RESULT_SUCCESS) ?
+            "succeeded" : "failed");
+
+    g_free (local_str);
+    g_free (remote_str);
+    g_object_unref (local);
+    g_object_unref (remote);
+  }
+
+  if (!quiclib_conn_is_migration_local (conn, &path->local)) {
+    return 0;
+  }
+
+  conn->migration_result = res;
+
+  source = g_idle_source_new ();
+  g_source_set_callback (source, quiclib_migration_finish,
+      g_object_ref (conn), g_object_unref);
+  g_source_attach (source, gst_quiclib_transport_context_get_loop_context (
+      GST_QUICLIB_TRANSPORT_CONTEXT (conn)));
+  g_source_unref (source);
+
+  return 0;
+}
+
+/**
+ * Implements the ngtcp2_select_preferred_addr callback. If the server has a
+ * preferred address in the same family as the current path, a socket is
+ * connected to it and @dest set to the new path, which ngtcp2 then validates.
+ * quiclib_ngtcp2_path_validation moves the connection over to the new socket
+ * once it has, just as for a client-initiated migration. Otherwise @dest is
+ * left alone and the connection stays on the address it connected to.
+ */
+int
+quiclib_ngtcp2_select_preferred_addr (ngtcp2_conn *quic_conn,
+    ngtcp2_path *dest, const ngtcp2_preferred_addr *paddr, void *user_data)
+{
+  GstQuicLibTransportConnection *conn =
+      (GstQuicLibTransportConnection *) user_data;
+  GstQuicLibTransportContext *ctx = GST_QUICLIB_TRANSPORT_CONTEXT (conn);
+  const ngtcp2_path *path = ngtcp2_conn_get_path (quic_conn);
+  GSocketAddress *remote = NULL, *local = NULL;
+  QuicLibSocketContext *socket_ctx;
+  gchar *remote_str;
+
+  switch (path->remote.addr->sa_family) {
+  case AF_INET:
+    if (paddr->ipv4_present) {
+      remote = g_socket_address_new_from_native ((gpointer) &paddr->ipv4,
+          sizeof (paddr->ipv4));
+    }
+    break;
+  case AF_INET6:
+    if (paddr->ipv6_present) {
+      remote = g_socket_address_new_from_native ((gpointer) &paddr->ipv6,
+          sizeof (paddr->ipv6));
+    }
+    break;
+  }
+
+  if (remote == NULL) {
+    GST_INFO_OBJECT (ctx, "Server has no preferred address in the family of "
+        "the current path, staying on it");
+    return 0;
+  }
+
+  if (conn->migration_socket != NULL) {
+    GST_INFO_OBJECT (ctx, "Not moving to the server's preferred address while "
+        "another migration is in progress");
+    g_object_unref (remote);
+    return 0;
+  }
+
+  /*
+   * Keep to the interface that the connection was bound to, if any, but let
+   * the kernel choose a new port as the old one is still in use.
+   */
+  if (conn->bind_addr != NULL) {
+    local = g_inet_socket_address_new (g_inet_socket_address_get_address (
+        G_INET_SOCKET_ADDRESS (conn->bind_addr)), 0);
+  }
+
+  socket_ctx = quiclib_conn_open_path_socket (conn, local, remote,
+      &conn->migration_path);
+
+  remote_str = g_socket_connectable_to_string (G_SOCKET_CONNECTABLE (remote));
+
+  if (socket_ctx == NULL) {
+    GST_WARNING_OBJECT (ctx, "Couldn't open a socket to the server's "
+        "preferred address %s, staying on the current path", remote_str);
+    ngtcp2_path_storage_zero (&conn->migration_path);
+  } else {
+    GST_INFO_OBJECT (ctx, "Moving to the server's preferred address %s",
+        remote_str);
+
+    ngtcp2_addr_copy_byte (&dest->local, conn->migration_path.path.local.addr,
+        conn->migration_path.path.local.addrlen);
+    ngtcp2_addr_copy_byte (&dest->remote,
+        conn->migration_path.path.remote.addr,
+        conn->migration_path.path.remote.addrlen);
+    conn->migration_socket = socket_ctx;
+  }
+
+  g_free (remote_str);
+  if (local != NULL) g_object_unref (local);
+  g_object_unref (remote);
+
+  return 0;
+}
+
+/*
+ * Implements the ngtcp2_crypto_get_conn callback.
+ */
+ngtcp2_conn *
+quiclib_get_ngtcp2_conn (ngtcp2_crypto_conn_ref *conn_ref)
+{
+  GstQuicLibTransportConnection *conn =
+      (GstQuicLibTransportConnection *) conn_ref->user_data;
+  return conn->quic_conn;
+}
+
+/*
+ * ngtcp2 callbacks end
+ */
+
+/*
+ * ngtcp2 utility functions
+ */
+
+/**
+ * Get the current time in nanoseconds.
+ */
+guint64
+quiclib_ngtcp2_timestamp (void)
+{
+  struct timespec tp;
+  if (clock_gettime (CLOCK_MONOTONIC, &tp) != 0) {
+    return UINT64_MAX;
+  }
+  return (guint64) tp.tv_sec * NGTCP2_SECONDS + (guint64) tp.tv_nsec;
+}
+
+ssize_t
+quiclib_ngtcp2_get_stream_window (GstQuicLibTransportConnection *conn,
+    int64_t stream_id)
+{
+  uint64_t cwnd, swnd;
+
+  gst_quiclib_transport_context_lock (conn);
+
+  cwnd = ngtcp2_conn_get_cwnd_left (conn->quic_conn);
+  if (stream_id >= 0) {
+    swnd = ngtcp2_conn_get_max_stream_data_left (conn->quic_conn,
+        stream_id);
+
+    /*g_assert (swnd != 0);*/
+
+    if (cwnd > swnd) {
+      cwnd = swnd;
+    }
+  }
+
+  gst_quiclib_transport_context_unlock (conn);
+
+  return cwnd;
+}
+
+gboolean
+quiclib_timer_expired (gpointer user_data)
+{
+  GstQuicLibTransportConnection *conn =
+      (GstQuicLibTransportConnection *) user_data;
+  int rv;
+
+  gst_quiclib_transport_context_lock (conn);
+
+  rv = ngtcp2_conn_handle_expiry (conn->quic_conn,
+      quiclib_conn_timestamp (conn, quiclib_ngtcp2_timestamp ()));
+
+  if (rv != 0) {
+    gst_quiclib_transport_disconnect (conn, FALSE,
+        QUICLIB_CLOSE_INTERNAL_ERROR);
+  }
+
+  gst_quiclib_transport_context_unlock (conn);
+
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * End ngtcp2 utility functions
+ */
+
+/**
+ * quiclib_track_datagram_ack
+ *
+ * Holds a reference to @buf in datagrams_awaiting_ack until the datagram with
+ * ticket @datagram_id is acknowledged.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_track_datagram_ack (GstQuicLibTransportConnection *conn,
+    guint64 datagram_id, GstBuffer *buf)
+{
+  QuicLibDatagramAck *ack = quiclib_slab_alloc (&conn->dgram_slab);
+
+  ack->ticket = (gint64) datagram_id;
+  ack->buf = gst_buffer_ref (buf);
+  ack->slab = &conn->dgram_slab;
+  ack->memory = conn->memory;
+  quiclib_mem_charge (&conn->memory->datagrams,
+      (gssize) gst_buffer_get_size (buf));
+
+  return g_hash_table_replace (conn->datagrams_awaiting_ack, &ack->ticket,
+      ack);
+}
+
+void
+quiclib_store_datagram_ack_ref (GstQuicLibTransportConnection *conn,
+    guint64 datagram_id, GstBuffer *orig)
+{
+  GstQuicLibTransportUserInterface *iface =
+      QUICLIB_TRANSPORT_USER_GET_IFACE (
+          gst_quiclib_transport_context_get_user (conn));
+  if (iface->datagram_ackd == NULL) return;
+
+  if (!quiclib_track_datagram_ack (conn, datagram_id, orig)) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Couldn't add datagram buffer to awaiting ack hashtable");
+  }
+}
+
+gboolean
+quiclib_cancel_timer (GstQuicLibTransportContext *ctx)
+{
+  GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (ctx);
+
+  if (priv->timeout) {
+    g_source_destroy (priv->timeout);
+    g_source_unref (priv->timeout);
+    priv->timeout = NULL;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+gboolean
+quiclib_set_timer (GstQuicLibTransportContext *ctx, GSourceFunc cb,
+    guint msec)
+{
+  GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (ctx);
+
+  GST_DEBUG_OBJECT (ctx, "Setting %s timer for %u msec",
+      (priv->timeout)?("replacement"):("new"), msec);
+
+  quiclib_cancel_timer (ctx);
+
+  priv->timeout = g_timeout_source_new (msec);
+  g_source_set_callback (priv->timeout, cb, ctx, NULL);
+  g_source_attach (priv->timeout, priv->loop_context);
+
+  return TRUE;
+}
+
+/*
+ * The shortest wait that an idle connection's timer is coarsened for. Below
+ * this, rounding to whole seconds would hold back the expiry by too much of
+ * the wait.
+ */
+#define QUICLIB_IDLE_TIMER_MIN_SEC 2
+
+/**
+ * quiclib_idle_timer_expired
+ *
+ * Callback for the timer set by quiclib_set_idle_timer. GLib may fire a
+ * seconds timer up to a quarter of a second early, in which case the rest of
+ * the wait is timed exactly.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_idle_timer_expired (gpointer user_data)
+{
+  GstQuicLibTransportConnection *conn =
+      (GstQuicLibTransportConnection *) user_data;
+  ngtcp2_tstamp expiry, now;
+
+  gst_quiclib_transport_context_lock (conn);
+
+  expiry = ngtcp2_conn_get_expiry (conn->quic_conn);
+  now = quiclib_ngtcp2_timestamp ();
+
+  if (expiry > now) {
+    quiclib_set_timer (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        quiclib_timer_expired, (expiry - now) / NGTCP2_MILLISECONDS + 1);
+  } else {
+    quiclib_timer_expired (conn);
+  }
+
+  gst_quiclib_transport_context_unlock (conn);
+
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * quiclib_set_idle_timer
+ *
+ * Like quiclib_set_timer, for an idle connection's expiry @sec seconds from
+ * now. This uses a GLib seconds timer, which fires on the same whole-second
+ * tick as every other seconds timer in the process, so that the shared loop
+ * threads wake once for all of the idle connections on them rather than once
+ * for each.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_set_idle_timer (GstQuicLibTransportContext *ctx, guint sec)
+{
+  GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (ctx);
+
+  GST_DEBUG_OBJECT (ctx, "Setting idle timer for %u sec", sec);
+
+  quiclib_cancel_timer (ctx);
+
+  priv->timeout = g_timeout_source_new_seconds (sec);
+  g_source_set_callback (priv->timeout, quiclib_idle_timer_expired, ctx, NULL);
+  g_source_attach (priv->timeout, priv->loop_context);
+}
+
+/**
+ * quiclib_conn_arm_timer
+ *
+ * Sets the timer of @conn for ngtcp2's next expiry, or handles the expiry
+ * straight away if it has already passed. The timer of a connection that is
+ * idle is set with quiclib_set_idle_timer.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_conn_arm_timer (GstQuicLibTransportConnection *conn)
+{
+  ngtcp2_tstamp expiry, now;
+  gboolean idle;
+
+  gst_quiclib_transport_context_lock (conn);
+
+  expiry = ngtcp2_conn_get_expiry (conn->quic_conn);
+  now = quiclib_ngtcp2_timestamp ();
+
+  GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      "ngtcp2 expiry time %lu, time now %lu", expiry, now);
+
+  idle = quiclib_conn_update_idle (conn);
+
+  if (expiry <= now) {
+    quiclib_cancel_timer (GST_QUICLIB_TRANSPORT_CONTEXT (conn));
+    quiclib_timer_expired ((void *) conn);
+  } else if (idle &&
+      (expiry - now) / NGTCP2_SECONDS >= QUICLIB_IDLE_TIMER_MIN_SEC) {
+    quiclib_set_idle_timer (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        (guint) ((expiry - now) / NGTCP2_SECONDS));
+  } else {
+    quiclib_set_timer (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        quiclib_timer_expired, (expiry - now) / NGTCP2_MILLISECONDS);
+  }
+
+  gst_quiclib_transport_context_unlock (conn);
+}
+
+/**
+ * quiclib_conn_wake
+ *
+ * Called once a packet has been sent on @conn. If @conn was idle, its timer
+ * is still the coarse one from quiclib_set_idle_timer, which won't do for the
+ * loss detection of what was just sent, so it is set again.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_conn_wake (GstQuicLibTransportConnection *conn)
+{
+  gst_quiclib_transport_context_lock (conn);
+  if (conn->idle) {
+    quiclib_conn_arm_timer (conn);
+  }
+  gst_quiclib_transport_context_unlock (conn);
+}
+
+void
+_quiclib_add_stat (GstQuicLibTransportConnection *conn, GQueue *queue,
+    gsize bytes, guint64 timestamp_ns)
+{
+  GstQuicLibPacketStats *stat;
+
+  g_mutex_lock (&conn->stats.mutex);
+  while (queue->head && timestamp_ns >
+      (((GstQuicLibPacketStats *) queue->head->data)->timestamp_ns +
+          1000000000)) {
+    stat = (GstQuicLibPacketStats *) queue->head->data;
+    g_queue_unlink (queue, queue->head);
+    quiclib_slab_free (&conn->stat_slab, stat);
+  }
+
+  stat = quiclib_slab_alloc (&conn->stat_slab);
+  stat->bytes = bytes;
+  stat->timestamp_ns = timestamp_ns;
+  stat->link.data = stat;
+  stat->link.prev = stat->link.next = NULL;
+  g_queue_push_tail_link (queue, &stat->link);
+  g_mutex_unlock (&conn->stats.mutex);
+}
+
+/*
+ * Caller must hold the stats mutex.
+ */
+void
+_quiclib_latency_histogram_add (GstQuicLibLatencyHistogram *hist,
+    guint64 sample_ns)
+{
+  guint64 usec = sample_ns / 1000;
+  guint bucket = 0;
+
+  while (usec > 0 && bucket < GST_QUICLIB_LATENCY_HISTOGRAM_BUCKETS - 1) {
+    usec >>= 1;
+    bucket++;
+  }
+
+  hist->buckets[bucket]++;
+  hist->count++;
+  hist->sum += sample_ns;
+  if (sample_ns > hist->max) {
+    hist->max = sample_ns;
+  }
+}
+
+/*
+ * Record the time taken between the packet currently being processed arriving
+ * at the socket and its contents being handed to the transport user.
+ */
+void
+_quiclib_record_rx_delivery (GstQuicLibTransportConnection *conn)
+{
+  GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (
+          GST_QUICLIB_TRANSPORT_CONTEXT (conn));
+  struct timespec ts;
+  guint64 now, sample, dev;
+
+  if (conn->stats.rx_timestamp_ns == 0) {
+    return;
+  }
+
+  clock_gettime (CLOCK_REALTIME, &ts);
+  now = ((guint64) ts.tv_sec * 1000000000) + ts.tv_nsec;
+
+  if (now <= conn->stats.rx_timestamp_ns) {
+    return;
+  }
+
+  sample = now - conn->stats.rx_timestamp_ns;
+
+  g_mutex_lock (&conn->stats.mutex);
+  if (priv->enable_stats) {
+    _quiclib_latency_histogram_add (&conn->stats.rx_delivery, sample);
+  }
+
+  /* As RFC 9002 section 5.3 does for the smoothed RTT */
+  if (conn->stats.rx_delivery_smoothed == 0) {
+    conn->stats.rx_delivery_smoothed = sample;
+    conn->stats.rx_delivery_meandev = sample / 2;
+  } else {
+    dev = sample > conn->stats.rx_delivery_smoothed ?
+        sample - conn->stats.rx_delivery_smoothed :
+        conn->stats.rx_delivery_smoothed - sample;
+    conn->stats.rx_delivery_meandev =
+        (3 * conn->stats.rx_delivery_meandev + dev) / 4;
+    conn->stats.rx_delivery_smoothed =
+        (7 * conn->stats.rx_delivery_smoothed + sample) / 8;
+  }
+  g_mutex_unlock (&conn->stats.mutex);
+}
+
+/*
+ * ngtcp2 marks at most this many packets while testing a path for ECN, and
+ * only marks more once the path has been validated.
+ */
+#define QUICLIB_ECN_VALIDATION_PKTS 10
+
+/*
+ * quiclib_conn_account_tx_ecn
+ *
+ * Counts a sent packet against its ECN codepoint. While ECN is being
+ * validated, the send times are also kept so that get_conn_stats can tell
+ * whether ngtcp2 has given up marking packets. Takes the stats mutex, as
+ * packets are sent from application threads as well as the transport thread.
+ */
+static void
+quiclib_conn_account_tx_ecn (GstQuicLibTransportConnection *conn, guint8 ecn)
+{
+  guint64 ect_sent;
+
+  g_mutex_lock (&conn->stats.mutex);
+
+  conn->stats.ecn.tx[ecn]++;
+
+  ect_sent = conn->stats.ecn.tx[NGTCP2_ECN_ECT_0] +
+      conn->stats.ecn.tx[NGTCP2_ECN_ECT_1];
+
+  if (ect_sent > 0 && ect_sent <= QUICLIB_ECN_VALIDATION_PKTS) {
+    if (ecn == NGTCP2_ECN_NOT_ECT) {
+      conn->stats.ecn.last_not_ect_ts = quiclib_ngtcp2_timestamp ();
+    } else {
+      conn->stats.ecn.last_ect_ts = quiclib_ngtcp2_timestamp ();
+    }
+  }
+
+  g_mutex_unlock (&conn->stats.mutex);
+}
+
+/*
+ * quiclib_packet_write
+ *
+ * Sends packets to the network that have been created by ngtcp2, marked with
+ * the IP TOS/traffic class byte @tos.
+ */
+gssize
+quiclib_packet_write (GstQuicLibTransportConnection *conn, const gchar *data,
+    gsize nwrite, ngtcp2_path_storage *ps, guint8 tos, GstBuffer *owner)
+{
+  GError *err = NULL;
+  gssize written;
+  QuicLibSocketContext *socket_ctx;
+  GSocketAddress *gsa = g_socket_address_new_from_native (
+      ps->path.remote.addr, ps->path.remote.addrlen);
+
+  g_assert (gsa != NULL);
+
+  /*
+   * quiclib_migration_finish can swap and free the sockets from another
+   * thread, so hold a reference to the one picked for as long as it's in use.
+   */
+  gst_quiclib_transport_context_lock (conn);
+  socket_ctx = conn->socket;
+
+  /* Probes of a path being migrated to leave from the new local address */
+  if (quiclib_conn_is_migration_local (conn, &ps->path.local)) {
+    socket_ctx = conn->migration_socket;
+  } else if (conn->server != NULL &&
+      !quiclib_socket_serves_local (socket_ctx, &ps->path.local)) {
+    /* The client has moved to, or is probing, a preferred address */
+    QuicLibSocketContext *preferred =
+        quiclib_server_socket_for_local (conn->server, &ps->path.local);
+    if (preferred != NULL) {
+      socket_ctx = preferred;
+    }
+  }
+  quiclib_socket_context_ref (socket_ctx);
+  gst_quiclib_transport_context_unlock (conn);
+
+  written = quiclib_socket_send (socket_ctx, gsa, data, nwrite, tos, owner,
+      &err);
+  quiclib_socket_context_destroy (socket_ctx);
+
+  if (written < 0 && err != NULL) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Failed to send packet: %s", err->message);
+  } else if (gst_debug_category_get_threshold (quiclib_transport)
+      >= GST_LEVEL_DEBUG){
+    gchar *peer_addr_str = g_socket_connectable_to_string (
+        G_SOCKET_CONNECTABLE (gsa));
+    ngtcp2_version_cid vc;
+    char dcid_str[CID_STR_LEN], scid_str[CID_STR_LEN];
+
+    ngtcp2_pkt_decode_version_cid (&vc, (const uint8_t *) data, nwrite, 18);
+
+    GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Sent %ld bytes to peer %s with DCID %s and SCID %s", written,
+        peer_addr_str, quiclib_rawcidtostr (vc.dcid, vc.dcidlen, dcid_str),
+        quiclib_rawcidtostr (vc.scid, vc.scidlen, scid_str));
+
+    g_free (peer_addr_str);
+  }
+
+  if (written > 0) {
+    GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (
+        GST_QUICLIB_TRANSPORT_CONTEXT (conn));
+    
+    if (priv->enable_stats) {
+      struct timespec ts;
+
+      clock_gettime (CLOCK_REALTIME, &ts);
+      _quiclib_add_stat (conn, &conn->stats.bytes_sent, (gsize) written,
+          ((guint64) ts.tv_sec * 1000000000) + ts.tv_nsec);
+    }
+
+    conn->stats.pkt_counts.sent++;
+    quiclib_conn_account_tx_ecn (conn, tos & 0x3);
+  }
+
+  g_object_unref (gsa);
+
+  return written;
+}
+
+/**
+ * quiclib_ngtcp2_conn_write
+ * 
+ * INTERNAL FUNCTION ONLY.
+ * Make ngtcp2 create packets to be sent with @quiclib_packet_write.
+ * 
+ * This code can be re-entrant if it is possible to send more than one packet.
+ * 
+ * @conn: The QUIC connection to write packets for
+ * @stream_id: The stream ID to write. This can be -1 during handshake and
+ *    crypto exchanges, and implies that some connection-level stuff needs to be
+ *    exchanged, not in streams. This will all be managed internally by ngtcp2,
+ *    and there should be a zero-length vector of buffers in this case.
+ * @frame: A vector of buffers for the stream to be sent.
+ * @nvec: The number of buffers in @frame.
+ * @final: Whether the stream should be closed on the completion of sending the
+ *    buffers in @frame.
+ * 
+ * @return The size of QUIC stream data written from @frame, or <0 on error.
+ */
+ssize_t
+quiclib_ngtcp2_conn_write (GstQuicLibTransportConnection *conn,
+    gint64 stream_id, ngtcp2_vec *frame, size_t nvec,
+    int final)
+{
+  ngtcp2_path_storage ps, prev_ps;
+  uint32_t flags = 0; /* NGTCP2_WRITE_STREAM_FLAG_MORE */
+  ngtcp2_pkt_info pi;
+  size_t max_udp_size;
+  ngtcp2_ssize nwrite, to_write = 0, pdatalen = 0;
+  size_t i;
+  guint64 ts;
+  guint8 dscp;
+
+  GstBuffer *buffer;
+  GstMapInfo map;
+
+  gst_quiclib_transport_context_lock (conn);
+
+  GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn), "nvec(%lu) final(%s)",
+      nvec, (final)?("TRUE"):("FALSE"));
+
+  if (nvec == 0 && final) {
+    _quiclib_add_stream_to_close (conn, stream_id);
+    gst_quiclib_transport_context_unlock (conn);
+    return 0;
+  }
+
+  if (ngtcp2_conn_in_closing_period (conn->quic_conn) ||
+      ngtcp2_conn_in_draining_period (conn->quic_conn)) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Connection closed");
+    gst_quiclib_transport_context_unlock (conn);
+    return -1;
+  }
+
+  ngtcp2_path_storage_zero (&ps);
+  ngtcp2_path_storage_zero (&prev_ps);
+
+  max_udp_size = ngtcp2_conn_get_max_tx_udp_payload_size (conn->quic_conn);
+
+  if (final) {
+    flags |= NGTCP2_WRITE_STREAM_FLAG_FIN;
+  }
+
+  buffer = gst_buffer_new_and_alloc (max_udp_size);
+  if (buffer == NULL) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Couldn't allocate GstBuffer");
+    gst_quiclib_transport_context_unlock (conn);
+    return -1;
+  }
+
+  gst_buffer_map (buffer, &map, GST_MAP_READ);
+
+  GST_LOG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      "There are %ld bytes available in the cwnd for stream %ld",
+      quiclib_ngtcp2_get_stream_window (conn, stream_id),
+      stream_id);
+
+  for (i = 0; i < nvec; i++) {
+    to_write += frame[i].len;
+  }
+
+  if (gst_debug_category_get_threshold (quiclib_transport) >= GST_LEVEL_TRACE)
+  {
+    GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "There are %lu stream buffers to write and %u outstanding streams to "
+        "close gracefully", nvec, g_list_length (conn->streams_to_close));
+    for (i = 0; i < nvec; i++) {
+      GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+          "Buffer %lu has size %lu bytes", i, frame[i].len);
+    }
+  }
+
+  ts = quiclib_conn_timestamp (conn, quiclib_ngtcp2_timestamp ());
+
+  /*
+   * Closing streams' FIN frames share the packet with this stream's data, and
+   * the packet takes the highest priority of their markings.
+   */
+  dscp = quiclib_conn_stream_dscp (conn, stream_id);
+
+  while (conn->streams_to_close) {
+    gint64 _close_stream_id = _quiclib_pop_stream_to_close (conn);
+    dscp = quiclib_dscp_higher (dscp,
+        quiclib_conn_stream_dscp (conn, _close_stream_id));
+    nwrite = ngtcp2_conn_writev_stream (conn->quic_conn, &ps.path, &pi,
+        map.data, map.size, &pdatalen,
+        flags | NGTCP2_WRITE_STREAM_FLAG_MORE | NGTCP2_WRITE_STREAM_FLAG_FIN,
+        _close_stream_id, NULL, 0, ts);
+
+    switch (nwrite) {
+      case NGTCP2_ERR_NOMEM:
+      case NGTCP2_ERR_INVALID_ARGUMENT:
+        gst_quiclib_transport_context_unlock (conn);
+        return GST_QUICLIB_ERR;
+      case NGTCP2_ERR_STREAM_NOT_FOUND:
+      case NGTCP2_ERR_STREAM_SHUT_WR:
+      case NGTCP2_ERR_WRITE_MORE:
+        continue;
+      case 0:
+        gst_quiclib_transport_context_unlock (conn);
+        return 0;
+      default:
+        GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+            "Ran out of packet space after writing final stream frame for "
+            "stream %lu", _close_stream_id);
+        gst_quiclib_transport_context_unlock (conn);
+
+        nwrite = quiclib_packet_write (conn, (const gchar *) map.data, nwrite,
+            &ps, (dscp << 2) | pi.ecn, buffer);
+        if (nwrite < 0) {
+          gst_buffer_unmap (buffer, &map);
+          return -1;
+        }
+
+        gst_buffer_unmap (buffer, &map);
+
+        return quiclib_ngtcp2_conn_write (conn, stream_id, frame, nvec, final);
+    }
+  }
+
+  /* 
+   * For WRITE_MORE: conn->quic_conn, ps.path, pi, map.data, map.size and the
+   * timestamp must be the same.
+   */
+  nwrite = ngtcp2_conn_writev_stream (conn->quic_conn, &ps.path, &pi,
+      map.data, map.size, &pdatalen, flags, stream_id,
+      (frame != NULL)?(frame):(NULL), (frame != NULL)?(nvec):(0), ts);
+
+  gst_quiclib_transport_context_unlock (conn);
+
+  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      "ngtcp2_conn_writev_stream: nwrite %ld, pdatalen %ld", nwrite, pdatalen);
+
+  if (nwrite <= 0) {
+    if (nwrite == 0) return 0;
+
+    GST_LOG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "writev_stream returned %s", ngtcp2_strerror (nwrite));
+    gst_buffer_unmap (buffer, &map);
+
+    switch (nwrite) {
+    case NGTCP2_ERR_WRITE_MORE:
+      GST_LOG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn), "Wrote packet "
+          "containing %ld bytes for stream ID %ld, with space remaining in "
+          "the same packet.", pdatalen, stream_id);
+      g_assert (0);
+      break;
+    case NGTCP2_ERR_NOMEM:
+    case NGTCP2_ERR_INVALID_ARGUMENT:
+      return GST_QUICLIB_ERR;
+    case NGTCP2_ERR_STREAM_NOT_FOUND:
+      guint64 test = 0;
+      switch (stream_id & 0x3) {
+        case 0x0: test = conn->last_client_bidi_stream_id; break;
+        case 0x1: test = conn->last_server_bidi_stream_id; break;
+        case 0x2: test = conn->last_client_uni_stream_id; break;
+        case 0x3: test = conn->last_server_uni_stream_id; break;
+      }
+
+      if (test < stream_id) {
+        return GST_QUICLIB_ERR;
+      }
+      /* Probably already been closed */
+      return GST_QUICLIB_ERR_STREAM_CLOSED;
+    case NGTCP2_ERR_STREAM_SHUT_WR:
+      return GST_QUICLIB_ERR_STREAM_CLOSED;
+    case NGTCP2_ERR_PKT_NUM_EXHAUSTED:
+      return GST_QUICLIB_ERR_PACKET_NUM_EXHAUSTED;
+    case NGTCP2_ERR_STREAM_DATA_BLOCKED:
+      return GST_QUICLIB_ERR_STREAM_DATA_BLOCKED;;
+    default:
+      GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+          "UNKNOWN NGTCP2 RETURN CODE: %ld", nwrite);
+      return GST_QUICLIB_ERR;
+    }
+  }
+
+  g_assert (nwrite <= max_udp_size);
+
+  nwrite = quiclib_packet_write (conn, (const gchar *) map.data, nwrite, &ps,
+      (dscp << 2) | pi.ecn, buffer);
+  if (nwrite < 0) {
+    gst_buffer_unmap (buffer, &map);
+    return -1;
+  }
+
+  gst_buffer_unmap (buffer, &map);
+
+  quiclib_conn_wake (conn);
+
+  if (pdatalen == -1) {
+    pdatalen = 0;
+  }
+
+  return pdatalen;
+}
+
+/**
+ * quiclib_ngtcp2_datagram_write
+ * 
+ * INTERNAL FUNCTION ONLY.
+ * Like @quiclib_ngtcp2_conn_write, but for writing DATAGRAM frames ONLY.
+ * 
+ * @conn: The connection to write the DATAGRAM frames out to.
+ * @frame: A vector of buffers to package into DATAGRAM frames. These will be
+ *    payloaded into individual DATAGRAM frames.
+ * @nvec: The number of buffers in @frame.
+ * @dscp: DSCP to mark the packet with, or -1 for the connection default.
+ * 
+ * @return The size of QUIC DATAGRAM frame body data written from @frame, or <0
+ *    on error.
+ */
+ssize_t
+quiclib_ngtcp2_datagram_write (GstQuicLibTransportConnection *conn,
+    ngtcp2_vec *frame, size_t nvec, gint dscp)
+{
+  ngtcp2_path_storage ps, prev_ps;
+  uint32_t flags = 0; /* NGTCP2_WRITE_DATAGRAM_FLAG_MORE */
+  ngtcp2_pkt_info pi;
+  size_t max_udp_size;
+  ngtcp2_ssize nwrite;
+  gint paccepted = 0;
+  guint64 datagram_id = conn->datagram_ticket;
+
+  GstBuffer *buffer;
+  GstMapInfo map;
+  QuicLibSocketContext *socket_ctx = NULL;
+
+  gst_quiclib_transport_context_lock (conn);
+
+  /*
+   * Wait until the handshake is completed, as we don't know whether we can send
+   * datagrams until this time!
+   */
+  /* TODO: Do this better! */
+  while (!ngtcp2_conn_get_handshake_completed (conn->quic_conn)) {
+    gst_quiclib_transport_context_unlock (conn);
+    usleep (100000);
+    gst_quiclib_transport_context_lock (conn);
+  }
+
+  if (ngtcp2_conn_in_closing_period (conn->quic_conn) ||
+      ngtcp2_conn_in_draining_period (conn->quic_conn)) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Connection closed");
+    gst_quiclib_transport_context_unlock (conn);
+    return GST_QUICLIB_ERR_CONN_CLOSED;
+  }
+  ngtcp2_path_storage_zero (&ps);
+  ngtcp2_path_storage_zero (&prev_ps);
+
+  max_udp_size = ngtcp2_conn_get_max_tx_udp_payload_size (conn->quic_conn);
+
+  buffer = gst_buffer_new_and_alloc (max_udp_size);
+  if (buffer == NULL) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Couldn't allocate GstBuffer");
+    gst_quiclib_transport_context_unlock (conn);
+    return GST_QUICLIB_ERR_OOM;
+  }
+
+  gst_buffer_map (buffer, &map, GST_MAP_WRITE);
+
+  GST_LOG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      "Writing datagram of size %lu into buffer of size %lu with %ld bytes "
+      "available in the cwnd", frame[0].len, map.size,
+      ngtcp2_conn_get_cwnd_left (conn->quic_conn));
+
+  nwrite = ngtcp2_conn_writev_datagram (conn->quic_conn, &ps.path,
+      &pi, (uint8_t *) map.data, map.size, &paccepted, flags, datagram_id,
+      frame, nvec, quiclib_conn_timestamp (conn, quiclib_ngtcp2_timestamp ()));
+
+  /* Keep the socket alive in case a migration swaps it out once unlocked */
+  if (nwrite > 0) {
+    socket_ctx = quiclib_socket_context_ref (conn->socket);
+  }
+
+  gst_quiclib_transport_context_unlock (conn);
+
+  gst_buffer_unmap (buffer, &map);
+  if (nwrite > 0) {
+    GError *err = NULL;
+    gssize written;
+    GSocketAddress *gsa = g_socket_address_new_from_native (
+        ps.path.remote.addr, ps.path.remote.addrlen);
+
+    g_assert (gsa != NULL);
+
+    if (dscp < 0) {
+      dscp = quiclib_conn_stream_dscp (conn, -1);
+    }
+
+    written = quiclib_socket_send (socket_ctx, gsa, (gchar *) map.data,
+        nwrite, (dscp << 2) | pi.ecn, buffer, &err);
+    quiclib_socket_context_destroy (socket_ctx);
+
+    if (written > 0) {
+      quiclib_conn_account_tx_ecn (conn, pi.ecn);
+    }
+
+    GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Sent UDP packet of size %ld bytes containing %lu bytes of payload - "
+        "paccepted is %d", written, frame->len, paccepted);
+
+    if (written < 0 && err != NULL) {
+      GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+          "Failed to send datagram: %s", err->message);
+    }
+
+    if (paccepted != 0) {
+      quiclib_store_datagram_ack_ref (conn, datagram_id, buffer);
+      conn->datagram_ticket++;
+    }
+
+    g_object_unref (gsa);
+
+    quiclib_conn_wake (conn);
+  } else {
+    switch (nwrite) {
+    case 0:
+      GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+          "ngtcp2_conn_writev_datagram returned 0. paccepted is %d", paccepted);
+      break;
+    case NGTCP2_ERR_WRITE_MORE:
+      GST_LOG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn), "Wrote packet for "
+          "datagram %ld, with space remaining in the same packet.",
+          datagram_id);
+      g_assert (0);
+      break;
+    case NGTCP2_ERR_INVALID_STATE:
+      GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+          "Remote endpoint does not support DATAGRAMs!");
+      return GST_QUICLIB_ERR_EXTENSION_NOT_SUPPORTED;
+    default:
+      GST_LOG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+          "writev_datagram returned %s", ngtcp2_strerror (nwrite));
+      return GST_QUICLIB_ERR;
+    }
+  }
+
+  return nwrite;
+}
+
+/* For debugging only */
+#define quiclib_print_ngtcp2_transport_params(ctx, params) \
+do { \
+  GST_DEBUG_OBJECT (ctx, \
+      "Preferred addr %s present, Original DCID %s present, " \
+      "Initial SCID %s present, Retry SCID %s present, " \
+      "initial_max_stream_data_bidi_local %lu, " \
+      "initial_max_stream_data_bidi_remote %lu, " \
+      "initial_max_stream_data_uni %lu, initial_max_data %lu, " \
+      "initial_max_streams_bidi %lu, initial_max_streams_uni %lu, " \
+      "max_idle_timeout %lu, max_udp_payload_size %lu, " \
+      "active_connection_id_limit %lu, ack_delay_exponent %lu, " \
+      "max_ack_delay %lu, max_datagram_frame_size %lu, " \
+      "stateless_reset_token_present %s, disable_active_migration %s,", \
+      params.preferred_addr_present?(""):("not"), \
+      params.original_dcid_present?(""):("not"), \
+      params.initial_scid_present?(""):("not"), \
+      params.retry_scid_present?(""):("not"), \
+      params.initial_max_stream_data_bidi_local, \
+      params.initial_max_stream_data_bidi_remote, \
+      params.initial_max_stream_data_uni, params.initial_max_data, \
+      params.initial_max_streams_bidi, params.initial_max_streams_uni, \
+      params.max_idle_timeout, params.max_udp_payload_size,\
+      params.active_connection_id_limit, params.ack_delay_exponent,\
+      params.max_ack_delay, params.max_datagram_frame_size, \
+      params.stateless_reset_token_present?("SET"):("NOT SET"), \
+      params.disable_active_migration?("SET"):("NOT SET")); \
+} while (0); \
+
+#define MAX_UDP 65507
+
+/**
+ * gst_quiclib_new_conn_from_server
+ * 
+ * Create a new connection object from a running server instance. This is used
+ * when a client makes a connection to the server.
+ * 
+ * INTERNAL FUNCTION ONLY.
+ */
+GstQuicLibTransportConnection *
+gst_quiclib_new_conn_from_server (GstQuicLibServerContext *server)
+{
+  GstQuicLibTransportConnection *conn;
+  GstQuicLibTransportContextPrivate *conn_priv;
+  GstQuicLibTransportContextPrivate *server_priv =
+      gst_quiclib_transport_context_get_instance_private (
+          GST_QUICLIB_TRANSPORT_CONTEXT (server));
+
+  conn = g_object_new (GST_TYPE_QUICLIB_TRANSPORT_CONNECTION, NULL);
+  if (!conn) {
+    return NULL;
+  }
+
+  conn->server = server;
+  conn_priv = gst_quiclib_transport_context_get_instance_private (
+      GST_QUICLIB_TRANSPORT_CONTEXT (conn));
+
+  gst_quiclib_transport_context_lock (server);
+  gst_quiclib_transport_context_lock (conn);
+
+  conn_priv->user = server_priv->user;
+  conn_priv->app_ctx = server_priv->app_ctx;
+  conn_priv->loop = server_priv->loop;
+  conn_priv->loop_context = server_priv->loop_context;
+  conn_priv->loop_thread = server_priv->loop_thread;
+  conn_priv->enable_stats = server_priv->enable_stats;
+  conn_priv->dscp = server_priv->dscp;
+  conn_priv->rate_limit = server_priv->rate_limit;
+  conn_priv->rate_burst = server_priv->rate_burst;
+  conn_priv->probe_duration = server_priv->probe_duration;
+  conn_priv->async_notif_loop = server_priv->async_notif_loop;
+  conn_priv->conn_memory_limit = server_priv->conn_memory_limit;
+  conn_priv->idle_mode = server_priv->idle_mode;
+  conn_priv->async_notif_loop_context = server_priv->async_notif_loop_context;
+  conn_priv->async_notif_thread = server_priv->async_notif_thread;
+
+  conn->transport_params.initial_max_data = server_priv->tp_sent.max_data;
+  conn->transport_params.initial_max_stream_data_bidi_local =
+      conn->transport_params.initial_max_stream_data_bidi_remote =
+          server_priv->tp_sent.max_stream_data_bidi;
+  conn->transport_params.initial_max_stream_data_uni =
+      server_priv->tp_sent.max_stream_data_uni;
+  conn->transport_params.initial_max_streams_bidi =
+      server_priv->tp_sent.max_streams_bidi;
+  conn->transport_params.initial_max_streams_uni =
       server_priv->tp_sent.max_streams_uni;
   conn->transport_params.active_connection_id_limit =
       server_priv->tp_sent.num_cids;
@@ -3676,1915 +7960,6025 @@ gst_quiclib_new_conn_from_server (GstQuicLibServerContext *server)
     conn->transport_params.max_datagram_frame_size = 65535;
   }
 
-  quiclib_print_ngtcp2_transport_params (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-      conn->transport_params);
+  quiclib_print_ngtcp2_transport_params (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      conn->transport_params);
+
+  server->connections = g_list_append (server->connections, conn);
+
+  gst_quiclib_transport_context_unlock (conn);
+  gst_quiclib_transport_context_unlock (server);
+
+  return conn;
+}
+
+/**
+ * quiclib_handle_control_messages
+ *
+ * Pulls the ECN mark, local address and kernel receive timestamp out of the
+ * control messages received alongside a UDP datagram. Takes ownership of each
+ * message in @msgs, but not of the array itself.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_handle_control_messages (QuicLibSocketContext *socket_ctx,
+    GSocketControlMessage **msgs, gint num_msgs, gssize bytes_read,
+    ngtcp2_pkt_info *pi, GSocketAddress **local_addr,
+    GstQuicLibPacketStats *stat, guint64 *rx_ts)
+{
+  GstQuicLibTransportContextPrivate *owner_priv =
+      gst_quiclib_transport_context_get_instance_private (socket_ctx->owner);
+  GError *err = NULL;
+  gint i;
+
+  for (i = 0; i < num_msgs; i++) {
+    if (SOCKET_CONTROL_MESSAGE_IS_ECN (msgs[i])) {
+      SocketControlMessageECN *ecn_scm =
+          SOCKET_CONTROL_MESSAGE_ECN (msgs [i]);
+
+      pi->ecn = ecn_scm->ecn;
+    } else if (SOCKET_CONTROL_MESSAGE_IS_PKTINFO (msgs[i])) {
+      SocketControlMessagePKTINFO *pktinfo_scm =
+          SOCKET_CONTROL_MESSAGE_PKTINFO (msgs [i]);
+      GSocketAddress *sa = g_socket_get_local_address (socket_ctx->socket,
+          &err);
+
+      if (sa == NULL) {
+        GST_ERROR_OBJECT (socket_ctx->owner, "Couldn't get local address: %s",
+            err->message);
+        g_clear_error (&err);
+      } else {
+        *local_addr = g_inet_socket_address_new (
+            pktinfo_scm->destination_address,
+            g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (sa)));
+
+        g_object_unref (sa);
+      }
+    } else if (SOCKET_CONTROL_MESSAGE_IS_TIMESTAMP (msgs [i])) {
+      guint64 ts;
+      SocketControlMessageTimestamp *timestamp =
+          SOCKET_CONTROL_MESSAGE_TIMESTAMP (msgs [i]);
+
+      g_object_get (timestamp, "timestamp-ns", &ts, NULL);
+
+      if (owner_priv->enable_stats) {
+        GST_FIXME_OBJECT (socket_ctx->owner,
+            "New packet stat with %ld bytes read at timestamp %lu", bytes_read,
+            ts);
+
+        stat->bytes = (gsize) bytes_read;
+        stat->timestamp_ns = ts;
+      }
+      *rx_ts = ts;
+    }
+
+    g_object_unref (msgs[i]);
+  }
+}
+
+/*
+ * Kernel receive timestamps older than this are assumed to be from before a
+ * step of the realtime clock, and aren't used as the packet arrival time.
+ */
+#define QUICLIB_RX_TIMESTAMP_MAX_AGE (1 * NGTCP2_SECONDS)
+
+/**
+ * quiclib_rx_timestamp_to_ngtcp2
+ *
+ * Converts a SO_TIMESTAMPNS kernel receive timestamp, which is against
+ * CLOCK_REALTIME, to the CLOCK_MONOTONIC timebase that ngtcp2 timestamps use.
+ * Returns the current time if @rx_ts is 0 or can't be trusted. If
+ * @queueing_ns is non-NULL, it returns how long the packet waited between
+ * arriving at the socket and now.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static ngtcp2_tstamp
+quiclib_rx_timestamp_to_ngtcp2 (guint64 rx_ts, guint64 *queueing_ns)
+{
+  struct timespec ts;
+  guint64 now_real;
+  ngtcp2_tstamp now;
+
+  now = quiclib_ngtcp2_timestamp ();
+
+  if (queueing_ns) *queueing_ns = 0;
+
+  if (rx_ts == 0) {
+    return now;
+  }
+
+  clock_gettime (CLOCK_REALTIME, &ts);
+  now_real = ((guint64) ts.tv_sec * 1000000000) + ts.tv_nsec;
+
+  if (rx_ts > now_real || now_real - rx_ts > QUICLIB_RX_TIMESTAMP_MAX_AGE ||
+      now_real - rx_ts > now) {
+    return now;
+  }
+
+  if (queueing_ns) *queueing_ns = now_real - rx_ts;
+
+  return now - (now_real - rx_ts);
+}
+
+/*
+ * Admission control.
+ *
+ * A server samples its load every QUICLIB_ADMISSION_SAMPLE_INTERVAL as
+ * packets arrive on its loop thread: the share of the loop thread's time
+ * spent on the CPU, the connections still handshaking, and the resident
+ * memory of the process. Once any of these reaches its admission-max-*
+ * property the server is overloaded, and stays so until all of them have
+ * fallen back below QUICLIB_ADMISSION_HYSTERESIS percent of their limits, so
+ * that it doesn't flap at the boundary. The bytes pinned by all of the
+ * server's connections are sampled the same way against the
+ * server-memory-limit property, and being over that also overloads it.
+ *
+ * While overloaded, Initial packets for new connections are answered with a
+ * stateless CONNECTION_CLOSE carrying CONNECTION_REFUSED, or with a Retry if
+ * the admission-action property asks for one. Clients that come back with a
+ * valid Retry token have shown that they can receive at their address, and
+ * are admitted. With the admission-shed-idle property set, the server also
+ * closes one idle connection per sample while overloaded, taking the lowest
+ * egress weight first and then the longest idle.
+ */
+#define QUICLIB_ADMISSION_SAMPLE_INTERVAL (250 * NGTCP2_MILLISECONDS)
+#define QUICLIB_ADMISSION_HYSTERESIS 80
+#define QUICLIB_RETRY_TOKEN_TIMEOUT (10 * NGTCP2_SECONDS)
+
+typedef enum {
+  QUICLIB_ADMISSION_ACCEPT,
+  QUICLIB_ADMISSION_ACCEPT_RETRIED,
+  QUICLIB_ADMISSION_TURNED_AWAY
+} QuicLibAdmissionDecision;
+
+/**
+ * quiclib_process_rss
+ *
+ * Returns the resident memory of the process in bytes, or 0 if it can't be
+ * read.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static guint64
+quiclib_process_rss (void)
+{
+  gchar *contents = NULL;
+  guint64 size, resident = 0;
+
+  if (!g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL)) {
+    return 0;
+  }
+
+  if (sscanf (contents, "%lu %lu", &size, &resident) != 2) {
+    resident = 0;
+  }
+
+  g_free (contents);
+
+  return resident * (guint64) sysconf (_SC_PAGESIZE);
+}
+
+/**
+ * quiclib_admission_over
+ *
+ * Returns TRUE if @value is at least @percent percent of @limit, where a
+ * @limit of 0 means there is no limit.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_admission_over (guint64 value, guint64 limit, guint percent)
+{
+  if (limit == 0) {
+    return FALSE;
+  }
+
+  return value >= gst_util_uint64_scale (limit, percent, 100);
+}
+
+/**
+ * quiclib_admission_shed
+ *
+ * Closes the idle connection of @server with the lowest egress weight, the
+ * longest idle of those, if any has been idle for the admission-shed-idle
+ * property. Call on the server's loop thread.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_admission_shed (GstQuicLibServerContext *server, ngtcp2_tstamp now,
+    guint idle_secs)
+{
+  GstQuicLibTransportConnection *victim = NULL;
+  ngtcp2_tstamp idle = (ngtcp2_tstamp) idle_secs * NGTCP2_SECONDS;
+  GList *it;
+
+  g_mutex_lock (&server->egress_mutex);
+  for (it = server->connections; it != NULL; it = it->next) {
+    GstQuicLibTransportConnection *conn =
+        (GstQuicLibTransportConnection *) it->data;
+
+    if (gst_quiclib_transport_get_state (GST_QUICLIB_TRANSPORT_CONTEXT (conn))
+        != QUIC_STATE_OPEN || now < conn->last_ts ||
+        now - conn->last_ts < idle) {
+      continue;
+    }
+
+    if (victim == NULL || conn->egress_weight < victim->egress_weight ||
+        (conn->egress_weight == victim->egress_weight &&
+            conn->last_ts < victim->last_ts)) {
+      victim = conn;
+    }
+  }
+  g_mutex_unlock (&server->egress_mutex);
+
+  if (victim == NULL) {
+    return;
+  }
+
+  GST_INFO_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (server),
+      "Shedding connection %p, idle for %lu ms with egress weight %u", victim,
+      (now - victim->last_ts) / NGTCP2_MILLISECONDS, victim->egress_weight);
+
+  gst_quiclib_transport_disconnect (victim, FALSE, NGTCP2_NO_ERROR);
+
+  g_mutex_lock (&server->admission.mutex);
+  server->admission.stats.shed++;
+  g_mutex_unlock (&server->admission.mutex);
+}
+
+/**
+ * quiclib_admission_sample
+ *
+ * Samples the load of @server if QUICLIB_ADMISSION_SAMPLE_INTERVAL has passed
+ * since it was last sampled, and moves it into or out of overload. Call on the
+ * server's loop thread.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_admission_sample (GstQuicLibServerContext *server, ngtcp2_tstamp now)
+{
+  GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (
+          GST_QUICLIB_TRANSPORT_CONTEXT (server));
+  guint64 cpu, memory = 0, pinned = 0;
+  guint load = server->admission.stats.load, handshakes = 0;
+  gboolean overloaded = server->admission.stats.overloaded;
+  gboolean memory_limited = server->admission.stats.memory_limited;
+  GList *it;
+
+  if (priv->admission_max_load == 0 && priv->admission_max_handshakes == 0 &&
+      priv->admission_max_memory == 0 && priv->server_memory_limit == 0 &&
+      !overloaded && !memory_limited) {
+    return;
+  }
+
+  if (server->admission.sample_ts != 0 &&
+      now - server->admission.sample_ts < QUICLIB_ADMISSION_SAMPLE_INTERVAL) {
+    return;
+  }
+
+  cpu = quiclib_thread_cpu_ns ();
+  if (server->admission.sample_ts != 0) {
+    load = (guint) MIN (gst_util_uint64_scale (
+        cpu - server->admission.sample_cpu, 100,
+        now - server->admission.sample_ts), 100);
+  }
+  server->admission.sample_ts = now;
+  server->admission.sample_cpu = cpu;
+
+  for (it = server->connections; it != NULL; it = it->next) {
+    if (gst_quiclib_transport_get_state (
+        GST_QUICLIB_TRANSPORT_CONTEXT (it->data)) < QUIC_STATE_OPEN) {
+      handshakes++;
+    }
+    if (priv->server_memory_limit > 0) {
+      pinned += quiclib_conn_memory (GST_QUICLIB_TRANSPORT_CONNECTION (
+          it->data));
+    }
+  }
+
+  /*
+   * Being over the server memory limit also holds back every connection, see
+   * "Memory accounting".
+   */
+  if (!memory_limited &&
+      quiclib_admission_over (pinned, priv->server_memory_limit, 100)) {
+    GST_WARNING_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (server),
+        "Connections are pinning %lu bytes, holding them back", pinned);
+    memory_limited = TRUE;
+  } else if (memory_limited && !quiclib_admission_over (pinned,
+      priv->server_memory_limit, QUICLIB_ADMISSION_HYSTERESIS)) {
+    GST_INFO_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (server),
+        "Connections are pinning %lu bytes, no longer held back", pinned);
+    memory_limited = FALSE;
+  }
+  g_atomic_int_set (&server->admission.memory_limited, memory_limited);
+
+  if (priv->admission_max_memory > 0) {
+    memory = quiclib_process_rss ();
+  }
+
+  if (!overloaded && (memory_limited ||
+      quiclib_admission_over (load, priv->admission_max_load, 100) ||
+      quiclib_admission_over (handshakes, priv->admission_max_handshakes,
+          100) ||
+      quiclib_admission_over (memory, priv->admission_max_memory, 100))) {
+    GST_WARNING_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (server),
+        "Overloaded, turning new connections away: loop thread %u%% busy, "
+        "%u handshakes in progress, %lu bytes resident", load, handshakes,
+        memory);
+    overloaded = TRUE;
+  } else if (overloaded && !memory_limited &&
+      !quiclib_admission_over (load, priv->admission_max_load,
+          QUICLIB_ADMISSION_HYSTERESIS) &&
+      !quiclib_admission_over (handshakes, priv->admission_max_handshakes,
+          QUICLIB_ADMISSION_HYSTERESIS) &&
+      !quiclib_admission_over (memory, priv->admission_max_memory,
+          QUICLIB_ADMISSION_HYSTERESIS)) {
+    GST_INFO_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (server),
+        "No longer overloaded, admitting new connections: loop thread %u%% "
+        "busy, %u handshakes in progress, %lu bytes resident", load,
+        handshakes, memory);
+    overloaded = FALSE;
+  }
+
+  g_mutex_lock (&server->admission.mutex);
+  server->admission.stats.overloaded = overloaded;
+  server->admission.stats.load = load;
+  server->admission.stats.handshakes = handshakes;
+  server->admission.stats.memory = memory;
+  server->admission.stats.pinned = pinned;
+  server->admission.stats.memory_limited = memory_limited;
+  g_mutex_unlock (&server->admission.mutex);
+
+  if (overloaded && priv->admission_shed_idle > 0) {
+    quiclib_admission_shed (server, now, priv->admission_shed_idle);
+  }
+}
+
+/**
+ * quiclib_admission_send
+ *
+ * Sends the stateless packet of @len bytes in @buf to @peer_addr from
+ * @socket_ctx, logging @what if it can't be.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_admission_send (QuicLibSocketContext *socket_ctx,
+    GSocketAddress *peer_addr, const guint8 *buf, ngtcp2_ssize len,
+    const gchar *what)
+{
+  GError *err = NULL;
+
+  if (len < 0) {
+    GST_WARNING_OBJECT (socket_ctx->owner, "Couldn't write %s: %s", what,
+        ngtcp2_strerror ((int) len));
+    return;
+  }
+
+  if (quiclib_socket_send (socket_ctx, peer_addr, (const gchar *) buf,
+      (gsize) len, 0, NULL, &err) < 0) {
+    GST_WARNING_OBJECT (socket_ctx->owner, "Couldn't send %s: %s", what,
+        err->message);
+    g_clear_error (&err);
+  }
+}
+
+/**
+ * quiclib_admission_send_retry
+ *
+ * Sends a Retry in response to @hdr, the Initial packet of a new connection
+ * from @peer_addr, so that the client has to prove its address before
+ * @server keeps any state for it. Returns FALSE if nothing could be sent.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_admission_send_retry (GstQuicLibServerContext *server,
+    QuicLibSocketContext *socket_ctx, const ngtcp2_pkt_hd *hdr,
+    GSocketAddress *peer_addr)
+{
+  guint8 buf[NGTCP2_MAX_UDP_PAYLOAD_SIZE];
+  guint8 token[NGTCP2_CRYPTO_MAX_RETRY_TOKENLEN];
+  ngtcp2_sockaddr_union remote_sa;
+  ngtcp2_socklen remote_len;
+  ngtcp2_ssize tokenlen;
+  ngtcp2_cid retry_scid;
+
+  remote_len = (ngtcp2_socklen) g_socket_address_get_native_size (peer_addr);
+  if (!g_socket_address_to_native (peer_addr, &remote_sa, sizeof (remote_sa),
+      NULL)) {
+    return FALSE;
+  }
+
+  if (!quiclib_generate_cid_for (GST_QUICLIB_TRANSPORT_CONTEXT (server),
+      server, &retry_scid, 0)) {
+    return FALSE;
+  }
+
+  tokenlen = ngtcp2_crypto_generate_retry_token (token,
+      server->admission.retry_secret,
+      sizeof (server->admission.retry_secret), hdr->version, &remote_sa.sa,
+      remote_len, &retry_scid, &hdr->dcid, quiclib_ngtcp2_timestamp ());
+  if (tokenlen < 0) {
+    GST_WARNING_OBJECT (socket_ctx->owner,
+        "Couldn't generate a Retry token: %s",
+        ngtcp2_strerror ((int) tokenlen));
+    return FALSE;
+  }
+
+  quiclib_admission_send (socket_ctx, peer_addr, buf,
+      ngtcp2_crypto_write_retry (buf, sizeof (buf), hdr->version,
+          &hdr->scid, &retry_scid, &hdr->dcid, token, (size_t) tokenlen),
+      "Retry");
+
+  return TRUE;
+}
+
+/**
+ * quiclib_admission_check
+ *
+ * Decides whether to admit the new connection that @hdr, an Initial packet
+ * from @peer_addr, is trying to open on @server, and sends the Retry or
+ * CONNECTION_CLOSE if not. If the packet carries a valid Retry token,
+ * @odcid is set to the DCID that the client first used, and
+ * QUICLIB_ADMISSION_ACCEPT_RETRIED is returned unless @server is still
+ * overloaded. A valid token only proves the client's address, so it only
+ * gets past the overload with QUICLIB_ADMISSION_ACTION_VALIDATE. Call on the
+ * server's loop thread.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static QuicLibAdmissionDecision
+quiclib_admission_check (GstQuicLibServerContext *server,
+    QuicLibSocketContext *socket_ctx, const ngtcp2_pkt_hd *hdr,
+    GSocketAddress *peer_addr, ngtcp2_cid *odcid)
+{
+  GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (
+          GST_QUICLIB_TRANSPORT_CONTEXT (server));
+  guint8 buf[NGTCP2_MAX_UDP_PAYLOAD_SIZE];
+  ngtcp2_sockaddr_union remote_sa;
+  ngtcp2_socklen remote_len;
+  ngtcp2_tstamp now = quiclib_ngtcp2_timestamp ();
+  QuicLibAdmissionDecision decision = QUICLIB_ADMISSION_TURNED_AWAY;
+  guint64 *counter;
+
+  remote_len = (ngtcp2_socklen) g_socket_address_get_native_size (peer_addr);
+  if (!g_socket_address_to_native (peer_addr, &remote_sa, sizeof (remote_sa),
+      NULL)) {
+    return QUICLIB_ADMISSION_TURNED_AWAY;
+  }
+
+  if (hdr->tokenlen > 0 && hdr->token[0] == NGTCP2_CRYPTO_TOKEN_MAGIC_RETRY) {
+    if (ngtcp2_crypto_verify_retry_token (odcid, hdr->token, hdr->tokenlen,
+        server->admission.retry_secret,
+        sizeof (server->admission.retry_secret), hdr->version, &remote_sa.sa,
+        remote_len, &hdr->dcid, QUICLIB_RETRY_TOKEN_TIMEOUT, now) != 0) {
+      GST_INFO_OBJECT (socket_ctx->owner,
+          "Refusing new connection with an invalid Retry token");
+      quiclib_admission_send (socket_ctx, peer_addr, buf,
+          ngtcp2_crypto_write_connection_close (buf, sizeof (buf),
+              hdr->version, &hdr->scid, &hdr->dcid, NGTCP2_INVALID_TOKEN,
+              NULL, 0), "CONNECTION_CLOSE");
+      counter = &server->admission.stats.refused;
+    } else if (!server->admission.stats.overloaded ||
+        priv->admission_action == QUICLIB_ADMISSION_ACTION_VALIDATE) {
+      decision = QUICLIB_ADMISSION_ACCEPT_RETRIED;
+      counter = &server->admission.stats.accepted;
+    } else {
+      GST_DEBUG_OBJECT (socket_ctx->owner,
+          "Still overloaded, refusing a new connection back from a Retry");
+      quiclib_admission_send (socket_ctx, peer_addr, buf,
+          ngtcp2_crypto_write_connection_close (buf, sizeof (buf),
+              hdr->version, &hdr->scid, &hdr->dcid, NGTCP2_CONNECTION_REFUSED,
+              NULL, 0), "CONNECTION_CLOSE");
+      counter = &server->admission.stats.refused;
+    }
+  } else if (!server->admission.stats.overloaded) {
+    decision = QUICLIB_ADMISSION_ACCEPT;
+    counter = &server->admission.stats.accepted;
+  } else if (priv->admission_action == QUICLIB_ADMISSION_ACTION_RETRY ||
+      priv->admission_action == QUICLIB_ADMISSION_ACTION_VALIDATE) {
+    GST_DEBUG_OBJECT (socket_ctx->owner,
+        "Overloaded, sending a Retry to a new connection");
+    if (!quiclib_admission_send_retry (server, socket_ctx, hdr, peer_addr)) {
+      return QUICLIB_ADMISSION_TURNED_AWAY;
+    }
+    counter = &server->admission.stats.retried;
+  } else {
+    GST_DEBUG_OBJECT (socket_ctx->owner,
+        "Overloaded, refusing a new connection");
+    quiclib_admission_send (socket_ctx, peer_addr, buf,
+        ngtcp2_crypto_write_connection_close (buf, sizeof (buf), hdr->version,
+            &hdr->scid, &hdr->dcid, NGTCP2_CONNECTION_REFUSED, NULL, 0),
+        "CONNECTION_CLOSE");
+    counter = &server->admission.stats.refused;
+  }
+
+  g_mutex_lock (&server->admission.mutex);
+  (*counter)++;
+  g_mutex_unlock (&server->admission.mutex);
+
+  return decision;
+}
+
+/**
+ * gst_quiclib_transport_get_admission_stats
+ *
+ * Fills in @stats with the admission control state and decisions of the
+ * server @ctx.
+ *
+ * @ctx: The server context.
+ * @stats: The statistics to fill in.
+ * @return TRUE if @ctx is a server, otherwise FALSE.
+ */
+gboolean
+gst_quiclib_transport_get_admission_stats (GstQuicLibTransportContext *ctx,
+    GstQuicLibAdmissionStats *stats)
+{
+  GstQuicLibServerContext *server;
+
+  if (!QUICLIB_SERVER (ctx)) {
+    return FALSE;
+  }
+
+  server = GST_QUICLIB_SERVER_CONTEXT (ctx);
+
+  g_mutex_lock (&server->admission.mutex);
+  *stats = server->admission.stats;
+  g_mutex_unlock (&server->admission.mutex);
+
+  return TRUE;
+}
+
+/**
+ * quiclib_handle_datagram
+ *
+ * Processes a single UDP datagram read from a socket, by whichever I/O backend
+ * the socket is using. Finds (or for a server, creates) the connection the
+ * packet belongs to, feeds the packet to ngtcp2 and writes any response.
+ * Doesn't take ownership of @peer_addr, @local_addr or @stat.
+ *
+ * Returns FALSE if the socket should stop being read from.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_handle_datagram (QuicLibSocketContext *socket_ctx, guint8 *buf,
+    gssize bytes_read, GSocketAddress *peer_addr, GSocketAddress *local_addr,
+    ngtcp2_pkt_info *pi, GstQuicLibPacketStats *stat, guint64 rx_ts)
+{
+  GstQuicLibTransportContextPrivate *owner_priv =
+      gst_quiclib_transport_context_get_instance_private (socket_ctx->owner);
+  GstQuicLibTransportConnection *conn;
+  ngtcp2_version_cid vc;
+  ngtcp2_path_storage ps;
+  ngtcp2_tstamp arrival_ts;
+  guint64 queueing_ns;
+  int rv;
+
+  socket_ctx->rx_pending++;
+
+  rv = ngtcp2_pkt_decode_version_cid (&vc, buf, bytes_read, 18);
+  switch (rv) {
+  case 0:
+  {
+    gchar dcid_str[CID_STR_LEN], scid_str[CID_STR_LEN], *peer_addr_str;
+    peer_addr_str = g_socket_connectable_to_string (
+        G_SOCKET_CONNECTABLE (peer_addr));
+    GST_DEBUG_OBJECT (socket_ctx->owner,
+        "Received packet of length %ld with DCID %s, SCID %s from %s",
+        bytes_read, quiclib_rawcidtostr (vc.dcid, vc.dcidlen, dcid_str),
+        quiclib_rawcidtostr (vc.scid, vc.scidlen, scid_str), peer_addr_str);
+    g_free (peer_addr_str);
+    break;
+  }
+  case NGTCP2_ERR_VERSION_NEGOTIATION:
+    GST_ERROR_OBJECT (socket_ctx->owner,
+        "Need to implement version negotiation!");
+    g_assert (0);
+    break;
+  default:
+    GST_WARNING_OBJECT (socket_ctx->owner,
+        "Could not decode version and CID from QUIC packet header: %s",
+        ngtcp2_strerror (rv));
+    return TRUE;
+  }
+
+  if (QUICLIB_SERVER (socket_ctx->owner)) {
+    GstQuicLibServerContext *server =
+        GST_QUICLIB_SERVER_CONTEXT (socket_ctx->owner);
+    GList *conn_it = server->connections;
+
+    quiclib_admission_sample (server, quiclib_ngtcp2_timestamp ());
+
+    while (conn_it != NULL) {
+      GList *cid = ((GstQuicLibTransportConnection *) conn_it->data)->cids;
+      while (cid != NULL) {
+        if (((ngtcp2_cid *) cid->data)->datalen == vc.dcidlen) {
+          if (memcmp (((ngtcp2_cid *) cid->data)->data, vc.dcid, vc.dcidlen)
+              == 0) {
+            conn = GST_QUICLIB_TRANSPORT_CONNECTION (conn_it->data);
+            break;
+          }
+        }
+        cid = cid->next;
+      }
+      if (cid) break;
+
+      conn_it = conn_it->next;
+    }
+
+    if (conn_it == NULL) {
+      ngtcp2_pkt_hd hdr;
+      ngtcp2_cid *new_scid, *dcid, odcid;
+      QuicLibAdmissionDecision admission;
+      gchar debug_scid_str[CID_STR_LEN], debug_dcid_str[CID_STR_LEN],
+      *debug_remote_addr;
+
+      /*
+       * Whether a Retry is needed is decided by quiclib_admission_check
+       * below, as ngtcp2_accept only checks that this is a valid Initial.
+       */
+      rv = ngtcp2_accept (&hdr, buf, bytes_read);
+      if (rv != 0) {
+        GST_WARNING_OBJECT (socket_ctx->owner,
+            "Unexpected packet of length %lu bytes", bytes_read);
+        return TRUE;
+      }
+
+      g_assert (hdr.type == NGTCP2_PKT_INITIAL);
+
+      admission = quiclib_admission_check (server, socket_ctx, &hdr,
+          peer_addr, &odcid);
+      if (admission == QUICLIB_ADMISSION_TURNED_AWAY) {
+        return TRUE;
+      }
+
+      conn = gst_quiclib_new_conn_from_server (server);
+      if (conn == NULL) {
+        GST_ERROR_OBJECT (socket_ctx->owner,
+            "Couldn't allocation connection context");
+        return TRUE;
+      }
+
+      new_scid = quiclib_slab_alloc (&conn->cid_slab);
+      if (new_scid == NULL) {
+        GST_ERROR_OBJECT (socket_ctx->owner,
+            "Couldn't allocate space for new SCID");
+        g_free (conn);
+        return TRUE;
+      }
+
+      if (!quiclib_generate_cid (conn, new_scid, 0)) {
+        g_free (conn);
+        return TRUE;
+      }
+
+      dcid = quiclib_slab_alloc (&conn->cid_slab);
+      if (dcid == NULL) {
+        GST_ERROR_OBJECT (socket_ctx->owner,
+            "Couldn't allocate space for new DCID");
+        quiclib_slab_free (&conn->cid_slab, new_scid);
+        g_free (conn);
+        return TRUE;
+      }
+      memcpy (dcid->data, hdr.scid.data, hdr.scid.datalen);
+      dcid->datalen = hdr.scid.datalen;
+
+      /* TODO: Should this be a copy, and then set the owner as the conn? */
+      conn->socket = socket_ctx;
+
+      ngtcp2_settings_default (&conn->conn_settings);
+
+      conn->conn_settings.initial_ts = quiclib_ngtcp2_timestamp ();
+      conn->last_ts = conn->conn_settings.initial_ts;
+      conn->conn_settings.log_printf = quiclib_ngtcp2_print;
+      /*
+       * Fine to just share the pointer - according to the ngtcp2_settings
+       * docs, ngtcp2_conn_server_new makes a copy of the token
+       */
+      conn->conn_settings.token = hdr.token;
+
+      conn->transport_params.stateless_reset_token_present = 0;
+      if (admission == QUICLIB_ADMISSION_ACCEPT_RETRIED) {
+        /* The client's address was validated by its Retry token */
+        conn->conn_settings.tokenlen = hdr.tokenlen;
+        conn->conn_settings.token_type = NGTCP2_TOKEN_TYPE_RETRY;
+        memcpy (&conn->transport_params.original_dcid, &odcid,
+            sizeof (ngtcp2_cid));
+        memcpy (&conn->transport_params.retry_scid, &hdr.dcid,
+            sizeof (ngtcp2_cid));
+        conn->transport_params.retry_scid_present = 1;
+      } else {
+        memcpy (&conn->transport_params.original_dcid, &hdr.dcid,
+            sizeof (ngtcp2_cid));
+      }
+      conn->transport_params.original_dcid_present = 1;
+
+      if (RAND_bytes (conn->transport_params.stateless_reset_token, 16) != 1) {
+        GST_WARNING_OBJECT (socket_ctx->owner,
+            "OpenSSL RAND_bytes failed to generate a stateless reset token:"
+            " %s", ERR_error_string (ERR_get_error (), NULL));
+      }
+
+      if (!quiclib_conn_set_preferred_addr (conn)) {
+        GST_WARNING_OBJECT (socket_ctx->owner,
+            "Couldn't set the preferred address transport parameter, clients "
+            "will stay on the address they connected to");
+        conn->transport_params.preferred_addr_present = 0;
+      }
+
+      switch (g_socket_address_get_family (peer_addr)) {
+      case G_SOCKET_FAMILY_IPV4:
+      {
+        struct sockaddr_in local_sa, remote_sa;
+        g_socket_address_to_native (local_addr, &local_sa,
+            sizeof (struct sockaddr_in), NULL);
+        g_socket_address_to_native (peer_addr, &remote_sa,
+            sizeof (struct sockaddr_in), NULL);
+        ngtcp2_path_storage_init (&conn->path,
+            (ngtcp2_sockaddr *) &local_sa, sizeof (struct sockaddr_in),
+            (ngtcp2_sockaddr *) &remote_sa, sizeof (struct sockaddr_in),
+            (void *) conn);
+        break;
+      }
+      case G_SOCKET_FAMILY_IPV6:
+      {
+        struct sockaddr_in6 local_sa, remote_sa;
+        g_socket_address_to_native (local_addr, &local_sa,
+            sizeof (struct sockaddr_in6), NULL);
+        g_socket_address_to_native (peer_addr, &remote_sa,
+            sizeof (struct sockaddr_in6), NULL);
+        ngtcp2_path_storage_init (&conn->path,
+            (ngtcp2_sockaddr *) &local_sa, sizeof (struct sockaddr_in6),
+            (ngtcp2_sockaddr *) &remote_sa, sizeof (struct sockaddr_in6),
+            (void *) conn);
+        break;
+      }
+      default:
+        GST_ERROR_OBJECT (socket_ctx->owner,
+            "Received unknown socket family %d",
+            g_socket_address_get_family (peer_addr));
+        return FALSE;
+      }
+
+      quiclib_print_ngtcp2_transport_params (
+          GST_QUICLIB_TRANSPORT_CONTEXT (conn), conn->transport_params);
+
+      rv = ngtcp2_conn_server_new (&conn->quic_conn, dcid, new_scid,
+          &conn->path.path, hdr.version, &quiclib_ngtcp2_server_callbacks,
+          &conn->conn_settings, &conn->transport_params, &conn->mem,
+          (void *) conn);
+      if (rv != 0) {
+        GST_ERROR_OBJECT (socket_ctx->owner,
+            "Failed to create new server instance: %s",
+            ngtcp2_strerror (rv));
+        g_free (conn);
+        return TRUE;
+      }
+
+      conn->ssl = SSL_new (server->ssl_ctx);
+      if (conn->ssl == NULL) {
+        GST_ERROR_OBJECT (socket_ctx->owner,
+            "Failed to configure server SSL context");
+        ngtcp2_conn_del (conn->quic_conn);
+        g_free (conn);
+        return TRUE;
+      }
+
+#ifdef OPENSSL_DEBUG
+      SSL_set_msg_callback (conn->ssl, quiclib_openssl_dbg_cb);
+      SSL_set_msg_callback_arg (conn->ssl, (void *) conn);
+#endif
+
+      quiclib_enable_tls_export (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+          conn->ssl);
+
+      conn->conn_ref.get_conn = quiclib_get_ngtcp2_conn;
+      conn->conn_ref.user_data = (void *) conn;
+
+      SSL_set_app_data (conn->ssl, &conn->conn_ref);
+      SSL_set_accept_state (conn->ssl);
+      SSL_set_quic_early_data_enabled (conn->ssl, 1);
+
+      ngtcp2_conn_set_tls_native_handle (conn->quic_conn, conn->ssl);
+
+      debug_remote_addr = g_socket_connectable_to_string (
+          G_SOCKET_CONNECTABLE (peer_addr));
+      GST_DEBUG_OBJECT (socket_ctx->owner,
+          "New client connect from %s, SCID %s DCID %s",
+          debug_remote_addr, quiclib_cidtostr (new_scid, debug_scid_str),
+          quiclib_cidtostr (dcid, debug_dcid_str));
+
+      conn->cids = g_list_append (conn->cids, new_scid);
+      conn->cids = g_list_append (conn->cids, dcid);
+
+      conn->initial_dcid = quiclib_slab_alloc (&conn->cid_slab);
+      if (conn->initial_dcid != NULL) {
+        memcpy (conn->initial_dcid, &hdr.dcid, sizeof (ngtcp2_cid));
+        conn->cids = g_list_append (conn->cids, conn->initial_dcid);
+      }
+
+      /* Clients address packets on the preferred address to its own CID */
+      if (conn->transport_params.preferred_addr_present) {
+        ngtcp2_cid *paddr_cid = quiclib_slab_alloc (&conn->cid_slab);
+        memcpy (paddr_cid, &conn->transport_params.preferred_addr.cid,
+            sizeof (ngtcp2_cid));
+        conn->cids = g_list_append (conn->cids, paddr_cid);
+      }
+    }
+  } else {
+    conn = GST_QUICLIB_TRANSPORT_CONNECTION (socket_ctx->owner);
+  }
+
+  if (stat) {
+    _quiclib_add_stat (conn, &conn->stats.bytes_received, stat->bytes,
+        stat->timestamp_ns);
+  }
+  conn->stats.pkt_counts.received++;
+  g_mutex_lock (&conn->stats.mutex);
+  conn->stats.ecn.rx[pi->ecn & 0x3]++;
+  g_mutex_unlock (&conn->stats.mutex);
+
+  arrival_ts = quiclib_rx_timestamp_to_ngtcp2 (rx_ts, &queueing_ns);
+
+  if (owner_priv->enable_stats && rx_ts != 0) {
+    g_mutex_lock (&conn->stats.mutex);
+    _quiclib_latency_histogram_add (&conn->stats.rx_queueing, queueing_ns);
+    g_mutex_unlock (&conn->stats.mutex);
+  }
+
+  if (rx_ts == 0 && owner_priv->enable_stats) {
+    struct timespec ts;
+
+    clock_gettime (CLOCK_REALTIME, &ts);
+    rx_ts = ((guint64) ts.tv_sec * 1000000000) + ts.tv_nsec;
+  }
+  conn->stats.rx_timestamp_ns = rx_ts;
+
+  if (ngtcp2_conn_in_closing_period (conn->quic_conn)) {
+    gchar *debug_remote_addr = g_socket_connectable_to_string (
+        G_SOCKET_CONNECTABLE (peer_addr));
+    GST_WARNING_OBJECT (socket_ctx->owner,
+        "Connection with %s is in closing period", debug_remote_addr);
+    g_free (debug_remote_addr);
+    return TRUE;
+  }
+
+  if (ngtcp2_conn_in_draining_period (conn->quic_conn)) {
+    gchar *debug_remote_addr = g_socket_connectable_to_string (
+        G_SOCKET_CONNECTABLE (peer_addr));
+    GST_WARNING_OBJECT (socket_ctx->owner,
+        "Connection with %s is in draining period", debug_remote_addr);
+    g_free (debug_remote_addr);
+    return TRUE;
+  }
+
+  if (!quiclib_path_storage_from_addresses (&ps, local_addr, peer_addr,
+      (void *) conn)) {
+    GST_WARNING_OBJECT (socket_ctx->owner,
+        "Couldn't convert the packet's addresses to a native path");
+    return TRUE;
+  }
+
+  rv = quiclib_transport_process_packet (conn, &ps.path, pi, buf, bytes_read,
+      arrival_ts);
+  if (rv != 0) {
+    return TRUE;
+  }
+
+  /*
+   * TODO: Make this a timeout operation to pack ACKs into regular packets
+   * and minimise small packet overheads
+   */
+  rv = quiclib_ngtcp2_conn_write (conn, -1, NULL, 0, 0);
+  if (rv != 0) {
+    return TRUE;
+  }
+
+  /*
+   * Wake up any threads waiting for cwnd
+   */
+  g_cond_signal (&conn->cond);
+
+  return TRUE;
+}
+
+/**
+ * quiclib_data_received
+ * 
+ * Called by the GLib socket handling code when there is a packet to read on the
+ * UDP socket.
+ * 
+ * INTERNAL FUNCTION ONLY.
+ */
+gboolean
+quiclib_data_received (GSocket *socket, GIOCondition condition,
+    gpointer user_data) {
+  QuicLibSocketContext *socket_ctx = (QuicLibSocketContext *) user_data;
+  GstQuicLibTransportContextPrivate *owner_priv =
+      gst_quiclib_transport_context_get_instance_private (socket_ctx->owner);
+  gssize bytes_read = 0;
+  GError *err = NULL;
+  gint64 spin_deadline = 0;
+  gboolean spin;
+  guint64 cpu_start = 0;
+
+  g_return_val_if_fail (socket == socket_ctx->socket, FALSE);
+
+  if (owner_priv->enable_stats) {
+    cpu_start = quiclib_thread_cpu_ns ();
+  }
+
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+  /*
+   * Zero-copy completions raise POLLERR, which wakes this source up. Always
+   * drain them here so it doesn't keep firing.
+   */
+  if (socket_ctx->zerocopy_threshold > 0) {
+    quiclib_socket_drain_zerocopy (socket_ctx);
+  }
+#endif
+
+  do {
+    GSocketAddress *peer_addr, *local_addr = NULL;
+    GInputVector ivec;
+    guint8 buf[MAX_UDP];
+    GSocketControlMessage **msgs;
+    GstQuicLibPacketStats stat = { 0, };
+    gint num_msgs, flags = G_SOCKET_MSG_NONE;
+    guint64 rx_ts = 0;
+
+    gboolean rv;
+    ngtcp2_pkt_info pi = { 0 };
+
+    ivec.buffer = buf;
+    ivec.size = MAX_UDP;
+    spin = FALSE;
+
+    if (!G_IS_OBJECT (socket_ctx->socket)) {
+      return FALSE;
+    }
+
+    bytes_read = g_socket_receive_message (socket_ctx->socket, &peer_addr,
+        &ivec, 1, &msgs, &num_msgs, &flags, NULL, &err);
+
+    if (bytes_read < 0) {
+      if (err->code == G_IO_ERROR_WOULD_BLOCK) {
+        bytes_read = 0;
+
+        /*
+         * In busy-poll mode, keep spinning on the non-blocking socket for up to
+         * busy_poll_budget microseconds after it last had data, to avoid the
+         * wakeup latency of going back to sleep in poll(). Timers attached to
+         * the loop can't fire while we spin, so the budget should be kept well
+         * below the connection's timer granularity. A shared loop never spins,
+         * as that would hold up every other connection on it.
+         */
+        if (owner_priv->busy_poll_budget > 0 &&
+            owner_priv->shared_loop == NULL) {
+          gint64 now = g_get_monotonic_time ();
+
+          if (spin_deadline == 0) {
+            spin_deadline = now + owner_priv->busy_poll_budget;
+          }
+
+          if (now < spin_deadline) {
+            g_error_free (err);
+            err = NULL;
+            spin = TRUE;
+            continue;
+          }
+        }
+
+        GST_DEBUG_OBJECT (socket_ctx->owner, "No more data, wait");
+      } else {
+        GST_ERROR_OBJECT (socket_ctx->owner,
+            "Couldn't receive UDP message: %s", err->message);
+      }
+      g_error_free (err);
+      err = NULL;
+      break;
+    }
+
+    GST_FIXME_OBJECT (socket_ctx->owner, "bytes_read: %ld, num_msgs: %d",
+        bytes_read, num_msgs);
+
+    /* Got data, so restart the spin budget the next time the socket is dry */
+    spin_deadline = 0;
+
+    quiclib_handle_control_messages (socket_ctx, msgs, num_msgs, bytes_read,
+        &pi, &local_addr, &stat, &rx_ts);
+
+    if (msgs) g_free (msgs);
+
+    if (local_addr == NULL) {
+      local_addr = g_socket_get_local_address (socket_ctx->socket, &err);
+    }
+
+    if (local_addr == NULL) {
+      GST_ERROR_OBJECT (socket_ctx->owner, "Couldn't get local address: %s",
+          err->message);
+      g_object_unref (peer_addr);
+      break;
+    }
+
+    rv = quiclib_handle_datagram (socket_ctx, buf, bytes_read, peer_addr,
+        local_addr, &pi, stat.timestamp_ns != 0 ? &stat : NULL, rx_ts);
+
+    g_object_unref (peer_addr);
+    g_object_unref (local_addr);
+
+    if (!rv) {
+      return FALSE;
+    }
+  } while (bytes_read > 0 || spin);
+
+  quiclib_socket_account_rx (socket_ctx, cpu_start);
+
+  if (err != NULL) {
+    g_error_free (err);
+  }
+
+  return bytes_read == 0?TRUE:FALSE;
+}
+
+#ifdef HAVE_LIBURING
+/**
+ * quiclib_uring_arm_recv
+ *
+ * Submits a multishot recvmsg that reads into the provided buffer ring. This
+ * stays armed and produces a completion per datagram until the kernel drops
+ * it, for example when the buffer ring runs dry.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_uring_arm_recv (QuicLibSocketContext *socket_ctx)
+{
+  QuicLibUring *uring = socket_ctx->uring;
+  struct io_uring_sqe *sqe;
+
+  g_mutex_lock (&uring->sq_mutex);
+
+  sqe = quiclib_uring_get_sqe_locked (socket_ctx);
+  if (sqe == NULL) {
+    g_mutex_unlock (&uring->sq_mutex);
+    GST_ERROR_OBJECT (socket_ctx->owner,
+        "No space in the io_uring submission queue to arm receive");
+    return FALSE;
+  }
+
+  io_uring_prep_recvmsg_multishot (sqe, g_socket_get_fd (socket_ctx->socket),
+      &uring->rx_msg, 0);
+  sqe->flags |= IOSQE_BUFFER_SELECT;
+  sqe->buf_group = QUICLIB_URING_RX_BGID;
+  io_uring_sqe_set_data (sqe, NULL);
+  uring->pending++;
+
+  quiclib_uring_submit_locked (socket_ctx);
+
+  g_mutex_unlock (&uring->sq_mutex);
+
+  return TRUE;
+}
+
+/**
+ * quiclib_uring_handle_recv
+ *
+ * Unpacks a datagram received by the multishot recvmsg into @rxbuf and hands
+ * it to quiclib_handle_datagram, in the same way as quiclib_data_received does
+ * for the GSocket backend.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_uring_handle_recv (QuicLibSocketContext *socket_ctx, guint8 *rxbuf,
+    gint res)
+{
+  QuicLibUring *uring = socket_ctx->uring;
+  struct io_uring_recvmsg_out *out;
+  struct cmsghdr *cmsg;
+  GSocketControlMessage *msgs[8];
+  GSocketAddress *peer_addr, *local_addr = NULL;
+  GstQuicLibPacketStats stat = { 0, };
+  ngtcp2_pkt_info pi = { 0 };
+  guint64 rx_ts = 0;
+  gint num_msgs = 0;
+  gssize bytes_read;
+  gboolean rv;
+
+  out = io_uring_recvmsg_validate (rxbuf, res, &uring->rx_msg);
+  if (out == NULL) {
+    GST_WARNING_OBJECT (socket_ctx->owner,
+        "Discarding malformed io_uring receive of %d bytes", res);
+    return TRUE;
+  }
+
+  if (out->flags & MSG_TRUNC) {
+    GST_WARNING_OBJECT (socket_ctx->owner, "Discarding truncated datagram");
+    return TRUE;
+  }
+
+  bytes_read = io_uring_recvmsg_payload_length (out, res, &uring->rx_msg);
+
+  peer_addr = g_socket_address_new_from_native (io_uring_recvmsg_name (out),
+      MIN (out->namelen, uring->rx_msg.msg_namelen));
+  if (peer_addr == NULL) {
+    GST_WARNING_OBJECT (socket_ctx->owner,
+        "Couldn't parse peer address of received datagram");
+    return TRUE;
+  }
+
+  /*
+   * Let GIO build the same control message objects as g_socket_receive_message
+   * would have, so the parsing is shared with the GSocket backend.
+   */
+  for (cmsg = io_uring_recvmsg_cmsg_firsthdr (out, &uring->rx_msg);
+      cmsg != NULL && num_msgs < (gint) G_N_ELEMENTS (msgs);
+      cmsg = io_uring_recvmsg_cmsg_nexthdr (out, &uring->rx_msg, cmsg)) {
+    GSocketControlMessage *scm = g_socket_control_message_deserialize (
+        cmsg->cmsg_level, cmsg->cmsg_type, cmsg->cmsg_len - CMSG_LEN (0),
+        CMSG_DATA (cmsg));
+
+    if (scm != NULL) {
+      msgs[num_msgs++] = scm;
+    }
+  }
+
+  quiclib_handle_control_messages (socket_ctx, msgs, num_msgs, bytes_read,
+      &pi, &local_addr, &stat, &rx_ts);
+
+  if (local_addr == NULL) {
+    local_addr = g_socket_get_local_address (socket_ctx->socket, NULL);
+  }
+
+  if (local_addr == NULL) {
+    GST_ERROR_OBJECT (socket_ctx->owner, "Couldn't get local address");
+    g_object_unref (peer_addr);
+    return TRUE;
+  }
+
+  rv = quiclib_handle_datagram (socket_ctx,
+      (guint8 *) io_uring_recvmsg_payload (out, &uring->rx_msg), bytes_read,
+      peer_addr, local_addr, &pi, stat.timestamp_ns != 0 ? &stat : NULL,
+      rx_ts);
+
+  g_object_unref (peer_addr);
+  g_object_unref (local_addr);
+
+  return rv;
+}
+
+/**
+ * quiclib_uring_completions
+ *
+ * Called on the transport thread when the io_uring's eventfd signals that
+ * there are completions to reap. Processes all received datagrams, recycles
+ * their buffers and frees completed sends. Any packets written in response are
+ * submitted together at the end.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_uring_completions (gint fd, GIOCondition condition,
+    gpointer user_data)
+{
+  QuicLibSocketContext *socket_ctx = (QuicLibSocketContext *) user_data;
+  QuicLibUring *uring = socket_ctx->uring;
+  GstQuicLibTransportContextPrivate *owner_priv =
+      gst_quiclib_transport_context_get_instance_private (socket_ctx->owner);
+  struct io_uring_cqe *cqe;
+  guint64 events, cpu_start = 0;
+  gboolean keep = TRUE, rearm = FALSE;
+
+  if (owner_priv->enable_stats) {
+    cpu_start = quiclib_thread_cpu_ns ();
+  }
+
+  if (read (uring->event_fd, &events, sizeof (events)) < 0 && errno != EAGAIN) {
+    GST_WARNING_OBJECT (socket_ctx->owner, "Couldn't read io_uring eventfd: %s",
+        g_strerror (errno));
+  }
+
+  g_mutex_lock (&uring->sq_mutex);
+  uring->batch_thread = g_thread_self ();
+  g_mutex_unlock (&uring->sq_mutex);
+
+  while (keep && io_uring_peek_cqe (&uring->ring, &cqe) == 0) {
+    QuicLibUringTx *tx = (QuicLibUringTx *) io_uring_cqe_get_data (cqe);
+
+    if (tx != NULL) {
+      if (cqe->res < 0) {
+        GST_WARNING_OBJECT (socket_ctx->owner, "io_uring sendmsg failed: %s",
+            g_strerror (-cqe->res));
+      }
+      g_free (tx);
+      g_atomic_int_dec_and_test (&uring->tx_inflight);
+    } else {
+      if (cqe->res < 0) {
+        /* ENOBUFS just means the buffer ring ran dry, it'll be re-armed */
+        if (cqe->res != -ENOBUFS) {
+          GST_WARNING_OBJECT (socket_ctx->owner,
+              "io_uring recvmsg failed: %s", g_strerror (-cqe->res));
+        }
+      } else if (cqe->flags & IORING_CQE_F_BUFFER) {
+        guint bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        guint8 *rxbuf = uring->rx_bufs + (bid * uring->rx_buf_size);
+
+        keep = quiclib_uring_handle_recv (socket_ctx, rxbuf, cqe->res);
+
+        io_uring_buf_ring_add (uring->buf_ring, rxbuf, uring->rx_buf_size, bid,
+            io_uring_buf_ring_mask (QUICLIB_URING_RX_BUFFERS), 0);
+        io_uring_buf_ring_advance (uring->buf_ring, 1);
+      }
+
+      if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        rearm = TRUE;
+      }
+    }
+
+    io_uring_cqe_seen (&uring->ring, cqe);
+  }
+
+  g_mutex_lock (&uring->sq_mutex);
+  uring->batch_thread = NULL;
+  quiclib_uring_submit_locked (socket_ctx);
+  g_mutex_unlock (&uring->sq_mutex);
+
+  quiclib_socket_account_rx (socket_ctx, cpu_start);
+
+  if (keep && rearm) {
+    keep = quiclib_uring_arm_recv (socket_ctx);
+  }
+
+  return keep ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+/**
+ * quiclib_uring_new
+ *
+ * Sets up an io_uring for @socket_ctx, with a provided buffer ring for
+ * receives and an eventfd for completion notifications. Returns NULL if
+ * io_uring or any of the features needed aren't supported by the running
+ * kernel, in which case the caller should fall back to the GSocket backend.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static QuicLibUring *
+quiclib_uring_new (QuicLibSocketContext *socket_ctx)
+{
+  QuicLibUring *uring;
+  struct io_uring_probe *probe;
+  gboolean supported;
+  gint rv, i;
+
+  uring = g_new0 (QuicLibUring, 1);
+  uring->event_fd = -1;
+  g_mutex_init (&uring->sq_mutex);
+
+  rv = io_uring_queue_init (QUICLIB_URING_ENTRIES, &uring->ring, 0);
+  if (rv < 0) {
+    GST_WARNING_OBJECT (socket_ctx->owner, "Couldn't set up io_uring: %s",
+        g_strerror (-rv));
+    g_mutex_clear (&uring->sq_mutex);
+    g_free (uring);
+    return NULL;
+  }
+
+  /*
+   * There's no way to probe for multishot recvmsg directly. It arrived in the
+   * same kernel release (6.0) as IORING_OP_SEND_ZC, so use that as a proxy.
+   */
+  probe = io_uring_get_probe_ring (&uring->ring);
+  supported = probe != NULL &&
+      io_uring_opcode_supported (probe, IORING_OP_SENDMSG) &&
+      io_uring_opcode_supported (probe, IORING_OP_SEND_ZC);
+  if (probe != NULL) {
+    io_uring_free_probe (probe);
+  }
+  if (!supported) {
+    GST_WARNING_OBJECT (socket_ctx->owner,
+        "Kernel io_uring doesn't support multishot recvmsg");
+    goto failed;
+  }
+
+  uring->rx_msg.msg_namelen = sizeof (struct sockaddr_storage);
+  uring->rx_msg.msg_controllen = QUICLIB_URING_CONTROL_LEN;
+  uring->rx_buf_size = sizeof (struct io_uring_recvmsg_out) +
+      uring->rx_msg.msg_namelen + uring->rx_msg.msg_controllen + MAX_UDP;
+  uring->rx_bufs = g_malloc (uring->rx_buf_size * QUICLIB_URING_RX_BUFFERS);
+
+  uring->buf_ring = io_uring_setup_buf_ring (&uring->ring,
+      QUICLIB_URING_RX_BUFFERS, QUICLIB_URING_RX_BGID, 0, &rv);
+  if (uring->buf_ring == NULL) {
+    GST_WARNING_OBJECT (socket_ctx->owner,
+        "Couldn't register io_uring provided buffer ring: %s",
+        g_strerror (-rv));
+    goto failed;
+  }
+
+  for (i = 0; i < QUICLIB_URING_RX_BUFFERS; i++) {
+    io_uring_buf_ring_add (uring->buf_ring,
+        uring->rx_bufs + (i * uring->rx_buf_size), uring->rx_buf_size, i,
+        io_uring_buf_ring_mask (QUICLIB_URING_RX_BUFFERS), i);
+  }
+  io_uring_buf_ring_advance (uring->buf_ring, QUICLIB_URING_RX_BUFFERS);
+
+  uring->event_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (uring->event_fd < 0) {
+    GST_WARNING_OBJECT (socket_ctx->owner, "Couldn't create eventfd: %s",
+        g_strerror (errno));
+    goto failed;
+  }
+
+  rv = io_uring_register_eventfd (&uring->ring, uring->event_fd);
+  if (rv < 0) {
+    GST_WARNING_OBJECT (socket_ctx->owner,
+        "Couldn't register eventfd with io_uring: %s", g_strerror (-rv));
+    goto failed;
+  }
+
+  return uring;
+
+failed:
+  quiclib_uring_free (uring);
+  return NULL;
+}
+
+/**
+ * quiclib_uring_start
+ *
+ * Attaches the io_uring's eventfd to @context and arms the first receive.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_uring_start (QuicLibSocketContext *socket_ctx, GMainContext *context)
+{
+  QuicLibUring *uring = socket_ctx->uring;
+
+  uring->source = g_unix_fd_source_new (uring->event_fd, G_IO_IN);
+  g_source_set_callback (uring->source,
+      (GSourceFunc) quiclib_uring_completions, socket_ctx, NULL);
+  g_source_attach (uring->source, context);
+
+  return quiclib_uring_arm_recv (socket_ctx);
+}
+#endif
+
+#ifdef HAVE_LIBXDP
+/**
+ * quiclib_xdp_address_new
+ *
+ * Makes a socket address of @family from the 4 or 16 byte IP address @ip and
+ * @port, in network byte order. An IPv4 address is mapped into IPv6 for an
+ * IPv6 socket, as the kernel would have done. Returns NULL if the address
+ * can't be represented in @family.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static GSocketAddress *
+quiclib_xdp_address_new (GSocketFamily family, const guint8 *ip, gsize ip_len,
+    guint16 port)
+{
+  struct sockaddr_in sin = { 0, };
+  struct sockaddr_in6 sin6 = { 0, };
+
+  if (family == G_SOCKET_FAMILY_IPV4) {
+    if (ip_len != 4) {
+      return NULL;
+    }
+
+    sin.sin_family = AF_INET;
+    sin.sin_port = port;
+    memcpy (&sin.sin_addr, ip, 4);
+
+    return g_socket_address_new_from_native (&sin, sizeof (sin));
+  }
+
+  sin6.sin6_family = AF_INET6;
+  sin6.sin6_port = port;
+  if (ip_len == 4) {
+    sin6.sin6_addr.s6_addr[10] = 0xff;
+    sin6.sin6_addr.s6_addr[11] = 0xff;
+    memcpy (&sin6.sin6_addr.s6_addr[12], ip, 4);
+  } else {
+    memcpy (&sin6.sin6_addr, ip, 16);
+  }
+
+  return g_socket_address_new_from_native (&sin6, sizeof (sin6));
+}
+
+/**
+ * quiclib_xdp_handle_frame
+ *
+ * Parses the headers of a frame that the XDP program redirected to the AF_XDP
+ * socket, remembers the addresses needed to send packets back to the peer and
+ * hands the UDP payload to quiclib_handle_datagram, in the same way as
+ * quiclib_data_received does for the GSocket backend.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_xdp_handle_frame (QuicLibSocketContext *socket_ctx, guint8 *frame,
+    guint32 frame_len)
+{
+  GstQuicLibTransportContextPrivate *owner_priv =
+      gst_quiclib_transport_context_get_instance_private (socket_ctx->owner);
+  QuicLibXdp *xdp = socket_ctx->xdp;
+  struct ether_header *eth = (struct ether_header *) frame;
+  QuicLibXdpNeighbour *neigh;
+  GSocketAddress *peer_addr, *local_addr;
+  GSocketFamily family;
+  GstQuicLibPacketStats stat = { 0, };
+  ngtcp2_pkt_info pi = { 0 };
+  struct udphdr *udp;
+  const guint8 *src_ip, *dst_ip;
+  gsize ip_len, udp_len;
+  GBytes *key;
+  gboolean rv;
+
+  /* Only UDP over IPv4 without options or IPv6 without extension headers */
+  if (frame_len < sizeof (struct ether_header)) {
+    return TRUE;
+  }
+
+  if (eth->ether_type == g_htons (ETHERTYPE_IP)) {
+    struct iphdr *ip = (struct iphdr *) (eth + 1);
+
+    if (frame_len < sizeof (struct ether_header) + sizeof (struct iphdr) +
+        sizeof (struct udphdr) || ip->ihl != sizeof (struct iphdr) / 4 ||
+        ip->protocol != IPPROTO_UDP) {
+      return TRUE;
+    }
+
+    pi.ecn = ip->tos & NGTCP2_ECN_MASK;
+    src_ip = (const guint8 *) &ip->saddr;
+    dst_ip = (const guint8 *) &ip->daddr;
+    ip_len = 4;
+    udp = (struct udphdr *) (ip + 1);
+  } else if (eth->ether_type == g_htons (ETHERTYPE_IPV6)) {
+    struct ip6_hdr *ip6 = (struct ip6_hdr *) (eth + 1);
+
+    if (frame_len < sizeof (struct ether_header) + sizeof (struct ip6_hdr) +
+        sizeof (struct udphdr) || ip6->ip6_nxt != IPPROTO_UDP) {
+      return TRUE;
+    }
+
+    pi.ecn = (g_ntohl (ip6->ip6_flow) >> 20) & NGTCP2_ECN_MASK;
+    src_ip = (const guint8 *) &ip6->ip6_src;
+    dst_ip = (const guint8 *) &ip6->ip6_dst;
+    ip_len = 16;
+    udp = (struct udphdr *) (ip6 + 1);
+  } else {
+    return TRUE;
+  }
+
+  udp_len = g_ntohs (udp->len);
+  if (udp_len < sizeof (struct udphdr) ||
+      (guint8 *) udp + udp_len > frame + frame_len) {
+    GST_WARNING_OBJECT (socket_ctx->owner, "Discarding truncated datagram");
+    return TRUE;
+  }
+
+  family = g_socket_get_family (socket_ctx->socket);
+  peer_addr = quiclib_xdp_address_new (family, src_ip, ip_len, udp->source);
+  if (peer_addr == NULL) {
+    GST_DEBUG_OBJECT (socket_ctx->owner,
+        "Discarding IPv6 datagram for IPv4 socket");
+    return TRUE;
+  }
+  local_addr = quiclib_xdp_address_new (family, dst_ip, ip_len, udp->dest);
+
+  /*
+   * Replies go back the way this frame came. The table is bounded, as each
+   * spoofed source address would otherwise add an entry.
+   */
+  key = g_bytes_new (src_ip, ip_len);
+  g_mutex_lock (&xdp->neigh_mutex);
+  neigh = (QuicLibXdpNeighbour *) g_hash_table_lookup (xdp->neighbours, key);
+  if (neigh == NULL) {
+    if (g_hash_table_size (xdp->neighbours) >= QUICLIB_XDP_MAX_NEIGHBOURS) {
+      g_hash_table_remove_all (xdp->neighbours);
+    }
+    neigh = g_new0 (QuicLibXdpNeighbour, 1);
+    g_hash_table_insert (xdp->neighbours, key, neigh);
+  } else {
+    g_bytes_unref (key);
+  }
+  memcpy (neigh->local_mac, eth->ether_dhost, ETH_ALEN);
+  memcpy (neigh->next_hop_mac, eth->ether_shost, ETH_ALEN);
+  memcpy (neigh->local_ip, dst_ip, ip_len);
+  g_mutex_unlock (&xdp->neigh_mutex);
+
+  /* There's no kernel receive timestamp for frames that bypass the stack */
+  if (owner_priv->enable_stats) {
+    stat.bytes = udp_len - sizeof (struct udphdr);
+    stat.timestamp_ns = (guint64) g_get_real_time () * 1000;
+  }
+
+  rv = quiclib_handle_datagram (socket_ctx, (guint8 *) (udp + 1),
+      udp_len - sizeof (struct udphdr), peer_addr, local_addr, &pi,
+      stat.timestamp_ns != 0 ? &stat : NULL, 0);
+
+  g_object_unref (peer_addr);
+  g_object_unref (local_addr);
+
+  return rv;
+}
+
+/**
+ * quiclib_xdp_receive
+ *
+ * Called on the transport thread when the AF_XDP socket has received frames.
+ * Handles each of them and gives their buffers straight back to the kernel.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_xdp_receive (gint fd, GIOCondition condition, gpointer user_data)
+{
+  QuicLibSocketContext *socket_ctx = (QuicLibSocketContext *) user_data;
+  QuicLibXdp *xdp = socket_ctx->xdp;
+  GstQuicLibTransportContextPrivate *owner_priv =
+      gst_quiclib_transport_context_get_instance_private (socket_ctx->owner);
+  guint32 rx_idx, fill_idx, n, i, reserved;
+  guint64 cpu_start = 0;
+  gboolean keep = TRUE;
+
+  if (owner_priv->enable_stats) {
+    cpu_start = quiclib_thread_cpu_ns ();
+  }
+
+  while (keep &&
+      (n = xsk_ring_cons__peek (&xdp->rx, QUICLIB_XDP_RX_BATCH, &rx_idx)) > 0) {
+    /*
+     * The fill ring has room for every receive frame, so there's always space
+     * for the ones just taken off the receive ring.
+     */
+    reserved = xsk_ring_prod__reserve (&xdp->fill, n, &fill_idx);
+    g_assert (reserved == n);
+
+    for (i = 0; i < n; i++) {
+      const struct xdp_desc *desc =
+          xsk_ring_cons__rx_desc (&xdp->rx, rx_idx + i);
+
+      if (keep) {
+        keep = quiclib_xdp_handle_frame (socket_ctx,
+            xsk_umem__get_data (xdp->umem_area, desc->addr), desc->len);
+      }
+
+      *xsk_ring_prod__fill_addr (&xdp->fill, fill_idx + i) =
+          desc->addr & ~((guint64) QUICLIB_XDP_FRAME_SIZE - 1);
+    }
+
+    xsk_ring_prod__submit (&xdp->fill, n);
+    xsk_ring_cons__release (&xdp->rx, n);
+  }
+
+  if (xsk_ring_prod__needs_wakeup (&xdp->fill)) {
+    recvfrom (fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+  }
+
+  quiclib_socket_account_rx (socket_ctx, cpu_start);
+
+  return keep ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+#define QUICLIB_BPF_INSN(c, d, s, o, i) \
+    { .code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i) }
+
+/**
+ * quiclib_xdp_load_prog
+ *
+ * Creates the XSKMAP holding the AF_XDP socket at @queue, and loads an XDP
+ * program that redirects UDP packets for the socket's port into it. Packets
+ * for any other port, or that arrive on a queue with no socket in the map,
+ * are passed to the kernel as normal, so ARP and everything else on the
+ * interface keep working.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_xdp_load_prog (QuicLibSocketContext *socket_ctx, QuicLibXdp *xdp,
+    guint queue)
+{
+  gint xsk_fd = xsk_socket__fd (xdp->xsk);
+  gint key = (gint) queue;
+
+  xdp->map_fd = bpf_map_create (BPF_MAP_TYPE_XSKMAP, "quiclib_xsks",
+      sizeof (gint), sizeof (gint), QUICLIB_XDP_QUEUE_MAX + 1, NULL);
+  if (xdp->map_fd < 0) {
+    GST_WARNING_OBJECT (socket_ctx->owner, "Couldn't create XSKMAP: %s",
+        g_strerror (errno));
+    return FALSE;
+  }
+
+  if (bpf_map_update_elem (xdp->map_fd, &key, &xsk_fd, BPF_ANY) < 0) {
+    GST_WARNING_OBJECT (socket_ctx->owner,
+        "Couldn't add AF_XDP socket to XSKMAP: %s", g_strerror (errno));
+    return FALSE;
+  }
+
+  {
+    /*
+     * Jump offsets count instructions from the one after the jump. Loads
+     * from the packet are in host byte order, so compare against values in
+     * network byte order.
+     */
+    struct bpf_insn insns[] = {
+      /* 0: r6 = ctx, r2 = data, r3 = data_end */
+      QUICLIB_BPF_INSN (BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0,
+          0),
+      QUICLIB_BPF_INSN (BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_6,
+          offsetof (struct xdp_md, data), 0),
+      QUICLIB_BPF_INSN (BPF_LDX | BPF_MEM | BPF_W, BPF_REG_3, BPF_REG_6,
+          offsetof (struct xdp_md, data_end), 0),
+      /* 3: Ethernet header */
+      QUICLIB_BPF_INSN (BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0,
+          0),
+      QUICLIB_BPF_INSN (BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, 14),
+      QUICLIB_BPF_INSN (BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 26,
+          0),
+      QUICLIB_BPF_INSN (BPF_LDX | BPF_MEM | BPF_H, BPF_REG_5, BPF_REG_2, 12,
+          0),
+      QUICLIB_BPF_INSN (BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_5, 0, 2,
+          g_htons (ETHERTYPE_IP)),
+      QUICLIB_BPF_INSN (BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_5, 0, 10,
+          g_htons (ETHERTYPE_IPV6)),
+      QUICLIB_BPF_INSN (BPF_JMP | BPF_JA, 0, 0, 22, 0),
+      /* 10: IPv4 without options, then UDP destination port */
+      QUICLIB_BPF_INSN (BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0,
+          0),
+      QUICLIB_BPF_INSN (BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, 42),
+      QUICLIB_BPF_INSN (BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 19,
+          0),
+      QUICLIB_BPF_INSN (BPF_LDX | BPF_MEM | BPF_B, BPF_REG_5, BPF_REG_2, 14,
+          0),
+      QUICLIB_BPF_INSN (BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, 17, 0x45),
+      QUICLIB_BPF_INSN (BPF_LDX | BPF_MEM | BPF_B, BPF_REG_5, BPF_REG_2, 23,
+          0),
+      QUICLIB_BPF_INSN (BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, 15,
+          IPPROTO_UDP),
+      QUICLIB_BPF_INSN (BPF_LDX | BPF_MEM | BPF_H, BPF_REG_5, BPF_REG_2, 36,
+          0),
+      QUICLIB_BPF_INSN (BPF_JMP | BPF_JA, 0, 0, 6, 0),
+      /* 19: IPv6 without extension headers, then UDP destination port */
+      QUICLIB_BPF_INSN (BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0,
+          0),
+      QUICLIB_BPF_INSN (BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, 62),
+      QUICLIB_BPF_INSN (BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 10,
+          0),
+      QUICLIB_BPF_INSN (BPF_LDX | BPF_MEM | BPF_B, BPF_REG_5, BPF_REG_2, 20,
+          0),
+      QUICLIB_BPF_INSN (BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, 8,
+          IPPROTO_UDP),
+      QUICLIB_BPF_INSN (BPF_LDX | BPF_MEM | BPF_H, BPF_REG_5, BPF_REG_2, 56,
+          0),
+      /* 25: Redirect to the socket for this queue, or pass if there's none */
+      QUICLIB_BPF_INSN (BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, 6, xdp->port),
+      QUICLIB_BPF_INSN (BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_6,
+          offsetof (struct xdp_md, rx_queue_index), 0),
+      QUICLIB_BPF_INSN (BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1,
+          BPF_PSEUDO_MAP_FD, 0, xdp->map_fd),
+      QUICLIB_BPF_INSN (0, 0, 0, 0, 0),
+      QUICLIB_BPF_INSN (BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0,
+          XDP_PASS),
+      QUICLIB_BPF_INSN (BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+      QUICLIB_BPF_INSN (BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+      /* 32: Not ours */
+      QUICLIB_BPF_INSN (BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0,
+          XDP_PASS),
+      QUICLIB_BPF_INSN (BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+    };
+
+    xdp->prog_fd = bpf_prog_load (BPF_PROG_TYPE_XDP, "quiclib_xsk", "MIT",
+        insns, G_N_ELEMENTS (insns), NULL);
+  }
+
+  if (xdp->prog_fd < 0) {
+    GST_WARNING_OBJECT (socket_ctx->owner, "Couldn't load XDP program: %s",
+        g_strerror (errno));
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+#undef QUICLIB_BPF_INSN
+
+/**
+ * quiclib_xdp_new
+ *
+ * Sets up an AF_XDP socket on receive queue @queue of @ifname, and attaches an
+ * XDP program to the interface that redirects UDP packets for @port, in
+ * network byte order, to it. Only one program can be attached to an interface
+ * at a time, so only one socket per interface can use AF_XDP. Returns NULL if
+ * any of this fails, in which case the caller should fall back to the GSocket
+ * backend.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static QuicLibXdp *
+quiclib_xdp_new (QuicLibSocketContext *socket_ctx, const gchar *ifname,
+    guint queue, gboolean skb_mode, guint16 port)
+{
+  struct xsk_umem_config umem_cfg = {
+    .fill_size = QUICLIB_XDP_RING_SIZE,
+    .comp_size = QUICLIB_XDP_RING_SIZE,
+    .frame_size = QUICLIB_XDP_FRAME_SIZE,
+    .frame_headroom = 0,
+    .flags = 0
+  };
+  struct xsk_socket_config xsk_cfg = {
+    .rx_size = QUICLIB_XDP_RING_SIZE,
+    .tx_size = QUICLIB_XDP_RING_SIZE,
+    .libxdp_flags = XSK_LIBXDP_FLAGS__INHIBIT_PROG_LOAD,
+    .xdp_flags = 0,
+    .bind_flags = XDP_USE_NEED_WAKEUP
+  };
+  gsize umem_size = (gsize) QUICLIB_XDP_FRAMES * QUICLIB_XDP_FRAME_SIZE;
+  QuicLibXdp *xdp;
+  guint32 idx, reserved;
+  gint rv, i;
+
+  if (ifname == NULL || *ifname == '\0') {
+    GST_WARNING_OBJECT (socket_ctx->owner,
+        "No interface set for the AF_XDP backend");
+    return NULL;
+  }
+
+  xdp = g_new0 (QuicLibXdp, 1);
+  xdp->prog_fd = -1;
+  xdp->map_fd = -1;
+  xdp->port = port;
+  xdp->mode_flags = skb_mode ? XDP_FLAGS_SKB_MODE : XDP_FLAGS_DRV_MODE;
+  g_mutex_init (&xdp->tx_mutex);
+  g_mutex_init (&xdp->neigh_mutex);
+  xdp->neighbours = g_hash_table_new_full (g_bytes_hash, g_bytes_equal,
+      (GDestroyNotify) g_bytes_unref, g_free);
+
+  xdp->ifindex = if_nametoindex (ifname);
+  if (xdp->ifindex == 0) {
+    GST_WARNING_OBJECT (socket_ctx->owner, "Unknown interface %s: %s", ifname,
+        g_strerror (errno));
+    goto failed;
+  }
+
+  xdp->umem_area = mmap (NULL, umem_size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (xdp->umem_area == MAP_FAILED) {
+    GST_WARNING_OBJECT (socket_ctx->owner,
+        "Couldn't allocate AF_XDP packet buffers: %s", g_strerror (errno));
+    xdp->umem_area = NULL;
+    goto failed;
+  }
+
+  rv = xsk_umem__create (&xdp->umem, xdp->umem_area, umem_size, &xdp->fill,
+      &xdp->comp, &umem_cfg);
+  if (rv < 0) {
+    GST_WARNING_OBJECT (socket_ctx->owner,
+        "Couldn't register AF_XDP packet buffers: %s", g_strerror (-rv));
+    xdp->umem = NULL;
+    goto failed;
+  }
+
+  /* Generic XDP can't hand frames to the socket without copying them */
+  if (skb_mode) {
+    xsk_cfg.bind_flags |= XDP_COPY;
+  }
+
+  rv = xsk_socket__create (&xdp->xsk, ifname, queue, xdp->umem, &xdp->rx,
+      &xdp->tx, &xsk_cfg);
+  if (rv < 0) {
+    GST_WARNING_OBJECT (socket_ctx->owner,
+        "Couldn't create AF_XDP socket on %s queue %u: %s", ifname, queue,
+        g_strerror (-rv));
+    xdp->xsk = NULL;
+    goto failed;
+  }
+
+  reserved = xsk_ring_prod__reserve (&xdp->fill, QUICLIB_XDP_RING_SIZE, &idx);
+  g_assert (reserved == QUICLIB_XDP_RING_SIZE);
+  for (i = 0; i < QUICLIB_XDP_RING_SIZE; i++) {
+    *xsk_ring_prod__fill_addr (&xdp->fill, idx + i) =
+        (guint64) i * QUICLIB_XDP_FRAME_SIZE;
+    xdp->tx_free[i] =
+        (guint64) (QUICLIB_XDP_RING_SIZE + i) * QUICLIB_XDP_FRAME_SIZE;
+  }
+  xsk_ring_prod__submit (&xdp->fill, QUICLIB_XDP_RING_SIZE);
+  xdp->n_tx_free = QUICLIB_XDP_RING_SIZE;
+
+  if (!quiclib_xdp_load_prog (socket_ctx, xdp, queue)) {
+    goto failed;
+  }
+
+  rv = bpf_xdp_attach (xdp->ifindex, xdp->prog_fd,
+      xdp->mode_flags | XDP_FLAGS_UPDATE_IF_NOEXIST, NULL);
+  if (rv < 0) {
+    GST_WARNING_OBJECT (socket_ctx->owner,
+        "Couldn't attach XDP program to %s: %s", ifname, g_strerror (-rv));
+    goto failed;
+  }
+  xdp->attached = TRUE;
+
+  return xdp;
+
+failed:
+  quiclib_xdp_free (xdp);
+  return NULL;
+}
+
+/**
+ * quiclib_xdp_start
+ *
+ * Attaches the AF_XDP socket to @context, to start handling received frames.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_xdp_start (QuicLibSocketContext *socket_ctx, GMainContext *context)
+{
+  QuicLibXdp *xdp = socket_ctx->xdp;
+
+  xdp->source = g_unix_fd_source_new (xsk_socket__fd (xdp->xsk), G_IO_IN);
+  g_source_set_callback (xdp->source, (GSourceFunc) quiclib_xdp_receive,
+      socket_ctx, NULL);
+  g_source_attach (xdp->source, context);
+}
+#endif
+
+/**
+ * quiclib_open_socket
+ * 
+ * Common code for opening listening sockets for QUIC connections.
+ * 
+ * INTERNAL FUNCTION ONLY.
+ */
+QuicLibSocketContext *
+quiclib_open_socket (GstQuicLibTransportContext *ctx, GSocketAddress *addr)
+{
+  GstQuicLibTransportContextPrivate *priv;
+  GSocketAddress *local, *remote;
+  gchar *debug_addr;
+  GSocket *socket;
+  GSource *source;
+  QuicLibSocketContext *socket_ctx;
+  GSocketFamily fam;
+  GError *err;
+  guint16 local_port;
+  gchar thread_name[16], async_thread_name[16];
+
+  priv = gst_quiclib_transport_context_get_instance_private (ctx);
+  debug_addr =
+      g_socket_connectable_to_string (G_SOCKET_CONNECTABLE (addr));
+
+  fam = g_socket_address_get_family ((GSocketAddress *) addr);
+
+  socket = g_socket_new (fam, G_SOCKET_TYPE_DATAGRAM, G_SOCKET_PROTOCOL_UDP,
+      &err);
+
+  if (socket == NULL) {
+    GST_ERROR_OBJECT (ctx, "Failed to open socket: %s", err->message);
+    goto no_socket;
+  }
+
+  switch (fam) {
+  case G_SOCKET_FAMILY_IPV4:
+    if (!g_socket_set_option (socket, IPPROTO_IP, IP_PKTINFO, 1, &err)) {
+      GST_ERROR_OBJECT (ctx, "Couldn't set IP_PKTINFO: %s", err->message);
+      goto no_bind;
+    }
+
+    if (!g_socket_set_option (socket, IPPROTO_IP, IP_RECVTOS, 1, &err)) {
+      GST_WARNING_OBJECT (ctx, "Couldn't enable ECN for IPv4: %s",
+          err->message);
+    }
+
+    if (!g_socket_set_option (socket, IPPROTO_IP, IP_MTU_DISCOVER, 1, &err)) {
+      GST_WARNING_OBJECT (ctx, "Couldn't enable MTU discovery for IPv4: %s",
+          err->message);
+    }
+
+#if defined(IP_DONTFRAG)
+    if (!g_socket_set_option (socket, IPPROTO_IP, IP_DONTFRAG, 1, &err)) {
+      GST_WARNING_OBJECT (ctx,
+          "Couldn't enable the don't fragment socket option for IPv4: %s",
+          err->message);
+    }
+#endif
+    break;
+  case G_SOCKET_FAMILY_IPV6:
+    if (!g_socket_set_option (socket, IPPROTO_IPV6, IPV6_RECVPKTINFO, 1, &err))
+    {
+      GST_ERROR_OBJECT (ctx, "Couldn't set IPV6_RECVPKTINFO: %s", err->message);
+      goto no_bind;
+    }
+
+    if (!g_socket_set_option (socket, IPPROTO_IPV6, IPV6_RECVTCLASS, 1, &err)) {
+      GST_WARNING_OBJECT (ctx, "Couldn't enable ECN for IPv6: %s",
+          err->message);
+    }
+
+    if (!g_socket_set_option (socket, IPPROTO_IPV6, IPV6_MTU_DISCOVER, 1,
+        &err)) {
+      GST_WARNING_OBJECT (ctx, "Couldn't enable MTU discovery for IPv6: %s",
+          err->message);
+    }
+
+#if defined(IPV6_DONTFRAG)
+    if (!g_socket_set_option (socket, IPPROTO_IPV6, IPV6_DONTFRAG, 1, &err)) {
+      GST_WARNING_OBJECT (ctx,
+          "Couldn't enable the don't fragment socket option for IPv6: %s",
+          err->message);
+    }
+#endif
+    break;
+  default:
+    g_assert (fam == G_SOCKET_FAMILY_IPV4 || fam == G_SOCKET_FAMILY_IPV6);
+  }
+
+  /*
+   * Kernel receive timestamps are used as the packet arrival time given to
+   * ngtcp2, as well as for the statistics.
+   */
+  if (!g_socket_set_option (socket, SOL_SOCKET, SO_TIMESTAMPNS, 1, &err)) {
+    GST_WARNING_OBJECT (ctx,
+        "Couldn't enable the timestamp option for incoming sockets: %s",
+        err->message);
+  }
+
+  if (priv->busy_poll > 0) {
+#if defined(SO_BUSY_POLL)
+    if (!g_socket_set_option (socket, SOL_SOCKET, SO_BUSY_POLL,
+        (gint) priv->busy_poll, &err)) {
+      GST_WARNING_OBJECT (ctx, "Couldn't set SO_BUSY_POLL to %u usec: %s",
+          priv->busy_poll, err->message);
+      g_clear_error (&err);
+    }
+#else
+    GST_WARNING_OBJECT (ctx, "SO_BUSY_POLL is not supported on this platform");
+#endif
+#if defined(SO_PREFER_BUSY_POLL)
+    if (!g_socket_set_option (socket, SOL_SOCKET, SO_PREFER_BUSY_POLL, 1,
+        &err)) {
+      GST_WARNING_OBJECT (ctx, "Couldn't set SO_PREFER_BUSY_POLL: %s",
+          err->message);
+      g_clear_error (&err);
+    }
+#endif
+  }
+
+  g_socket_set_blocking (socket, FALSE);
+
+  if (QUICLIB_SERVER (ctx)) {
+    local = addr;
+    if (g_socket_bind (socket, local, TRUE, &err) == FALSE) {
+      GST_ERROR_OBJECT (ctx,
+          "Couldn't bind local listening socket to address %s: %s", debug_addr,
+          err->message);
+      goto no_bind;
+    }
+  } else {
+    GSocketAddress *bind_addr =
+        GST_QUICLIB_TRANSPORT_CONNECTION (ctx)->bind_addr;
+
+    if (bind_addr != NULL) {
+      gchar *debug_bind_addr =
+          g_socket_connectable_to_string (G_SOCKET_CONNECTABLE (bind_addr));
+
+      if (g_socket_bind (socket, bind_addr, FALSE, &err) == FALSE) {
+        GST_ERROR_OBJECT (ctx, "Couldn't bind client socket to local address "
+            "%s: %s", debug_bind_addr, err->message);
+        g_free (debug_bind_addr);
+        goto no_bind;
+      }
+
+      g_free (debug_bind_addr);
+    }
+
+    remote = addr;
+    if (g_socket_connect (socket, remote, NULL, &err) == FALSE) {
+      GST_ERROR_OBJECT (ctx, "Couldn't connect to remote address %s: %s",
+          debug_addr, err->message);
+      goto no_bind;
+    }
+
+    local = g_socket_get_local_address (socket, &err);
+    if (local == NULL) {
+      GST_ERROR_OBJECT (ctx, "Couldn't get local address: %s", err->message);
+      goto no_bind;
+    }
+  }
+
+  source = g_socket_create_source (socket, G_IO_IN, NULL);
+
+  socket_ctx = g_malloc (sizeof (QuicLibSocketContext));
+  if (socket_ctx == NULL) {
+    GST_ERROR_OBJECT (ctx, "Couldn't allocate memory for the socket context");
+    goto no_source_ctx;
+  }
+
+  socket_ctx->ref_count = 1;
+  socket_ctx->owner = ctx;
+  socket_ctx->socket = socket;
+  socket_ctx->source = source;
+  socket_ctx->local_addrlen = 0;
+  if (g_socket_address_to_native (local, &socket_ctx->local_addr,
+      sizeof (socket_ctx->local_addr), NULL)) {
+    socket_ctx->local_addrlen =
+        (ngtcp2_socklen) g_socket_address_get_native_size (local);
+  }
+  socket_ctx->backend = QUICLIB_IO_BACKEND_GSOCKET;
+  g_mutex_init (&socket_ctx->io_stats_mutex);
+  memset (&socket_ctx->io_stats, 0, sizeof (socket_ctx->io_stats));
+  socket_ctx->rx_pending = 0;
+  socket_ctx->zerocopy_threshold = 0;
+  g_mutex_init (&socket_ctx->zc_mutex);
+  socket_ctx->zc_next_seq = 0;
+  g_queue_init (&socket_ctx->zc_pending);
+#ifdef HAVE_LIBURING
+  socket_ctx->uring = NULL;
+
+  if (priv->io_backend == QUICLIB_IO_BACKEND_IO_URING) {
+    socket_ctx->uring = quiclib_uring_new (socket_ctx);
+    if (socket_ctx->uring != NULL) {
+      socket_ctx->backend = QUICLIB_IO_BACKEND_IO_URING;
+    }
+  }
+#endif
+#ifdef HAVE_LIBXDP
+  socket_ctx->xdp = NULL;
+
+  if (priv->io_backend == QUICLIB_IO_BACKEND_AF_XDP) {
+    socket_ctx->xdp = quiclib_xdp_new (socket_ctx, priv->xdp_interface,
+        priv->xdp_queue, priv->xdp_skb_mode, g_htons (
+            g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (local))));
+    if (socket_ctx->xdp != NULL) {
+      socket_ctx->backend = QUICLIB_IO_BACKEND_AF_XDP;
+    }
+  }
+#endif
+
+  if (priv->io_backend != socket_ctx->backend) {
+    GST_WARNING_OBJECT (ctx, "Requested I/O backend %d isn't available, "
+        "falling back to GSocket", priv->io_backend);
+  }
+
+  if (priv->zerocopy_threshold > 0 &&
+      socket_ctx->backend == QUICLIB_IO_BACKEND_GSOCKET) {
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+    /*
+     * Every send is a single QUIC datagram, and pinning the pages and reaping
+     * the completion from the error queue costs more than copying anything
+     * much under 10KB. So zero-copy is only ever used for the large payloads
+     * some paths allow, such as loopback, and never for typical 1200-1500
+     * byte packets.
+     */
+    if (priv->zerocopy_threshold < QUICLIB_ZEROCOPY_THRESHOLD_MIN) {
+      GST_WARNING_OBJECT (ctx, "Raising zero-copy threshold from %u to %u "
+          "bytes", priv->zerocopy_threshold, QUICLIB_ZEROCOPY_THRESHOLD_MIN);
+    }
+
+    if (g_socket_set_option (socket, SOL_SOCKET, SO_ZEROCOPY, 1, &err)) {
+      socket_ctx->zerocopy_threshold = MAX (priv->zerocopy_threshold,
+          QUICLIB_ZEROCOPY_THRESHOLD_MIN);
+    } else {
+      GST_WARNING_OBJECT (ctx, "Couldn't enable SO_ZEROCOPY: %s",
+          err->message);
+      g_clear_error (&err);
+    }
+#else
+    GST_WARNING_OBJECT (ctx, "MSG_ZEROCOPY is not supported on this platform");
+#endif
+  }
+
+  /*
+   * Linux limits thread names to 15 characters, so name the threads after the
+   * role and local port of the socket they serve rather than the full
+   * address. The thread names are logged with the full local address at
+   * debug level, which is enough to tie a thread in a perf profile back to a
+   * socket. Client threads are renamed with the first bytes of their SCID
+   * once the handshake completes, see quiclib_conn_name_threads.
+   *
+   * A client connection that migrates opens a second socket while the new
+   * path is validated, which is served by the threads it already has.
+   *
+   * In idle mode, client connections run on one of the shared loops instead.
+   */
+  if (priv->loop_thread == NULL && priv->idle_mode && !QUICLIB_SERVER (ctx)) {
+    /* The shared loops serve every idle connection in the process */
+    if ((priv->cpu_affinity != NULL && priv->cpu_affinity[0] != '\0') ||
+        (priv->async_cpu_affinity != NULL &&
+            priv->async_cpu_affinity[0] != '\0') ||
+        priv->thread_sched_policy != QUICLIB_THREAD_SCHED_OTHER ||
+        priv->busy_poll_budget > 0) {
+      GST_WARNING_OBJECT (ctx, "Idle mode ignores the CPU affinity, thread "
+          "scheduling and busy-poll-budget settings");
+    }
+
+    quiclib_shared_loop_join (priv);
+
+    GST_DEBUG_OBJECT (ctx, "Using shared loop %u for socket on %s",
+        (guint) (priv->shared_loop - quiclib_shared_loops), debug_addr);
+  } else if (priv->loop_thread == NULL) {
+    local_port =
+        g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (local));
+    g_snprintf (thread_name, sizeof (thread_name), "qtx-%c%u",
+        QUICLIB_SERVER (ctx) ? 's' : 'c', local_port);
+    g_snprintf (async_thread_name, sizeof (async_thread_name), "qas-%c%u",
+        QUICLIB_SERVER (ctx) ? 's' : 'c', local_port);
+
+    GST_DEBUG_OBJECT (ctx, "Starting threads %s and %s for socket on %s",
+        thread_name, async_thread_name, debug_addr);
+
+    priv->loop_context = g_main_context_new ();
+    priv->loop = g_main_loop_new (priv->loop_context, FALSE);
+    priv->loop_thread = g_thread_new (thread_name,
+        quiclib_transport_context_loop_thread, priv);
+
+    priv->async_notif_loop_context = g_main_context_new ();
+    priv->async_notif_loop = g_main_loop_new (priv->async_notif_loop_context,
+        FALSE);
+    priv->async_notif_thread = g_thread_new (async_thread_name,
+        quiclib_transport_async_notif_context_loop_thread, priv);
+  }
+
+  /*
+   * So this takes a GSourceFunc argument, which carries a single argument, but
+   * socket_source_dispatch actually calls a function pointer with three args?
+   *
+   * What the hell guys?
+   */
+#ifdef HAVE_LIBURING
+  if (socket_ctx->backend == QUICLIB_IO_BACKEND_IO_URING &&
+      !quiclib_uring_start (socket_ctx,
+          gst_quiclib_transport_context_get_loop_context (ctx))) {
+    GST_WARNING_OBJECT (ctx, "Couldn't start io_uring receive, falling back "
+        "to GSocket");
+    quiclib_uring_free (socket_ctx->uring);
+    socket_ctx->uring = NULL;
+    socket_ctx->backend = QUICLIB_IO_BACKEND_GSOCKET;
+  }
+#endif
+#ifdef HAVE_LIBXDP
+  if (socket_ctx->backend == QUICLIB_IO_BACKEND_AF_XDP) {
+    quiclib_xdp_start (socket_ctx,
+        gst_quiclib_transport_context_get_loop_context (ctx));
+  }
+#endif
+
+  /*
+   * AF_XDP only sees the packets that arrive on its own queue, so the socket
+   * is read as well for the ones that are steered to any other.
+   */
+  if (socket_ctx->backend != QUICLIB_IO_BACKEND_IO_URING) {
+    g_source_set_callback (source, (GSourceFunc) quiclib_data_received,
+        socket_ctx, NULL);
+
+    g_source_attach (source,
+        gst_quiclib_transport_context_get_loop_context (ctx));
+  }
+
+  GST_DEBUG_OBJECT (ctx,
+      "Opened %s socket %p with %s address %s, source %p, ctx %p",
+      QUICLIB_SERVER (ctx)?"server":"client", socket_ctx->socket,
+          QUICLIB_SERVER (ctx)?"local":"peer", debug_addr,
+              socket_ctx->source, socket_ctx);
+
+  g_free (debug_addr);
+  if (local != addr) {
+    g_object_unref (local);
+  }
+
+  return socket_ctx;
+
+  no_source_ctx:
+  if (local != addr) {
+    g_object_unref (local);
+  }
+  g_source_unref (source);
+  no_bind:
+  g_socket_close (socket, NULL);
+  no_socket:
+  g_error_free (err);
+  g_free (debug_addr);
+  return NULL;
+}
+
+void
+quiclib_open_server_socket_foreach (gpointer data, gpointer user_data)
+{
+  GstQuicLibServerContext *ctx = GST_QUICLIB_SERVER_CONTEXT (user_data);
+  QuicLibSocketContext *socket = quiclib_open_socket (
+      GST_QUICLIB_TRANSPORT_CONTEXT (ctx), (GSocketAddress *) data);
+
+  ctx->sockets = g_slist_prepend (ctx->sockets, socket);
+}
+
+/**
+ * gst_quiclib_transport_server_new
+ * 
+ * Create a new QuicLib server instance with default settings. This function
+ * creates a new GstQuicLibServerContext object, but DOES NOT start the source
+ * listener for packets, allowing you to configure the server object further
+ * as necessary using it's attributes.
+ * 
+ * @user: The callback target.
+ * @pkey_location: Path to the PEM/PK12 private key for the server to use.
+ * @cert_location: Path to the PEM certificate for the server to present to
+ *    clients.
+ * @sni: The server name information (SNI) value to present as part of the TLS
+ *    handshake.
+ * @app_ctx: Opaque application context passed back in callbacks. 
+ * @return GstQuicLibServerContext* 
+ */
+GstQuicLibServerContext *
+gst_quiclib_transport_server_new (GstQuicLibTransportUser *user,
+    const gchar *pkey_location, const gchar *cert_location, const gchar *sni,
+    gpointer app_ctx)
+{
+  int rv;
+  GstQuicLibServerContext *server =
+      g_object_new (GST_TYPE_QUICLIB_SERVER_CONTEXT, "user", user, "app_ctx",
+          app_ctx, PROP_PRIVKEY_LOCATION_SHORTNAME, pkey_location,
+          PROP_CERT_LOCATION_SHORTNAME, cert_location,
+          PROP_SNI_SHORTNAME, sni, NULL);
+  if (server == NULL) return NULL;
+
+  server->ssl_ctx = SSL_CTX_new (TLS_server_method ());
+  if (server->ssl_ctx == NULL) {
+    GST_ERROR_OBJECT (QUICLIB_PARENT (server),
+        "Failed to allocate new server SSL context: %s",
+        ERR_error_string (ERR_get_error (), NULL));
+    goto error;
+  }
+
+#ifdef OPENSSL_DEBUG
+  SSL_CTX_set_msg_callback (server->ssl_ctx, quiclib_openssl_dbg_cb);
+  SSL_CTX_set_msg_callback_arg (server->ssl_ctx, (void *) server);
+#endif
+
+  rv = ngtcp2_crypto_quictls_configure_server_context (server->ssl_ctx);
+  if (rv != 0) {
+    GST_ERROR_OBJECT (QUICLIB_PARENT (server),
+        "Failed to configure ngtcp2/openssl server ctx");
+    goto error;
+  }
+
+  SSL_CTX_set_max_early_data (server->ssl_ctx, UINT32_MAX);
+  SSL_CTX_set_options (server->ssl_ctx, SSL_OP_SINGLE_ECDH_USE |
+      SSL_OP_CIPHER_SERVER_PREFERENCE | SSL_OP_NO_ANTI_REPLAY);
+  SSL_CTX_set_mode (server->ssl_ctx, SSL_MODE_RELEASE_BUFFERS);
+  SSL_CTX_set_alpn_select_cb (server->ssl_ctx,
+      quiclib_ssl_select_proto_cb, (void *) server);
+  SSL_CTX_add_custom_ext (server->ssl_ctx, QUICLIB_TLS_EXT_STRIPE_ID,
+      SSL_EXT_CLIENT_HELLO | SSL_EXT_TLS1_3_ENCRYPTED_EXTENSIONS,
+      quiclib_ssl_stripe_id_add_cb, quiclib_ssl_stripe_id_free_cb, NULL,
+      quiclib_ssl_stripe_id_parse_cb, NULL);
+  SSL_CTX_set_default_verify_paths (server->ssl_ctx);
+
+  if (SSL_CTX_use_certificate_chain_file (server->ssl_ctx,
+      server->cert_file_location) != 1) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (server),
+        "SSL_CTX_user_certificate_chain_file failed to load certificate file "
+        "%s, %s", server->cert_file_location, ERR_error_string (
+            ERR_get_error (), NULL));
+    goto error;
+  }
+
+  if (strstr (server->priv_key_location, ".pkcs8")) {
+    EVP_PKEY *pkey = NULL;
+    FILE *fp = fopen (server->priv_key_location, "r");
+    if (!fp) {
+      GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (server),
+          "Opening private key from %s failed: %s", server->priv_key_location,
+          strerror (errno));
+      goto error;
+    }
+    pkey = d2i_PrivateKey_fp (fp, NULL);
+    fclose (fp);
+    if (!pkey) {
+      GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (server),
+          "Reading private key from %s failed", server->priv_key_location);
+      goto error;
+    }
+    if (!SSL_CTX_use_PrivateKey (server->ssl_ctx, pkey)) {
+      GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (server),
+          "SSL_CTX_use_PrivateKey failed: %s",
+          ERR_error_string (ERR_get_error (), NULL));
+      goto error;
+    }
+  } else if (SSL_CTX_use_PrivateKey_file (server->ssl_ctx,
+      server->priv_key_location, SSL_FILETYPE_PEM) != 1) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (server),
+        "SSL_CTX_use_PrivateKey_file for %s failed: %s",
+        server->priv_key_location, ERR_error_string (ERR_get_error (), NULL));
+    goto error;
+  }
+
+  return server;
+
+error:
+  if (server->ssl_ctx) {
+    SSL_CTX_free (server->ssl_ctx);
+  }
+  g_object_unref (server);
+  server = NULL;
+  return NULL;
+}
+
+/**
+ * quiclib_server_parse_preferred_address
+ *
+ * Parses @str, a comma separated list of at most one IPv4 and one IPv6
+ * address:port, into the preferred addresses of @server.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_server_parse_preferred_address (GstQuicLibServerContext *server,
+    const gchar *str)
+{
+  GstQuicLibTransportContext *ctx = GST_QUICLIB_TRANSPORT_CONTEXT (server);
+  gchar **addrs;
+  guint i;
+  gboolean rv = TRUE;
+
+  g_clear_object (&server->preferred_addr_ipv4);
+  g_clear_object (&server->preferred_addr_ipv6);
+
+  if (str == NULL || *str == '\0') {
+    return TRUE;
+  }
+
+  addrs = g_strsplit (str, ",", -1);
+
+  for (i = 0; rv && addrs[i] != NULL; i++) {
+    GSocketConnectable *na;
+    GInetAddress *ia = NULL;
+    GSocketAddress **slot;
+    GError *err = NULL;
+    gchar *addr_str = g_strstrip (addrs[i]);
+    guint16 port;
+
+    na = g_network_address_parse (addr_str, 0, &err);
+    if (na == NULL) {
+      GST_ERROR_OBJECT (ctx, "Couldn't parse preferred address \"%s\": %s",
+          addr_str, err->message);
+      g_error_free (err);
+      rv = FALSE;
+      break;
+    }
+
+    port = g_network_address_get_port (G_NETWORK_ADDRESS (na));
+    ia = g_inet_address_new_from_string (
+        g_network_address_get_hostname (G_NETWORK_ADDRESS (na)));
+    g_object_unref (na);
+
+    if (ia == NULL || port == 0 || g_inet_address_get_is_any (ia)) {
+      GST_ERROR_OBJECT (ctx, "Preferred address \"%s\" must be an IP address "
+          "and port", addr_str);
+      rv = FALSE;
+    } else {
+      slot = (g_inet_address_get_family (ia) == G_SOCKET_FAMILY_IPV4) ?
+          &server->preferred_addr_ipv4 : &server->preferred_addr_ipv6;
+
+      if (*slot != NULL) {
+        GST_ERROR_OBJECT (ctx, "Only one preferred address can be given for "
+            "each of IPv4 and IPv6");
+        rv = FALSE;
+      } else {
+        *slot = g_inet_socket_address_new (ia, port);
+      }
+    }
+
+    if (ia != NULL) g_object_unref (ia);
+  }
+
+  g_strfreev (addrs);
+
+  if (!rv) {
+    g_clear_object (&server->preferred_addr_ipv4);
+    g_clear_object (&server->preferred_addr_ipv6);
+  }
+
+  return rv;
+}
+
+/**
+ * quiclib_server_listen_preferred_addresses
+ *
+ * Reads the preferred addresses of @server from its preferred-address
+ * property, and listens on each of them alongside the address that clients
+ * first connect to. A client that moves over carries on with the same
+ * connection, so the packets it sends to a preferred address have to reach
+ * this server context.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_server_listen_preferred_addresses (GstQuicLibServerContext *server)
+{
+  GstQuicLibTransportContext *ctx = GST_QUICLIB_TRANSPORT_CONTEXT (server);
+  GSocketAddress *addrs[2];
+  gchar *preferred_address = NULL;
+  guint i;
+
+  g_object_get (ctx, PROP_PREFERRED_ADDRESS_SHORTNAME, &preferred_address,
+      NULL);
+
+  if (!quiclib_server_parse_preferred_address (server, preferred_address)) {
+    g_free (preferred_address);
+    return FALSE;
+  }
+
+  g_free (preferred_address);
+
+  addrs[0] = server->preferred_addr_ipv4;
+  addrs[1] = server->preferred_addr_ipv6;
+
+  for (i = 0; i < G_N_ELEMENTS (addrs); i++) {
+    QuicLibSocketContext *socket;
+    gchar *addr_str;
+
+    if (addrs[i] == NULL) continue;
+
+    addr_str = g_socket_connectable_to_string (
+        G_SOCKET_CONNECTABLE (addrs[i]));
+
+    socket = quiclib_open_socket (ctx, addrs[i]);
+    if (socket == NULL) {
+      GST_ERROR_OBJECT (ctx, "Couldn't listen on preferred address %s",
+          addr_str);
+      g_free (addr_str);
+      return FALSE;
+    }
+
+    GST_INFO_OBJECT (ctx, "Advertising preferred address %s", addr_str);
+    g_free (addr_str);
+
+    server->sockets = g_slist_prepend (server->sockets, socket);
+  }
+
+  return TRUE;
+}
+
+/**
+ * gst_quiclib_transport_server_listen
+ * 
+ * Start a QUIC transport server.
+ * 
+ * Attempting to start a QUIC transport server that's already started may lead
+ * to undefined behaviour!
+ * 
+ * @server: The server to start listening.
+ */
+gboolean
+gst_quiclib_transport_server_listen (GstQuicLibServerContext *server)
+{
+  gchar *location = NULL;
+  GUri *uri = NULL;
+  GSocketAddress *sa = NULL;
+  QuicLibSocketContext *socket;
+  gboolean rv = FALSE;
+
+  /* TODO: Support multiple listening addresses again */
+  /*g_slist_foreach (listen_addrs, quiclib_open_server_socket_foreach, server);*/
+
+  g_object_get (GST_QUICLIB_TRANSPORT_CONTEXT (server),
+      PROP_LOCATION_SHORT, &location, NULL);
+
+  g_assert (location);
+  uri = gst_quiclib_parse_location (location);
+  if (!uri) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (server),
+        "Couldn't parse location \"%s\"", location);
+    goto error;
+  }
+
+  sa = G_SOCKET_ADDRESS (gst_quiclib_resolve (uri));
+  if (!sa) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (server),
+        "Couldn't resolve location \"%s\"", location);
+    goto error;
+  }
+
+  socket = quiclib_open_socket (GST_QUICLIB_TRANSPORT_CONTEXT (server),
+      (GSocketAddress *) sa);
+
+  server->sockets = g_slist_prepend (server->sockets, socket);
+
+  if (!quiclib_server_listen_preferred_addresses (server)) {
+    goto error;
+  }
+
+  gst_quiclib_transport_context_set_state (
+      GST_QUICLIB_TRANSPORT_CONTEXT (server), QUIC_STATE_LISTENING);
+
+  rv = TRUE;
+
+error:
+  if (sa) g_object_unref (sa);
+  if (uri) g_uri_unref (uri);
+  if (location) g_free (location);
+
+  return rv;
+}
+
+/**
+ * gst_quiclib_transport_client_new
+ * 
+ * Create a new QuicLib client instance with default settings. This function
+ * creates a new GstQuicLibTransportConnection object, but DOES NOT start the
+ * source listener for packets nor send the INITIAL message, allowing you to
+ * configure the server object further as necessary using it's attributes.
+ * 
+ * @user: The callback target.
+ * @app_ctx: Opaque application context passed back in callbacks.
+ * @return GstQuicLibServerContext* 
+ */
+GstQuicLibTransportConnection *
+gst_quiclib_transport_client_new (GstQuicLibTransportUser *user,
+    gpointer app_ctx)
+{
+  gint rv;
+  GstQuicLibTransportConnection *conn =
+      g_object_new (GST_TYPE_QUICLIB_TRANSPORT_CONNECTION, NULL);
+  if (conn == NULL) return NULL;
+
+  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      "New connection context: %p", conn);
+
+  gst_quiclib_transport_context_set_user (
+      GST_QUICLIB_TRANSPORT_CONTEXT (conn), user);
+  gst_quiclib_transport_context_set_app_ctx (
+      GST_QUICLIB_TRANSPORT_CONTEXT (conn), app_ctx);
+
+  conn->ssl_ctx = SSL_CTX_new (TLS_client_method ());
+  if (conn->ssl_ctx == NULL) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Failed to allocate new client SSL context: %s",
+        ERR_error_string (ERR_get_error (), NULL));
+    goto free_conn;
+  }
+
+#ifdef OPENSSL_DEBUG
+  SSL_CTX_set_msg_callback (conn->ssl_ctx, quiclib_openssl_dbg_cb);
+  SSL_CTX_set_msg_callback_arg (conn->ssl_ctx, conn);
+#endif
+
+  rv = ngtcp2_crypto_quictls_configure_client_context (conn->ssl_ctx);
+  if (rv != 0) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Failed to configure the client SSL context");
+    goto free_ssl_ctx;
+  } 
+
+  SSL_CTX_add_custom_ext (conn->ssl_ctx, QUICLIB_TLS_EXT_STRIPE_ID,
+      SSL_EXT_CLIENT_HELLO | SSL_EXT_TLS1_3_ENCRYPTED_EXTENSIONS,
+      quiclib_ssl_stripe_id_add_cb, quiclib_ssl_stripe_id_free_cb, NULL,
+      quiclib_ssl_stripe_id_parse_cb, NULL);
+
+  return conn;
+
+free_ssl_ctx:
+  SSL_CTX_free (conn->ssl_ctx);
+free_conn:
+  g_object_unref (conn);
+  return NULL;
+}
+
+/**
+ * gst_quiclib_transport_client_set_local_address
+ *
+ * Bind the client connection to a local address, so that its packets leave
+ * through a particular interface. The port may be 0 to let the kernel choose.
+ * Must be called before gst_quiclib_transport_client_connect.
+ *
+ * @conn: The connection to bind.
+ * @local: The local address, or NULL to let the kernel choose.
+ * @return FALSE if the connection has already been started.
+ */
+gboolean
+gst_quiclib_transport_client_set_local_address (
+    GstQuicLibTransportConnection *conn, GInetSocketAddress *local)
+{
+  if (conn->socket != NULL) {
+    GST_WARNING_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Can't set the local address of a connection that has started");
+    return FALSE;
+  }
+
+  g_clear_object (&conn->bind_addr);
+  if (local != NULL) {
+    conn->bind_addr = G_SOCKET_ADDRESS (g_object_ref (local));
+  }
+
+  return TRUE;
+}
+
+/**
+ * gst_quiclib_transport_client_set_stripe_id
+ *
+ * Tag the client connection as one of a set of striped connections to the
+ * same server. The ID is sent in the handshake, so that the server can tell
+ * which connections belong together. Must be called before
+ * gst_quiclib_transport_client_connect.
+ *
+ * @conn: The connection to tag.
+ * @stripe_id: An ID shared by every connection in the stripe and unlikely to
+ *    be used by any other, or 0 if the connection isn't striped.
+ * @return FALSE if the connection has already been started.
+ */
+gboolean
+gst_quiclib_transport_client_set_stripe_id (
+    GstQuicLibTransportConnection *conn, guint64 stripe_id)
+{
+  if (conn->socket != NULL) {
+    GST_WARNING_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Can't set the stripe ID of a connection that has started");
+    return FALSE;
+  }
+
+  conn->stripe_id = stripe_id;
+
+  return TRUE;
+}
+
+/**
+ * gst_quiclib_transport_get_stripe_id
+ *
+ * Returns the stripe ID that a client connection was tagged with, or for a
+ * server's connection, the one the client sent. Only known to the server once
+ * the handshake is complete.
+ *
+ * @conn: The connection.
+ * @return The stripe ID, or 0 if the connection isn't striped.
+ */
+guint64
+gst_quiclib_transport_get_stripe_id (GstQuicLibTransportConnection *conn)
+{
+  return conn->stripe_id;
+}
+
+/**
+ * gst_quiclib_transport_client_set_stripe_redundant
+ *
+ * Ask the server to accept redundant datagrams on a striped client connection.
+ * Once accepted, every datagram sent or received on the connection starts
+ * with a QUICLIB_REDUNDANT_HEADER_LEN byte sequence number, which the receiver
+ * uses to pass on only the first copy of each datagram sent across the
+ * stripe. Must be called before gst_quiclib_transport_client_connect, and only
+ * has an effect with a stripe ID.
+ *
+ * @conn: The connection.
+ * @redundant: Whether to ask for redundant datagrams.
+ * @return FALSE if the connection has already been started.
+ */
+gboolean
+gst_quiclib_transport_client_set_stripe_redundant (
+    GstQuicLibTransportConnection *conn, gboolean redundant)
+{
+  if (conn->socket != NULL) {
+    GST_WARNING_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Can't ask for redundant datagrams on a connection that has started");
+    return FALSE;
+  }
+
+  conn->stripe_redundant_requested = redundant;
+
+  return TRUE;
+}
+
+/**
+ * gst_quiclib_transport_get_stripe_redundant
+ *
+ * Returns whether both ends of the connection have agreed that every datagram
+ * carries a redundant datagram header. Only known once the handshake is
+ * complete.
+ *
+ * @conn: The connection.
+ * @return TRUE if datagrams carry a redundant datagram header.
+ */
+gboolean
+gst_quiclib_transport_get_stripe_redundant (
+    GstQuicLibTransportConnection *conn)
+{
+  return conn->stripe_redundant;
+}
+
+/**
+ * gst_quiclib_transport_client_connect
+ * 
+ * Start the client connection and send the INITIAL packet.
+ * 
+ * @conn: The connection to start
+ * @return TRUE if connection was started and INITIAL packet sent. Wait for
+ *    handshake_complete callback before attempting to use the connection!
+ */
+gboolean
+gst_quiclib_transport_client_connect (GstQuicLibTransportConnection *conn)
+{
+  gint rv;
+  GSocketAddress *sa;
+  ngtcp2_cid *dcid = NULL, *scid = NULL;
+  gchar dcid_str[CID_STR_LEN], scid_str[CID_STR_LEN];
+  GError *err = NULL;
+  gchar *location;
+  GUri *uri;
+  struct sockaddr *localsa, *remotesa;
+  gsize localsa_size, remotesa_size;
+  gchar *debug_local_addr, *debug_remote_addr;
+  gboolean enable_datagram;
+
+  g_object_get (G_OBJECT (conn), PROP_LOCATION_SHORT, &location, NULL);
+  g_assert (location != NULL);
+  uri = gst_quiclib_parse_location (location);
+  if (uri == NULL) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Couldn't parse location \"%s\"", location);
+    goto free_location;
+  }
+
+  sa = G_SOCKET_ADDRESS (gst_quiclib_resolve (uri));
+
+  if (sa == NULL) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Couldn't resolve location \"%s\"", location);
+    goto free_location;
+  }
+
+  conn->socket = quiclib_open_socket (GST_QUICLIB_TRANSPORT_CONTEXT (conn), sa);
+  if (conn->socket == NULL) {
+    goto free_location;
+  }
+
+  debug_remote_addr =
+      g_socket_connectable_to_string (G_SOCKET_CONNECTABLE (sa));
+
+  debug_local_addr =
+      g_socket_connectable_to_string (G_SOCKET_CONNECTABLE (
+          g_socket_get_local_address (conn->socket->socket, &err)));
+
+  localsa_size = g_socket_address_get_native_size (
+      g_socket_get_local_address (conn->socket->socket, &err));
+  remotesa_size = g_socket_address_get_native_size (sa);
+  localsa = (struct sockaddr *) g_malloc (localsa_size);
+  remotesa = (struct sockaddr *) g_malloc (remotesa_size);
+  if (g_socket_address_to_native (
+      g_socket_get_local_address (conn->socket->socket, NULL), localsa,
+      localsa_size, &err) == FALSE) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Failed to convert local socket address %s to native sockaddr: %s",
+        debug_local_addr, err->message);
+    goto free_sa;
+  }
+
+  if (g_socket_address_to_native (sa, remotesa, remotesa_size, &err) == FALSE) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Failed to convert remote socket address %s to native sockaddr: %s",
+        g_socket_connectable_to_string (G_SOCKET_CONNECTABLE (sa)),
+        err->message);
+    goto free_sa;
+  }
+
+  ngtcp2_path_storage_init (&conn->path, localsa, localsa_size, remotesa,
+      remotesa_size, (void *) conn);
+
+  dcid = g_malloc (sizeof (ngtcp2_cid));
+  scid = g_malloc (sizeof (ngtcp2_cid));
+  if (dcid == NULL || scid == NULL) {
+    goto remove_listener;
+  }
+
+  if (quiclib_ngtcp2_get_new_connection_id (NULL, dcid, NULL,
+      NGTCP2_MIN_INITIAL_DCIDLEN, (void *) conn) < 0) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Failed to generate initial DCID");
+    goto remove_listener;
+  }
+
+  if (quiclib_ngtcp2_get_new_connection_id (NULL, scid, NULL, 8,
+      (void *) conn) < 0) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Failed to generate initial SCID");
+    goto remove_listener;
+  }
+
+  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      "Opening connection with QUIC peer %s with local address %s",
+      debug_remote_addr, debug_local_addr);
+
+  ngtcp2_settings_default (&conn->conn_settings);
+
+  conn->conn_settings.initial_ts = quiclib_ngtcp2_timestamp ();
+  conn->last_ts = conn->conn_settings.initial_ts;
+  conn->conn_settings.log_printf = quiclib_ngtcp2_print;
+
+  quiclib_cidtostr (dcid, dcid_str);
+  quiclib_cidtostr (scid, scid_str);
+
+  /*
+   * Retrieve the transport params from the base class
+   */
+  g_object_get (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      PROP_MAX_STREAM_DATA_BIDI_REMOTE_SHORTNAME,
+        &conn->transport_params.initial_max_stream_data_bidi_local,
+      PROP_MAX_STREAM_DATA_UNI_REMOTE_SHORTNAME,
+        &conn->transport_params.initial_max_stream_data_uni,
+      PROP_MAX_DATA_REMOTE_SHORTNAME,
+        &conn->transport_params.initial_max_data,
+      PROP_MAX_STREAMS_BIDI_REMOTE_SHORTNAME,
+        &conn->transport_params.initial_max_streams_bidi,
+      PROP_MAX_STREAMS_UNI_REMOTE_SHORTNAME,
+        &conn->transport_params.initial_max_streams_uni,
+      PROP_ENABLE_DATAGRAM_SHORTNAME, &enable_datagram,
+      NULL);
+
+  conn->transport_params.initial_max_stream_data_bidi_remote =
+      conn->transport_params.initial_max_stream_data_bidi_local;
+
+  if (enable_datagram) {
+    /*
+     * RFC 9221, section 3:
+     *
+     * For most uses of DATAGRAM frames, it is RECOMMENDED to send a value of
+     * 65535 in the max_datagram_frame_size transport parameter to indicate that
+     * this endpoint will accept any DATAGRAM frame that fits inside a QUIC
+     * packet.
+     */
+    conn->transport_params.max_datagram_frame_size = 65535;
+  }
+
+  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      "Opening connection with QUIC peer %s with local address %s, DCID %s"
+      "and SCID %s", debug_remote_addr, debug_local_addr, dcid_str, scid_str);
+
+  quiclib_print_ngtcp2_transport_params (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        conn->transport_params);
+
+  rv = ngtcp2_conn_client_new (&conn->quic_conn, dcid, scid,
+      &conn->path.path, NGTCP2_PROTO_VER_V1, &quiclib_ngtcp2_client_callbacks,
+      &conn->conn_settings, &conn->transport_params, &conn->mem,
+      (void *) conn);
+  if (rv != 0) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "ngtcp2 failed to create new client: %s", ngtcp2_strerror (rv));
+    goto remove_listener;
+  }
+
+  conn->ssl = SSL_new (conn->ssl_ctx);
+  if (conn->ssl == NULL) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Couldn't create SSL object for connection: %s",
+        ERR_error_string (ERR_get_error (), NULL));
+    goto remove_listener;
+  }
+
+#ifdef OPENSSL_DEBUG
+  SSL_set_msg_callback (conn->ssl, quiclib_openssl_dbg_cb);
+  SSL_set_msg_callback_arg (conn->ssl, (void *) conn);
+#endif
+
+  conn->conn_ref.get_conn = quiclib_get_ngtcp2_conn;
+  conn->conn_ref.user_data = (void *) conn;
+
+  SSL_set_app_data (conn->ssl, &conn->conn_ref);
+  SSL_set_connect_state (conn->ssl);
+  if (conn->alpn) {
+    guchar alpn_len = (guchar) strlen (conn->alpn);
+    guchar alpn_plf[alpn_len + 1];
+    alpn_plf[0] = alpn_len;
+    memcpy (alpn_plf + 1, conn->alpn, alpn_len);
+    if (SSL_set_alpn_protos (conn->ssl, alpn_plf, alpn_len + 1) != 0) {
+      GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+          "Failed to set client ALPN");
+    }
+  }
+
+  SSL_set_tlsext_host_name (conn->ssl, g_uri_get_host (uri));
+
+  SSL_set_quic_transport_version (conn->ssl,
+      TLSEXT_TYPE_quic_transport_parameters);
+
+  ngtcp2_conn_set_tls_native_handle (conn->quic_conn, conn->ssl);
+
+  quiclib_enable_tls_export (GST_QUICLIB_TRANSPORT_CONTEXT (conn), conn->ssl);
+
+  rv = quiclib_ngtcp2_conn_write (conn, -1, NULL, 0, 0);
+  if (rv != 0) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn), "conn_write failed");
+    ngtcp2_conn_del (conn->quic_conn);
+    SSL_free (conn->ssl);
+    goto remove_listener;
+  }
+
+  GST_INFO_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      "Initiated %s connection with remote peer %s", conn->alpn,
+      debug_remote_addr);
+
+  gst_quiclib_transport_context_set_state (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      QUIC_STATE_INITIAL);
+
+  g_free (debug_remote_addr);
+  g_free (debug_local_addr);
+
+  return TRUE;
+
+remove_listener:
+  if (dcid != NULL) {
+    g_free (dcid);
+  }
+  if (scid != NULL) {
+    g_free (scid);
+  }
+free_sa:
+  g_free (localsa);
+  g_free (remotesa);
+  g_free (debug_remote_addr);
+  g_free (debug_local_addr);
+  /* Also detaches the XDP program if the socket was using AF_XDP */
+  quiclib_socket_context_destroy (conn->socket);
+  conn->socket = NULL;
+  SSL_CTX_free (conn->ssl_ctx);
+  if (err != NULL) {
+    g_error_free (err);
+  }
+free_location:
+  if (sa) g_object_unref (sa);
+  if (uri) g_uri_unref (uri);
+  if (location) g_free (location);
+  return FALSE;
+}
+
+/**
+ * gst_quiclib_transport_client_migrate
+ *
+ * Move an established client connection to a new local address, such as
+ * after the network interface it was using has gone away. A socket is bound
+ * to @local and the path from it to the peer is validated with PATH_CHALLENGE.
+ * The connection carries on over the old path until the new one validates,
+ * and stays on the old path if validation fails.
+ *
+ * @conn: The client connection to migrate.
+ * @local: The local address to migrate to. The port may be 0 to let the
+ *    kernel choose.
+ * @return TRUE if validation of the new path has started.
+ */
+gboolean
+gst_quiclib_transport_client_migrate (GstQuicLibTransportConnection *conn,
+    GInetSocketAddress *local)
+{
+  GstQuicLibTransportContext *ctx = GST_QUICLIB_TRANSPORT_CONTEXT (conn);
+  GSocketAddress *peer;
+  QuicLibSocketContext *socket_ctx;
+  gint rv;
+
+  g_return_val_if_fail (local != NULL, FALSE);
+
+  if (conn->server != NULL || conn->quic_conn == NULL ||
+      gst_quiclib_transport_get_state (ctx) != QUIC_STATE_OPEN) {
+    GST_WARNING_OBJECT (ctx, "Only an open client connection can migrate");
+    return FALSE;
+  }
+
+  gst_quiclib_transport_context_lock (conn);
+
+  if (conn->migration_socket != NULL) {
+    gst_quiclib_transport_context_unlock (conn);
+    GST_WARNING_OBJECT (ctx, "A migration is already in progress");
+    return FALSE;
+  }
+
+  peer = G_SOCKET_ADDRESS (gst_quiclib_transport_get_peer (conn));
+
+  socket_ctx = quiclib_conn_open_path_socket (conn, G_SOCKET_ADDRESS (local),
+      peer, &conn->migration_path);
+  g_object_unref (peer);
+
+  if (socket_ctx == NULL) {
+    ngtcp2_path_storage_zero (&conn->migration_path);
+    gst_quiclib_transport_context_unlock (conn);
+    return FALSE;
+  }
+
+  rv = ngtcp2_conn_initiate_migration (conn->quic_conn,
+      &conn->migration_path.path,
+      quiclib_conn_timestamp (conn, quiclib_ngtcp2_timestamp ()));
+
+  if (rv == 0) {
+    conn->migration_socket = socket_ctx;
+  } else {
+    ngtcp2_path_storage_zero (&conn->migration_path);
+  }
+
+  gst_quiclib_transport_context_unlock (conn);
+
+  if (rv != 0) {
+    GST_WARNING_OBJECT (ctx, "Couldn't start migration: %s",
+        ngtcp2_strerror (rv));
+    quiclib_socket_context_destroy (socket_ctx);
+    return FALSE;
+  }
+
+  /* Send the PATH_CHALLENGE now rather than waiting for other traffic */
+  if (quiclib_ngtcp2_conn_write (conn, -1, NULL, 0, 0) < 0) {
+    GST_WARNING_OBJECT (ctx, "Couldn't write the path challenge");
+  }
+
+  return TRUE;
+}
+
+GstQUICMode
+gst_quiclib_transport_get_mode (GstQuicLibTransportContext *ctx)
+{
+  if (QUICLIB_SERVER (ctx)) return QUICLIB_MODE_SERVER;
+  if (QUICLIB_CLIENT (ctx)) return QUICLIB_MODE_CLIENT;
+  return -1;
+}
+
+GstQuicLibTransportState
+gst_quiclib_transport_get_state (GstQuicLibTransportContext *ctx)
+{
+  GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (ctx);
+  return priv->state;
+}
+
+gpointer
+gst_quiclib_transport_get_app_ctx (GstQuicLibTransportContext *ctx)
+{
+  GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (ctx);
+  return priv->app_ctx;
+}
+
+void
+gst_quiclib_transport_set_app_ctx (GstQuicLibTransportContext *ctx,
+    gpointer app_ctx)
+{
+  GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (ctx);
+  priv->app_ctx = app_ctx;
+}
+
+GSList *
+gst_quiclib_transport_get_listening_addrs (GstQuicLibServerContext *server)
+{
+  GSList *addrs;
+  GSList *sockets = server->sockets;
+
+  while (sockets != NULL) {
+    GSocketAddress *sa = g_socket_get_local_address (
+        ((QuicLibSocketContext *) sockets->data)->socket, NULL);
+    addrs = g_slist_prepend (addrs, sa);
+    sockets = sockets->next;
+  }
+
+  return addrs;
+}
+
+GSList *
+gst_quiclib_transport_get_acceptable_alpns (GstQuicLibServerContext *server)
+{
+  return server->acceptable_alpns;
+}
+
+GInetSocketAddress *
+gst_quiclib_transport_get_local (GstQuicLibTransportConnection *conn)
+{
+  return (GInetSocketAddress *) g_socket_address_new_from_native (
+      conn->path.path.local.addr, conn->path.path.local.addrlen);
+}
+
+GInetSocketAddress *
+gst_quiclib_transport_get_peer (GstQuicLibTransportConnection *conn)
+{
+  return (GInetSocketAddress *) g_socket_address_new_from_native (
+      conn->path.path.remote.addr, conn->path.path.remote.addrlen);
+}
+
+/**
+ * quiclib_server_reap
+ *
+ * Drops @server's references to its connections that have closed, so that a
+ * long-running server doesn't keep every connection it has ever accepted.
+ * Anything else still using a connection holds its own reference. Runs on
+ * the server's loop thread, which is the only one that walks the list
+ * without the egress_mutex.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_server_reap (gpointer user_data)
+{
+  GstQuicLibServerContext *server = (GstQuicLibServerContext *) user_data;
+  GList *it, *next, *reaped = NULL;
+
+  g_mutex_lock (&server->egress_mutex);
+  for (it = server->connections; it != NULL; it = next) {
+    next = it->next;
+    if (gst_quiclib_transport_get_state (
+        GST_QUICLIB_TRANSPORT_CONTEXT (it->data)) == QUIC_STATE_CLOSED) {
+      server->connections = g_list_remove_link (server->connections, it);
+      reaped = g_list_concat (reaped, it);
+    }
+  }
+  g_mutex_unlock (&server->egress_mutex);
+
+  for (it = reaped; it != NULL; it = it->next) {
+    GstQuicLibTransportConnection *conn =
+        GST_QUICLIB_TRANSPORT_CONNECTION (it->data);
+
+    GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (server),
+        "Reaping closed connection %p", conn);
+
+    /* Its timers don't hold a reference */
+    gst_quiclib_transport_context_lock (conn);
+    quiclib_cancel_timer (GST_QUICLIB_TRANSPORT_CONTEXT (conn));
+    gst_quiclib_transport_context_unlock (conn);
+  }
+
+  g_list_free_full (reaped, g_object_unref);
+
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * quiclib_conn_set_closed
+ *
+ * Marks @conn as closed, and if it belongs to a server, schedules the server
+ * to drop it. The reaping is always deferred to an idle source, as this can
+ * be called from the connection's own timer.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_conn_set_closed (GstQuicLibTransportConnection *conn)
+{
+  GstQuicLibTransportContextPrivate *priv;
+  GSource *source;
+
+  gst_quiclib_transport_context_set_state (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      QUIC_STATE_CLOSED);
+
+  if (conn->server == NULL) {
+    return;
+  }
+
+  priv = gst_quiclib_transport_context_get_instance_private (
+      GST_QUICLIB_TRANSPORT_CONTEXT (conn->server));
+  if (priv->loop_context == NULL) {
+    return;
+  }
+
+  source = g_idle_source_new ();
+  g_source_set_callback (source, quiclib_server_reap,
+      g_object_ref (conn->server), g_object_unref);
+  g_source_attach (source, priv->loop_context);
+  g_source_unref (source);
+}
+
+gboolean
+quiclib_close_wait (gpointer user_data)
+{
+  gboolean rv = G_SOURCE_CONTINUE;
+  GstQuicLibTransportConnection *conn =
+      (GstQuicLibTransportConnection *) user_data;
+
+  gst_quiclib_transport_context_lock (conn);
+
+  if (ngtcp2_conn_in_closing_period (conn->quic_conn) ||
+      ngtcp2_conn_in_draining_period (conn->quic_conn))
+  {
+    /* The closing or draining period is over */
+    g_source_unref (gst_quiclib_transport_context_get_timeout (conn));
+    gst_quiclib_transport_context_set_timeout (conn, NULL);
+    quiclib_conn_set_closed (conn);
+    rv = G_SOURCE_REMOVE;
+  } else {
+    quiclib_conn_set_closed (conn);
+  }
+
+  gst_quiclib_transport_context_unlock (conn);
+
+  return rv;
+}
+
+/**
+ * quiclib_transport_process_packet
+ * 
+ * Feed a received packet into NGTCP2 for processing. @path is the path the
+ * packet actually arrived on, which differs from the connection's current
+ * path when the peer migrates or a new path is being probed.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+gint
+quiclib_transport_process_packet (GstQuicLibTransportConnection *conn,
+    const ngtcp2_path *path, const ngtcp2_pkt_info *pktinfo, uint8_t *pkt,
+    size_t pktlen, ngtcp2_tstamp ts)
+{
+  gint rv;
+
+  gst_quiclib_transport_context_lock (conn);
+
+  rv = ngtcp2_conn_read_pkt (conn->quic_conn, path, pktinfo, pkt, pktlen,
+      quiclib_conn_timestamp (conn, ts));
+
+  gst_quiclib_transport_context_unlock (conn);
+
+  if (rv != 0) {
+    GST_INFO_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "ngtcp2 failed to read packet: %s", ngtcp2_strerror (rv));
+    switch (rv) {
+    case NGTCP2_ERR_DRAINING:
+    {
+      GstQuicLibTransportUserInterface *iface =
+            QUICLIB_TRANSPORT_USER_GET_IFACE (
+                gst_quiclib_transport_context_get_user (conn));
+
+      GST_INFO_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+          "Draining period is starting");
+      quiclib_set_timer (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+          quiclib_close_wait,
+          ngtcp2_conn_get_pto (conn->quic_conn) / NGTCP2_MILLISECONDS * 3);
+
+      iface->connection_closed (gst_quiclib_transport_context_get_user (conn),
+          GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+          gst_quiclib_transport_get_peer (conn));
+
+      return -2;
+    }
+    case NGTCP2_ERR_RETRY:
+    {
+      /*
+       * ngtcp2 wants the client's address validated before it keeps any
+       * state, so send a Retry and drop this connection. The client's next
+       * Initial carries the token, and is admitted as a new connection.
+       */
+      ngtcp2_pkt_hd hdr;
+      GSocketAddress *peer_addr;
+
+      if (conn->server != NULL && ngtcp2_accept (&hdr, pkt, pktlen) == 0) {
+        peer_addr = g_socket_address_new_from_native (path->remote.addr,
+            path->remote.addrlen);
+        if (quiclib_admission_send_retry (conn->server, conn->socket, &hdr,
+            peer_addr)) {
+          g_mutex_lock (&conn->server->admission.mutex);
+          conn->server->admission.stats.retried++;
+          g_mutex_unlock (&conn->server->admission.mutex);
+        }
+        g_object_unref (peer_addr);
+      }
+
+      quiclib_conn_set_closed (conn);
+      return -1;
+    }
+    case NGTCP2_ERR_DROP_CONN:
+      /* Just drop the connection silently */
+      return -1;
+    case NGTCP2_ERR_CRYPTO:
+      GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+          "Error in TLS stack: %s", SSL_alert_type_string (
+              ngtcp2_conn_get_tls_alert (conn->quic_conn)));
+      gst_quiclib_transport_disconnect (conn, FALSE,
+          QUICLIB_CLOSE_CRYPTO_ERROR);
+      return -1;
+    }
+  }
+
+  quiclib_conn_arm_timer (conn);
+
+  return 0;
+}
+
+/**
+ * gst_quiclib_transport_disconnect
+ * 
+ * Closes a QUIC connection.
+ * 
+ * @conn: Connection to close.
+ * @app_error: Whether this is closing due to an application error.
+ * @reason: The transport or application error code that caused this closure.
+ * @return 0 on success, <0 on error.
+ */
+gint
+gst_quiclib_transport_disconnect (GstQuicLibTransportConnection *conn,
+    gboolean app_error, guint reason)
+{
+  ngtcp2_ssize written;
+  ngtcp2_pkt_info pi;
+  uint8_t buf[NGTCP2_MAX_UDP_PAYLOAD_SIZE];
+
+  if (app_error) {
+    ngtcp2_ccerr_set_application_error (&conn->last_error, reason, NULL, 0);
+  } else {
+    ngtcp2_ccerr_set_transport_error (&conn->last_error, reason, NULL, 0);
+  }
+
+  if (conn->quic_conn == NULL) {
+    return 0;
+  }
+
+  gst_quiclib_transport_context_set_state (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      QUIC_STATE_HALF_CLOSED);
+
+  gst_quiclib_transport_context_lock (conn);
+  written = ngtcp2_conn_write_connection_close (conn->quic_conn,
+      &conn->path.path, &pi, buf, NGTCP2_MAX_UDP_PAYLOAD_SIZE,
+      &conn->last_error,
+      quiclib_conn_timestamp (conn, quiclib_ngtcp2_timestamp ()));
+
+  if (written < 0) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Couldn't write connection close packet: %s",
+        ngtcp2_strerror ((int) written));
+    gst_quiclib_transport_context_unlock (conn);
+    return -1;
+  }
+
+  /*
+   * Can return 0 if the connection was already closed
+   */
+  if (written > 0) {
+    written = ngtcp2_conn_write_pkt (conn->quic_conn, &conn->path.path, &pi,
+        buf, (size_t) written,
+        quiclib_conn_timestamp (conn, quiclib_ngtcp2_timestamp ()));
+  }
+
+  if (!ngtcp2_conn_in_closing_period (conn->quic_conn) &&
+      !ngtcp2_conn_in_draining_period (conn->quic_conn))
+  {
+    quiclib_set_timer (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        quiclib_close_wait,
+        ngtcp2_conn_get_pto (conn->quic_conn) / NGTCP2_MILLISECONDS * 3);
+  } else {
+    quiclib_conn_set_closed (conn);
+  }
+
+  gst_quiclib_transport_context_unlock (conn);
+
+  return 0;
+}
+
+/*
+ * Maps the memories of @buf into an array of ngtcp2_vecs. The mapping records
+ * come from the slab of @conn, or from g_malloc if @conn is NULL, and are
+ * chained on to *@unmap for quiclib_buffer_unmap.
+ */
+size_t
+quiclib_buffer_to_vec (GstQuicLibTransportConnection *conn, GstBuffer *buf,
+    ngtcp2_vec **vec, QuicLibUnmap **unmap)
+{
+  size_t i, n = gst_buffer_n_memory (buf);
+  ngtcp2_vec *v = g_new0 (ngtcp2_vec, n);
+  QuicLibUnmap **tail = unmap;
+  gsize offset = 0;
+  if (v == NULL) return 0;
+
+  while (*tail != NULL) {
+    tail = &(*tail)->next;
+  }
+
+  for (i = 0; i < n; i++) {
+    QuicLibUnmap *map;
+
+    if (conn != NULL) {
+      map = quiclib_slab_alloc (&conn->unmap_slab);
+      map->slab = &conn->unmap_slab;
+    } else {
+      map = g_new (QuicLibUnmap, 1);
+      map->slab = NULL;
+    }
+    map->mem = gst_buffer_peek_memory (buf, i);
+    gst_memory_map (map->mem, &map->map, GST_MAP_READ);
+    /* Unmapped in quiclib_buffer_unmap */
+    v[i].base = map->map.data;
+    v[i].len = map->map.size;
+    offset += map->map.size;
+    map->end_offset = offset;
+    map->next = NULL;
+    *tail = map;
+    tail = &map->next;
+  }
+
+  *vec = v;
+  return n;
+}
+
+void
+quiclib_buffer_unmap (QuicLibUnmap **map)
+{
+  while (*map != NULL) {
+    QuicLibUnmap *unmap = *map;
+
+    *map = unmap->next;
+    gst_memory_unmap (unmap->mem, &unmap->map);
+    if (unmap->slab != NULL) {
+      quiclib_slab_free (unmap->slab, unmap);
+    } else {
+      g_free (unmap);
+    }
+  }
+}
+
+/**
+ * gst_quiclib_transport_open_stream
+ * 
+ * Open a new stream on an open connection. The handshake MUST be completed
+ * before this method is called.
+ * 
+ * @conn: Connection
+ * @bidirectional: Open new bidirectional stream when TRUE, unidirectional when
+ *    FALSE.
+ * @stream_ctx: Opaque application context to return in callbacks about this
+ *    stream.
+ * @return The QUIC stream ID of the new stream, or a GstQuicLibErr value on
+ *    error.
+ */
+gint64
+gst_quiclib_transport_open_stream (GstQuicLibTransportConnection *conn,
+    gboolean bidirectional, gpointer stream_ctx)
+{
+  gint rv;
+  gint64 stream_id = -1;
+
+  gst_quiclib_transport_context_lock (conn);
+
+  if (ngtcp2_conn_get_handshake_completed (conn->quic_conn) == 0) {
+    GST_WARNING_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Cannot open stream as handshake has not completed yet");
+    gst_quiclib_transport_context_unlock (conn);
+    return GST_QUICLIB_ERR;
+  }
+
+  if (bidirectional) {
+    rv = ngtcp2_conn_open_bidi_stream (conn->quic_conn, &stream_id,
+        stream_ctx);
+  } else {
+    rv = ngtcp2_conn_open_uni_stream (conn->quic_conn, &stream_id, stream_ctx);
+  }
+
+  gst_quiclib_transport_context_unlock (conn);
+
+  if (rv != 0) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Failed to open new QUIC stream: %s", ngtcp2_strerror (rv));
+    if (rv == NGTCP2_ERR_STREAM_ID_BLOCKED) {
+      return GST_QUICLIB_ERR_STREAM_ID_BLOCKED;
+    }
+    return GST_QUICLIB_ERR;
+  }
+
+  switch (stream_id & 0x3) {
+    case 0x0: conn->last_client_bidi_stream_id = (guint64) stream_id; break;
+    case 0x1: conn->last_server_bidi_stream_id = (guint64) stream_id; break;
+    case 0x2: conn->last_client_uni_stream_id = (guint64) stream_id; break;
+    case 0x3: conn->last_server_uni_stream_id = (guint64) stream_id; break;
+  }
 
-  server->connections = g_list_append (server->connections, conn);
+  if (quiclib_alloc_stream_context (conn, stream_id) == FALSE) {
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Failed to allocate stream context");
+    gst_quiclib_transport_context_lock (conn);
+    ngtcp2_conn_shutdown_stream (conn->quic_conn, 0, stream_id, 0);
+    gst_quiclib_transport_context_unlock (conn);
+    return GST_QUICLIB_ERR;
+  }
+
+  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      "Opened new %sdirectional QUIC stream %ld",
+      (bidirectional)?("bi"):("uni"), stream_id);
+
+  return stream_id;
+}
+
+GstQuicLibStreamState
+gst_quiclib_transport_stream_state (GstQuicLibTransportConnection *conn,
+    guint64 stream_id)
+{
+  GstQuicLibStreamState rv = QUIC_STREAM_OPEN;
+
+  gst_quiclib_transport_context_lock (conn);
+
+  if (ngtcp2_conn_get_max_stream_data_left (conn->quic_conn, (gint64) stream_id)
+      == 0) {
+    rv |= QUIC_STREAM_DATA_BLOCKED;
+  }
+  if (ngtcp2_conn_get_cwnd_left (conn->quic_conn) == 0) {
+    rv |= QUIC_STREAM_CONNECTION_BLOCKED;
+  }
 
   gst_quiclib_transport_context_unlock (conn);
-  gst_quiclib_transport_context_unlock (server);
 
-  return conn;
+  if (stream_id & 0x2) {
+    if (conn->server) {
+      if (stream_id & 0x1) {
+        rv |= QUIC_STREAM_CLOSED_READING;
+      } else {
+        rv |= QUIC_STREAM_CLOSED_SENDING;
+      }
+    } else {
+      if (stream_id & 0x1) {
+        rv |= QUIC_STREAM_CLOSED_SENDING;
+      } else {
+        rv |= QUIC_STREAM_CLOSED_READING;
+      }
+    }
+  }
+
+  return rv;
 }
 
 /**
- * quiclib_data_received
- * 
- * Called by the GLib socket handling code when there is a packet to read on the
- * UDP socket.
- * 
- * INTERNAL FUNCTION ONLY.
+ * gst_quiclib_transport_stream_set_dscp
+ *
+ * Sets the Differentiated Services Code Point to mark packets carrying frames
+ * for @stream_id with, overriding the connection's "dscp" property. When frames
+ * for streams of different classes share a packet, it takes the one with the
+ * highest priority, with EF above the AF and CS classes and LE below the
+ * default.
+ *
+ * @conn: The connection that @stream_id belongs to.
+ * @stream_id: The stream to mark.
+ * @dscp: The DSCP between 0 and 63, or -1 to use the connection's default.
+ * @return TRUE if the stream was found, otherwise FALSE.
  */
 gboolean
-quiclib_data_received (GSocket *socket, GIOCondition condition,
-    gpointer user_data) {
-  QuicLibSocketContext *socket_ctx = (QuicLibSocketContext *) user_data;
-  gssize bytes_read = 0;
-  GError *err = NULL;
+gst_quiclib_transport_stream_set_dscp (GstQuicLibTransportConnection *conn,
+    guint64 stream_id, gint dscp)
+{
+  GstQuicLibStreamContext *stream;
+  gboolean rv = FALSE;
 
-  g_return_val_if_fail (socket == socket_ctx->socket, FALSE);
+  g_return_val_if_fail (dscp >= -1 && dscp <= QUICLIB_DSCP_MAX, FALSE);
 
-  do {
-    GSocketAddress *peer_addr, *local_addr;
-    GInputVector ivec;
-    guint8 buf[MAX_UDP];
-    GSocketControlMessage **msgs;
-    GstQuicLibPacketStats *stat = NULL;
-    gint i, num_msgs, flags = G_SOCKET_MSG_NONE;
+  gst_quiclib_transport_context_lock (conn);
 
-    int rv;
-    ngtcp2_pkt_info pi;
-    ngtcp2_version_cid vc;
+  if (g_hash_table_lookup_extended (conn->streams, &stream_id, NULL,
+      (gpointer *) &stream)) {
+    stream->dscp = dscp;
+    rv = TRUE;
+  }
+
+  gst_quiclib_transport_context_unlock (conn);
+
+  return rv;
+}
+
+typedef struct _GstQuicLibStreamClose GstQuicLibStreamClose;
+
+struct _GstQuicLibStreamClose {
+  GstMiniObject mini_object;
+
+  guint64 stream_id;
+  guint64 error_close;
+};
+
+GST_DEFINE_MINI_OBJECT_TYPE (GstQuicLibStreamClose, gst_quiclib_stream_close);
+
+#define QUICLIB_TYPE_STREAM_CLOSE gst_quiclib_stream_close_get_type ()
+#define QUICLIB_IS_STREAM_CLOSE(obj) \
+    (GST_IS_MINI_OBJECT_TYPE (obj, QUICLIB_TYPE_STREAM_CLOSE))
+#define QUICLIB_STREAM_CLOSE_CAST(obj) ((GstQuicLibStreamClose *) obj)
+
+
+#define gst_quiclib_stream_close_ref(obj) \
+    (GstQuicLibStreamClose *) gst_mini_object_ref (GST_MINI_OBJECT_CAST (obj));
+
+#define gst_quiclib_stream_close_unref(obj) \
+    gst_mini_object_unref (GST_MINI_OBJECT_CAST (obj));
+
+/*
+ * Asynchronous callback handling starts
+ */
+
+static gboolean
+_quiclib_transport_send_queue_source_prepare (GSource *source, gint *timeout)
+{
+  GstQuicLibTransportSendQueueSource *send_queue_src =
+      (GstQuicLibTransportSendQueueSource *) source;
+
+  GST_TRACE_OBJECT (send_queue_src->conn,
+      "send_queue_source_prepare: cwnd %lu, queue length: %u, bytes: %lu",
+      ngtcp2_conn_get_cwnd_left (send_queue_src->conn->quic_conn),
+      g_async_queue_length (send_queue_src->queue), send_queue_src->queue_len);
+
+  return (ngtcp2_conn_get_cwnd_left (send_queue_src->conn->quic_conn) &&
+      g_async_queue_length (send_queue_src->queue) > 0);
+}
+
+static gboolean
+_quiclib_transport_send_queue_source_dispatch (GSource *source, GSourceFunc cb,
+    gpointer user_data)
+{
+  GstQuicLibTransportSendQueueSource *send_queue_src =
+      (GstQuicLibTransportSendQueueSource *) source;
+  GstMiniObject *obj;
+  GQueue *replace = g_queue_new ();
+
+  for (obj = GST_MINI_OBJECT (g_async_queue_pop (send_queue_src->queue));
+      obj != NULL;
+      obj = GST_MINI_OBJECT (g_async_queue_try_pop (send_queue_src->queue))) {
+
+    if (GST_IS_BUFFER (obj)) {
+      GstQuicLibStreamMeta *smeta;
+      GstQuicLibDatagramMeta *dmeta;
+      gssize bytes_sent = 0;
+      GstQuicLibError err = GST_QUICLIB_ERR_OK;
+      GstBuffer *buf = GST_BUFFER (obj);
+
+      smeta = gst_buffer_get_quiclib_stream_meta (buf);
+      if (smeta != NULL) {
+        GST_TRACE_OBJECT (send_queue_src->conn, "Buffer of size %lu for stream "
+            "ID %lu to send, stream data remaining %lu",
+            gst_buffer_get_size (buf), smeta->stream_id,
+            ngtcp2_conn_get_max_stream_data_left (
+                send_queue_src->conn->quic_conn, smeta->stream_id));
+        if (ngtcp2_conn_get_max_stream_data_left (send_queue_src->conn->quic_conn,
+            smeta->stream_id) >= gst_buffer_get_size (buf)) {
+          err = gst_quiclib_transport_send_stream (send_queue_src->conn,
+              buf, smeta->stream_id, &bytes_sent);
+        }
+      }
+
+      dmeta = gst_buffer_get_quiclib_datagram_meta (buf);
+      if (dmeta != NULL) {
+        GST_TRACE_OBJECT (send_queue_src->conn, "Buffer of size %lu for "
+            "datagram to send", gst_buffer_get_size (buf));
+        err = gst_quiclib_transport_send_datagram (send_queue_src->conn,
+            buf, NULL, &bytes_sent);
+      }
+
+      if (err < 0) {
+        /* An error! */
+        GST_TRACE_OBJECT (send_queue_src->conn,
+            "An error was encountered when sending buffer! %s",
+            gst_quiclib_error_as_string(err));
+        break;
+      } else if (bytes_sent < gst_buffer_get_size (buf)) {
+        GST_TRACE_OBJECT (send_queue_src->conn,
+            "Managed to send %ld bytes of %ld", bytes_sent,
+            gst_buffer_get_size (buf));
+        if (bytes_sent > 0) {
+          /*
+           * Resize the buffer to account for what's been sent
+           */
+          gst_buffer_resize (buf, bytes_sent, -1);
+        }
+
+        g_queue_push_tail (replace, (gpointer) buf);
+      }
+
+      g_mutex_lock (&send_queue_src->mutex);
+      send_queue_src->queue_len -= bytes_sent;
+      g_mutex_unlock (&send_queue_src->mutex);
+    } else if (QUICLIB_IS_STREAM_CLOSE (obj)) {
+      GstQuicLibStreamClose *close_obj = QUICLIB_STREAM_CLOSE_CAST (obj);
+      GList *it;
+      gboolean needs_queuing = FALSE;
+
+      GST_TRACE_OBJECT (send_queue_src->conn, "Queued stream close %lu",
+          close_obj->stream_id);
+
+      for (it = replace->head; it != NULL; it = it->next) {
+        if (GST_IS_BUFFER (it->data)) {
+          GstQuicLibStreamMeta *smeta =
+              gst_buffer_get_quiclib_stream_meta (GST_BUFFER (it->data));
+          if (smeta != NULL &&
+              ((guint64) smeta->stream_id == close_obj->stream_id)) {
+            needs_queuing = TRUE;
+            break;
+          }
+        }
+      }
+
+      if (needs_queuing) {
+        GST_TRACE_OBJECT (send_queue_src->conn,
+            "Still data to send for stream %lu, requeueing",
+            close_obj->stream_id);
+        g_queue_push_tail (replace, (gpointer) obj);
+      } else if (QUICLIB_STREAM_IS_UNI (close_obj->stream_id) ||
+          close_obj->error_close) {
+        GST_TRACE_OBJECT (send_queue_src->conn,
+            "Forcing shutdown of stream %lu", close_obj->stream_id);
+        gst_quiclib_transport_context_lock (send_queue_src->conn);
+        if (ngtcp2_conn_shutdown_stream (send_queue_src->conn->quic_conn, 0,
+            (gint64) close_obj->stream_id, close_obj->error_close) != 0) {
+          GST_ERROR_OBJECT (obj, "Couldn't shut down stream %lu",
+              close_obj->stream_id);
+        }
+        gst_quiclib_transport_context_unlock (send_queue_src->conn);
+      } else if (quiclib_ngtcp2_conn_write (send_queue_src->conn,
+            close_obj->stream_id, NULL, 0, 1) != 0) {
+        GST_ERROR_OBJECT (obj, "Couldn't write end-of-stream for stream %lu",
+            close_obj->stream_id);
+      }
+    }
+  }
+
+  if (g_queue_get_length (replace)) {
+    GstMiniObject *obj;
+
+    g_async_queue_lock (send_queue_src->queue);
+
+    for (obj = GST_MINI_OBJECT (g_queue_pop_tail (replace)); obj != NULL;
+        obj = GST_MINI_OBJECT (g_queue_pop_tail (replace))) {
+      g_async_queue_push_front_unlocked (send_queue_src->queue, (gpointer) obj);
+    }
 
-    GstQuicLibTransportConnection *conn;
+    g_async_queue_unlock (send_queue_src->queue);
+  }
 
-    ivec.buffer = buf;
-    ivec.size = MAX_UDP;
+  g_queue_free (replace);
 
-    if (!G_IS_OBJECT (socket_ctx->socket)) {
-      return FALSE;
-    }
+  return TRUE;
+}
 
-    bytes_read = g_socket_receive_message (socket_ctx->socket, &peer_addr,
-        &ivec, 1, &msgs, &num_msgs, &flags, NULL, &err);
+static void
+_quiclib_transport_send_queue_source_finalize (GSource *source)
+{
+  GstQuicLibTransportSendQueueSource *send_queue_src =
+      (GstQuicLibTransportSendQueueSource *) source;
 
-    if (bytes_read < 0) {
-      if (err->code == G_IO_ERROR_WOULD_BLOCK) {
-        GST_DEBUG_OBJECT (socket_ctx->owner, "No more data, wait");
-        bytes_read = 0;
-      } else {
-        GST_ERROR_OBJECT (socket_ctx->owner,
-            "Couldn't receive UDP message: %s", err->message);
-      }
-      g_error_free (err);
-      err = NULL;
-      break;
-    }
+  g_async_queue_unref (send_queue_src->queue);
+}
 
-    GST_FIXME_OBJECT (socket_ctx->owner, "bytes_read: %ld, num_msgs: %d",
-        bytes_read, num_msgs);
+static GSourceFuncs _quiclib_transport_send_queue_source_funcs = {
+    .prepare = _quiclib_transport_send_queue_source_prepare,
+    .check = NULL,
+    .dispatch = _quiclib_transport_send_queue_source_dispatch,
+    .finalize = _quiclib_transport_send_queue_source_finalize
+};
 
-    for (i = 0; i < num_msgs; i++) {
-      if (SOCKET_CONTROL_MESSAGE_IS_ECN (msgs[i])) {
-        SocketControlMessageECN *ecn_scm =
-            SOCKET_CONTROL_MESSAGE_ECN (msgs [i]);
-
-        pi.ecn = ecn_scm->ecn;
-      } else if (SOCKET_CONTROL_MESSAGE_IS_PKTINFO (msgs[i])) {
-        SocketControlMessagePKTINFO *pktinfo_scm =
-            SOCKET_CONTROL_MESSAGE_PKTINFO (msgs [i]);
-        GSocketAddress *sa = g_socket_get_local_address (socket_ctx->socket,
-            &err);
-
-        if (sa == NULL) {
-          GST_ERROR_OBJECT (socket_ctx->owner, "Couldn't get local address: %s",
-              err->message);
-        } else {
-          local_addr = g_inet_socket_address_new (
-              pktinfo_scm->destination_address,
-              g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (sa)));
-
-          g_object_unref (sa);
-        }
-      } else if (SOCKET_CONTROL_MESSAGE_IS_TIMESTAMP (msgs [i])) {
-        guint64 ts;
-        SocketControlMessageTimestamp *timestamp =
-            SOCKET_CONTROL_MESSAGE_TIMESTAMP (msgs [i]);
+void
+_ensure_quiclib_send_queue (GstQuicLibTransportConnection *conn)
+{
+  if (conn->send_queue_source == NULL) {
+    GstQuicLibTransportContextPrivate *priv =
+        gst_quiclib_transport_context_get_instance_private (
+            GST_QUICLIB_TRANSPORT_CONTEXT (conn));
 
-        g_object_get (timestamp, "timestamp-ns", &ts, NULL);
+    conn->send_queue_source = (GstQuicLibTransportSendQueueSource *)
+        g_source_new (&_quiclib_transport_send_queue_source_funcs,
+          sizeof (GstQuicLibTransportSendQueueSource));
 
-        GST_FIXME_OBJECT (socket_ctx->owner,
-            "New packet stat with %ld bytes read at timestamp %lu", bytes_read,
-            ts);
+    conn->send_queue_source->conn = conn;
+    conn->send_queue_source->queue_len = 0;
 
-        stat = g_new (GstQuicLibPacketStats, 1);
-        stat->bytes = (gsize) bytes_read;
-        stat->timestamp_ns = ts;
-      }
+    g_mutex_init (&conn->send_queue_source->mutex);
 
-      g_object_unref (msgs[i]);
-    }
+    conn->send_queue_source->queue =
+        g_async_queue_new_full ((GDestroyNotify) gst_buffer_unref);
 
-    if (msgs) g_free (msgs);
+    g_source_attach ((GSource *) conn->send_queue_source, priv->loop_context);
+  }
+}
 
-    if (local_addr == NULL) {
-      local_addr = g_socket_get_local_address (socket_ctx->socket, &err);
-    }
+/*
+ * End asynchronous callback hanlding.
+ */
 
-    if (local_addr == NULL) {
-      GST_ERROR_OBJECT (socket_ctx->owner, "Couldn't get local address: %s",
-          err->message);
-      g_object_unref (peer_addr);
-      break;
-    }
+/*
+ * Shaping.
+ *
+ * The stream data sent on a connection can be shaped to a token bucket for
+ * the whole connection, set by the rate-limit and rate-burst properties, and
+ * to one for each stream, set from the GstQuicLibStreamMeta or with
+ * gst_quiclib_transport_stream_set_rate_limit. A buffer that both buckets have
+ * the tokens for is sent by the caller as usual. Otherwise it is held back on
+ * its stream's shaping queue and the caller returns as if it had been sent, so
+ * that shaping never blocks the sender. The queues are released on the
+ * connection's loop thread as tokens accrue, with the streams taking turns at
+ * the connection's bucket a chunk at a time so that one large buffer doesn't
+ * hold up the others.
+ *
+ * Once a stream has buffers held back, the rest of that stream queues behind
+ * them to keep it in order, and while any stream is waiting on the
+ * connection's bucket new data on the others waits its turn. DATAGRAM frames
+ * take tokens from the connection's bucket but are never held back, as they
+ * are only any use if they're sent now.
+ *
+ * A server can also cap the data sent by all of its connections together with
+ * the egress-rate-limit property. Stream data over that cap is held back in
+ * the same way, and the connections with data held back are kept on the
+ * server's egress backlog. That is released on the server's loop thread a
+ * chunk at a time by weighted fair queueing: the connection with the lowest
+ * virtual finish time goes next, and each chunk moves its finish time on by
+ * its size over the connection's weight, as set with
+ * gst_quiclib_transport_connection_set_egress_weight. A connection that
+ * bursts only spends its own share of the cap, and one that has been idle
+ * rejoins at the server's current virtual time rather than catching up.
+ *
+ * The context lock of a connection is always taken before the server's
+ * egress_mutex, never after it.
+ */
+#define QUICLIB_SHAPER_DEFAULT_BURST (100 * NGTCP2_MILLISECONDS)
+#define QUICLIB_SHAPER_MIN_CHUNK 1200
+#define QUICLIB_SHAPER_BLOCKED_RETRY (5 * NGTCP2_MILLISECONDS)
 
-    rv = ngtcp2_pkt_decode_version_cid (&vc, buf, bytes_read, 18);
-    switch (rv) {
-    case 0:
-    {
-      gchar dcid_str[CID_STR_LEN], scid_str[CID_STR_LEN], *peer_addr_str;
-      peer_addr_str = g_socket_connectable_to_string (
-          G_SOCKET_CONNECTABLE (peer_addr));
-      GST_DEBUG_OBJECT (socket_ctx->owner,
-          "Received packet of length %ld with DCID %s, SCID %s from %s",
-          bytes_read, quiclib_rawcidtostr (vc.dcid, vc.dcidlen, dcid_str),
-          quiclib_rawcidtostr (vc.scid, vc.scidlen, scid_str), peer_addr_str);
-      g_free (peer_addr_str);
-      break;
-    }
-    case NGTCP2_ERR_VERSION_NEGOTIATION:
-      GST_ERROR_OBJECT (socket_ctx->owner,
-          "Need to implement version negotiation!");
-      g_assert (0);
-      break;
-    default:
-      GST_WARNING_OBJECT (socket_ctx->owner,
-          "Could not decode version and CID from QUIC packet header: %s",
-          ngtcp2_strerror (rv));
-      continue;
-    }
+typedef enum {
+  QUICLIB_SHAPER_SENT,
+  QUICLIB_SHAPER_WAIT,
+  QUICLIB_SHAPER_BLOCKED,
+  QUICLIB_SHAPER_DONE
+} QuicLibShaperResult;
 
-    if (QUICLIB_SERVER (socket_ctx->owner)) {
-      GstQuicLibServerContext *server =
-          GST_QUICLIB_SERVER_CONTEXT (socket_ctx->owner);
-      GList *conn_it = server->connections;
-      while (conn_it != NULL) {
-        GList *cid = ((GstQuicLibTransportConnection *) conn_it->data)->cids;
-        while (cid != NULL) {
-          if (((ngtcp2_cid *) cid->data)->datalen == vc.dcidlen) {
-            if (memcmp (((ngtcp2_cid *) cid->data)->data, vc.dcid, vc.dcidlen)
-                == 0) {
-              conn = GST_QUICLIB_TRANSPORT_CONNECTION (conn_it->data);
-              break;
-            }
-          }
-          cid = cid->next;
-        }
-        if (cid) break;
+/**
+ * quiclib_token_bucket_depth
+ *
+ * Returns the most tokens that @tb can hold. Without a burst size, this is
+ * QUICLIB_SHAPER_DEFAULT_BURST worth of the rate, and at least a packet.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gint64
+quiclib_token_bucket_depth (const QuicLibTokenBucket *tb)
+{
+  guint64 depth = tb->burst;
 
-        conn_it = conn_it->next;
-      }
+  if (depth == 0) {
+    depth = MAX (gst_util_uint64_scale (tb->rate / 8,
+        QUICLIB_SHAPER_DEFAULT_BURST, NGTCP2_SECONDS),
+        QUICLIB_SHAPER_MIN_CHUNK);
+  }
 
-      if (conn_it == NULL) {
-        ngtcp2_pkt_hd hdr;
-        ngtcp2_cid *new_scid, *dcid;
-        gchar debug_scid_str[CID_STR_LEN], debug_dcid_str[CID_STR_LEN],
-        *debug_remote_addr;
+  return (gint64) MIN (depth, G_MAXINT64 / 2);
+}
 
+/**
+ * quiclib_token_bucket_fill
+ *
+ * Adds the tokens that @tb has accrued up to @now. The time is only moved on
+ * when at least a whole token is added, so slow rates still fill.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_token_bucket_fill (QuicLibTokenBucket *tb, ngtcp2_tstamp now)
+{
+  gint64 depth;
+  guint64 added;
 
-        /*
-         * TODO: Support multiple clients
-         */
-        if (server->connections != NULL) {
-          GST_WARNING_OBJECT (socket_ctx->owner,
-              "TODO: Support multiple clients on a single server");
-          continue;
-        }
+  if (tb->rate == 0 || now <= tb->last_fill) {
+    return;
+  }
 
-        rv = ngtcp2_accept (&hdr, buf, bytes_read);
-        if (rv != 0) {
-          if (rv == NGTCP2_ERR_RETRY) {
-            GST_ERROR_OBJECT (socket_ctx->owner, "Need to implement retry!");
-            g_assert (0);
-          }
-          GST_WARNING_OBJECT (socket_ctx->owner,
-              "Unexpected packet of length %lu bytes", bytes_read);
-          continue;
-        }
+  depth = quiclib_token_bucket_depth (tb);
+  added = gst_util_uint64_scale (MAX (tb->rate / 8, 1),
+      MIN (now - tb->last_fill, NGTCP2_SECONDS), NGTCP2_SECONDS);
+  if (added == 0) {
+    return;
+  }
 
-        g_assert (hdr.type == NGTCP2_PKT_INITIAL);
+  tb->tokens += (gint64) MIN (added, (guint64) depth * 2);
+  tb->tokens = MIN (tb->tokens, depth);
+  tb->last_fill = now;
+}
 
-        conn = gst_quiclib_new_conn_from_server (server);
-        if (conn == NULL) {
-          GST_ERROR_OBJECT (socket_ctx->owner,
-              "Couldn't allocation connection context");
-          continue;
-        }
+/**
+ * quiclib_token_bucket_configure
+ *
+ * Sets the @rate and @burst of @tb. A bucket that wasn't limited starts out
+ * full, and one that was keeps its tokens up to its new depth.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_token_bucket_configure (QuicLibTokenBucket *tb, guint64 rate,
+    guint64 burst, ngtcp2_tstamp now)
+{
+  gboolean was_limited = tb->rate > 0;
 
-        new_scid = g_malloc (sizeof (ngtcp2_cid));
-        if (new_scid == NULL) {
-          GST_ERROR_OBJECT (socket_ctx->owner,
-              "Couldn't allocate space for new SCID");
-          g_free (conn);
-          continue;
-        }
+  if (tb->rate == rate && tb->burst == burst) {
+    return;
+  }
 
-        new_scid->datalen = 18;
-        if (RAND_bytes (new_scid->data, new_scid->datalen) != 1) {
-          GST_ERROR_OBJECT (socket_ctx->owner, "OpenSSL RAND_bytes failed: %s",
-              ERR_error_string (ERR_get_error (), NULL));
-          g_free (conn);
-          continue;
-        }
+  quiclib_token_bucket_fill (tb, now);
 
-        dcid = g_malloc (sizeof (ngtcp2_cid));
-        if (dcid == NULL) {
-          GST_ERROR_OBJECT (socket_ctx->owner,
-              "Couldn't allocate space for new DCID");
-          g_free (new_scid);
-          g_free (conn);
-          continue;
-        }
-        memcpy (dcid->data, hdr.scid.data, hdr.scid.datalen);
-        dcid->datalen = hdr.scid.datalen;
+  tb->rate = rate;
+  tb->burst = burst;
+  tb->last_fill = now;
 
-        /* TODO: Should this be a copy, and then set the owner as the conn? */
-        conn->socket = socket_ctx;
+  if (!was_limited) {
+    tb->tokens = quiclib_token_bucket_depth (tb);
+  } else {
+    tb->tokens = MIN (tb->tokens, quiclib_token_bucket_depth (tb));
+  }
+}
 
-        ngtcp2_settings_default (&conn->conn_settings);
+/**
+ * quiclib_token_bucket_allowance
+ *
+ * Returns how many bytes @tb will let through now.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gint64
+quiclib_token_bucket_allowance (const QuicLibTokenBucket *tb)
+{
+  return (tb->rate == 0) ? G_MAXINT64 : tb->tokens;
+}
 
-        conn->conn_settings.initial_ts = quiclib_ngtcp2_timestamp ();
-        conn->conn_settings.log_printf = quiclib_ngtcp2_print;
-        /*
-         * Fine to just share the pointer - according to the ngtcp2_settings
-         * docs, ngtcp2_conn_server_new makes a copy of the token
-         */
-        conn->conn_settings.token = hdr.token;
+/**
+ * quiclib_token_bucket_consume
+ *
+ * Takes @bytes worth of tokens from @tb. The debt is capped at the depth of
+ * the bucket, so that a burst of DATAGRAM frames can't shut out stream data
+ * for long.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_token_bucket_consume (QuicLibTokenBucket *tb, gsize bytes)
+{
+  gint64 depth;
 
-        conn->transport_params.stateless_reset_token_present = 0;
-        memcpy (&conn->transport_params.original_dcid, &hdr.dcid,
-            sizeof (ngtcp2_cid));
-        conn->transport_params.original_dcid_present = 1;
+  if (tb->rate == 0) {
+    return;
+  }
 
-        if (RAND_bytes (conn->transport_params.stateless_reset_token, 16) != 1) {
-          GST_WARNING_OBJECT (socket_ctx->owner,
-              "OpenSSL RAND_bytes failed to generate a stateless reset token:"
-              " %s", ERR_error_string (ERR_get_error (), NULL));
-        }
+  depth = quiclib_token_bucket_depth (tb);
+  tb->tokens -= (gint64) MIN (bytes, (gsize) depth * 2);
+  tb->tokens = MAX (tb->tokens, -depth);
+}
 
-        switch (g_socket_address_get_family (peer_addr)) {
-        case G_SOCKET_FAMILY_IPV4:
-        {
-          struct sockaddr_in local_sa, remote_sa;
-          g_socket_address_to_native (local_addr, &local_sa,
-              sizeof (struct sockaddr_in), NULL);
-          g_socket_address_to_native (peer_addr, &remote_sa,
-              sizeof (struct sockaddr_in), NULL);
-          ngtcp2_path_storage_init (&conn->path,
-              (ngtcp2_sockaddr *) &local_sa, sizeof (struct sockaddr_in),
-              (ngtcp2_sockaddr *) &remote_sa, sizeof (struct sockaddr_in),
-              (void *) conn);
-          break;
-        }
-        case G_SOCKET_FAMILY_IPV6:
-        {
-          struct sockaddr_in6 local_sa, remote_sa;
-          g_socket_address_to_native (local_addr, &local_sa,
-              sizeof (struct sockaddr_in6), NULL);
-          g_socket_address_to_native (peer_addr, &remote_sa,
-              sizeof (struct sockaddr_in6), NULL);
-          ngtcp2_path_storage_init (&conn->path,
-              (ngtcp2_sockaddr *) &local_sa, sizeof (struct sockaddr_in6),
-              (ngtcp2_sockaddr *) &remote_sa, sizeof (struct sockaddr_in6),
-              (void *) conn);
-          break;
-        }
-        default:
-          GST_ERROR_OBJECT (socket_ctx->owner,
-              "Received unknown socket family %d",
-              g_socket_address_get_family (peer_addr));
-          return FALSE;
-        }
+/**
+ * quiclib_token_bucket_wait
+ *
+ * Returns how long in nanoseconds until @tb will let @bytes through, or 0 if
+ * it will now.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static guint64
+quiclib_token_bucket_wait (const QuicLibTokenBucket *tb, gsize bytes)
+{
+  if (tb->rate == 0 || tb->tokens >= (gint64) bytes) {
+    return 0;
+  }
 
-        quiclib_print_ngtcp2_transport_params (
-            GST_QUICLIB_TRANSPORT_CONTEXT (conn), conn->transport_params);
+  return gst_util_uint64_scale_ceil ((guint64) ((gint64) bytes - tb->tokens),
+      NGTCP2_SECONDS, MAX (tb->rate / 8, 1));
+}
 
-        rv = ngtcp2_conn_server_new (&conn->quic_conn, dcid, new_scid,
-            &conn->path.path, hdr.version, &quiclib_ngtcp2_server_callbacks,
-            &conn->conn_settings, &conn->transport_params, NULL,
-            (void *) conn);
-        if (rv != 0) {
-          GST_ERROR_OBJECT (socket_ctx->owner,
-              "Failed to create new server instance: %s",
-              ngtcp2_strerror (rv));
-          g_free (conn);
-          continue;
-        }
+/**
+ * quiclib_shaper_sync
+ *
+ * Brings the connection's token bucket up to date with the rate-limit and
+ * rate-burst properties, and fills it up to @now. Call with the context lock
+ * held.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_shaper_sync (GstQuicLibTransportConnection *conn, ngtcp2_tstamp now)
+{
+  GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (
+          GST_QUICLIB_TRANSPORT_CONTEXT (conn));
 
-        conn->ssl = SSL_new (server->ssl_ctx);
-        if (conn->ssl == NULL) {
-          GST_ERROR_OBJECT (socket_ctx->owner,
-              "Failed to configure server SSL context");
-          ngtcp2_conn_del (conn->quic_conn);
-          g_free (conn);
-          continue;
-        }
+  quiclib_token_bucket_configure (&conn->shaper, priv->rate_limit,
+      priv->rate_burst, now);
+  quiclib_token_bucket_fill (&conn->shaper, now);
+}
 
-#ifdef OPENSSL_DEBUG
-        SSL_set_msg_callback (conn->ssl, quiclib_openssl_dbg_cb);
-        SSL_set_msg_callback_arg (conn->ssl, (void *) conn);
-#endif
+/**
+ * quiclib_shaper_drop_stream
+ *
+ * Drops the buffers held back on @stream, such as when it is reset.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_shaper_drop_stream (GstQuicLibStreamContext *stream)
+{
+  g_queue_clear_full (&stream->shaped, quiclib_shaped_buffer_free);
+  quiclib_mem_charge (&stream->memory->shaped, -(gssize) stream->shaped_bytes);
+  stream->shaped_bytes = 0;
+  stream->shaped_close = FALSE;
+}
 
-        quiclib_enable_tls_export (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-            conn->ssl);
+static gboolean quiclib_shaper_release (gpointer user_data);
+static gboolean quiclib_egress_release (gpointer user_data);
 
-        conn->conn_ref.get_conn = quiclib_get_ngtcp2_conn;
-        conn->conn_ref.user_data = (void *) conn;
+/**
+ * quiclib_shaper_schedule
+ *
+ * Schedules a release of @conn's shaping queues on its loop thread in
+ * @delay_ns nanoseconds, unless one is already scheduled. Call with the
+ * context lock held.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_shaper_schedule (GstQuicLibTransportConnection *conn,
+    guint64 delay_ns)
+{
+  GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (
+          GST_QUICLIB_TRANSPORT_CONTEXT (conn));
+  GSource *source;
 
-        SSL_set_app_data (conn->ssl, &conn->conn_ref);
-        SSL_set_accept_state (conn->ssl);
-        SSL_set_quic_early_data_enabled (conn->ssl, 1);
+  if (conn->shaper_scheduled || priv->loop_context == NULL) {
+    return;
+  }
 
-        ngtcp2_conn_set_tls_native_handle (conn->quic_conn, conn->ssl);
+  if (delay_ns == 0) {
+    source = g_idle_source_new ();
+  } else {
+    source = g_timeout_source_new ((guint) MIN (
+        (delay_ns + NGTCP2_MILLISECONDS - 1) / NGTCP2_MILLISECONDS,
+        G_MAXUINT));
+  }
 
-        debug_remote_addr = g_socket_connectable_to_string (
-            G_SOCKET_CONNECTABLE (peer_addr));
-        GST_DEBUG_OBJECT (socket_ctx->owner,
-            "New client connect from %s, SCID %s DCID %s",
-            debug_remote_addr, quiclib_cidtostr (new_scid, debug_scid_str),
-            quiclib_cidtostr (dcid, debug_dcid_str));
+  conn->shaper_scheduled = TRUE;
+  g_source_set_callback (source, quiclib_shaper_release, g_object_ref (conn),
+      g_object_unref);
+  g_source_attach (source, priv->loop_context);
+  g_source_unref (source);
+}
 
-        conn->cids = g_list_append (conn->cids, new_scid);
-        conn->cids = g_list_append (conn->cids, dcid);
-      }
-    } else {
-      conn = GST_QUICLIB_TRANSPORT_CONNECTION (socket_ctx->owner);
-    }
+/**
+ * quiclib_egress_server
+ *
+ * Returns the server that @conn belongs to if it has an egress-rate-limit,
+ * otherwise NULL.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static GstQuicLibServerContext *
+quiclib_egress_server (GstQuicLibTransportConnection *conn)
+{
+  GstQuicLibTransportContextPrivate *priv;
 
-    if (stat) {
-      _quiclib_add_stat (conn, &conn->stats.bytes_received, stat);
-    }
-    conn->stats.pkt_counts.received++;
+  if (conn->server == NULL) {
+    return NULL;
+  }
 
-    if (ngtcp2_conn_in_closing_period (conn->quic_conn)) {
-      gchar *debug_remote_addr = g_socket_connectable_to_string (
-          G_SOCKET_CONNECTABLE (peer_addr));
-      GST_WARNING_OBJECT (socket_ctx->owner,
-          "Connection with %s is in closing period", debug_remote_addr);
-      g_free (debug_remote_addr);
-      continue;
-    }
+  priv = gst_quiclib_transport_context_get_instance_private (
+      GST_QUICLIB_TRANSPORT_CONTEXT (conn->server));
 
-    if (ngtcp2_conn_in_draining_period (conn->quic_conn)) {
-      gchar *debug_remote_addr = g_socket_connectable_to_string (
-          G_SOCKET_CONNECTABLE (peer_addr));
-      GST_WARNING_OBJECT (socket_ctx->owner,
-          "Connection with %s is in draining period", debug_remote_addr);
-      g_free (debug_remote_addr);
-      continue;
-    }
+  return (priv->egress_rate_limit > 0) ? conn->server : NULL;
+}
 
-    rv = quiclib_transport_process_packet (conn, &pi, buf, bytes_read);
-    if (rv != 0) {
-      continue;
-    }
+/**
+ * quiclib_egress_sync
+ *
+ * Brings @server's egress token bucket up to date with its egress-rate-limit
+ * property, and fills it up to @now. Call with the egress_mutex held.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_egress_sync (GstQuicLibServerContext *server, ngtcp2_tstamp now)
+{
+  GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (
+          GST_QUICLIB_TRANSPORT_CONTEXT (server));
 
-    /*
-     * TODO: Make this a timeout operation to pack ACKs into regular packets
-     * and minimise small packet overheads
-     */
-    rv = quiclib_ngtcp2_conn_write (conn, -1, NULL, 0, 0);
-    if (rv != 0) {
-      continue;
-    }
+  quiclib_token_bucket_configure (&server->egress, priv->egress_rate_limit, 0,
+      now);
+  quiclib_token_bucket_fill (&server->egress, now);
+}
 
-    /*
-     * Wake up any threads waiting for cwnd
-     */
-    g_cond_signal (&conn->cond);
-  } while (bytes_read > 0);
+/**
+ * quiclib_egress_snapshot
+ *
+ * Fills @egress with a copy of the egress token bucket of @conn's server as
+ * of @now, or an unlimited bucket if there isn't one.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_egress_snapshot (GstQuicLibTransportConnection *conn,
+    ngtcp2_tstamp now, QuicLibTokenBucket *egress)
+{
+  GstQuicLibServerContext *server = quiclib_egress_server (conn);
 
-  if (err != NULL) {
-    g_error_free (err);
+  memset (egress, 0, sizeof (*egress));
+
+  if (server == NULL) {
+    return;
   }
 
-  return bytes_read == 0?TRUE:FALSE;
+  g_mutex_lock (&server->egress_mutex);
+  quiclib_egress_sync (server, now);
+  *egress = server->egress;
+  g_mutex_unlock (&server->egress_mutex);
 }
 
 /**
- * quiclib_open_socket
- * 
- * Common code for opening listening sockets for QUIC connections.
- * 
+ * quiclib_egress_consume
+ *
+ * Takes the tokens for @bytes sent on @conn from its server's egress token
+ * bucket, if it has one.
+ *
  * INTERNAL FUNCTION ONLY.
  */
-QuicLibSocketContext *
-quiclib_open_socket (GstQuicLibTransportContext *ctx, GSocketAddress *addr)
+static void
+quiclib_egress_consume (GstQuicLibTransportConnection *conn, gsize bytes)
 {
-  GstQuicLibTransportContextPrivate *priv;
-  GSocketAddress *local, *remote;
-  gchar *debug_addr;
-  GSocket *socket;
-  GSource *source;
-  QuicLibSocketContext *socket_ctx;
-  GSocketFamily fam;
-  GError *err;
-
-  priv = gst_quiclib_transport_context_get_instance_private (ctx);
-  debug_addr =
-      g_socket_connectable_to_string (G_SOCKET_CONNECTABLE (addr));
-
-  fam = g_socket_address_get_family ((GSocketAddress *) addr);
+  GstQuicLibServerContext *server = quiclib_egress_server (conn);
 
-  socket = g_socket_new (fam, G_SOCKET_TYPE_DATAGRAM, G_SOCKET_PROTOCOL_UDP,
-      &err);
-
-  if (socket == NULL) {
-    GST_ERROR_OBJECT (ctx, "Failed to open socket: %s", err->message);
-    goto no_socket;
+  if (server == NULL) {
+    return;
   }
 
-  switch (fam) {
-  case G_SOCKET_FAMILY_IPV4:
-    if (!g_socket_set_option (socket, IPPROTO_IP, IP_PKTINFO, 1, &err)) {
-      GST_ERROR_OBJECT (ctx, "Couldn't set IP_PKTINFO: %s", err->message);
-      goto no_bind;
-    }
+  g_mutex_lock (&server->egress_mutex);
+  quiclib_egress_sync (server, quiclib_ngtcp2_timestamp ());
+  quiclib_token_bucket_consume (&server->egress, bytes);
+  g_mutex_unlock (&server->egress_mutex);
+}
 
-    if (!g_socket_set_option (socket, IPPROTO_IP, IP_RECVTOS, 1, &err)) {
-      GST_WARNING_OBJECT (ctx, "Couldn't enable ECN for IPv4: %s",
-          err->message);
-    }
+/**
+ * quiclib_egress_try_consume
+ *
+ * Takes the tokens for @bytes from the egress token bucket of @conn's server
+ * and returns TRUE, if it has them and no other connection is waiting on it.
+ * Always returns TRUE if there is no egress-rate-limit.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_egress_try_consume (GstQuicLibTransportConnection *conn, gsize bytes,
+    ngtcp2_tstamp now)
+{
+  GstQuicLibServerContext *server = quiclib_egress_server (conn);
+  gboolean rv = FALSE;
 
-    if (!g_socket_set_option (socket, IPPROTO_IP, IP_MTU_DISCOVER, 1, &err)) {
-      GST_WARNING_OBJECT (ctx, "Couldn't enable MTU discovery for IPv4: %s",
-          err->message);
-    }
+  if (server == NULL) {
+    return TRUE;
+  }
 
-#if defined(IP_DONTFRAG)
-    if (!g_socket_set_option (socket, IPPROTO_IP, IP_DONTFRAG, 1, &err)) {
-      GST_WARNING_OBJECT (ctx,
-          "Couldn't enable the don't fragment socket option for IPv4: %s",
-          err->message);
-    }
-#endif
-    break;
-  case G_SOCKET_FAMILY_IPV6:
-    if (!g_socket_set_option (socket, IPPROTO_IPV6, IPV6_RECVPKTINFO, 1, &err))
-    {
-      GST_ERROR_OBJECT (ctx, "Couldn't set IPV6_RECVPKTINFO: %s", err->message);
-      goto no_bind;
-    }
+  g_mutex_lock (&server->egress_mutex);
+  quiclib_egress_sync (server, now);
+  if (server->egress_backlog == NULL &&
+      quiclib_token_bucket_allowance (&server->egress) >= (gint64) bytes) {
+    quiclib_token_bucket_consume (&server->egress, bytes);
+    rv = TRUE;
+  }
+  g_mutex_unlock (&server->egress_mutex);
 
-    if (!g_socket_set_option (socket, IPPROTO_IPV6, IPV6_RECVTCLASS, 1, &err)) {
-      GST_WARNING_OBJECT (ctx, "Couldn't enable ECN for IPv6: %s",
-          err->message);
-    }
+  return rv;
+}
 
-    if (!g_socket_set_option (socket, IPPROTO_IPV6, IPV6_MTU_DISCOVER, 1,
-        &err)) {
-      GST_WARNING_OBJECT (ctx, "Couldn't enable MTU discovery for IPv6: %s",
-          err->message);
-    }
+/**
+ * quiclib_egress_schedule
+ *
+ * Schedules a release of @server's egress backlog on its loop thread in
+ * @delay_ns nanoseconds, unless one is already scheduled. Call with the
+ * egress_mutex held.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_egress_schedule (GstQuicLibServerContext *server, guint64 delay_ns)
+{
+  GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (
+          GST_QUICLIB_TRANSPORT_CONTEXT (server));
+  GSource *source;
 
-#if defined(IPV6_DONTFRAG)
-    if (!g_socket_set_option (socket, IPPROTO_IPV6, IPV6_DONTFRAG, 1, &err)) {
-      GST_WARNING_OBJECT (ctx,
-          "Couldn't enable the don't fragment socket option for IPv6: %s",
-          err->message);
-    }
-#endif
-    break;
-  default:
-    g_assert (fam == G_SOCKET_FAMILY_IPV4 || fam == G_SOCKET_FAMILY_IPV6);
+  if (server->egress_scheduled || priv->loop_context == NULL) {
+    return;
   }
 
-  if (priv->enable_stats) {
-    GST_FIXME_OBJECT (ctx, "Enabling packet reception timestamps!");
-    if (!g_socket_set_option (socket, SOL_SOCKET, SO_TIMESTAMPNS, 1, &err)) {
-      GST_WARNING_OBJECT (ctx,
-          "Couldn't enable the timestamp option for incoming sockets: %s",
-          err->message);
-    }
+  if (delay_ns == 0) {
+    source = g_idle_source_new ();
+  } else {
+    source = g_timeout_source_new ((guint) MIN (
+        (delay_ns + NGTCP2_MILLISECONDS - 1) / NGTCP2_MILLISECONDS,
+        G_MAXUINT));
   }
 
-  g_socket_set_blocking (socket, FALSE);
+  server->egress_scheduled = TRUE;
+  g_source_set_callback (source, quiclib_egress_release,
+      g_object_ref (server), g_object_unref);
+  g_source_attach (source, priv->loop_context);
+  g_source_unref (source);
+}
 
-  if (QUICLIB_SERVER (ctx)) {
-    local = addr;
-    if (g_socket_bind (socket, local, TRUE, &err) == FALSE) {
-      GST_ERROR_OBJECT (ctx,
-          "Couldn't bind local listening socket to address %s: %s", debug_addr,
-          err->message);
-      goto no_bind;
-    }
-  } else {
-    remote = addr;
-    if (g_socket_connect (socket, remote, NULL, &err) == FALSE) {
-      GST_ERROR_OBJECT (ctx, "Couldn't connect to remote address %s: %s",
-          debug_addr, err->message);
-      goto no_bind;
-    }
+/**
+ * quiclib_shaper_kick
+ *
+ * Makes sure that the buffers held back on @conn's streams will be released,
+ * by putting @conn on its server's egress backlog if there is an
+ * egress-rate-limit, or otherwise by scheduling a release of its own. A
+ * connection joining the backlog starts at the server's current virtual time.
+ * Call with the context lock held.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_shaper_kick (GstQuicLibTransportConnection *conn, guint64 delay_ns)
+{
+  GstQuicLibServerContext *server = quiclib_egress_server (conn);
 
-    local = g_socket_get_local_address (socket, &err);
-    if (local == NULL) {
-      GST_ERROR_OBJECT (ctx, "Couldn't get local address: %s", err->message);
-      goto no_bind;
-    }
+  if (server == NULL) {
+    quiclib_shaper_schedule (conn, delay_ns);
+    return;
   }
 
-  source = g_socket_create_source (socket, G_IO_IN, NULL);
-
-  socket_ctx = g_malloc (sizeof (QuicLibSocketContext));
-  if (socket_ctx == NULL) {
-    GST_ERROR_OBJECT (ctx, "Couldn't allocate memory for the socket context");
-    goto no_source_ctx;
+  g_mutex_lock (&server->egress_mutex);
+  if (!conn->egress_backlogged) {
+    conn->egress_vtime = MAX (conn->egress_vtime, server->egress_vtime);
+    server->egress_backlog = g_list_append (server->egress_backlog,
+        g_object_ref (conn));
+    conn->egress_backlogged = TRUE;
   }
+  quiclib_egress_schedule (server, delay_ns);
+  g_mutex_unlock (&server->egress_mutex);
+}
 
-  socket_ctx->owner = ctx;
-  socket_ctx->socket = socket;
-  socket_ctx->source = source;
+/**
+ * quiclib_shaper_hold
+ *
+ * Decides whether @buf, about to be sent on @stream_id, is within the rate
+ * limits of @conn and @stream. If it is, the tokens for it are taken and FALSE
+ * is returned for the caller to send it. Otherwise @buf is queued on @stream
+ * to be released later and TRUE is returned. Call with the context lock held.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_shaper_hold (GstQuicLibTransportConnection *conn,
+    GstQuicLibStreamContext *stream, gint64 stream_id, GstBuffer *buf,
+    GstQuicLibStreamMeta *meta)
+{
+  GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (
+          GST_QUICLIB_TRANSPORT_CONTEXT (conn));
+  ngtcp2_tstamp now = quiclib_ngtcp2_timestamp ();
+  gsize size = gst_buffer_get_size (buf);
+  gboolean egress = quiclib_egress_server (conn) != NULL;
+  QuicLibShapedBuffer *sb;
 
-  priv->loop_context = g_main_context_new ();
-  priv->loop = g_main_loop_new (priv->loop_context, FALSE);
-  priv->loop_thread = g_thread_new ("quiclib-transport",
-      quiclib_transport_context_loop_thread, priv);
+  if (priv->loop_context == NULL) {
+    return FALSE;
+  }
 
-  priv->async_notif_loop_context = g_main_context_new ();
-  priv->async_notif_loop = g_main_loop_new (priv->async_notif_loop_context,
-      FALSE);
-  priv->async_notif_thread = g_thread_new ("quiclib-async",
-      quiclib_transport_async_notif_context_loop_thread, priv);
+  if (meta != NULL && meta->rate_limit > 0) {
+    quiclib_token_bucket_configure (&stream->shaper, meta->rate_limit,
+        meta->rate_burst, now);
+  }
 
-  /*
-   * So this takes a GSourceFunc argument, which carries a single argument, but
-   * socket_source_dispatch actually calls a function pointer with three args?
-   *
-   * What the hell guys?
-   */
-  g_source_set_callback (source, (GSourceFunc) quiclib_data_received,
-      socket_ctx, NULL);
+  quiclib_shaper_sync (conn, now);
+  quiclib_token_bucket_fill (&stream->shaper, now);
+
+  if (g_queue_is_empty (&stream->shaped)) {
+    if (conn->shaper.rate == 0 && stream->shaper.rate == 0 && !egress) {
+      return FALSE;
+    }
 
-  g_source_attach (source,
-      gst_quiclib_transport_context_get_loop_context (ctx));
+    if ((conn->shaper.rate == 0 || conn->shaped_streams == NULL) &&
+        quiclib_token_bucket_allowance (&conn->shaper) >= (gint64) size &&
+        quiclib_token_bucket_allowance (&stream->shaper) >= (gint64) size &&
+        quiclib_egress_try_consume (conn, size, now)) {
+      quiclib_token_bucket_consume (&conn->shaper, size);
+      quiclib_token_bucket_consume (&stream->shaper, size);
+      return FALSE;
+    }
 
-  GST_DEBUG_OBJECT (ctx,
-      "Opened %s socket %p with %s address %s, source %p, ctx %p",
-      QUICLIB_SERVER (ctx)?"server":"client", socket_ctx->socket,
-          QUICLIB_SERVER (ctx)?"local":"peer", debug_addr,
-              socket_ctx->source, socket_ctx);
+    gint64 *id = quiclib_slab_alloc (&conn->id_slab);
 
-  g_free (debug_addr);
-  if (local != addr) {
-    g_object_unref (local);
+    *id = stream_id;
+    conn->shaped_streams = g_list_append (conn->shaped_streams, id);
   }
 
-  return socket_ctx;
+  sb = g_new (QuicLibShapedBuffer, 1);
+  sb->buf = gst_buffer_ref (buf);
+  sb->queued_at = now;
+  g_queue_push_tail (&stream->shaped, sb);
+  stream->shaped_bytes += size;
+  quiclib_mem_charge (&conn->memory->shaped, (gssize) size);
 
-  no_source_ctx:
-  if (local != addr) {
-    g_object_unref (local);
-  }
-  g_source_unref (source);
-  no_bind:
-  g_socket_close (socket, NULL);
-  no_socket:
-  g_error_free (err);
-  g_free (debug_addr);
-  return NULL;
-}
+  GST_LOG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      "Holding back %lu bytes on stream %ld, %lu bytes now held back", size,
+      stream_id, stream->shaped_bytes);
 
-void
-quiclib_open_server_socket_foreach (gpointer data, gpointer user_data)
-{
-  GstQuicLibServerContext *ctx = GST_QUICLIB_SERVER_CONTEXT (user_data);
-  QuicLibSocketContext *socket = quiclib_open_socket (
-      GST_QUICLIB_TRANSPORT_CONTEXT (ctx), (GSocketAddress *) data);
+  quiclib_shaper_kick (conn, 0);
 
-  ctx->sockets = g_slist_prepend (ctx->sockets, socket);
+  return TRUE;
 }
 
 /**
- * gst_quiclib_transport_server_new
- * 
- * Create a new QuicLib server instance with default settings. This function
- * creates a new GstQuicLibServerContext object, but DOES NOT start the source
- * listener for packets, allowing you to configure the server object further
- * as necessary using it's attributes.
- * 
- * @user: The callback target.
- * @pkey_location: Path to the PEM/PK12 private key for the server to use.
- * @cert_location: Path to the PEM certificate for the server to present to
- *    clients.
- * @sni: The server name information (SNI) value to present as part of the TLS
- *    handshake.
- * @app_ctx: Opaque application context passed back in callbacks. 
- * @return GstQuicLibServerContext* 
+ * quiclib_shaper_release_stream
+ *
+ * Sends the next chunk held back on @stream_id if the token buckets and the
+ * flow and congestion windows allow it, adding its size to @sent. If the
+ * buckets don't, @wait is set to how long until they will. Returns
+ * QUICLIB_SHAPER_DONE once the queue is empty or the stream has gone. Call
+ * with the context lock held on the loop thread.
+ *
+ * INTERNAL FUNCTION ONLY.
  */
-GstQuicLibServerContext *
-gst_quiclib_transport_server_new (GstQuicLibTransportUser *user,
-    const gchar *pkey_location, const gchar *cert_location, const gchar *sni,
-    gpointer app_ctx)
+static QuicLibShaperResult
+quiclib_shaper_release_stream (GstQuicLibTransportConnection *conn,
+    gint64 stream_id, ngtcp2_tstamp now, guint64 *wait, gsize *sent)
 {
-  int rv;
-  GstQuicLibServerContext *server =
-      g_object_new (GST_TYPE_QUICLIB_SERVER_CONTEXT, "user", user, "app_ctx",
-          app_ctx, PROP_PRIVKEY_LOCATION_SHORTNAME, pkey_location,
-          PROP_CERT_LOCATION_SHORTNAME, cert_location,
-          PROP_SNI_SHORTNAME, sni, NULL);
-  if (server == NULL) return NULL;
+  GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (
+          GST_QUICLIB_TRANSPORT_CONTEXT (conn));
+  GstQuicLibStreamContext *stream;
+  QuicLibShapedBuffer *sb;
+  GstQuicLibStreamMeta *meta;
+  GstQuicLibError err;
+  GstBuffer *chunk;
+  QuicLibTokenBucket egress;
+  ngtcp2_vec *vec = NULL;
+  QuicLibUnmap *maps = NULL;
+  size_t n = 0;
+  gsize size, need, chunk_size;
+  guint64 window;
+  gint64 allowance;
+  ssize_t written = 0;
 
-  server->ssl_ctx = SSL_CTX_new (TLS_server_method ());
-  if (server->ssl_ctx == NULL) {
-    GST_ERROR_OBJECT (QUICLIB_PARENT (server),
-        "Failed to allocate new server SSL context: %s",
-        ERR_error_string (ERR_get_error (), NULL));
-    goto error;
+  if (!g_hash_table_lookup_extended (conn->streams, &stream_id, NULL,
+      (gpointer *) &stream)) {
+    return QUICLIB_SHAPER_DONE;
   }
 
-#ifdef OPENSSL_DEBUG
-  SSL_CTX_set_msg_callback (server->ssl_ctx, quiclib_openssl_dbg_cb);
-  SSL_CTX_set_msg_callback_arg (server->ssl_ctx, (void *) server);
-#endif
+  if (g_queue_is_empty (&stream->shaped)) {
+    return QUICLIB_SHAPER_DONE;
+  }
 
-  rv = ngtcp2_crypto_quictls_configure_server_context (server->ssl_ctx);
-  if (rv != 0) {
-    GST_ERROR_OBJECT (QUICLIB_PARENT (server),
-        "Failed to configure ngtcp2/openssl server ctx");
-    goto error;
+  quiclib_token_bucket_fill (&stream->shaper, now);
+  quiclib_egress_snapshot (conn, now, &egress);
+
+  sb = (QuicLibShapedBuffer *) g_queue_peek_head (&stream->shaped);
+  size = gst_buffer_get_size (sb->buf);
+
+  /* Don't dribble out chunks much smaller than a packet */
+  need = MIN (size, QUICLIB_SHAPER_MIN_CHUNK);
+  if (conn->shaper.rate > 0) {
+    need = MIN (need, (gsize) quiclib_token_bucket_depth (&conn->shaper));
+  }
+  if (stream->shaper.rate > 0) {
+    need = MIN (need, (gsize) quiclib_token_bucket_depth (&stream->shaper));
+  }
+  if (egress.rate > 0) {
+    need = MIN (need, (gsize) quiclib_token_bucket_depth (&egress));
   }
 
-  SSL_CTX_set_max_early_data (server->ssl_ctx, UINT32_MAX);
-  SSL_CTX_set_options (server->ssl_ctx, SSL_OP_SINGLE_ECDH_USE |
-      SSL_OP_CIPHER_SERVER_PREFERENCE | SSL_OP_NO_ANTI_REPLAY);
-  SSL_CTX_set_mode (server->ssl_ctx, SSL_MODE_RELEASE_BUFFERS);
-  SSL_CTX_set_alpn_select_cb (server->ssl_ctx,
-      quiclib_ssl_select_proto_cb, (void *) server);
-  SSL_CTX_set_default_verify_paths (server->ssl_ctx);
+  allowance = MIN (quiclib_token_bucket_allowance (&conn->shaper),
+      MIN (quiclib_token_bucket_allowance (&stream->shaper),
+          quiclib_token_bucket_allowance (&egress)));
+  if (allowance < (gint64) need) {
+    *wait = MAX (quiclib_token_bucket_wait (&conn->shaper, need),
+        MAX (quiclib_token_bucket_wait (&stream->shaper, need),
+            quiclib_token_bucket_wait (&egress, need)));
+    return QUICLIB_SHAPER_WAIT;
+  }
 
-  if (SSL_CTX_use_certificate_chain_file (server->ssl_ctx,
-      server->cert_file_location) != 1) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (server),
-        "SSL_CTX_user_certificate_chain_file failed to load certificate file "
-        "%s, %s", server->cert_file_location, ERR_error_string (
-            ERR_get_error (), NULL));
-    goto error;
+  window = MIN (ngtcp2_conn_get_cwnd_left (conn->quic_conn),
+      MIN (ngtcp2_conn_get_max_stream_data_left (conn->quic_conn, stream_id),
+          ngtcp2_conn_get_max_data_left (conn->quic_conn)));
+  chunk_size = (gsize) MIN ((guint64) size,
+      MIN ((guint64) allowance, window));
+  if (size > 0 && chunk_size == 0) {
+    return QUICLIB_SHAPER_BLOCKED;
   }
 
-  if (strstr (server->priv_key_location, ".pkcs8")) {
-    EVP_PKEY *pkey = NULL;
-    FILE *fp = fopen (server->priv_key_location, "r");
-    if (!fp) {
-      GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (server),
-          "Opening private key from %s failed: %s", server->priv_key_location,
-          strerror (errno));
-      goto error;
-    }
-    pkey = d2i_PrivateKey_fp (fp, NULL);
-    fclose (fp);
-    if (!pkey) {
-      GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (server),
-          "Reading private key from %s failed", server->priv_key_location);
-      goto error;
-    }
-    if (!SSL_CTX_use_PrivateKey (server->ssl_ctx, pkey)) {
-      GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (server),
-          "SSL_CTX_use_PrivateKey failed: %s",
-          ERR_error_string (ERR_get_error (), NULL));
-      goto error;
+  if (chunk_size < size) {
+    chunk = gst_buffer_copy_region (sb->buf,
+        GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS |
+        GST_BUFFER_COPY_META | GST_BUFFER_COPY_MEMORY, 0, chunk_size);
+    meta = gst_buffer_get_quiclib_stream_meta (chunk);
+    if (meta != NULL) {
+      meta->final = FALSE;
     }
-  } else if (SSL_CTX_use_PrivateKey_file (server->ssl_ctx,
-      server->priv_key_location, SSL_FILETYPE_PEM) != 1) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (server),
-        "SSL_CTX_use_PrivateKey_file for %s failed: %s",
-        server->priv_key_location, ERR_error_string (ERR_get_error (), NULL));
-    goto error;
+  } else {
+    chunk = gst_buffer_ref (sb->buf);
   }
 
-  return server;
+  if (chunk_size > 0) {
+    n = quiclib_buffer_to_vec (conn, chunk, &vec, &maps);
+  }
 
-error:
-  if (server->ssl_ctx) {
-    SSL_CTX_free (server->ssl_ctx);
+  err = quiclib_transport_write_stream_vec (conn, chunk, stream_id, vec, n,
+      FALSE, &written);
+
+  quiclib_buffer_unmap (&maps);
+  g_free (vec);
+  gst_buffer_unref (chunk);
+
+  if (err == GST_QUICLIB_ERR_CONN_DATA_BLOCKED) {
+    return QUICLIB_SHAPER_BLOCKED;
   }
-  g_object_unref (server);
-  server = NULL;
-  return NULL;
+
+  if (err != GST_QUICLIB_ERR_OK) {
+    GST_WARNING_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Couldn't send %lu bytes held back on stream %ld: %s", chunk_size,
+        stream_id, gst_quiclib_error_as_string (err));
+    quiclib_shaper_drop_stream (stream);
+    return QUICLIB_SHAPER_DONE;
+  }
+
+  quiclib_token_bucket_consume (&conn->shaper, chunk_size);
+  quiclib_token_bucket_consume (&stream->shaper, chunk_size);
+  quiclib_egress_consume (conn, chunk_size);
+  stream->shaped_bytes -= chunk_size;
+  quiclib_mem_charge (&conn->memory->shaped, -(gssize) chunk_size);
+  *sent += chunk_size;
+
+  if (chunk_size < size) {
+    GstBuffer *rest = gst_buffer_copy_region (sb->buf,
+        GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS |
+        GST_BUFFER_COPY_META | GST_BUFFER_COPY_MEMORY, chunk_size,
+        size - chunk_size);
+
+    gst_buffer_unref (sb->buf);
+    sb->buf = rest;
+
+    return QUICLIB_SHAPER_SENT;
+  }
+
+  g_queue_pop_head (&stream->shaped);
+
+  if (priv->enable_stats) {
+    g_mutex_lock (&conn->stats.mutex);
+    _quiclib_latency_histogram_add (&conn->stats.shaping_delay,
+        now - sb->queued_at);
+    g_mutex_unlock (&conn->stats.mutex);
+  }
+
+  quiclib_shaped_buffer_free (sb);
+
+  if (!g_queue_is_empty (&stream->shaped)) {
+    return QUICLIB_SHAPER_SENT;
+  }
+
+  if (stream->shaped_close) {
+    stream->shaped_close = FALSE;
+    gst_quiclib_transport_close_stream (conn, (guint64) stream_id, 0);
+  }
+
+  return QUICLIB_SHAPER_DONE;
 }
 
 /**
- * gst_quiclib_transport_server_listen
- * 
- * Start a QUIC transport server.
- * 
- * Attempting to start a QUIC transport server that's already started may lead
- * to undefined behaviour!
- * 
- * @server: The server to start listening.
+ * quiclib_shaper_drop_all
+ *
+ * Drops the buffers held back on all of @conn's streams. Call with the context
+ * lock held.
+ *
+ * INTERNAL FUNCTION ONLY.
  */
-gboolean
-gst_quiclib_transport_server_listen (GstQuicLibServerContext *server)
+static void
+quiclib_shaper_drop_all (GstQuicLibTransportConnection *conn)
 {
-  gchar *location = NULL;
-  GUri *uri = NULL;
-  GSocketAddress *sa = NULL;
-  QuicLibSocketContext *socket;
-  gboolean rv = FALSE;
-
-  /* TODO: Support multiple listening addresses again */
-  /*g_slist_foreach (listen_addrs, quiclib_open_server_socket_foreach, server);*/
+  GList *it;
 
-  g_object_get (GST_QUICLIB_TRANSPORT_CONTEXT (server),
-      PROP_LOCATION_SHORT, &location, NULL);
+  for (it = conn->shaped_streams; it != NULL; it = it->next) {
+    GstQuicLibStreamContext *stream;
 
-  g_assert (location);
-  uri = gst_quiclib_parse_location (location);
-  if (!uri) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (server),
-        "Couldn't parse location \"%s\"", location);
-    goto error;
+    if (g_hash_table_lookup_extended (conn->streams, it->data, NULL,
+        (gpointer *) &stream)) {
+      quiclib_shaper_drop_stream (stream);
+    }
+    quiclib_slab_free (&conn->id_slab, it->data);
   }
+  g_list_free (conn->shaped_streams);
+  conn->shaped_streams = NULL;
+}
 
-  sa = G_SOCKET_ADDRESS (gst_quiclib_resolve (uri));
-  if (!sa) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (server),
-        "Couldn't resolve location \"%s\"", location);
-    goto error;
+/**
+ * quiclib_shaper_release_conn
+ *
+ * Sends one chunk held back on @conn, from the first of its streams that can
+ * go, which then moves to the back of the line. The size of the chunk is added
+ * to @sent. Returns QUICLIB_SHAPER_SENT if a chunk went and more are held
+ * back, QUICLIB_SHAPER_DONE once nothing is held back, or otherwise
+ * QUICLIB_SHAPER_BLOCKED if a stream is stuck on the flow or congestion
+ * windows or QUICLIB_SHAPER_WAIT with @wait set to how long until the token
+ * buckets let a chunk through. Anything held back is dropped if @conn is no
+ * longer open. Call with the context lock held on the loop thread.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static QuicLibShaperResult
+quiclib_shaper_release_conn (GstQuicLibTransportConnection *conn,
+    ngtcp2_tstamp now, guint64 *wait, gsize *sent)
+{
+  gboolean blocked = FALSE;
+  GList *it, *next;
+
+  *wait = G_MAXUINT64;
+
+  if (gst_quiclib_transport_get_state (GST_QUICLIB_TRANSPORT_CONTEXT (conn))
+      != QUIC_STATE_OPEN) {
+    quiclib_shaper_drop_all (conn);
+    return QUICLIB_SHAPER_DONE;
   }
 
-  socket = quiclib_open_socket (GST_QUICLIB_TRANSPORT_CONTEXT (server),
-      (GSocketAddress *) sa);
+  quiclib_shaper_sync (conn, now);
 
-  server->sockets = g_slist_prepend (server->sockets, socket);
-  gst_quiclib_transport_context_set_state (
-      GST_QUICLIB_TRANSPORT_CONTEXT (server), QUIC_STATE_LISTENING);
+  for (it = conn->shaped_streams; it != NULL; it = next) {
+    guint64 stream_wait = 0;
+    gsize before = *sent;
 
-  rv = TRUE;
+    next = it->next;
 
-error:
-  if (sa) g_object_unref (sa);
-  if (uri) g_uri_unref (uri);
-  if (location) g_free (location);
+    switch (quiclib_shaper_release_stream (conn, *(gint64 *) it->data, now,
+        &stream_wait, sent)) {
+      case QUICLIB_SHAPER_SENT:
+        conn->shaped_streams = g_list_remove_link (conn->shaped_streams, it);
+        conn->shaped_streams = g_list_concat (conn->shaped_streams, it);
+        return QUICLIB_SHAPER_SENT;
+      case QUICLIB_SHAPER_WAIT:
+        *wait = MIN (*wait, stream_wait);
+        break;
+      case QUICLIB_SHAPER_BLOCKED:
+        blocked = TRUE;
+        break;
+      case QUICLIB_SHAPER_DONE:
+        quiclib_slab_free (&conn->id_slab, it->data);
+        conn->shaped_streams = g_list_delete_link (conn->shaped_streams, it);
+        if (*sent > before) {
+          return (conn->shaped_streams != NULL) ? QUICLIB_SHAPER_SENT :
+              QUICLIB_SHAPER_DONE;
+        }
+        break;
+    }
+  }
 
-  return rv;
+  if (conn->shaped_streams == NULL) {
+    return QUICLIB_SHAPER_DONE;
+  }
+
+  return blocked ? QUICLIB_SHAPER_BLOCKED : QUICLIB_SHAPER_WAIT;
 }
 
 /**
- * gst_quiclib_transport_client_new
- * 
- * Create a new QuicLib client instance with default settings. This function
- * creates a new GstQuicLibTransportConnection object, but DOES NOT start the
- * source listener for packets nor send the INITIAL message, allowing you to
- * configure the server object further as necessary using it's attributes.
- * 
- * @user: The callback target.
- * @app_ctx: Opaque application context passed back in callbacks.
- * @return GstQuicLibServerContext* 
+ * quiclib_shaper_release
+ *
+ * Callback run on the loop thread to send what it can of the buffers held back
+ * on @conn's streams, taking each stream in turn. Reschedules itself for when
+ * the next chunk can go if any are left.
+ *
+ * INTERNAL FUNCTION ONLY.
  */
-GstQuicLibTransportConnection *
-gst_quiclib_transport_client_new (GstQuicLibTransportUser *user,
-    gpointer app_ctx)
+static gboolean
+quiclib_shaper_release (gpointer user_data)
 {
-  gint rv;
   GstQuicLibTransportConnection *conn =
-      g_object_new (GST_TYPE_QUICLIB_TRANSPORT_CONNECTION, NULL);
-  if (conn == NULL) return NULL;
-
-  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-      "New connection context: %p", conn);
+      (GstQuicLibTransportConnection *) user_data;
+  ngtcp2_tstamp now;
+  QuicLibShaperResult res;
+  guint64 wait;
+  gsize sent = 0;
 
-  gst_quiclib_transport_context_set_user (
-      GST_QUICLIB_TRANSPORT_CONTEXT (conn), user);
-  gst_quiclib_transport_context_set_app_ctx (
-      GST_QUICLIB_TRANSPORT_CONTEXT (conn), app_ctx);
+  gst_quiclib_transport_context_lock (conn);
 
-  conn->ssl_ctx = SSL_CTX_new (TLS_client_method ());
-  if (conn->ssl_ctx == NULL) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Failed to allocate new client SSL context: %s",
-        ERR_error_string (ERR_get_error (), NULL));
-    goto free_conn;
-  }
+  conn->shaper_scheduled = FALSE;
 
-#ifdef OPENSSL_DEBUG
-  SSL_CTX_set_msg_callback (conn->ssl_ctx, quiclib_openssl_dbg_cb);
-  SSL_CTX_set_msg_callback_arg (conn->ssl_ctx, conn);
-#endif
+  now = quiclib_ngtcp2_timestamp ();
+  do {
+    res = quiclib_shaper_release_conn (conn, now, &wait, &sent);
+  } while (res == QUICLIB_SHAPER_SENT);
 
-  rv = ngtcp2_crypto_quictls_configure_client_context (conn->ssl_ctx);
-  if (rv != 0) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Failed to configure the client SSL context");
-    goto free_ssl_ctx;
-  } 
+  if (conn->shaped_streams != NULL) {
+    if (res == QUICLIB_SHAPER_BLOCKED || wait == G_MAXUINT64) {
+      wait = MIN (wait, QUICLIB_SHAPER_BLOCKED_RETRY);
+    }
+    quiclib_shaper_kick (conn, wait);
+  }
 
-  return conn;
+  gst_quiclib_transport_context_unlock (conn);
 
-free_ssl_ctx:
-  SSL_CTX_free (conn->ssl_ctx);
-free_conn:
-  g_object_unref (conn);
-  return NULL;
+  return G_SOURCE_REMOVE;
 }
 
 /**
- * gst_quiclib_transport_client_connect
- * 
- * Start the client connection and send the INITIAL packet.
- * 
- * @conn: The connection to start
- * @return TRUE if connection was started and INITIAL packet sent. Wait for
- *    handshake_complete callback before attempting to use the connection!
+ * quiclib_egress_release
+ *
+ * Callback run on @server's loop thread to send what its egress token bucket
+ * allows of the data held back on the connections in its egress backlog. Each
+ * chunk goes from the connection with the lowest virtual finish time that can
+ * send, whose finish time then moves on by the size of the chunk over its
+ * weight. Connections with nothing left are taken off the backlog, and a
+ * release is rescheduled for when the next chunk can go if any are left.
+ *
+ * INTERNAL FUNCTION ONLY.
  */
-gboolean
-gst_quiclib_transport_client_connect (GstQuicLibTransportConnection *conn)
+static gboolean
+quiclib_egress_release (gpointer user_data)
 {
-  gint rv;
-  GSocketAddress *sa;
-  ngtcp2_cid *dcid = NULL, *scid = NULL;
-  gchar dcid_str[CID_STR_LEN], scid_str[CID_STR_LEN];
-  GError *err = NULL;
-  gchar *location;
-  GUri *uri;
-  struct sockaddr *localsa, *remotesa;
-  gsize localsa_size, remotesa_size;
-  gchar *debug_local_addr, *debug_remote_addr;
-  gboolean enable_datagram;
-
-  g_object_get (G_OBJECT (conn), PROP_LOCATION_SHORT, &location, NULL);
-  g_assert (location != NULL);
-  uri = gst_quiclib_parse_location (location);
-  if (uri == NULL) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Couldn't parse location \"%s\"", location);
-    goto free_location;
-  }
+  GstQuicLibServerContext *server = (GstQuicLibServerContext *) user_data;
+  GList *skipped = NULL, *unrefs = NULL;
+  guint64 wait = G_MAXUINT64;
+  gboolean blocked = FALSE;
+
+  g_mutex_lock (&server->egress_mutex);
+
+  server->egress_scheduled = FALSE;
+
+  for (;;) {
+    GstQuicLibTransportConnection *conn = NULL;
+    ngtcp2_tstamp now = quiclib_ngtcp2_timestamp ();
+    QuicLibShaperResult res;
+    guint64 conn_wait;
+    gsize sent = 0;
+    gboolean backlogged;
+    GList *it;
+
+    quiclib_egress_sync (server, now);
+    if (quiclib_token_bucket_allowance (&server->egress) <= 0) {
+      wait = MIN (wait, quiclib_token_bucket_wait (&server->egress,
+          QUICLIB_SHAPER_MIN_CHUNK));
+      break;
+    }
 
-  sa = G_SOCKET_ADDRESS (gst_quiclib_resolve (uri));
+    for (it = server->egress_backlog; it != NULL; it = it->next) {
+      GstQuicLibTransportConnection *c =
+          (GstQuicLibTransportConnection *) it->data;
 
-  if (sa == NULL) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Couldn't resolve location \"%s\"", location);
-    goto free_location;
-  }
+      if (g_list_find (skipped, c) == NULL &&
+          (conn == NULL || c->egress_vtime < conn->egress_vtime)) {
+        conn = c;
+      }
+    }
 
-  conn->socket = quiclib_open_socket (GST_QUICLIB_TRANSPORT_CONTEXT (conn), sa);
+    if (conn == NULL) {
+      break;
+    }
 
-  debug_remote_addr =
-      g_socket_connectable_to_string (G_SOCKET_CONNECTABLE (sa));
+    /*
+     * The connection's context lock must be taken before the egress_mutex, so
+     * drop it while the connection sends.
+     */
+    unrefs = g_list_prepend (unrefs, g_object_ref (conn));
+    g_mutex_unlock (&server->egress_mutex);
 
-  debug_local_addr =
-      g_socket_connectable_to_string (G_SOCKET_CONNECTABLE (
-          g_socket_get_local_address (conn->socket->socket, &err)));
+    gst_quiclib_transport_context_lock (conn);
+    res = quiclib_shaper_release_conn (conn, now, &conn_wait, &sent);
+    backlogged = conn->shaped_streams != NULL;
+    g_mutex_lock (&server->egress_mutex);
+    gst_quiclib_transport_context_unlock (conn);
 
-  localsa_size = g_socket_address_get_native_size (
-      g_socket_get_local_address (conn->socket->socket, &err));
-  remotesa_size = g_socket_address_get_native_size (sa);
-  localsa = (struct sockaddr *) g_malloc (localsa_size);
-  remotesa = (struct sockaddr *) g_malloc (remotesa_size);
-  if (g_socket_address_to_native (
-      g_socket_get_local_address (conn->socket->socket, NULL), localsa,
-      localsa_size, &err) == FALSE) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Failed to convert local socket address %s to native sockaddr: %s",
-        debug_local_addr, err->message);
-    goto free_sa;
+    if (sent > 0) {
+      server->egress_vtime = MAX (server->egress_vtime, conn->egress_vtime);
+      conn->egress_vtime += gst_util_uint64_scale (sent,
+          QUICLIB_EGRESS_WEIGHT_MAX, conn->egress_weight);
+    }
+
+    if (!backlogged) {
+      server->egress_backlog = g_list_remove (server->egress_backlog, conn);
+      conn->egress_backlogged = FALSE;
+      unrefs = g_list_prepend (unrefs, conn);
+    } else if (res == QUICLIB_SHAPER_WAIT) {
+      skipped = g_list_prepend (skipped, conn);
+      wait = MIN (wait, conn_wait);
+    } else if (res == QUICLIB_SHAPER_BLOCKED) {
+      skipped = g_list_prepend (skipped, conn);
+      blocked = TRUE;
+    }
   }
 
-  if (g_socket_address_to_native (sa, remotesa, remotesa_size, &err) == FALSE) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Failed to convert remote socket address %s to native sockaddr: %s",
-        g_socket_connectable_to_string (G_SOCKET_CONNECTABLE (sa)),
-        err->message);
-    goto free_sa;
+  if (server->egress_backlog != NULL) {
+    if (blocked || wait == G_MAXUINT64) {
+      wait = MIN (wait, QUICLIB_SHAPER_BLOCKED_RETRY);
+    }
+    quiclib_egress_schedule (server, wait);
   }
 
-  ngtcp2_path_storage_init (&conn->path, localsa, localsa_size, remotesa,
-      remotesa_size, (void *) conn);
+  g_mutex_unlock (&server->egress_mutex);
 
-  dcid = g_malloc (sizeof (ngtcp2_cid));
-  scid = g_malloc (sizeof (ngtcp2_cid));
-  if (dcid == NULL || scid == NULL) {
-    goto remove_listener;
-  }
+  g_list_free (skipped);
+  g_list_free_full (unrefs, g_object_unref);
 
-  if (quiclib_ngtcp2_get_new_connection_id (NULL, dcid, NULL,
-      NGTCP2_MIN_INITIAL_DCIDLEN, (void *) conn) < 0) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Failed to generate initial DCID");
-    goto remove_listener;
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * quiclib_shaper_charge
+ *
+ * Takes the tokens for @bytes of DATAGRAM frames sent on @conn from its token
+ * bucket, and from its server's egress token bucket.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_shaper_charge (GstQuicLibTransportConnection *conn, gsize bytes)
+{
+  gst_quiclib_transport_context_lock (conn);
+  quiclib_shaper_sync (conn, quiclib_ngtcp2_timestamp ());
+  quiclib_token_bucket_consume (&conn->shaper, bytes);
+  quiclib_egress_consume (conn, bytes);
+  gst_quiclib_transport_context_unlock (conn);
+}
+
+/**
+ * gst_quiclib_transport_stream_set_rate_limit
+ *
+ * Shapes the data sent on @stream_id to a token bucket, on top of the
+ * connection's "rate-limit" property. Data over the limit is held back and
+ * sent as the tokens accrue, rather than blocking the sender.
+ *
+ * @conn: The connection that @stream_id belongs to.
+ * @stream_id: The stream to shape.
+ * @rate: The rate in bits/second, or 0 to remove the stream's limit.
+ * @burst: The depth of the bucket in bytes, or 0 for 100ms worth of @rate.
+ * @return TRUE if the stream was found, otherwise FALSE.
+ */
+gboolean
+gst_quiclib_transport_stream_set_rate_limit (
+    GstQuicLibTransportConnection *conn, guint64 stream_id, guint64 rate,
+    guint64 burst)
+{
+  GstQuicLibStreamContext *stream;
+  gboolean rv = FALSE;
+
+  gst_quiclib_transport_context_lock (conn);
+
+  if (g_hash_table_lookup_extended (conn->streams, &stream_id, NULL,
+      (gpointer *) &stream)) {
+    quiclib_token_bucket_configure (&stream->shaper, rate, burst,
+        quiclib_ngtcp2_timestamp ());
+    if (!g_queue_is_empty (&stream->shaped)) {
+      quiclib_shaper_kick (conn, 0);
+    }
+    rv = TRUE;
   }
 
-  if (quiclib_ngtcp2_get_new_connection_id (NULL, scid, NULL, 8,
-      (void *) conn) < 0) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Failed to generate initial SCID");
-    goto remove_listener;
+  gst_quiclib_transport_context_unlock (conn);
+
+  return rv;
+}
+
+/**
+ * gst_quiclib_transport_connection_set_egress_weight
+ *
+ * Sets @conn's share of its server's "egress-rate-limit" relative to the
+ * server's other connections. While the cap is reached, the connections with
+ * data waiting get bandwidth in proportion to their weights, so one with a
+ * weight of 4 gets four times the share of one with a weight of 1. Has no
+ * effect without an egress-rate-limit.
+ *
+ * @conn: The server connection to set the weight of.
+ * @weight: The weight, from 1 to QUICLIB_EGRESS_WEIGHT_MAX. Connections start
+ *    with QUICLIB_EGRESS_WEIGHT_DEFAULT.
+ * @return TRUE if the weight was set, or FALSE if @weight is out of range.
+ */
+gboolean
+gst_quiclib_transport_connection_set_egress_weight (
+    GstQuicLibTransportConnection *conn, guint weight)
+{
+  if (weight == 0 || weight > QUICLIB_EGRESS_WEIGHT_MAX) {
+    return FALSE;
   }
 
-  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-      "Opening connection with QUIC peer %s with local address %s",
-      debug_remote_addr, debug_local_addr);
+  if (conn->server == NULL) {
+    conn->egress_weight = weight;
+    return TRUE;
+  }
 
-  ngtcp2_settings_default (&conn->conn_settings);
+  g_mutex_lock (&conn->server->egress_mutex);
+  conn->egress_weight = weight;
+  g_mutex_unlock (&conn->server->egress_mutex);
 
-  conn->conn_settings.initial_ts = quiclib_ngtcp2_timestamp ();
-  conn->conn_settings.log_printf = quiclib_ngtcp2_print;
+  return TRUE;
+}
 
-  quiclib_cidtostr (dcid, dcid_str);
-  quiclib_cidtostr (scid, scid_str);
+gboolean
+gst_quiclib_transport_close_stream (GstQuicLibTransportConnection *conn,
+    guint64 stream_id, guint64 error_code)
+{
+  GstQuicLibStreamContext *stream;
+  int rv = -1;
 
   /*
-   * Retrieve the transport params from the base class
+   * A graceful close waits for anything held back by shaping to be sent, and
+   * is finished off when the shaping queue drains.
    */
-  g_object_get (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-      PROP_MAX_STREAM_DATA_BIDI_REMOTE_SHORTNAME,
-        &conn->transport_params.initial_max_stream_data_bidi_local,
-      PROP_MAX_STREAM_DATA_UNI_REMOTE_SHORTNAME,
-        &conn->transport_params.initial_max_stream_data_uni,
-      PROP_MAX_DATA_REMOTE_SHORTNAME,
-        &conn->transport_params.initial_max_data,
-      PROP_MAX_STREAMS_BIDI_REMOTE_SHORTNAME,
-        &conn->transport_params.initial_max_streams_bidi,
-      PROP_MAX_STREAMS_UNI_REMOTE_SHORTNAME,
-        &conn->transport_params.initial_max_streams_uni,
-      PROP_ENABLE_DATAGRAM_SHORTNAME, &enable_datagram,
-      NULL);
+  gst_quiclib_transport_context_lock (conn);
+  if (g_hash_table_lookup_extended (conn->streams, &stream_id, NULL,
+      (gpointer *) &stream) && !g_queue_is_empty (&stream->shaped)) {
+    if (error_code == 0) {
+      stream->shaped_close = TRUE;
+      gst_quiclib_transport_context_unlock (conn);
+      return TRUE;
+    }
 
-  conn->transport_params.initial_max_stream_data_bidi_remote =
-      conn->transport_params.initial_max_stream_data_bidi_local;
+    quiclib_shaper_drop_stream (stream);
+  }
+  gst_quiclib_transport_context_unlock (conn);
 
-  if (enable_datagram) {
-    /*
-     * RFC 9221, section 3:
-     *
-     * For most uses of DATAGRAM frames, it is RECOMMENDED to send a value of
-     * 65535 in the max_datagram_frame_size transport parameter to indicate that
-     * this endpoint will accept any DATAGRAM frame that fits inside a QUIC
-     * packet.
-     */
-    conn->transport_params.max_datagram_frame_size = 65535;
+  if (QUICLIB_STREAM_IS_UNI (stream_id) || error_code) {
+    gst_quiclib_transport_context_lock (conn);
+    rv = ngtcp2_conn_shutdown_stream (conn->quic_conn, 0, (gint64) stream_id,
+        error_code);
+    gst_quiclib_transport_context_unlock (conn);
+  } else {
+    rv = (int) quiclib_ngtcp2_conn_write (conn, stream_id, NULL, 0, 1);
   }
 
-  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-      "Opening connection with QUIC peer %s with local address %s, DCID %s"
-      "and SCID %s", debug_remote_addr, debug_local_addr, dcid_str, scid_str);
+  return (rv == 0)?(TRUE):(FALSE);
+}
 
-  quiclib_print_ngtcp2_transport_params (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        conn->transport_params);
+/**
+ * gst_quiclib_transport_send_buffer
+ * 
+ * Convenience function that wraps _send_stream and _send_datagram depending on
+ * if the passed in buffer has a GstQuicLibStreamMeta or GstQuicLibDatagramMeta
+ * respectively.
+ * 
+ * @conn: The connection to send the buffer on.
+ * @buf: The buffer to send.
+ * @bytes_written: If non-NULL, returns the number of bytes from @buf that was
+ *    written to the remote peer.
+ * @return GST_QUICLIB_ERR if buffer did not contain a suitable meta, or any 
+ *    other GstQuicLibError on sending failure.
+ */
+GstQuicLibError
+gst_quiclib_transport_send_buffer (GstQuicLibTransportConnection *conn,
+    GstBuffer *buf, ssize_t *bytes_written)
+{
+  GstQuicLibStreamMeta *smeta;
+  GstQuicLibDatagramMeta *dmeta;
 
-  rv = ngtcp2_conn_client_new (&conn->quic_conn, dcid, scid,
-      &conn->path.path, NGTCP2_PROTO_VER_V1, &quiclib_ngtcp2_client_callbacks,
-      &conn->conn_settings, &conn->transport_params, NULL, (void *) conn);
-  if (rv != 0) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "ngtcp2 failed to create new client: %s", ngtcp2_strerror (rv));
-    goto remove_listener;
+  smeta = gst_buffer_get_quiclib_stream_meta (buf);
+  if (smeta != NULL) {
+    return gst_quiclib_transport_send_stream (conn, buf, smeta->stream_id, 
+        bytes_written);
   }
 
-  conn->ssl = SSL_new (conn->ssl_ctx);
-  if (conn->ssl == NULL) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Couldn't create SSL object for connection: %s",
-        ERR_error_string (ERR_get_error (), NULL));
-    goto remove_listener;
+  dmeta = gst_buffer_get_quiclib_datagram_meta (buf);
+  if (dmeta != NULL) {
+    return gst_quiclib_transport_send_datagram (conn, buf, NULL, bytes_written);
   }
 
-#ifdef OPENSSL_DEBUG
-  SSL_set_msg_callback (conn->ssl, quiclib_openssl_dbg_cb);
-  SSL_set_msg_callback_arg (conn->ssl, (void *) conn);
-#endif
+  return GST_QUICLIB_ERR;
+}
 
-  conn->conn_ref.get_conn = quiclib_get_ngtcp2_conn;
-  conn->conn_ref.user_data = (void *) conn;
+gboolean
+_quiclib_transport_store_ack_bufs (GstQuicLibTransportConnection *conn,
+    GstBuffer *buf, GstQuicLibStreamContext *stream, gsize size)
+{
+  GstBuffer *store;
 
-  SSL_set_app_data (conn->ssl, &conn->conn_ref);
-  SSL_set_connect_state (conn->ssl);
-  if (conn->alpn) {
-    guchar alpn_len = (guchar) strlen (conn->alpn);
-    guchar alpn_plf[alpn_len + 1];
-    alpn_plf[0] = alpn_len;
-    memcpy (alpn_plf + 1, conn->alpn, alpn_len);
-    if (SSL_set_alpn_protos (conn->ssl, alpn_plf, alpn_len + 1) != 0) {
-      GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-          "Failed to set client ALPN");
-    }
+  if (gst_buffer_get_size (buf) <= size) {
+    store = gst_buffer_ref (buf);
+  } else {
+    store = gst_buffer_copy_region (buf,
+        GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS |
+        GST_BUFFER_COPY_META | GST_BUFFER_COPY_MEMORY, 0, size);
   }
 
-  SSL_set_tlsext_host_name (conn->ssl, g_uri_get_host (uri));
+  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn), "Storing buffer %"
+      GST_PTR_FORMAT " of size %lu from original %lu with offset %lu", store,
+      size, gst_buffer_get_size (buf), buf->offset);
 
-  SSL_set_quic_transport_version (conn->ssl,
-      TLSEXT_TYPE_quic_transport_parameters);
+  quiclib_mem_charge (&conn->memory->retained,
+      (gssize) gst_buffer_get_size (store));
 
-  ngtcp2_conn_set_tls_native_handle (conn->quic_conn, conn->ssl);
+  g_mutex_lock (&stream->mutex);
+  stream->ack_bufs = g_list_append (stream->ack_bufs, (gpointer) store);
+  g_mutex_unlock (&stream->mutex);
 
-  quiclib_enable_tls_export (GST_QUICLIB_TRANSPORT_CONTEXT (conn), conn->ssl);
+  return stream->ack_bufs != NULL;
+}
+
+/**
+ * quiclib_transport_write_stream_vec
+ *
+ * Writes @buf on @stream_id from @buf_vec, the @n vectors that @buf has
+ * already been mapped to, so that a buffer mapped once can be sent on several
+ * connections. @buf is retained for retransmission and has its offset set to
+ * the stream offset, so it mustn't be shared between connections. This
+ * doesn't apply any rate limits, see quiclib_transport_send_stream_vec.
+ *
+ * If @may_block is FALSE and @conn hasn't the window to send all of @buf,
+ * nothing is sent and GST_QUICLIB_ERR_CONN_DATA_BLOCKED is returned. If the
+ * window still runs out part way through, what was sent is left in
+ * @bytes_written and GST_QUICLIB_ERR_CONN_DATA_BLOCKED is returned rather
+ * than waiting for more.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static GstQuicLibError
+quiclib_transport_write_stream_vec (GstQuicLibTransportConnection *conn,
+    GstBuffer *buf, gint64 stream_id, const ngtcp2_vec *buf_vec, size_t n,
+    gboolean may_block, ssize_t *bytes_written)
+{
+  ssize_t _bytes_written = 0;
+  ngtcp2_vec *vec = NULL, *vec_orig = NULL;
+  GstQuicLibError rv = GST_QUICLIB_ERR_OK;
+  GstQuicLibStreamContext *stream;
+  GstQuicLibStreamMeta *meta = gst_buffer_get_quiclib_stream_meta (buf);
+  gsize buf_size = gst_buffer_get_size (buf);
+  guint64 max_stream_data;
 
-  rv = quiclib_ngtcp2_conn_write (conn, -1, NULL, 0, 0);
-  if (rv != 0) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn), "conn_write failed");
-    ngtcp2_conn_del (conn->quic_conn);
-    SSL_free (conn->ssl);
-    goto remove_listener;
+  if (stream_id < 0 && meta != NULL) {
+    stream_id = meta->stream_id;
   }
 
-  GST_INFO_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-      "Initiated %s connection with remote peer %s", conn->alpn,
-      debug_remote_addr);
+  g_return_val_if_fail (stream_id >= 0, -1);
 
-  gst_quiclib_transport_context_set_state (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-      QUIC_STATE_INITIAL);
+  if (stream_id & 0x2) {
+    max_stream_data = ngtcp2_conn_get_remote_transport_params (conn->quic_conn)
+        ->initial_max_stream_data_uni;
+  } else if ((stream_id & 0x1 && conn->server) ||
+            !(conn->server || stream_id & 0x01)) {
+    max_stream_data = ngtcp2_conn_get_remote_transport_params (conn->quic_conn)
+        ->initial_max_stream_data_bidi_remote;
+  } else {
+    max_stream_data = ngtcp2_conn_get_remote_transport_params (conn->quic_conn)
+        ->initial_max_stream_data_bidi_local;
+  }
 
-  g_free (debug_remote_addr);
-  g_free (debug_local_addr);
+  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      "Received %lu bytes to send on stream %lu with %lu bytes stream data "
+      "remaining of %lu", buf_size, stream_id,
+      ngtcp2_conn_get_max_stream_data_left (conn->quic_conn, stream_id),
+      max_stream_data);
 
-  return TRUE;
+  /*quiclib_transport_print_buffer (GST_QUICLIB_TRANSPORT_CONTEXT (conn), buf);*/
 
-remove_listener:
-  if (dcid != NULL) {
-    g_free (dcid);
+  if (!g_hash_table_lookup_extended (conn->streams, &stream_id, NULL,
+      (gpointer *) &stream)){
+    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Couldn't find stream context for stream %ld", stream_id);
+    return GST_QUICLIB_ERR_STREAM_CLOSED;
   }
-  if (scid != NULL) {
-    g_free (scid);
+
+  if (!may_block && buf_size > 0 &&
+      (ngtcp2_conn_get_cwnd_left (conn->quic_conn) < buf_size ||
+          ngtcp2_conn_get_max_stream_data_left (conn->quic_conn, stream_id)
+              < buf_size ||
+          ngtcp2_conn_get_max_data_left (conn->quic_conn) < buf_size)) {
+    GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Not enough window to send %lu bytes on stream %ld without blocking",
+        buf_size, stream_id);
+    if (bytes_written) *bytes_written = 0;
+    return GST_QUICLIB_ERR_CONN_DATA_BLOCKED;
   }
-  g_source_destroy (conn->socket->source);
-free_sa:
-  g_free (localsa);
-  g_free (remotesa);
-  g_free (debug_remote_addr);
-  g_free (debug_local_addr);
-  g_object_unref (conn->socket->socket);
-  g_free (conn->socket);
-  SSL_CTX_free (conn->ssl_ctx);
-  if (err != NULL) {
-    g_error_free (err);
+
+  buf->offset = stream->last_offset;
+
+  if (meta != NULL && meta->dscp >= 0) {
+    stream->dscp = meta->dscp;
   }
-free_location:
-  if (sa) g_object_unref (sa);
-  if (uri) g_uri_unref (uri);
-  if (location) g_free (location);
-  return FALSE;
-}
 
-GstQUICMode
-gst_quiclib_transport_get_mode (GstQuicLibTransportContext *ctx)
-{
-  if (QUICLIB_SERVER (ctx)) return QUICLIB_MODE_SERVER;
-  if (QUICLIB_CLIENT (ctx)) return QUICLIB_MODE_CLIENT;
-  return -1;
-}
+  if (buf_size > 0) {
+    vec = vec_orig = g_new (ngtcp2_vec, n);
+    memcpy (vec, buf_vec, n * sizeof (ngtcp2_vec));
+  }
 
-GstQuicLibTransportState
-gst_quiclib_transport_get_state (GstQuicLibTransportContext *ctx)
-{
-  GstQuicLibTransportContextPrivate *priv =
-      gst_quiclib_transport_context_get_instance_private (ctx);
-  return priv->state;
-}
+  do {
+    ssize_t _b_written = quiclib_ngtcp2_conn_write (conn, stream_id, vec, n,
+      (meta != NULL) ? meta->final : FALSE);
 
-gpointer
-gst_quiclib_transport_get_app_ctx (GstQuicLibTransportContext *ctx)
-{
-  GstQuicLibTransportContextPrivate *priv =
-      gst_quiclib_transport_context_get_instance_private (ctx);
-  return priv->app_ctx;
-}
+    if (_b_written < 0) {
+      GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+          "quiclib_ngtcp2_conn_write returned error %s",
+          gst_quiclib_error_as_string((GstQuicLibError) _b_written));
+      rv = _b_written;
+      if (_b_written == GST_QUICLIB_ERR_STREAM_CLOSED) {
+        stream = NULL;
+      }
+      break;
+    }
 
-void
-gst_quiclib_transport_set_app_ctx (GstQuicLibTransportContext *ctx,
-    gpointer app_ctx)
-{
-  GstQuicLibTransportContextPrivate *priv =
-      gst_quiclib_transport_context_get_instance_private (ctx);
-  priv->app_ctx = app_ctx;
-}
 
-GSList *
-gst_quiclib_transport_get_listening_addrs (GstQuicLibServerContext *server)
-{
-  GSList *addrs;
-  GSList *sockets = server->sockets;
+    _bytes_written += _b_written;
+    GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Written %ld bytes of data on stream %ld, %ld remaining of %ld - "
+        "cwnd %lu, stream data %lu, max data %lu", _b_written, stream_id,
+        buf_size - _bytes_written, buf_size,
+        ngtcp2_conn_get_cwnd_left (conn->quic_conn),
+        ngtcp2_conn_get_max_stream_data_left (conn->quic_conn, stream_id),
+        ngtcp2_conn_get_max_data_left (conn->quic_conn));
 
-  while (sockets != NULL) {
-    GSocketAddress *sa = g_socket_get_local_address (
-        ((QuicLibSocketContext *) sockets->data)->socket, NULL);
-    addrs = g_slist_prepend (addrs, sa);
-    sockets = sockets->next;
-  }
+    if (_b_written == 0 && !may_block) {
+      GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+          "Window ran out after %ld of %lu bytes on stream %ld, not waiting",
+          _bytes_written, buf_size, stream_id);
+      rv = GST_QUICLIB_ERR_CONN_DATA_BLOCKED;
+      break;
+    }
 
-  return addrs;
-}
+    if (_b_written == 0) {
+      /*
+       * Wait until there's flow window to send again
+       */
+      g_mutex_lock (&conn->mutex);
 
-GSList *
-gst_quiclib_transport_get_acceptable_alpns (GstQuicLibServerContext *server)
-{
-  return server->acceptable_alpns;
-}
+      while (ngtcp2_conn_get_cwnd_left (conn->quic_conn) == 0) {
+        gint64 end_time;
 
-GInetSocketAddress *
-gst_quiclib_transport_get_local (GstQuicLibTransportConnection *conn)
-{
-  return (GInetSocketAddress *) g_socket_address_new_from_native (
-      conn->path.path.local.addr, conn->path.path.local.addrlen);
-}
+        /*
+         * TODO: Is it worth having the end time be configurable? 100ms is very
+         * much a finger-in-the-air value to stop it busy waiting.
+         */
+        end_time = g_get_monotonic_time () + (100 * G_TIME_SPAN_MILLISECOND);
+        GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+            "No congestion window left, waiting until %lu", end_time);
+        g_cond_wait_until (&conn->cond, &conn->mutex, end_time);
+      }
 
-GInetSocketAddress *
-gst_quiclib_transport_get_peer (GstQuicLibTransportConnection *conn)
-{
-  return (GInetSocketAddress *) g_socket_address_new_from_native (
-      conn->path.path.remote.addr, conn->path.path.remote.addrlen);
-}
+      g_mutex_unlock (&conn->mutex);
+    }
+    if (buf_size - _bytes_written > 0) {
+      /* Adjust the vectors as necessary */
 
-gboolean
-quiclib_close_wait (gpointer user_data)
-{
-  gboolean rv = G_SOURCE_CONTINUE;
-  GstQuicLibTransportConnection *conn =
-      (GstQuicLibTransportConnection *) user_data;
+      while (_b_written >= vec[0].len) {
+        _b_written -= vec[0].len;
+        vec += 1; /* Go to the next buffer in the vector */
+        n -= 1;
+      }
 
-  gst_quiclib_transport_context_lock (conn);
+      if (_b_written > 0) {
+        vec[0].base += _b_written;
+        vec[0].len -= (size_t) _b_written;
+      }
+    }
+  } while (_bytes_written < buf_size);
 
-  if (ngtcp2_conn_in_closing_period (conn->quic_conn) ||
-      ngtcp2_conn_in_draining_period (conn->quic_conn))
-  {
-    g_object_unref (gst_quiclib_transport_context_get_timeout (conn));
-    gst_quiclib_transport_context_set_timeout (conn, NULL);
-    rv = G_SOURCE_REMOVE;
-  } else {
-    gst_quiclib_transport_context_set_state (
-        GST_QUICLIB_TRANSPORT_CONTEXT (conn), QUIC_STATE_CLOSED);
+  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      "Written %ld total bytes from %ld", _bytes_written, buf_size);
+
+  if (stream) {
+    stream->last_offset += (gsize) _bytes_written;
+    _quiclib_transport_store_ack_bufs (conn, buf, stream, _bytes_written);
   }
 
-  gst_quiclib_transport_context_unlock (conn);
+  if (buf_size > 0) {
+    g_free (vec_orig);
+  }
 
+  if (bytes_written) *bytes_written = _bytes_written;
+  
   return rv;
 }
 
 /**
- * quiclib_transport_process_packet
- * 
- * Feed a received packet into NGTCP2 for processing.
+ * quiclib_transport_send_stream_vec
+ *
+ * Sends @buf on @stream_id from @buf_vec as quiclib_transport_write_stream_vec
+ * does, unless the connection's or the stream's rate limit holds it back. A
+ * buffer that is held back is retained and counted as written in full, and is
+ * sent later from the loop thread. See "Shaping" above.
  *
  * INTERNAL FUNCTION ONLY.
  */
-gint
-quiclib_transport_process_packet (GstQuicLibTransportConnection *conn,
-    const ngtcp2_pkt_info *pktinfo, uint8_t *pkt, size_t pktlen)
+static GstQuicLibError
+quiclib_transport_send_stream_vec (GstQuicLibTransportConnection *conn,
+    GstBuffer *buf, gint64 stream_id, const ngtcp2_vec *buf_vec, size_t n,
+    gboolean may_block, ssize_t *bytes_written)
 {
-  gint rv;
-  ngtcp2_tstamp expiry, now;
-
-  gst_quiclib_transport_context_lock (conn);
-
-  rv = ngtcp2_conn_read_pkt (conn->quic_conn, &conn->path.path, pktinfo, pkt,
-      pktlen, quiclib_ngtcp2_timestamp());
-
-  gst_quiclib_transport_context_unlock (conn);
-
-  if (rv != 0) {
-    GST_INFO_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "ngtcp2 failed to read packet: %s", ngtcp2_strerror (rv));
-    switch (rv) {
-    case NGTCP2_ERR_DRAINING:
-    {
-      GstQuicLibTransportUserInterface *iface =
-            QUICLIB_TRANSPORT_USER_GET_IFACE (
-                gst_quiclib_transport_context_get_user (conn));
+  GstQuicLibStreamMeta *meta = gst_buffer_get_quiclib_stream_meta (buf);
+  GstQuicLibStreamContext *stream;
+  gboolean held = FALSE;
 
-      GST_INFO_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-          "Draining period is starting");
-      quiclib_set_timer (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-          quiclib_close_wait,
-          ngtcp2_conn_get_pto (conn->quic_conn) / NGTCP2_MILLISECONDS * 3);
+  if (stream_id < 0 && meta != NULL) {
+    stream_id = meta->stream_id;
+  }
 
-      iface->connection_closed (gst_quiclib_transport_context_get_user (conn),
-          GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-          gst_quiclib_transport_get_peer (conn));
+  g_return_val_if_fail (stream_id >= 0, -1);
 
-      return -2;
-    }
-    case NGTCP2_ERR_RETRY:
-      GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-          "TODO: implement address validation and retry");
-      g_assert (0);
-      break;
-    case NGTCP2_ERR_DROP_CONN:
-      /* Just drop the connection silently */
-      return -1;
-    case NGTCP2_ERR_CRYPTO:
-      GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-          "Error in TLS stack: %s", SSL_alert_type_string (
-              ngtcp2_conn_get_tls_alert (conn->quic_conn)));
-      gst_quiclib_transport_disconnect (conn, FALSE,
-          QUICLIB_CLOSE_CRYPTO_ERROR);
-      return -1;
-    }
+  if (!quiclib_conn_memory_wait (conn, may_block)) {
+    GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Over memory limit, not sending on stream %ld", stream_id);
+    if (bytes_written) *bytes_written = 0;
+    return GST_QUICLIB_ERR_CONN_DATA_BLOCKED;
   }
 
-  expiry = ngtcp2_conn_get_expiry (conn->quic_conn);
-  now = quiclib_ngtcp2_timestamp ();
-
-  GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-      "ngtcp2 expiry time %lu, time now %lu", expiry, now);
+  gst_quiclib_transport_context_lock (conn);
+  if (g_hash_table_lookup_extended (conn->streams, &stream_id, NULL,
+      (gpointer *) &stream)) {
+    held = quiclib_shaper_hold (conn, stream, stream_id, buf, meta);
+  }
+  gst_quiclib_transport_context_unlock (conn);
 
-  if (expiry <= now) {
-    quiclib_cancel_timer (GST_QUICLIB_TRANSPORT_CONTEXT (conn));
-    quiclib_timer_expired ((void *) conn);
-  } else {
-    quiclib_set_timer (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        quiclib_timer_expired, (expiry - now) / NGTCP2_MILLISECONDS);
+  if (held) {
+    if (bytes_written) *bytes_written = (ssize_t) gst_buffer_get_size (buf);
+    return GST_QUICLIB_ERR_OK;
   }
 
-  return 0;
+  return quiclib_transport_write_stream_vec (conn, buf, stream_id, buf_vec, n,
+      may_block, bytes_written);
 }
 
 /**
- * gst_quiclib_transport_disconnect
+ * gst_quiclib_transport_send_stream
  * 
- * Closes a QUIC connection.
+ * Send a buffer on a nominated stream ID. If stream ID is -1 and @buf contains
+ * a buffer with a GstQuicLibStreamMeta, the stream ID carried in the meta will
+ * be used instead.
  * 
- * @conn: Connection to close.
- * @app_error: Whether this is closing due to an application error.
- * @reason: The transport or application error code that caused this closure.
- * @return 0 on success, <0 on error.
+ * @conn: Connection to send buffer on.
+ * @buf: Buffer to send
+ * @stream_id: Stream to send the buffer on.
+ * @bytes_written: If non-NULL, returns the number of bytes written from @buf
+ * @return GstQuicLibError 
  */
-gint
-gst_quiclib_transport_disconnect (GstQuicLibTransportConnection *conn,
-    gboolean app_error, guint reason)
+GstQuicLibError
+gst_quiclib_transport_send_stream (GstQuicLibTransportConnection *conn,
+    GstBuffer *buf, gint64 stream_id, ssize_t *bytes_written)
 {
-  ngtcp2_ssize written;
-  ngtcp2_pkt_info pi;
-  uint8_t buf[NGTCP2_MAX_UDP_PAYLOAD_SIZE];
+  ngtcp2_vec *vec = NULL;
+  QuicLibUnmap *maps = NULL;
+  size_t n = 0;
+  GstQuicLibError rv;
 
-  if (app_error) {
-    ngtcp2_ccerr_set_application_error (&conn->last_error, reason, NULL, 0);
-  } else {
-    ngtcp2_ccerr_set_transport_error (&conn->last_error, reason, NULL, 0);
-  }
+  if (gst_buffer_get_size (buf) > 0) {
+    n = quiclib_buffer_to_vec (conn, buf, &vec, &maps);
 
-  if (conn->quic_conn == NULL) {
-    return 0;
+    g_return_val_if_fail (n != 0, -1);
   }
 
-  gst_quiclib_transport_context_set_state (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-      QUIC_STATE_HALF_CLOSED);
+  rv = quiclib_transport_send_stream_vec (conn, buf, stream_id, vec, n, TRUE,
+      bytes_written);
 
-  gst_quiclib_transport_context_lock (conn);
-  written = ngtcp2_conn_write_connection_close (conn->quic_conn,
-      &conn->path.path, &pi, buf, NGTCP2_MAX_UDP_PAYLOAD_SIZE,
-      &conn->last_error, quiclib_ngtcp2_timestamp ());
+  quiclib_buffer_unmap (&maps);
+  g_free (vec);
 
-  if (written < 0) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Couldn't write connection close packet: %s",
-        ngtcp2_strerror ((int) written));
-    gst_quiclib_transport_context_unlock (conn);
-    return -1;
-  }
+  return rv;
+}
 
-  /*
-   * Can return 0 if the connection was already closed
-   */
-  if (written > 0) {
-    written = ngtcp2_conn_write_pkt (conn->quic_conn, &conn->path.path, &pi,
-        buf, (size_t) written, quiclib_ngtcp2_timestamp ());
-  }
+GstQuicLibError
+gst_quiclib_transport_send_datagram (GstQuicLibTransportConnection *conn,
+    GstBuffer *buf, GstQuicLibDatagramTicket *ticket, ssize_t *bytes_written)
+{
+  ssize_t _bytes_written;
+  ngtcp2_vec *vec = NULL;
+  QuicLibUnmap *maps = NULL;
+  GstQuicLibDatagramMeta *dmeta;
+  size_t n;
 
-  if (!ngtcp2_conn_in_closing_period (conn->quic_conn) &&
-      !ngtcp2_conn_in_draining_period (conn->quic_conn))
-  {
-    quiclib_set_timer (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        quiclib_close_wait,
-        ngtcp2_conn_get_pto (conn->quic_conn) / NGTCP2_MILLISECONDS * 3);
-  } else {
-    gst_quiclib_transport_context_set_state (
-        GST_QUICLIB_TRANSPORT_CONTEXT (conn), QUIC_STATE_CLOSED);
+  if (quiclib_conn_memory_limited (conn)) {
+    GST_LOG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Over memory limit, dropping datagram");
+    quiclib_mem_charge (&conn->memory->shed, 1);
+    if (bytes_written) *bytes_written = 0;
+    return GST_QUICLIB_ERR_OK;
   }
 
-  gst_quiclib_transport_context_unlock (conn);
+  n = quiclib_buffer_to_vec (conn, buf, &vec, &maps);
 
-  return 0;
-}
+  g_return_val_if_fail (n != 0, -1);
 
-struct _GstQuicLibUnmap {
-  GstMapInfo map;
-  gsize end_offset;
-  GstMemory *mem;
-};
+  dmeta = gst_buffer_get_quiclib_datagram_meta (buf);
 
-size_t
-quiclib_buffer_to_vec (GstBuffer *buf, ngtcp2_vec **vec, GList **unmap)
-{
-  size_t i, n = gst_buffer_n_memory (buf);
-  ngtcp2_vec *v = g_new0 (ngtcp2_vec, n);
-  GList *maps = NULL;
-  gsize offset = 0;
-  if (v == NULL) return 0;
+  _bytes_written = quiclib_ngtcp2_datagram_write (conn, vec, n,
+      (dmeta != NULL)?(dmeta->dscp):(-1));
 
-  for (i = 0; i < n; i++) {
-    struct _GstQuicLibUnmap *map = g_new0 (struct _GstQuicLibUnmap, 1);
-    map->mem = gst_buffer_peek_memory (buf, i);
-    gst_memory_map (map->mem, &map->map, GST_MAP_READ);
-    /* Unmapped in quiclib_buffer_unmap */
-    v[i].base = map->map.data;
-    v[i].len = map->map.size;
-    offset += map->map.size;
-    map->end_offset = offset;
-    maps = g_list_append (maps, map);
+  if (_bytes_written > 0) {
+    quiclib_shaper_charge (conn, gst_buffer_get_size (buf));
   }
 
-  *vec = v;
-  *unmap = maps;
-  return n;
-}
+  if (_bytes_written > 0 && ticket != NULL) {
 
-void
-quiclib_buffer_unmap (GList **map)
-{
-  GList *maps = *map;
-  while (maps != NULL) {
-    struct _GstQuicLibUnmap *unmap =
-        (struct _GstQuicLibUnmap *) maps->data;
-    gst_memory_unmap (unmap->mem, &unmap->map);
-    g_free (unmap);
-    maps = g_list_delete_link (maps, maps);
+    *ticket = conn->datagram_ticket++;
   }
-  *map = maps;
+
+  quiclib_buffer_unmap (&maps);
+
+  if (_bytes_written > 0 && bytes_written) *bytes_written = _bytes_written;
+  
+  return (bytes_written >= 0)?(GST_QUICLIB_ERR_OK):(
+      (GstQuicLibError) bytes_written);
 }
 
 /**
- * gst_quiclib_transport_open_stream
- * 
- * Open a new stream on an open connection. The handshake MUST be completed
- * before this method is called.
- * 
- * @conn: Connection
- * @bidirectional: Open new bidirectional stream when TRUE, unidirectional when
- *    FALSE.
- * @stream_ctx: Opaque application context to return in callbacks about this
- *    stream.
- * @return The QUIC stream ID of the new stream, or a GstQuicLibErr value on
- *    error.
+ * gst_quiclib_transport_send_fanout
+ *
+ * Send the same buffer to many connections, such as all of the subscribers to
+ * a stream of media. @buf is mapped once and every connection sends from that
+ * one mapping. Each stream target retains a lightweight view of @buf for
+ * retransmission, sharing @buf's memory rather than copying it.
+ *
+ * Targets are sent to in order, so a target that may block holds up those
+ * after it while it waits for window.
+ *
+ * @buf: The buffer to send. Any GstQuicLibStreamMeta or
+ *    GstQuicLibDatagramMeta on it is used for the final flag and DSCP.
+ * @targets: The connections to send @buf to, and the result for each.
+ * @n_targets: The number of entries in @targets.
+ * @return The number of targets that @buf was sent to in full.
  */
-gint64
-gst_quiclib_transport_open_stream (GstQuicLibTransportConnection *conn,
-    gboolean bidirectional, gpointer stream_ctx)
+guint
+gst_quiclib_transport_send_fanout (GstBuffer *buf,
+    GstQuicLibFanoutTarget *targets, guint n_targets)
 {
-  gint rv;
-  gint64 stream_id = -1;
+  ngtcp2_vec *vec = NULL;
+  QuicLibUnmap *maps = NULL;
+  size_t n = 0;
+  gsize buf_size = gst_buffer_get_size (buf);
+  GstQuicLibDatagramMeta *dmeta = gst_buffer_get_quiclib_datagram_meta (buf);
+  guint i, sent = 0;
 
-  gst_quiclib_transport_context_lock (conn);
+  if (buf_size > 0) {
+    n = quiclib_buffer_to_vec (NULL, buf, &vec, &maps);
 
-  if (ngtcp2_conn_get_handshake_completed (conn->quic_conn) == 0) {
-    GST_WARNING_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Cannot open stream as handshake has not completed yet");
-    gst_quiclib_transport_context_unlock (conn);
-    return GST_QUICLIB_ERR;
+    g_return_val_if_fail (n != 0, 0);
   }
 
-  if (bidirectional) {
-    rv = ngtcp2_conn_open_bidi_stream (conn->quic_conn, &stream_id,
-        stream_ctx);
-  } else {
-    rv = ngtcp2_conn_open_uni_stream (conn->quic_conn, &stream_id, stream_ctx);
-  }
+  for (i = 0; i < n_targets; i++) {
+    GstQuicLibFanoutTarget *target = &targets[i];
 
-  gst_quiclib_transport_context_unlock (conn);
+    target->bytes_written = 0;
 
-  if (rv != 0) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Failed to open new QUIC stream: %s", ngtcp2_strerror (rv));
-    if (rv == NGTCP2_ERR_STREAM_ID_BLOCKED) {
-      return GST_QUICLIB_ERR_STREAM_ID_BLOCKED;
-    }
-    return GST_QUICLIB_ERR;
-  }
+    if (target->stream_id >= 0) {
+      GstBuffer *view = gst_buffer_copy_region (buf,
+          GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS |
+          GST_BUFFER_COPY_META | GST_BUFFER_COPY_MEMORY, 0, buf_size);
 
-  switch (stream_id & 0x3) {
-    case 0x0: conn->last_client_bidi_stream_id = (guint64) stream_id; break;
-    case 0x1: conn->last_server_bidi_stream_id = (guint64) stream_id; break;
-    case 0x2: conn->last_client_uni_stream_id = (guint64) stream_id; break;
-    case 0x3: conn->last_server_uni_stream_id = (guint64) stream_id; break;
-  }
+      target->error = quiclib_transport_send_stream_vec (target->conn, view,
+          target->stream_id, vec, n, target->may_block,
+          &target->bytes_written);
 
-  if (quiclib_alloc_stream_context (conn, stream_id) == FALSE) {
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Failed to allocate stream context");
-    gst_quiclib_transport_context_lock (conn);
-    ngtcp2_conn_shutdown_stream (conn->quic_conn, 0, stream_id, 0);
-    gst_quiclib_transport_context_unlock (conn);
-    return GST_QUICLIB_ERR;
+      gst_buffer_unref (view);
+    } else {
+      ngtcp2_ssize nwrite;
+      gboolean blocked = FALSE;
+
+      if (quiclib_conn_memory_limited (target->conn)) {
+        quiclib_mem_charge (&target->conn->memory->shed, 1);
+        target->error = GST_QUICLIB_ERR_OK;
+        continue;
+      }
+
+      /*
+       * Only the query is locked: quiclib_ngtcp2_datagram_write drops the lock
+       * while it waits for the handshake, which it can't do if it's held here.
+       */
+      if (!target->may_block) {
+        gst_quiclib_transport_context_lock (target->conn);
+        blocked = ngtcp2_conn_get_cwnd_left (target->conn->quic_conn) <
+            buf_size;
+        gst_quiclib_transport_context_unlock (target->conn);
+      }
+
+      if (blocked) {
+        target->error = GST_QUICLIB_ERR_CONN_DATA_BLOCKED;
+        continue;
+      }
+
+      nwrite = quiclib_ngtcp2_datagram_write (target->conn, vec, n,
+          (dmeta != NULL) ? dmeta->dscp : -1);
+
+      if (nwrite > 0) {
+        quiclib_shaper_charge (target->conn, buf_size);
+        target->bytes_written = (ssize_t) buf_size;
+        target->error = GST_QUICLIB_ERR_OK;
+      } else if (nwrite == 0) {
+        target->error = GST_QUICLIB_ERR_CONN_DATA_BLOCKED;
+      } else {
+        target->error = (GstQuicLibError) nwrite;
+      }
+    }
+
+    if (target->error == GST_QUICLIB_ERR_OK &&
+        (gsize) target->bytes_written == buf_size) {
+      sent++;
+    }
   }
 
-  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-      "Opened new %sdirectional QUIC stream %ld",
-      (bidirectional)?("bi"):("uni"), stream_id);
+  quiclib_buffer_unmap (&maps);
+  g_free (vec);
 
-  return stream_id;
+  return sent;
 }
 
-GstQuicLibStreamState
-gst_quiclib_transport_stream_state (GstQuicLibTransportConnection *conn,
-    guint64 stream_id)
+/*
+ * Relaying.
+ *
+ * A relay rule forwards the streams, and optionally the DATAGRAM frames,
+ * received on an upstream connection to a downstream connection. Forwarding
+ * happens on the upstream connection's loop thread as the data arrives, and
+ * relayed data isn't passed to the transport user. Each upstream stream is
+ * forwarded onto a new stream of the same type on the downstream connection,
+ * opened when the start of the upstream stream arrives. Upstream streams that
+ * were already under way when the rule was added aren't forwarded.
+ *
+ * Relaying never waits for a downstream connection. Stream data it hasn't the
+ * window for is queued on the rule's stream and flushed as more data arrives
+ * and when the downstream connection's data is acknowledged. If the queue
+ * grows beyond the rule's max_queued bytes, the downstream stream is reset and
+ * the rest of the upstream stream is dropped for that rule. DATAGRAM frames
+ * that can't be sent straight away are dropped.
+ *
+ * The rules are protected by the upstream connection's context lock, which is
+ * held while it receives data. Forwarding takes the downstream connection's
+ * lock, so relays mustn't form a cycle between connections that run on
+ * different loop threads.
+ */
+#define QUICLIB_RELAY_DROPPED_ERROR 0x1
+
+typedef struct {
+  /* -1 if this rule is dropping the upstream stream */
+  gint64 downstream_id;
+  GQueue queue;
+  gsize queued;
+} QuicLibRelayStream;
+
+typedef struct {
+  GstQuicLibTransportConnection *downstream;
+  gint64 stream_id;
+  gboolean datagrams;
+  gsize max_queued;
+
+  /** GHashTable<gint64 (upstream stream id), QuicLibRelayStream> */
+  GHashTable *streams;
+} QuicLibRelayRule;
+
+static void
+quiclib_relay_stream_free (gpointer data)
 {
-  GstQuicLibStreamState rv = QUIC_STREAM_OPEN;
+  QuicLibRelayStream *rs = (QuicLibRelayStream *) data;
 
-  gst_quiclib_transport_context_lock (conn);
+  g_queue_clear_full (&rs->queue, (GDestroyNotify) gst_buffer_unref);
+  g_free (rs);
+}
 
-  if (ngtcp2_conn_get_max_stream_data_left (conn->quic_conn, (gint64) stream_id)
-      == 0) {
-    rv |= QUIC_STREAM_DATA_BLOCKED;
-  }
-  if (ngtcp2_conn_get_cwnd_left (conn->quic_conn) == 0) {
-    rv |= QUIC_STREAM_CONNECTION_BLOCKED;
-  }
+static void
+quiclib_relay_rule_free (QuicLibRelayRule *rule)
+{
+  g_hash_table_destroy (rule->streams);
+  g_object_unref (rule->downstream);
+  g_free (rule);
+}
 
-  gst_quiclib_transport_context_unlock (conn);
+/**
+ * quiclib_relay_rule_stream
+ *
+ * Returns the state of @rule for @stream_id, opening a stream on the
+ * downstream connection if this is the start of the upstream stream. Call with
+ * the upstream connection's context lock held.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static QuicLibRelayStream *
+quiclib_relay_rule_stream (QuicLibRelayRule *rule, gint64 stream_id,
+    guint64 offset)
+{
+  QuicLibRelayStream *rs = g_hash_table_lookup (rule->streams, &stream_id);
+  gint64 *key;
 
-  if (stream_id & 0x2) {
-    if (conn->server) {
-      if (stream_id & 0x1) {
-        rv |= QUIC_STREAM_CLOSED_READING;
-      } else {
-        rv |= QUIC_STREAM_CLOSED_SENDING;
-      }
-    } else {
-      if (stream_id & 0x1) {
-        rv |= QUIC_STREAM_CLOSED_SENDING;
-      } else {
-        rv |= QUIC_STREAM_CLOSED_READING;
-      }
-    }
+  if (rs != NULL) {
+    return rs;
   }
 
-  return rv;
-}
+  rs = g_new0 (QuicLibRelayStream, 1);
+  rs->downstream_id = -1;
+  g_queue_init (&rs->queue);
 
-typedef struct _GstQuicLibStreamClose GstQuicLibStreamClose;
+  if (offset == 0 && gst_quiclib_transport_get_state (
+      GST_QUICLIB_TRANSPORT_CONTEXT (rule->downstream)) == QUIC_STATE_OPEN) {
+    rs->downstream_id = gst_quiclib_transport_open_stream (rule->downstream,
+        !QUICLIB_STREAM_IS_UNI (stream_id), NULL);
 
-struct _GstQuicLibStreamClose {
-  GstMiniObject mini_object;
+    if (rs->downstream_id < 0) {
+      GST_WARNING_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (rule->downstream),
+          "Couldn't open a stream to relay stream %ld onto: %s", stream_id,
+          gst_quiclib_error_as_string ((GstQuicLibError) rs->downstream_id));
+      rs->downstream_id = -1;
+    } else {
+      GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (rule->downstream),
+          "Relaying stream %ld onto stream %ld", stream_id,
+          rs->downstream_id);
+    }
+  }
 
-  guint64 stream_id;
-  guint64 error_close;
-};
+  key = g_new (gint64, 1);
+  *key = stream_id;
+  g_hash_table_insert (rule->streams, key, rs);
 
-GST_DEFINE_MINI_OBJECT_TYPE (GstQuicLibStreamClose, gst_quiclib_stream_close);
+  return rs;
+}
 
-#define QUICLIB_TYPE_STREAM_CLOSE gst_quiclib_stream_close_get_type ()
-#define QUICLIB_IS_STREAM_CLOSE(obj) \
-    (GST_IS_MINI_OBJECT_TYPE (obj, QUICLIB_TYPE_STREAM_CLOSE))
-#define QUICLIB_STREAM_CLOSE_CAST(obj) ((GstQuicLibStreamClose *) obj)
+/**
+ * quiclib_relay_drop_stream
+ *
+ * Resets the downstream stream of @rs with @error_code, and drops the rest of
+ * the upstream stream for its rule.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_relay_drop_stream (QuicLibRelayRule *rule, QuicLibRelayStream *rs,
+    guint64 error_code)
+{
+  if (rs->downstream_id >= 0) {
+    gst_quiclib_transport_close_stream (rule->downstream,
+        (guint64) rs->downstream_id, error_code);
+  }
 
+  g_queue_clear_full (&rs->queue, (GDestroyNotify) gst_buffer_unref);
+  rs->queued = 0;
+  rs->downstream_id = -1;
+}
 
-#define gst_quiclib_stream_close_ref(obj) \
-    (GstQuicLibStreamClose *) gst_mini_object_ref (GST_MINI_OBJECT_CAST (obj));
+/**
+ * quiclib_relay_remainder
+ *
+ * Returns a new buffer with what is left of @buf after the first @written
+ * bytes, for when the downstream window ran out part way through sending it.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static GstBuffer *
+quiclib_relay_remainder (GstBuffer *buf, gsize written)
+{
+  gsize size = gst_buffer_get_size (buf);
+  GstBuffer *rest;
+  GstQuicLibStreamMeta *meta;
 
-#define gst_quiclib_stream_close_unref(obj) \
-    gst_mini_object_unref (GST_MINI_OBJECT_CAST (obj));
+  rest = gst_buffer_copy_region (buf, GST_BUFFER_COPY_FLAGS |
+      GST_BUFFER_COPY_TIMESTAMPS | GST_BUFFER_COPY_META |
+      GST_BUFFER_COPY_MEMORY, written, size - written);
 
-/*
- * Asynchronous callback handling starts
- */
+  meta = gst_buffer_get_quiclib_stream_meta (rest);
+  if (meta != NULL) {
+    meta->offset += written;
+    meta->length = size - written;
+  }
 
+  return rest;
+}
+
+/**
+ * quiclib_relay_flush_stream
+ *
+ * Sends as much of the queue of @rs as the downstream connection has the
+ * window for. Returns TRUE if @rs can be removed, as the end of the stream has
+ * been sent, or the stream was dropped after its end was queued so nothing
+ * more will arrive for it. Call with the upstream connection's context lock
+ * held.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
 static gboolean
-_quiclib_transport_send_queue_source_prepare (GSource *source, gint *timeout)
+quiclib_relay_flush_stream (QuicLibRelayRule *rule, QuicLibRelayStream *rs)
 {
-  GstQuicLibTransportSendQueueSource *send_queue_src =
-      (GstQuicLibTransportSendQueueSource *) source;
+  while (!g_queue_is_empty (&rs->queue)) {
+    GstBuffer *buf = (GstBuffer *) g_queue_peek_head (&rs->queue);
+    GstQuicLibStreamMeta *meta = gst_buffer_get_quiclib_stream_meta (buf);
+    GstQuicLibFanoutTarget target = {rule->downstream, rs->downstream_id,
+        FALSE, GST_QUICLIB_ERR_OK, 0};
+
+    gst_quiclib_transport_send_fanout (buf, &target, 1);
+
+    if (target.error == GST_QUICLIB_ERR_CONN_DATA_BLOCKED) {
+      if (target.bytes_written > 0) {
+        g_queue_pop_head (&rs->queue);
+        g_queue_push_head (&rs->queue,
+            quiclib_relay_remainder (buf, (gsize) target.bytes_written));
+        rs->queued -= (gsize) target.bytes_written;
+        gst_buffer_unref (buf);
+      }
+      return FALSE;
+    }
 
-  GST_TRACE_OBJECT (send_queue_src->conn,
-      "send_queue_source_prepare: cwnd %lu, queue length: %u, bytes: %lu",
-      ngtcp2_conn_get_cwnd_left (send_queue_src->conn->quic_conn),
-      g_async_queue_length (send_queue_src->queue), send_queue_src->queue_len);
+    if (target.error != GST_QUICLIB_ERR_OK) {
+      GstQuicLibStreamMeta *last = gst_buffer_get_quiclib_stream_meta (
+          (GstBuffer *) g_queue_peek_tail (&rs->queue));
+      gboolean fin_queued = last != NULL && last->final;
 
-  return (ngtcp2_conn_get_cwnd_left (send_queue_src->conn->quic_conn) &&
-      g_async_queue_length (send_queue_src->queue) > 0);
+      GST_WARNING_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (rule->downstream),
+          "Couldn't relay onto stream %ld: %s", rs->downstream_id,
+          gst_quiclib_error_as_string (target.error));
+      quiclib_relay_drop_stream (rule, rs, QUICLIB_RELAY_DROPPED_ERROR);
+      return fin_queued;
+    }
+
+    g_queue_pop_head (&rs->queue);
+    rs->queued -= gst_buffer_get_size (buf);
+    gst_buffer_unref (buf);
+
+    if (meta != NULL && meta->final) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
 }
 
-static gboolean
-_quiclib_transport_send_queue_source_dispatch (GSource *source, GSourceFunc cb,
-    gpointer user_data)
+/**
+ * quiclib_relay_enqueue
+ *
+ * Queues @buf to be sent on the downstream stream of @rs, dropping the stream
+ * if that takes the queue over the rule's limit.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_relay_enqueue (QuicLibRelayRule *rule, QuicLibRelayStream *rs,
+    GstBuffer *buf)
 {
-  GstQuicLibTransportSendQueueSource *send_queue_src =
-      (GstQuicLibTransportSendQueueSource *) source;
-  GstMiniObject *obj;
-  GQueue *replace = g_queue_new ();
-
-  for (obj = GST_MINI_OBJECT (g_async_queue_pop (send_queue_src->queue));
-      obj != NULL;
-      obj = GST_MINI_OBJECT (g_async_queue_try_pop (send_queue_src->queue))) {
+  g_queue_push_tail (&rs->queue, gst_buffer_ref (buf));
+  rs->queued += gst_buffer_get_size (buf);
 
-    if (GST_IS_BUFFER (obj)) {
-      GstQuicLibStreamMeta *smeta;
-      GstQuicLibDatagramMeta *dmeta;
-      gssize bytes_sent = 0;
-      GstQuicLibError err = GST_QUICLIB_ERR_OK;
-      GstBuffer *buf = GST_BUFFER (obj);
+  if (rule->max_queued > 0 && rs->queued > rule->max_queued) {
+    GST_WARNING_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (rule->downstream),
+        "Relay queue for stream %ld is over its limit of %lu bytes, dropping "
+        "the stream", rs->downstream_id, rule->max_queued);
+    quiclib_relay_drop_stream (rule, rs, QUICLIB_RELAY_DROPPED_ERROR);
+  }
+}
 
-      smeta = gst_buffer_get_quiclib_stream_meta (buf);
-      if (smeta != NULL) {
-        GST_TRACE_OBJECT (send_queue_src->conn, "Buffer of size %lu for stream "
-            "ID %lu to send, stream data remaining %lu",
-            gst_buffer_get_size (buf), smeta->stream_id,
-            ngtcp2_conn_get_max_stream_data_left (
-                send_queue_src->conn->quic_conn, smeta->stream_id));
-        if (ngtcp2_conn_get_max_stream_data_left (send_queue_src->conn->quic_conn,
-            smeta->stream_id) >= gst_buffer_get_size (buf)) {
-          err = gst_quiclib_transport_send_stream (send_queue_src->conn,
-              buf, smeta->stream_id, &bytes_sent);
-        }
-      }
+/**
+ * quiclib_relay_stream_data
+ *
+ * Forwards @buf, received at @offset on @stream_id of @conn, according to the
+ * relay rules of @conn. Returns TRUE if the stream is relayed, in which case
+ * it isn't passed to the transport user. Call with the context lock held.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_relay_stream_data (GstQuicLibTransportConnection *conn,
+    GstBuffer *buf, gint64 stream_id, guint64 offset, gboolean fin)
+{
+  GstQuicLibFanoutTarget *targets;
+  QuicLibRelayRule **rules;
+  QuicLibRelayStream **streams;
+  gboolean relayed = FALSE;
+  guint n = 0, i, n_rules = g_list_length (conn->relays);
+  GList *it;
 
-      dmeta = gst_buffer_get_quiclib_datagram_meta (buf);
-      if (dmeta != NULL) {
-        GST_TRACE_OBJECT (send_queue_src->conn, "Buffer of size %lu for "
-            "datagram to send", gst_buffer_get_size (buf));
-        err = gst_quiclib_transport_send_datagram (send_queue_src->conn,
-            buf, NULL, &bytes_sent);
-      }
+  if (n_rules == 0) {
+    return FALSE;
+  }
 
-      if (err < 0) {
-        /* An error! */
-        GST_TRACE_OBJECT (send_queue_src->conn,
-            "An error was encountered when sending buffer! %s",
-            gst_quiclib_error_as_string(err));
-        break;
-      } else if (bytes_sent < gst_buffer_get_size (buf)) {
-        GST_TRACE_OBJECT (send_queue_src->conn,
-            "Managed to send %ld bytes of %ld", bytes_sent,
-            gst_buffer_get_size (buf));
-        if (bytes_sent > 0) {
-          /*
-           * Resize the buffer to account for what's been sent
-           */
-          gst_buffer_resize (buf, bytes_sent, -1);
-        }
+  targets = g_new0 (GstQuicLibFanoutTarget, n_rules);
+  rules = g_new (QuicLibRelayRule *, n_rules);
+  streams = g_new (QuicLibRelayStream *, n_rules);
 
-        g_queue_push_tail (replace, (gpointer) buf);
-      }
+  for (it = conn->relays; it != NULL; it = it->next) {
+    QuicLibRelayRule *rule = (QuicLibRelayRule *) it->data;
+    QuicLibRelayStream *rs;
 
-      g_mutex_lock (&send_queue_src->mutex);
-      send_queue_src->queue_len -= bytes_sent;
-      g_mutex_unlock (&send_queue_src->mutex);
-    } else if (QUICLIB_IS_STREAM_CLOSE (obj)) {
-      GstQuicLibStreamClose *close_obj = QUICLIB_STREAM_CLOSE_CAST (obj);
-      GList *it;
-      gboolean needs_queuing = FALSE;
+    if (rule->stream_id >= 0 && rule->stream_id != stream_id) {
+      continue;
+    }
 
-      GST_TRACE_OBJECT (send_queue_src->conn, "Queued stream close %lu",
-          close_obj->stream_id);
+    relayed = TRUE;
+    rs = quiclib_relay_rule_stream (rule, stream_id, offset);
 
-      for (it = replace->head; it != NULL; it = it->next) {
-        if (GST_IS_BUFFER (it->data)) {
-          GstQuicLibStreamMeta *smeta =
-              gst_buffer_get_quiclib_stream_meta (GST_BUFFER (it->data));
-          if (smeta != NULL &&
-              ((guint64) smeta->stream_id == close_obj->stream_id)) {
-            needs_queuing = TRUE;
-            break;
-          }
-        }
+    if (rs->downstream_id < 0) {
+      if (fin) {
+        g_hash_table_remove (rule->streams, &stream_id);
       }
+      continue;
+    }
 
-      if (needs_queuing) {
-        GST_TRACE_OBJECT (send_queue_src->conn,
-            "Still data to send for stream %lu, requeueing",
-            close_obj->stream_id);
-        g_queue_push_tail (replace, (gpointer) obj);
-      } else if (QUICLIB_STREAM_IS_UNI (close_obj->stream_id) ||
-          close_obj->error_close) {
-        GST_TRACE_OBJECT (send_queue_src->conn,
-            "Forcing shutdown of stream %lu", close_obj->stream_id);
-        gst_quiclib_transport_context_lock (send_queue_src->conn);
-        if (ngtcp2_conn_shutdown_stream (send_queue_src->conn->quic_conn, 0,
-            (gint64) close_obj->stream_id, close_obj->error_close) != 0) {
-          GST_ERROR_OBJECT (obj, "Couldn't shut down stream %lu",
-              close_obj->stream_id);
-        }
-        gst_quiclib_transport_context_unlock (send_queue_src->conn);
-      } else if (quiclib_ngtcp2_conn_write (send_queue_src->conn,
-            close_obj->stream_id, NULL, 0, 1) != 0) {
-        GST_ERROR_OBJECT (obj, "Couldn't write end-of-stream for stream %lu",
-            close_obj->stream_id);
+    /* Keep the stream in order behind anything already waiting */
+    if (!g_queue_is_empty (&rs->queue)) {
+      quiclib_relay_enqueue (rule, rs, buf);
+      if (quiclib_relay_flush_stream (rule, rs) ||
+          (fin && rs->downstream_id < 0)) {
+        g_hash_table_remove (rule->streams, &stream_id);
       }
+      continue;
     }
-  }
 
-  if (g_queue_get_length (replace)) {
-    GstMiniObject *obj;
+    targets[n].conn = rule->downstream;
+    targets[n].stream_id = rs->downstream_id;
+    targets[n].may_block = FALSE;
+    rules[n] = rule;
+    streams[n] = rs;
+    n++;
+  }
 
-    g_async_queue_lock (send_queue_src->queue);
+  if (n > 0) {
+    gst_quiclib_transport_send_fanout (buf, targets, n);
+  }
 
-    for (obj = GST_MINI_OBJECT (g_queue_pop_tail (replace)); obj != NULL;
-        obj = GST_MINI_OBJECT (g_queue_pop_tail (replace))) {
-      g_async_queue_push_front_unlocked (send_queue_src->queue, (gpointer) obj);
+  /*
+   * A downstream without the window for all of @buf is never waited for, see
+   * quiclib_transport_write_stream_vec, so that one slow downstream can't
+   * hold up the upstream connection. Whatever it couldn't take is queued.
+   */
+  for (i = 0; i < n; i++) {
+    if (targets[i].error == GST_QUICLIB_ERR_CONN_DATA_BLOCKED &&
+        targets[i].bytes_written > 0) {
+      GstBuffer *rest = quiclib_relay_remainder (buf,
+          (gsize) targets[i].bytes_written);
+
+      quiclib_relay_enqueue (rules[i], streams[i], rest);
+      gst_buffer_unref (rest);
+    } else if (targets[i].error == GST_QUICLIB_ERR_CONN_DATA_BLOCKED) {
+      quiclib_relay_enqueue (rules[i], streams[i], buf);
+    } else if (targets[i].error != GST_QUICLIB_ERR_OK) {
+      GST_WARNING_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (targets[i].conn),
+          "Couldn't relay stream %ld onto stream %ld: %s", stream_id,
+          targets[i].stream_id, gst_quiclib_error_as_string (targets[i].error));
+      quiclib_relay_drop_stream (rules[i], streams[i],
+          QUICLIB_RELAY_DROPPED_ERROR);
     }
 
-    g_async_queue_unlock (send_queue_src->queue);
+    /* Blocked data still has the end of the stream queued */
+    if (fin && (targets[i].error == GST_QUICLIB_ERR_OK ||
+        streams[i]->downstream_id < 0)) {
+      g_hash_table_remove (rules[i]->streams, &stream_id);
+    }
   }
 
-  g_queue_free (replace);
+  g_free (streams);
+  g_free (rules);
+  g_free (targets);
 
-  return TRUE;
+  return relayed;
 }
 
-static void
-_quiclib_transport_send_queue_source_finalize (GSource *source)
+/**
+ * quiclib_relay_datagram
+ *
+ * Forwards @buf, a DATAGRAM frame received on @conn, to every downstream
+ * connection with a rule relaying DATAGRAM frames. Returns TRUE if there are
+ * any, in which case @buf isn't passed to the transport user. Call with the
+ * context lock held.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_relay_datagram (GstQuicLibTransportConnection *conn, GstBuffer *buf)
 {
-  GstQuicLibTransportSendQueueSource *send_queue_src =
-      (GstQuicLibTransportSendQueueSource *) source;
-
-  g_async_queue_unref (send_queue_src->queue);
-}
+  GstQuicLibFanoutTarget *targets;
+  guint n = 0, sent;
+  GList *it;
 
-static GSourceFuncs _quiclib_transport_send_queue_source_funcs = {
-    .prepare = _quiclib_transport_send_queue_source_prepare,
-    .check = NULL,
-    .dispatch = _quiclib_transport_send_queue_source_dispatch,
-    .finalize = _quiclib_transport_send_queue_source_finalize
-};
+  if (conn->relays == NULL) {
+    return FALSE;
+  }
 
-void
-_ensure_quiclib_send_queue (GstQuicLibTransportConnection *conn)
-{
-  if (conn->send_queue_source == NULL) {
-    GstQuicLibTransportContextPrivate *priv =
-        gst_quiclib_transport_context_get_instance_private (
-            GST_QUICLIB_TRANSPORT_CONTEXT (conn));
+  targets = g_new0 (GstQuicLibFanoutTarget, g_list_length (conn->relays));
 
-    conn->send_queue_source = (GstQuicLibTransportSendQueueSource *)
-        g_source_new (&_quiclib_transport_send_queue_source_funcs,
-          sizeof (GstQuicLibTransportSendQueueSource));
+  for (it = conn->relays; it != NULL; it = it->next) {
+    QuicLibRelayRule *rule = (QuicLibRelayRule *) it->data;
 
-    conn->send_queue_source->conn = conn;
-    conn->send_queue_source->queue_len = 0;
+    if (!rule->datagrams || gst_quiclib_transport_get_state (
+        GST_QUICLIB_TRANSPORT_CONTEXT (rule->downstream)) != QUIC_STATE_OPEN) {
+      continue;
+    }
 
-    g_mutex_init (&conn->send_queue_source->mutex);
+    targets[n].conn = rule->downstream;
+    targets[n].stream_id = -1;
+    targets[n].may_block = FALSE;
+    n++;
+  }
 
-    conn->send_queue_source->queue =
-        g_async_queue_new_full ((GDestroyNotify) gst_buffer_unref);
+  if (n == 0) {
+    g_free (targets);
+    return FALSE;
+  }
 
-    g_source_attach ((GSource *) conn->send_queue_source, priv->loop_context);
+  sent = gst_quiclib_transport_send_fanout (buf, targets, n);
+  if (sent < n) {
+    GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Relayed DATAGRAM of %lu bytes to %u of %u connections, dropped for "
+        "the rest", gst_buffer_get_size (buf), sent, n);
   }
+
+  g_free (targets);
+
+  return TRUE;
 }
 
-/*
- * End asynchronous callback hanlding.
+/**
+ * quiclib_relay_stream_reset
+ *
+ * Passes the reset of @stream_id on @conn on to every stream it is relayed
+ * onto. Call with the context lock held.
+ *
+ * INTERNAL FUNCTION ONLY.
  */
-
-gboolean
-gst_quiclib_transport_close_stream (GstQuicLibTransportConnection *conn,
-    guint64 stream_id, guint64 error_code)
+static void
+quiclib_relay_stream_reset (GstQuicLibTransportConnection *conn,
+    gint64 stream_id, guint64 app_error_code)
 {
-  int rv = -1;
+  GList *it;
 
-  if (QUICLIB_STREAM_IS_UNI (stream_id) || error_code) {
-    gst_quiclib_transport_context_lock (conn);
-    rv = ngtcp2_conn_shutdown_stream (conn->quic_conn, 0, (gint64) stream_id,
-        error_code);
-    gst_quiclib_transport_context_unlock (conn);
-  } else {
-    rv = (int) quiclib_ngtcp2_conn_write (conn, stream_id, NULL, 0, 1);
-  }
+  for (it = conn->relays; it != NULL; it = it->next) {
+    QuicLibRelayRule *rule = (QuicLibRelayRule *) it->data;
+    QuicLibRelayStream *rs = g_hash_table_lookup (rule->streams, &stream_id);
 
-  return (rv == 0)?(TRUE):(FALSE);
+    if (rs != NULL) {
+      /* An error code of 0 would close the stream cleanly */
+      quiclib_relay_drop_stream (rule, rs,
+          (app_error_code != 0) ? app_error_code : QUICLIB_RELAY_DROPPED_ERROR);
+      g_hash_table_remove (rule->streams, &stream_id);
+    }
+  }
 }
 
 /**
- * gst_quiclib_transport_send_buffer
- * 
- * Convenience function that wraps _send_stream and _send_datagram depending on
- * if the passed in buffer has a GstQuicLibStreamMeta or GstQuicLibDatagramMeta
- * respectively.
- * 
- * @conn: The connection to send the buffer on.
- * @buf: The buffer to send.
- * @bytes_written: If non-NULL, returns the number of bytes from @buf that was
- *    written to the remote peer.
- * @return GST_QUICLIB_ERR if buffer did not contain a suitable meta, or any 
- *    other GstQuicLibError on sending failure.
+ * quiclib_relay_flush
+ *
+ * Idle callback run on an upstream connection's loop thread to flush the
+ * queues of all of its relay rules.
+ *
+ * INTERNAL FUNCTION ONLY.
  */
-GstQuicLibError
-gst_quiclib_transport_send_buffer (GstQuicLibTransportConnection *conn,
-    GstBuffer *buf, ssize_t *bytes_written)
+static gboolean
+quiclib_relay_flush (gpointer user_data)
 {
-  GstQuicLibStreamMeta *smeta;
-  GstQuicLibDatagramMeta *dmeta;
+  GstQuicLibTransportConnection *upstream =
+      (GstQuicLibTransportConnection *) user_data;
+  GList *it;
 
-  smeta = gst_buffer_get_quiclib_stream_meta (buf);
-  if (smeta != NULL) {
-    return gst_quiclib_transport_send_stream (conn, buf, smeta->stream_id, 
-        bytes_written);
-  }
+  gst_quiclib_transport_context_lock (upstream);
 
-  dmeta = gst_buffer_get_quiclib_datagram_meta (buf);
-  if (dmeta != NULL) {
-    return gst_quiclib_transport_send_datagram (conn, buf, NULL, bytes_written);
+  g_atomic_int_set (&upstream->relay_flush_pending, 0);
+
+  for (it = upstream->relays; it != NULL; it = it->next) {
+    QuicLibRelayRule *rule = (QuicLibRelayRule *) it->data;
+    GHashTableIter iter;
+    gpointer value;
+
+    g_hash_table_iter_init (&iter, rule->streams);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+      if (quiclib_relay_flush_stream (rule, (QuicLibRelayStream *) value)) {
+        g_hash_table_iter_remove (&iter);
+      }
+    }
   }
 
-  return GST_QUICLIB_ERR;
+  gst_quiclib_transport_context_unlock (upstream);
+
+  return G_SOURCE_REMOVE;
 }
 
-gboolean
-_quiclib_transport_store_ack_bufs (GstQuicLibTransportConnection *conn,
-    GstBuffer *buf, GstQuicLibStreamContext *stream, gsize size)
+/**
+ * quiclib_relay_schedule_flushes
+ *
+ * Schedules a flush of the relay queues of every connection relaying onto
+ * @downstream. The flushes run on the upstream connections' loop threads, as
+ * the caller holds the context lock of @downstream which mustn't be held
+ * while taking an upstream connection's lock.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_relay_schedule_flushes (GstQuicLibTransportConnection *downstream)
 {
-  GstBuffer *store;
-
-  if (gst_buffer_get_size (buf) <= size) {
-    store = gst_buffer_ref (buf);
-  } else {
-    store = gst_buffer_copy_region (buf,
-        GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS |
-        GST_BUFFER_COPY_META | GST_BUFFER_COPY_MEMORY, 0, size);
-  }
+  GList *it;
 
-  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn), "Storing buffer %"
-      GST_PTR_FORMAT " of size %lu from original %lu with offset %lu", store,
-      size, gst_buffer_get_size (buf), buf->offset);
+  for (it = downstream->relay_upstreams; it != NULL; it = it->next) {
+    GstQuicLibTransportConnection *upstream =
+        (GstQuicLibTransportConnection *) it->data;
+    GstQuicLibTransportContextPrivate *priv =
+        gst_quiclib_transport_context_get_instance_private (
+            GST_QUICLIB_TRANSPORT_CONTEXT (upstream));
+    GSource *source;
 
-  g_mutex_lock (&stream->mutex);
-  stream->ack_bufs = g_list_append (stream->ack_bufs, (gpointer) store);
-  g_mutex_unlock (&stream->mutex);
+    if (priv->loop_context == NULL ||
+        !g_atomic_int_compare_and_exchange (&upstream->relay_flush_pending, 0,
+            1)) {
+      continue;
+    }
 
-  return stream->ack_bufs != NULL;
+    source = g_idle_source_new ();
+    g_source_set_callback (source, quiclib_relay_flush,
+        g_object_ref (upstream), g_object_unref);
+    g_source_attach (source, priv->loop_context);
+    g_source_unref (source);
+  }
 }
 
 /**
- * gst_quiclib_transport_send_stream
- * 
- * Send a buffer on a nominated stream ID. If stream ID is -1 and @buf contains
- * a buffer with a GstQuicLibStreamMeta, the stream ID carried in the meta will
- * be used instead.
- * 
- * @conn: Connection to send buffer on.
- * @buf: Buffer to send
- * @stream_id: Stream to send the buffer on.
- * @bytes_written: If non-NULL, returns the number of bytes written from @buf
- * @return GstQuicLibError 
+ * quiclib_relay_remove_rules
+ *
+ * Removes the relay rules of @upstream forwarding to @downstream, or all of
+ * them if @downstream is NULL. Any downstream streams still being relayed onto
+ * are reset.
+ *
+ * INTERNAL FUNCTION ONLY.
  */
-GstQuicLibError
-gst_quiclib_transport_send_stream (GstQuicLibTransportConnection *conn,
-    GstBuffer *buf, gint64 stream_id, ssize_t *bytes_written)
+static void
+quiclib_relay_remove_rules (GstQuicLibTransportConnection *upstream,
+    GstQuicLibTransportConnection *downstream)
 {
-  ssize_t _bytes_written = 0;
-  ngtcp2_vec *vec = NULL, *vec_orig;
-  GList *maps = NULL;
-  size_t n = 0;
-  GstQuicLibError rv = GST_QUICLIB_ERR_OK;
-  GstQuicLibStreamContext *stream;
-  GstQuicLibStreamMeta *meta = gst_buffer_get_quiclib_stream_meta (buf);
-  gsize buf_size = gst_buffer_get_size (buf);
-  guint64 max_stream_data;
+  GList *it, *link, *removed = NULL;
+  guint n_unref = 0;
 
-  if (stream_id < 0 && meta != NULL) {
-    stream_id = meta->stream_id;
-  }
+  gst_quiclib_transport_context_lock (upstream);
 
-  g_return_val_if_fail (stream_id >= 0, -1);
+  it = upstream->relays;
+  while (it != NULL) {
+    QuicLibRelayRule *rule = (QuicLibRelayRule *) it->data;
+    GList *next = it->next;
 
-  if (stream_id & 0x2) {
-    max_stream_data = ngtcp2_conn_get_remote_transport_params (conn->quic_conn)
-        ->initial_max_stream_data_uni;
-  } else if ((stream_id & 0x1 && conn->server) ||
-            !(conn->server || stream_id & 0x01)) {
-    max_stream_data = ngtcp2_conn_get_remote_transport_params (conn->quic_conn)
-        ->initial_max_stream_data_bidi_remote;
-  } else {
-    max_stream_data = ngtcp2_conn_get_remote_transport_params (conn->quic_conn)
-        ->initial_max_stream_data_bidi_local;
+    if (downstream == NULL || rule->downstream == downstream) {
+      upstream->relays = g_list_delete_link (upstream->relays, it);
+      removed = g_list_prepend (removed, rule);
+    }
+
+    it = next;
   }
 
-  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-      "Received %lu bytes to send on stream %lu with %lu bytes stream data "
-      "remaining of %lu", buf_size, stream_id,
-      ngtcp2_conn_get_max_stream_data_left (conn->quic_conn, stream_id),
-      max_stream_data);
+  for (it = removed; it != NULL; it = it->next) {
+    QuicLibRelayRule *rule = (QuicLibRelayRule *) it->data;
+    GHashTableIter iter;
+    gpointer value;
 
-  /*quiclib_transport_print_buffer (GST_QUICLIB_TRANSPORT_CONTEXT (conn), buf);*/
+    g_hash_table_iter_init (&iter, rule->streams);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+      quiclib_relay_drop_stream (rule, (QuicLibRelayStream *) value,
+          QUICLIB_RELAY_DROPPED_ERROR);
+    }
 
-  if (!g_hash_table_lookup_extended (conn->streams, &stream_id, NULL,
-      (gpointer *) &stream)){
-    GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Couldn't find stream context for stream %ld", stream_id);
-    return GST_QUICLIB_ERR_STREAM_CLOSED;
+    gst_quiclib_transport_context_lock (rule->downstream);
+    link = g_list_find (rule->downstream->relay_upstreams, upstream);
+    if (link != NULL) {
+      rule->downstream->relay_upstreams =
+          g_list_delete_link (rule->downstream->relay_upstreams, link);
+      n_unref++;
+    }
+    gst_quiclib_transport_context_unlock (rule->downstream);
   }
 
-  buf->offset = stream->last_offset;
+  gst_quiclib_transport_context_unlock (upstream);
 
-  if (buf_size > 0) {
-    n = quiclib_buffer_to_vec (buf, &vec, &maps);
-    vec_orig = vec;
+  g_list_free_full (removed, (GDestroyNotify) quiclib_relay_rule_free);
 
-    g_return_val_if_fail (n != 0, -1);
+  /* Dropped outside the lock, as one of these could be the last reference */
+  while (n_unref-- > 0) {
+    g_object_unref (upstream);
   }
+}
 
-  do {
-    ssize_t _b_written = quiclib_ngtcp2_conn_write (conn, stream_id, vec, n,
-      meta->final);
+/*
+ * A change to the relay rules of an upstream connection. Rules are only
+ * changed on the upstream connection's loop thread, as the downstream
+ * connection's lock may be held by the caller, such as from a handshake
+ * callback, and mustn't be held while taking the upstream connection's lock.
+ */
+typedef struct {
+  GstQuicLibTransportConnection *upstream;
+  GstQuicLibTransportConnection *downstream;
+  /* The rule to add, or NULL to remove the rules for downstream */
+  QuicLibRelayRule *rule;
+} QuicLibRelayOp;
 
-    if (_b_written < 0) {
-      GST_ERROR_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-          "quiclib_ngtcp2_conn_write returned error %s",
-          gst_quiclib_error_as_string((GstQuicLibError) _b_written));
-      rv = _b_written;
-      if (_b_written == GST_QUICLIB_ERR_STREAM_CLOSED) {
-        stream = NULL;
-      }
-      break;
-    }
+static void
+quiclib_relay_op_free (gpointer data)
+{
+  QuicLibRelayOp *op = (QuicLibRelayOp *) data;
 
+  if (op->rule != NULL) {
+    quiclib_relay_rule_free (op->rule);
+  }
+  g_object_unref (op->downstream);
+  g_object_unref (op->upstream);
+  g_free (op);
+}
 
-    _bytes_written += _b_written;
-    GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-        "Written %ld bytes of data on stream %ld, %ld remaining of %ld - "
-        "cwnd %lu, stream data %lu, max data %lu", _b_written, stream_id,
-        buf_size - _bytes_written, buf_size,
-        ngtcp2_conn_get_cwnd_left (conn->quic_conn),
-        ngtcp2_conn_get_max_stream_data_left (conn->quic_conn, stream_id),
-        ngtcp2_conn_get_max_data_left (conn->quic_conn));
+static gboolean
+quiclib_relay_op_run (gpointer data)
+{
+  QuicLibRelayOp *op = (QuicLibRelayOp *) data;
 
-    if (_b_written == 0) {
-      /*
-       * Wait until there's flow window to send again
-       */
-      g_mutex_lock (&conn->mutex);
+  if (op->rule == NULL) {
+    quiclib_relay_remove_rules (op->upstream, op->downstream);
+    return G_SOURCE_REMOVE;
+  }
 
-      while (ngtcp2_conn_get_cwnd_left (conn->quic_conn) == 0) {
-        gint64 end_time;
+  gst_quiclib_transport_context_lock (op->upstream);
 
-        /*
-         * TODO: Is it worth having the end time be configurable? 100ms is very
-         * much a finger-in-the-air value to stop it busy waiting.
-         */
-        end_time = g_get_monotonic_time () + (100 * G_TIME_SPAN_MILLISECOND);
-        GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-            "No congestion window left, waiting until %lu", end_time);
-        g_cond_wait_until (&conn->cond, &conn->mutex, end_time);
-      }
+  op->upstream->relays = g_list_append (op->upstream->relays, op->rule);
 
-      g_mutex_unlock (&conn->mutex);
-    }
-    if (buf_size - _bytes_written > 0) {
-      /* Adjust the vectors as necessary */
+  gst_quiclib_transport_context_lock (op->downstream);
+  if (g_list_find (op->downstream->relay_upstreams, op->upstream) == NULL) {
+    op->downstream->relay_upstreams =
+        g_list_prepend (op->downstream->relay_upstreams,
+            g_object_ref (op->upstream));
+  }
+  gst_quiclib_transport_context_unlock (op->downstream);
 
-      while (_b_written >= vec[0].len) {
-        _b_written -= vec[0].len;
-        vec += 1; /* Go to the next buffer in the vector */
-        n -= 1;
-      }
+  gst_quiclib_transport_context_unlock (op->upstream);
 
-      if (_b_written > 0) {
-        vec[0].base += _b_written;
-        vec[0].len -= (size_t) _b_written;
-      }
-    }
-  } while (_bytes_written < buf_size);
+  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (op->upstream),
+      "Relaying %s%ld onto connection %p",
+      (op->rule->stream_id < 0) ? "all streams" : "stream ",
+      (op->rule->stream_id < 0) ? 0 : op->rule->stream_id, op->downstream);
 
-  GST_DEBUG_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
-      "Written %ld total bytes from %ld", _bytes_written, buf_size);
+  op->rule = NULL;
 
-  quiclib_buffer_unmap (&maps);
+  return G_SOURCE_REMOVE;
+}
 
-  if (stream) {
-    stream->last_offset += (gsize) _bytes_written;
-    _quiclib_transport_store_ack_bufs (conn, buf, stream, _bytes_written);
-  }
+/**
+ * quiclib_relay_op_schedule
+ *
+ * Runs @op on the loop thread of its upstream connection, or straight away if
+ * the upstream connection has no loop thread yet.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_relay_op_schedule (QuicLibRelayOp *op)
+{
+  GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (
+          GST_QUICLIB_TRANSPORT_CONTEXT (op->upstream));
+  GSource *source;
 
-  if (buf_size > 0) {
-    g_free (vec_orig);
+  if (priv->loop_context == NULL) {
+    quiclib_relay_op_run (op);
+    quiclib_relay_op_free (op);
+    return;
   }
 
-  if (bytes_written) *bytes_written = _bytes_written;
-  
-  return rv;
+  source = g_idle_source_new ();
+  g_source_set_callback (source, quiclib_relay_op_run, op,
+      quiclib_relay_op_free);
+  g_source_attach (source, priv->loop_context);
+  g_source_unref (source);
 }
 
-GstQuicLibError
-gst_quiclib_transport_send_datagram (GstQuicLibTransportConnection *conn,
-    GstBuffer *buf, GstQuicLibDatagramTicket *ticket, ssize_t *bytes_written)
+/**
+ * gst_quiclib_transport_relay_add
+ *
+ * Adds a rule forwarding streams received on @upstream onto new streams of
+ * @downstream, directly from the loop thread of @upstream. Relayed streams
+ * aren't passed to the transport user of @upstream, and a stream that is
+ * already under way when the rule takes effect isn't relayed. Each buffer
+ * received is sent to every downstream connection from the same memory.
+ *
+ * Relaying never blocks @upstream. Data that @downstream can't send yet is
+ * queued, and if more than @max_queued bytes of a stream are waiting, the
+ * downstream stream is reset and the rest of that stream is dropped.
+ *
+ * The rule takes effect on the loop thread of @upstream, so this is safe to
+ * call from the transport callbacks of either connection. Rules mustn't form
+ * a cycle between connections that run on different loop threads.
+ *
+ * While a rule exists, @upstream and @downstream hold references to each
+ * other, so rules must be removed with gst_quiclib_transport_relay_remove
+ * for the connections to be freed.
+ *
+ * @upstream: The connection to relay from.
+ * @downstream: The connection to relay onto.
+ * @stream_id: The stream of @upstream to relay, or -1 for all of them.
+ * @datagrams: Whether to also relay DATAGRAM frames. Those that @downstream
+ *    can't send straight away are dropped.
+ * @max_queued: The most bytes of each stream to queue for @downstream, or 0
+ *    for no limit.
+ * @return TRUE if the rule will be added.
+ */
+gboolean
+gst_quiclib_transport_relay_add (GstQuicLibTransportConnection *upstream,
+    GstQuicLibTransportConnection *downstream, gint64 stream_id,
+    gboolean datagrams, gsize max_queued)
 {
-  ssize_t _bytes_written;
-  ngtcp2_vec *vec = NULL;
-  GList *maps = NULL;
-  size_t n = quiclib_buffer_to_vec (buf, &vec, &maps);
+  QuicLibRelayOp *op;
 
-  g_return_val_if_fail (n != 0, -1);
+  g_return_val_if_fail (upstream != NULL && downstream != NULL, FALSE);
+  g_return_val_if_fail (upstream != downstream, FALSE);
 
-  _bytes_written = quiclib_ngtcp2_datagram_write (conn, vec, n);
+  op = g_new0 (QuicLibRelayOp, 1);
+  op->upstream = g_object_ref (upstream);
+  op->downstream = g_object_ref (downstream);
+  op->rule = g_new0 (QuicLibRelayRule, 1);
+  op->rule->downstream = g_object_ref (downstream);
+  op->rule->stream_id = stream_id;
+  op->rule->datagrams = datagrams;
+  op->rule->max_queued = max_queued;
+  op->rule->streams = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+      g_free, quiclib_relay_stream_free);
 
-  if (_bytes_written > 0 && ticket != NULL) {
+  quiclib_relay_op_schedule (op);
 
-    *ticket = conn->datagram_ticket++;
-  }
+  return TRUE;
+}
+
+/**
+ * gst_quiclib_transport_relay_remove
+ *
+ * Removes all of the relay rules forwarding from @upstream onto @downstream.
+ * Streams of @downstream still being relayed onto are reset. Like adding a
+ * rule, this takes effect on the loop thread of @upstream.
+ *
+ * @upstream: The connection being relayed from.
+ * @downstream: The connection being relayed onto.
+ */
+void
+gst_quiclib_transport_relay_remove (GstQuicLibTransportConnection *upstream,
+    GstQuicLibTransportConnection *downstream)
+{
+  QuicLibRelayOp *op;
+
+  g_return_if_fail (upstream != NULL && downstream != NULL);
 
-  quiclib_buffer_unmap (&maps);
+  op = g_new0 (QuicLibRelayOp, 1);
+  op->upstream = g_object_ref (upstream);
+  op->downstream = g_object_ref (downstream);
 
-  if (_bytes_written > 0 && bytes_written) *bytes_written = _bytes_written;
-  
-  return (bytes_written >= 0)?(GST_QUICLIB_ERR_OK):(
-      (GstQuicLibError) bytes_written);
+  quiclib_relay_op_schedule (op);
 }
 
 static void
@@ -5630,6 +14024,7 @@ gst_quiclib_transport_get_conn_stats (GstQuicLibTransportConnection *conn,
   guint64 one_sec_ago;
   guint64 receive_bps = 0;
   guint64 send_bps = 0;
+  guint64 last_ect_ts, last_not_ect_ts;
   GList *it;
 
   if (conn == NULL || conn_stats == NULL) {
@@ -5637,16 +14032,16 @@ gst_quiclib_transport_get_conn_stats (GstQuicLibTransportConnection *conn,
   }
 
   clock_gettime (CLOCK_REALTIME, &ts);
-  one_sec_ago = (ts.tv_sec * 1000000000) + ts.tv_nsec - 1000000000;
+  one_sec_ago = ((guint64) ts.tv_sec * 1000000000) + ts.tv_nsec - 1000000000;
 
   g_mutex_lock (&conn->stats.mutex);
-  for (it = conn->stats.bytes_received; it != NULL; it = it->next) {
+  for (it = conn->stats.bytes_received.head; it != NULL; it = it->next) {
     if (((GstQuicLibPacketStats *) it->data)->timestamp_ns > one_sec_ago) {
       receive_bps += ((GstQuicLibPacketStats *) it->data)->bytes;
     }
   }
 
-  for (it = conn->stats.bytes_sent; it != NULL; it = it->next) {
+  for (it = conn->stats.bytes_sent.head; it != NULL; it = it->next) {
     if (((GstQuicLibPacketStats *) it->data)->timestamp_ns > one_sec_ago) {
       send_bps += ((GstQuicLibPacketStats *) it->data)->bytes;
     }
@@ -5668,5 +14063,594 @@ gst_quiclib_transport_get_conn_stats (GstQuicLibTransportConnection *conn,
   conn_stats->pkt_counts.sent = conn->stats.pkt_counts.sent;
   conn_stats->pkt_counts.received = conn->stats.pkt_counts.received;
 
+  g_mutex_lock (&conn->stats.mutex);
+  conn_stats->rx_delivery = conn->stats.rx_delivery;
+  conn_stats->rx_queueing = conn->stats.rx_queueing;
+  conn_stats->shaping.delay = conn->stats.shaping_delay;
+  g_mutex_unlock (&conn->stats.mutex);
+
+  conn_stats->shaping.queued_bytes = 0;
+  gst_quiclib_transport_context_lock (conn);
+  for (it = conn->shaped_streams; it != NULL; it = it->next) {
+    GstQuicLibStreamContext *stream;
+
+    if (g_hash_table_lookup_extended (conn->streams, it->data, NULL,
+        (gpointer *) &stream)) {
+      conn_stats->shaping.queued_bytes += stream->shaped_bytes;
+    }
+  }
+  conn_stats->mem.held = conn->mem_pool.held;
+  conn_stats->mem.cached = conn->mem_pool.cached;
+  conn_stats->pinned.retained = quiclib_mem_read (&conn->memory->retained);
+  conn_stats->pinned.datagrams = quiclib_mem_read (&conn->memory->datagrams);
+  conn_stats->pinned.shaped = quiclib_mem_read (&conn->memory->shaped);
+  conn_stats->pinned.received = quiclib_mem_read (&conn->memory->received);
+  conn_stats->pinned.quic = conn->mem_pool.held + conn->mem_pool.cached;
+  conn_stats->pinned.total = quiclib_conn_memory (conn);
+  conn_stats->pinned.limited = quiclib_mem_read (&conn->memory->limited);
+  conn_stats->pinned.shed = quiclib_mem_read (&conn->memory->shed);
+
+  memset (&conn_stats->alloc, 0, sizeof (conn_stats->alloc));
+  quiclib_slab_count (&conn->cid_slab, conn_stats);
+  quiclib_slab_count (&conn->stat_slab, conn_stats);
+  quiclib_slab_count (&conn->id_slab, conn_stats);
+  quiclib_slab_count (&conn->dgram_slab, conn_stats);
+  quiclib_slab_count (&conn->unmap_slab, conn_stats);
+  gst_quiclib_transport_context_unlock (conn);
+
+  g_mutex_lock (&conn->stats.mutex);
+  conn_stats->ecn.tx_ect0 = conn->stats.ecn.tx[NGTCP2_ECN_ECT_0];
+  conn_stats->ecn.tx_ect1 = conn->stats.ecn.tx[NGTCP2_ECN_ECT_1];
+  conn_stats->ecn.rx_ect0 = conn->stats.ecn.rx[NGTCP2_ECN_ECT_0];
+  conn_stats->ecn.rx_ect1 = conn->stats.ecn.rx[NGTCP2_ECN_ECT_1];
+  conn_stats->ecn.rx_ce = conn->stats.ecn.rx[NGTCP2_ECN_CE];
+  last_ect_ts = conn->stats.ecn.last_ect_ts;
+  last_not_ect_ts = conn->stats.ecn.last_not_ect_ts;
+  g_mutex_unlock (&conn->stats.mutex);
+
+  /*
+   * ngtcp2 marks a handful of packets to test the path, then stops until the
+   * peer's ACKs show whether the marks got through. It only carries on
+   * marking if they did, so more marks than the test allows means the path
+   * validated. If it's sent unmarked packets for a few PTOs since the last
+   * test packet, it has given up.
+   */
+  if (conn_stats->ecn.tx_ect0 + conn_stats->ecn.tx_ect1 == 0) {
+    conn_stats->ecn.validation = GST_QUICLIB_ECN_VALIDATION_NONE;
+  } else if (conn_stats->ecn.tx_ect0 + conn_stats->ecn.tx_ect1 >
+      QUICLIB_ECN_VALIDATION_PKTS) {
+    conn_stats->ecn.validation = GST_QUICLIB_ECN_VALIDATION_CAPABLE;
+  } else if (last_not_ect_ts >
+      last_ect_ts + 3 * ngtcp2_conn_get_pto (conn->quic_conn)) {
+    conn_stats->ecn.validation = GST_QUICLIB_ECN_VALIDATION_FAILED;
+  } else {
+    conn_stats->ecn.validation = GST_QUICLIB_ECN_VALIDATION_TESTING;
+  }
+
+  memset (&conn_stats->io, 0, sizeof (conn_stats->io));
+  /* A migration can swap and free the socket, so only look at it locked */
+  gst_quiclib_transport_context_lock (conn);
+  if (conn->socket != NULL) {
+    conn_stats->io.backend = conn->socket->backend;
+
+    g_mutex_lock (&conn->socket->io_stats_mutex);
+    conn_stats->io.rx_packets = conn->socket->io_stats.rx_packets;
+    conn_stats->io.tx_packets = conn->socket->io_stats.tx_packets;
+    conn_stats->io.rx_cpu_ns = conn->socket->io_stats.rx_cpu_ns;
+    conn_stats->io.zerocopy_sent = conn->socket->io_stats.zerocopy_sent;
+    conn_stats->io.zerocopy_copied = conn->socket->io_stats.zerocopy_copied;
+    conn_stats->io.zerocopy_fallback =
+        conn->socket->io_stats.zerocopy_fallback;
+    g_mutex_unlock (&conn->socket->io_stats_mutex);
+  }
+  gst_quiclib_transport_context_unlock (conn);
+
+  return TRUE;
+}
+
+gboolean
+gst_quiclib_transport_get_path_load (GstQuicLibTransportConnection *conn,
+    guint64 *smoothed_rtt, guint64 *cwnd, guint64 *bytes_in_flight)
+{
+  ngtcp2_conn_info cinfo;
+
+  if (conn == NULL || conn->quic_conn == NULL) {
+    return FALSE;
+  }
+
+  gst_quiclib_transport_context_lock (conn);
+  ngtcp2_conn_get_conn_info (conn->quic_conn, &cinfo);
+  gst_quiclib_transport_context_unlock (conn);
+
+  if (smoothed_rtt != NULL) *smoothed_rtt = cinfo.smoothed_rtt;
+  if (cwnd != NULL) *cwnd = cinfo.cwnd;
+  if (bytes_in_flight != NULL) *bytes_in_flight = cinfo.bytes_in_flight;
+
+  return TRUE;
+}
+
+static void
+_quiclib_latency_histogram_merge (GstQuicLibLatencyHistogram *total,
+    const GstQuicLibLatencyHistogram *hist)
+{
+  gint i;
+
+  for (i = 0; i < GST_QUICLIB_LATENCY_HISTOGRAM_BUCKETS; i++) {
+    total->buckets[i] += hist->buckets[i];
+  }
+  total->count += hist->count;
+  total->sum += hist->sum;
+  total->max = MAX (total->max, hist->max);
+}
+
+gboolean
+gst_quiclib_transport_get_striped_conn_stats (
+    GstQuicLibTransportConnection **conns, guint n_conns,
+    GstQuicLibConnStats *conn_stats)
+{
+  GstQuicLibConnStats stats;
+  GList *sockets = NULL;
+  gboolean found = FALSE;
+  guint i;
+
+  if (conns == NULL || conn_stats == NULL) {
+    return FALSE;
+  }
+
+  memset (conn_stats, 0, sizeof (*conn_stats));
+
+  for (i = 0; i < n_conns; i++) {
+    memset (&stats, 0, sizeof (stats));
+    if (!gst_quiclib_transport_get_conn_stats (conns[i], &stats)) {
+      continue;
+    }
+
+    if (!found) {
+      conn_stats->quic_implementation = stats.quic_implementation;
+      conn_stats->quic_implementation_version =
+          stats.quic_implementation_version;
+      conn_stats->rtt.min = stats.rtt.min;
+      conn_stats->io.backend = stats.io.backend;
+      found = TRUE;
+    }
+
+    conn_stats->rtt.min = MIN (conn_stats->rtt.min, stats.rtt.min);
+    conn_stats->rtt.meandev = MAX (conn_stats->rtt.meandev,
+        stats.rtt.meandev);
+    conn_stats->rtt.smoothed = MAX (conn_stats->rtt.smoothed,
+        stats.rtt.smoothed);
+    conn_stats->cwnd += stats.cwnd;
+    conn_stats->bytes_in_flight += stats.bytes_in_flight;
+    conn_stats->rate.send += stats.rate.send;
+    conn_stats->rate.receive += stats.rate.receive;
+    conn_stats->pkt_counts.sent += stats.pkt_counts.sent;
+    conn_stats->pkt_counts.received += stats.pkt_counts.received;
+    conn_stats->pkt_counts.rtx += stats.pkt_counts.rtx;
+
+    _quiclib_latency_histogram_merge (&conn_stats->rx_delivery,
+        &stats.rx_delivery);
+    _quiclib_latency_histogram_merge (&conn_stats->rx_queueing,
+        &stats.rx_queueing);
+    _quiclib_latency_histogram_merge (&conn_stats->shaping.delay,
+        &stats.shaping.delay);
+    conn_stats->shaping.queued_bytes += stats.shaping.queued_bytes;
+    conn_stats->mem.held += stats.mem.held;
+    conn_stats->mem.cached += stats.mem.cached;
+    conn_stats->alloc.objects += stats.alloc.objects;
+    conn_stats->alloc.refills += stats.alloc.refills;
+    conn_stats->alloc.in_use += stats.alloc.in_use;
+    conn_stats->pinned.retained += stats.pinned.retained;
+    conn_stats->pinned.datagrams += stats.pinned.datagrams;
+    conn_stats->pinned.shaped += stats.pinned.shaped;
+    conn_stats->pinned.received += stats.pinned.received;
+    conn_stats->pinned.quic += stats.pinned.quic;
+    conn_stats->pinned.total += stats.pinned.total;
+    conn_stats->pinned.limited += stats.pinned.limited;
+    conn_stats->pinned.shed += stats.pinned.shed;
+
+    /* The enum is ordered so that the highest value is the most telling */
+    conn_stats->ecn.validation = MAX (conn_stats->ecn.validation,
+        stats.ecn.validation);
+    conn_stats->ecn.tx_ect0 += stats.ecn.tx_ect0;
+    conn_stats->ecn.tx_ect1 += stats.ecn.tx_ect1;
+    conn_stats->ecn.rx_ect0 += stats.ecn.rx_ect0;
+    conn_stats->ecn.rx_ect1 += stats.ecn.rx_ect1;
+    conn_stats->ecn.rx_ce += stats.ecn.rx_ce;
+
+    /* Connections accepted by the same server share a socket */
+    if (conns[i]->socket != NULL &&
+        g_list_find (sockets, conns[i]->socket) == NULL) {
+      sockets = g_list_prepend (sockets, conns[i]->socket);
+
+      conn_stats->io.rx_packets += stats.io.rx_packets;
+      conn_stats->io.tx_packets += stats.io.tx_packets;
+      conn_stats->io.rx_cpu_ns += stats.io.rx_cpu_ns;
+      conn_stats->io.zerocopy_sent += stats.io.zerocopy_sent;
+      conn_stats->io.zerocopy_copied += stats.io.zerocopy_copied;
+      conn_stats->io.zerocopy_fallback += stats.io.zerocopy_fallback;
+    }
+  }
+
+  g_list_free (sockets);
+
+  return found;
+}
+
+/*
+ * Delivery rate samples are taken over at least a smoothed RTT, and no less
+ * than this, so that a burst of ACKs doesn't read as a huge rate.
+ */
+#define QUICLIB_BWE_MIN_SAMPLE_INTERVAL (50 * NGTCP2_MILLISECONDS)
+
+/*
+ * When the sender isn't using its whole congestion window, the estimate may
+ * only run this fraction (in 1/8ths) ahead of what has actually been
+ * delivered, so that encoders ramp up over a few updates.
+ */
+#define QUICLIB_BWE_APP_LIMITED_GAIN 10
+
+/*
+ * Queueing delay that is tolerated before the estimate is backed off, as a
+ * fraction (in 1/8ths) of the minimum RTT.
+ */
+#define QUICLIB_BWE_QUEUE_TOLERANCE 1
+
+guint64
+gst_quiclib_transport_get_bitrate_estimate (
+    GstQuicLibTransportConnection *conn)
+{
+  ngtcp2_conn_info cinfo;
+  ngtcp2_tstamp now, elapsed;
+  guint64 cwnd_rate, delivery_rate, base, queue_delay, tolerance;
+  gboolean app_limited;
+
+  if (conn == NULL || conn->quic_conn == NULL) {
+    return 0;
+  }
+
+  gst_quiclib_transport_context_lock (conn);
+
+  ngtcp2_conn_get_conn_info (conn->quic_conn, &cinfo);
+  if (cinfo.smoothed_rtt == 0) {
+    gst_quiclib_transport_context_unlock (conn);
+    return 0;
+  }
+
+  /* What the congestion controller will currently let through */
+  cwnd_rate = cinfo.cwnd * 8 * NGTCP2_SECONDS / cinfo.smoothed_rtt;
+  app_limited = cinfo.bytes_in_flight < cinfo.cwnd / 2;
+
+  /*
+   * What the path has actually delivered. Samples taken while the sender
+   * wasn't filling the window only show how much it had to send, so they may
+   * only raise the smoothed rate.
+   */
+  now = quiclib_ngtcp2_timestamp ();
+  if (conn->bwe.sample_start == 0) {
+    conn->bwe.sample_start = now;
+    conn->bwe.acked = 0;
+  }
+
+  elapsed = now - conn->bwe.sample_start;
+  if (elapsed >= MAX (cinfo.smoothed_rtt, QUICLIB_BWE_MIN_SAMPLE_INTERVAL)) {
+    guint64 sample = conn->bwe.acked * 8 * NGTCP2_SECONDS / elapsed;
+
+    if (conn->bwe.delivery_rate == 0) {
+      conn->bwe.delivery_rate = sample;
+    } else if (!app_limited || sample > conn->bwe.delivery_rate) {
+      conn->bwe.delivery_rate = (7 * conn->bwe.delivery_rate + sample) / 8;
+    }
+
+    conn->bwe.sample_start = now;
+    conn->bwe.acked = 0;
+  }
+
+  delivery_rate = conn->bwe.delivery_rate;
+  if (delivery_rate == 0) {
+    base = cwnd_rate;
+  } else if (app_limited) {
+    base = MIN (cwnd_rate, delivery_rate * QUICLIB_BWE_APP_LIMITED_GAIN / 8);
+  } else {
+    base = MIN (cwnd_rate, delivery_rate);
+  }
+
+  /*
+   * A smoothed RTT above the minimum means a queue is standing somewhere on
+   * the path. Scale back by how much it inflates the RTT, and by as much
+   * again if it has grown since the last estimate, so that the queue drains
+   * rather than just stops growing.
+   */
+  queue_delay = cinfo.smoothed_rtt > cinfo.min_rtt ?
+      cinfo.smoothed_rtt - cinfo.min_rtt : 0;
+  tolerance = cinfo.min_rtt * QUICLIB_BWE_QUEUE_TOLERANCE / 8;
+
+  if (queue_delay > tolerance) {
+    base = base * (cinfo.min_rtt + tolerance) / cinfo.smoothed_rtt;
+
+    if (queue_delay > conn->bwe.queue_delay) {
+      base = base * (cinfo.min_rtt + tolerance) / cinfo.smoothed_rtt;
+    }
+  }
+  conn->bwe.queue_delay = queue_delay;
+
+  gst_quiclib_transport_context_unlock (conn);
+
+  GST_TRACE_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn), "Bitrate estimate "
+      "%lu bps (cwnd rate %lu bps, delivery rate %lu bps%s, queueing delay "
+      "%lu ns)", base, cwnd_rate, delivery_rate,
+      app_limited ? ", app limited" : "", queue_delay);
+
+  return base;
+}
+
+gboolean
+gst_quiclib_transport_get_latency (GstQuicLibTransportConnection *conn,
+    guint64 *smoothed, guint64 *worst_case)
+{
+  ngtcp2_conn_info cinfo;
+  guint64 rx_smoothed, rx_meandev;
+
+  if (conn == NULL || conn->quic_conn == NULL) {
+    return FALSE;
+  }
+
+  gst_quiclib_transport_context_lock (conn);
+  ngtcp2_conn_get_conn_info (conn->quic_conn, &cinfo);
+  gst_quiclib_transport_context_unlock (conn);
+
+  g_mutex_lock (&conn->stats.mutex);
+  rx_smoothed = conn->stats.rx_delivery_smoothed;
+  rx_meandev = conn->stats.rx_delivery_meandev;
+  g_mutex_unlock (&conn->stats.mutex);
+
+  if (smoothed) {
+    *smoothed = cinfo.smoothed_rtt / 2 + rx_smoothed;
+  }
+
+  /* The same bound that RFC 9002 section 6.2.1 puts on the PTO */
+  if (worst_case) {
+    *worst_case = (cinfo.smoothed_rtt + 4 * cinfo.rttvar) / 2 + rx_smoothed +
+        4 * rx_meandev;
+  }
+
   return TRUE;
 }
+
+/*
+ * Probing.
+ *
+ * At the start of a session nothing is known about the path capacity, and
+ * media encoders start conservatively, which leaves congestion control to
+ * ramp up slowly on what little they send. When the probe-duration property
+ * is set, the spare congestion window is filled with probe DATAGRAM frames for
+ * that long after the handshake, so that congestion control ramps up to the
+ * path capacity straight away. A quarter of the window is left for the
+ * application's own data. The probes carry QUICLIB_PROBE_MAGIC, and are
+ * discarded by the receiving end rather than handed to the transport user,
+ * as long as it has the probe-duration property set too.
+ *
+ * The delivery rate is sampled over each RTT of the probe, and the capacity
+ * is the highest sample capped by what the congestion window allows at the
+ * end. This seeds the bitrate estimate so that it doesn't have to climb back
+ * up from what the application was sending.
+ */
+#define QUICLIB_PROBE_MAGIC "GstQuicLibProbe"
+#define QUICLIB_PROBE_SIZE 1100
+#define QUICLIB_PROBE_INTERVAL_MS 5
+#define QUICLIB_PROBE_MAX_BURST 64
+
+/**
+ * quiclib_probe_is_probe
+ *
+ * Returns TRUE if the DATAGRAM frame payload @data received on @conn is a
+ * capacity probe. Probes are only looked for when @conn has probing enabled
+ * itself, so that an application's own datagrams can never be mistaken for
+ * them.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_probe_is_probe (GstQuicLibTransportConnection *conn,
+    const uint8_t *data, size_t datalen)
+{
+  GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (
+          GST_QUICLIB_TRANSPORT_CONTEXT (conn));
+
+  return priv->probe_duration > 0 &&
+      datalen >= sizeof (QUICLIB_PROBE_MAGIC) &&
+      memcmp (data, QUICLIB_PROBE_MAGIC, sizeof (QUICLIB_PROBE_MAGIC)) == 0;
+}
+
+/**
+ * quiclib_probe_finish
+ *
+ * Works out the capacity found by the probe of @conn, and seeds the bitrate
+ * estimate with it. Call with the context lock held.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_probe_finish (GstQuicLibTransportConnection *conn,
+    const ngtcp2_conn_info *cinfo)
+{
+  guint64 cwnd_rate = 0, result;
+
+  if (cinfo->smoothed_rtt > 0) {
+    cwnd_rate = cinfo->cwnd * 8 * NGTCP2_SECONDS / cinfo->smoothed_rtt;
+  }
+
+  if (conn->probe.max_rate > 0 && cwnd_rate > 0) {
+    result = MIN (conn->probe.max_rate, cwnd_rate);
+  } else {
+    result = MAX (conn->probe.max_rate, cwnd_rate);
+  }
+
+  conn->probe.result = result;
+  conn->probe.done = TRUE;
+  conn->probe.end = 0;
+  conn->bwe.delivery_rate = MAX (conn->bwe.delivery_rate, result);
+
+  GST_INFO_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn), "Probing finished "
+      "after sending %lu bytes of probes, capacity estimate %lu bps (delivery "
+      "rate %lu bps, cwnd rate %lu bps)", conn->probe.sent, result,
+      conn->probe.max_rate, cwnd_rate);
+}
+
+/**
+ * quiclib_probe_tick
+ *
+ * Timeout callback run on the loop thread while @conn is probing. Takes a
+ * delivery rate sample each RTT, and tops up the congestion window with
+ * probes.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static gboolean
+quiclib_probe_tick (gpointer user_data)
+{
+  GstQuicLibTransportConnection *conn =
+      (GstQuicLibTransportConnection *) user_data;
+  ngtcp2_conn_info cinfo;
+  ngtcp2_tstamp now, elapsed;
+  GstMapInfo map;
+  gsize max_udp_size;
+  guint burst = 0;
+
+  gst_quiclib_transport_context_lock (conn);
+
+  if (conn->probe.end == 0 || gst_quiclib_transport_get_state (
+      GST_QUICLIB_TRANSPORT_CONTEXT (conn)) != QUIC_STATE_OPEN) {
+    conn->probe.end = 0;
+    gst_quiclib_transport_context_unlock (conn);
+    return G_SOURCE_REMOVE;
+  }
+
+  now = quiclib_ngtcp2_timestamp ();
+  ngtcp2_conn_get_conn_info (conn->quic_conn, &cinfo);
+
+  elapsed = now - conn->probe.sample_start;
+  if (elapsed >= MAX (cinfo.smoothed_rtt, QUICLIB_BWE_MIN_SAMPLE_INTERVAL)) {
+    conn->probe.max_rate = MAX (conn->probe.max_rate,
+        conn->probe.acked * 8 * NGTCP2_SECONDS / elapsed);
+    conn->probe.acked = 0;
+    conn->probe.sample_start = now;
+  }
+
+  if (now >= conn->probe.end) {
+    quiclib_probe_finish (conn, &cinfo);
+    gst_quiclib_transport_context_unlock (conn);
+    return G_SOURCE_REMOVE;
+  }
+
+  max_udp_size = ngtcp2_conn_get_max_tx_udp_payload_size (conn->quic_conn);
+
+  gst_buffer_map (conn->probe.buf, &map, GST_MAP_READ);
+
+  while (burst < QUICLIB_PROBE_MAX_BURST &&
+      ngtcp2_conn_get_cwnd_left (conn->quic_conn) >
+          cinfo.cwnd / 4 + max_udp_size) {
+    ngtcp2_vec vec = {(uint8_t *) map.data, map.size};
+    guint64 ticket = conn->datagram_ticket;
+
+    if (quiclib_ngtcp2_datagram_write (conn, &vec, 1, -1) <= 0 ||
+        conn->datagram_ticket == ticket) {
+      break;
+    }
+
+    quiclib_track_datagram_ack (conn, ticket, conn->probe.buf);
+
+    conn->probe.sent += map.size;
+    burst++;
+  }
+
+  gst_buffer_unmap (conn->probe.buf, &map);
+
+  gst_quiclib_transport_context_unlock (conn);
+
+  return G_SOURCE_CONTINUE;
+}
+
+/**
+ * quiclib_probe_start
+ *
+ * Starts probing the path capacity of @conn if the probe-duration property is
+ * set and the peer accepts DATAGRAM frames. Called on the loop thread when the
+ * handshake completes.
+ *
+ * INTERNAL FUNCTION ONLY.
+ */
+static void
+quiclib_probe_start (GstQuicLibTransportConnection *conn)
+{
+  GstQuicLibTransportContextPrivate *priv =
+      gst_quiclib_transport_context_get_instance_private (
+          GST_QUICLIB_TRANSPORT_CONTEXT (conn));
+  const ngtcp2_transport_params *remote_params;
+  GSource *source;
+  gsize size;
+  guint8 *payload;
+
+  if (priv->probe_duration == 0 || priv->loop_context == NULL) {
+    return;
+  }
+
+  remote_params = ngtcp2_conn_get_remote_transport_params (conn->quic_conn);
+  if (remote_params == NULL || remote_params->max_datagram_frame_size <=
+      sizeof (QUICLIB_PROBE_MAGIC) + 8) {
+    GST_WARNING_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+        "Not probing the path capacity as the peer doesn't accept DATAGRAM "
+        "frames");
+    return;
+  }
+
+  /* Leave room for the DATAGRAM frame type and length */
+  size = MIN (QUICLIB_PROBE_SIZE, remote_params->max_datagram_frame_size - 8);
+
+  gst_quiclib_transport_context_lock (conn);
+
+  if (conn->probe.buf == NULL) {
+    payload = g_malloc0 (size);
+    memcpy (payload, QUICLIB_PROBE_MAGIC, sizeof (QUICLIB_PROBE_MAGIC));
+    conn->probe.buf = gst_buffer_new_wrapped (payload, size);
+  }
+
+  conn->probe.sample_start = quiclib_ngtcp2_timestamp ();
+  conn->probe.end = conn->probe.sample_start +
+      (ngtcp2_tstamp) priv->probe_duration * NGTCP2_MILLISECONDS;
+  conn->probe.acked = 0;
+  conn->probe.max_rate = 0;
+  conn->probe.sent = 0;
+  conn->probe.done = FALSE;
+
+  GST_INFO_OBJECT (GST_QUICLIB_TRANSPORT_CONTEXT (conn),
+      "Probing the path capacity for %u ms", priv->probe_duration);
+
+  source = g_timeout_source_new (QUICLIB_PROBE_INTERVAL_MS);
+  g_source_set_callback (source, quiclib_probe_tick, g_object_ref (conn),
+      g_object_unref);
+  g_source_attach (source, priv->loop_context);
+  g_source_unref (source);
+
+  gst_quiclib_transport_context_unlock (conn);
+}
+
+gboolean
+gst_quiclib_transport_get_probe_result (GstQuicLibTransportConnection *conn,
+    guint64 *bitrate)
+{
+  gboolean done;
+
+  g_return_val_if_fail (bitrate != NULL, FALSE);
+
+  if (conn == NULL) {
+    return FALSE;
+  }
+
+  gst_quiclib_transport_context_lock (conn);
+  done = conn->probe.done;
+  *bitrate = conn->probe.result;
+  gst_quiclib_transport_context_unlock (conn);
+
+  return done;
+}
@@ -266,13 +266,50 @@ gst_quiclib_transport_server_new (GstQuicLibTransportUser *user,
 gboolean
 gst_quiclib_transport_server_listen (GstQuicLibServerContext *server);
 
+/**
+ * GstQuicLibCidGenerator
+ *
+ * Fills @cid with a new connection ID of @cidlen octets, returning FALSE on
+ * failure. See gstquiclb.h for a generator that load balancers can route on.
+ */
+typedef gboolean (*GstQuicLibCidGenerator) (guint8 *cid, gsize cidlen,
+    gpointer user_data);
+
+void
+gst_quiclib_transport_set_cid_generator (GstQuicLibTransportContext *ctx,
+    GstQuicLibCidGenerator generator, gsize cidlen, gpointer user_data,
+    GDestroyNotify destroy);
+
 GstQuicLibTransportConnection *
 gst_quiclib_transport_client_new (GstQuicLibTransportUser *user,
     gpointer app_ctx);
 
+gboolean
+gst_quiclib_transport_client_set_local_address (
+    GstQuicLibTransportConnection *conn, GInetSocketAddress *local);
+
+gboolean
+gst_quiclib_transport_client_set_stripe_id (
+    GstQuicLibTransportConnection *conn, guint64 stripe_id);
+
+guint64
+gst_quiclib_transport_get_stripe_id (GstQuicLibTransportConnection *conn);
+
+gboolean
+gst_quiclib_transport_client_set_stripe_redundant (
+    GstQuicLibTransportConnection *conn, gboolean redundant);
+
+gboolean
+gst_quiclib_transport_get_stripe_redundant (
+    GstQuicLibTransportConnection *conn);
+
 gboolean
 gst_quiclib_transport_client_connect (GstQuicLibTransportConnection *conn);
 
+gboolean
+gst_quiclib_transport_client_migrate (GstQuicLibTransportConnection *conn,
+    GInetSocketAddress *local);
+
 typedef enum _GstQUICMode GstQUICMode;
 GstQUICMode
 gst_quiclib_transport_get_mode (GstQuicLibTransportContext *ctx);
@@ -330,6 +367,55 @@ GstQuicLibStreamState
 gst_quiclib_transport_stream_state (GstQuicLibTransportConnection *conn,
     guint64 stream_id);
 
+gboolean
+gst_quiclib_transport_stream_set_dscp (GstQuicLibTransportConnection *conn,
+    guint64 stream_id, gint dscp);
+
+gboolean
+gst_quiclib_transport_stream_set_rate_limit (
+    GstQuicLibTransportConnection *conn, guint64 stream_id, guint64 rate,
+    guint64 burst);
+
+gboolean
+gst_quiclib_transport_connection_set_egress_weight (
+    GstQuicLibTransportConnection *conn, guint weight);
+
+/**
+ * GstQuicLibAdmissionStats
+ * @overloaded: Whether the server is currently turning new connections away.
+ * @load: The utilisation of the server's transport thread at the last sample,
+ *      in percent.
+ * @handshakes: The number of connections still handshaking at the last
+ *      sample.
+ * @memory: The resident memory of the process at the last sample, in bytes.
+ *      Only sampled when the admission-max-memory property is set.
+ * @pinned: The bytes pinned by all of the server's connections at the last
+ *      sample. Only sampled when the server-memory-limit property is set.
+ * @memory_limited: Whether the server's connections are being held back for
+ *      being over the server-memory-limit property.
+ * @accepted: Total number of new connections admitted.
+ * @refused: Total number of new connections closed with CONNECTION_REFUSED, or
+ *      INVALID_TOKEN for a bad Retry token.
+ * @retried: Total number of Retry packets sent to new connections.
+ * @shed: Total number of idle connections closed to shed load.
+ */
+typedef struct {
+    gboolean overloaded;
+    guint load;
+    guint handshakes;
+    guint64 memory;
+    guint64 pinned;
+    gboolean memory_limited;
+    guint64 accepted;
+    guint64 refused;
+    guint64 retried;
+    guint64 shed;
+} GstQuicLibAdmissionStats;
+
+gboolean
+gst_quiclib_transport_get_admission_stats (GstQuicLibTransportContext *ctx,
+    GstQuicLibAdmissionStats *stats);
+
 gboolean
 gst_quiclib_transport_close_stream (GstQuicLibTransportConnection *conn,
     guint64 stream_id, guint64 error_code);
@@ -349,11 +435,79 @@ GstQuicLibError
 gst_quiclib_transport_send_datagram (GstQuicLibTransportConnection *conn,
     GstBuffer *buf, GstQuicLibDatagramTicket *ticket, ssize_t *bytes_written);
 
+/**
+ * GstQuicLibFanoutTarget
+ * @conn: The connection to send the buffer on.
+ * @stream_id: The stream on @conn to send the buffer on, or -1 to send it as a
+ *      DATAGRAM frame.
+ * @may_block: If TRUE, wait for congestion and flow control window on @conn as
+ *      gst_quiclib_transport_send_stream does. If FALSE, nothing is sent to
+ *      @conn if it hasn't the window for the whole buffer, and @error is set
+ *      to GST_QUICLIB_ERR_CONN_DATA_BLOCKED.
+ * @error: Returns the result of sending the buffer on @conn.
+ * @bytes_written: Returns the number of bytes of the buffer sent on @conn.
+ */
+typedef struct {
+    GstQuicLibTransportConnection *conn;
+    gint64 stream_id;
+    gboolean may_block;
+    GstQuicLibError error;
+    ssize_t bytes_written;
+} GstQuicLibFanoutTarget;
+
+guint
+gst_quiclib_transport_send_fanout (GstBuffer *buf,
+    GstQuicLibFanoutTarget *targets, guint n_targets);
+
+gboolean
+gst_quiclib_transport_relay_add (GstQuicLibTransportConnection *upstream,
+    GstQuicLibTransportConnection *downstream, gint64 stream_id,
+    gboolean datagrams, gsize max_queued);
+
+void
+gst_quiclib_transport_relay_remove (GstQuicLibTransportConnection *upstream,
+    GstQuicLibTransportConnection *downstream);
+
 #define GST_QUICLIB_VARINT_MAX 4611686018427387903
 /*
  * TODO: Move the varint set/get functions here
  */
 
+#define GST_QUICLIB_LATENCY_HISTOGRAM_BUCKETS 16
+
+/**
+ * GstQuicLibEcnValidation
+ * @GST_QUICLIB_ECN_VALIDATION_NONE: No ECT-marked packets have been sent.
+ * @GST_QUICLIB_ECN_VALIDATION_TESTING: The first ECT-marked packets have been
+ *      sent, and the transport is waiting for the peer's ECN counts.
+ * @GST_QUICLIB_ECN_VALIDATION_CAPABLE: The path was validated as ECN capable,
+ *      and all packets are being sent ECT-marked.
+ * @GST_QUICLIB_ECN_VALIDATION_FAILED: Validation failed, for example because
+ *      the path bleaches the ECN bits, and packets are sent unmarked.
+ */
+typedef enum {
+    GST_QUICLIB_ECN_VALIDATION_NONE,
+    GST_QUICLIB_ECN_VALIDATION_TESTING,
+    GST_QUICLIB_ECN_VALIDATION_CAPABLE,
+    GST_QUICLIB_ECN_VALIDATION_FAILED
+} GstQuicLibEcnValidation;
+
+/**
+ * GstQuicLibLatencyHistogram
+ * @buckets: Sample counts in power-of-two microsecond buckets. Bucket 0 counts
+ *      samples below 1us, bucket n counts samples in [2^(n-1), 2^n) us, and the
+ *      last bucket also counts every sample larger than that.
+ * @count: The total number of samples.
+ * @sum: The sum of all samples in nanoseconds, for calculating the mean.
+ * @max: The largest sample seen, in nanoseconds.
+ */
+typedef struct {
+    guint64 buckets[GST_QUICLIB_LATENCY_HISTOGRAM_BUCKETS];
+    guint64 count;
+    guint64 sum;
+    guint64 max;
+} GstQuicLibLatencyHistogram;
+
 /**
  * GstQuicLibConnStats
  * @quic_implementation: A string indicating the underlying QUIC implementation
@@ -376,6 +530,64 @@ gst_quiclib_transport_send_datagram (GstQuicLibTransportConnection *conn,
  *          connection.
  *      @rtx: Total number of packets that needed to be retransmitted by this
  *          endpoint in this connection.
+ * @rx_delivery: Time from a packet arriving at the socket (the kernel receive
+ *      timestamp where available) to its stream or datagram data being handed
+ *      to the transport user.
+ * @rx_queueing: Time from a packet arriving at the socket to the transport
+ *      thread handing it to ngtcp2. Only counted for packets with a kernel
+ *      receive timestamp.
+ * @shaping: Token bucket shaping of the data sent by this endpoint.
+ *      @delay: Time that buffers of stream data were held back by the
+ *          connection's or their stream's rate limit before being sent.
+ *          Buffers sent straight away aren't counted.
+ *      @queued_bytes: Bytes of stream data currently held back.
+ * @mem: Memory that ngtcp2 has allocated for this connection, from the
+ *      connection's own pool.
+ *      @held: Bytes of the allocations that ngtcp2 currently holds.
+ *      @cached: Bytes of freed blocks that the pool keeps for reuse.
+ * @alloc: The library's own small per-connection objects, such as copies of
+ *      connection IDs and packet statistics, which come from slab caches.
+ *      @objects: Total number of objects handed out by the caches.
+ *      @refills: Number of times a cache had to allocate more memory. Once a
+ *          connection is in a steady state this should stop rising.
+ *      @in_use: Number of objects currently handed out.
+ * @pinned: Memory that the connection pins, in bytes, as counted against the
+ *      conn-memory-limit and server-memory-limit properties. TLS state isn't
+ *      counted.
+ *      @retained: Stream data sent but not yet acknowledged.
+ *      @datagrams: Datagrams kept until they are acknowledged.
+ *      @shaped: Stream data held back by rate limits.
+ *      @received: Received data that the application still holds, such as
+ *          buffers waiting in quicsrc.
+ *      @quic: ngtcp2's allocations, including the blocks its pool keeps.
+ *      @total: The sum of the above.
+ *      @limited: Number of times sending stream data was held back for being
+ *          over a memory limit.
+ *      @shed: Number of datagrams dropped for being over a memory limit.
+ * @ecn: Explicit Congestion Notification state for the connection.
+ *      @validation: The GstQuicLibEcnValidation state of the path. ngtcp2
+ *          doesn't expose this directly, so it is inferred from the marks it
+ *          asks for on outgoing packets.
+ *      @tx_ect0: Number of packets sent marked ECT(0).
+ *      @tx_ect1: Number of packets sent marked ECT(1).
+ *      @rx_ect0: Number of packets received marked ECT(0).
+ *      @rx_ect1: Number of packets received marked ECT(1).
+ *      @rx_ce: Number of packets received marked Congestion Experienced.
+ * @io: Packet I/O counters for the socket this connection uses. On a server
+ *      these are shared by all connections on the same listening socket.
+ *      @backend: The GstQuicLibIOBackend actually in use, after any fallback.
+ *      @rx_packets: Total number of UDP datagrams read from the socket.
+ *      @tx_packets: Total number of UDP datagrams written to the socket.
+ *      @rx_cpu_ns: CPU time the transport thread has spent handling socket
+ *          wakeups, including QUIC processing and any packets sent in reply.
+ *          Divide by @rx_packets for an approximate per-packet cost. Only
+ *          counted when statistics are enabled.
+ *      @zerocopy_sent: Number of sends made with MSG_ZEROCOPY.
+ *      @zerocopy_copied: Number of MSG_ZEROCOPY sends that the kernel
+ *          completed by copying the data anyway.
+ *      @zerocopy_fallback: Number of sends over the zero-copy threshold that
+ *          the kernel refused with MSG_ZEROCOPY, and were sent with a normal
+ *          copy instead.
  */
 typedef struct {
     const gchar *quic_implementation;
@@ -400,12 +612,160 @@ typedef struct {
         guint64 received;
         guint64 rtx;
     } pkt_counts;
+
+    GstQuicLibLatencyHistogram rx_delivery;
+    GstQuicLibLatencyHistogram rx_queueing;
+
+    struct {
+        GstQuicLibLatencyHistogram delay;
+        guint64 queued_bytes;
+    } shaping;
+
+    struct {
+        guint64 held;
+        guint64 cached;
+    } mem;
+
+    struct {
+        guint64 objects;
+        guint64 refills;
+        guint64 in_use;
+    } alloc;
+
+    struct {
+        guint64 retained;
+        guint64 datagrams;
+        guint64 shaped;
+        guint64 received;
+        guint64 quic;
+        guint64 total;
+        guint64 limited;
+        guint64 shed;
+    } pinned;
+
+    struct {
+        GstQuicLibEcnValidation validation;
+        guint64 tx_ect0;
+        guint64 tx_ect1;
+        guint64 rx_ect0;
+        guint64 rx_ect1;
+        guint64 rx_ce;
+    } ecn;
+
+    struct {
+        gint backend;
+        guint64 rx_packets;
+        guint64 tx_packets;
+        guint64 rx_cpu_ns;
+        guint64 zerocopy_sent;
+        guint64 zerocopy_copied;
+        guint64 zerocopy_fallback;
+    } io;
 } GstQuicLibConnStats;
 
 gboolean
 gst_quiclib_transport_get_conn_stats (GstQuicLibTransportConnection *conn,
     GstQuicLibConnStats *conn_stats);
 
+/**
+ * gst_quiclib_transport_get_striped_conn_stats
+ * @conns: Array of the connections in a stripe.
+ * @n_conns: Number of connections in @conns.
+ * @conn_stats: Statistics to fill in.
+ *
+ * Fill in @conn_stats for a set of striped connections as if they were one.
+ * Counters, rates, congestion windows and bytes in flight are summed. The
+ * minimum RTT is the lowest of the set, and the smoothed RTT and its mean
+ * deviation are the highest, as the slowest connection bounds the delivery
+ * of the whole flow. The latency histograms are merged.
+ *
+ * Returns: TRUE if at least one connection's statistics could be read.
+ */
+gboolean
+gst_quiclib_transport_get_striped_conn_stats (
+    GstQuicLibTransportConnection **conns, guint n_conns,
+    GstQuicLibConnStats *conn_stats);
+
+/**
+ * gst_quiclib_transport_get_path_load
+ * @conn: Connection to read.
+ * @smoothed_rtt: (out) (optional): Smoothed RTT in nanoseconds.
+ * @cwnd: (out) (optional): Congestion window in bytes.
+ * @bytes_in_flight: (out) (optional): Bytes sent but not yet acknowledged.
+ *
+ * Read just the congestion state of @conn, for schedulers that have to decide
+ * between connections on every packet without the cost of
+ * gst_quiclib_transport_get_conn_stats.
+ *
+ * Returns: FALSE if @conn has no QUIC connection yet.
+ */
+gboolean
+gst_quiclib_transport_get_path_load (GstQuicLibTransportConnection *conn,
+    guint64 *smoothed_rtt, guint64 *cwnd, guint64 *bytes_in_flight);
+
+/**
+ * gst_quiclib_transport_get_bitrate_estimate
+ * @conn: Connection to estimate the available capacity of.
+ *
+ * Estimate the rate that @conn can currently carry without building a queue.
+ * This is the lower of what the congestion window allows over the smoothed
+ * RTT and the smoothed rate at which data has been acknowledged, backed off
+ * while the smoothed RTT is inflated above the minimum RTT, and further still
+ * while that queueing delay is growing. While the sender isn't filling the
+ * congestion window, the estimate is allowed to run a little ahead of the
+ * delivery rate so that a sender tracking it can ramp up.
+ *
+ * Each call takes a new delivery rate sample once at least a smoothed RTT
+ * has passed since the last one, so it should be called periodically.
+ *
+ * Returns: The estimate in bits/second, or 0 if there isn't one.
+ */
+guint64
+gst_quiclib_transport_get_bitrate_estimate (
+    GstQuicLibTransportConnection *conn);
+
+/**
+ * gst_quiclib_transport_get_latency
+ * @conn: Connection to get the latency of.
+ * @smoothed: (out) (optional): Smoothed one-way transport latency, in
+ *      nanoseconds.
+ * @worst_case: (out) (optional): Worst-case one-way transport latency, in
+ *      nanoseconds.
+ *
+ * The one-way latency is taken to be half the smoothed RTT, plus the smoothed
+ * time between packets arriving at the socket and their data being handed to
+ * the transport user. The worst case adds four mean deviations to each of
+ * these. The receive side is only measured when packets have an arrival time,
+ * which is either a kernel receive timestamp or statistics being enabled.
+ *
+ * Data waiting to be sent isn't included, as it depends on how the user
+ * feeds the connection. Users that queue data should add their own delay.
+ *
+ * Returns: FALSE if @conn isn't connected.
+ */
+gboolean
+gst_quiclib_transport_get_latency (GstQuicLibTransportConnection *conn,
+    guint64 *smoothed, guint64 *worst_case);
+
+/**
+ * gst_quiclib_transport_get_probe_result
+ * @conn: Connection that was probed.
+ * @bitrate: (out): The capacity found by probing, in bits/second.
+ *
+ * Get the outcome of probing the path capacity after the handshake, as set up
+ * by the probe-duration property. For that long, the spare congestion window
+ * is filled with probe DATAGRAM frames that the peer discards. The capacity
+ * is the highest rate at which data was acknowledged over an RTT of the
+ * probe, capped by what the congestion window allows when it ends. That also
+ * seeds gst_quiclib_transport_get_bitrate_estimate.
+ *
+ * Returns: TRUE once probing has finished, FALSE while it is under way or if
+ *      @conn wasn't probed.
+ */
+gboolean
+gst_quiclib_transport_get_probe_result (GstQuicLibTransportConnection *conn,
+    guint64 *bitrate);
+
 G_END_DECLS
 
 #endif /* __GSTLIB_QUICTRANSPORT_H__ */
@@ -0,0 +1,214 @@
+/*
+ * Copyright 2024 British Broadcasting Corporation - Research and Development
+ *
+ * Author: Sam Hurst <sam.hurst@bbc.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * QUIC-LB connection IDs checked against the test vectors from the draft
+ * (draft-ietf-quic-load-balancers, Appendix B), covering the plaintext,
+ * single-pass and four-pass formats, and decoded back to the server ID as a
+ * load balancer would.
+ */
+
+#include "gstquiclb.h"
+#include "gstquictransport.h"
+
+#include <string.h>
+
+#define QUIC_LB_TEST_KEY "8f95f09245765f80256934e50c66207f"
+
+typedef struct {
+  guint8 config_id;
+  const gchar *server_id;
+  const gchar *nonce;
+  const gchar *key;
+  const gchar *cid;
+} QuicLbVector;
+
+static const QuicLbVector plaintext_vectors[] = {
+  { 0, "c4605e", "4504cc4f", NULL, "07c4605e4504cc4f" },
+};
+
+/* Server ID and nonce together make exactly one AES block */
+static const QuicLbVector single_pass_vectors[] = {
+  { 2, "ed793a51d49b8f5f", "ee080dbf48c0d1e5", QUIC_LB_TEST_KEY,
+    "504dd2d05a7b0de9b2b9907afb5ecf8cc3" },
+};
+
+/* Odd and even plaintext lengths other than a block */
+static const QuicLbVector four_pass_vectors[] = {
+  { 0, "ed793a", "ee080dbf", QUIC_LB_TEST_KEY, "0720b1d07b359d3c" },
+  { 1, "ed793a51d49b8f5fab65", "ee080dbf48", QUIC_LB_TEST_KEY,
+    "2fcc381bc74cb4fbad2823a3d1f8fed2" },
+  { 0, "ed793a51d49b8f5fab", "ee080dbf48c0d1e55d", QUIC_LB_TEST_KEY,
+    "125779c9cc86beb3a3a4a3ca96fce4bfe0cdbc" },
+};
+
+static gsize
+parse_hex (const gchar *hex, guint8 *out)
+{
+  gsize len = strlen (hex) / 2, i;
+
+  for (i = 0; i < len; i++) {
+    out[i] = (guint8) ((g_ascii_xdigit_value (hex[2 * i]) << 4) |
+        g_ascii_xdigit_value (hex[2 * i + 1]));
+  }
+
+  return len;
+}
+
+/*
+ * Encodes the vector's nonce and compares the CID with the expected one, then
+ * decodes both that and a CID with a random nonce back to the server ID. The
+ * random one is made through a GstQuicLibCidGenerator, as the transport's
+ * quiclib_generate_cid_for does when the server has a QUIC-LB configuration.
+ */
+static void
+run_vector (const QuicLbVector *vector)
+{
+  guint8 server_id[GST_QUICLIB_QUIC_LB_MAX_CID_LEN];
+  guint8 nonce[GST_QUICLIB_QUIC_LB_MAX_CID_LEN];
+  guint8 key[GST_QUICLIB_QUIC_LB_KEY_LEN];
+  guint8 expected[GST_QUICLIB_QUIC_LB_MAX_CID_LEN];
+  guint8 cid[GST_QUICLIB_QUIC_LB_MAX_CID_LEN];
+  guint8 decoded[GST_QUICLIB_QUIC_LB_MAX_CID_LEN];
+  gsize server_id_len, nonce_len, cidlen;
+  GstQuicLibQuicLbConfig *config;
+  GstQuicLibCidGenerator generator = gst_quiclib_quic_lb_generate_cid;
+
+  server_id_len = parse_hex (vector->server_id, server_id);
+  nonce_len = parse_hex (vector->nonce, nonce);
+  cidlen = parse_hex (vector->cid, expected);
+  if (vector->key != NULL) {
+    parse_hex (vector->key, key);
+  }
+
+  config = gst_quiclib_quic_lb_config_new (vector->config_id, server_id,
+      server_id_len, nonce_len, vector->key != NULL ? key : NULL);
+  g_assert_nonnull (config);
+  g_assert_cmpuint (gst_quiclib_quic_lb_config_get_cid_len (config), ==,
+      cidlen);
+
+  g_assert_true (gst_quiclib_quic_lb_encode_cid (config, nonce, cid, cidlen));
+  g_assert_cmpmem (cid, cidlen, expected, cidlen);
+
+  g_assert_true (gst_quiclib_quic_lb_decode_server_id (config, cid, cidlen,
+      decoded));
+  g_assert_cmpmem (decoded, server_id_len, server_id, server_id_len);
+
+  memset (decoded, 0, sizeof (decoded));
+  g_assert_false (generator (cid, cidlen - 1, config));
+  g_assert_true (generator (cid, cidlen, config));
+  g_assert_cmpuint (cid[0], ==, expected[0]);
+  g_assert_true (gst_quiclib_quic_lb_decode_server_id (config, cid, cidlen,
+      decoded));
+  g_assert_cmpmem (decoded, server_id_len, server_id, server_id_len);
+
+  gst_quiclib_quic_lb_config_free (config);
+}
+
+static void
+test_plaintext (void)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (plaintext_vectors); i++) {
+    run_vector (&plaintext_vectors[i]);
+  }
+}
+
+static void
+test_single_pass (void)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (single_pass_vectors); i++) {
+    run_vector (&single_pass_vectors[i]);
+  }
+}
+
+static void
+test_four_pass (void)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (four_pass_vectors); i++) {
+    run_vector (&four_pass_vectors[i]);
+  }
+}
+
+static void
+test_wrong_config (void)
+{
+  const QuicLbVector *vector = &four_pass_vectors[0];
+  guint8 server_id[GST_QUICLIB_QUIC_LB_MAX_CID_LEN];
+  guint8 cid[GST_QUICLIB_QUIC_LB_MAX_CID_LEN];
+  guint8 key[GST_QUICLIB_QUIC_LB_KEY_LEN];
+  guint8 decoded[GST_QUICLIB_QUIC_LB_MAX_CID_LEN];
+  gsize server_id_len, cidlen;
+  GstQuicLibQuicLbConfig *config;
+
+  server_id_len = parse_hex (vector->server_id, server_id);
+  cidlen = parse_hex (vector->cid, cid);
+  parse_hex (vector->key, key);
+
+  /* A CID from another config rotation isn't decoded */
+  config = gst_quiclib_quic_lb_config_new (vector->config_id + 1, server_id,
+      server_id_len, strlen (vector->nonce) / 2, key);
+  g_assert_nonnull (config);
+  g_assert_false (gst_quiclib_quic_lb_decode_server_id (config, cid, cidlen,
+      decoded));
+  gst_quiclib_quic_lb_config_free (config);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/quiclb/plaintext", test_plaintext);
+  g_test_add_func ("/quiclb/single-pass", test_single_pass);
+  g_test_add_func ("/quiclb/four-pass", test_four_pass);
+  g_test_add_func ("/quiclb/wrong-config", test_wrong_config);
+
+  return g_test_run ();
+}
@@ -0,0 +1,216 @@
+/*
+ * Copyright 2024 British Broadcasting Corporation - Research and Development
+ *
+ * Author: Sam Hurst <sam.hurst@bbc.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Redundant datagrams across a stripe, with loss on one path recovered by the
+ * other. Each path is simulated as a list of the sequence numbers it delivers,
+ * in arrival order, and the receiver keeps the first copy of each through a
+ * GstQuicLibRedundantWindow as quicsrc does.
+ */
+
+#include "gstquiccommon.h"
+
+#define N_DATAGRAMS 1000
+
+typedef gboolean (*PathLoss) (guint64 seq);
+
+static gboolean
+lose_none (guint64 seq)
+{
+  return FALSE;
+}
+
+static gboolean
+lose_every_third (guint64 seq)
+{
+  return seq % 3 == 0;
+}
+
+static gboolean
+lose_every_fifth (guint64 seq)
+{
+  return seq % 5 == 0;
+}
+
+static gboolean
+lose_after_half (guint64 seq)
+{
+  return seq > N_DATAGRAMS / 2;
+}
+
+static gboolean
+lose_all (guint64 seq)
+{
+  return TRUE;
+}
+
+/*
+ * Frames each datagram as quicsink does, then reads the sequence number back
+ * out of the header as quicsrc does.
+ */
+static guint64
+frame_and_parse (guint64 seq)
+{
+  guint8 header[QUICLIB_REDUNDANT_HEADER_LEN];
+
+  GST_WRITE_UINT64_BE (header, seq);
+
+  return GST_READ_UINT64_BE (header);
+}
+
+/*
+ * Sends N_DATAGRAMS on two paths, each losing the datagrams its loss function
+ * picks. The second path runs @delay datagrams behind the first, so copies
+ * from the two are interleaved out of order. Checks that every datagram that
+ * survived on either path is passed on exactly once.
+ */
+static void
+run_stripe (PathLoss loss_a, PathLoss loss_b, guint delay)
+{
+  GstQuicLibRedundantWindow window = { 0, 0 };
+  guint8 *delivered = g_new0 (guint8, N_DATAGRAMS + 1);
+  guint64 seq, dropped = 0;
+  guint i;
+
+  for (i = 1; i <= N_DATAGRAMS + delay; i++) {
+    guint64 arrivals[2];
+    guint n = 0, j;
+
+    if (i <= N_DATAGRAMS && !loss_a (i)) {
+      arrivals[n++] = i;
+    }
+    if (i > delay && !loss_b (i - delay)) {
+      arrivals[n++] = i - delay;
+    }
+
+    for (j = 0; j < n; j++) {
+      seq = frame_and_parse (arrivals[j]);
+      if (gst_quiclib_redundant_window_is_new (&window, seq)) {
+        delivered[seq]++;
+      } else {
+        dropped++;
+      }
+    }
+  }
+
+  for (seq = 1; seq <= N_DATAGRAMS; seq++) {
+    if (loss_a (seq) && loss_b (seq)) {
+      g_assert_cmpuint (delivered[seq], ==, 0);
+    } else {
+      g_assert_cmpuint (delivered[seq], ==, 1);
+    }
+    if (!loss_a (seq) && !loss_b (seq)) {
+      dropped--;
+    }
+  }
+
+  /* Only the second copies were dropped */
+  g_assert_cmpuint (dropped, ==, 0);
+
+  g_free (delivered);
+}
+
+static void
+test_no_loss (void)
+{
+  run_stripe (lose_none, lose_none, 0);
+  run_stripe (lose_none, lose_none, 7);
+}
+
+static void
+test_loss_on_one_path (void)
+{
+  run_stripe (lose_every_third, lose_none, 0);
+  run_stripe (lose_none, lose_every_third, 5);
+  run_stripe (lose_every_third, lose_none, 5);
+}
+
+static void
+test_loss_on_both_paths (void)
+{
+  run_stripe (lose_every_third, lose_every_fifth, 3);
+}
+
+static void
+test_path_failure (void)
+{
+  run_stripe (lose_after_half, lose_none, 2);
+  run_stripe (lose_all, lose_none, 0);
+}
+
+static void
+test_window (void)
+{
+  GstQuicLibRedundantWindow window = { 0, 0 };
+
+  g_assert_true (gst_quiclib_redundant_window_is_new (&window, 1));
+  g_assert_false (gst_quiclib_redundant_window_is_new (&window, 1));
+
+  /* Still inside the window, so a late first copy gets through */
+  g_assert_true (gst_quiclib_redundant_window_is_new (&window,
+      QUICLIB_REDUNDANT_WINDOW));
+  g_assert_false (gst_quiclib_redundant_window_is_new (&window, 1));
+
+  /* Too far behind the newest to tell, so treated as a duplicate */
+  g_assert_true (gst_quiclib_redundant_window_is_new (&window,
+      QUICLIB_REDUNDANT_WINDOW * 3));
+  g_assert_false (gst_quiclib_redundant_window_is_new (&window,
+      QUICLIB_REDUNDANT_WINDOW * 2));
+  g_assert_true (gst_quiclib_redundant_window_is_new (&window,
+      QUICLIB_REDUNDANT_WINDOW * 3 - 1));
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/redundant/no-loss", test_no_loss);
+  g_test_add_func ("/redundant/loss-on-one-path", test_loss_on_one_path);
+  g_test_add_func ("/redundant/loss-on-both-paths", test_loss_on_both_paths);
+  g_test_add_func ("/redundant/path-failure", test_path_failure);
+  g_test_add_func ("/redundant/window", test_window);
+
+  return g_test_run ();
+}